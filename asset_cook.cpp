@@ -0,0 +1,688 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include "content_hash.h"
+#include "cook_cache.h"
+#include "job_system.h"
+#include "mesh_file.h"
+#include "mesh_simplify.h"
+#include "pack_file.h"
+#include "sampling_profiler.h"
+#include "texture_compress.h"
+#include "texture_file.h"
+#include "texture_mips.h"
+
+// -----------------------------------------------------------------------------
+// Offline asset pipeline. Walks a source tree, picks a cooker by extension
+// and writes each cooked asset to the same relative path under the output
+// directory, with the cooker's extension. Cooks go through a CookCache, so
+// a warm run only stats its sources; assets are cooked in parallel, one per
+// job. --pack also stores every cooked asset in one compressed pack.
+//
+//   AssetCook [options] [--pack file] <source dir> <output dir>
+//   AssetCook [options] --bench <assets> <work dir>
+//
+// Cookers:
+//   .obj, .mesh   LOD chain from the mesh simplifier, as a .mesh file
+//   .hlsl         source without comments or blank lines, as the runtime
+//                 compiles shaders itself
+//   .tga          full mip chain, Kaiser filtered unless --mip-filter box,
+//                 block compressed to --texture-format (bc7 unless given)
+//                 with the --texture-quality preset, as a .tex file
+//
+// --bench generates that many meshes, shaders and textures under
+// <work dir>/source and times a cold cook, a warm one, one after touching
+// 5% of the sources without changing them and one after editing another
+// 5%. --sample-profile
+// samples every thread's stacks (SIGPROF, --sample-hz, default 997) into
+// <prefix>.folded and a <prefix>.svg flamegraph.
+namespace fs = std::filesystem;
+
+namespace {
+
+class MeshCooker : public Cooker {
+ public:
+    MeshCooker(std::vector<float> ratios, const SimplifyOptions& options)
+        : ratios_(std::move(ratios)), options_(options) {
+    }
+
+    const char* name() const override { return "mesh"; }
+    uint32_t version() const override { return 1; }
+    const char* extension() const override { return ".mesh"; }
+
+    std::string settings() const override {
+        char text[64];
+        std::string s;
+        for (float ratio : ratios_) {
+            snprintf(text, sizeof(text), "%.9g,", ratio);
+            s += text;
+        }
+        snprintf(text, sizeof(text), " %.9g %.9g %d", options_.attributeWeight,
+                 options_.borderWeight, options_.lockBorders ? 1 : 0);
+        return s + text;
+    }
+
+    // .mesh sources are recognized by their magic and simplified again from
+    // their first level
+    bool cook(const std::vector<uint8_t>& source,
+              std::vector<uint8_t>& output) const override {
+        std::vector<MeshVertex> triangles;
+        uint32_t magic = 0;
+        if (source.size() >= sizeof(magic)) {
+            memcpy(&magic, source.data(), sizeof(magic));
+        }
+        if (magic == kMeshFileMagic) {
+            std::vector<MeshVertex> vertices;
+            LodMesh lods;
+            if (!decodeMeshFile(source.data(), source.size(), vertices,
+                                lods)) {
+                return false;
+            }
+            const LodLevel& full = lods.levels[0];
+            triangles.assign(
+                vertices.begin() + full.firstVertex,
+                vertices.begin() + full.firstVertex + full.vertexCount);
+        } else if (!parseObj(reinterpret_cast<const char*>(source.data()),
+                             source.size(), triangles)) {
+            return false;
+        }
+        if (triangles.empty()) return false;
+
+        std::vector<MeshVertex> vertices;
+        LodMesh lods;
+        buildLodChain(triangles.data(),
+                      static_cast<uint32_t>(triangles.size()), ratios_.data(),
+                      static_cast<uint32_t>(ratios_.size()), options_,
+                      vertices, lods);
+        encodeMeshFile(vertices, lods, output);
+        return true;
+    }
+
+ private:
+    std::vector<float> ratios_;
+    SimplifyOptions options_;
+};
+
+class ShaderCooker : public Cooker {
+ public:
+    const char* name() const override { return "shader"; }
+    uint32_t version() const override { return 1; }
+    const char* extension() const override { return ".hlsl"; }
+    std::string settings() const override { return ""; }
+
+    // Drops comments, trailing spaces and blank lines; line structure is
+    // kept for the preprocessor
+    bool cook(const std::vector<uint8_t>& source,
+              std::vector<uint8_t>& output) const override {
+        output.reserve(source.size());
+        size_t lineStart = output.size();
+        bool block = false;
+        for (size_t i = 0; i < source.size(); ++i) {
+            char c = static_cast<char>(source[i]);
+            char next = i + 1 < source.size()
+                ? static_cast<char>(source[i + 1]) : '\0';
+            if (block) {
+                if (c == '*' && next == '/') {
+                    block = false;
+                    ++i;
+                }
+                if (c != '\n') continue;
+            } else if (c == '/' && next == '/') {
+                while (i + 1 < source.size() && source[i + 1] != '\n') ++i;
+                continue;
+            } else if (c == '/' && next == '*') {
+                block = true;
+                ++i;
+                continue;
+            }
+
+            if (c == '\r') continue;
+            if (c != '\n') {
+                output.push_back(static_cast<uint8_t>(c));
+                continue;
+            }
+            while (output.size() > lineStart &&
+                   (output.back() == ' ' || output.back() == '\t')) {
+                output.pop_back();
+            }
+            if (output.size() > lineStart) output.push_back('\n');
+            lineStart = output.size();
+        }
+        while (output.size() > lineStart &&
+               (output.back() == ' ' || output.back() == '\t')) {
+            output.pop_back();
+        }
+        return true;
+    }
+};
+
+class TextureCooker : public Cooker {
+ public:
+    TextureCooker(MipFilter filter, TextureFormat format, BcQuality quality)
+        : filter_(filter), format_(format), quality_(quality) {
+    }
+
+    const char* name() const override { return "texture"; }
+    uint32_t version() const override { return 2; }
+    const char* extension() const override { return ".tex"; }
+
+    std::string settings() const override {
+        std::string settings =
+            filter_ == MipFilter::kKaiser ? "kaiser" : "box";
+        settings += ' ';
+        settings += textureFormatName(format_);
+        settings += ' ';
+        settings += bcQualityName(quality_);
+        return settings;
+    }
+
+    bool cook(const std::vector<uint8_t>& source,
+              std::vector<uint8_t>& output) const override {
+        Image image;
+        if (!decodeTga(source.data(), source.size(), image)) return false;
+        std::vector<Image> chain;
+        generateMips(image, filter_, chain);
+        // D3D only creates block compressed textures of whole blocks
+        TextureFormat format = format_;
+        if (image.width % 4 != 0 || image.height % 4 != 0) {
+            format = TextureFormat::kRgba8;
+        }
+        // The cook already runs one asset per job; the blocks of a large
+        // texture spread over the workers as well
+        std::vector<std::vector<uint8_t>> levels(chain.size());
+        for (size_t l = 0; l < chain.size(); ++l) {
+            compressImage(chain[l], format, quality_, levels[l]);
+        }
+        encodeTextureFile(format, image.width, image.height, levels, output);
+        return true;
+    }
+
+ private:
+    MipFilter filter_;
+    TextureFormat format_;
+    BcQuality quality_;
+};
+
+struct CookerEntry {
+    const char* sourceExtension;
+    const Cooker* cooker;
+};
+
+enum class Outcome { kFailed, kUpToDate, kCacheHit, kCooked };
+
+struct Asset {
+    std::string source;         // relative to the source directory
+    const Cooker* cooker = nullptr;
+    uint64_t config = 0;
+    Outcome outcome = Outcome::kFailed;
+    uint64_t bytesRead = 0;
+};
+
+struct CookStats {
+    uint32_t upToDate = 0;
+    uint32_t cacheHits = 0;
+    uint32_t cooked = 0;
+    uint32_t failed = 0;
+    uint64_t bytesRead = 0;
+    double ms = 0.0;
+};
+
+std::string outputPath(const std::string& outputDir, const Asset& asset) {
+    fs::path path = fs::path(outputDir) / asset.source;
+    path.replace_extension(asset.cooker->extension());
+    return path.string();
+}
+
+bool stampOf(const std::string& path, SourceStamp& stamp) {
+    std::error_code error;
+    stamp.size = fs::file_size(path, error);
+    if (error) return false;
+    stamp.modified = fs::last_write_time(path, error)
+        .time_since_epoch().count();
+    return !error;
+}
+
+Outcome cookAsset(CookCache& cache, const std::string& sourceDir,
+                  const std::string& outputDir, Asset& asset) {
+    std::string sourcePath = (fs::path(sourceDir) / asset.source).string();
+    std::string outPath = outputPath(outputDir, asset);
+    SourceStamp stamp;
+    if (!stampOf(sourcePath, stamp)) return Outcome::kFailed;
+
+    uint64_t key = 0;
+    std::error_code error;
+    if (cache.upToDate(asset.source, stamp, asset.config, key) &&
+        fs::is_regular_file(outPath, error)) {
+        return Outcome::kUpToDate;
+    }
+
+    std::vector<uint8_t> source;
+    if (!readFileBytes(sourcePath, source)) return Outcome::kFailed;
+    asset.bytesRead = source.size();
+    key = contentHash(source.data(), source.size(), asset.config);
+
+    Outcome outcome = Outcome::kCacheHit;
+    if (cache.contains(key)) {
+        fs::copy_file(cache.objectPath(key), outPath,
+                      fs::copy_options::overwrite_existing, error);
+        if (error) {
+            std::cerr << "Failed to write " << outPath << std::endl;
+            return Outcome::kFailed;
+        }
+    } else {
+        std::vector<uint8_t> output;
+        if (!asset.cooker->cook(source, output)) {
+            std::cerr << "Failed to cook " << sourcePath << std::endl;
+            return Outcome::kFailed;
+        }
+        if (!cache.store(key, output) ||
+            !writeFileBytes(outPath, output.data(), output.size())) {
+            return Outcome::kFailed;
+        }
+        outcome = Outcome::kCooked;
+    }
+    cache.record(asset.source, stamp, asset.config, key);
+    return outcome;
+}
+
+// Every source under `sourceDir` that some cooker accepts, in path order
+std::vector<Asset> findAssets(const std::string& sourceDir,
+                              const std::vector<CookerEntry>& cookers) {
+    std::vector<Asset> assets;
+    std::error_code error;
+    for (const fs::directory_entry& entry :
+         fs::recursive_directory_iterator(sourceDir, error)) {
+        if (!entry.is_regular_file()) continue;
+        std::string extension = entry.path().extension().string();
+        for (const CookerEntry& c : cookers) {
+            if (extension != c.sourceExtension) continue;
+            Asset asset;
+            asset.source =
+                fs::relative(entry.path(), sourceDir).generic_string();
+            asset.cooker = c.cooker;
+            asset.config = cookerConfig(*c.cooker);
+            assets.push_back(std::move(asset));
+            break;
+        }
+    }
+    if (error) std::cerr << "Failed to list " << sourceDir << std::endl;
+    std::sort(assets.begin(), assets.end(),
+              [](const Asset& a, const Asset& b) {
+                  return a.source < b.source;
+              });
+    return assets;
+}
+
+bool cookAll(const std::string& sourceDir, const std::string& outputDir,
+             const std::string& cacheDir,
+             const std::vector<CookerEntry>& cookers, CookStats& stats,
+             std::vector<Asset>* cooked = nullptr) {
+    auto start = std::chrono::steady_clock::now();
+    CookCache cache;
+    if (!cache.open(cacheDir)) return false;
+    std::vector<Asset> assets = findAssets(sourceDir, cookers);
+
+    // Output directories up front, so jobs never race to create them
+    std::vector<std::string> directories;
+    for (const Asset& asset : assets) {
+        directories.push_back(
+            fs::path(outputPath(outputDir, asset)).parent_path().string());
+    }
+    std::sort(directories.begin(), directories.end());
+    directories.erase(std::unique(directories.begin(), directories.end()),
+                      directories.end());
+    for (const std::string& directory : directories) {
+        std::error_code error;
+        fs::create_directories(directory, error);
+    }
+
+    jobSystem().parallelFor(
+        static_cast<uint32_t>(assets.size()), 1,
+        [&](uint32_t begin, uint32_t end) {
+            for (uint32_t a = begin; a < end; ++a) {
+                assets[a].outcome =
+                    cookAsset(cache, sourceDir, outputDir, assets[a]);
+            }
+        });
+    bool saved = cache.saveManifest();
+
+    stats = CookStats();
+    for (const Asset& asset : assets) {
+        stats.bytesRead += asset.bytesRead;
+        switch (asset.outcome) {
+        case Outcome::kFailed: ++stats.failed; break;
+        case Outcome::kUpToDate: ++stats.upToDate; break;
+        case Outcome::kCacheHit: ++stats.cacheHits; break;
+        case Outcome::kCooked: ++stats.cooked; break;
+        }
+    }
+    stats.ms = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+    if (cooked != nullptr) *cooked = std::move(assets);
+    return saved && stats.failed == 0;
+}
+
+// Every cooked asset, named by its path under the output directory
+bool writePack(const std::string& path, const std::string& outputDir,
+               const std::vector<Asset>& assets) {
+    PackWriter writer;
+    for (const Asset& asset : assets) {
+        if (asset.outcome == Outcome::kFailed) continue;
+        std::string output = outputPath(outputDir, asset);
+        std::vector<uint8_t> bytes;
+        if (!readFileBytes(output, bytes)) return false;
+        writer.add(fs::relative(output, outputDir).generic_string(),
+                   std::move(bytes));
+    }
+
+    PackWriteStats stats;
+    if (!writer.write(path, PackCodec::kLzHigh, kDefaultPackBlockSize,
+                      &stats)) {
+        return false;
+    }
+    std::cerr << "Pack: " << path << ", " << stats.rawBytes / 1048576.0
+              << " -> " << stats.packBytes / 1048576.0 << " MB in "
+              << stats.compressMs << " ms" << std::endl;
+    return true;
+}
+
+void printStats(const char* label, const CookStats& stats) {
+    std::cerr << label << stats.ms << " ms: " << stats.cooked << " cooked, "
+              << stats.cacheHits << " cache hits, " << stats.upToDate
+              << " up to date, " << stats.failed << " failed, "
+              << stats.bytesRead / 1048576.0 << " MB read" << std::endl;
+}
+
+// -----------------------------------------------------------------------------
+// Bench sources: small colored height fields, shaders padded with comments
+// like hand-written ones, and textures of smooth color bands with noise
+std::string benchMesh(std::mt19937& rng) {
+    std::uniform_int_distribution<int> sides(12, 48);
+    std::uniform_real_distribution<float> phase(0.0f, 6.28f);
+    int side = sides(rng);
+    float p = phase(rng);
+    float q = phase(rng);
+    std::string text;
+    char line[96];
+    for (int y = 0; y <= side; ++y) {
+        for (int x = 0; x <= side; ++x) {
+            float u = float(x) / side;
+            float v = float(y) / side;
+            float h = 0.1f * std::sin(u * 9.0f + p) * std::cos(v * 5.0f + q);
+            snprintf(line, sizeof(line), "v %.5f %.5f %.5f %.3f 0.5 %.3f\n",
+                     u, v, h, u, v);
+            text += line;
+        }
+    }
+    for (int y = 0; y < side; ++y) {
+        for (int x = 0; x < side; ++x) {
+            int a = y * (side + 1) + x + 1;
+            snprintf(line, sizeof(line), "f %d %d %d %d\n", a, a + 1,
+                     a + side + 2, a + side + 1);
+            text += line;
+        }
+    }
+    return text;
+}
+
+std::string benchShader(std::mt19937& rng, uint32_t index) {
+    std::uniform_int_distribution<int> terms(8, 48);
+    std::string text = "// Generated shader " + std::to_string(index) +
+                       "\n/* Block comment that the cook removes.\n */\n"
+                       "cbuffer Constants : register(b0) {\n"
+                       "    float4x4 world;   // object to world\n};\n\n"
+                       "float4 PSMain(float4 color : COLOR) : SV_TARGET {\n"
+                       "    float4 c = color;\n";
+    int count = terms(rng);
+    for (int t = 0; t < count; ++t) {
+        text += "    // Term " + std::to_string(t) + "\n    c = c * " +
+                std::to_string(0.5f + t * 0.01f) + " + " +
+                std::to_string(index % 97 * 0.001f) + ";\n\n";
+    }
+    return text + "    return c;\n}\n";
+}
+
+// Uncompressed 32-bit TGA, top-down, 32 to 256 pixels a side
+std::string benchTexture(std::mt19937& rng) {
+    std::uniform_int_distribution<int> sizes(5, 8);
+    std::uniform_real_distribution<float> phase(0.0f, 6.28f);
+    std::uniform_int_distribution<int> noise(-8, 8);
+    uint32_t side = 1u << sizes(rng);
+    float p = phase(rng);
+    float q = phase(rng);
+    std::string bytes(18, '\0');
+    bytes[2] = 2;
+    bytes[12] = static_cast<char>(side & 0xff);
+    bytes[13] = static_cast<char>(side >> 8);
+    bytes[14] = bytes[12];
+    bytes[15] = bytes[13];
+    bytes[16] = 32;
+    bytes[17] = 0x28;           // 8 alpha bits, rows top down
+    auto channel = [&noise, &rng](float value) {
+        int c = static_cast<int>(127.5f + 120.0f * value) + noise(rng);
+        return static_cast<char>(std::min(255, std::max(0, c)));
+    };
+    for (uint32_t y = 0; y < side; ++y) {
+        for (uint32_t x = 0; x < side; ++x) {
+            float u = float(x) / side;
+            float v = float(y) / side;
+            bytes += channel(std::sin(u * 7.0f + p));           // blue
+            bytes += channel(std::cos(v * 5.0f + q));           // green
+            bytes += channel(std::sin((u + v) * 3.0f + p));     // red
+            bytes += static_cast<char>(255);
+        }
+    }
+    return bytes;
+}
+
+bool writeText(const fs::path& path, const std::string& text) {
+    return writeFileBytes(path.string(),
+                          reinterpret_cast<const uint8_t*>(text.data()),
+                          text.size());
+}
+
+int bench(uint32_t assetCount, const std::string& workDir,
+          const std::vector<CookerEntry>& cookers) {
+    std::string sourceDir = workDir + "/source";
+    std::string outputDir = workDir + "/cooked";
+    std::string cacheDir = workDir + "/cache";
+    std::error_code error;
+    fs::remove_all(workDir, error);
+
+    // In every ten sources seven meshes, two shaders and a texture; a
+    // hundred sources to a directory
+    std::mt19937 rng(1);
+    std::vector<std::string> sources;
+    uint64_t sourceBytes = 0;
+    for (uint32_t i = 0; i < assetCount; ++i) {
+        fs::path dir = fs::path(sourceDir) / ("dir" + std::to_string(i / 100));
+        fs::create_directories(dir, error);
+        std::string name;
+        std::string text;
+        if (i % 5 == 4) {
+            name = "shader" + std::to_string(i) + ".hlsl";
+            text = benchShader(rng, i);
+        } else if (i % 10 == 3) {
+            name = "texture" + std::to_string(i) + ".tga";
+            text = benchTexture(rng);
+        } else {
+            name = "mesh" + std::to_string(i) + ".obj";
+            text = benchMesh(rng);
+        }
+        if (!writeText(dir / name, text)) return 1;
+        sources.push_back((dir / name).string());
+        sourceBytes += text.size();
+    }
+    std::cerr << "Bench: " << assetCount << " sources, "
+              << sourceBytes / 1048576.0 << " MB, "
+              << jobSystem().workerCount() + 1 << " threads" << std::endl;
+
+    CookStats stats;
+    bool ok = cookAll(sourceDir, outputDir, cacheDir, cookers, stats);
+    printStats("  cold:    ", stats);
+    ok = cookAll(sourceDir, outputDir, cacheDir, cookers, stats) && ok;
+    printStats("  warm:    ", stats);
+
+    // Same bytes, new time stamps: hashed again but not cooked
+    uint32_t step = 20;
+    for (uint32_t i = 0; i < assetCount; i += step) {
+        std::vector<uint8_t> bytes;
+        ok = readFileBytes(sources[i], bytes) &&
+             writeFileBytes(sources[i], bytes.data(), bytes.size()) && ok;
+    }
+    ok = cookAll(sourceDir, outputDir, cacheDir, cookers, stats) && ok;
+    printStats("  touched: ", stats);
+
+    for (uint32_t i = step / 2; i < assetCount; i += step) {
+        std::vector<uint8_t> bytes;
+        ok = readFileBytes(sources[i], bytes) && ok;
+        const char* edit = "\n// edited\n";
+        bytes.insert(bytes.end(), edit, edit + strlen(edit));
+        ok = writeFileBytes(sources[i], bytes.data(), bytes.size()) && ok;
+    }
+    ok = cookAll(sourceDir, outputDir, cacheDir, cookers, stats) && ok;
+    printStats("  edited:  ", stats);
+    return ok ? 0 : 1;
+}
+
+std::vector<float> parseRatios(const char* list) {
+    std::vector<float> ratios;
+    for (const char* p = list; *p != '\0';) {
+        char* end;
+        float r = strtof(p, &end);
+        if (end == p) break;
+        if (r > 0.0f && r < 1.0f) ratios.push_back(r);
+        p = *end == ',' ? end + 1 : end;
+    }
+    std::sort(ratios.begin(), ratios.end(), std::greater<float>());
+    return ratios;
+}
+
+} // namespace
+
+// -----------------------------------------------------------------------------
+int main(int argc, char* argv[]) {
+    std::vector<float> ratios = { 0.5f, 0.25f, 0.125f, 0.0625f };
+    SimplifyOptions options;
+    MipFilter mipFilter = MipFilter::kKaiser;
+    TextureFormat textureFormat = TextureFormat::kBc7;
+    BcQuality textureQuality = BcQuality::kBalanced;
+    std::string cacheDir;
+    std::string packPath;
+    int workerCount = -1;
+    uint32_t benchAssets = 0;
+    const char* sampleProfilePath = nullptr;
+    int sampleHz = 997;
+    std::vector<std::string> paths;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--ratios") == 0 && i + 1 < argc) {
+            ratios = parseRatios(argv[++i]);
+        } else if (strcmp(argv[i], "--attribute-weight") == 0 &&
+                   i + 1 < argc) {
+            options.attributeWeight = static_cast<float>(atof(argv[++i]));
+        } else if (strcmp(argv[i], "--mip-filter") == 0 && i + 1 < argc) {
+            ++i;
+            mipFilter = strcmp(argv[i], "box") == 0 ? MipFilter::kBox
+                                                    : MipFilter::kKaiser;
+        } else if (strcmp(argv[i], "--texture-format") == 0 && i + 1 < argc) {
+            if (!parseTextureFormat(argv[++i], textureFormat)) {
+                std::cerr << "Unknown texture format " << argv[i]
+                          << std::endl;
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--texture-quality") == 0 &&
+                   i + 1 < argc) {
+            if (!parseBcQuality(argv[++i], textureQuality)) {
+                std::cerr << "Unknown texture quality " << argv[i]
+                          << std::endl;
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc) {
+            cacheDir = argv[++i];
+        } else if (strcmp(argv[i], "--pack") == 0 && i + 1 < argc) {
+            packPath = argv[++i];
+        } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            workerCount = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--bench") == 0 && i + 1 < argc) {
+            benchAssets = static_cast<uint32_t>(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--sample-profile") == 0 && i + 1 < argc) {
+            sampleProfilePath = argv[++i];
+        } else if (strcmp(argv[i], "--sample-hz") == 0 && i + 1 < argc) {
+            sampleHz = atoi(argv[++i]);
+        } else {
+            paths.push_back(argv[i]);
+        }
+    }
+
+    bool usage = benchAssets > 0 ? paths.size() != 1 : paths.size() != 2;
+    if (usage) {
+        std::cerr << "Usage: AssetCook [--cache dir] [--workers n] "
+                     "[--ratios r,r,...] [--attribute-weight w]\n"
+                     "                 [--mip-filter box|kaiser] "
+                     "[--texture-format rgba8|bc1|bc3|bc4|bc5|bc7]\n"
+                     "                 [--texture-quality "
+                     "fast|balanced|best|reference] [--pack file]\n"
+                     "                 [--sample-profile prefix] "
+                     "[--sample-hz n]\n"
+                     "                 <source dir> <output dir>\n"
+                     "       AssetCook [options] --bench <assets> <work dir>"
+                  << std::endl;
+        return 1;
+    }
+
+    if (workerCount < 0) {
+        workerCount = std::max(
+            0, static_cast<int>(std::thread::hardware_concurrency()) - 1);
+    }
+    jobSystem().start(workerCount);
+
+    samplingProfiler().registerCurrentThread("main");
+    if (sampleProfilePath != nullptr && !samplingProfiler().start(sampleHz)) {
+        std::cerr << "Failed to start sampling profiler" << std::endl;
+    }
+
+    MeshCooker meshCooker(ratios, options);
+    ShaderCooker shaderCooker;
+    TextureCooker textureCooker(mipFilter, textureFormat, textureQuality);
+    std::vector<CookerEntry> cookers = {
+        { ".obj", &meshCooker },
+        { ".mesh", &meshCooker },
+        { ".hlsl", &shaderCooker },
+        { ".tga", &textureCooker },
+    };
+
+    int result;
+    if (benchAssets > 0) {
+        result = bench(benchAssets, paths[0], cookers);
+    } else {
+        // The cache defaults to a directory beside the output
+        if (cacheDir.empty()) cacheDir = paths[1] + "/.cook_cache";
+        CookStats stats;
+        std::vector<Asset> assets;
+        result = cookAll(paths[0], paths[1], cacheDir, cookers, stats,
+                         &assets) ? 0 : 1;
+        printStats("Cook: ", stats);
+        if (result == 0 && !packPath.empty() &&
+            !writePack(packPath, paths[1], assets)) {
+            result = 1;
+        }
+    }
+    jobSystem().stop();
+    if (samplingProfiler().running()) {
+        samplingProfiler().stopAndWrite(sampleProfilePath);
+    }
+    return result;
+}
@@ -0,0 +1,46 @@
+#include "async_loading.h"
+
+#include <cstring>
+#include <iostream>
+
+#include "job_system.h"
+
+// -----------------------------------------------------------------------------
+Task<ShaderBlob> compileShader(const char* source, std::string entryPoint,
+                               std::string target) {
+    co_await jobSystem().schedule();
+
+    ShaderBlob result;
+    ID3DBlob* errorBlob = nullptr;
+    result.hr = D3DCompile(source, strlen(source), nullptr, nullptr, nullptr,
+                           entryPoint.c_str(), target.c_str(), 0, 0,
+                           &result.blob, &errorBlob);
+    if (FAILED(result.hr)) {
+        if (errorBlob) {
+            std::cerr << reinterpret_cast<char*>(errorBlob->GetBufferPointer())
+                      << std::endl;
+        }
+        result.blob = nullptr;
+    }
+    if (errorBlob) {
+        errorBlob->Release();
+    }
+    co_return result;
+}
+
+Task<BufferUpload> uploadBuffer(ID3D11Device* device, D3D11_BUFFER_DESC desc,
+                                std::vector<uint8_t> data) {
+    co_await jobSystem().schedule();
+
+    D3D11_SUBRESOURCE_DATA initData = {};
+    initData.pSysMem = data.data();
+
+    BufferUpload result;
+    result.hr = device->CreateBuffer(&desc, data.empty() ? nullptr : &initData,
+                                     &result.buffer);
+    if (FAILED(result.hr)) {
+        std::cerr << "Failed to create buffer" << std::endl;
+        result.buffer = nullptr;
+    }
+    co_return result;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <d3d11.h>
+#include <d3dcompiler.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "task.h"
+
+// -----------------------------------------------------------------------------
+// Awaitable loading steps. Each one moves to the job system before doing
+// its blocking work, so independent loads started with whenAll() overlap.
+// They complete on a worker thread; callers that need the immediate context
+// afterwards must `co_await` their context executor.
+struct ShaderBlob {
+    HRESULT hr = E_FAIL;
+    ID3DBlob* blob = nullptr;     // owned by the caller on success
+};
+
+struct BufferUpload {
+    HRESULT hr = E_FAIL;
+    ID3D11Buffer* buffer = nullptr;
+};
+
+
+Task<ShaderBlob> compileShader(const char* source, std::string entryPoint,
+                               std::string target);
+
+// ID3D11Device is free-threaded, so creation happens on the worker.
+Task<BufferUpload> uploadBuffer(ID3D11Device* device, D3D11_BUFFER_DESC desc,
+                                std::vector<uint8_t> data);
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <array>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+
+// -----------------------------------------------------------------------------
+// Fixed-capacity FIFO used to hand work from one thread to another.
+// Producers never block: tryPush() fails when the queue is full so the caller
+// can keep pumping window messages. Consumers block in pop() until an item
+// arrives or the queue is closed and drained.
+template <typename T, size_t Capacity>
+class BoundedQueue {
+ public:
+    bool tryPush(const T& item) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (closed_ || count_ == Capacity) return false;
+            items_[(head_ + count_) % Capacity] = item;
+            ++count_;
+        }
+        notEmpty_.notify_one();
+        return true;
+    }
+
+    // Returns false once the queue is closed and every queued item was popped.
+    bool pop(T& item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        notEmpty_.wait(lock, [this] { return count_ > 0 || closed_; });
+        if (count_ == 0) return false;
+        item = items_[head_];
+        head_ = (head_ + 1) % Capacity;
+        --count_;
+        return true;
+    }
+
+    // Never blocks; false when nothing is queued
+    bool tryPop(T& item) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (count_ == 0) return false;
+        item = items_[head_];
+        head_ = (head_ + 1) % Capacity;
+        --count_;
+        return true;
+    }
+
+    bool full() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return count_ == Capacity;
+    }
+
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            closed_ = true;
+        }
+        notEmpty_.notify_all();
+    }
+
+    void reopen() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = false;
+    }
+
+ private:
+    mutable std::mutex mutex_;
+    std::condition_variable notEmpty_;
+    std::array<T, Capacity> items_ = {};
+    size_t head_ = 0;
+    size_t count_ = 0;
+    bool closed_ = false;
+};
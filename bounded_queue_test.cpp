@@ -0,0 +1,184 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "bounded_queue.h"
+#include "test_check.h"
+
+// -----------------------------------------------------------------------------
+// Tests for BoundedQueue, the renderer's frame handoff: tryPush() failing
+// when full and after close(), pop() draining what was queued before
+// close() and then returning false, reopen(), and one producer and one
+// consumer passing items in order. With --bench it runs that many frames of
+// a headless render loop, building each on the main thread and "presenting"
+// it with a fixed wait standing in for a blocking Present(), once serially
+// and once through the queue to a present thread, and prints the main
+// thread's time per frame in each.
+//
+//   BoundedQueueTest [--bench <frames>]
+namespace {
+
+void testFull() {
+    BoundedQueue<int, 2> queue;
+    CHECK(!queue.full());
+    CHECK(queue.tryPush(1) && queue.tryPush(2));
+    CHECK(queue.full());
+    CHECK(!queue.tryPush(3));
+
+    int item = 0;
+    CHECK(queue.tryPop(item) && item == 1);
+    CHECK(!queue.full());
+    CHECK(queue.tryPush(3));
+    CHECK(queue.pop(item) && item == 2);
+    CHECK(queue.pop(item) && item == 3);
+    CHECK(!queue.tryPop(item));
+}
+
+void testCloseDrains() {
+    BoundedQueue<int, 4> queue;
+    CHECK(queue.tryPush(1) && queue.tryPush(2));
+    queue.close();
+    CHECK(!queue.tryPush(3));
+
+    // What was queued before close() still comes out, then pop() stops
+    // blocking
+    int item = 0;
+    CHECK(queue.pop(item) && item == 1);
+    CHECK(queue.pop(item) && item == 2);
+    CHECK(!queue.pop(item));
+    CHECK(!queue.pop(item));
+
+    queue.reopen();
+    CHECK(queue.tryPush(4));
+    CHECK(queue.pop(item) && item == 4);
+    CHECK(!queue.tryPop(item));
+}
+
+// A consumer blocked in pop() wakes when the queue closes
+void testCloseWakesConsumer() {
+    BoundedQueue<int, 1> queue;
+    bool popped = true;
+    std::thread consumer([&queue, &popped] {
+        int item;
+        popped = queue.pop(item);
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    queue.close();
+    consumer.join();
+    CHECK(!popped);
+}
+
+// The producer never blocks, as the renderer's main loop, and retries
+// while the queue is full
+template <size_t Capacity>
+void stress(uint32_t count) {
+    BoundedQueue<uint32_t, Capacity> queue;
+    std::vector<uint32_t> received;
+    received.reserve(count);
+    std::thread consumer([&queue, &received] {
+        uint32_t item;
+        while (queue.pop(item)) received.push_back(item);
+    });
+    for (uint32_t i = 0; i < count; ++i) {
+        while (!queue.tryPush(i)) std::this_thread::yield();
+    }
+    queue.close();
+    consumer.join();
+
+    bool inOrder = received.size() == count;
+    for (uint32_t i = 0; inOrder && i < count; ++i) {
+        inOrder = received[i] == i;
+    }
+    CHECK(inOrder);
+}
+
+void testStress() {
+    stress<1>(100000);
+    stress<4>(100000);
+}
+
+// -----------------------------------------------------------------------------
+double msSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+// Stands in for building a frame: 2 ms of arithmetic
+uint64_t build() {
+    auto start = std::chrono::steady_clock::now();
+    uint64_t x = 1;
+    while (msSince(start) < 2.0) {
+        for (int i = 0; i < 1000; ++i) x = x * 6364136223846793005ull + 1;
+    }
+    return x;
+}
+
+// Stands in for Present() blocking on vsync
+void present() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(8));
+}
+
+void bench(uint32_t frames) {
+    using Clock = std::chrono::steady_clock;
+    uint64_t sink = 0;
+
+    double buildMs = 0.0;
+    auto start = Clock::now();
+    for (uint32_t f = 0; f < frames; ++f) {
+        auto built = Clock::now();
+        sink += build();
+        buildMs += msSince(built);
+        present();
+    }
+    double serialMs = msSince(start);
+    std::cerr << "serial:   " << serialMs / frames << " ms/frame, build "
+              << buildMs / frames << " ms, Present() on the main thread "
+              << (serialMs - buildMs) / frames << " ms" << std::endl;
+
+    BoundedQueue<uint64_t, 1> queue;
+    std::thread presenter([&queue] {
+        uint64_t frame;
+        while (queue.pop(frame)) present();
+    });
+    buildMs = 0.0;
+    double waitMs = 0.0;
+    start = Clock::now();
+    for (uint32_t f = 0; f < frames; ++f) {
+        auto built = Clock::now();
+        uint64_t frame = build();
+        buildMs += msSince(built);
+        auto waited = Clock::now();
+        while (!queue.tryPush(frame)) std::this_thread::yield();
+        waitMs += msSince(waited);
+        sink += frame;
+    }
+    queue.close();
+    presenter.join();
+    double threadedMs = msSince(start);
+    std::cerr << "threaded: " << threadedMs / frames << " ms/frame, build "
+              << buildMs / frames << " ms, waiting for a slot "
+              << waitMs / frames << " ms, Present() on the main thread 0 ms"
+              << std::endl;
+    if (sink == 42) std::cerr << std::endl;
+}
+
+} // namespace
+
+// -----------------------------------------------------------------------------
+int main(int argc, char* argv[]) {
+    if (argc == 3 && strcmp(argv[1], "--bench") == 0) {
+        bench(static_cast<uint32_t>(std::max(1, atoi(argv[2]))));
+        return 0;
+    }
+
+    testFull();
+    testCloseDrains();
+    testCloseWakesConsumer();
+    testStress();
+    return testResult("bounded_queue");
+}
@@ -0,0 +1,797 @@
+#include "bvh.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <limits>
+
+#include "job_system.h"
+
+namespace {
+
+constexpr uint32_t kBins = 16;
+
+// Ranges this small always become leaves; up to kMaxLeafSize may when
+// splitting does not pay off
+constexpr uint32_t kMinLeafSize = 4;
+constexpr uint32_t kMaxLeafSize = 8;
+
+// Surface area heuristic weight of visiting a node, in primitive tests
+constexpr float kTraversalCost = 1.0f;
+
+// Ranges at least this large are measured and binned in parallel chunks
+constexpr uint32_t kParallelBinning = 64 * 1024;
+constexpr uint32_t kBinningChunk = 16 * 1024;
+
+// Ranges at least this large build their two halves as separate jobs
+constexpr uint32_t kParallelSubtree = 4096;
+
+// Refit ranges in nodes, as in SceneGraph::partition()
+constexpr uint32_t kMinGrain = 1024;
+constexpr uint32_t kBatchesPerWorker = 4;
+
+// A subtree is rebuilt once its cost grew this much since it was built
+constexpr float kRebuildGrowth = 1.25f;
+
+constexpr float kInfinity = std::numeric_limits<float>::infinity();
+
+Bounds emptyBounds() {
+    return { { kInfinity, kInfinity, kInfinity },
+             { -kInfinity, -kInfinity, -kInfinity } };
+}
+
+Bounds lane(const BvhNode& node, int k) {
+    return { { node.minX[k], node.minY[k], node.minZ[k] },
+             { node.maxX[k], node.maxY[k], node.maxZ[k] } };
+}
+
+void setLane(BvhNode& node, int k, const Bounds& b) {
+    node.minX[k] = b.min.x;
+    node.minY[k] = b.min.y;
+    node.minZ[k] = b.min.z;
+    node.maxX[k] = b.max.x;
+    node.maxY[k] = b.max.y;
+    node.maxZ[k] = b.max.z;
+}
+
+Bounds nodeBounds(const BvhNode& node) {
+    return { { std::min(std::min(node.minX[0], node.minX[1]),
+                         std::min(node.minX[2], node.minX[3])),
+               std::min(std::min(node.minY[0], node.minY[1]),
+                         std::min(node.minY[2], node.minY[3])),
+               std::min(std::min(node.minZ[0], node.minZ[1]),
+                         std::min(node.minZ[2], node.minZ[3])) },
+             { std::max(std::max(node.maxX[0], node.maxX[1]),
+                         std::max(node.maxX[2], node.maxX[3])),
+               std::max(std::max(node.maxY[0], node.maxY[1]),
+                         std::max(node.maxY[2], node.maxY[3])),
+               std::max(std::max(node.maxZ[0], node.maxZ[1]),
+                         std::max(node.maxZ[2], node.maxZ[3])) } };
+}
+
+float axis(const Float3& v, int a) {
+    return a == 0 ? v.x : a == 1 ? v.y : v.z;
+}
+
+bool isLeaf(uint32_t child) {
+    return child != BvhNode::kEmpty && (child & BvhNode::kLeaf) != 0;
+}
+
+double elapsedMs(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+} // namespace
+
+// -----------------------------------------------------------------------------
+// Binary tree built by the binned surface area heuristic. Children of a node
+// are allocated as a pair, so the right child is left + 1.
+struct Bvh::BuildNode {
+    Bounds bounds;
+    uint32_t left;
+    uint32_t first;
+    uint32_t count;              // non-zero for leaves
+};
+
+struct Bvh::Builder {
+    struct Extent {
+        Bounds bounds = emptyBounds();
+        Bounds centroids = emptyBounds();
+    };
+
+    struct Bin {
+        Extent extent;
+        uint32_t count = 0;
+    };
+
+    // Primitive with a copy of its bounds. These are partitioned in place,
+    // so every pass reads memory in order rather than gathering bounds.
+    struct Ref {
+        Bounds bounds;
+        uint32_t prim;
+    };
+
+    Builder(const Bounds* bounds, uint32_t* primitives, uint32_t count)
+        : primitives(primitives), refs(count), nodes(2 * count) {
+        for (uint32_t i = 0; i < count; ++i) {
+            refs[i] = { bounds[primitives[i]], primitives[i] };
+        }
+    }
+
+    // Writes the primitive order back; leaves index into it
+    void finish() {
+        for (uint32_t i = 0; i < refs.size(); ++i) primitives[i] = refs[i].prim;
+    }
+
+    Extent measure(uint32_t begin, uint32_t end) const;
+    void bin(uint32_t begin, uint32_t end, int a, float origin, float scale,
+             Bin* bins) const;
+    void build(uint32_t node, uint32_t begin, uint32_t end,
+               const Extent& extent);
+
+    uint32_t* primitives;
+    std::vector<Ref> refs;
+    std::vector<BuildNode> nodes;
+    std::atomic<uint32_t> nodeCount{1};
+};
+
+Bvh::Builder::Extent Bvh::Builder::measure(uint32_t begin,
+                                           uint32_t end) const {
+    auto measureRange = [this](uint32_t b, uint32_t e) {
+        Extent extent;
+        for (uint32_t i = b; i < e; ++i) {
+            const Bounds& box = refs[i].bounds;
+            Float3 c = box.center();
+            extent.bounds = merge(extent.bounds, box);
+            extent.centroids = merge(extent.centroids, { c, c });
+        }
+        return extent;
+    };
+    if (end - begin < kParallelBinning) return measureRange(begin, end);
+
+    uint32_t chunks = (end - begin + kBinningChunk - 1) / kBinningChunk;
+    std::vector<Extent> partial(chunks);
+    jobSystem().parallelFor(chunks, 1, [&](uint32_t first, uint32_t last) {
+        for (uint32_t c = first; c < last; ++c) {
+            uint32_t b = begin + c * kBinningChunk;
+            partial[c] = measureRange(b, std::min(end, b + kBinningChunk));
+        }
+    });
+
+    Extent extent;
+    for (const Extent& p : partial) {
+        extent.bounds = merge(extent.bounds, p.bounds);
+        extent.centroids = merge(extent.centroids, p.centroids);
+    }
+    return extent;
+}
+
+void Bvh::Builder::bin(uint32_t begin, uint32_t end, int a, float origin,
+                       float scale, Bin* bins) const {
+    auto binRange = [&](uint32_t b, uint32_t e, Bin* out) {
+        for (uint32_t i = b; i < e; ++i) {
+            const Bounds& box = refs[i].bounds;
+            Float3 center = box.center();
+            float c = axis(center, a);
+            uint32_t index = std::min(
+                kBins - 1, static_cast<uint32_t>((c - origin) * scale));
+            Extent& extent = out[index].extent;
+            extent.bounds = merge(extent.bounds, box);
+            extent.centroids = merge(extent.centroids, { center, center });
+            ++out[index].count;
+        }
+    };
+    if (end - begin < kParallelBinning) {
+        binRange(begin, end, bins);
+        return;
+    }
+
+    uint32_t chunks = (end - begin + kBinningChunk - 1) / kBinningChunk;
+    std::vector<Bin> partial(size_t(chunks) * kBins);
+    jobSystem().parallelFor(chunks, 1, [&](uint32_t first, uint32_t last) {
+        for (uint32_t c = first; c < last; ++c) {
+            uint32_t b = begin + c * kBinningChunk;
+            binRange(b, std::min(end, b + kBinningChunk),
+                     &partial[size_t(c) * kBins]);
+        }
+    });
+
+    for (uint32_t c = 0; c < chunks; ++c) {
+        for (uint32_t i = 0; i < kBins; ++i) {
+            const Bin& p = partial[size_t(c) * kBins + i];
+            Extent& extent = bins[i].extent;
+            extent.bounds = merge(extent.bounds, p.extent.bounds);
+            extent.centroids = merge(extent.centroids, p.extent.centroids);
+            bins[i].count += p.count;
+        }
+    }
+}
+
+// `extent` covers [begin, end); the children's extents come out of the
+// binning, so each level reads the range twice: to bin and to partition.
+void Bvh::Builder::build(uint32_t node, uint32_t begin, uint32_t end,
+                         const Extent& extent) {
+    uint32_t count = end - begin;
+    BuildNode& out = nodes[node];
+    out.bounds = extent.bounds;
+    out.first = begin;
+    out.count = count;
+    if (count <= kMinLeafSize) return;
+
+    Float3 size = extent.centroids.max - extent.centroids.min;
+    int a = 0;
+    if (size.y > axis(size, a)) a = 1;
+    if (size.z > axis(size, a)) a = 2;
+    float width = axis(size, a);
+    if (width <= 0.0f && count <= kMaxLeafSize) return;
+
+    uint32_t mid = begin;
+    Extent leftExtent;
+    Extent rightExtent;
+    if (width > 0.0f) {
+        float origin = axis(extent.centroids.min, a);
+        float scale = kBins / width;
+        Bin bins[kBins];
+        bin(begin, end, a, origin, scale, bins);
+
+        // Sweep from the right for the suffix areas, then from the left
+        float rightArea[kBins];
+        Bounds right = emptyBounds();
+        for (uint32_t i = kBins - 1; i > 0; --i) {
+            right = merge(right, bins[i].extent.bounds);
+            rightArea[i] = halfArea(right);
+        }
+        Bounds left = emptyBounds();
+        uint32_t leftCount = 0;
+        float bestCost = kInfinity;
+        uint32_t bestSplit = 0;
+        for (uint32_t i = 1; i < kBins; ++i) {
+            left = merge(left, bins[i - 1].extent.bounds);
+            leftCount += bins[i - 1].count;
+            if (leftCount == 0 || leftCount == count) continue;
+            float cost = halfArea(left) * leftCount +
+                         rightArea[i] * (count - leftCount);
+            if (cost < bestCost) {
+                bestCost = cost;
+                bestSplit = i;
+            }
+        }
+
+        float parentArea = halfArea(extent.bounds);
+        float leafCost = parentArea * count;
+        float splitCost = parentArea * kTraversalCost + bestCost;
+        if (count <= kMaxLeafSize &&
+            (bestSplit == 0 || splitCost >= leafCost)) {
+            return;
+        }
+        if (bestSplit != 0) {
+            auto split = std::partition(
+                refs.begin() + begin, refs.begin() + end, [&](const Ref& r) {
+                    float c = axis(r.bounds.center(), a);
+                    return static_cast<uint32_t>((c - origin) * scale) <
+                           bestSplit;
+                });
+            mid = static_cast<uint32_t>(split - refs.begin());
+            for (uint32_t i = 0; i < kBins; ++i) {
+                Extent& side = i < bestSplit ? leftExtent : rightExtent;
+                side.bounds = merge(side.bounds, bins[i].extent.bounds);
+                side.centroids =
+                    merge(side.centroids, bins[i].extent.centroids);
+            }
+        }
+    }
+
+    // Everything in one bin: split at the median instead
+    if (mid == begin || mid == end) {
+        mid = begin + count / 2;
+        if (width > 0.0f) {
+            std::nth_element(refs.begin() + begin, refs.begin() + mid,
+                             refs.begin() + end,
+                             [a](const Ref& p, const Ref& q) {
+                                 return axis(p.bounds.center(), a) <
+                                        axis(q.bounds.center(), a);
+                             });
+        }
+        leftExtent = measure(begin, mid);
+        rightExtent = measure(mid, end);
+    }
+
+    uint32_t children = nodeCount.fetch_add(2);
+    out.left = children;
+    out.count = 0;
+    if (count < kParallelSubtree) {
+        build(children, begin, mid, leftExtent);
+        build(children + 1, mid, end, rightExtent);
+        return;
+    }
+    jobSystem().parallelFor(2, 1, [&](uint32_t first, uint32_t last) {
+        for (uint32_t c = first; c < last; ++c) {
+            if (c == 0) build(children, begin, mid, leftExtent);
+            else build(children + 1, mid, end, rightExtent);
+        }
+    });
+}
+
+// -----------------------------------------------------------------------------
+void Bvh::build(const Bounds* bounds, uint32_t count) {
+    auto start = std::chrono::steady_clock::now();
+    nodes_.clear();
+    subtreeEnd_.clear();
+    primitives_.resize(count);
+    for (uint32_t i = 0; i < count; ++i) primitives_[i] = i;
+
+    if (count > 0) {
+        Builder builder(bounds, primitives_.data(), count);
+        builder.build(0, 0, count, builder.measure(0, count));
+        builder.finish();
+        nodes_.reserve(builder.nodeCount / 2 + 1);
+        subtreeEnd_.reserve(builder.nodeCount / 2 + 1);
+        flatten(builder.nodes, 0, nodes_, subtreeEnd_);
+    }
+    partition();
+
+    ++stats_.builds;
+    stats_.buildMs += elapsedMs(start);
+}
+
+// Opens the largest inner child until four lanes are filled, then emits the
+// node followed by its children's subtrees in lane order.
+uint32_t Bvh::flatten(const std::vector<BuildNode>& tree, uint32_t root,
+                      std::vector<BvhNode>& nodes,
+                      std::vector<uint32_t>& subtreeEnd) const {
+    uint32_t lanes[4];
+    int laneCount = 0;
+    if (tree[root].count != 0) {
+        lanes[laneCount++] = root;
+    } else {
+        lanes[laneCount++] = tree[root].left;
+        lanes[laneCount++] = tree[root].left + 1;
+    }
+    while (laneCount < 4) {
+        int widest = -1;
+        for (int k = 0; k < laneCount; ++k) {
+            if (tree[lanes[k]].count != 0) continue;
+            if (widest < 0 || halfArea(tree[lanes[k]].bounds) >
+                                  halfArea(tree[lanes[widest]].bounds)) {
+                widest = k;
+            }
+        }
+        if (widest < 0) break;
+        uint32_t opened = lanes[widest];
+        lanes[widest] = tree[opened].left;
+        lanes[laneCount++] = tree[opened].left + 1;
+    }
+
+    uint32_t index = static_cast<uint32_t>(nodes.size());
+    nodes.emplace_back();
+    subtreeEnd.push_back(0);
+    for (int k = 0; k < 4; ++k) {
+        uint32_t child = BvhNode::kEmpty;
+        uint32_t count = 0;
+        Bounds bounds = emptyBounds();
+        if (k < laneCount) {
+            const BuildNode& b = tree[lanes[k]];
+            bounds = b.bounds;
+            if (b.count != 0) {
+                child = BvhNode::kLeaf | b.first;
+                count = b.count;
+            } else {
+                child = flatten(tree, lanes[k], nodes, subtreeEnd);
+            }
+        }
+        BvhNode& node = nodes[index];
+        setLane(node, k, bounds);
+        node.child[k] = child;
+        node.count[k] = count;
+    }
+    subtreeEnd[index] = static_cast<uint32_t>(nodes.size());
+    return index;
+}
+
+// Subtrees no larger than the grain become refit batches; nodes above them
+// form the serial spine.
+void Bvh::partition() {
+    spine_.clear();
+    batches_.clear();
+    rebuildCursor_ = 0;
+
+    uint32_t workers = std::max(1, jobSystem().workerCount());
+    uint32_t grain = std::max(kMinGrain,
+                              nodeCount() / (workers * kBatchesPerWorker));
+
+    uint32_t i = 0;
+    while (i < nodeCount()) {
+        uint32_t end = subtreeEnd_[i];
+        if (end - i > grain) {
+            spine_.push_back(i);
+            ++i;
+            continue;
+        }
+        batches_.push_back({ i, end, subtreeCost(i, end) });
+        i = end;
+    }
+}
+
+// -----------------------------------------------------------------------------
+void Bvh::update(const Bounds* bounds) {
+    if (nodes_.empty()) return;
+    auto start = std::chrono::steady_clock::now();
+
+    if (jobSystem().workerCount() == 0 || batches_.size() < 2) {
+        refitRange(0, nodeCount(), bounds);
+    } else {
+        jobSystem().parallelFor(
+            static_cast<uint32_t>(batches_.size()), 1,
+            [this, bounds](uint32_t begin, uint32_t end) {
+                for (uint32_t b = begin; b < end; ++b) {
+                    refitRange(batches_[b].begin, batches_[b].end, bounds);
+                }
+            });
+        for (auto it = spine_.rbegin(); it != spine_.rend(); ++it) {
+            refitNode(*it, bounds);
+        }
+    }
+    ++stats_.refits;
+    stats_.refitMs += elapsedMs(start);
+
+    uint32_t b = rebuildCursor_++ % batches_.size();
+    float cost = subtreeCost(batches_[b].begin, batches_[b].end);
+    if (cost > batches_[b].builtCost * kRebuildGrowth) {
+        start = std::chrono::steady_clock::now();
+        rebuild(b, bounds);
+        ++stats_.rebuilds;
+        stats_.rebuildMs += elapsedMs(start);
+    }
+}
+
+// Children follow their parent, so a backward pass sees them first
+void Bvh::refitRange(uint32_t begin, uint32_t end, const Bounds* bounds) {
+    for (uint32_t i = end; i-- > begin;) refitNode(i, bounds);
+}
+
+void Bvh::refitNode(uint32_t index, const Bounds* bounds) {
+    BvhNode& node = nodes_[index];
+    for (int k = 0; k < 4; ++k) {
+        uint32_t child = node.child[k];
+        if (child == BvhNode::kEmpty) continue;
+        if (!isLeaf(child)) {
+            setLane(node, k, nodeBounds(nodes_[child]));
+            continue;
+        }
+        uint32_t first = child & ~BvhNode::kLeaf;
+        Bounds box = bounds[primitives_[first]];
+        for (uint32_t i = 1; i < node.count[k]; ++i) {
+            box = merge(box, bounds[primitives_[first + i]]);
+        }
+        setLane(node, k, box);
+    }
+}
+
+float Bvh::cost() const {
+    return nodes_.empty() ? 0.0f : subtreeCost(0, nodeCount());
+}
+
+float Bvh::subtreeCost(uint32_t begin, uint32_t end) const {
+    float rootArea = halfArea(nodeBounds(nodes_[begin]));
+    if (rootArea <= 0.0f) return 0.0f;
+
+    float cost = 0.0f;
+    for (uint32_t i = begin; i < end; ++i) {
+        const BvhNode& node = nodes_[i];
+        for (int k = 0; k < 4; ++k) {
+            if (node.child[k] == BvhNode::kEmpty) continue;
+            float weight = isLeaf(node.child[k])
+                               ? static_cast<float>(node.count[k])
+                               : kTraversalCost;
+            cost += halfArea(lane(node, k)) * weight;
+        }
+    }
+    return cost / rootArea;
+}
+
+// Rebuilds the batch's subtree over the primitives its leaves cover, which
+// are contiguous, and splices the new nodes in place of the old ones.
+void Bvh::rebuild(uint32_t batch, const Bounds* bounds) {
+    uint32_t begin = batches_[batch].begin;
+    uint32_t oldEnd = batches_[batch].end;
+
+    uint32_t first = ~0u;
+    uint32_t last = 0;
+    for (uint32_t i = begin; i < oldEnd; ++i) {
+        for (int k = 0; k < 4; ++k) {
+            if (!isLeaf(nodes_[i].child[k])) continue;
+            uint32_t p = nodes_[i].child[k] & ~BvhNode::kLeaf;
+            first = std::min(first, p);
+            last = std::max(last, p + nodes_[i].count[k]);
+        }
+    }
+    if (first >= last) return;
+
+    // Build over the range as if it were the whole array, then rebase the
+    // primitive and node indices
+    Builder builder(bounds, primitives_.data() + first, last - first);
+    builder.build(0, 0, last - first,
+                  builder.measure(0, last - first));
+    builder.finish();
+    std::vector<BvhNode> nodes;
+    std::vector<uint32_t> subtreeEnd;
+    flatten(builder.nodes, 0, nodes, subtreeEnd);
+    for (uint32_t i = 0; i < nodes.size(); ++i) {
+        for (int k = 0; k < 4; ++k) {
+            uint32_t& child = nodes[i].child[k];
+            if (child == BvhNode::kEmpty) continue;
+            child += isLeaf(child) ? first : begin;
+        }
+        subtreeEnd[i] += begin;
+    }
+
+    uint32_t newEnd = begin + static_cast<uint32_t>(nodes.size());
+    auto shift = [oldEnd, newEnd](uint32_t& index) {
+        if (index >= oldEnd) index = index - oldEnd + newEnd;
+    };
+    for (uint32_t i = 0; i < nodeCount(); ++i) {
+        if (i >= begin && i < oldEnd) continue;
+        for (int k = 0; k < 4; ++k) {
+            uint32_t child = nodes_[i].child[k];
+            if (child != BvhNode::kEmpty && !isLeaf(child)) {
+                shift(nodes_[i].child[k]);
+            }
+        }
+        shift(subtreeEnd_[i]);
+    }
+    for (uint32_t& s : spine_) shift(s);
+    for (Batch& b : batches_) {
+        shift(b.begin);
+        shift(b.end);
+    }
+
+    nodes_.erase(nodes_.begin() + begin, nodes_.begin() + oldEnd);
+    nodes_.insert(nodes_.begin() + begin, nodes.begin(), nodes.end());
+    subtreeEnd_.erase(subtreeEnd_.begin() + begin,
+                      subtreeEnd_.begin() + oldEnd);
+    subtreeEnd_.insert(subtreeEnd_.begin() + begin, subtreeEnd.begin(),
+                       subtreeEnd.end());
+
+    batches_[batch].begin = begin;
+    batches_[batch].end = newEnd;
+    batches_[batch].builtCost = subtreeCost(begin, newEnd);
+}
+
+// -----------------------------------------------------------------------------
+void Bvh::query(const Bounds& box,
+                const std::function<void(uint32_t)>& fn) const {
+    if (nodes_.empty()) return;
+    std::vector<uint32_t> stack(1, 0);
+    while (!stack.empty()) {
+        const BvhNode& node = nodes_[stack.back()];
+        stack.pop_back();
+
+        int overlap = 0;
+        for (int k = 0; k < 4; ++k) {
+            bool x = node.minX[k] <= box.max.x && node.maxX[k] >= box.min.x;
+            bool y = node.minY[k] <= box.max.y && node.maxY[k] >= box.min.y;
+            bool z = node.minZ[k] <= box.max.z && node.maxZ[k] >= box.min.z;
+            overlap |= (x && y && z) << k;
+        }
+        for (int k = 0; k < 4; ++k) {
+            uint32_t child = node.child[k];
+            if (!(overlap & (1 << k)) || child == BvhNode::kEmpty) continue;
+            if (!isLeaf(child)) {
+                stack.push_back(child);
+                continue;
+            }
+            uint32_t first = child & ~BvhNode::kLeaf;
+            for (uint32_t i = 0; i < node.count[k]; ++i) {
+                fn(primitives_[first + i]);
+            }
+        }
+    }
+}
+
+void Bvh::cull(const Plane* planes, uint32_t planeCount,
+               const std::function<void(uint32_t)>& fn) const {
+    if (nodes_.empty()) return;
+    std::vector<uint32_t> stack(1, 0);
+    while (!stack.empty()) {
+        const BvhNode& node = nodes_[stack.back()];
+        stack.pop_back();
+
+        // A lane is out once its corner furthest along a plane's normal
+        // is behind that plane
+        int outside = 0;
+        for (uint32_t p = 0; p < planeCount; ++p) {
+            const Plane& plane = planes[p];
+            const float* x = plane.normal.x >= 0.0f ? node.maxX : node.minX;
+            const float* y = plane.normal.y >= 0.0f ? node.maxY : node.minY;
+            const float* z = plane.normal.z >= 0.0f ? node.maxZ : node.minZ;
+            for (int k = 0; k < 4; ++k) {
+                float distance = plane.normal.x * x[k] +
+                                 plane.normal.y * y[k] +
+                                 plane.normal.z * z[k] + plane.d;
+                outside |= (distance < 0.0f) << k;
+            }
+        }
+        for (int k = 0; k < 4; ++k) {
+            uint32_t child = node.child[k];
+            if ((outside & (1 << k)) || child == BvhNode::kEmpty) continue;
+            if (!isLeaf(child)) {
+                stack.push_back(child);
+                continue;
+            }
+            uint32_t first = child & ~BvhNode::kLeaf;
+            for (uint32_t i = 0; i < node.count[k]; ++i) {
+                fn(primitives_[first + i]);
+            }
+        }
+    }
+}
+
+uint32_t Bvh::raycast(const Float3& origin, const Float3& direction,
+                      float maxT, float& t,
+                      const std::function<float(uint32_t, float)>& hit) const {
+    struct Entry {
+        uint32_t child;
+        uint32_t count;
+        float near;
+    };
+
+    uint32_t closest = kNoHit;
+    t = maxT;
+    if (nodes_.empty()) return closest;
+
+    Float3 inv = { 1.0f / direction.x, 1.0f / direction.y,
+                   1.0f / direction.z };
+    std::vector<Entry> stack(1, Entry{ 0, 0, 0.0f });
+    while (!stack.empty()) {
+        Entry entry = stack.back();
+        stack.pop_back();
+        if (entry.near >= t) continue;
+
+        if (isLeaf(entry.child)) {
+            uint32_t first = entry.child & ~BvhNode::kLeaf;
+            for (uint32_t i = 0; i < entry.count; ++i) {
+                uint32_t prim = primitives_[first + i];
+                float distance = hit(prim, t);
+                if (distance < t) {
+                    t = distance;
+                    closest = prim;
+                }
+            }
+            continue;
+        }
+
+        // Slab test on all four lanes
+        const BvhNode& node = nodes_[entry.child];
+        float near[4];
+        float far[4];
+        for (int k = 0; k < 4; ++k) {
+            float x0 = (node.minX[k] - origin.x) * inv.x;
+            float x1 = (node.maxX[k] - origin.x) * inv.x;
+            float y0 = (node.minY[k] - origin.y) * inv.y;
+            float y1 = (node.maxY[k] - origin.y) * inv.y;
+            float z0 = (node.minZ[k] - origin.z) * inv.z;
+            float z1 = (node.maxZ[k] - origin.z) * inv.z;
+            near[k] = std::max(std::max(std::min(x0, x1), std::min(y0, y1)),
+                               std::max(std::min(z0, z1), 0.0f));
+            far[k] = std::min(std::min(std::max(x0, x1), std::max(y0, y1)),
+                              std::min(std::max(z0, z1), t));
+        }
+
+        // Push the hit lanes far to near so the nearest is popped first
+        Entry hits[4];
+        int hitCount = 0;
+        for (int k = 0; k < 4; ++k) {
+            if (node.child[k] == BvhNode::kEmpty || near[k] > far[k]) {
+                continue;
+            }
+            Entry e = { node.child[k], node.count[k], near[k] };
+            int j = hitCount++;
+            while (j > 0 && hits[j - 1].near < e.near) {
+                hits[j] = hits[j - 1];
+                --j;
+            }
+            hits[j] = e;
+        }
+        stack.insert(stack.end(), hits, hits + hitCount);
+    }
+    return closest;
+}
+
+void Bvh::raycast4(
+    const Float3 origin[4], const Float3 direction[4], float t[4],
+    uint32_t closest[4],
+    const std::function<float(uint32_t, uint32_t, float)>& hit) const {
+    struct Entry {
+        uint32_t child;
+        uint32_t count;
+        uint32_t rays;           // bit per ray that reached this entry
+        float near;              // nearest entry distance among them
+    };
+
+    float ox[4], oy[4], oz[4];
+    float ix[4], iy[4], iz[4];
+    for (int r = 0; r < 4; ++r) {
+        closest[r] = kNoHit;
+        ox[r] = origin[r].x;
+        oy[r] = origin[r].y;
+        oz[r] = origin[r].z;
+        ix[r] = 1.0f / direction[r].x;
+        iy[r] = 1.0f / direction[r].y;
+        iz[r] = 1.0f / direction[r].z;
+    }
+    if (nodes_.empty()) return;
+
+    std::vector<Entry> stack(1, Entry{ 0, 0, 0xF, 0.0f });
+    while (!stack.empty()) {
+        Entry entry = stack.back();
+        stack.pop_back();
+
+        // Drop the rays that already hit something nearer
+        uint32_t rays = 0;
+        for (int r = 0; r < 4; ++r) {
+            if ((entry.rays & (1 << r)) && entry.near < t[r]) rays |= 1 << r;
+        }
+        if (rays == 0) continue;
+
+        if (isLeaf(entry.child)) {
+            uint32_t first = entry.child & ~BvhNode::kLeaf;
+            for (int r = 0; r < 4; ++r) {
+                if (!(rays & (1 << r))) continue;
+                for (uint32_t i = 0; i < entry.count; ++i) {
+                    uint32_t prim = primitives_[first + i];
+                    float distance = hit(r, prim, t[r]);
+                    if (distance < t[r]) {
+                        t[r] = distance;
+                        closest[r] = prim;
+                    }
+                }
+            }
+            continue;
+        }
+
+        // Slab tests, four lanes per ray
+        const BvhNode& node = nodes_[entry.child];
+        uint32_t laneRays[4] = {};
+        float laneNear[4] = { kInfinity, kInfinity, kInfinity, kInfinity };
+        for (int r = 0; r < 4; ++r) {
+            if (!(rays & (1 << r))) continue;
+            for (int k = 0; k < 4; ++k) {
+                float x0 = (node.minX[k] - ox[r]) * ix[r];
+                float x1 = (node.maxX[k] - ox[r]) * ix[r];
+                float y0 = (node.minY[k] - oy[r]) * iy[r];
+                float y1 = (node.maxY[k] - oy[r]) * iy[r];
+                float z0 = (node.minZ[k] - oz[r]) * iz[r];
+                float z1 = (node.maxZ[k] - oz[r]) * iz[r];
+                float near = std::max(
+                    std::max(std::min(x0, x1), std::min(y0, y1)),
+                    std::max(std::min(z0, z1), 0.0f));
+                float far = std::min(
+                    std::min(std::max(x0, x1), std::max(y0, y1)),
+                    std::min(std::max(z0, z1), t[r]));
+                bool enter = near <= far;
+                laneRays[k] |= uint32_t(enter) << r;
+                laneNear[k] = enter ? std::min(laneNear[k], near)
+                                    : laneNear[k];
+            }
+        }
+
+        // Push far to near so the nearest lane is popped first
+        Entry hits[4];
+        int hitCount = 0;
+        for (int k = 0; k < 4; ++k) {
+            if (node.child[k] == BvhNode::kEmpty || laneRays[k] == 0) {
+                continue;
+            }
+            Entry e = { node.child[k], node.count[k], laneRays[k],
+                        laneNear[k] };
+            int j = hitCount++;
+            while (j > 0 && hits[j - 1].near < e.near) {
+                hits[j] = hits[j - 1];
+                --j;
+            }
+            hits[j] = e;
+        }
+        stack.insert(stack.end(), hits, hits + hitCount);
+    }
+}
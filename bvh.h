@@ -0,0 +1,122 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "math_types.h"
+
+// -----------------------------------------------------------------------------
+// Four-wide bounding volume hierarchy over caller-owned primitive bounds.
+// Each node stores the boxes of its four children as separate x/y/z arrays,
+// so one node visit tests all four lanes with the same few vector
+// instructions. A lane is an inner node, a leaf (a contiguous run of
+// primitive ids) or empty.
+//
+// build() splits with the binned surface area heuristic; large ranges are
+// binned in parallel and independent subtrees are built on the job system.
+// The binary tree is then collapsed into four-wide nodes stored depth-first,
+// so every subtree is a contiguous node range. update() refits the boxes to
+// moved primitives, subtree ranges in parallel, and checks one subtree per
+// call for decay, rebuilding it when its cost drifted too far from what it
+// was when built.
+//
+// Primitives are identified by their index in the bounds array. Queries
+// report every primitive of each leaf whose box passes, so callers test the
+// primitive itself where that matters. Not thread-safe.
+struct BvhStats {
+    uint64_t builds = 0;
+    double buildMs = 0.0;
+    uint64_t refits = 0;
+    double refitMs = 0.0;
+    uint64_t rebuilds = 0;       // partial
+    double rebuildMs = 0.0;
+};
+
+struct alignas(64) BvhNode {
+    static constexpr uint32_t kLeaf = 0x80000000u;
+    static constexpr uint32_t kEmpty = ~0u;
+
+    float minX[4], minY[4], minZ[4];
+    float maxX[4], maxY[4], maxZ[4];
+    uint32_t child[4];           // node index, kLeaf | first primitive, kEmpty
+    uint32_t count[4];           // primitives in a leaf lane
+};
+static_assert(sizeof(BvhNode) == 128, "two cache lines per node");
+
+class Bvh {
+ public:
+    static constexpr uint32_t kNoHit = ~0u;
+
+    void build(const Bounds* bounds, uint32_t count);
+
+    // Refits to the new bounds of the same primitives, then may rebuild one
+    // decayed subtree
+    void update(const Bounds* bounds);
+
+    uint32_t primitiveCount() const {
+        return static_cast<uint32_t>(primitives_.size());
+    }
+    uint32_t nodeCount() const { return static_cast<uint32_t>(nodes_.size()); }
+
+    // Surface area heuristic cost relative to the root box
+    float cost() const;
+
+    // fn(prim) for the primitives of leaves overlapping `box`
+    void query(const Bounds& box,
+               const std::function<void(uint32_t)>& fn) const;
+
+    // fn(prim) for the primitives of leaves not entirely outside a plane
+    void cull(const Plane* planes, uint32_t planeCount,
+              const std::function<void(uint32_t)>& fn) const;
+
+    // Visits leaves along the ray, nearest box first. hit(prim, maxT)
+    // returns the primitive's hit distance, or maxT or more for a miss.
+    // Returns the closest primitive, or kNoHit, and its distance in `t`.
+    uint32_t raycast(const Float3& origin, const Float3& direction,
+                     float maxT, float& t,
+                     const std::function<float(uint32_t, float)>& hit) const;
+
+    // Four rays as a packet: a node is entered while any of them may still
+    // hit it, so rays that travel together share node fetches, and each
+    // visit tests four rays against four lanes. t[] holds each ray's maxT
+    // on entry and its distance on return, closest[] the primitive or
+    // kNoHit. hit(ray, prim, maxT) is as for raycast().
+    void raycast4(const Float3 origin[4], const Float3 direction[4],
+                  float t[4], uint32_t closest[4],
+                  const std::function<float(uint32_t, uint32_t, float)>& hit)
+        const;
+
+    const BvhStats& stats() const { return stats_; }
+
+ private:
+    struct BuildNode;
+    struct Builder;
+
+    // A subtree refitted as one job, with its cost when it was built
+    struct Batch {
+        uint32_t begin;
+        uint32_t end;
+        float builtCost;
+    };
+
+    uint32_t flatten(const std::vector<BuildNode>& tree, uint32_t root,
+                     std::vector<BvhNode>& nodes,
+                     std::vector<uint32_t>& subtreeEnd) const;
+    void partition();
+    void refitRange(uint32_t begin, uint32_t end, const Bounds* bounds);
+    void refitNode(uint32_t index, const Bounds* bounds);
+    float subtreeCost(uint32_t begin, uint32_t end) const;
+    void rebuild(uint32_t batch, const Bounds* bounds);
+
+    std::vector<BvhNode> nodes_;
+    std::vector<uint32_t> subtreeEnd_;
+    std::vector<uint32_t> primitives_;
+
+    // Serial ancestors and parallel subtrees, from partition()
+    std::vector<uint32_t> spine_;
+    std::vector<Batch> batches_;
+    uint32_t rebuildCursor_ = 0;
+
+    BvhStats stats_;
+};
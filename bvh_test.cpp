@@ -0,0 +1,328 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "bvh.h"
+#include "job_system.h"
+#include "test_check.h"
+
+// -----------------------------------------------------------------------------
+// Tests for Bvh against brute force over random boxes: query() and cull()
+// report every primitive whose box passes and none twice, raycast() and
+// raycast4() find the closest box, refits keep all of that true after the
+// boxes move, and empty and single-primitive trees work. With --bench it
+// builds over that many random boxes and prints build time, refit time with
+// 10%, 50% and 100% of them moving, and query and cull time against a scan.
+//
+//   BvhTest [--bench <boxes>]
+namespace {
+
+Bounds randomBox(std::mt19937& rng, float maxSize) {
+    std::uniform_real_distribution<float> position(-1.0f, 1.0f);
+    std::uniform_real_distribution<float> size(0.0f, maxSize);
+    Float3 c = { position(rng), position(rng), position(rng) };
+    Float3 e = { size(rng), size(rng), size(rng) };
+    return { c - e, c + e };
+}
+
+std::vector<Bounds> randomBoxes(uint32_t count, uint32_t seed) {
+    std::mt19937 rng(seed);
+    std::vector<Bounds> boxes(count);
+    for (Bounds& b : boxes) b = randomBox(rng, 0.05f);
+    return boxes;
+}
+
+bool overlaps(const Bounds& a, const Bounds& b) {
+    return a.min.x <= b.max.x && b.min.x <= a.max.x &&
+           a.min.y <= b.max.y && b.min.y <= a.max.y &&
+           a.min.z <= b.max.z && b.min.z <= a.max.z;
+}
+
+bool outside(const Bounds& b, const Plane* planes, uint32_t planeCount) {
+    for (uint32_t p = 0; p < planeCount; ++p) {
+        const Plane& plane = planes[p];
+        Float3 corner = { plane.normal.x >= 0.0f ? b.max.x : b.min.x,
+                          plane.normal.y >= 0.0f ? b.max.y : b.min.y,
+                          plane.normal.z >= 0.0f ? b.max.z : b.min.z };
+        if (dot(plane.normal, corner) + plane.d < 0.0f) return true;
+    }
+    return false;
+}
+
+// Entry distance of the ray into the box, or maxT on a miss
+float slab(const Bounds& b, const Float3& origin, const Float3& direction,
+           float maxT) {
+    float near = 0.0f;
+    float far = maxT;
+    const float o[3] = { origin.x, origin.y, origin.z };
+    const float d[3] = { direction.x, direction.y, direction.z };
+    const float lo[3] = { b.min.x, b.min.y, b.min.z };
+    const float hi[3] = { b.max.x, b.max.y, b.max.z };
+    for (int axis = 0; axis < 3; ++axis) {
+        float inverse = 1.0f / d[axis];
+        float t0 = (lo[axis] - o[axis]) * inverse;
+        float t1 = (hi[axis] - o[axis]) * inverse;
+        near = std::max(near, std::min(t0, t1));
+        far = std::min(far, std::max(t0, t1));
+    }
+    return near <= far ? near : maxT;
+}
+
+// Every primitive brute force accepts is reported, once; leaves may add
+// neighbours whose own box fails
+void checkReported(const std::vector<uint32_t>& reported,
+                   const std::vector<bool>& expected, int line) {
+    std::vector<uint32_t> seen(expected.size(), 0);
+    bool valid = true;
+    for (uint32_t prim : reported) {
+        if (prim >= expected.size()) {
+            valid = false;
+            continue;
+        }
+        ++seen[prim];
+    }
+    bool once = true;
+    bool complete = true;
+    for (size_t i = 0; i < expected.size(); ++i) {
+        once &= seen[i] <= 1;
+        complete &= !expected[i] || seen[i] == 1;
+    }
+    CHECK_AT(valid, "reported ids in range", line);
+    CHECK_AT(once, "no primitive reported twice", line);
+    CHECK_AT(complete, "every passing primitive reported", line);
+}
+
+void checkQueries(const Bvh& bvh, const std::vector<Bounds>& boxes,
+                  uint32_t seed, int line) {
+    std::mt19937 rng(seed);
+    for (int q = 0; q < 20; ++q) {
+        Bounds box = randomBox(rng, 0.3f);
+        std::vector<uint32_t> reported;
+        bvh.query(box, [&reported](uint32_t prim) {
+            reported.push_back(prim);
+        });
+        std::vector<bool> expected(boxes.size());
+        for (size_t i = 0; i < boxes.size(); ++i) {
+            expected[i] = overlaps(box, boxes[i]);
+        }
+        checkReported(reported, expected, line);
+    }
+
+    // A slab between two planes facing each other
+    Plane planes[2] = { { { 1.0f, 0.0f, 0.0f }, 0.2f },
+                        { { -1.0f, 0.0f, 0.0f }, 0.1f } };
+    std::vector<uint32_t> reported;
+    bvh.cull(planes, 2, [&reported](uint32_t prim) {
+        reported.push_back(prim);
+    });
+    std::vector<bool> expected(boxes.size());
+    for (size_t i = 0; i < boxes.size(); ++i) {
+        expected[i] = !outside(boxes[i], planes, 2);
+    }
+    checkReported(reported, expected, line);
+}
+
+void checkRays(const Bvh& bvh, const std::vector<Bounds>& boxes,
+               uint32_t seed, int line) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    const float maxT = 100.0f;
+    auto hit = [&boxes](const Float3& o, const Float3& d, uint32_t prim,
+                        float limit) {
+        return slab(boxes[prim], o, d, limit);
+    };
+
+    for (int packet = 0; packet < 16; ++packet) {
+        Float3 origin[4];
+        Float3 direction[4];
+        float t4[4];
+        uint32_t closest4[4];
+        for (int r = 0; r < 4; ++r) {
+            origin[r] = { unit(rng) * 2.0f, unit(rng) * 2.0f, -3.0f };
+            direction[r] = { unit(rng) * 0.3f, unit(rng) * 0.3f, 1.0f };
+            t4[r] = maxT;
+        }
+        bvh.raycast4(origin, direction, t4, closest4,
+                     [&](uint32_t ray, uint32_t prim, float limit) {
+            return hit(origin[ray], direction[ray], prim, limit);
+        });
+
+        for (int r = 0; r < 4; ++r) {
+            float bestT = maxT;
+            for (size_t i = 0; i < boxes.size(); ++i) {
+                bestT = std::min(bestT,
+                                 slab(boxes[i], origin[r], direction[r],
+                                      maxT));
+            }
+            float t = maxT;
+            uint32_t closest = bvh.raycast(
+                origin[r], direction[r], maxT, t,
+                [&](uint32_t prim, float limit) {
+                    return hit(origin[r], direction[r], prim, limit);
+                });
+            CHECK_AT(t == bestT, "raycast finds the closest box", line);
+            CHECK_AT((closest == Bvh::kNoHit) == (bestT == maxT),
+                     "raycast reports a hit exactly when there is one",
+                     line);
+            CHECK_AT(t4[r] == bestT, "raycast4 finds the closest box", line);
+            CHECK_AT(closest4[r] == closest || t4[r] == t,
+                     "raycast4 agrees with raycast", line);
+        }
+    }
+}
+
+void testBuild() {
+    std::vector<Bounds> boxes = randomBoxes(5000, 1);
+    Bvh bvh;
+    bvh.build(boxes.data(), static_cast<uint32_t>(boxes.size()));
+    CHECK(bvh.primitiveCount() == boxes.size());
+    CHECK(bvh.nodeCount() > 1);
+    CHECK(bvh.cost() > 0.0f);
+    CHECK(bvh.stats().builds == 1);
+    checkQueries(bvh, boxes, 2, __LINE__);
+    checkRays(bvh, boxes, 3, __LINE__);
+}
+
+void testRefit() {
+    std::vector<Bounds> boxes = randomBoxes(5000, 4);
+    Bvh bvh;
+    bvh.build(boxes.data(), static_cast<uint32_t>(boxes.size()));
+
+    // Move a third of the boxes, then everything, a few frames each
+    std::mt19937 rng(5);
+    for (int frame = 0; frame < 8; ++frame) {
+        size_t step = frame < 4 ? 3 : 1;
+        for (size_t i = 0; i < boxes.size(); i += step) {
+            boxes[i] = randomBox(rng, 0.05f);
+        }
+        bvh.update(boxes.data());
+    }
+    CHECK(bvh.stats().refits == 8);
+    checkQueries(bvh, boxes, 6, __LINE__);
+    checkRays(bvh, boxes, 7, __LINE__);
+}
+
+void testSmallTrees() {
+    Bvh empty;
+    empty.build(nullptr, 0);
+    int calls = 0;
+    Bounds everything = { { -10, -10, -10 }, { 10, 10, 10 } };
+    empty.query(everything, [&calls](uint32_t) { ++calls; });
+    float t = 1.0f;
+    CHECK(empty.raycast({ 0, 0, -1 }, { 0, 0, 1 }, 1.0f, t,
+                        [](uint32_t, float) { return 0.0f; }) ==
+          Bvh::kNoHit);
+    CHECK(calls == 0);
+
+    Bounds one = { { -0.1f, -0.1f, -0.1f }, { 0.1f, 0.1f, 0.1f } };
+    Bvh single;
+    single.build(&one, 1);
+    single.query(everything, [&calls](uint32_t prim) { calls += prim + 1; });
+    CHECK(calls == 1);
+    t = 10.0f;
+    CHECK(single.raycast({ 0, 0, -1 }, { 0, 0, 1 }, 10.0f, t,
+                         [&one](uint32_t, float limit) {
+        return slab(one, { 0, 0, -1 }, { 0, 0, 1 }, limit);
+    }) == 0);
+    CHECK(std::fabs(t - 0.9f) < 1e-5f);
+}
+
+// -----------------------------------------------------------------------------
+double msSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+void bench(uint32_t count) {
+    int workers = std::max(1, static_cast<int>(
+                                  std::thread::hardware_concurrency()) - 1);
+    jobSystem().start(workers);
+    std::vector<Bounds> boxes = randomBoxes(count, 1);
+    std::cerr << count << " random boxes, " << workers << " workers"
+              << std::endl;
+
+    Bvh bvh;
+    auto start = std::chrono::steady_clock::now();
+    bvh.build(boxes.data(), count);
+    std::cerr << "  build " << msSince(start) << " ms, " << bvh.nodeCount()
+              << " nodes, cost " << bvh.cost() << std::endl;
+
+    // Boxes drift a little each frame, as instances do
+    std::mt19937 rng(2);
+    std::uniform_real_distribution<float> drift(-0.01f, 0.01f);
+    const int frames = 10;
+    for (uint32_t percent : { 10u, 50u, 100u }) {
+        uint32_t moved = static_cast<uint32_t>(uint64_t(count) * percent /
+                                               100);
+        uint64_t rebuilds = bvh.stats().rebuilds;
+        double ms = 0.0;
+        for (int frame = 0; frame < frames; ++frame) {
+            for (uint32_t i = 0; i < moved; ++i) {
+                Bounds& b = boxes[rng() % count];
+                Float3 d = { drift(rng), drift(rng), drift(rng) };
+                b = { b.min + d, b.max + d };
+            }
+            start = std::chrono::steady_clock::now();
+            bvh.update(boxes.data());
+            ms += msSince(start);
+        }
+        std::cerr << "  " << percent << "% moving: refit " << ms / frames
+                  << " ms, " << bvh.stats().rebuilds - rebuilds
+                  << " partial rebuilds, cost " << bvh.cost() << std::endl;
+    }
+
+    // Small boxes and a slab of the scene, through the tree and by scan
+    const int queries = 1000;
+    std::vector<Bounds> queryBoxes = randomBoxes(queries, 3);
+    uint64_t found = 0;
+    start = std::chrono::steady_clock::now();
+    for (const Bounds& box : queryBoxes) {
+        bvh.query(box, [&found](uint32_t) { ++found; });
+    }
+    double queryMs = msSince(start);
+    uint64_t scanned = 0;
+    start = std::chrono::steady_clock::now();
+    for (int q = 0; q < 10; ++q) {
+        for (const Bounds& b : boxes) scanned += overlaps(queryBoxes[q], b);
+    }
+    double scanMs = msSince(start) / 10;
+    std::cerr << "  query " << queryMs * 1000.0 / queries << " us ("
+              << found / queries << " reported), scan " << scanMs * 1000.0
+              << " us (" << scanned / 10 << ")" << std::endl;
+
+    Plane planes[2] = { { { 1.0f, 0.0f, 0.0f }, 0.2f },
+                        { { -1.0f, 0.0f, 0.0f }, 0.2f } };
+    found = 0;
+    start = std::chrono::steady_clock::now();
+    bvh.cull(planes, 2, [&found](uint32_t) { ++found; });
+    double cullMs = msSince(start);
+    scanned = 0;
+    start = std::chrono::steady_clock::now();
+    for (const Bounds& b : boxes) scanned += !outside(b, planes, 2);
+    std::cerr << "  cull " << cullMs << " ms (" << found
+              << " reported), scan " << msSince(start) << " ms ("
+              << scanned << ")" << std::endl;
+    jobSystem().stop();
+}
+
+} // namespace
+
+// -----------------------------------------------------------------------------
+int main(int argc, char* argv[]) {
+    if (argc == 3 && strcmp(argv[1], "--bench") == 0) {
+        bench(static_cast<uint32_t>(std::max(1, atoi(argv[2]))));
+        return 0;
+    }
+
+    testBuild();
+    testRefit();
+    testSmallTrees();
+    return testResult("bvh");
+}
@@ -0,0 +1,286 @@
+#include "command_buffer.h"
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef _WIN32
+#include "constant_cache.h"
+#include "gpu_resources.h"
+#include "upload_manager.h"
+#endif
+
+// -----------------------------------------------------------------------------
+void CommandBuffer::reset(uint32_t* storage, size_t capacityWords) {
+    words_ = storage;
+    size_ = 0;
+    capacity_ = storage != nullptr ? capacityWords : 0;
+    drawCount_ = 0;
+    overflowed_ = false;
+    vertexShader_ = 0;
+    pixelShader_ = 0;
+    inputLayout_ = 0;
+    topology_ = 0;
+    texture_ = 0;
+}
+
+void CommandBuffer::setVertexShader(VertexShaderHandle shader) {
+    if (shader.value == vertexShader_ || !reserve(2)) return;
+    vertexShader_ = shader.value;
+    header(kCmdSetVertexShader, 0);
+    push(shader.value);
+}
+
+void CommandBuffer::setPixelShader(PixelShaderHandle shader) {
+    if (shader.value == pixelShader_ || !reserve(2)) return;
+    pixelShader_ = shader.value;
+    header(kCmdSetPixelShader, 0);
+    push(shader.value);
+}
+
+void CommandBuffer::setInputLayout(InputLayoutHandle layout) {
+    if (layout.value == inputLayout_ || !reserve(2)) return;
+    inputLayout_ = layout.value;
+    header(kCmdSetInputLayout, 0);
+    push(layout.value);
+}
+
+void CommandBuffer::setVertexBuffer(uint32_t slot, BufferHandle buffer,
+                                    uint32_t stride, uint32_t offset) {
+    if (!fits(stride, kArgMax >> 4) || !reserve(3)) return;
+    header(kCmdSetVertexBuffer, (slot & 0xf) | (stride << 4));
+    push(buffer.value);
+    push(offset);
+}
+
+void CommandBuffer::setConstantBuffer(ShaderStage stage, uint32_t slot,
+                                      BufferHandle buffer) {
+    if (!reserve(2)) return;
+    header(kCmdSetConstantBuffer, (slot & 0xf) | (stage << 4));
+    push(buffer.value);
+}
+
+void CommandBuffer::setTopology(uint32_t topology) {
+    if (topology == topology_ || !fits(topology, kArgMax) || !reserve(1)) {
+        return;
+    }
+    topology_ = topology;
+    header(kCmdSetTopology, topology);
+}
+
+void CommandBuffer::setTexture(uint32_t slot, TextureHandle texture) {
+    if ((slot == 0 && texture.value == texture_) || !reserve(2)) return;
+    if (slot == 0) texture_ = texture.value;
+    header(kCmdSetTexture, slot);
+    push(texture.value);
+}
+
+void CommandBuffer::setSampler(uint32_t slot, SamplerHandle sampler) {
+    if (!reserve(2)) return;
+    header(kCmdSetSampler, slot);
+    push(sampler.value);
+}
+
+void CommandBuffer::updateBuffer(BufferHandle buffer, const void* data,
+                                 uint32_t bytes, uint32_t offset) {
+    update(kCmdUpdateBuffer, buffer, data, bytes, offset);
+}
+
+void CommandBuffer::updateConstants(BufferHandle buffer, const void* data,
+                                    uint32_t bytes, uint32_t offset) {
+    update(kCmdUpdateConstants, buffer, data, bytes, offset);
+}
+
+void CommandBuffer::update(CommandOp op, BufferHandle buffer,
+                           const void* data, uint32_t bytes,
+                           uint32_t offset) {
+    // An empty update changes nothing; recording it would also zero the
+    // word before the (missing) payload
+    if (bytes == 0) return;
+    size_t payloadWords = (bytes + 3) / 4;
+    if (!fits(bytes, kArgMax) || !reserve(3 + payloadWords)) return;
+    header(op, bytes);
+    push(buffer.value);
+    push(offset);
+
+    words_[size_ + payloadWords - 1] = 0;    // padding of a partial word
+    memcpy(words_ + size_, data, bytes);
+    size_ += payloadWords;
+}
+
+void CommandBuffer::clear(const float color[4]) {
+    uint32_t packed = 0;
+    for (int i = 0; i < 4; ++i) {
+        float c = std::min(1.0f, std::max(0.0f, color[i]));
+        packed |= static_cast<uint32_t>(c * 255.0f + 0.5f) << (i * 8);
+    }
+    if (!reserve(2)) return;
+    header(kCmdClear, 0);
+    push(packed);
+}
+
+void CommandBuffer::draw(uint32_t vertexCount, uint32_t startVertex) {
+    if (!fits(vertexCount, kArgMax >> 1) ||
+        !reserve(startVertex != 0 ? 2 : 1)) {
+        return;
+    }
+    ++drawCount_;
+    header(kCmdDraw, (vertexCount << 1) | (startVertex != 0 ? 1 : 0));
+    if (startVertex != 0) push(startVertex);
+}
+
+void CommandBuffer::drawInstanced(uint32_t vertexCount, uint32_t instanceCount,
+                                  uint32_t startVertex,
+                                  uint32_t startInstance) {
+    if (!fits(vertexCount, kArgMax) || !reserve(4)) return;
+    ++drawCount_;
+    header(kCmdDrawInstanced, vertexCount);
+    push(instanceCount);
+    push(startVertex);
+    push(startInstance);
+}
+
+void recordDraws(CommandBuffer& commands, TexturedDraw* draws, size_t count) {
+    std::stable_sort(draws, draws + count,
+                     [](const TexturedDraw& a, const TexturedDraw& b) {
+                         return a.texture.value < b.texture.value;
+                     });
+    for (size_t i = 0; i < count; ++i) {
+        const TexturedDraw& d = draws[i];
+        commands.setTexture(0, d.texture);
+        commands.drawInstanced(d.vertexCount, d.instanceCount, d.startVertex,
+                               d.startInstance);
+    }
+}
+
+// -----------------------------------------------------------------------------
+#ifdef _WIN32
+
+void executeCommands(const CommandBuffer& commands,
+                     ID3D11DeviceContext* context,
+                     const GpuResources& resources,
+                     ID3D11RenderTargetView* renderTarget,
+                     UploadManager& uploads,
+                     ConstantCache& constants) {
+    const uint32_t* word = commands.data();
+    const uint32_t* end = word + commands.sizeWords();
+
+    while (word < end) {
+        uint32_t op = *word & ((1u << CommandBuffer::kOpBits) - 1);
+        uint32_t arg = *word >> CommandBuffer::kOpBits;
+        ++word;
+
+        switch (op) {
+        case kCmdSetVertexShader: {
+            VertexShaderHandle handle = { word[0] };
+            context->VSSetShader(resolve(resources.vertexShaders, handle),
+                                 nullptr, 0);
+            word += 1;
+            break;
+        }
+        case kCmdSetPixelShader: {
+            PixelShaderHandle handle = { word[0] };
+            context->PSSetShader(resolve(resources.pixelShaders, handle),
+                                 nullptr, 0);
+            word += 1;
+            break;
+        }
+        case kCmdSetInputLayout: {
+            InputLayoutHandle handle = { word[0] };
+            context->IASetInputLayout(resolve(resources.inputLayouts, handle));
+            word += 1;
+            break;
+        }
+        case kCmdSetVertexBuffer: {
+            BufferHandle handle = { word[0] };
+            ID3D11Buffer* buffer = resolve(resources.buffers, handle);
+            UINT stride = arg >> 4;
+            UINT offset = word[1];
+            context->IASetVertexBuffers(arg & 0xf, 1, &buffer, &stride,
+                                        &offset);
+            word += 2;
+            break;
+        }
+        case kCmdSetConstantBuffer: {
+            BufferHandle handle = { word[0] };
+            word += 1;
+            if (!constants.bind(arg >> 4, arg & 0xf, handle)) break;
+
+            ID3D11Buffer* buffer = resolve(resources.buffers, handle);
+            if ((arg >> 4) == kStageVertex) {
+                context->VSSetConstantBuffers(arg & 0xf, 1, &buffer);
+            } else {
+                context->PSSetConstantBuffers(arg & 0xf, 1, &buffer);
+            }
+            break;
+        }
+        case kCmdSetTopology:
+            context->IASetPrimitiveTopology(
+                static_cast<D3D11_PRIMITIVE_TOPOLOGY>(arg));
+            break;
+        case kCmdSetTexture: {
+            TextureHandle handle = { word[0] };
+            ID3D11ShaderResourceView* view =
+                resolve(resources.textures, handle);
+            context->PSSetShaderResources(arg, 1, &view);
+            word += 1;
+            break;
+        }
+        case kCmdSetSampler: {
+            SamplerHandle handle = { word[0] };
+            ID3D11SamplerState* sampler = resolve(resources.samplers, handle);
+            context->PSSetSamplers(arg, 1, &sampler);
+            word += 1;
+            break;
+        }
+        case kCmdUpdateBuffer: {
+            BufferHandle handle = { word[0] };
+            ID3D11Buffer* buffer = resolve(resources.buffers, handle);
+            uploads.enqueue(buffer, word[1], word + 2, arg);
+            word += 2 + (arg + 3) / 4;
+            break;
+        }
+        case kCmdUpdateConstants: {
+            BufferHandle handle = { word[0] };
+            ID3D11Buffer* buffer = resolve(resources.buffers, handle);
+            if (buffer != nullptr &&
+                constants.update(handle, word[1], word + 2, arg)) {
+                uploads.enqueue(buffer, word[1], word + 2, arg);
+            }
+            word += 2 + (arg + 3) / 4;
+            break;
+        }
+        case kCmdClear: {
+            float color[4];
+            for (int i = 0; i < 4; ++i) {
+                color[i] = ((word[0] >> (i * 8)) & 0xff) / 255.0f;
+            }
+            context->ClearRenderTargetView(renderTarget, color);
+            word += 1;
+            break;
+        }
+        case kCmdDraw: {
+            uploads.flush(context);
+            UINT start = 0;
+            if (arg & 1) {
+                start = word[0];
+                word += 1;
+            }
+            context->Draw(arg >> 1, start);
+            break;
+        }
+        case kCmdDrawInstanced:
+            uploads.flush(context);
+            context->DrawInstanced(arg, word[0], word[1], word[2]);
+            word += 3;
+            break;
+        default:
+            // Corrupt stream; stop rather than misinterpret the rest
+            uploads.flush(context);
+            return;
+        }
+    }
+
+    uploads.flush(context);
+}
+
+#endif
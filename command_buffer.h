@@ -0,0 +1,141 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "gpu_handles.h"
+
+struct GpuResources;
+struct ID3D11DeviceContext;
+struct ID3D11RenderTargetView;
+class ConstantCache;
+class UploadManager;
+
+// -----------------------------------------------------------------------------
+// Recorded frame commands in a compact word stream. Every command starts with
+// a 32-bit header: the low 6 bits are the opcode, the upper 26 bits carry the
+// command's most common argument (vertex count, stride, byte count, ...).
+// Handles follow as full 32-bit words so they are still validated on
+// replay. A non-indexed draw starting at vertex 0 is a single word; with a
+// start vertex it is two. The recorder also drops binds that would not
+// change state, so a typical draw costs 8-16 bytes in total.
+//
+// Storage is supplied by the caller (normally the frame arena) and never
+// grows; commands that do not fit are dropped and overflowed() is set, as
+// are commands whose header argument does not fit its bits. Recording has
+// no D3D11 dependency; only executeCommands() needs the device.
+enum CommandOp : uint32_t {
+    kCmdSetVertexShader,         // handle
+    kCmdSetPixelShader,          // handle
+    kCmdSetInputLayout,          // handle
+    kCmdSetVertexBuffer,         // A = slot | stride << 4; handle, offset
+    kCmdSetConstantBuffer,       // A = slot | stage << 4; handle
+    kCmdSetTopology,             // A = D3D11_PRIMITIVE_TOPOLOGY
+    kCmdUpdateBuffer,            // A = byte count; handle, offset, payload
+    kCmdUpdateConstants,         // as kCmdUpdateBuffer, deduplicated
+    kCmdClear,                   // A = unused; RGBA8 clear color
+    kCmdDraw,                    // A = vertex count << 1 | has start; [start]
+    kCmdDrawInstanced,           // A = vertex count; instances, start, start
+    kCmdSetTexture,              // A = pixel shader slot; handle
+    kCmdSetSampler,              // A = pixel shader slot; handle
+    kCmdOpCount
+};
+
+enum ShaderStage : uint32_t {
+    kStageVertex,
+    kStagePixel,
+};
+
+class CommandBuffer {
+ public:
+    static constexpr uint32_t kOpBits = 6;
+    static constexpr uint32_t kArgMax = (1u << (32 - kOpBits)) - 1;
+
+    void reset(uint32_t* storage, size_t capacityWords);
+
+    void setVertexShader(VertexShaderHandle shader);
+    void setPixelShader(PixelShaderHandle shader);
+    void setInputLayout(InputLayoutHandle layout);
+    void setVertexBuffer(uint32_t slot, BufferHandle buffer, uint32_t stride,
+                         uint32_t offset);
+    void setConstantBuffer(ShaderStage stage, uint32_t slot,
+                           BufferHandle buffer);
+    void setTopology(uint32_t topology);     // D3D11_PRIMITIVE_TOPOLOGY
+    // Pixel shader texture and sampler slots
+    void setTexture(uint32_t slot, TextureHandle texture);
+    void setSampler(uint32_t slot, SamplerHandle sampler);
+    void updateBuffer(BufferHandle buffer, const void* data, uint32_t bytes,
+                      uint32_t offset = 0);
+    // Constant data is hashed on replay; if the block still holds the same
+    // bytes the upload is skipped.
+    void updateConstants(BufferHandle buffer, const void* data,
+                         uint32_t bytes, uint32_t offset = 0);
+    void clear(const float color[4]);
+    void draw(uint32_t vertexCount, uint32_t startVertex = 0);
+    void drawInstanced(uint32_t vertexCount, uint32_t instanceCount,
+                       uint32_t startVertex = 0, uint32_t startInstance = 0);
+
+    const uint32_t* data() const { return words_; }
+    size_t sizeWords() const { return size_; }
+    size_t sizeBytes() const { return size_ * sizeof(uint32_t); }
+    uint32_t drawCount() const { return drawCount_; }
+    bool overflowed() const { return overflowed_; }
+
+ private:
+    bool reserve(size_t words) {
+        if (size_ + words <= capacity_) return true;
+        overflowed_ = true;
+        return false;
+    }
+    // Arguments wider than their header field drop the command
+    bool fits(uint32_t arg, uint32_t max) {
+        if (arg <= max) return true;
+        overflowed_ = true;
+        return false;
+    }
+    void push(uint32_t word) { words_[size_++] = word; }
+    void header(CommandOp op, uint32_t arg) {
+        push(static_cast<uint32_t>(op) | (arg << kOpBits));
+    }
+    void update(CommandOp op, BufferHandle buffer, const void* data,
+                uint32_t bytes, uint32_t offset);
+
+    uint32_t* words_ = nullptr;
+    size_t size_ = 0;
+    size_t capacity_ = 0;
+    uint32_t drawCount_ = 0;
+    bool overflowed_ = false;
+
+    // Last recorded binds, for redundant-state filtering
+    uint32_t vertexShader_ = 0;
+    uint32_t pixelShader_ = 0;
+    uint32_t inputLayout_ = 0;
+    uint32_t topology_ = 0;
+    uint32_t texture_ = 0;       // in slot 0, the only one filtered
+};
+
+// One instanced draw and the texture it samples in pixel shader slot 0
+struct TexturedDraw {
+    TextureHandle texture;
+    uint32_t vertexCount;
+    uint32_t instanceCount;
+    uint32_t startVertex;
+    uint32_t startInstance;
+};
+
+// Records the draws grouped by texture, keeping their order within a
+// texture, so each texture is bound once rather than at every change. Only
+// for draws whose order does not matter. Sorts `draws` in place.
+void recordDraws(CommandBuffer& commands, TexturedDraw* draws, size_t count);
+
+// Replays the buffer on the immediate context. `renderTarget` is the view
+// kCmdClear clears. Stale handles are skipped. Buffer updates are queued on
+// `uploads` and flushed as one batch before the next draw, so updates
+// recorded up front cost a single staging copy per destination range.
+// `constants` filters constant uploads and binds the GPU already has.
+void executeCommands(const CommandBuffer& commands,
+                     ID3D11DeviceContext* context,
+                     const GpuResources& resources,
+                     ID3D11RenderTargetView* renderTarget,
+                     UploadManager& uploads,
+                     ConstantCache& constants);
@@ -0,0 +1,453 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include "command_buffer.h"
+#include "test_check.h"
+
+// -----------------------------------------------------------------------------
+// Tests for the CommandBuffer encoder: word layout of each command, padding
+// of partial payload words, empty updates, redundant-bind filtering, and
+// overflow on full storage or on arguments wider than the header. Replay
+// needs D3D11, so commands are decoded here as executeCommands() reads
+// them. With --bench it records and decodes that many draws a frame
+// against a struct per command, as a conventional command list stores them,
+// and with the draws grouped by texture through recordDraws().
+//
+//   CommandBufferTest [--bench <draws>]
+namespace {
+
+struct Decoded {
+    uint32_t op;
+    uint32_t arg;
+    std::vector<uint32_t> operands;
+};
+
+// Operand words after the header, as executeCommands() advances
+uint32_t operandWords(uint32_t op, uint32_t arg) {
+    switch (op) {
+    case kCmdSetVertexShader:
+    case kCmdSetPixelShader:
+    case kCmdSetInputLayout:
+    case kCmdSetConstantBuffer:
+    case kCmdSetTexture:
+    case kCmdSetSampler:
+    case kCmdClear:
+        return 1;
+    case kCmdSetVertexBuffer:
+        return 2;
+    case kCmdSetTopology:
+        return 0;
+    case kCmdUpdateBuffer:
+    case kCmdUpdateConstants:
+        return 2 + (arg + 3) / 4;
+    case kCmdDraw:
+        return arg & 1;
+    case kCmdDrawInstanced:
+        return 3;
+    default:
+        return 0;
+    }
+}
+
+std::vector<Decoded> decode(const CommandBuffer& commands) {
+    std::vector<Decoded> decoded;
+    const uint32_t* word = commands.data();
+    const uint32_t* end = word + commands.sizeWords();
+    while (word < end) {
+        Decoded d;
+        d.op = *word & ((1u << CommandBuffer::kOpBits) - 1);
+        d.arg = *word >> CommandBuffer::kOpBits;
+        ++word;
+        uint32_t count = operandWords(d.op, d.arg);
+        if (d.op >= kCmdOpCount || word + count > end) {
+            d.op = kCmdOpCount;          // corrupt
+            decoded.push_back(d);
+            break;
+        }
+        d.operands.assign(word, word + count);
+        word += count;
+        decoded.push_back(d);
+    }
+    return decoded;
+}
+
+template <typename Handle>
+Handle handle(uint32_t value) {
+    Handle h;
+    h.value = value;
+    return h;
+}
+
+void testDrawLayout() {
+    std::vector<uint32_t> storage(64);
+    CommandBuffer commands;
+    commands.reset(storage.data(), storage.size());
+    commands.draw(3);
+    commands.draw(6, 12);
+    commands.drawInstanced(36, 100, 5, 7);
+    CHECK(commands.sizeWords() == 1 + 2 + 4);
+    CHECK(commands.drawCount() == 3);
+
+    std::vector<Decoded> d = decode(commands);
+    CHECK(d.size() == 3);
+    CHECK(d[0].op == kCmdDraw && d[0].arg == (3u << 1));
+    CHECK(d[1].op == kCmdDraw && d[1].arg == ((6u << 1) | 1) &&
+          d[1].operands[0] == 12);
+    CHECK(d[2].op == kCmdDrawInstanced && d[2].arg == 36 &&
+          d[2].operands == std::vector<uint32_t>({ 100, 5, 7 }));
+}
+
+void testUpdatePayload() {
+    std::vector<uint32_t> storage(64, 0xCDCDCDCD);
+    CommandBuffer commands;
+    commands.reset(storage.data(), storage.size());
+    const uint8_t bytes[6] = { 1, 2, 3, 4, 5, 6 };
+    BufferHandle buffer = handle<BufferHandle>(0x1234);
+    commands.updateBuffer(buffer, bytes, sizeof(bytes), 16);
+    CHECK(commands.sizeWords() == 3 + 2);
+
+    std::vector<Decoded> d = decode(commands);
+    CHECK(d.size() == 1 && d[0].op == kCmdUpdateBuffer && d[0].arg == 6);
+    CHECK(d[0].operands[0] == 0x1234 && d[0].operands[1] == 16);
+    CHECK(memcmp(&d[0].operands[2], bytes, sizeof(bytes)) == 0);
+    // The partial last word is padded with zeros, not left as it was
+    const uint8_t* tail = reinterpret_cast<const uint8_t*>(&d[0].operands[3]);
+    CHECK(tail[2] == 0 && tail[3] == 0);
+}
+
+// An empty update records nothing and leaves the previous command intact
+void testEmptyUpdate() {
+    std::vector<uint32_t> storage(64);
+    CommandBuffer commands;
+    commands.reset(storage.data(), storage.size());
+    commands.draw(6, 12);
+    size_t before = commands.sizeWords();
+    commands.updateConstants(handle<BufferHandle>(7), nullptr, 0, 0);
+    commands.updateBuffer(handle<BufferHandle>(7), nullptr, 0, 0);
+    CHECK(commands.sizeWords() == before);
+    CHECK(!commands.overflowed());
+    std::vector<Decoded> d = decode(commands);
+    CHECK(d.size() == 1 && d[0].operands[0] == 12);
+}
+
+void testRedundantBinds() {
+    std::vector<uint32_t> storage(64);
+    CommandBuffer commands;
+    commands.reset(storage.data(), storage.size());
+    VertexShaderHandle shader = handle<VertexShaderHandle>(3);
+    TextureHandle a = handle<TextureHandle>(5);
+    TextureHandle b = handle<TextureHandle>(6);
+    commands.setVertexShader(shader);
+    commands.setVertexShader(shader);
+    commands.setTopology(4);
+    commands.setTopology(4);
+    commands.setTexture(0, a);
+    commands.setTexture(0, a);
+    commands.setTexture(0, b);
+    commands.setTexture(1, b);           // other slots are never filtered
+    commands.setTexture(1, b);
+
+    std::vector<Decoded> d = decode(commands);
+    CHECK(d.size() == 6);
+    CHECK(d[0].op == kCmdSetVertexShader && d[0].operands[0] == 3);
+    CHECK(d[1].op == kCmdSetTopology && d[1].arg == 4);
+    CHECK(d[2].op == kCmdSetTexture && d[2].operands[0] == 5);
+    CHECK(d[3].op == kCmdSetTexture && d[3].operands[0] == 6);
+    CHECK(d[4].arg == 1 && d[5].arg == 1);
+
+    // reset() forgets the filter state
+    commands.reset(storage.data(), storage.size());
+    commands.setVertexShader(shader);
+    CHECK(commands.sizeWords() == 2);
+}
+
+// Grouped by texture, in submission order within each
+void testRecordDraws() {
+    std::vector<uint32_t> storage(256);
+    CommandBuffer commands;
+    commands.reset(storage.data(), storage.size());
+    const uint32_t textures[] = { 7, 5, 7, 5, 9, 5 };
+    std::vector<TexturedDraw> draws;
+    for (uint32_t i = 0; i < 6; ++i) {
+        draws.push_back({ handle<TextureHandle>(textures[i]), 36, 1, 0, i });
+    }
+    recordDraws(commands, draws.data(), draws.size());
+
+    std::vector<Decoded> d = decode(commands);
+    const uint32_t expected[][2] = {
+        { kCmdSetTexture, 5 }, { kCmdDrawInstanced, 1 },
+        { kCmdDrawInstanced, 3 }, { kCmdDrawInstanced, 5 },
+        { kCmdSetTexture, 7 }, { kCmdDrawInstanced, 0 },
+        { kCmdDrawInstanced, 2 }, { kCmdSetTexture, 9 },
+        { kCmdDrawInstanced, 4 },
+    };
+    bool grouped = d.size() == 9;
+    for (size_t i = 0; grouped && i < 9; ++i) {
+        uint32_t operand = d[i].op == kCmdSetTexture ? d[i].operands[0]
+                                                     : d[i].operands[2];
+        grouped = d[i].op == expected[i][0] && operand == expected[i][1];
+    }
+    CHECK(grouped);
+    CHECK(commands.drawCount() == 6);
+
+    // A texture still bound from earlier draws is not bound again
+    commands.reset(storage.data(), storage.size());
+    commands.setTexture(0, handle<TextureHandle>(5));
+    recordDraws(commands, draws.data(), 1);
+    d = decode(commands);
+    CHECK(d.size() == 2 && d[1].op == kCmdDrawInstanced);
+    recordDraws(commands, nullptr, 0);
+    CHECK(commands.drawCount() == 1);
+}
+
+void testOverflow() {
+    std::vector<uint32_t> storage(4);
+    CommandBuffer commands;
+    commands.reset(storage.data(), storage.size());
+    commands.drawInstanced(3, 1);
+    CHECK(!commands.overflowed() && commands.sizeWords() == 4);
+    commands.draw(3);
+    CHECK(commands.overflowed());
+    CHECK(commands.sizeWords() == 4 && commands.drawCount() == 1);
+
+    // No storage at all
+    commands.reset(nullptr, 16);
+    commands.draw(3);
+    CHECK(commands.overflowed() && commands.sizeWords() == 0);
+}
+
+// Arguments wider than the header are dropped, not masked
+void testWideArguments() {
+    std::vector<uint32_t> storage(64);
+    CommandBuffer commands;
+    commands.reset(storage.data(), storage.size());
+    commands.draw(CommandBuffer::kArgMax >> 1);
+    CHECK(!commands.overflowed() && commands.drawCount() == 1);
+    commands.draw((CommandBuffer::kArgMax >> 1) + 1);
+    CHECK(commands.overflowed() && commands.drawCount() == 1);
+
+    commands.reset(storage.data(), storage.size());
+    commands.drawInstanced(CommandBuffer::kArgMax + 1, 1);
+    CHECK(commands.overflowed() && commands.sizeWords() == 0);
+
+    commands.reset(storage.data(), storage.size());
+    commands.setVertexBuffer(0, handle<BufferHandle>(1), 1u << 24, 0);
+    CHECK(commands.overflowed() && commands.sizeWords() == 0);
+
+    commands.reset(storage.data(), storage.size());
+    commands.setVertexBuffer(1, handle<BufferHandle>(1), 64, 128);
+    std::vector<Decoded> d = decode(commands);
+    CHECK(!commands.overflowed() && d.size() == 1);
+    CHECK((d[0].arg & 0xf) == 1 && (d[0].arg >> 4) == 64);
+    CHECK(d[0].operands[1] == 128);
+}
+
+// -----------------------------------------------------------------------------
+double msSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+// One command per struct, with room for the widest command's arguments and
+// the update payload stored beside the list
+struct StructCommand {
+    CommandOp op;
+    uint32_t handle;
+    uint32_t args[4];
+    uint32_t payloadOffset;
+    uint32_t payloadBytes;
+};
+
+struct StructCommandList {
+    std::vector<StructCommand> commands;
+    std::vector<uint8_t> payload;
+    uint32_t texture = 0;
+
+    void clear() {
+        commands.clear();
+        payload.clear();
+        texture = 0;
+    }
+    void updateConstants(BufferHandle buffer, const void* data,
+                         uint32_t bytes) {
+        uint32_t offset = static_cast<uint32_t>(payload.size());
+        const uint8_t* p = static_cast<const uint8_t*>(data);
+        payload.insert(payload.end(), p, p + bytes);
+        commands.push_back({ kCmdUpdateConstants, buffer.value, { 0 },
+                             offset, bytes });
+    }
+    void setTexture(uint32_t slot, TextureHandle handle) {
+        if (slot == 0 && handle.value == texture) return;
+        if (slot == 0) texture = handle.value;
+        commands.push_back({ kCmdSetTexture, handle.value, { slot }, 0, 0 });
+    }
+    void drawInstanced(uint32_t vertexCount, uint32_t instanceCount,
+                       uint32_t startVertex, uint32_t startInstance) {
+        commands.push_back({ kCmdDrawInstanced, 0,
+                             { vertexCount, instanceCount, startVertex,
+                               startInstance }, 0, 0 });
+    }
+};
+
+// A frame as the renderer records it: constants, then runs of draws that
+// share a texture
+template <typename Recorder>
+void recordFrame(Recorder& recorder, uint32_t draws, uint32_t frame) {
+    float constants[16] = { float(frame) };
+    recorder.updateConstants(handle<BufferHandle>(1), constants,
+                             sizeof(constants));
+    for (uint32_t d = 0; d < draws; ++d) {
+        recorder.setTexture(0, handle<TextureHandle>(2 + d / 4 % 16));
+        recorder.drawInstanced(36 + d % 3 * 12, 1 + d % 7, d * 36, d * 8);
+    }
+}
+
+// The same frame collected first and recorded by recordDraws(), as the
+// renderer now records its instances
+void recordSortedFrame(CommandBuffer& commands,
+                       std::vector<TexturedDraw>& scratch, uint32_t draws,
+                       uint32_t frame) {
+    float constants[16] = { float(frame) };
+    commands.updateConstants(handle<BufferHandle>(1), constants,
+                             sizeof(constants));
+    scratch.clear();
+    for (uint32_t d = 0; d < draws; ++d) {
+        scratch.push_back({ handle<TextureHandle>(2 + d / 4 % 16),
+                            36 + d % 3 * 12, 1 + d % 7, d * 36, d * 8 });
+    }
+    recordDraws(commands, scratch.data(), scratch.size());
+}
+
+// Replays by summing what the context would receive
+uint64_t replay(const CommandBuffer& commands) {
+    uint64_t sum = 0;
+    const uint32_t* word = commands.data();
+    const uint32_t* end = word + commands.sizeWords();
+    while (word < end) {
+        uint32_t op = *word & ((1u << CommandBuffer::kOpBits) - 1);
+        uint32_t arg = *word >> CommandBuffer::kOpBits;
+        ++word;
+        switch (op) {
+        case kCmdUpdateConstants:
+            sum += word[0] + word[2];
+            word += 2 + (arg + 3) / 4;
+            break;
+        case kCmdSetTexture:
+            sum += word[0] + arg;
+            word += 1;
+            break;
+        case kCmdDrawInstanced:
+            sum += arg + word[0] + word[1] + word[2];
+            word += 3;
+            break;
+        default:
+            word += operandWords(op, arg);
+            break;
+        }
+    }
+    return sum;
+}
+
+uint64_t replay(const StructCommandList& list) {
+    uint64_t sum = 0;
+    for (const StructCommand& c : list.commands) {
+        switch (c.op) {
+        case kCmdUpdateConstants: {
+            uint32_t first;
+            memcpy(&first, &list.payload[c.payloadOffset], sizeof(first));
+            sum += c.handle + first;
+            break;
+        }
+        case kCmdSetTexture:
+            sum += c.handle + c.args[0];
+            break;
+        case kCmdDrawInstanced:
+            sum += c.args[0] + c.args[1] + c.args[2] + c.args[3];
+            break;
+        default:
+            break;
+        }
+    }
+    return sum;
+}
+
+void bench(uint32_t draws) {
+    const uint32_t frames = 200;
+    std::vector<uint32_t> storage(size_t(draws) * 8 + 64);
+    CommandBuffer commands;
+    StructCommandList list;
+    CommandBuffer sorted;
+    std::vector<TexturedDraw> scratch;
+
+    double recordMs[3] = {};
+    double replayMs[3] = {};
+    uint64_t sums[3] = {};
+    size_t bytes[3] = {};
+    for (uint32_t f = 0; f < frames; ++f) {
+        auto start = std::chrono::steady_clock::now();
+        commands.reset(storage.data(), storage.size());
+        recordFrame(commands, draws, f);
+        recordMs[0] += msSince(start);
+        start = std::chrono::steady_clock::now();
+        sums[0] += replay(commands);
+        replayMs[0] += msSince(start);
+        bytes[0] = commands.sizeBytes();
+
+        start = std::chrono::steady_clock::now();
+        list.clear();
+        recordFrame(list, draws, f);
+        recordMs[1] += msSince(start);
+        start = std::chrono::steady_clock::now();
+        sums[1] += replay(list);
+        replayMs[1] += msSince(start);
+        bytes[1] = list.commands.size() * sizeof(StructCommand) +
+                   list.payload.size();
+
+        start = std::chrono::steady_clock::now();
+        sorted.reset(storage.data(), storage.size());
+        recordSortedFrame(sorted, scratch, draws, f);
+        recordMs[2] += msSince(start);
+        start = std::chrono::steady_clock::now();
+        sums[2] += replay(sorted);
+        replayMs[2] += msSince(start);
+        bytes[2] = sorted.sizeBytes();
+    }
+
+    std::cerr << draws << " draws a frame, " << frames << " frames"
+              << (commands.overflowed() || sorted.overflowed()
+                      ? ", OVERFLOWED" : "") << std::endl;
+    const char* names[3] = { "word stream", "struct per command",
+                             "word stream, sorted by texture" };
+    for (int i = 0; i < 3; ++i) {
+        std::cerr << "  " << names[i] << ": " << bytes[i] << " bytes ("
+                  << double(bytes[i]) / draws << " per draw), record "
+                  << recordMs[i] * 1e6 / (double(frames) * draws)
+                  << " ns, replay "
+                  << replayMs[i] * 1e6 / (double(frames) * draws)
+                  << " ns per draw (sum " << sums[i] << ")" << std::endl;
+    }
+}
+
+} // namespace
+
+// -----------------------------------------------------------------------------
+int main(int argc, char* argv[]) {
+    if (argc == 3 && strcmp(argv[1], "--bench") == 0) {
+        bench(static_cast<uint32_t>(std::max(1, atoi(argv[2]))));
+        return 0;
+    }
+
+    testDrawLayout();
+    testUpdatePayload();
+    testEmptyUpdate();
+    testRedundantBinds();
+    testRecordDraws();
+    testOverflow();
+    testWideArguments();
+    return testResult("command_buffer");
+}
@@ -0,0 +1,41 @@
+#include "constant_cache.h"
+
+#include "content_hash.h"
+
+// -----------------------------------------------------------------------------
+bool ConstantCache::update(BufferHandle buffer, uint32_t offset,
+                           const void* data, uint32_t bytes) {
+    ++stats_.lookups;
+
+    uint64_t key = static_cast<uint64_t>(buffer.value) << 32 | offset;
+    uint64_t hash = contentHash(data, bytes);
+
+    Block& block = blocks_[key];
+    if (block.bytes == bytes && block.hash == hash) {
+        ++stats_.hits;
+        stats_.bytesSkipped += bytes;
+        return false;
+    }
+    block.hash = hash;
+    block.bytes = bytes;
+    return true;
+}
+
+bool ConstantCache::bind(uint32_t stage, uint32_t slot, BufferHandle buffer) {
+    ++stats_.binds;
+    if (stage >= kStages || slot >= kSlots) return true;
+
+    if (bound_[stage][slot] == buffer.value) {
+        ++stats_.bindsSkipped;
+        return false;
+    }
+    bound_[stage][slot] = buffer.value;
+    return true;
+}
+
+void ConstantCache::invalidate() {
+    blocks_.clear();
+    for (auto& stage : bound_) {
+        for (uint32_t& slot : stage) slot = 0;
+    }
+}
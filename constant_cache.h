@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+
+#include "gpu_handles.h"
+
+// -----------------------------------------------------------------------------
+// Remembers what the GPU already has for each constant block so unchanged
+// data is neither uploaded nor rebound. Blocks are keyed by buffer handle and
+// byte offset; handles carry a generation, so a recycled slot never matches
+// a stale entry. Bindings are tracked per stage and slot. Blocks must only
+// be written through the cache, or it goes stale.
+//
+// Context-thread only: the cache mirrors the immediate context's state.
+struct ConstantCacheStats {
+    uint64_t lookups = 0;
+    uint64_t hits = 0;           // uploads skipped
+    uint64_t bytesSkipped = 0;
+    uint64_t binds = 0;
+    uint64_t bindsSkipped = 0;
+};
+
+class ConstantCache {
+ public:
+    static constexpr uint32_t kStages = 2;
+    static constexpr uint32_t kSlots = 16;
+
+    // True if `data` differs from the last upload to this block, in which
+    // case it is recorded as the block's new contents.
+    bool update(BufferHandle buffer, uint32_t offset, const void* data,
+                uint32_t bytes);
+
+    // True if the slot is not already bound to `buffer`
+    bool bind(uint32_t stage, uint32_t slot, BufferHandle buffer);
+
+    // Forget everything, e.g. after the context state was cleared
+    void invalidate();
+
+    const ConstantCacheStats& stats() const { return stats_; }
+
+ private:
+    struct Block {
+        uint64_t hash;
+        uint32_t bytes;
+    };
+
+    std::unordered_map<uint64_t, Block> blocks_;
+    uint32_t bound_[kStages][kSlots] = {};
+    ConstantCacheStats stats_;
+};
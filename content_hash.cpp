@@ -0,0 +1,168 @@
+#include "content_hash.h"
+
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CONTENT_HASH_SSE2 1
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define CONTENT_HASH_NEON 1
+#endif
+
+namespace {
+
+constexpr size_t kStripeBytes = 64;
+constexpr size_t kLanes = kStripeBytes / sizeof(uint64_t);
+
+constexpr uint64_t kPrime1 = 0x9E3779B185EBCA87ull;
+constexpr uint64_t kPrime2 = 0xC2B2AE3D27D4EB4Full;
+constexpr uint64_t kPrime3 = 0x165667B19E3779F9ull;
+
+alignas(16) constexpr uint64_t kSecret[kLanes] = {
+    0xbe4ba423396cfeb8ull, 0x1cad21f72c81017cull,
+    0xdb979083e96dd4deull, 0x1f67b3b7a4a44072ull,
+    0x78e5c0cc4ee679cbull, 0x2172ffcc7dd05a82ull,
+    0x8e2443f7744608b8ull, 0x4c263a81e69035e0ull,
+};
+
+// Added to every key lane after each stripe
+constexpr uint64_t kKeyStep = kPrime2;
+
+uint64_t rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+uint64_t load64(const uint8_t* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// One stripe: acc[j] += data[j ^ 1] + lo32(dk) * hi32(dk), dk = data ^ key.
+// This is the definition; the SIMD versions must match it bit for bit.
+void accumulateScalar(uint64_t* acc, const uint8_t* data, size_t stripes,
+                      uint64_t* key) {
+    for (size_t s = 0; s < stripes; ++s, data += kStripeBytes) {
+        for (size_t j = 0; j < kLanes; ++j) {
+            uint64_t dk = load64(data + 8 * j) ^ key[j];
+            acc[j] += load64(data + 8 * (j ^ 1)) +
+                      (dk & 0xffffffffull) * (dk >> 32);
+            key[j] += kKeyStep;
+        }
+    }
+}
+
+#if CONTENT_HASH_SSE2
+void accumulateSimd(uint64_t* acc, const uint8_t* data, size_t stripes,
+                    uint64_t* key) {
+    __m128i a[4];
+    __m128i k[4];
+    for (int i = 0; i < 4; ++i) {
+        a[i] = _mm_load_si128(reinterpret_cast<const __m128i*>(acc) + i);
+        k[i] = _mm_load_si128(reinterpret_cast<const __m128i*>(key) + i);
+    }
+    const __m128i step = _mm_set1_epi64x(static_cast<long long>(kKeyStep));
+
+    for (size_t s = 0; s < stripes; ++s, data += kStripeBytes) {
+        for (int i = 0; i < 4; ++i) {
+            __m128i d = _mm_loadu_si128(
+                reinterpret_cast<const __m128i*>(data) + i);
+            __m128i dk = _mm_xor_si128(d, k[i]);
+            __m128i hi = _mm_shuffle_epi32(dk, _MM_SHUFFLE(3, 3, 1, 1));
+            __m128i product = _mm_mul_epu32(dk, hi);
+            __m128i swapped = _mm_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2));
+            a[i] = _mm_add_epi64(a[i], _mm_add_epi64(product, swapped));
+            k[i] = _mm_add_epi64(k[i], step);
+        }
+    }
+
+    for (int i = 0; i < 4; ++i) {
+        _mm_store_si128(reinterpret_cast<__m128i*>(acc) + i, a[i]);
+        _mm_store_si128(reinterpret_cast<__m128i*>(key) + i, k[i]);
+    }
+}
+#elif CONTENT_HASH_NEON
+void accumulateSimd(uint64_t* acc, const uint8_t* data, size_t stripes,
+                    uint64_t* key) {
+    uint64x2_t a[4];
+    uint64x2_t k[4];
+    for (int i = 0; i < 4; ++i) {
+        a[i] = vld1q_u64(acc + 2 * i);
+        k[i] = vld1q_u64(key + 2 * i);
+    }
+    const uint64x2_t step = vdupq_n_u64(kKeyStep);
+
+    for (size_t s = 0; s < stripes; ++s, data += kStripeBytes) {
+        for (int i = 0; i < 4; ++i) {
+            uint64x2_t d = vreinterpretq_u64_u8(vld1q_u8(data + 16 * i));
+            uint64x2_t dk = veorq_u64(d, k[i]);
+            uint32x2_t lo = vmovn_u64(dk);
+            uint32x2_t hi = vshrn_n_u64(dk, 32);
+            uint64x2_t swapped = vextq_u64(d, d, 1);
+            a[i] = vaddq_u64(a[i], vaddq_u64(vmull_u32(lo, hi), swapped));
+            k[i] = vaddq_u64(k[i], step);
+        }
+    }
+
+    for (int i = 0; i < 4; ++i) {
+        vst1q_u64(acc + 2 * i, a[i]);
+        vst1q_u64(key + 2 * i, k[i]);
+    }
+}
+#endif
+
+typedef void (*Accumulate)(uint64_t* acc, const uint8_t* data,
+                           size_t stripes, uint64_t* key);
+
+template <Accumulate accumulate>
+uint64_t hash(const void* data, size_t bytes, uint64_t seed) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+
+    alignas(16) uint64_t acc[kLanes] = {
+        kPrime3, kPrime1, kPrime2, kPrime3, kPrime1, kPrime2, kPrime3, kPrime1,
+    };
+    alignas(16) uint64_t key[kLanes];
+    for (size_t j = 0; j < kLanes; ++j) key[j] = kSecret[j] + seed;
+
+    size_t stripes = bytes / kStripeBytes;
+    accumulate(acc, p, stripes, key);
+
+    // The tail is zero-padded to a full stripe; the length is mixed in
+    // below so padding cannot collide with real zeros.
+    size_t tail = bytes - stripes * kStripeBytes;
+    if (tail > 0) {
+        alignas(16) uint8_t last[kStripeBytes] = {};
+        memcpy(last, p + stripes * kStripeBytes, tail);
+        accumulate(acc, last, 1, key);
+    }
+
+    uint64_t h = static_cast<uint64_t>(bytes) * kPrime1 ^ seed;
+    for (size_t j = 0; j < kLanes; ++j) {
+        h ^= rotl(acc[j] * kPrime2, 31) * kPrime1;
+        h = rotl(h, 27) * kPrime1 + kPrime3;
+    }
+
+    h ^= h >> 33;
+    h *= kPrime2;
+    h ^= h >> 29;
+    h *= kPrime3;
+    h ^= h >> 32;
+    return h;
+}
+
+} // namespace
+
+// -----------------------------------------------------------------------------
+uint64_t contentHash(const void* data, size_t bytes, uint64_t seed) {
+#if CONTENT_HASH_SSE2 || CONTENT_HASH_NEON
+    return hash<accumulateSimd>(data, bytes, seed);
+#else
+    return hash<accumulateScalar>(data, bytes, seed);
+#endif
+}
+
+uint64_t contentHashScalar(const void* data, size_t bytes, uint64_t seed) {
+    return hash<accumulateScalar>(data, bytes, seed);
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// -----------------------------------------------------------------------------
+// 64-bit non-cryptographic content hash for change detection. XXH3-style
+// construction: 64-byte stripes are folded into eight 64-bit accumulators
+// with a 32x32->64 multiply per lane (two lanes per SSE2/NEON instruction),
+// the key is advanced every stripe so reordered stripes hash differently,
+// and the accumulators are merged and avalanched at the end. The SIMD and
+// scalar paths produce identical values.
+uint64_t contentHash(const void* data, size_t bytes, uint64_t seed = 0);
+
+// The scalar path on every target, for checking the SIMD one against it
+uint64_t contentHashScalar(const void* data, size_t bytes, uint64_t seed = 0);
@@ -0,0 +1,160 @@
+#include "cook_cache.h"
+
+#include <atomic>
+#include <cinttypes>
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <system_error>
+
+#include "content_hash.h"
+
+namespace {
+
+// Distinguishes temporary files of concurrent writers
+std::atomic<uint64_t> g_tempCounter{ 0 };
+
+} // namespace
+
+// -----------------------------------------------------------------------------
+uint64_t cookerConfig(const Cooker& cooker) {
+    std::string config = cooker.name();
+    config += '\n';
+    config += std::to_string(cooker.version());
+    config += '\n';
+    config += cooker.settings();
+    return contentHash(config.data(), config.size());
+}
+
+bool readFileBytes(const std::string& path, std::vector<uint8_t>& bytes) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        std::cerr << "Failed to open " << path << std::endl;
+        return false;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    bool ok = size >= 0;
+    if (ok) {
+        bytes.resize(static_cast<size_t>(size));
+        ok = fread(bytes.data(), 1, bytes.size(), file) == bytes.size();
+    }
+    fclose(file);
+    if (!ok) std::cerr << "Failed to read " << path << std::endl;
+    return ok;
+}
+
+bool writeFileBytes(const std::string& path, const uint8_t* data,
+                    size_t size) {
+    std::string temp = path + ".tmp" + std::to_string(++g_tempCounter);
+    FILE* file = fopen(temp.c_str(), "wb");
+    if (file == nullptr) {
+        std::cerr << "Failed to open " << temp << std::endl;
+        return false;
+    }
+
+    bool ok = fwrite(data, 1, size, file) == size;
+    ok = fclose(file) == 0 && ok;
+    std::error_code error;
+    if (ok) std::filesystem::rename(temp, path, error);
+    if (!ok || error) {
+        std::filesystem::remove(temp, error);
+        std::cerr << "Failed to write " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+bool CookCache::open(const std::string& directory) {
+    directory_ = directory;
+    std::error_code error;
+    std::filesystem::create_directories(directory_ + "/objects", error);
+    if (error) {
+        std::cerr << "Failed to create " << directory_ << std::endl;
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    manifest_.clear();
+    FILE* file = fopen((directory_ + "/manifest").c_str(), "r");
+    if (file == nullptr) return true;       // first run
+
+    // The path is everything after the single space ending the fields;
+    // a trailing " %n" would also eat spaces the path starts with
+    char line[4096];
+    while (fgets(line, sizeof(line), file) != nullptr) {
+        Entry entry;
+        int pathStart = 0;
+        if (sscanf(line, "%" SCNx64 " %" SCNx64 " %" SCNu64 " %" SCNd64 "%n",
+                   &entry.key, &entry.config, &entry.stamp.size,
+                   &entry.stamp.modified, &pathStart) != 4 ||
+            line[pathStart] != ' ') {
+            continue;
+        }
+        std::string path = line + pathStart + 1;
+        while (!path.empty() && (path.back() == '\n' || path.back() == '\r')) {
+            path.pop_back();
+        }
+        manifest_[path] = entry;
+    }
+    fclose(file);
+    return true;
+}
+
+bool CookCache::saveManifest() const {
+    std::string text;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        char fields[80];
+        for (const auto& [path, entry] : manifest_) {
+            snprintf(fields, sizeof(fields),
+                     "%016" PRIx64 " %016" PRIx64 " %" PRIu64 " %" PRId64 " ",
+                     entry.key, entry.config, entry.stamp.size,
+                     entry.stamp.modified);
+            text += fields;
+            text += path;
+            text += '\n';
+        }
+    }
+    return writeFileBytes(directory_ + "/manifest",
+                          reinterpret_cast<const uint8_t*>(text.data()),
+                          text.size());
+}
+
+bool CookCache::upToDate(const std::string& source, const SourceStamp& stamp,
+                         uint64_t config, uint64_t& key) const {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = manifest_.find(source);
+        if (it == manifest_.end() || it->second.config != config ||
+            !(it->second.stamp == stamp)) {
+            return false;
+        }
+        key = it->second.key;
+    }
+    return contains(key);
+}
+
+void CookCache::record(const std::string& source, const SourceStamp& stamp,
+                       uint64_t config, uint64_t key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    manifest_[source] = { key, config, stamp };
+}
+
+bool CookCache::contains(uint64_t key) const {
+    std::error_code error;
+    return std::filesystem::is_regular_file(objectPath(key), error);
+}
+
+bool CookCache::store(uint64_t key, const std::vector<uint8_t>& output) {
+    return writeFileBytes(objectPath(key), output.data(), output.size());
+}
+
+std::string CookCache::objectPath(uint64_t key) const {
+    char name[24];
+    snprintf(name, sizeof(name), "%016" PRIx64, key);
+    return directory_ + "/objects/" + name;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+// Content-addressed store for cooked assets. A cook's key hashes the source
+// bytes together with the cooker's name, version and settings, and its
+// output is stored under that key: identical sources cook once however many
+// assets share them, touching a file without changing it costs a hash
+// instead of a cook, and bumping a cooker's version or settings re-cooks
+// only the assets that cooker handles.
+//
+// A manifest remembers each source's size, modification time and last key.
+// A source whose stamp and cooker still match is up to date without being
+// read, which is what keeps a warm cook of a large project fast.
+//
+// Layout under the cache directory:
+//   objects/<16 hex digits>    cooked output
+//   manifest                   one line per source: key config size time path
+//
+// All methods may be called from several jobs at once. Objects are written
+// under a temporary name and renamed, so a later run never finds a partial
+// one.
+class Cooker {
+ public:
+    virtual ~Cooker() {}
+
+    virtual const char* name() const = 0;
+
+    // Bump when the output changes for the same source and settings
+    virtual uint32_t version() const = 0;
+
+    // Of the cooked file, with the dot
+    virtual const char* extension() const = 0;
+
+    // Everything besides the source that the output depends on
+    virtual std::string settings() const = 0;
+
+    virtual bool cook(const std::vector<uint8_t>& source,
+                      std::vector<uint8_t>& output) const = 0;
+};
+
+// Hash of the cooker's name, version and settings; seeds the cook key
+uint64_t cookerConfig(const Cooker& cooker);
+
+struct SourceStamp {
+    uint64_t size = 0;
+    int64_t modified = 0;       // file clock ticks
+
+    bool operator==(const SourceStamp& o) const {
+        return size == o.size && modified == o.modified;
+    }
+};
+
+bool readFileBytes(const std::string& path, std::vector<uint8_t>& bytes);
+
+// Writes under a temporary name and renames over `path`
+bool writeFileBytes(const std::string& path, const uint8_t* data,
+                    size_t size);
+
+class CookCache {
+ public:
+    // Creates the directory if needed and loads its manifest
+    bool open(const std::string& directory);
+    bool saveManifest() const;
+
+    // True when `source` was last cooked from a file with this stamp by a
+    // cooker with this config, and its object is still present
+    bool upToDate(const std::string& source, const SourceStamp& stamp,
+                  uint64_t config, uint64_t& key) const;
+
+    void record(const std::string& source, const SourceStamp& stamp,
+                uint64_t config, uint64_t key);
+
+    bool contains(uint64_t key) const;
+    bool store(uint64_t key, const std::vector<uint8_t>& output);
+    std::string objectPath(uint64_t key) const;
+
+ private:
+    struct Entry {
+        uint64_t key;
+        uint64_t config;
+        SourceStamp stamp;
+    };
+
+    std::string directory_;
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, Entry> manifest_;
+};
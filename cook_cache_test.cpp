@@ -0,0 +1,365 @@
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "content_hash.h"
+#include "cook_cache.h"
+#include "job_system.h"
+#include "test_check.h"
+
+// -----------------------------------------------------------------------------
+// Tests for CookCache in a temp directory: the manifest surviving a save
+// and reopen with source paths holding spaces, leading and trailing ones
+// included; the cook step AssetCook runs staying up to date on a warm run,
+// paying only a hash (a cache hit) after a touch, re-cooking after an
+// edit, after a cooker's version or settings change and after its object
+// is deleted, and sharing one object between identical sources; and
+// sources stored and recorded from many jobs at once all reaching the
+// manifest. With --bench it records that many sources and prints the time
+// to save and reopen the manifest and upToDate() checks per second.
+//
+//   CookCacheTest [--bench <sources>]
+namespace {
+
+namespace fs = std::filesystem;
+
+// Upper-cases its source; counts the cooks it really did
+class UpperCooker : public Cooker {
+ public:
+    const char* name() const override { return "upper"; }
+    uint32_t version() const override { return version_; }
+    const char* extension() const override { return ".up"; }
+    std::string settings() const override { return settings_; }
+
+    bool cook(const std::vector<uint8_t>& source,
+              std::vector<uint8_t>& output) const override {
+        ++cooks_;
+        output.resize(source.size());
+        std::transform(source.begin(), source.end(), output.begin(),
+                       [](uint8_t c) { return uint8_t(toupper(c)); });
+        return true;
+    }
+
+    uint32_t version_ = 1;
+    std::string settings_ = "plain";
+    mutable std::atomic<uint32_t> cooks_{ 0 };
+};
+
+enum class Step { kFailed, kUpToDate, kCacheHit, kCooked };
+
+// A fresh directory under the temp path
+std::string scratch(const char* name) {
+    fs::path path = fs::temp_directory_path() / name;
+    std::error_code error;
+    fs::remove_all(path, error);
+    fs::create_directories(path, error);
+    return path.string();
+}
+
+bool stampOf(const std::string& path, SourceStamp& stamp) {
+    std::error_code error;
+    stamp.size = fs::file_size(path, error);
+    if (error) return false;
+    stamp.modified = fs::last_write_time(path, error)
+        .time_since_epoch().count();
+    return !error;
+}
+
+bool writeText(const std::string& path, const std::string& text) {
+    return writeFileBytes(path, reinterpret_cast<const uint8_t*>(text.data()),
+                          text.size());
+}
+
+// The cook step of AssetCook, short of writing the output tree
+Step cook(CookCache& cache, const std::string& sourceDir,
+          const std::string& source, const Cooker& cooker) {
+    std::string path = sourceDir + "/" + source;
+    SourceStamp stamp;
+    if (!stampOf(path, stamp)) return Step::kFailed;
+    uint64_t config = cookerConfig(cooker);
+    uint64_t key = 0;
+    if (cache.upToDate(source, stamp, config, key)) return Step::kUpToDate;
+
+    std::vector<uint8_t> bytes;
+    if (!readFileBytes(path, bytes)) return Step::kFailed;
+    key = contentHash(bytes.data(), bytes.size(), config);
+    Step step = Step::kCacheHit;
+    if (!cache.contains(key)) {
+        std::vector<uint8_t> output;
+        if (!cooker.cook(bytes, output) || !cache.store(key, output)) {
+            return Step::kFailed;
+        }
+        step = Step::kCooked;
+    }
+    cache.record(source, stamp, config, key);
+    return step;
+}
+
+const char* const kSources[] = {
+    "plain.txt",
+    "dir with spaces/two  spaces.txt",
+    " leading.txt",
+    "trailing.txt ",
+    "same as plain.txt",
+};
+
+void testManifest() {
+    std::string dir = scratch("cook_cache_test_manifest");
+    {
+        CookCache cache;
+        CHECK(cache.open(dir));             // no manifest yet
+        uint64_t key = 0;
+        CHECK(!cache.upToDate("plain.txt", SourceStamp(), 1, key));
+        uint64_t n = 0;
+        for (const char* source : kSources) {
+            ++n;
+            SourceStamp stamp;
+            stamp.size = n * 100;
+            stamp.modified = -int64_t(n) * 1000000007;
+            CHECK(cache.store(n, { uint8_t(n) }));
+            cache.record(source, stamp, 0xc0ffee00 + n, n);
+        }
+        CHECK(cache.saveManifest());
+    }
+
+    CookCache cache;
+    CHECK(cache.open(dir));
+    uint64_t n = 0;
+    for (const char* source : kSources) {
+        ++n;
+        SourceStamp stamp;
+        stamp.size = n * 100;
+        stamp.modified = -int64_t(n) * 1000000007;
+        uint64_t key = 0;
+        bool found = cache.upToDate(source, stamp, 0xc0ffee00 + n, key);
+        CHECK_AT(found && key == n, source, __LINE__);
+
+        SourceStamp later = stamp;
+        ++later.modified;
+        CHECK(!cache.upToDate(source, later, 0xc0ffee00 + n, key));
+        CHECK(!cache.upToDate(source, stamp, 0xc0ffee00, key));
+    }
+
+    // Not trimmed on the way back in
+    SourceStamp stamp;
+    stamp.size = 300;
+    stamp.modified = -3 * int64_t(1000000007);
+    CHECK(cache.upToDate(" leading.txt", stamp, 0xc0ffee03, n));
+    CHECK(!cache.upToDate("leading.txt", stamp, 0xc0ffee03, n));
+    fs::remove_all(dir);
+}
+
+// Reopens the cache from its manifest, as each AssetCook run does
+Step cookAgain(const std::string& cacheDir, const std::string& sourceDir,
+               const std::string& source, const Cooker& cooker) {
+    CookCache cache;
+    if (!cache.open(cacheDir)) return Step::kFailed;
+    Step step = cook(cache, sourceDir, source, cooker);
+    return cache.saveManifest() ? step : Step::kFailed;
+}
+
+void testCook() {
+    std::string sourceDir = scratch("cook_cache_test_source");
+    std::string cacheDir = scratch("cook_cache_test_cache");
+    fs::create_directories(sourceDir + "/dir with spaces");
+    for (const char* source : kSources) {
+        CHECK(writeText(sourceDir + "/" + source, "same text"));
+    }
+    CHECK(writeText(sourceDir + "/plain.txt", "plain text"));
+    UpperCooker cooker;
+
+    // Cold: identical sources share one object
+    {
+        CookCache cache;
+        CHECK(cache.open(cacheDir));
+        for (const char* source : kSources) {
+            Step step = cook(cache, sourceDir, source, cooker);
+            CHECK(step == Step::kCooked || step == Step::kCacheHit);
+        }
+        CHECK(cache.saveManifest());
+        CHECK(cooker.cooks_ == 2);
+    }
+
+    // Warm: nothing read
+    for (const char* source : kSources) {
+        CHECK(cookAgain(cacheDir, sourceDir, source, cooker) ==
+              Step::kUpToDate);
+    }
+
+    // Touched: hashed again, found in the cache, then up to date
+    std::string touched = sourceDir + "/" + kSources[1];
+    fs::last_write_time(touched, fs::last_write_time(touched) +
+                                     std::chrono::seconds(10));
+    CHECK(cookAgain(cacheDir, sourceDir, kSources[1], cooker) ==
+          Step::kCacheHit);
+    CHECK(cookAgain(cacheDir, sourceDir, kSources[1], cooker) ==
+          Step::kUpToDate);
+    CHECK(cooker.cooks_ == 2);
+
+    // Edited: cooked, and the output follows the edit
+    CHECK(writeText(sourceDir + "/" + kSources[2], "edited text"));
+    CHECK(cookAgain(cacheDir, sourceDir, kSources[2], cooker) ==
+          Step::kCooked);
+    CHECK(cooker.cooks_ == 3);
+    {
+        CookCache cache;
+        CHECK(cache.open(cacheDir));
+        SourceStamp stamp;
+        uint64_t key = 0;
+        std::vector<uint8_t> output;
+        CHECK(stampOf(sourceDir + "/" + kSources[2], stamp));
+        CHECK(cache.upToDate(kSources[2], stamp, cookerConfig(cooker), key));
+        CHECK(readFileBytes(cache.objectPath(key), output));
+        CHECK(std::string(output.begin(), output.end()) == "EDITED TEXT");
+    }
+
+    // A version or settings bump re-cooks everything, once per content
+    for (int bump = 0; bump < 2; ++bump) {
+        if (bump == 0) ++cooker.version_;
+        if (bump == 1) cooker.settings_ = "fancy";
+        uint32_t before = cooker.cooks_;
+        for (const char* source : kSources) {
+            Step step = cookAgain(cacheDir, sourceDir, source, cooker);
+            CHECK(step == Step::kCooked || step == Step::kCacheHit);
+        }
+        CHECK(cooker.cooks_ - before == 3);
+    }
+
+    // A lost object is cooked again, though the stamp still matches
+    {
+        CookCache cache;
+        CHECK(cache.open(cacheDir));
+        SourceStamp stamp;
+        uint64_t key = 0;
+        CHECK(stampOf(sourceDir + "/plain.txt", stamp));
+        CHECK(cache.upToDate("plain.txt", stamp, cookerConfig(cooker), key));
+        CHECK(fs::remove(cache.objectPath(key)));
+        CHECK(!cache.contains(key));
+    }
+    uint32_t before = cooker.cooks_;
+    CHECK(cookAgain(cacheDir, sourceDir, "plain.txt", cooker) ==
+          Step::kCooked);
+    CHECK(cooker.cooks_ == before + 1);
+    CHECK(cookAgain(cacheDir, sourceDir, "plain.txt", cooker) ==
+          Step::kUpToDate);
+
+    // No temporaries left behind by the renames
+    bool clean = true;
+    for (const fs::directory_entry& entry :
+         fs::recursive_directory_iterator(cacheDir)) {
+        clean &= entry.path().string().find(".tmp") == std::string::npos;
+    }
+    CHECK(clean);
+    fs::remove_all(sourceDir);
+    fs::remove_all(cacheDir);
+}
+
+// Many jobs storing and recording into one cache, some under the same key
+void testConcurrent() {
+    std::string dir = scratch("cook_cache_test_concurrent");
+    const uint32_t sources = 2000;
+    jobSystem().start(3);
+    {
+        CookCache cache;
+        CHECK(cache.open(dir));
+        std::atomic<uint32_t> failed{ 0 };
+        jobSystem().parallelFor(sources, 16, [&](uint32_t begin,
+                                                 uint32_t end) {
+            for (uint32_t s = begin; s < end; ++s) {
+                uint64_t key = s % 500;
+                SourceStamp stamp;
+                stamp.size = s;
+                if (!cache.store(key, { uint8_t(key) })) ++failed;
+                cache.record("source " + std::to_string(s), stamp, 7, key);
+            }
+        });
+        CHECK(failed == 0);
+        CHECK(cache.saveManifest());
+    }
+    jobSystem().stop();
+
+    CookCache cache;
+    CHECK(cache.open(dir));
+    bool all = true;
+    for (uint32_t s = 0; s < sources; ++s) {
+        SourceStamp stamp;
+        stamp.size = s;
+        uint64_t key = 0;
+        all &= cache.upToDate("source " + std::to_string(s), stamp, 7, key) &&
+               key == s % 500;
+    }
+    CHECK(all);
+    fs::remove_all(dir);
+}
+
+// -----------------------------------------------------------------------------
+void bench(uint32_t sources) {
+    std::string dir = scratch("cook_cache_bench");
+    std::vector<std::string> names(sources);
+    for (uint32_t s = 0; s < sources; ++s) {
+        names[s] = "assets/group " + std::to_string(s % 97) + "/asset " +
+                   std::to_string(s) + ".obj";
+    }
+    {
+        CookCache cache;
+        cache.open(dir);
+        for (uint32_t s = 0; s < sources; ++s) {
+            cache.store(s % 1000, { uint8_t(s) });
+            SourceStamp stamp;
+            stamp.size = s;
+            cache.record(names[s], stamp, 1, s % 1000);
+        }
+        auto start = std::chrono::steady_clock::now();
+        cache.saveManifest();
+        std::cerr << sources << " sources: manifest saved in "
+                  << std::chrono::duration<double, std::milli>(
+                         std::chrono::steady_clock::now() - start).count()
+                  << " ms";
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    CookCache cache;
+    cache.open(dir);
+    std::cerr << ", opened in "
+              << std::chrono::duration<double, std::milli>(
+                     std::chrono::steady_clock::now() - start).count()
+              << " ms" << std::endl;
+
+    start = std::chrono::steady_clock::now();
+    uint32_t current = 0;
+    for (uint32_t s = 0; s < sources; ++s) {
+        SourceStamp stamp;
+        stamp.size = s;
+        uint64_t key = 0;
+        current += cache.upToDate(names[s], stamp, 1, key) ? 1 : 0;
+    }
+    double ms = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+    std::cerr << "  upToDate(): " << sources * 1e-3 / ms
+              << " M checks/s, " << current << " up to date" << std::endl;
+    fs::remove_all(dir);
+}
+
+} // namespace
+
+// -----------------------------------------------------------------------------
+int main(int argc, char* argv[]) {
+    if (argc == 3 && strcmp(argv[1], "--bench") == 0) {
+        bench(static_cast<uint32_t>(std::max(1, atoi(argv[2]))));
+        return 0;
+    }
+
+    testManifest();
+    testCook();
+    testConcurrent();
+    return testResult("cook_cache");
+}
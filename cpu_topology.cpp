@@ -0,0 +1,361 @@
+#include "cpu_topology.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
+
+#ifdef __linux__
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#elif defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+namespace {
+
+#ifdef __linux__
+
+bool readText(const std::string& path, std::string& out) {
+    FILE* file = fopen(path.c_str(), "r");
+    if (file == nullptr) return false;
+
+    char buffer[256];
+    size_t size = fread(buffer, 1, sizeof(buffer) - 1, file);
+    fclose(file);
+    buffer[size] = '\0';
+    out = buffer;
+    while (!out.empty() && (out.back() == '\n' || out.back() == ' ')) {
+        out.pop_back();
+    }
+    return true;
+}
+
+int readInt(const std::string& path, int fallback) {
+    std::string text;
+    return readText(path, text) ? atoi(text.c_str()) : fallback;
+}
+
+// Parses kernel cpu lists such as "0-3,8,10-11"
+std::vector<int> parseCpuList(const std::string& text) {
+    std::vector<int> cpus;
+    std::stringstream stream(text);
+    std::string range;
+    while (std::getline(stream, range, ',')) {
+        int first = 0;
+        int last = 0;
+        int fields = sscanf(range.c_str(), "%d-%d", &first, &last);
+        if (fields == 1) last = first;
+        if (fields < 1) continue;
+        for (int cpu = first; cpu <= last; ++cpu) cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+uint64_t parseCacheSize(const std::string& text) {
+    uint64_t size = strtoull(text.c_str(), nullptr, 10);
+    if (text.find('K') != std::string::npos) size <<= 10;
+    if (text.find('M') != std::string::npos) size <<= 20;
+    return size;
+}
+
+#endif
+
+}  // namespace
+
+// -----------------------------------------------------------------------------
+#ifdef __linux__
+
+bool discoverTopology(CpuTopology& topology) {
+    topology = CpuTopology();
+
+    std::string online;
+    if (!readText("/sys/devices/system/cpu/online", online)) return false;
+
+    std::map<std::pair<int, int>, int> coreIds;  // (package, core_id) -> core
+    std::set<std::string> seenCaches;
+    for (int cpu : parseCpuList(online)) {
+        std::string base = "/sys/devices/system/cpu/cpu" +
+                           std::to_string(cpu);
+
+        LogicalCpu logical;
+        logical.id = cpu;
+        logical.package = readInt(base + "/topology/physical_package_id", 0);
+        int coreId = readInt(base + "/topology/core_id", cpu);
+        auto key = std::make_pair(logical.package, coreId);
+        auto it = coreIds.find(key);
+        if (it == coreIds.end()) {
+            it = coreIds.emplace(key, static_cast<int>(coreIds.size())).first;
+        }
+        logical.core = it->second;
+
+        std::string siblings;
+        if (readText(base + "/topology/thread_siblings_list", siblings)) {
+            std::vector<int> list = parseCpuList(siblings);
+            logical.smtPrimary = list.empty() || list.front() == cpu;
+        }
+
+        DIR* dir = opendir(base.c_str());
+        if (dir != nullptr) {
+            while (dirent* entry = readdir(dir)) {
+                int node = 0;
+                if (sscanf(entry->d_name, "node%d", &node) == 1) {
+                    logical.numaNode = node;
+                }
+            }
+            closedir(dir);
+        }
+
+        for (int index = 0; ; ++index) {
+            std::string cache = base + "/cache/index" + std::to_string(index);
+            std::string type;
+            if (!readText(cache + "/type", type)) break;
+            if (type == "Instruction") continue;
+
+            std::string shared;
+            readText(cache + "/shared_cpu_list", shared);
+            int level = readInt(cache + "/level", 0);
+            std::string key = std::to_string(level) + ":" + shared;
+            if (!seenCaches.insert(key).second) continue;
+
+            std::string size;
+            readText(cache + "/size", size);
+            CpuCache info;
+            info.level = level;
+            info.sizeBytes = parseCacheSize(size);
+            info.sharedCpus = parseCpuList(shared);
+            topology.caches.push_back(info);
+        }
+
+        topology.cpus.push_back(logical);
+    }
+
+    std::set<int> packages;
+    std::set<int> nodes;
+    for (const LogicalCpu& cpu : topology.cpus) {
+        packages.insert(cpu.package);
+        nodes.insert(cpu.numaNode);
+    }
+    topology.coreCount = static_cast<int>(coreIds.size());
+    topology.packageCount = static_cast<int>(packages.size());
+    topology.numaNodeCount = static_cast<int>(nodes.size());
+    return !topology.cpus.empty();
+}
+
+int currentCpu() {
+    return sched_getcpu();
+}
+
+bool pinCurrentThread(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+bool setCurrentThreadPriority(ThreadPriority priority) {
+    if (priority == kThreadPriorityNormal) {
+        sched_param param = {};
+        return pthread_setschedparam(pthread_self(), SCHED_OTHER, &param) == 0;
+    }
+
+    // SCHED_FIFO needs CAP_SYS_NICE or an rtprio limit; otherwise settle
+    // for a lower nice value on this thread.
+    sched_param param = {};
+    param.sched_priority = std::max(1, sched_get_priority_min(SCHED_FIFO) + 1);
+    if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0) {
+        return true;
+    }
+    pid_t tid = static_cast<pid_t>(syscall(SYS_gettid));
+    return setpriority(PRIO_PROCESS, tid, -5) == 0;
+}
+
+#elif defined(_WIN32)
+
+bool discoverTopology(CpuTopology& topology) {
+    topology = CpuTopology();
+
+    DWORD length = 0;
+    GetLogicalProcessorInformationEx(RelationAll, nullptr, &length);
+    std::vector<uint8_t> buffer(length);
+    auto* info = reinterpret_cast<SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*>(
+        buffer.data());
+    if (!GetLogicalProcessorInformationEx(RelationAll, info, &length)) {
+        return false;
+    }
+
+    // Logical CPU ids are flattened as group * 64 + bit
+    auto forEachCpu = [](const GROUP_AFFINITY& affinity, auto&& fn) {
+        for (int bit = 0; bit < 64; ++bit) {
+            if (affinity.Mask & (KAFFINITY(1) << bit)) {
+                fn(affinity.Group * 64 + bit);
+            }
+        }
+    };
+
+    std::map<int, LogicalCpu> cpus;
+    int package = 0;
+    for (DWORD offset = 0; offset < length; ) {
+        auto* entry =
+            reinterpret_cast<SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*>(
+                buffer.data() + offset);
+        switch (entry->Relationship) {
+        case RelationProcessorCore: {
+            int core = topology.coreCount++;
+            bool first = true;
+            for (WORD g = 0; g < entry->Processor.GroupCount; ++g) {
+                forEachCpu(entry->Processor.GroupMask[g], [&](int cpu) {
+                    cpus[cpu].id = cpu;
+                    cpus[cpu].core = core;
+                    cpus[cpu].smtPrimary = first;
+                    first = false;
+                });
+            }
+            break;
+        }
+        case RelationProcessorPackage:
+            for (WORD g = 0; g < entry->Processor.GroupCount; ++g) {
+                forEachCpu(entry->Processor.GroupMask[g], [&](int cpu) {
+                    cpus[cpu].package = package;
+                });
+            }
+            ++package;
+            break;
+        case RelationNumaNode:
+            forEachCpu(entry->NumaNode.GroupMask, [&](int cpu) {
+                cpus[cpu].numaNode =
+                    static_cast<int>(entry->NumaNode.NodeNumber);
+            });
+            ++topology.numaNodeCount;
+            break;
+        case RelationCache:
+            if (entry->Cache.Type != CacheInstruction) {
+                CpuCache cache;
+                cache.level = entry->Cache.Level;
+                cache.sizeBytes = entry->Cache.CacheSize;
+                forEachCpu(entry->Cache.GroupMask, [&](int cpu) {
+                    cache.sharedCpus.push_back(cpu);
+                });
+                topology.caches.push_back(cache);
+            }
+            break;
+        default:
+            break;
+        }
+        offset += entry->Size;
+    }
+
+    for (const auto& entry : cpus) topology.cpus.push_back(entry.second);
+    topology.packageCount = package;
+    return !topology.cpus.empty();
+}
+
+int currentCpu() {
+    PROCESSOR_NUMBER processor;
+    GetCurrentProcessorNumberEx(&processor);
+    return processor.Group * 64 + processor.Number;
+}
+
+bool pinCurrentThread(int cpu) {
+    GROUP_AFFINITY affinity = {};
+    affinity.Group = static_cast<WORD>(cpu / 64);
+    affinity.Mask = KAFFINITY(1) << (cpu % 64);
+    return SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr) != 0;
+}
+
+bool setCurrentThreadPriority(ThreadPriority priority) {
+    int value = priority == kThreadPriorityHigh ? THREAD_PRIORITY_HIGHEST
+                                                : THREAD_PRIORITY_NORMAL;
+    return SetThreadPriority(GetCurrentThread(), value) != 0;
+}
+
+#else
+
+bool discoverTopology(CpuTopology& topology) {
+    topology = CpuTopology();
+    return false;
+}
+
+int currentCpu() {
+    return -1;
+}
+
+bool pinCurrentThread(int) {
+    return false;
+}
+
+bool setCurrentThreadPriority(ThreadPriority) {
+    return false;
+}
+
+#endif
+
+// -----------------------------------------------------------------------------
+std::string CpuTopology::describe() const {
+    std::ostringstream out;
+    out << cpus.size() << " logical CPUs, " << coreCount << " cores, "
+        << packageCount << " packages, " << numaNodeCount << " NUMA nodes";
+    for (int level = 1; level <= 3; ++level) {
+        uint64_t size = 0;
+        int count = 0;
+        for (const CpuCache& cache : caches) {
+            if (cache.level != level) continue;
+            size = cache.sizeBytes;
+            ++count;
+        }
+        if (count > 0) {
+            out << ", " << count << "x L" << level << " " << (size >> 10)
+                << " KB";
+        }
+    }
+    return out.str();
+}
+
+std::vector<int> planThreadPlacement(const CpuTopology& topology,
+                                     int threadCount, int renderCpu) {
+    std::vector<int> placement(threadCount, -1);
+    if (topology.cpus.empty()) return placement;
+
+    // One SMT primary per core, render thread's node first. Core 0 is
+    // skipped when there are spare cores: it takes most device interrupts.
+    std::vector<LogicalCpu> primaries;
+    for (const LogicalCpu& cpu : topology.cpus) {
+        if (cpu.smtPrimary) primaries.push_back(cpu);
+    }
+    if (static_cast<int>(primaries.size()) > threadCount) {
+        primaries.erase(primaries.begin());
+    }
+    int homeNode = primaries.front().numaNode;
+    for (const LogicalCpu& cpu : topology.cpus) {
+        if (cpu.id == renderCpu) homeNode = cpu.numaNode;
+    }
+    std::stable_sort(primaries.begin(), primaries.end(),
+                     [homeNode](const LogicalCpu& a, const LogicalCpu& b) {
+        return (a.numaNode == homeNode) > (b.numaNode == homeNode);
+    });
+
+    for (int i = 0; i < threadCount && i < static_cast<int>(primaries.size());
+         ++i) {
+        placement[i] = primaries[i].id;
+    }
+    return placement;
+}
+
+void applyThreadPlacement(const char* name, const ThreadPlacement& placement) {
+    if (placement.cpu >= 0 && !pinCurrentThread(placement.cpu)) {
+        std::cerr << "Failed to pin " << name << " thread to CPU "
+                  << placement.cpu << std::endl;
+    }
+    if (placement.priority != kThreadPriorityNormal &&
+        !setCurrentThreadPriority(placement.priority)) {
+        std::cerr << "Failed to raise " << name << " thread priority"
+                  << std::endl;
+    }
+}
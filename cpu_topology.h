@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+// Processor topology (packages, cores, SMT siblings, caches, NUMA nodes) and
+// helpers to place threads on it. Threads that are pinned by the policy get
+// a physical core each so the render thread never shares a core with a
+// worker through SMT.
+struct LogicalCpu {
+    int id = 0;
+    int core = 0;                // unique across packages
+    int package = 0;
+    int numaNode = 0;
+    bool smtPrimary = true;      // first hardware thread of its core
+};
+
+struct CpuCache {
+    int level = 0;
+    uint64_t sizeBytes = 0;
+    std::vector<int> sharedCpus;
+};
+
+struct CpuTopology {
+    std::vector<LogicalCpu> cpus;
+    std::vector<CpuCache> caches;     // data and unified caches only
+    int coreCount = 0;
+    int packageCount = 0;
+    int numaNodeCount = 0;
+
+    std::string describe() const;
+};
+
+bool discoverTopology(CpuTopology& topology);
+
+// CPUs for [render, present, worker0, worker1, ...], one physical core each
+// in that order, preferring the NUMA node of `renderCpu`, the CPU the render
+// thread runs on before it is pinned, where the memory it touched so far
+// lives. Threads beyond the number of cores get -1 (leave unpinned).
+std::vector<int> planThreadPlacement(const CpuTopology& topology,
+                                     int threadCount, int renderCpu);
+
+enum ThreadPriority {
+    kThreadPriorityNormal,
+    kThreadPriorityHigh,         // above normal; real-time where permitted
+};
+
+// CPU the calling thread is running on, -1 if unknown
+int currentCpu();
+
+bool pinCurrentThread(int cpu);
+bool setCurrentThreadPriority(ThreadPriority priority);
+
+struct ThreadPlacement {
+    int cpu = -1;
+    ThreadPriority priority = kThreadPriorityNormal;
+};
+
+// Pins and prioritizes the calling thread; logs what could not be applied.
+void applyThreadPlacement(const char* name, const ThreadPlacement& placement);
@@ -0,0 +1,197 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include "cpu_topology.h"
+#include "job_system.h"
+#include "test_check.h"
+
+// -----------------------------------------------------------------------------
+// Tests for planThreadPlacement on made-up topologies: one physical core per
+// thread, core 0 skipped when there are spare cores, and the render thread's
+// NUMA node preferred. With --bench it runs that many frames of a render
+// loop on this machine, each a fixed batch of work spread over the job
+// system, unpinned, pinned as the renderer's --pin-threads does, and pinned
+// at high priority, and prints the frame time jitter of each.
+//
+//   CpuTopologyTest [--bench <frames>]
+namespace {
+
+// Nodes of `cores` cores with `smt` threads each; CPU ids number the first
+// thread of every core before the siblings, as Linux does
+CpuTopology makeTopology(int nodes, int cores, int smt) {
+    CpuTopology topology;
+    int total = nodes * cores;
+    for (int t = 0; t < smt; ++t) {
+        for (int c = 0; c < total; ++c) {
+            LogicalCpu cpu;
+            cpu.id = t * total + c;
+            cpu.core = c;
+            cpu.numaNode = c / cores;
+            cpu.package = cpu.numaNode;
+            cpu.smtPrimary = t == 0;
+            topology.cpus.push_back(cpu);
+        }
+    }
+    topology.coreCount = total;
+    topology.packageCount = nodes;
+    topology.numaNodeCount = nodes;
+    return topology;
+}
+
+const LogicalCpu& cpuById(const CpuTopology& topology, int id) {
+    for (const LogicalCpu& cpu : topology.cpus) {
+        if (cpu.id == id) return cpu;
+    }
+    return topology.cpus.front();
+}
+
+void testOneThreadPerCore() {
+    CpuTopology topology = makeTopology(1, 4, 2);
+    std::vector<int> cpus = planThreadPlacement(topology, 3, 0);
+    CHECK(cpus.size() == 3);
+    std::vector<int> cores;
+    for (int cpu : cpus) {
+        CHECK(cpu >= 0 && cpuById(topology, cpu).smtPrimary);
+        cores.push_back(cpuById(topology, cpu).core);
+    }
+    std::sort(cores.begin(), cores.end());
+    CHECK(std::unique(cores.begin(), cores.end()) == cores.end());
+    // A spare core, so core 0 is left to interrupts
+    CHECK(std::find(cores.begin(), cores.end(), 0) == cores.end());
+}
+
+void testCoreZeroWhenNeeded() {
+    CpuTopology topology = makeTopology(1, 4, 1);
+    std::vector<int> cpus = planThreadPlacement(topology, 6, 0);
+    CHECK(cpus.size() == 6);
+    CHECK(std::find(cpus.begin(), cpus.end(), 0) != cpus.end());
+    CHECK(cpus[4] == -1 && cpus[5] == -1);
+}
+
+void testRenderThreadNode() {
+    CpuTopology topology = makeTopology(2, 4, 2);
+
+    // Running on node 1: the render thread and the first threads stay there
+    int renderCpu = 6;
+    std::vector<int> cpus = planThreadPlacement(topology, 5, renderCpu);
+    CHECK(cpuById(topology, cpus[0]).numaNode == 1);
+    for (int i = 0; i < 4; ++i) {
+        CHECK(cpus[i] >= 0 && cpuById(topology, cpus[i]).numaNode == 1);
+    }
+    CHECK(cpuById(topology, cpus[4]).numaNode == 0);
+
+    // On node 0 with core 0 skipped, the rest of node 0 comes first; an SMT
+    // sibling's id maps to its core's node as well
+    cpus = planThreadPlacement(topology, 4, 8);
+    for (int i = 0; i < 3; ++i) {
+        CHECK(cpuById(topology, cpus[i]).numaNode == 0);
+    }
+    CHECK(cpus[0] != 0 && cpuById(topology, cpus[3]).numaNode == 1);
+
+    // Unknown CPU: the first core kept decides
+    cpus = planThreadPlacement(topology, 2, -1);
+    CHECK(cpuById(topology, cpus[0]).numaNode == 0);
+}
+
+void testEmptyTopology() {
+    std::vector<int> cpus = planThreadPlacement(CpuTopology(), 3, 0);
+    CHECK(cpus.size() == 3);
+    CHECK(cpus[0] == -1 && cpus[1] == -1 && cpus[2] == -1);
+}
+
+// -----------------------------------------------------------------------------
+// Arithmetic that stays in registers, so frames vary through scheduling
+// rather than memory
+uint64_t spin(uint64_t seed, uint32_t iterations) {
+    uint64_t x = seed | 1;
+    for (uint32_t i = 0; i < iterations; ++i) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+    }
+    return x;
+}
+
+// Runs `frames` frames of 64 jobs and prints mean, jitter (standard
+// deviation), p99 and max frame time
+void runFrames(const char* name, uint32_t frames) {
+    std::vector<uint64_t> results(64);
+    std::vector<double> times(frames);
+    for (uint32_t f = 0; f < frames; ++f) {
+        auto start = std::chrono::steady_clock::now();
+        jobSystem().parallelFor(
+            static_cast<uint32_t>(results.size()), 1,
+            [&results, f](uint32_t begin, uint32_t end) {
+                for (uint32_t j = begin; j < end; ++j) {
+                    results[j] = spin(f * 64 + j, 20000);
+                }
+            });
+        times[f] = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - start).count();
+    }
+
+    double mean = 0.0;
+    for (double t : times) mean += t;
+    mean /= frames;
+    double variance = 0.0;
+    for (double t : times) variance += (t - mean) * (t - mean);
+    double stddev = frames > 1 ? std::sqrt(variance / (frames - 1)) : 0.0;
+    std::sort(times.begin(), times.end());
+    std::cerr << "  " << name << ": mean " << mean << " ms, jitter "
+              << stddev << " ms, p99 " << times[(frames - 1) * 99 / 100]
+              << " ms, max " << times.back() << " ms" << std::endl;
+}
+
+void bench(uint32_t frames) {
+    CpuTopology topology;
+    discoverTopology(topology);
+    std::cerr << topology.describe() << std::endl;
+
+    // The calling thread plays the render thread; a core each for it and
+    // the workers
+    int workerCount = std::max(1, topology.coreCount - 1);
+    std::vector<int> cpus =
+        planThreadPlacement(topology, 1 + workerCount, currentCpu());
+    std::cerr << frames << " frames, " << workerCount << " workers"
+              << std::endl;
+
+    jobSystem().start(workerCount);
+    runFrames("unpinned", frames);
+    jobSystem().stop();
+
+    for (ThreadPriority priority : { kThreadPriorityNormal,
+                                     kThreadPriorityHigh }) {
+        ThreadPlacement render;
+        render.cpu = cpus[0];
+        render.priority = priority;
+        applyThreadPlacement("render", render);
+        std::vector<ThreadPlacement> placements(workerCount);
+        for (int i = 0; i < workerCount; ++i) placements[i].cpu = cpus[1 + i];
+        jobSystem().start(workerCount, placements);
+        runFrames(priority == kThreadPriorityNormal
+                      ? "pinned" : "pinned, high priority", frames);
+        jobSystem().stop();
+    }
+}
+
+} // namespace
+
+// -----------------------------------------------------------------------------
+int main(int argc, char* argv[]) {
+    if (argc == 3 && strcmp(argv[1], "--bench") == 0) {
+        bench(static_cast<uint32_t>(std::max(1, atoi(argv[2]))));
+        return 0;
+    }
+
+    testOneThreadPerCore();
+    testCoreZeroWhenNeeded();
+    testRenderThreadNode();
+    testEmptyTopology();
+    return testResult("cpu_topology");
+}
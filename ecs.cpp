@@ -0,0 +1,292 @@
+#include "ecs.h"
+
+#include <bit>
+#include <cstdlib>
+#include <mutex>
+
+namespace {
+
+// Entries are written once, before their id is published through the
+// registering type's static, so reads need no lock.
+std::mutex registryMutex;
+ComponentInfo registeredInfos[kMaxComponents];
+uint32_t registeredCount = 0;
+
+size_t alignUp(size_t value, size_t align) {
+    return (value + align - 1) / align * align;
+}
+
+} // namespace
+
+// -----------------------------------------------------------------------------
+uint32_t ComponentRegistry::add(uint32_t size, uint32_t align) {
+    std::lock_guard<std::mutex> lock(registryMutex);
+    if (registeredCount == kMaxComponents) {
+        std::abort();
+    }
+    registeredInfos[registeredCount] = { size, align };
+    return registeredCount++;
+}
+
+ComponentInfo ComponentRegistry::info(uint32_t id) {
+    return registeredInfos[id];
+}
+
+// -----------------------------------------------------------------------------
+Archetype* World::archetypeFor(ComponentMask mask) {
+    auto it = byMask_.find(mask);
+    if (it != byMask_.end()) return it->second;
+
+    auto archetype = std::make_unique<Archetype>();
+    archetype->mask = mask;
+
+    size_t rowBytes = sizeof(Entity);
+    std::vector<ComponentInfo> infos;
+    for (ComponentMask bits = mask; bits != 0; bits &= bits - 1) {
+        uint32_t id = std::countr_zero(bits);
+        archetype->components.push_back(id);
+        infos.push_back(ComponentRegistry::info(id));
+        rowBytes += infos.back().size;
+    }
+
+    // Start from the naive estimate and shrink until the padded columns fit
+    uint32_t capacity = static_cast<uint32_t>(Chunk::kDataBytes / rowBytes);
+    while (capacity > 1) {
+        size_t offset = sizeof(Entity) * capacity;
+        for (const ComponentInfo& info : infos) {
+            offset = alignUp(offset, info.align) +
+                     size_t(info.size) * capacity;
+        }
+        if (offset <= Chunk::kDataBytes) break;
+        --capacity;
+    }
+    archetype->capacity = capacity;
+
+    size_t offset = sizeof(Entity) * capacity;
+    for (size_t i = 0; i < infos.size(); ++i) {
+        offset = alignUp(offset, infos[i].align);
+        archetype->offsets[archetype->components[i]] =
+            static_cast<uint32_t>(offset);
+        archetype->sizes[archetype->components[i]] = infos[i].size;
+        offset += size_t(infos[i].size) * capacity;
+    }
+
+    Archetype* result = archetype.get();
+    archetypes_.push_back(std::move(archetype));
+    byMask_[mask] = result;
+    return result;
+}
+
+// Appends `e` to the archetype's last chunk; components are uninitialized
+void World::insert(Entity e, Archetype* archetype) {
+    if (archetype->chunks.empty() ||
+        archetype->chunks.back()->count == archetype->capacity) {
+        // Default-initialized: rows are written as they are handed out
+        archetype->chunks.push_back(std::unique_ptr<Chunk>(new Chunk));
+        archetype->chunks.back()->count = 0;
+    }
+
+    Chunk* chunk = archetype->chunks.back().get();
+    uint32_t row = chunk->count++;
+    archetype->entities(*chunk)[row] = e;
+
+    Record& record = records_[e.index];
+    record.archetype = archetype;
+    record.chunk = chunk;
+    record.row = row;
+}
+
+// Fills the entity's row with the archetype's last row, then frees the
+// last chunk if it became empty.
+void World::detach(Entity e) {
+    Record& record = records_[e.index];
+    Archetype* a = record.archetype;
+    Chunk* last = a->chunks.back().get();
+    uint32_t lastRow = last->count - 1;
+
+    if (last != record.chunk || lastRow != record.row) {
+        Entity moved = a->entities(*last)[lastRow];
+        a->entities(*record.chunk)[record.row] = moved;
+        for (uint32_t id : a->components) {
+            uint32_t size = a->sizes[id];
+            memcpy(a->column(*record.chunk, id) + size_t(size) * record.row,
+                   a->column(*last, id) + size_t(size) * lastRow, size);
+        }
+        records_[moved.index].chunk = record.chunk;
+        records_[moved.index].row = record.row;
+    }
+
+    if (--last->count == 0) a->chunks.pop_back();
+    record.archetype = nullptr;
+    record.chunk = nullptr;
+}
+
+// Moves the entity to the archetype for `mask`, keeping shared components
+// and zeroing new ones.
+void World::move(Entity e, ComponentMask mask) {
+    Record& record = records_[e.index];
+    Archetype* from = record.archetype;
+    Chunk* fromChunk = record.chunk;
+    uint32_t fromRow = record.row;
+
+    Archetype* to = archetypeFor(mask);
+    insert(e, to);
+    for (uint32_t id : to->components) {
+        uint32_t size = to->sizes[id];
+        uint8_t* dst =
+            to->column(*record.chunk, id) + size_t(size) * record.row;
+        if (from->mask & (ComponentMask(1) << id)) {
+            memcpy(dst, from->column(*fromChunk, id) + size_t(size) * fromRow,
+                   size);
+        } else {
+            memset(dst, 0, size);
+        }
+    }
+
+    // Detach from the old archetype using the old location
+    Record moved = record;
+    record.archetype = from;
+    record.chunk = fromChunk;
+    record.row = fromRow;
+    detach(e);
+    record.archetype = moved.archetype;
+    record.chunk = moved.chunk;
+    record.row = moved.row;
+    ++structuralChanges_;
+}
+
+Entity World::createWithMask(ComponentMask mask) {
+    Entity e;
+    if (!freeIndices_.empty()) {
+        e.index = freeIndices_.back();
+        freeIndices_.pop_back();
+    } else {
+        e.index = static_cast<uint32_t>(records_.size());
+        records_.emplace_back();
+    }
+    e.generation = records_[e.index].generation;
+
+    Archetype* archetype = archetypeFor(mask);
+    insert(e, archetype);
+    const Record& record = records_[e.index];
+    for (uint32_t id : archetype->components) {
+        uint32_t size = archetype->sizes[id];
+        memset(archetype->column(*record.chunk, id) +
+               size_t(size) * record.row, 0, size);
+    }
+
+    ++alive_;
+    ++structuralChanges_;
+    return e;
+}
+
+void World::destroy(Entity e) {
+    if (!alive(e)) return;
+    detach(e);
+
+    // Generation 0 is reserved for the null entity
+    Record& record = records_[e.index];
+    if (++record.generation == 0) record.generation = 1;
+    freeIndices_.push_back(e.index);
+    --alive_;
+    ++structuralChanges_;
+}
+
+bool World::alive(Entity e) const {
+    return e.index < records_.size() && e.generation != 0 &&
+           records_[e.index].generation == e.generation &&
+           records_[e.index].archetype != nullptr;
+}
+
+void* World::getRaw(Entity e, uint32_t id) {
+    if (!alive(e)) return nullptr;
+    const Record& record = records_[e.index];
+    if ((record.archetype->mask & (ComponentMask(1) << id)) == 0) {
+        return nullptr;
+    }
+    return record.archetype->column(*record.chunk, id) +
+           size_t(record.archetype->sizes[id]) * record.row;
+}
+
+void World::setRaw(Entity e, uint32_t id, const void* value) {
+    void* dst = getRaw(e, id);
+    if (dst != nullptr) memcpy(dst, value, ComponentRegistry::info(id).size);
+}
+
+void World::addRaw(Entity e, uint32_t id, const void* value) {
+    if (!alive(e)) return;
+    ComponentMask mask = records_[e.index].archetype->mask;
+    if ((mask & (ComponentMask(1) << id)) == 0) {
+        move(e, mask | (ComponentMask(1) << id));
+    }
+    setRaw(e, id, value);
+}
+
+void World::removeRaw(Entity e, uint32_t id) {
+    if (!alive(e)) return;
+    ComponentMask mask = records_[e.index].archetype->mask;
+    if (mask & (ComponentMask(1) << id)) {
+        move(e, mask & ~(ComponentMask(1) << id));
+    }
+}
+
+EcsStats World::stats() const {
+    EcsStats stats;
+    stats.entities = alive_;
+    stats.archetypes = static_cast<uint32_t>(archetypes_.size());
+    for (const std::unique_ptr<Archetype>& a : archetypes_) {
+        stats.chunks += static_cast<uint32_t>(a->chunks.size());
+    }
+    stats.structuralChanges = structuralChanges_;
+    return stats;
+}
+
+// -----------------------------------------------------------------------------
+void EntityCommandBuffer::begin(Op op, Entity e, ComponentMask mask) {
+    Header header = { op, e, mask };
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&header);
+    bytes_.insert(bytes_.end(), bytes, bytes + sizeof(header));
+}
+
+void EntityCommandBuffer::payload(uint32_t id, const void* value,
+                                  size_t size) {
+    const uint8_t* idBytes = reinterpret_cast<const uint8_t*>(&id);
+    bytes_.insert(bytes_.end(), idBytes, idBytes + sizeof(id));
+    const uint8_t* bytes = static_cast<const uint8_t*>(value);
+    bytes_.insert(bytes_.end(), bytes, bytes + size);
+}
+
+void EntityCommandBuffer::playback(World& world,
+                                   std::vector<Entity>* created) {
+    size_t pos = 0;
+    while (pos < bytes_.size()) {
+        Header header;
+        memcpy(&header, bytes_.data() + pos, sizeof(header));
+        pos += sizeof(header);
+
+        Entity e = header.entity;
+        if (header.op == kOpCreate) {
+            e = world.createWithMask(header.mask);
+            if (created != nullptr) created->push_back(e);
+        }
+
+        if (header.op == kOpCreate || header.op == kOpAdd) {
+            for (int i = std::popcount(header.mask); i > 0; --i) {
+                uint32_t id;
+                memcpy(&id, bytes_.data() + pos, sizeof(id));
+                pos += sizeof(id);
+                if (header.op == kOpAdd) {
+                    world.addRaw(e, id, bytes_.data() + pos);
+                } else {
+                    world.setRaw(e, id, bytes_.data() + pos);
+                }
+                pos += ComponentRegistry::info(id).size;
+            }
+        } else if (header.op == kOpDestroy) {
+            world.destroy(e);
+        } else if (header.op == kOpRemove) {
+            world.removeRaw(e, std::countr_zero(header.mask));
+        }
+    }
+    bytes_.clear();
+}
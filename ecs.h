@@ -0,0 +1,286 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include "job_system.h"
+
+// -----------------------------------------------------------------------------
+// Archetype entity-component store. Entities with the same set of components
+// share an archetype, whose storage is a list of 16 KB chunks. A chunk holds
+// one array per component (structure of arrays) plus the entity ids, so a
+// query walks tightly packed arrays chunk by chunk. Removal swaps the
+// archetype's last entity into the hole, keeping every chunk but the last
+// one full.
+//
+// Components must be trivially copyable; they are moved with memcpy when an
+// entity changes archetype. Structural changes (create, destroy, add,
+// remove) invalidate pointers into chunks, so they are not allowed while a
+// query runs. Record them into an EntityCommandBuffer instead and play it
+// back afterwards.
+constexpr uint32_t kMaxComponents = 64;
+constexpr size_t kChunkBytes = 16 << 10;
+
+typedef uint64_t ComponentMask;
+
+struct Entity {
+    uint32_t index = 0;
+    uint32_t generation = 0;     // 0 is never issued
+
+    bool operator==(const Entity& other) const {
+        return index == other.index && generation == other.generation;
+    }
+    bool operator!=(const Entity& other) const { return !(*this == other); }
+};
+
+struct ComponentInfo {
+    uint32_t size;
+    uint32_t align;
+};
+
+// Process-wide component ids, assigned on first use of each type
+class ComponentRegistry {
+ public:
+    template <typename T>
+    static uint32_t id() {
+        static_assert(std::is_trivially_copyable<T>::value,
+                      "components are moved with memcpy");
+        static const uint32_t id = add(sizeof(T), alignof(T));
+        return id;
+    }
+
+    template <typename... Ts>
+    static ComponentMask mask() {
+        return (ComponentMask(0) | ... |
+                (ComponentMask(1) << id<std::remove_const_t<Ts>>()));
+    }
+
+    static ComponentInfo info(uint32_t id);
+
+ private:
+    static uint32_t add(uint32_t size, uint32_t align);
+};
+
+struct alignas(64) Chunk {
+    static constexpr size_t kHeaderBytes = 64;
+    static constexpr size_t kDataBytes = kChunkBytes - kHeaderBytes;
+
+    uint32_t count;
+    alignas(64) uint8_t data[kDataBytes];
+};
+static_assert(sizeof(Chunk) == kChunkBytes, "chunk header overflow");
+
+struct Archetype {
+    ComponentMask mask = 0;
+    uint32_t capacity = 0;                     // entities per chunk
+    std::vector<uint32_t> components;          // ids in the mask
+    uint32_t offsets[kMaxComponents] = {};     // column start per id
+    uint32_t sizes[kMaxComponents] = {};       // component size per id
+    std::vector<std::unique_ptr<Chunk>> chunks;
+
+    Entity* entities(Chunk& chunk) const {
+        return reinterpret_cast<Entity*>(chunk.data);
+    }
+    uint8_t* column(Chunk& chunk, uint32_t id) const {
+        return chunk.data + offsets[id];
+    }
+};
+
+struct EcsStats {
+    uint32_t entities = 0;
+    uint32_t archetypes = 0;
+    uint32_t chunks = 0;
+    uint64_t structuralChanges = 0;
+};
+
+class World {
+ public:
+    World() = default;
+    World(const World&) = delete;
+    World& operator=(const World&) = delete;
+
+    template <typename... Ts>
+    Entity create(const Ts&... values) {
+        Entity e = createWithMask(ComponentRegistry::mask<Ts...>());
+        (setRaw(e, ComponentRegistry::id<Ts>(), &values), ...);
+        return e;
+    }
+
+    // New entity with zero-initialized components
+    Entity createWithMask(ComponentMask mask);
+    void destroy(Entity e);
+    bool alive(Entity e) const;
+
+    template <typename T>
+    bool has(Entity e) const {
+        return alive(e) && (records_[e.index].archetype->mask &
+                            ComponentRegistry::mask<T>()) != 0;
+    }
+
+    // Null if the entity is dead or lacks the component
+    template <typename T>
+    T* get(Entity e) {
+        return static_cast<T*>(getRaw(e, ComponentRegistry::id<T>()));
+    }
+
+    template <typename T>
+    void add(Entity e, const T& value) {
+        addRaw(e, ComponentRegistry::id<T>(), &value);
+    }
+
+    template <typename T>
+    void remove(Entity e) {
+        removeRaw(e, ComponentRegistry::id<T>());
+    }
+
+    void* getRaw(Entity e, uint32_t id);
+    void setRaw(Entity e, uint32_t id, const void* value);
+    void addRaw(Entity e, uint32_t id, const void* value);
+    void removeRaw(Entity e, uint32_t id);
+
+    // fn(count, const Entity*, Ts*...) once per chunk with all of Ts.
+    // Query `const T` for components that are only read.
+    template <typename... Ts, typename Fn>
+    void forEachChunk(Fn&& fn) {
+        ComponentMask mask = ComponentRegistry::mask<Ts...>();
+        for (const std::unique_ptr<Archetype>& a : archetypes_) {
+            if ((a->mask & mask) != mask) continue;
+            for (const std::unique_ptr<Chunk>& chunk : a->chunks) {
+                fn(chunk->count, a->entities(*chunk),
+                   column<Ts>(*a, *chunk)...);
+            }
+        }
+    }
+
+    // fn(Entity, Ts&...) for every entity with all of Ts
+    template <typename... Ts, typename Fn>
+    void forEach(Fn&& fn) {
+        forEachChunk<Ts...>([&fn](uint32_t count, const Entity* entities,
+                                  Ts*... columns) {
+            for (uint32_t i = 0; i < count; ++i) {
+                fn(entities[i], columns[i]...);
+            }
+        });
+    }
+
+    // As forEach, with chunks spread across the job system. `fn` runs
+    // concurrently and must not make structural changes.
+    template <typename... Ts, typename Fn>
+    void parallelForEach(Fn&& fn) {
+        ComponentMask mask = ComponentRegistry::mask<Ts...>();
+        std::vector<std::pair<Archetype*, Chunk*>> chunks;
+        for (const std::unique_ptr<Archetype>& a : archetypes_) {
+            if ((a->mask & mask) != mask) continue;
+            for (const std::unique_ptr<Chunk>& chunk : a->chunks) {
+                chunks.push_back({ a.get(), chunk.get() });
+            }
+        }
+
+        jobSystem().parallelFor(
+            static_cast<uint32_t>(chunks.size()), 1,
+            [&](uint32_t begin, uint32_t end) {
+                for (uint32_t c = begin; c < end; ++c) {
+                    Archetype& a = *chunks[c].first;
+                    Chunk& chunk = *chunks[c].second;
+                    callRows<Ts...>(fn, chunk.count, a.entities(chunk),
+                                    column<Ts>(a, chunk)...);
+                }
+            });
+    }
+
+    EcsStats stats() const;
+
+ private:
+    struct Record {
+        Archetype* archetype = nullptr;
+        Chunk* chunk = nullptr;
+        uint32_t row = 0;
+        uint32_t generation = 1;
+    };
+
+    template <typename T>
+    static T* column(Archetype& a, Chunk& chunk) {
+        return reinterpret_cast<T*>(a.column(
+            chunk, ComponentRegistry::id<std::remove_const_t<T>>()));
+    }
+
+    template <typename... Ts, typename Fn>
+    static void callRows(Fn& fn, uint32_t count, const Entity* entities,
+                         Ts*... columns) {
+        for (uint32_t i = 0; i < count; ++i) fn(entities[i], columns[i]...);
+    }
+
+    Archetype* archetypeFor(ComponentMask mask);
+    void insert(Entity e, Archetype* archetype);
+    void detach(Entity e);
+    void move(Entity e, ComponentMask mask);
+
+    std::vector<std::unique_ptr<Archetype>> archetypes_;
+    std::unordered_map<ComponentMask, Archetype*> byMask_;
+    std::vector<Record> records_;
+    std::vector<uint32_t> freeIndices_;
+    uint32_t alive_ = 0;
+    uint64_t structuralChanges_ = 0;
+};
+
+// -----------------------------------------------------------------------------
+// Structural changes recorded during a query and applied by playback().
+// Not thread-safe; give each job its own buffer.
+class EntityCommandBuffer {
+ public:
+    template <typename... Ts>
+    void create(const Ts&... values) {
+        begin(kOpCreate, Entity(), ComponentRegistry::mask<Ts...>());
+        (payload(ComponentRegistry::id<Ts>(), &values, sizeof(Ts)), ...);
+    }
+
+    void destroy(Entity e) { begin(kOpDestroy, e, 0); }
+
+    template <typename T>
+    void add(Entity e, const T& value) {
+        uint32_t id = ComponentRegistry::id<T>();
+        begin(kOpAdd, e, ComponentMask(1) << id);
+        payload(id, &value, sizeof(T));
+    }
+
+    template <typename T>
+    void remove(Entity e) {
+        begin(kOpRemove, e, ComponentRegistry::mask<T>());
+    }
+
+    bool empty() const { return bytes_.empty(); }
+    const uint8_t* data() const { return bytes_.data(); }
+    size_t sizeBytes() const { return bytes_.size(); }
+
+    // Applies the commands in recording order and clears the buffer.
+    // Commands on entities that died in the meantime are skipped. Entities
+    // made by create() are appended to `created`, if given, in the order
+    // they were recorded.
+    void playback(World& world, std::vector<Entity>* created = nullptr);
+
+ private:
+    enum Op : uint32_t {
+        kOpCreate,
+        kOpDestroy,
+        kOpAdd,
+        kOpRemove,
+    };
+
+    // Followed, for create and add, by one (component id, value) pair per
+    // bit in `mask`
+    struct Header {
+        Op op;
+        Entity entity;
+        ComponentMask mask;
+    };
+
+    void begin(Op op, Entity e, ComponentMask mask);
+    void payload(uint32_t id, const void* value, size_t size);
+
+    std::vector<uint8_t> bytes_;
+};
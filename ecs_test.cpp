@@ -0,0 +1,416 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "ecs.h"
+#include "math_types.h"
+#include "scene_components.h"
+#include "test_check.h"
+
+// -----------------------------------------------------------------------------
+// Tests for World and EntityCommandBuffer: handles and generations, values
+// kept across archetype moves, swap-remove keeping chunks full, the byte
+// layout of recorded commands (a header, then one component id and value
+// per component for create and add), and playback of changes recorded
+// during a query, including the destroy-and-create respawn the renderer's
+// --instance-respawn records. With --bench it builds that many entities
+// shaped like the renderer's instances and times the transform and bounds
+// refresh over the chunks, serially and on the job system, against the
+// same fields in an array of structs; then structural changes per second,
+// as archetype moves and as command buffer respawns.
+//
+//   EcsTest [--bench <entities>]
+namespace {
+
+struct Position {
+    float x, y, z;
+};
+
+struct Velocity {
+    float x, y, z;
+};
+
+struct Health {
+    uint32_t points;
+};
+
+struct Tag {
+    uint8_t value;
+};
+
+template <typename... Ts>
+uint32_t count(World& world) {
+    uint32_t total = 0;
+    world.forEachChunk<Ts...>([&total](uint32_t n, const Entity*,
+                                       Ts*...) { total += n; });
+    return total;
+}
+
+void testHandles() {
+    World world;
+    Entity a = world.create(Position{ 1, 2, 3 });
+    Entity b = world.create(Position{ 4, 5, 6 }, Health{ 10 });
+    CHECK(a != b && a.generation != 0);
+    CHECK(world.alive(a) && world.alive(b));
+    CHECK(world.get<Position>(b)->y == 5);
+    CHECK(world.get<Health>(b)->points == 10);
+    CHECK(world.get<Health>(a) == nullptr);
+    CHECK(world.stats().entities == 2 && world.stats().archetypes == 2);
+
+    // A destroyed handle stays dead once its index is reused
+    world.destroy(a);
+    CHECK(!world.alive(a) && world.get<Position>(a) == nullptr);
+    Entity c = world.create(Position{ 7, 8, 9 });
+    CHECK(c.index == a.index && c.generation != a.generation);
+    CHECK(!world.alive(a) && world.alive(c));
+    world.destroy(a);                   // stale: nothing happens
+    CHECK(world.alive(c) && world.stats().entities == 2);
+}
+
+void testArchetypeMoves() {
+    World world;
+    Entity e = world.create(Position{ 1, 2, 3 }, Health{ 5 });
+    world.add(e, Velocity{ 4, 5, 6 });
+    CHECK(world.has<Velocity>(e));
+    CHECK(world.get<Position>(e)->z == 3);
+    CHECK(world.get<Health>(e)->points == 5);
+    CHECK(world.get<Velocity>(e)->x == 4);
+
+    world.remove<Health>(e);
+    CHECK(!world.has<Health>(e) && world.get<Velocity>(e)->z == 6);
+    CHECK(world.get<Position>(e)->x == 1);
+
+    // Adding a component it already has only sets the value
+    uint64_t changes = world.stats().structuralChanges;
+    world.add(e, Velocity{ 7, 7, 7 });
+    CHECK(world.get<Velocity>(e)->x == 7);
+    CHECK(world.stats().structuralChanges == changes);
+}
+
+// Removal swaps the last entity into the hole: chunks stay full and every
+// survivor keeps its values
+void testSwapRemove() {
+    World world;
+    std::vector<Entity> entities;
+    for (uint32_t i = 0; i < 5000; ++i) {
+        entities.push_back(world.create(Health{ i }));
+    }
+    uint32_t chunks = world.stats().chunks;
+    CHECK(chunks > 1);
+    for (uint32_t i = 0; i < 5000; i += 2) world.destroy(entities[i]);
+    CHECK(world.stats().entities == 2500);
+    CHECK(world.stats().chunks < chunks);
+
+    uint32_t partial = 0;
+    uint32_t capacity = 0;
+    world.forEachChunk<Health>([&](uint32_t n, const Entity*, Health*) {
+        capacity = std::max(capacity, n);
+    });
+    world.forEachChunk<Health>([&](uint32_t n, const Entity*, Health*) {
+        if (n < capacity) ++partial;
+    });
+    CHECK(partial <= 1);
+    for (uint32_t i = 1; i < 5000; i += 2) {
+        CHECK(world.get<Health>(entities[i])->points == i);
+    }
+}
+
+// Recorded sizes give the layout away: every command has the same header,
+// and create and add follow it with an id and a value per component
+void testCommandBytes() {
+    World world;
+    Entity e = world.create(Position{});
+    EntityCommandBuffer commands;
+    CHECK(commands.empty() && commands.sizeBytes() == 0);
+
+    commands.destroy(e);
+    size_t header = commands.sizeBytes();
+    CHECK(header >= sizeof(uint32_t) + sizeof(Entity) +
+                    sizeof(ComponentMask));
+
+    commands.remove<Position>(e);
+    CHECK(commands.sizeBytes() == 2 * header);
+
+    commands.add(e, Health{ 3 });
+    size_t afterAdd = 2 * header + header + sizeof(uint32_t) +
+                      sizeof(Health);
+    CHECK(commands.sizeBytes() == afterAdd);
+
+    // The record after the add's header: the component id, then its bytes
+    const uint8_t* record = commands.data() + 3 * header;
+    uint32_t id;
+    Health health;
+    memcpy(&id, record, sizeof(id));
+    memcpy(&health, record + sizeof(id), sizeof(health));
+    CHECK(id == ComponentRegistry::id<Health>() && health.points == 3);
+
+    commands.create(Position{ 1, 2, 3 }, Tag{ 9 });
+    CHECK(commands.sizeBytes() == afterAdd + header +
+                                  2 * sizeof(uint32_t) + sizeof(Position) +
+                                  sizeof(Tag));
+
+    // Playback consumes every record and empties the buffer
+    std::vector<Entity> created;
+    commands.playback(world, &created);
+    CHECK(commands.empty());
+    CHECK(created.size() == 1);
+    CHECK(world.get<Position>(created[0])->y == 2);
+    CHECK(world.get<Tag>(created[0])->value == 9);
+    CHECK(!world.alive(e));
+}
+
+// Changes recorded while a query walks the chunks, applied afterwards
+void testPlaybackAfterQuery() {
+    World world;
+    std::vector<Entity> entities;
+    for (uint32_t i = 0; i < 1000; ++i) {
+        entities.push_back(world.create(Health{ i }, Position{}));
+    }
+
+    EntityCommandBuffer commands;
+    world.forEach<const Health>([&commands](Entity e, const Health& h) {
+        if (h.points % 10 == 0) {
+            commands.destroy(e);
+            commands.create(Health{ h.points + 1000 });
+        } else if (h.points % 10 == 1) {
+            commands.add(e, Velocity{ 1, 0, 0 });
+        } else if (h.points % 10 == 2) {
+            commands.remove<Position>(e);
+        }
+    });
+    CHECK(world.stats().entities == 1000);  // nothing applied yet
+
+    std::vector<Entity> created;
+    commands.playback(world, &created);
+    CHECK(created.size() == 100);
+    CHECK(world.stats().entities == 1000);
+    CHECK(count<Health>(world) == 1000);
+    CHECK(count<Velocity>(world) == 100);
+    CHECK(count<Position>(world) == 1000 - 100 - 100);
+    for (uint32_t i = 0; i < 1000; ++i) {
+        CHECK(world.alive(entities[i]) == (i % 10 != 0));
+    }
+
+    // Created in recording order, which followed the query
+    for (size_t i = 0; i < created.size(); ++i) {
+        CHECK(world.get<Health>(created[i])->points == 1000 + 10 * i);
+        CHECK(!world.has<Position>(created[i]));
+    }
+}
+
+// Commands on entities that die first are skipped
+void testDeadEntitiesSkipped() {
+    World world;
+    Entity e = world.create(Health{ 1 });
+    EntityCommandBuffer commands;
+    commands.destroy(e);
+    commands.add(e, Velocity{ 1, 1, 1 });
+    commands.remove<Health>(e);
+    commands.destroy(e);
+    commands.playback(world);
+    CHECK(!world.alive(e));
+    CHECK(world.stats().entities == 0);
+    CHECK(count<Velocity>(world) == 0);
+}
+
+// The renderer's respawn: each replaced slot's entity is destroyed and a
+// new one created with the same values, then the slots are remapped from
+// the created list
+void testRespawn() {
+    World world;
+    std::vector<Entity> slots;
+    for (uint32_t i = 0; i < 64; ++i) {
+        slots.push_back(world.create(Health{ i }, Tag{ 1 }));
+    }
+
+    EntityCommandBuffer commands;
+    std::vector<uint32_t> replaced = { 5, 17, 40, 63 };
+    for (uint32_t slot : replaced) {
+        commands.destroy(slots[slot]);
+        commands.create(Health{ slot }, Tag{ 2 });
+    }
+    std::vector<Entity> created;
+    std::vector<Entity> old = slots;
+    commands.playback(world, &created);
+    CHECK(created.size() == replaced.size());
+    for (size_t i = 0; i < replaced.size(); ++i) {
+        slots[replaced[i]] = created[i];
+    }
+
+    CHECK(world.stats().entities == 64);
+    for (uint32_t i = 0; i < 64; ++i) {
+        bool respawned = std::find(replaced.begin(), replaced.end(), i) !=
+                         replaced.end();
+        CHECK(world.get<Health>(slots[i])->points == i);
+        CHECK(world.get<Tag>(slots[i])->value == (respawned ? 2 : 1));
+        CHECK(world.alive(old[i]) == !respawned);
+    }
+}
+
+// -----------------------------------------------------------------------------
+double msSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+// A renderer instance: its hot fields, plus data the refresh never reads,
+// as names, flags and gameplay state sit next to them in an object
+struct LocalTransform {
+    Matrix4 local;
+};
+
+struct ColdData {
+    uint8_t bytes[64];
+};
+
+struct InstanceObject {
+    Matrix4 local;
+    Matrix4 world;
+    Bounds bounds;
+    uint32_t mesh;
+    uint32_t material;
+    uint32_t slot;
+    uint8_t moved;
+    ColdData cold;
+};
+
+Matrix4 randomLocal(std::mt19937& rng) {
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    return Matrix4::rotationZ(unit(rng) * 3.0f) *
+           Matrix4::translation(unit(rng), unit(rng), 0.0f);
+}
+
+// The refresh updateInstances() runs for each moved instance
+void refresh(const Matrix4& parent, const Bounds& mesh, const Matrix4& local,
+             Matrix4& world, Bounds& bounds) {
+    world = local * parent;
+    bounds = transformBounds(mesh, world);
+}
+
+void bench(uint32_t count) {
+    const int passes = 10;
+    const Matrix4 parent = Matrix4::translation(0.0f, 0.5f, 0.0f);
+    const Bounds mesh = { { -0.5f, -0.5f, 0.0f }, { 0.5f, 0.5f, 0.0f } };
+    std::mt19937 rng(1);
+
+    World world;
+    std::vector<Entity> entities(count);
+    std::vector<InstanceObject> objects(count);
+    for (uint32_t i = 0; i < count; ++i) {
+        Matrix4 local = randomLocal(rng);
+        entities[i] = world.create(
+            LocalTransform{ local }, WorldTransform{}, WorldBounds{},
+            MeshRef{ 0 }, MaterialRef{ i % 4 }, InstanceSlot{ i },
+            Moved{ 1 }, ColdData{});
+        objects[i] = InstanceObject();
+        objects[i].local = local;
+        objects[i].slot = i;
+        objects[i].moved = 1;
+    }
+    EcsStats s = world.stats();
+    std::cerr << count << " entities in " << s.chunks << " chunks of "
+              << (kChunkBytes >> 10) << " KB; " << sizeof(InstanceObject)
+              << " bytes per object in the array of structs" << std::endl;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int p = 0; p < passes; ++p) {
+        for (InstanceObject& o : objects) {
+            if (o.moved) refresh(parent, mesh, o.local, o.world, o.bounds);
+        }
+    }
+    double aosMs = msSince(start) / passes;
+
+    auto chunked = [&](Entity, const LocalTransform& local,
+                       WorldTransform& transform, WorldBounds& bounds,
+                       const Moved& moved) {
+        if (moved.moved) {
+            refresh(parent, mesh, local.local, transform.world,
+                    bounds.bounds);
+        }
+    };
+    start = std::chrono::steady_clock::now();
+    for (int p = 0; p < passes; ++p) {
+        world.forEach<const LocalTransform, WorldTransform, WorldBounds,
+                      const Moved>(chunked);
+    }
+    double serialMs = msSince(start) / passes;
+
+    int workers = std::max(1, static_cast<int>(
+                                  std::thread::hardware_concurrency()) - 1);
+    jobSystem().start(workers);
+    start = std::chrono::steady_clock::now();
+    for (int p = 0; p < passes; ++p) {
+        world.parallelForEach<const LocalTransform, WorldTransform,
+                              WorldBounds, const Moved>(chunked);
+    }
+    double parallelMs = msSince(start) / passes;
+    jobSystem().stop();
+
+    std::cerr << "  refresh: array of structs " << aosMs << " ms, chunks "
+              << serialMs << " ms, chunks on " << workers << " workers "
+              << parallelMs << " ms" << std::endl;
+
+    // A tenth of the entities gain a component and lose it again, each
+    // a move between archetypes
+    uint32_t changed = std::max(1u, count / 10);
+    start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < changed; ++i) {
+        world.add(entities[i * 10 % count], Health{ i });
+    }
+    for (uint32_t i = 0; i < changed; ++i) {
+        world.remove<Health>(entities[i * 10 % count]);
+    }
+    double moveMs = msSince(start);
+
+    // Then are respawned through a command buffer: a destroy and a
+    // create each
+    EntityCommandBuffer commands;
+    std::vector<Entity> created;
+    start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < changed; ++i) {
+        uint32_t slot = i * 10 % count;
+        commands.destroy(entities[slot]);
+        commands.create(LocalTransform{ objects[slot].local },
+                        WorldTransform{}, WorldBounds{}, MeshRef{ 0 },
+                        MaterialRef{ slot % 4 }, InstanceSlot{ slot },
+                        Moved{ 1 }, ColdData{});
+    }
+    double recordMs = msSince(start);
+    size_t recordedBytes = commands.sizeBytes();
+    start = std::chrono::steady_clock::now();
+    commands.playback(world, &created);
+    double playbackMs = msSince(start);
+
+    std::cerr << "  archetype moves: " << 2 * changed / moveMs / 1000.0
+              << " M/s" << std::endl;
+    std::cerr << "  respawns: " << changed << " recorded in " << recordMs
+              << " ms (" << recordedBytes / changed << " bytes each), "
+              << "played back in " << playbackMs << " ms, "
+              << 2 * changed / (recordMs + playbackMs) / 1000.0
+              << " M structural changes/s" << std::endl;
+}
+
+} // namespace
+
+// -----------------------------------------------------------------------------
+int main(int argc, char* argv[]) {
+    if (argc == 3 && strcmp(argv[1], "--bench") == 0) {
+        bench(static_cast<uint32_t>(std::max(1, atoi(argv[2]))));
+        return 0;
+    }
+
+    testHandles();
+    testArchetypeMoves();
+    testSwapRemove();
+    testCommandBytes();
+    testPlaybackAfterQuery();
+    testDeadEntitiesSkipped();
+    testRespawn();
+    return testResult("ecs");
+}
@@ -0,0 +1,217 @@
+#include "frame_arena.h"
+
+#include <cstring>
+#include <iostream>
+
+#ifdef __linux__
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#elif defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+namespace {
+
+size_t roundUp(size_t value, size_t multiple) {
+    return (value + multiple - 1) / multiple * multiple;
+}
+
+#ifdef __linux__
+
+// From <linux/mempolicy.h>; called through syscall() to avoid libnuma
+constexpr int kMpolBind = 2;
+constexpr size_t kHugePageSize = 2 << 20;
+
+bool bindToNode(void* memory, size_t bytes, int node) {
+    unsigned long mask[16] = {};
+    const size_t bitsPerWord = sizeof(unsigned long) * 8;
+    if (node < 0 || static_cast<size_t>(node) >= sizeof(mask) * 8) {
+        return false;
+    }
+    mask[node / bitsPerWord] = 1UL << (node % bitsPerWord);
+    return syscall(SYS_mbind, memory, bytes, kMpolBind, mask,
+                   sizeof(mask) * 8, 0) == 0;
+}
+
+#elif defined(_WIN32)
+
+// Large pages need SeLockMemoryPrivilege, which must be enabled explicitly
+// even when the account holds it.
+bool enableLockMemoryPrivilege() {
+    static int enabled = -1;
+    if (enabled >= 0) return enabled != 0;
+
+    enabled = 0;
+    HANDLE token = nullptr;
+    if (!OpenProcessToken(GetCurrentProcess(),
+                          TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token)) {
+        return false;
+    }
+
+    TOKEN_PRIVILEGES privileges = {};
+    privileges.PrivilegeCount = 1;
+    privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+    if (LookupPrivilegeValueA(nullptr, "SeLockMemoryPrivilege",
+                              &privileges.Privileges[0].Luid) &&
+        AdjustTokenPrivileges(token, FALSE, &privileges, 0, nullptr,
+                              nullptr) &&
+        GetLastError() == ERROR_SUCCESS) {
+        enabled = 1;
+    }
+    CloseHandle(token);
+    return enabled != 0;
+}
+
+#endif
+
+}  // namespace
+
+// -----------------------------------------------------------------------------
+int currentNumaNode() {
+#ifdef __linux__
+    unsigned cpu = 0;
+    unsigned node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, nullptr) == 0) {
+        return static_cast<int>(node);
+    }
+#elif defined(_WIN32)
+    PROCESSOR_NUMBER processor;
+    GetCurrentProcessorNumberEx(&processor);
+    USHORT node = 0;
+    if (GetNumaProcessorNodeEx(&processor, &node)) {
+        return node;
+    }
+#endif
+    return 0;
+}
+
+void* reserveBacking(size_t bytes, const BackingOptions& options,
+                     BackingInfo& info) {
+    info = BackingInfo();
+    int node = options.numaNode == BackingOptions::kCallerNode
+        ? currentNumaNode() : options.numaNode;
+    void* memory = nullptr;
+
+#ifdef __linux__
+    size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+
+    if (options.hugePages) {
+        size_t size = roundUp(bytes, kHugePageSize);
+        memory = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (memory != MAP_FAILED) {
+            info.bytes = size;
+            info.pageSize = kHugePageSize;
+            info.hugePages = true;
+        } else {
+            memory = nullptr;
+        }
+    }
+
+    if (memory == nullptr) {
+        // No reserved hugetlbfs pages: fall back to transparent huge pages,
+        // sized in whole 2 MB pages so the tail can be collapsed too.
+        size_t size = options.hugePages ? roundUp(bytes, kHugePageSize)
+                                        : roundUp(bytes, pageSize);
+        memory = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED) return nullptr;
+        info.bytes = size;
+        info.pageSize = pageSize;
+        if (options.hugePages) {
+            info.transparentHuge = madvise(memory, size, MADV_HUGEPAGE) == 0;
+        }
+    }
+
+    if (node >= 0 && bindToNode(memory, info.bytes, node)) {
+        info.numaNode = node;
+    }
+#elif defined(_WIN32)
+    SYSTEM_INFO systemInfo;
+    GetSystemInfo(&systemInfo);
+    size_t pageSize = systemInfo.dwPageSize;
+    size_t largePageSize = GetLargePageMinimum();
+    DWORD preferredNode = node >= 0 ? static_cast<DWORD>(node)
+                                    : NUMA_NO_PREFERRED_NODE;
+
+    if (options.hugePages && largePageSize != 0 &&
+        enableLockMemoryPrivilege()) {
+        size_t size = roundUp(bytes, largePageSize);
+        memory = VirtualAllocExNuma(GetCurrentProcess(), nullptr, size,
+                                    MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES,
+                                    PAGE_READWRITE, preferredNode);
+        if (memory != nullptr) {
+            info.bytes = size;
+            info.pageSize = largePageSize;
+            info.hugePages = true;
+        }
+    }
+
+    if (memory == nullptr) {
+        size_t size = roundUp(bytes, pageSize);
+        memory = VirtualAllocExNuma(GetCurrentProcess(), nullptr, size,
+                                    MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE,
+                                    preferredNode);
+        if (memory == nullptr) return nullptr;
+        info.bytes = size;
+        info.pageSize = pageSize;
+    }
+
+    if (node >= 0) info.numaNode = node;
+#else
+    memory = ::operator new(bytes);
+    info.bytes = bytes;
+    info.pageSize = 4096;
+#endif
+
+    // First touch from the consuming thread places pages locally even when
+    // explicit binding was not possible.
+    if (options.prefault) {
+        for (size_t offset = 0; offset < info.bytes; offset += info.pageSize) {
+            static_cast<volatile uint8_t*>(memory)[offset] = 0;
+        }
+    }
+
+    return memory;
+}
+
+void releaseBacking(void* memory, const BackingInfo& info) {
+    if (memory == nullptr) return;
+#ifdef __linux__
+    munmap(memory, info.bytes);
+#elif defined(_WIN32)
+    (void)info;
+    VirtualFree(memory, 0, MEM_RELEASE);
+#else
+    (void)info;
+    ::operator delete(memory);
+#endif
+}
+
+// -----------------------------------------------------------------------------
+FrameArena::FrameArena()
+    : base_(nullptr),
+      offset_(0),
+      highWater_(0) {
+}
+
+FrameArena::~FrameArena() {
+    releaseBacking(base_, info_);
+}
+
+bool FrameArena::init(size_t bytes, const BackingOptions& options) {
+    releaseBacking(base_, info_);
+    offset_ = 0;
+    highWater_ = 0;
+
+    base_ = static_cast<uint8_t*>(reserveBacking(bytes, options, info_));
+    if (base_ == nullptr) {
+        std::cerr << "Failed to reserve frame arena memory" << std::endl;
+        info_ = BackingInfo();
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// -----------------------------------------------------------------------------
+// Backing memory for arenas and pools. Large per-frame working sets benefit
+// from huge pages (fewer TLB misses) and from living on the NUMA node of the
+// thread that consumes them. Every option degrades gracefully: if huge pages
+// or NUMA binding are unavailable the block is still returned, backed by
+// normal pages, and BackingInfo says what was actually obtained.
+struct BackingOptions {
+    static constexpr int kAnyNode = -1;
+    static constexpr int kCallerNode = -2;   // node of the calling thread
+
+    bool hugePages = false;
+    int numaNode = kAnyNode;
+    bool prefault = true;                    // touch pages on the caller
+};
+
+struct BackingInfo {
+    size_t bytes = 0;            // rounded up to the page size used
+    size_t pageSize = 0;
+    bool hugePages = false;      // explicit huge pages (MAP_HUGETLB / large pages)
+    bool transparentHuge = false;
+    int numaNode = BackingOptions::kAnyNode;
+};
+
+void* reserveBacking(size_t bytes, const BackingOptions& options,
+                     BackingInfo& info);
+void releaseBacking(void* memory, const BackingInfo& info);
+
+// NUMA node the calling thread is running on, 0 if unknown
+int currentNumaNode();
+
+// -----------------------------------------------------------------------------
+// Linear allocator reset once per frame. Allocations are never freed
+// individually; reset() makes the whole block available again.
+class FrameArena {
+ public:
+    FrameArena();
+    ~FrameArena();
+
+    FrameArena(const FrameArena&) = delete;
+    FrameArena& operator=(const FrameArena&) = delete;
+
+    bool init(size_t bytes, const BackingOptions& options);
+
+    void* allocate(size_t bytes, size_t alignment = 16) {
+        size_t offset = (offset_ + alignment - 1) & ~(alignment - 1);
+        if (offset + bytes > info_.bytes) return nullptr;
+        offset_ = offset + bytes;
+        if (offset_ > highWater_) highWater_ = offset_;
+        return base_ + offset;
+    }
+
+    template <typename T>
+    T* allocate(size_t count = 1) {
+        return static_cast<T*>(allocate(sizeof(T) * count, alignof(T)));
+    }
+
+    void reset() { offset_ = 0; }
+
+    size_t used() const { return offset_; }
+    size_t highWater() const { return highWater_; }
+    const BackingInfo& info() const { return info_; }
+
+ private:
+    uint8_t* base_;
+    size_t offset_;
+    size_t highWater_;
+    BackingInfo info_;
+};
@@ -0,0 +1,196 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <sched.h>
+#include <sys/mman.h>
+#endif
+
+#include "cpu_topology.h"
+#include "frame_arena.h"
+#include "hw_counters.h"
+#include "test_check.h"
+
+// -----------------------------------------------------------------------------
+// Tests for FrameArena: alignment, running out, reset and the high-water
+// mark, and that asking for huge pages or a NUMA node still returns a usable
+// block when neither can be had. With --bench it compares backings of that
+// many MB: 4 KB pages, huge pages, and huge pages bound to the local and,
+// with more than one node, a remote NUMA node. Each prints what was
+// obtained, write bandwidth, and random reads across the block with their
+// dTLB misses where hardware counters are available.
+//
+//   FrameArenaTest [--bench <MB>]
+namespace {
+
+bool aligned(const void* p, size_t alignment) {
+    return reinterpret_cast<uintptr_t>(p) % alignment == 0;
+}
+
+void testAllocate() {
+    FrameArena arena;
+    BackingOptions options;
+    CHECK(arena.init(64 << 10, options));
+    CHECK(arena.info().bytes >= (64u << 10));
+    CHECK(arena.info().pageSize > 0);
+
+    uint8_t* a = static_cast<uint8_t*>(arena.allocate(3, 1));
+    void* b = arena.allocate(16, 64);
+    uint32_t* c = arena.allocate<uint32_t>(10);
+    CHECK(a != nullptr && b != nullptr && c != nullptr);
+    CHECK(aligned(b, 64) && aligned(c, alignof(uint32_t)));
+    CHECK(static_cast<uint8_t*>(b) >= a + 3);
+    CHECK(arena.used() >= 3 + 16 + 40);
+    memset(c, 0xFF, 10 * sizeof(uint32_t));
+}
+
+void testExhaustAndReset() {
+    FrameArena arena;
+    BackingOptions options;
+    CHECK(arena.init(4096, options));
+    size_t capacity = arena.info().bytes;
+    CHECK(arena.allocate(capacity, 1) != nullptr);
+    CHECK(arena.allocate(1, 1) == nullptr);
+    CHECK(arena.used() == capacity);
+
+    arena.reset();
+    CHECK(arena.used() == 0);
+    CHECK(arena.highWater() == capacity);
+    void* again = arena.allocate(128);
+    CHECK(again != nullptr);
+    CHECK(arena.highWater() == capacity);
+}
+
+// Huge pages and NUMA binding degrade to normal pages, never to failure
+void testDegradedBacking() {
+    FrameArena arena;
+    BackingOptions options;
+    options.hugePages = true;
+    options.numaNode = BackingOptions::kCallerNode;
+    CHECK(arena.init(3 << 20, options));
+    const BackingInfo& info = arena.info();
+    CHECK(info.bytes >= (3u << 20));
+    CHECK(!info.hugePages || info.pageSize >= (2u << 20));
+    CHECK(info.numaNode == BackingOptions::kAnyNode || info.numaNode >= 0);
+    uint8_t* p = static_cast<uint8_t*>(arena.allocate(info.bytes, 1));
+    CHECK(p != nullptr);
+    p[0] = 1;
+    p[info.bytes - 1] = 1;
+
+    // A node that does not exist is not bound
+    FrameArena unbound;
+    options.numaNode = 1000;
+    CHECK(unbound.init(1 << 20, options));
+    CHECK(unbound.info().numaNode == BackingOptions::kAnyNode);
+}
+
+// -----------------------------------------------------------------------------
+double msSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+std::string describe(const BackingInfo& info) {
+    std::string text = info.hugePages ? "huge pages"
+                     : info.transparentHuge ? "transparent huge pages"
+                     : std::to_string(info.pageSize >> 10) + " KB pages";
+    if (info.numaNode >= 0) text += ", node " + std::to_string(info.numaNode);
+    return text;
+}
+
+// Fills the block to time writes, then reads 8 bytes at random offsets
+// across it, as scattered per-frame data is visited; with 4 KB pages most
+// of those reads miss the TLB once the block outgrows its reach.
+void benchBacking(const char* name, size_t bytes,
+                  const BackingOptions& options) {
+    BackingOptions unfaulted = options;
+    unfaulted.prefault = false;
+    BackingInfo info;
+    uint8_t* memory =
+        static_cast<uint8_t*>(reserveBacking(bytes, unfaulted, info));
+    if (memory == nullptr) {
+        std::cerr << "  " << name << ": reservation failed" << std::endl;
+        return;
+    }
+#ifdef __linux__
+    // Keep the baseline on 4 KB pages even where THP is always on
+    if (!options.hugePages) madvise(memory, info.bytes, MADV_NOHUGEPAGE);
+#endif
+    memset(memory, 0, info.bytes);    // first touch, from this thread
+
+    const int fills = 8;
+    auto start = std::chrono::steady_clock::now();
+    for (int f = 0; f < fills; ++f) memset(memory, f, info.bytes);
+    double fillMs = msSince(start) / fills;
+
+    const uint32_t reads = 1 << 24;
+    std::vector<uint32_t> offsets(reads);
+    std::mt19937 rng(1);
+    size_t slots = info.bytes / sizeof(uint64_t);
+    for (uint32_t& offset : offsets) {
+        offset = static_cast<uint32_t>(rng() % slots);
+    }
+    const uint64_t* words = reinterpret_cast<const uint64_t*>(memory);
+    HwCounterSpan counters(true);
+    start = std::chrono::steady_clock::now();
+    uint64_t sum = 0;
+    for (uint32_t offset : offsets) sum += words[offset];
+    double readMs = msSince(start);
+    std::string counted = counters.summary();
+
+    std::cerr << "  " << name << " (" << describe(info) << "): write "
+              << info.bytes / std::max(fillMs, 1e-3) / 1e6 << " GB/s, "
+              << "random reads " << readMs * 1e6 / reads << " ns (sum "
+              << sum << ")" << std::endl;
+    if (!counted.empty()) std::cerr << "    " << counted << std::endl;
+    releaseBacking(memory, info);
+}
+
+void bench(size_t megabytes) {
+    size_t bytes = megabytes << 20;
+    CpuTopology topology;
+    discoverTopology(topology);
+#ifdef __linux__
+    // Stay on one node so "local" means the same node throughout
+    pinCurrentThread(sched_getcpu());
+#endif
+    int node = currentNumaNode();
+    std::cerr << megabytes << " MB arenas, " << topology.numaNodeCount
+              << " NUMA nodes, running on node " << node << std::endl;
+    if (!hw_counters::available()) {
+        std::cerr << "  (hardware counters unavailable)" << std::endl;
+    }
+
+    BackingOptions options;
+    benchBacking("small pages", bytes, options);
+    options.hugePages = true;
+    benchBacking("huge pages", bytes, options);
+    options.numaNode = BackingOptions::kCallerNode;
+    benchBacking("huge pages, local node", bytes, options);
+    if (topology.numaNodeCount > 1) {
+        options.numaNode = (node + 1) % topology.numaNodeCount;
+        benchBacking("huge pages, remote node", bytes, options);
+    }
+}
+
+} // namespace
+
+// -----------------------------------------------------------------------------
+int main(int argc, char* argv[]) {
+    if (argc == 3 && strcmp(argv[1], "--bench") == 0) {
+        bench(static_cast<size_t>(std::max(1, atoi(argv[2]))));
+        return 0;
+    }
+
+    testAllocate();
+    testExhaustAndReset();
+    testDegradedBacking();
+    return testResult("frame_arena");
+}
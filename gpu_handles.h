@@ -0,0 +1,29 @@
+#pragma once
+
+#include "resource_table.h"
+
+// -----------------------------------------------------------------------------
+// Handle types of the GPU object tables, without the D3D11 headers, so code
+// that only records or stores handles (the command encoder, the instance
+// buffer) builds and is tested on every platform. The tables themselves are
+// in gpu_resources.h.
+struct ID3D11Buffer;
+struct ID3D11VertexShader;
+struct ID3D11PixelShader;
+struct ID3D11InputLayout;
+struct ID3D11ShaderResourceView;
+struct ID3D11SamplerState;
+
+typedef ResourceTable<ID3D11Buffer*> BufferTable;
+typedef ResourceTable<ID3D11VertexShader*> VertexShaderTable;
+typedef ResourceTable<ID3D11PixelShader*> PixelShaderTable;
+typedef ResourceTable<ID3D11InputLayout*> InputLayoutTable;
+typedef ResourceTable<ID3D11ShaderResourceView*> TextureTable;
+typedef ResourceTable<ID3D11SamplerState*> SamplerTable;
+
+typedef BufferTable::Handle BufferHandle;
+typedef VertexShaderTable::Handle VertexShaderHandle;
+typedef PixelShaderTable::Handle PixelShaderHandle;
+typedef InputLayoutTable::Handle InputLayoutHandle;
+typedef TextureTable::Handle TextureHandle;
+typedef SamplerTable::Handle SamplerHandle;
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <d3d11.h>
+
+#include "gpu_handles.h"
+
+// -----------------------------------------------------------------------------
+// GPU objects are owned by ResourceTables and referenced by handle. Tables
+// are only modified on the thread that owns the immediate context.
+struct GpuResources {
+    BufferTable buffers;
+    VertexShaderTable vertexShaders;
+    PixelShaderTable pixelShaders;
+    InputLayoutTable inputLayouts;
+    TextureTable textures;       // views; each holds its texture
+    SamplerTable samplers;
+};
+
+// Object behind a handle, nullptr if the handle is stale
+template <typename T>
+T* resolve(const ResourceTable<T*>& table,
+           typename ResourceTable<T*>::Handle handle) {
+    T* const* object = table.get(handle);
+    return object != nullptr ? *object : nullptr;
+}
+
+template <typename T>
+void releaseAll(ResourceTable<T*>& table) {
+    for (T* object : table) {
+        object->Release();
+    }
+}
+
+inline void releaseAll(GpuResources& resources) {
+    releaseAll(resources.buffers);
+    releaseAll(resources.vertexShaders);
+    releaseAll(resources.pixelShaders);
+    releaseAll(resources.inputLayouts);
+    releaseAll(resources.textures);
+    releaseAll(resources.samplers);
+}
@@ -0,0 +1,284 @@
+#include "hw_counters.h"
+
+#include <algorithm>
+#include <cstdio>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstring>
+#include <mutex>
+#include <vector>
+#endif
+
+namespace hw_counters {
+
+const char* name(HwCounter counter) {
+    switch (counter) {
+    case kHwCycles:       return "cycles";
+    case kHwInstructions: return "instructions";
+    case kHwCacheMisses:  return "cache_misses";
+    case kHwBranchMisses: return "branch_misses";
+    case kHwDtlbMisses:   return "dtlb_load_misses";
+    default:              return "unknown";
+    }
+}
+
+// A multiplexed group counts for part of the time only; the kernel's
+// estimate for the whole is raw * enabled / running. Summed over threads
+// this is exact when they ran for the same share of their time.
+bool delta(const HwCounterValues& start, const HwCounterValues& end,
+           HwCounterValues& out) {
+    out.enabledNs = end.enabledNs - start.enabledNs;
+    out.runningNs = end.runningNs - start.runningNs;
+    if (out.runningNs == 0) {
+        for (uint64_t& value : out.value) value = 0;
+        return false;
+    }
+    double scale = static_cast<double>(out.enabledNs) / out.runningNs;
+    for (int i = 0; i < kHwCounterCount; ++i) {
+        uint64_t raw = end.value[i] - start.value[i];
+        out.value[i] = out.enabledNs <= out.runningNs
+                           ? raw
+                           : static_cast<uint64_t>(raw * scale + 0.5);
+    }
+    return true;
+}
+
+namespace {
+
+double runningFraction(const HwCounterValues& counts) {
+    if (counts.enabledNs == 0) return 1.0;
+    return std::min(1.0, static_cast<double>(counts.runningNs) /
+                             counts.enabledNs);
+}
+
+double ratio(uint64_t a, uint64_t b) {
+    return b > 0 ? static_cast<double>(a) / b : 0.0;
+}
+
+}  // namespace
+
+std::string summary(const HwCounterValues& start, const HwCounterValues& end) {
+    HwCounterValues counts;
+    if (!delta(start, end, counts)) {
+        return "no counts (the counter group was never scheduled)";
+    }
+    double perK = 1000.0 * ratio(1, counts.value[kHwInstructions]);
+    char text[200];
+    int length = snprintf(
+        text, sizeof(text),
+        "IPC %.2f, per 1k instructions: %.2f cache, %.2f branch, "
+        "%.2f dTLB misses",
+        ratio(counts.value[kHwInstructions], counts.value[kHwCycles]),
+        counts.value[kHwCacheMisses] * perK,
+        counts.value[kHwBranchMisses] * perK,
+        counts.value[kHwDtlbMisses] * perK);
+    double fraction = runningFraction(counts);
+    if (fraction < 1.0 && length > 0 && length < int(sizeof(text))) {
+        snprintf(text + length, sizeof(text) - length,
+                 " (scaled, counted %.0f%% of the time)", fraction * 100.0);
+    }
+    return text;
+}
+
+std::string json(const char* step, const HwCounterValues& start,
+                 const HwCounterValues& end) {
+    HwCounterValues counts;
+    std::string text = std::string("{\"step\":\"") + step + "\",\"counted\":";
+    if (!delta(start, end, counts)) return text + "false}";
+
+    char number[64];
+    text += "true";
+    for (int i = 0; i < kHwCounterCount; ++i) {
+        snprintf(number, sizeof(number), ",\"%s\":%llu",
+                 name(static_cast<HwCounter>(i)),
+                 static_cast<unsigned long long>(counts.value[i]));
+        text += number;
+    }
+    snprintf(number, sizeof(number), ",\"running_fraction\":%.4f",
+             runningFraction(counts));
+    text += number;
+    snprintf(number, sizeof(number), ",\"ipc\":%.3f}",
+             ratio(counts.value[kHwInstructions], counts.value[kHwCycles]));
+    return text + number;
+}
+
+#ifdef __linux__
+
+namespace {
+
+struct ThreadCounters;
+
+// Groups readAll() sums, and the final counts of exited threads
+struct Registry {
+    std::mutex mutex;
+    std::vector<ThreadCounters*> threads;
+    HwCounterValues exited = {};
+    std::atomic<bool> countNew{ false };
+};
+
+Registry& registry() {
+    static Registry instance;
+    return instance;
+}
+
+// PERF_FORMAT_GROUP layout with both times: nr, time_enabled, time_running,
+// then one value per event
+bool readGroup(int leader, HwCounterValues& out) {
+    uint64_t data[3 + kHwCounterCount];
+    ssize_t size = ::read(leader, data, sizeof(data));
+    if (size != static_cast<ssize_t>(sizeof(data))) return false;
+
+    out.enabledNs = data[1];
+    out.runningNs = data[2];
+    for (int i = 0; i < kHwCounterCount; ++i) {
+        out.value[i] = data[3 + i];
+    }
+    return true;
+}
+
+void add(HwCounterValues& sum, const HwCounterValues& values) {
+    for (int i = 0; i < kHwCounterCount; ++i) sum.value[i] += values.value[i];
+    sum.enabledNs += values.enabledNs;
+    sum.runningNs += values.runningNs;
+}
+
+// One perf event group per thread; the cycles counter is the group leader so
+// all values are read atomically with a single read().
+struct ThreadCounters {
+    int fds[kHwCounterCount];
+    bool opened = false;
+    bool valid = false;
+
+    ~ThreadCounters() {
+        if (!valid) return;
+        Registry& r = registry();
+        {
+            std::lock_guard<std::mutex> lock(r.mutex);
+            HwCounterValues last;
+            if (readGroup(fds[0], last)) add(r.exited, last);
+            r.threads.erase(
+                std::find(r.threads.begin(), r.threads.end(), this));
+        }
+        for (int i = 0; i < kHwCounterCount; ++i) {
+            close(fds[i]);
+        }
+    }
+
+    void open() {
+        opened = true;
+        static const struct {
+            uint32_t type;
+            uint64_t config;
+        } events[kHwCounterCount] = {
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+            { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB |
+                                  (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+        };
+
+        int leader = -1;
+        for (int i = 0; i < kHwCounterCount; ++i) {
+            perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = events[i].type;
+            attr.config = events[i].config;
+            attr.read_format = PERF_FORMAT_GROUP |
+                               PERF_FORMAT_TOTAL_TIME_ENABLED |
+                               PERF_FORMAT_TOTAL_TIME_RUNNING;
+            attr.disabled = (i == 0) ? 1 : 0;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+
+            int fd = static_cast<int>(syscall(SYS_perf_event_open, &attr,
+                                              0, -1, leader, 0));
+            if (fd < 0) {
+                for (int j = 0; j < i; ++j) close(fds[j]);
+                return;
+            }
+            fds[i] = fd;
+            if (i == 0) leader = fd;
+        }
+
+        ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        valid = true;
+
+        Registry& r = registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        r.threads.push_back(this);
+    }
+};
+
+ThreadCounters& threadCounters() {
+    thread_local ThreadCounters counters;
+    if (!counters.opened) counters.open();
+    return counters;
+}
+
+}  // namespace
+
+bool available() {
+    return threadCounters().valid;
+}
+
+bool read(HwCounterValues& out) {
+    ThreadCounters& counters = threadCounters();
+    return counters.valid && readGroup(counters.fds[0], out);
+}
+
+void countNewThreads() {
+    registry().countNew = true;
+}
+
+void threadStarted() {
+    if (registry().countNew) threadCounters();
+}
+
+// Reading another thread's group is allowed; the kernel brings the counts
+// of a thread running elsewhere up to date first
+bool readAll(HwCounterValues& out) {
+    if (!available()) return false;
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    out = r.exited;
+    for (ThreadCounters* counters : r.threads) {
+        HwCounterValues values;
+        if (!readGroup(counters->fds[0], values)) return false;
+        add(out, values);
+    }
+    return true;
+}
+
+#else
+
+bool available() {
+    return false;
+}
+
+bool read(HwCounterValues&) {
+    return false;
+}
+
+void countNewThreads() {
+}
+
+void threadStarted() {
+}
+
+bool readAll(HwCounterValues&) {
+    return false;
+}
+
+#endif
+
+}  // namespace hw_counters
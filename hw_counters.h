@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// -----------------------------------------------------------------------------
+// CPU hardware performance counters for the calling thread. Backed by
+// perf_event_open on Linux; elsewhere available() is false and read() fails,
+// so callers can keep a single code path.
+enum HwCounter {
+    kHwCycles,
+    kHwInstructions,
+    kHwCacheMisses,
+    kHwBranchMisses,
+    kHwDtlbMisses,
+    kHwCounterCount
+};
+
+// Raw counts, with the time the group was enabled and the part of it the
+// kernel actually had it on the PMU; they differ when counters multiplex.
+struct HwCounterValues {
+    uint64_t value[kHwCounterCount];
+    uint64_t enabledNs;
+    uint64_t runningNs;
+};
+
+namespace hw_counters {
+
+// Opens the counter group for the calling thread on first use.
+bool available();
+
+// Snapshot of the calling thread's counters since the group was opened.
+bool read(HwCounterValues& out);
+
+// For the tools' benchmarks, whose work is spread over the job system:
+// after countNewThreads(), threads that call threadStarted() (the job
+// system's workers do) open their group as they start. readAll() sums the
+// calling thread and every such thread, including ones that have exited.
+void countNewThreads();
+void threadStarted();
+bool readAll(HwCounterValues& out);
+
+const char* name(HwCounter counter);
+
+// Counts between two snapshots, scaled by enabled over running time, with
+// the times themselves as deltas. False if the group never ran in between,
+// when there is nothing to scale.
+bool delta(const HwCounterValues& start, const HwCounterValues& end,
+           HwCounterValues& out);
+
+// "IPC 1.52, per 1k instructions: ..." over the counts between two snapshots
+std::string summary(const HwCounterValues& start, const HwCounterValues& end);
+
+// The same as one line of JSON: {"step":..., "counted":true, "cycles":...,
+// "running_fraction":..., "ipc":...}; counted is false, with no counts, if
+// the group never ran
+std::string json(const char* step, const HwCounterValues& start,
+                 const HwCounterValues& end);
+
+}  // namespace hw_counters
+
+// Counters of every counted thread over a span of work, which ends at
+// stop() or the first call of summary() or json(), so both describe the
+// same counts. They are empty when counting is off or the counters are
+// unavailable.
+class HwCounterSpan {
+ public:
+    explicit HwCounterSpan(bool enabled)
+        : counted_(enabled && hw_counters::readAll(start_)) {}
+
+    // False if not counting; later calls keep the first end
+    bool stop() const {
+        if (counted_ && !ended_) {
+            ended_ = true;
+            counted_ = hw_counters::readAll(end_);
+        }
+        return counted_;
+    }
+
+    std::string summary() const {
+        return stop() ? hw_counters::summary(start_, end_) : std::string();
+    }
+
+    std::string json(const char* step) const {
+        return stop() ? hw_counters::json(step, start_, end_) : std::string();
+    }
+
+ private:
+    HwCounterValues start_ = {};
+    mutable HwCounterValues end_ = {};
+    mutable bool counted_;
+    mutable bool ended_ = false;
+};
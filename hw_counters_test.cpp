@@ -0,0 +1,115 @@
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include "hw_counters.h"
+#include "test_check.h"
+
+// -----------------------------------------------------------------------------
+// Tests for the counter arithmetic: deltas passed through when the group ran
+// the whole time, scaled by enabled over running time when it was
+// multiplexed, and reported as not counted when it never ran; the summary
+// saying when counts were scaled; and the JSON line the tools' benches
+// print. Where the calling thread has a PMU, also a live span over a loop.
+//
+//   HwCountersTest
+namespace {
+
+HwCounterValues values(uint64_t base, uint64_t enabledNs,
+                       uint64_t runningNs) {
+    HwCounterValues v;
+    for (int i = 0; i < kHwCounterCount; ++i) v.value[i] = base * (i + 1);
+    v.enabledNs = enabledNs;
+    v.runningNs = runningNs;
+    return v;
+}
+
+void testDelta() {
+    HwCounterValues start = values(100, 1000, 1000);
+    HwCounterValues out;
+
+    // Never multiplexed: the raw differences
+    CHECK(hw_counters::delta(start, values(300, 5000, 5000), out));
+    CHECK(out.value[0] == 200 && out.value[kHwCounterCount - 1] ==
+                                     200 * kHwCounterCount);
+    CHECK(out.enabledNs == 4000 && out.runningNs == 4000);
+
+    // On the PMU for a quarter of the span: four times the raw counts
+    CHECK(hw_counters::delta(start, values(300, 5000, 2000), out));
+    CHECK(out.value[0] == 800 && out.value[1] == 1600);
+    CHECK(out.enabledNs == 4000 && out.runningNs == 1000);
+
+    // Never scheduled in between, however long it was enabled
+    CHECK(!hw_counters::delta(start, values(100, 9000, 1000), out));
+    CHECK(out.value[0] == 0 && out.enabledNs == 8000);
+}
+
+void testSummary() {
+    HwCounterValues start = values(0, 0, 0);
+    HwCounterValues end = values(0, 0, 0);
+    end.value[kHwCycles] = 1000;
+    end.value[kHwInstructions] = 2000;
+    end.value[kHwCacheMisses] = 4;
+    end.value[kHwBranchMisses] = 6;
+    end.value[kHwDtlbMisses] = 2;
+    end.enabledNs = 100;
+    end.runningNs = 100;
+    CHECK(hw_counters::summary(start, end) ==
+          "IPC 2.00, per 1k instructions: 2.00 cache, 3.00 branch, "
+          "1.00 dTLB misses");
+
+    // Scaling leaves the rates alone and says so
+    end.enabledNs = 200;
+    std::string scaled = hw_counters::summary(start, end);
+    CHECK(scaled.find("IPC 2.00") == 0);
+    CHECK(scaled.find("counted 50% of the time") != std::string::npos);
+
+    end.runningNs = 0;
+    CHECK(hw_counters::summary(start, end).find("never scheduled") !=
+          std::string::npos);
+}
+
+void testJson() {
+    HwCounterValues start = values(0, 0, 0);
+    HwCounterValues end = values(10, 400, 100);
+    CHECK(hw_counters::json("bc7 fast", start, end) ==
+          "{\"step\":\"bc7 fast\",\"counted\":true,\"cycles\":40,"
+          "\"instructions\":80,\"cache_misses\":120,\"branch_misses\":160,"
+          "\"dtlb_load_misses\":200,\"running_fraction\":0.2500,"
+          "\"ipc\":2.000}");
+
+    end.runningNs = 0;
+    CHECK(hw_counters::json("box", start, end) ==
+          "{\"step\":\"box\",\"counted\":false}");
+}
+
+void testLive() {
+    if (!hw_counters::available()) {
+        std::cerr << "(hardware counters unavailable, live check skipped)"
+                  << std::endl;
+        return;
+    }
+    HwCounterSpan span(true);
+    volatile uint64_t sink = 0;
+    for (uint64_t i = 0; i < 10000000; ++i) sink = sink + i;
+    CHECK(span.stop());
+    std::string json = span.json("loop");
+    CHECK(json == span.json("loop"));                  // one end only
+    CHECK(json.find("\"counted\":") != std::string::npos);
+    CHECK(!span.summary().empty());
+
+    HwCounterSpan off(false);
+    CHECK(!off.stop() && off.summary().empty() && off.json("x").empty());
+}
+
+} // namespace
+
+// -----------------------------------------------------------------------------
+int main() {
+    testDelta();
+    testSummary();
+    testJson();
+    testLive();
+    return testResult("hw_counters");
+}
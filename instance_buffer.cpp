@@ -0,0 +1,121 @@
+#include "instance_buffer.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+// -----------------------------------------------------------------------------
+void InstanceBuffer::init(uint32_t instanceBytes, uint32_t count) {
+    instanceBytes_ = instanceBytes;
+    count_ = count;
+    data_.assign(size_t(instanceBytes) * count, 0);
+    pageCount_ = (sizeBytes() + kPageBytes - 1) / kPageBytes;
+    dirty_.assign((pageCount_ + 63) / 64, 0);
+}
+
+void InstanceBuffer::set(uint32_t index, const void* instance) {
+    memcpy(data_.data() + size_t(index) * instanceBytes_, instance,
+           instanceBytes_);
+    uint32_t begin = index * instanceBytes_;
+    markPages(begin / kPageBytes, (begin + instanceBytes_ - 1) / kPageBytes);
+}
+
+void InstanceBuffer::markDirty(uint32_t first, uint32_t count) {
+    if (count == 0) return;
+    uint32_t begin = first * instanceBytes_;
+    uint32_t end = (first + count) * instanceBytes_;
+    markPages(begin / kPageBytes, (end - 1) / kPageBytes);
+}
+
+void InstanceBuffer::markPages(uint32_t first, uint32_t last) {
+    for (uint32_t page = first; page <= last; ++page) {
+        dirty_[page / 64] |= uint64_t(1) << (page % 64);
+    }
+}
+
+void InstanceBuffer::recordUploads(CommandBuffer& commands,
+                                   BufferHandle buffer,
+                                   uint32_t maxBytes,
+                                   uint32_t maxGapPages) {
+    ++stats_.frames;
+    uint32_t budget = maxBytes;
+
+    // Collect runs of set bits, skipping clean words 64 pages at a time
+    uint32_t runBegin = 0;
+    uint32_t runEnd = 0;            // one past the last dirty page
+    bool haveRun = false;
+
+    auto emit = [&](uint32_t beginPage, uint32_t endPage) {
+        // A run larger than what is left is split at a page boundary
+        bool fits = (endPage - beginPage) * kPageBytes <= budget;
+        if (!fits) {
+            uint32_t splitPage = beginPage + budget / kPageBytes;
+            markPages(splitPage, endPage - 1);
+            endPage = splitPage;
+        }
+        if (endPage > beginPage) {
+            uint32_t begin = beginPage * kPageBytes;
+            uint32_t end = std::min(endPage * kPageBytes, sizeBytes());
+            commands.updateBuffer(buffer, data_.data() + begin, end - begin,
+                                  begin);
+            budget -= end - begin;
+            ++stats_.runs;
+            stats_.bytes += end - begin;
+        }
+        return fits;
+    };
+
+    for (uint32_t w = 0; w < dirty_.size(); ++w) {
+        uint64_t bits = dirty_[w];
+        if (bits == 0) continue;
+        dirty_[w] = 0;
+
+        while (bits != 0) {
+            uint32_t page = w * 64 + std::countr_zero(bits);
+            uint32_t length = std::countr_one(bits >> (page % 64));
+            bits &= length == 64 ? 0 : ~(((uint64_t(1) << length) - 1)
+                                         << (page % 64));
+            stats_.dirtyPages += length;
+
+            if (haveRun && page - runEnd <= maxGapPages) {
+                runEnd = page + length;
+                continue;
+            }
+            if (haveRun && !emit(runBegin, runEnd)) {
+                // Over budget; the rest waits for the next frame
+                dirty_[w] |= bits;
+                markPages(page, page + length - 1);
+                countBacklog();
+                return;
+            }
+            runBegin = page;
+            runEnd = page + length;
+            haveRun = true;
+        }
+    }
+
+    if (haveRun) emit(runBegin, runEnd);
+    countBacklog();
+}
+
+uint32_t InstanceBuffer::dirtyPages() const {
+    uint32_t pages = 0;
+    for (uint64_t bits : dirty_) pages += std::popcount(bits);
+    return pages;
+}
+
+void InstanceBuffer::copyAll(void* out) {
+    ++stats_.frames;
+    ++stats_.fullUploads;
+    ++stats_.runs;
+    stats_.dirtyPages += dirtyPages();
+    stats_.bytes += sizeBytes();
+    memcpy(out, data_.data(), sizeBytes());
+    std::fill(dirty_.begin(), dirty_.end(), 0);
+}
+
+void InstanceBuffer::countBacklog() {
+    uint32_t pages = dirtyPages();
+    stats_.backlogPages += pages;
+    stats_.maxBacklogPages = std::max(stats_.maxBacklogPages, pages);
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "command_buffer.h"
+
+// -----------------------------------------------------------------------------
+// CPU copy of a large, persistent per-instance array with one dirty bit per
+// 4 KB page. Writes go through set() or markDirty(); once per frame
+// recordUploads() turns the dirty pages into runs and records one buffer
+// update per run, so only changed pages reach the GPU. Runs separated by a
+// few clean pages are merged, re-sending those pages to save a copy.
+//
+// Updates are recorded into a command buffer, which copies the payload, so
+// the array can be modified again while the frame is still being submitted.
+//
+// Pages over the per-frame cap wait for later frames, so a heavy churn
+// leaves the GPU copy that many frames behind. Past a few frames' worth,
+// copyAll() snapshots the whole array for one upload of the buffer instead.
+struct InstanceUploadStats {
+    uint64_t frames = 0;
+    uint64_t dirtyPages = 0;
+    uint64_t runs = 0;
+    uint64_t bytes = 0;
+    uint64_t fullUploads = 0;
+    // Pages left dirty after each frame's uploads, summed over frames, and
+    // the most left after one frame
+    uint64_t backlogPages = 0;
+    uint32_t maxBacklogPages = 0;
+};
+
+class InstanceBuffer {
+ public:
+    static constexpr uint32_t kPageBytes = 4096;
+
+    void init(uint32_t instanceBytes, uint32_t count);
+
+    uint32_t count() const { return count_; }
+    uint32_t instanceBytes() const { return instanceBytes_; }
+    uint32_t sizeBytes() const { return count_ * instanceBytes_; }
+
+    const void* get(uint32_t index) const {
+        return data_.data() + size_t(index) * instanceBytes_;
+    }
+    void set(uint32_t index, const void* instance);
+    void markDirty(uint32_t first, uint32_t count);
+    void markAllDirty() { markDirty(0, count_); }
+
+    // Records updates of `buffer` for dirty runs, in address order, until
+    // `maxBytes` are recorded, and clears their bits. The rest stays dirty
+    // for the next frame. Size `maxBytes` to leave room in `commands` for
+    // the rest of the frame.
+    void recordUploads(CommandBuffer& commands, BufferHandle buffer,
+                       uint32_t maxBytes, uint32_t maxGapPages = 1);
+
+    // Pages written since they were last recorded
+    uint32_t dirtyPages() const;
+
+    // Copies the whole array to `out`, sizeBytes() long, for one upload of
+    // the buffer, and clears every dirty bit
+    void copyAll(void* out);
+
+    const InstanceUploadStats& stats() const { return stats_; }
+
+ private:
+    void markPages(uint32_t first, uint32_t last);
+    void countBacklog();
+
+    std::vector<uint8_t> data_;
+    std::vector<uint64_t> dirty_;
+    uint32_t instanceBytes_ = 0;
+    uint32_t count_ = 0;
+    uint32_t pageCount_ = 0;
+    InstanceUploadStats stats_;
+};
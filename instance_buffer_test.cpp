@@ -0,0 +1,225 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "command_buffer.h"
+#include "instance_buffer.h"
+#include "test_check.h"
+
+// -----------------------------------------------------------------------------
+// Tests for InstanceBuffer: dirty pages turned into one update per run,
+// short clean gaps merged, the per-frame cap splitting a run and leaving the
+// rest for the next frame, the backlog that leaves behind, and copyAll()
+// clearing it. With --bench it moves a share of that many 64-byte
+// instances each frame, as the renderer's --instance-churn does, and prints
+// the bytes sent and how many frames the GPU copy trails by, with the
+// renderer's 2 MB cap alone and with its fallback to a whole-buffer upload.
+//
+//   InstanceBufferTest [--bench <instances>]
+namespace {
+
+constexpr uint32_t kPage = InstanceBuffer::kPageBytes;
+
+struct Update {
+    uint32_t offset;
+    uint32_t bytes;
+};
+
+// The buffer updates in a recorded stream, which holds nothing else here
+std::vector<Update> updates(const CommandBuffer& commands) {
+    std::vector<Update> found;
+    const uint32_t* word = commands.data();
+    const uint32_t* end = word + commands.sizeWords();
+    while (word < end) {
+        uint32_t op = *word & ((1u << CommandBuffer::kOpBits) - 1);
+        uint32_t bytes = *word >> CommandBuffer::kOpBits;
+        if (op != kCmdUpdateBuffer) break;
+        found.push_back({ word[2], bytes });
+        word += 3 + (bytes + 3) / 4;
+    }
+    return found;
+}
+
+struct Recorder {
+    std::vector<uint32_t> storage;
+    CommandBuffer commands;
+
+    explicit Recorder(size_t words) : storage(words) {}
+
+    std::vector<Update> record(InstanceBuffer& instances, uint32_t maxBytes,
+                               uint32_t maxGapPages = 1) {
+        commands.reset(storage.data(), storage.size());
+        instances.recordUploads(commands, BufferHandle(), maxBytes,
+                                maxGapPages);
+        return updates(commands);
+    }
+};
+
+void testRuns() {
+    InstanceBuffer instances;
+    instances.init(64, 1024);           // 64 instances per page, 16 pages
+    Recorder recorder(1 << 16);
+    CHECK(recorder.record(instances, 1 << 20).empty());
+
+    // Pages 0, 2 and 3 (one gap page, merged) and 8 (a gap of 4, not)
+    uint8_t instance[64] = {};
+    instances.set(0, instance);
+    instances.markDirty(2 * 64, 100);
+    instances.set(8 * 64 + 5, instance);
+    CHECK(instances.dirtyPages() == 4);
+    std::vector<Update> u = recorder.record(instances, 1 << 20);
+    CHECK(u.size() == 2);
+    CHECK(u[0].offset == 0 && u[0].bytes == 4 * kPage);
+    CHECK(u[1].offset == 8 * kPage && u[1].bytes == kPage);
+    CHECK(instances.dirtyPages() == 0);
+
+    // Without merging, the gap costs an update of its own
+    instances.set(0, instance);
+    instances.set(2 * 64, instance);
+    CHECK(recorder.record(instances, 1 << 20, 0).size() == 2);
+
+    // An instance straddling a page boundary dirties both
+    InstanceBuffer odd;
+    odd.init(48, 200);
+    odd.set(85, instance);              // bytes 4080 to 4127
+    CHECK(odd.dirtyPages() == 2);
+    u = recorder.record(odd, 1 << 20);
+    CHECK(u.size() == 1 && u[0].offset == 0 && u[0].bytes == 2 * kPage);
+}
+
+void testCapAndBacklog() {
+    InstanceBuffer instances;
+    instances.init(64, 1024);
+    Recorder recorder(1 << 16);
+    instances.markAllDirty();
+
+    // Five pages a frame: the 16 dirty pages take four frames
+    std::vector<Update> u = recorder.record(instances, 5 * kPage);
+    CHECK(u.size() == 1 && u[0].offset == 0 && u[0].bytes == 5 * kPage);
+    CHECK(instances.dirtyPages() == 11);
+    u = recorder.record(instances, 5 * kPage);
+    CHECK(u.size() == 1 && u[0].offset == 5 * kPage);
+    recorder.record(instances, 5 * kPage);
+    u = recorder.record(instances, 5 * kPage);
+    CHECK(u.size() == 1 && u[0].bytes == kPage);
+
+    const InstanceUploadStats& s = instances.stats();
+    CHECK(s.frames == 4 && s.bytes == instances.sizeBytes());
+    CHECK(s.backlogPages == 11 + 6 + 1 + 0);
+    CHECK(s.maxBacklogPages == 11);
+    CHECK(instances.dirtyPages() == 0);
+}
+
+void testCopyAll() {
+    InstanceBuffer instances;
+    instances.init(64, 1024);
+    uint8_t instance[64];
+    for (uint32_t i = 0; i < 1024; i += 3) {
+        memset(instance, i & 0xFF, sizeof(instance));
+        instances.set(i, instance);
+    }
+    CHECK(instances.dirtyPages() == 16);
+
+    std::vector<uint8_t> snapshot(instances.sizeBytes());
+    instances.copyAll(snapshot.data());
+    CHECK(memcmp(snapshot.data(), instances.get(0), snapshot.size()) == 0);
+    CHECK(instances.dirtyPages() == 0);
+    CHECK(instances.stats().fullUploads == 1);
+    CHECK(instances.stats().bytes == instances.sizeBytes());
+
+    // Nothing is left for the paged path
+    Recorder recorder(1 << 16);
+    CHECK(recorder.record(instances, 1 << 20).empty());
+}
+
+// -----------------------------------------------------------------------------
+double msSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+// Runs frames at each churn, recording at most 2 MB a frame; with a backlog
+// limit, a backlog past that many frames' worth is sent whole instead, as
+// the renderer does. Lag is the backlog after a frame divided by the cap:
+// the frames before the last change reaches the GPU.
+void benchChurn(uint32_t count, float churn, uint32_t backlogFrames) {
+    const uint32_t frames = 200;
+    const uint32_t cap = 2 << 20;
+    InstanceBuffer instances;
+    instances.init(64, count);
+    Recorder recorder(cap / 4 + (1 << 16));
+    std::vector<uint8_t> snapshot;
+    std::mt19937 rng(1);
+    uint8_t instance[64] = {};
+    uint32_t moved = static_cast<uint32_t>(count * churn / 100.0f);
+    uint32_t capPages = cap / kPage;
+
+    double ms = 0.0;
+    uint32_t maxLag = 0;
+    for (uint32_t f = 0; f < frames; ++f) {
+        for (uint32_t i = 0; i < moved; ++i) {
+            instance[0] = static_cast<uint8_t>(f);
+            instances.set(rng() % count, instance);
+        }
+        auto start = std::chrono::steady_clock::now();
+        if (backlogFrames > 0 &&
+            uint64_t(instances.dirtyPages()) * kPage >
+                uint64_t(cap) * backlogFrames) {
+            snapshot.resize(instances.sizeBytes());
+            instances.copyAll(snapshot.data());
+        } else {
+            recorder.record(instances, cap);
+        }
+        ms += msSince(start);
+        maxLag = std::max(maxLag, instances.dirtyPages() / capPages);
+    }
+
+    const InstanceUploadStats& s = instances.stats();
+    std::cerr << "  " << churn << "% moved: "
+              << (s.bytes / frames >> 10) << " KB/frame, "
+              << static_cast<double>(s.dirtyPages) / frames
+              << " dirty pages/frame, backlog "
+              << static_cast<double>(s.backlogPages) / frames
+              << " pages/frame (max " << s.maxBacklogPages << "), lag "
+              << static_cast<double>(s.backlogPages) / frames / capPages
+              << " frames (max " << maxLag << "), " << s.fullUploads
+              << " full uploads, " << ms / frames << " ms/frame"
+              << std::endl;
+}
+
+void bench(uint32_t count) {
+    std::cerr << count << " instances of 64 bytes ("
+              << (uint64_t(count) * 64 >> 20) << " MB), 2 MB per frame"
+              << std::endl;
+    for (uint32_t backlogFrames : { 0u, 4u }) {
+        if (backlogFrames == 0) {
+            std::cerr << "capped only:" << std::endl;
+        } else {
+            std::cerr << "whole upload past " << backlogFrames
+                      << " frames of backlog:" << std::endl;
+        }
+        for (float churn : { 0.1f, 1.0f, 10.0f }) {
+            benchChurn(count, churn, backlogFrames);
+        }
+    }
+}
+
+} // namespace
+
+// -----------------------------------------------------------------------------
+int main(int argc, char* argv[]) {
+    if (argc == 3 && strcmp(argv[1], "--bench") == 0) {
+        bench(static_cast<uint32_t>(std::max(1, atoi(argv[2]))));
+        return 0;
+    }
+
+    testRuns();
+    testCapAndBacklog();
+    testCopyAll();
+    return testResult("instance_buffer");
+}
@@ -0,0 +1,131 @@
+#include "job_system.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <string>
+
+#include "hw_counters.h"
+#include "sampling_profiler.h"
+
+// -----------------------------------------------------------------------------
+JobSystem& jobSystem() {
+    static JobSystem instance;
+    return instance;
+}
+
+JobSystem::JobSystem()
+    : stopping_(false) {
+}
+
+JobSystem::~JobSystem() {
+    stop();
+}
+
+void JobSystem::start(int workerCount,
+                      const std::vector<ThreadPlacement>& placements) {
+    stop();
+
+    stopping_ = false;
+    for (int i = 0; i < workerCount; ++i) {
+        ThreadPlacement placement;
+        if (i < static_cast<int>(placements.size())) {
+            placement = placements[i];
+        }
+        workers_.emplace_back(&JobSystem::workerMain, this, i, placement);
+    }
+}
+
+void JobSystem::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    hasWork_.notify_all();
+
+    for (std::thread& worker : workers_) {
+        worker.join();
+    }
+    workers_.clear();
+}
+
+void JobSystem::submit(std::function<void()> job) {
+    // Without workers (not started, or zero requested) run inline so
+    // callers never wait on a job nobody will pick up.
+    if (workers_.empty()) {
+        job();
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        jobs_.push_back(std::move(job));
+    }
+    hasWork_.notify_one();
+}
+
+void JobSystem::post(std::coroutine_handle<> handle) {
+    submit([handle] { handle.resume(); });
+}
+
+void JobSystem::parallelFor(
+        uint32_t count, uint32_t grain,
+        const std::function<void(uint32_t, uint32_t)>& fn) {
+    if (count == 0) return;
+    grain = std::max(1u, grain);
+    uint32_t batches = (count + grain - 1) / grain;
+
+    // Shared with the helpers, which may still look for work after the
+    // caller returned.
+    struct State {
+        std::atomic<uint32_t> next{0};
+        std::atomic<uint32_t> done{0};
+        std::mutex mutex;
+        std::condition_variable finished;
+    };
+    auto state = std::make_shared<State>();
+
+    // Returns after running out of batches
+    auto run = [state, count, grain, batches, &fn] {
+        uint32_t batch;
+        while ((batch = state->next.fetch_add(1)) < batches) {
+            uint32_t begin = batch * grain;
+            fn(begin, std::min(count, begin + grain));
+            if (state->done.fetch_add(1) + 1 == batches) {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                state->finished.notify_all();
+            }
+        }
+    };
+
+    // `fn` is only touched while batches remain, which the caller outlives
+    uint32_t helpers = std::min<uint32_t>(batches - 1, workers_.size());
+    for (uint32_t i = 0; i < helpers; ++i) {
+        submit(run);
+    }
+    run();
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->finished.wait(lock, [&] { return state->done == batches; });
+}
+
+void JobSystem::workerMain(int index, ThreadPlacement placement) {
+    std::string name = "worker" + std::to_string(index);
+    applyThreadPlacement(name.c_str(), placement);
+    samplingProfiler().registerCurrentThread(name.c_str());
+    hw_counters::threadStarted();
+
+    while (true) {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            hasWork_.wait(lock, [this] { return stopping_ || !jobs_.empty(); });
+            if (jobs_.empty()) break;
+            job = std::move(jobs_.front());
+            jobs_.pop_front();
+        }
+        job();
+    }
+
+    samplingProfiler().unregisterCurrentThread();
+}
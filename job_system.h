@@ -0,0 +1,49 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "cpu_topology.h"
+#include "task.h"
+
+// -----------------------------------------------------------------------------
+// Pool of worker threads running submitted jobs in FIFO order. Coroutines
+// move onto the pool with `co_await jobSystem().schedule()`.
+class JobSystem : public Executor {
+ public:
+    JobSystem();
+    ~JobSystem() override;
+
+    // One placement per worker; missing entries leave the worker unpinned.
+    void start(int workerCount,
+               const std::vector<ThreadPlacement>& placements = {});
+    void stop();
+
+    int workerCount() const { return static_cast<int>(workers_.size()); }
+
+    void submit(std::function<void()> job);
+    void post(std::coroutine_handle<> handle) override;
+
+    // Calls fn(begin, end) over [0, count) in batches of `grain` and returns
+    // once every batch ran. The calling thread takes batches as well, so
+    // this is safe to call from a worker and degrades to a serial loop when
+    // the pool is busy or empty.
+    void parallelFor(uint32_t count, uint32_t grain,
+                     const std::function<void(uint32_t, uint32_t)>& fn);
+
+ private:
+    void workerMain(int index, ThreadPlacement placement);
+
+    std::mutex mutex_;
+    std::condition_variable hasWork_;
+    std::deque<std::function<void()>> jobs_;
+    std::vector<std::thread> workers_;
+    bool stopping_;
+};
+
+JobSystem& jobSystem();
@@ -0,0 +1,146 @@
+#include "lod.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+
+#include "job_system.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define LOD_SSE2 1
+#endif
+
+namespace {
+
+constexpr uint32_t kSelectGrain = 4096;
+
+// Keeps objects at or behind the eye at full detail
+constexpr float kMinW = 1e-6f;
+
+float axisLength(const Matrix4& a, int row) {
+    return std::sqrt(a.m[row][0] * a.m[row][0] + a.m[row][1] * a.m[row][1] +
+                     a.m[row][2] * a.m[row][2]);
+}
+
+// Coarsest level whose projected error is within `limit` pixels
+uint32_t coarsest(const LodMesh& mesh, float pixels, float limit) {
+    uint32_t level = 0;
+    while (level + 1 < mesh.levelCount &&
+           mesh.levels[level + 1].error * pixels <= limit) {
+        ++level;
+    }
+    return level;
+}
+
+} // namespace
+
+// -----------------------------------------------------------------------------
+void LodSelector::init(uint32_t count) {
+    centerX_.assign(count, 0.0f);
+    centerY_.assign(count, 0.0f);
+    centerZ_.assign(count, 0.0f);
+    scale_.assign(count, 0.0f);
+    mesh_.assign(count, 0);
+    pixels_.assign(count, 0.0f);
+    level_.assign(count, 0);
+}
+
+void LodSelector::setObject(uint32_t index, const Matrix4& world,
+                            uint32_t mesh) {
+    centerX_[index] = world.m[3][0];
+    centerY_[index] = world.m[3][1];
+    centerZ_[index] = world.m[3][2];
+    scale_[index] = std::max(std::max(axisLength(world, 0),
+                                      axisLength(world, 1)),
+                             axisLength(world, 2));
+    mesh_[index] = mesh;
+}
+
+void LodSelector::select(const Matrix4& viewProjection, float width,
+                         float height, const LodMesh* meshes) {
+    auto start = std::chrono::steady_clock::now();
+
+    // Clip units per world unit along the screen axes, in pixels
+    auto column = [&viewProjection](int c) {
+        const Matrix4& a = viewProjection;
+        return std::sqrt(a.m[0][c] * a.m[0][c] + a.m[1][c] * a.m[1][c] +
+                         a.m[2][c] * a.m[2][c]);
+    };
+    float pixelsPerUnit = std::max(column(0) * width, column(1) * height) *
+                          0.5f;
+
+    uint32_t count = size();
+    std::atomic<uint32_t> changes{0};
+    jobSystem().parallelFor(
+        count, kSelectGrain, [&](uint32_t begin, uint32_t end) {
+            changes += selectRange(begin, end, viewProjection, pixelsPerUnit,
+                                   meshes);
+        });
+
+    ++stats_.selections;
+    stats_.objectsSelected += count;
+    stats_.levelChanges += changes;
+    stats_.selectMs += std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+uint32_t LodSelector::selectRange(uint32_t begin, uint32_t end,
+                                  const Matrix4& viewProjection,
+                                  float pixelsPerUnit, const LodMesh* meshes) {
+    // Pixels per object unit at each object's center
+    const float wx = viewProjection.m[0][3];
+    const float wy = viewProjection.m[1][3];
+    const float wz = viewProjection.m[2][3];
+    const float ww = viewProjection.m[3][3];
+    const float* cx = centerX_.data();
+    const float* cy = centerY_.data();
+    const float* cz = centerZ_.data();
+    const float* scale = scale_.data();
+    float* pixels = pixels_.data();
+    uint32_t i = begin;
+#if LOD_SSE2
+    const __m128 vx = _mm_set1_ps(wx);
+    const __m128 vy = _mm_set1_ps(wy);
+    const __m128 vz = _mm_set1_ps(wz);
+    const __m128 vw = _mm_set1_ps(ww);
+    const __m128 minW = _mm_set1_ps(kMinW);
+    const __m128 perUnit = _mm_set1_ps(pixelsPerUnit);
+    for (; i + 4 <= end; i += 4) {
+        __m128 w = _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(cx + i), vx),
+                       _mm_mul_ps(_mm_loadu_ps(cy + i), vy)),
+            _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(cz + i), vz), vw));
+        __m128 p = _mm_div_ps(_mm_mul_ps(perUnit, _mm_loadu_ps(scale + i)),
+                              _mm_max_ps(w, minW));
+        _mm_storeu_ps(pixels + i, p);
+    }
+#endif
+    for (; i < end; ++i) {
+        float w = cx[i] * wx + cy[i] * wy + cz[i] * wz + ww;
+        pixels[i] = pixelsPerUnit * scale[i] / std::max(w, kMinW);
+    }
+
+    // Locals: stores to the uint8_t levels may alias any member
+    const uint32_t* meshOf = mesh_.data();
+    uint8_t* levels = level_.data();
+    float threshold = threshold_;
+    float coarser = threshold * (1.0f - hysteresis_);
+    uint32_t changes = 0;
+    for (i = begin; i < end; ++i) {
+        const LodMesh& mesh = meshes[meshOf[i]];
+        uint32_t current = std::min<uint32_t>(levels[i], mesh.levelCount - 1);
+        uint32_t level = current;
+        uint32_t relaxed = coarsest(mesh, pixels[i], coarser);
+        if (relaxed > current) {
+            level = relaxed;
+        } else if (mesh.levels[current].error * pixels[i] > threshold) {
+            level = coarsest(mesh, pixels[i], threshold);
+        }
+        changes += level != levels[i];
+        levels[i] = static_cast<uint8_t>(level);
+    }
+    return changes;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "math_types.h"
+
+// -----------------------------------------------------------------------------
+// Level of detail selection by projected error. Each mesh level carries the
+// largest distance, in object units, between its surface and the full
+// detail surface. Every frame the error of each object's levels is projected
+// to pixels with the view-projection and the coarsest level within the
+// threshold is chosen.
+//
+// Hysteresis: an object only moves to a coarser level once that level is
+// within threshold * (1 - hysteresis), and only moves finer once its current
+// level exceeds the threshold, so objects near a boundary do not flip every
+// frame.
+//
+// Objects are kept as separate center and scale arrays. select() first
+// projects them to pixels per object unit four at a time with SSE2, then
+// walks the levels per object, both in ranges on the job system.
+constexpr uint32_t kMaxLodLevels = 8;
+
+struct LodLevel {
+    uint32_t firstVertex;
+    uint32_t vertexCount;
+    float error;                 // object units; 0 for full detail
+};
+
+// Finest level first, errors increasing
+struct LodMesh {
+    uint32_t levelCount = 0;
+    LodLevel levels[kMaxLodLevels];
+};
+
+struct LodStats {
+    uint64_t selections = 0;
+    double selectMs = 0.0;
+    uint64_t objectsSelected = 0;
+    uint64_t levelChanges = 0;
+};
+
+class LodSelector {
+ public:
+    void init(uint32_t count);
+
+    // Pixels of projected error allowed; 0 keeps every object at level 0
+    void setThreshold(float pixels) { threshold_ = pixels; }
+    void setHysteresis(float fraction) { hysteresis_ = fraction; }
+
+    void setObject(uint32_t index, const Matrix4& world, uint32_t mesh);
+
+    // Re-selects every object's level for a width by height view
+    void select(const Matrix4& viewProjection, float width, float height,
+                const LodMesh* meshes);
+
+    uint32_t size() const { return static_cast<uint32_t>(level_.size()); }
+    const uint8_t* levels() const { return level_.data(); }
+
+    const LodStats& stats() const { return stats_; }
+
+ private:
+    uint32_t selectRange(uint32_t begin, uint32_t end,
+                         const Matrix4& viewProjection, float pixelsPerUnit,
+                         const LodMesh* meshes);
+
+    std::vector<float> centerX_;
+    std::vector<float> centerY_;
+    std::vector<float> centerZ_;
+    std::vector<float> scale_;   // largest axis scale of the world matrix
+    std::vector<uint32_t> mesh_;
+    std::vector<float> pixels_;  // per object unit, from the last select()
+    std::vector<uint8_t> level_;
+    float threshold_ = 1.0f;
+    float hysteresis_ = 0.25f;
+    LodStats stats_;
+};
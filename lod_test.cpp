@@ -0,0 +1,235 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "job_system.h"
+#include "lod.h"
+#include "test_check.h"
+
+// -----------------------------------------------------------------------------
+// Tests for LodSelector on the renderer's disc, whose five levels run from
+// 768 rim segments down to 3: the level chosen for a projected size, a zero
+// threshold keeping full detail, objects at or behind the eye kept at full
+// detail, ranges whose length is not a multiple of four, and hysteresis
+// holding levels steady while the zoom wobbles. With --bench it lays that
+// many discs out on a ground plane receding from the eye and prints
+// selection time, triangles against full detail, and level changes per
+// frame under a 1% zoom jitter with and without hysteresis.
+//
+//   LodTest [--bench <objects>]
+namespace {
+
+// The disc buildMeshes() makes: each level a quarter of the segments of the
+// one before, its error how far its rim falls inside the finest one
+LodMesh disc() {
+    const float radius = 0.5f;
+    const float pi = 3.14159265f;
+    auto rim = [radius, pi](uint32_t segments) {
+        return radius * std::cos(pi / segments);
+    };
+    LodMesh mesh;
+    uint32_t first = 0;
+    for (uint32_t segments = 768; segments >= 3; segments /= 4) {
+        LodLevel& level = mesh.levels[mesh.levelCount++];
+        level.firstVertex = first;
+        level.vertexCount = segments * 3;
+        level.error = rim(768) - rim(segments);
+        first += level.vertexCount;
+    }
+    return mesh;
+}
+
+// Coarsest level within `limit` pixels for an object `pixels` per unit
+uint32_t expectedLevel(const LodMesh& mesh, float pixels, float limit) {
+    uint32_t level = 0;
+    while (level + 1 < mesh.levelCount &&
+           mesh.levels[level + 1].error * pixels <= limit) {
+        ++level;
+    }
+    return level;
+}
+
+// With an identity view over a 100x100 view, an object of scale s covers
+// 50 * s pixels per unit
+constexpr float kViewPixels = 100.0f;
+
+Matrix4 placed(float scale, float x, float y) {
+    return Matrix4::scaling(scale, scale, scale) *
+           Matrix4::translation(x, y, 0.0f);
+}
+
+void testLevelForSize() {
+    LodMesh mesh = disc();
+    CHECK(mesh.levelCount == 5);
+    CHECK(mesh.levels[0].error == 0.0f && mesh.levels[4].vertexCount == 9);
+
+    // Sizes spanning every level, in an odd count for the SIMD tail
+    const uint32_t count = 23;
+    LodSelector lods;
+    lods.init(count);
+    lods.setThreshold(1.0f);
+    lods.setHysteresis(0.0f);
+    std::vector<float> scales(count);
+    for (uint32_t i = 0; i < count; ++i) {
+        scales[i] = 0.01f * std::pow(1.7f, static_cast<float>(i));
+        lods.setObject(i, placed(scales[i], 0.0f, 0.0f), 0);
+    }
+    lods.select(Matrix4::identity(), kViewPixels, kViewPixels, &mesh);
+
+    bool matches = true;
+    for (uint32_t i = 0; i < count; ++i) {
+        float pixels = kViewPixels * 0.5f * scales[i];
+        matches &= lods.levels()[i] == expectedLevel(mesh, pixels, 1.0f);
+    }
+    CHECK(matches);
+    CHECK(lods.levels()[0] == 4);               // a speck: a triangle
+    CHECK(lods.levels()[count - 1] == 0);       // fills the view
+    CHECK(lods.stats().selections == 1);
+    CHECK(lods.stats().objectsSelected == count);
+
+    // Zero keeps everything at full detail
+    lods.setThreshold(0.0f);
+    lods.select(Matrix4::identity(), kViewPixels, kViewPixels, &mesh);
+    bool full = true;
+    for (uint32_t i = 0; i < count; ++i) full &= lods.levels()[i] == 0;
+    CHECK(full);
+}
+
+void testBehindEye() {
+    LodMesh mesh = disc();
+    LodSelector lods;
+    lods.init(5);
+    lods.setThreshold(1.0f);
+    // w = z: objects at z <= 0 are at or behind the eye
+    Matrix4 view = Matrix4::identity();
+    view.m[2][3] = 1.0f;
+    view.m[3][3] = 0.0f;
+    for (uint32_t i = 0; i < 5; ++i) {
+        Matrix4 world = Matrix4::scaling(0.01f, 0.01f, 0.01f) *
+                        Matrix4::translation(0.0f, 0.0f, -1.0f + i * 0.5f);
+        lods.setObject(i, world, 0);
+    }
+    lods.select(view, kViewPixels, kViewPixels, &mesh);
+    CHECK(lods.levels()[0] == 0 && lods.levels()[1] == 0);
+    CHECK(lods.levels()[2] == 0);
+    // Further away, the same small object coarsens
+    CHECK(lods.levels()[4] > 0);
+}
+
+// An object sitting on a level boundary while the zoom wobbles by 2%
+uint64_t wobble(float hysteresis) {
+    LodMesh mesh = disc();
+    const uint32_t count = 64;
+    LodSelector lods;
+    lods.init(count);
+    lods.setThreshold(1.0f);
+    lods.setHysteresis(hysteresis);
+    for (uint32_t i = 0; i < count; ++i) {
+        // Exactly where level 2 reaches the threshold, give or take
+        float pixels = 1.0f / mesh.levels[2].error * (0.99f + 0.0003f * i);
+        lods.setObject(i, placed(pixels / (kViewPixels * 0.5f), 0.0f, 0.0f),
+                       0);
+    }
+    lods.select(Matrix4::identity(), kViewPixels, kViewPixels, &mesh);
+    uint64_t first = lods.stats().levelChanges;
+    for (int frame = 0; frame < 20; ++frame) {
+        float zoom = frame % 2 == 0 ? 1.02f : 0.98f;
+        lods.select(Matrix4::scaling(zoom, zoom, 1.0f), kViewPixels,
+                    kViewPixels, &mesh);
+    }
+    return lods.stats().levelChanges - first;
+}
+
+void testHysteresis() {
+    uint64_t without = wobble(0.0f);
+    uint64_t with = wobble(0.25f);
+    CHECK(without > 0);
+    CHECK(with < without);
+    CHECK(with <= 64);               // at most one settling change each
+}
+
+// -----------------------------------------------------------------------------
+// Discs on the --instances grid, scaled into their cells, tipped back into
+// a ground plane that runs from just in front of the eye to a thousand
+// times as far, so the near rows want full detail and the far ones a
+// triangle. The view divides by depth and is zoomed by up to 1% each way
+// every frame. Triangles are summed over the levels chosen; full detail is
+// every disc at level 0.
+Matrix4 groundView(float zoom) {
+    Matrix4 view = Matrix4::scaling(zoom, zoom, 1.0f);
+    view.m[2][3] = 1.0f;
+    view.m[3][3] = 0.0f;
+    return view;
+}
+
+void benchRun(uint32_t count, float hysteresis) {
+    const int frames = 50;
+    LodMesh mesh = disc();
+    LodSelector lods;
+    lods.init(count);
+    lods.setThreshold(1.0f);
+    lods.setHysteresis(hysteresis);
+    uint32_t side = static_cast<uint32_t>(ceil(sqrt(double(count))));
+    float cell = 2.0f / side;
+    float scale = std::min(1.0f, cell * 0.9f);
+    for (uint32_t i = 0; i < count; ++i) {
+        float x = -1.0f + cell * (i % side + 0.5f);
+        float depth = scale * std::pow(1000.0f, float(i / side) / side);
+        lods.setObject(i, Matrix4::scaling(scale, scale, scale) *
+                              Matrix4::translation(x, 0.0f, depth), 0);
+    }
+
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> jitter(0.99f, 1.01f);
+    lods.select(groundView(1.0f), 1920.0f, 1080.0f, &mesh);
+    LodStats settled = lods.stats();
+    uint64_t triangles = 0;
+    for (int frame = 0; frame < frames; ++frame) {
+        float zoom = jitter(rng);
+        lods.select(groundView(zoom), 1920.0f, 1080.0f, &mesh);
+        for (uint32_t i = 0; i < count; ++i) {
+            triangles += mesh.levels[lods.levels()[i]].vertexCount / 3;
+        }
+    }
+
+    const LodStats& s = lods.stats();
+    std::cerr << "  hysteresis " << hysteresis << ": select "
+              << (s.selectMs - settled.selectMs) / frames << " ms, "
+              << triangles / frames << " triangles against "
+              << uint64_t(count) * mesh.levels[0].vertexCount / 3
+              << " at full detail, "
+              << (s.levelChanges - settled.levelChanges) / frames
+              << " level changes per frame" << std::endl;
+}
+
+void bench(uint32_t count) {
+    int workers = std::max(1, static_cast<int>(
+                                  std::thread::hardware_concurrency()) - 1);
+    jobSystem().start(workers);
+    std::cerr << count << " discs of 5 levels, 1920x1080, zoom jittering "
+              << "by 1%, " << workers << " workers" << std::endl;
+    benchRun(count, 0.25f);
+    benchRun(count, 0.0f);
+    jobSystem().stop();
+}
+
+} // namespace
+
+// -----------------------------------------------------------------------------
+int main(int argc, char* argv[]) {
+    if (argc == 3 && strcmp(argv[1], "--bench") == 0) {
+        bench(static_cast<uint32_t>(std::max(1, atoi(argv[2]))));
+        return 0;
+    }
+
+    testLevelForSize();
+    testBehindEye();
+    testHysteresis();
+    return testResult("lod");
+}
@@ -0,0 +1,280 @@
+#include "loose_grid.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// Coordinates are packed into 21 bits each for the cell key
+constexpr int32_t kMaxCoordinate = (1 << 20) - 1;
+
+float halfExtent(const Bounds& b) {
+    Float3 e = b.extent();
+    return std::max(std::max(e.x, e.y), e.z);
+}
+
+// Bit k set for the lanes of block `b` that hold an object
+int liveLanes(uint32_t count, size_t b) {
+    size_t left = count - b * 4;
+    return left >= 4 ? 0xF : (1 << left) - 1;
+}
+
+} // namespace
+
+// -----------------------------------------------------------------------------
+void LooseGrid::init(float cellSize) {
+    cells_.clear();
+    freeCells_.clear();
+    lookup_.clear();
+    records_.clear();
+    count_ = 0;
+    cellSize_ = cellSize;
+    inverseCellSize_ = 1.0f / cellSize;
+    maxReach_ = 0.0f;
+}
+
+int32_t LooseGrid::coordinate(float value) const {
+    float c = std::floor(value * inverseCellSize_);
+    return static_cast<int32_t>(std::clamp(
+        c, -static_cast<float>(kMaxCoordinate),
+        static_cast<float>(kMaxCoordinate)));
+}
+
+uint64_t LooseGrid::key(int32_t x, int32_t y, int32_t z) {
+    constexpr uint64_t kMask = (1u << 21) - 1;
+    return (uint64_t(x) & kMask) | ((uint64_t(y) & kMask) << 21) |
+           ((uint64_t(z) & kMask) << 42);
+}
+
+uint32_t LooseGrid::acquireCell(int32_t x, int32_t y, int32_t z) {
+    auto it = lookup_.find(key(x, y, z));
+    if (it != lookup_.end()) return it->second;
+
+    uint32_t index;
+    if (!freeCells_.empty()) {
+        index = freeCells_.back();
+        freeCells_.pop_back();
+    } else {
+        index = static_cast<uint32_t>(cells_.size());
+        cells_.emplace_back();
+    }
+    Cell& cell = cells_[index];
+    cell.x = x;
+    cell.y = y;
+    cell.z = z;
+    cell.count = 0;
+    cell.reach = 0.0f;
+    lookup_.emplace(key(x, y, z), index);
+    return index;
+}
+
+// The cell box widened by how far its objects reach past it
+Bounds LooseGrid::looseBounds(const Cell& cell) const {
+    float margin = cell.reach;
+    return { { cell.x * cellSize_ - margin, cell.y * cellSize_ - margin,
+               cell.z * cellSize_ - margin },
+             { (cell.x + 1) * cellSize_ + margin,
+               (cell.y + 1) * cellSize_ + margin,
+               (cell.z + 1) * cellSize_ + margin } };
+}
+
+void LooseGrid::write(Cell& cell, uint32_t slot, uint32_t id,
+                      const Bounds& bounds) {
+    Block& block = cell.blocks[slot / 4];
+    uint32_t k = slot % 4;
+    block.minX[k] = bounds.min.x;
+    block.minY[k] = bounds.min.y;
+    block.minZ[k] = bounds.min.z;
+    block.maxX[k] = bounds.max.x;
+    block.maxY[k] = bounds.max.y;
+    block.maxZ[k] = bounds.max.z;
+    block.id[k] = id;
+
+    // The center is inside the cell, so the object reaches past it by at
+    // most its half extent
+    cell.reach = std::max(cell.reach, halfExtent(bounds));
+    maxReach_ = std::max(maxReach_, cell.reach);
+}
+
+void LooseGrid::append(uint32_t cellIndex, uint32_t id,
+                       const Bounds& bounds) {
+    Cell& cell = cells_[cellIndex];
+    uint32_t slot = cell.count++;
+    if (slot / 4 == cell.blocks.size()) cell.blocks.emplace_back();
+    write(cell, slot, id, bounds);
+    records_[id] = { cellIndex, slot };
+}
+
+// Fills the slot with the cell's last object; an emptied cell is released
+void LooseGrid::erase(uint32_t cellIndex, uint32_t slot) {
+    Cell& cell = cells_[cellIndex];
+    uint32_t last = --cell.count;
+    if (slot != last) {
+        const Block& from = cell.blocks[last / 4];
+        uint32_t k = last % 4;
+        Bounds bounds = { { from.minX[k], from.minY[k], from.minZ[k] },
+                          { from.maxX[k], from.maxY[k], from.maxZ[k] } };
+        uint32_t moved = from.id[k];
+        write(cell, slot, moved, bounds);
+        records_[moved].slot = slot;
+    }
+    if (last % 4 == 0) cell.blocks.pop_back();
+
+    if (cell.count == 0) {
+        lookup_.erase(key(cell.x, cell.y, cell.z));
+        freeCells_.push_back(cellIndex);
+    }
+}
+
+void LooseGrid::insert(uint32_t id, const Bounds& bounds) {
+    if (id >= records_.size()) records_.resize(id + 1);
+    if (records_[id].cell != kNone) {
+        move(id, bounds);
+        return;
+    }
+    Float3 c = bounds.center();
+    append(acquireCell(coordinate(c.x), coordinate(c.y), coordinate(c.z)),
+           id, bounds);
+    ++count_;
+}
+
+void LooseGrid::move(uint32_t id, const Bounds& bounds) {
+    Record record = records_[id];
+    Float3 c = bounds.center();
+    int32_t x = coordinate(c.x);
+    int32_t y = coordinate(c.y);
+    int32_t z = coordinate(c.z);
+    ++stats_.moves;
+
+    Cell& cell = cells_[record.cell];
+    if (cell.x == x && cell.y == y && cell.z == z) {
+        write(cell, record.slot, id, bounds);
+        return;
+    }
+    erase(record.cell, record.slot);
+    append(acquireCell(x, y, z), id, bounds);
+    ++stats_.cellChanges;
+}
+
+void LooseGrid::remove(uint32_t id) {
+    if (!contains(id)) return;
+    erase(records_[id].cell, records_[id].slot);
+    records_[id].cell = kNone;
+    --count_;
+}
+
+// -----------------------------------------------------------------------------
+void LooseGrid::visitCell(const Cell& cell, const Bounds& box,
+                          const std::function<void(uint32_t)>& fn) {
+    ++stats_.cellsVisited;
+    stats_.objectsTested += cell.count;
+    for (size_t b = 0; b < cell.blocks.size(); ++b) {
+        const Block& block = cell.blocks[b];
+        int overlap = 0;
+        for (int k = 0; k < 4; ++k) {
+            bool x = block.minX[k] <= box.max.x && block.maxX[k] >= box.min.x;
+            bool y = block.minY[k] <= box.max.y && block.maxY[k] >= box.min.y;
+            bool z = block.minZ[k] <= box.max.z && block.maxZ[k] >= box.min.z;
+            overlap |= (x && y && z) << k;
+        }
+        overlap &= liveLanes(cell.count, b);
+        for (int k = 0; k < 4; ++k) {
+            if (overlap & (1 << k)) fn(block.id[k]);
+        }
+    }
+}
+
+void LooseGrid::query(const Bounds& box,
+                      const std::function<void(uint32_t)>& fn) {
+    ++stats_.queries;
+    int32_t x0 = coordinate(box.min.x - maxReach_);
+    int32_t y0 = coordinate(box.min.y - maxReach_);
+    int32_t z0 = coordinate(box.min.z - maxReach_);
+    int32_t x1 = coordinate(box.max.x + maxReach_);
+    int32_t y1 = coordinate(box.max.y + maxReach_);
+    int32_t z1 = coordinate(box.max.z + maxReach_);
+
+    // Look up each cell in the range unless there are fewer cells in use
+    double range = double(x1 - x0 + 1) * (y1 - y0 + 1) * (z1 - z0 + 1);
+    if (range <= lookup_.size()) {
+        for (int32_t z = z0; z <= z1; ++z) {
+            for (int32_t y = y0; y <= y1; ++y) {
+                for (int32_t x = x0; x <= x1; ++x) {
+                    auto it = lookup_.find(key(x, y, z));
+                    if (it != lookup_.end()) {
+                        visitCell(cells_[it->second], box, fn);
+                    }
+                }
+            }
+        }
+        return;
+    }
+
+    for (const Cell& cell : cells_) {
+        if (cell.count == 0) continue;
+        Bounds loose = looseBounds(cell);
+        if (loose.min.x <= box.max.x && loose.max.x >= box.min.x &&
+            loose.min.y <= box.max.y && loose.max.y >= box.min.y &&
+            loose.min.z <= box.max.z && loose.max.z >= box.min.z) {
+            visitCell(cell, box, fn);
+        }
+    }
+}
+
+void LooseGrid::cull(const Plane* planes, uint32_t planeCount,
+                     const std::function<void(uint32_t)>& fn) {
+    ++stats_.queries;
+    for (const Cell& cell : cells_) {
+        if (cell.count == 0) continue;
+
+        // Skip the cell when its loose box is behind a plane, and take all
+        // of it when the box is in front of every plane
+        Bounds loose = looseBounds(cell);
+        bool outside = false;
+        bool inside = true;
+        for (uint32_t p = 0; p < planeCount && !outside; ++p) {
+            const Float3& n = planes[p].normal;
+            Float3 far = { n.x >= 0.0f ? loose.max.x : loose.min.x,
+                           n.y >= 0.0f ? loose.max.y : loose.min.y,
+                           n.z >= 0.0f ? loose.max.z : loose.min.z };
+            Float3 near = { n.x >= 0.0f ? loose.min.x : loose.max.x,
+                            n.y >= 0.0f ? loose.min.y : loose.max.y,
+                            n.z >= 0.0f ? loose.min.z : loose.max.z };
+            outside = dot(n, far) + planes[p].d < 0.0f;
+            inside = inside && dot(n, near) + planes[p].d >= 0.0f;
+        }
+        if (outside) continue;
+
+        ++stats_.cellsVisited;
+        if (inside) {
+            for (uint32_t i = 0; i < cell.count; ++i) {
+                fn(cell.blocks[i / 4].id[i % 4]);
+            }
+            continue;
+        }
+        stats_.objectsTested += cell.count;
+        for (size_t b = 0; b < cell.blocks.size(); ++b) {
+            const Block& block = cell.blocks[b];
+            int culled = 0;
+            for (uint32_t p = 0; p < planeCount; ++p) {
+                const Plane& plane = planes[p];
+                const float* x =
+                    plane.normal.x >= 0.0f ? block.maxX : block.minX;
+                const float* y =
+                    plane.normal.y >= 0.0f ? block.maxY : block.minY;
+                const float* z =
+                    plane.normal.z >= 0.0f ? block.maxZ : block.minZ;
+                for (int k = 0; k < 4; ++k) {
+                    float distance = plane.normal.x * x[k] +
+                                     plane.normal.y * y[k] +
+                                     plane.normal.z * z[k] + plane.d;
+                    culled |= (distance < 0.0f) << k;
+                }
+            }
+            int visible = ~culled & liveLanes(cell.count, b);
+            for (int k = 0; k < 4; ++k) {
+                if (visible & (1 << k)) fn(block.id[k]);
+            }
+        }
+    }
+}
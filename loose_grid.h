@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+#include "math_types.h"
+
+// -----------------------------------------------------------------------------
+// Hashed loose grid for objects that move every frame. An object lives in
+// the one cell containing its center, whatever its size, so moving it is a
+// bounds write, or a swap-remove and an append when it crosses into another
+// cell; nothing is ever rebuilt. Each cell remembers how far its objects
+// reach past the cell, and queries widen the cell box by that much.
+//
+// Cells are allocated on demand and keyed by their integer coordinates, so
+// the grid is unbounded. A cell keeps its objects' bounds in blocks of four
+// with separate x/y/z arrays, the same layout as BvhNode, so queries test
+// four objects per step.
+//
+// Object ids are small caller-assigned integers, such as instance slots.
+// Not thread-safe.
+struct LooseGridStats {
+    uint64_t moves = 0;
+    uint64_t cellChanges = 0;
+    uint64_t queries = 0;
+    uint64_t cellsVisited = 0;
+    uint64_t objectsTested = 0;
+};
+
+class LooseGrid {
+ public:
+    // Objects around a quarter of the cell size or smaller work best
+    void init(float cellSize);
+
+    void insert(uint32_t id, const Bounds& bounds);
+    void move(uint32_t id, const Bounds& bounds);
+    void remove(uint32_t id);
+    bool contains(uint32_t id) const {
+        return id < records_.size() && records_[id].cell != kNone;
+    }
+
+    uint32_t size() const { return count_; }
+    uint32_t cellCount() const { return static_cast<uint32_t>(lookup_.size()); }
+
+    // fn(id) for objects whose bounds overlap `box`
+    void query(const Bounds& box, const std::function<void(uint32_t)>& fn);
+
+    // fn(id) for objects not entirely outside a plane
+    void cull(const Plane* planes, uint32_t planeCount,
+              const std::function<void(uint32_t)>& fn);
+
+    const LooseGridStats& stats() const { return stats_; }
+
+ private:
+    static constexpr uint32_t kNone = ~0u;
+
+    struct Block {
+        float minX[4], minY[4], minZ[4];
+        float maxX[4], maxY[4], maxZ[4];
+        uint32_t id[4];
+    };
+
+    struct Cell {
+        int32_t x, y, z;
+        uint32_t count;
+        float reach;                 // largest half extent since emptied
+        std::vector<Block> blocks;
+    };
+
+    struct Record {
+        uint32_t cell = kNone;
+        uint32_t slot = 0;
+    };
+
+    int32_t coordinate(float value) const;
+    static uint64_t key(int32_t x, int32_t y, int32_t z);
+    uint32_t acquireCell(int32_t x, int32_t y, int32_t z);
+    Bounds looseBounds(const Cell& cell) const;
+    void append(uint32_t cell, uint32_t id, const Bounds& bounds);
+    void write(Cell& cell, uint32_t slot, uint32_t id, const Bounds& bounds);
+    void erase(uint32_t cell, uint32_t slot);
+    void visitCell(const Cell& cell, const Bounds& box,
+                   const std::function<void(uint32_t)>& fn);
+
+    std::vector<Cell> cells_;
+    std::vector<uint32_t> freeCells_;
+    std::unordered_map<uint64_t, uint32_t> lookup_;
+    std::vector<Record> records_;
+    uint32_t count_ = 0;
+    float cellSize_ = 1.0f;
+    float inverseCellSize_ = 1.0f;
+    float maxReach_ = 0.0f;      // over all cells, for widening queries
+    LooseGridStats stats_;
+};
@@ -0,0 +1,269 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "bvh.h"
+#include "job_system.h"
+#include "loose_grid.h"
+#include "test_check.h"
+
+// -----------------------------------------------------------------------------
+// Tests for LooseGrid against brute force: query() and cull() report
+// exactly the objects that pass, after inserts, moves within and across
+// cells, removals and id reuse, with objects larger than a cell included.
+// With --bench it lays that many objects out as the renderer's --instances
+// does and, with 10%, 50% and 100% of them moving each frame, prints the
+// grid's update and cull times next to a BVH's refit and cull.
+//
+//   LooseGridTest [--bench <objects>]
+namespace {
+
+Bounds box(const Float3& center, float halfExtent) {
+    Float3 e = { halfExtent, halfExtent, halfExtent };
+    return { center - e, center + e };
+}
+
+bool overlaps(const Bounds& a, const Bounds& b) {
+    return a.min.x <= b.max.x && b.min.x <= a.max.x &&
+           a.min.y <= b.max.y && b.min.y <= a.max.y &&
+           a.min.z <= b.max.z && b.min.z <= a.max.z;
+}
+
+bool outside(const Bounds& b, const Plane* planes, uint32_t planeCount) {
+    for (uint32_t p = 0; p < planeCount; ++p) {
+        const Plane& plane = planes[p];
+        Float3 corner = { plane.normal.x >= 0.0f ? b.max.x : b.min.x,
+                          plane.normal.y >= 0.0f ? b.max.y : b.min.y,
+                          plane.normal.z >= 0.0f ? b.max.z : b.min.z };
+        if (dot(plane.normal, corner) + plane.d < 0.0f) return true;
+    }
+    return false;
+}
+
+// The grid's contents mirrored in a plain array; live[id] says whether id
+// is in the grid
+struct Mirror {
+    std::vector<Bounds> bounds;
+    std::vector<bool> live;
+
+    void set(uint32_t id, const Bounds& b) {
+        if (id >= bounds.size()) {
+            bounds.resize(id + 1);
+            live.resize(id + 1);
+        }
+        bounds[id] = b;
+        live[id] = true;
+    }
+};
+
+std::vector<uint32_t> sorted(std::vector<uint32_t> ids) {
+    std::sort(ids.begin(), ids.end());
+    return ids;
+}
+
+void checkAgainst(LooseGrid& grid, const Mirror& mirror, uint32_t seed,
+                  int line) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> position(-12.0f, 12.0f);
+    std::uniform_real_distribution<float> size(0.0f, 4.0f);
+    for (int q = 0; q < 20; ++q) {
+        Bounds query = box({ position(rng), position(rng), position(rng) },
+                           size(rng));
+        std::vector<uint32_t> reported;
+        grid.query(query, [&reported](uint32_t id) {
+            reported.push_back(id);
+        });
+        std::vector<uint32_t> expected;
+        for (uint32_t id = 0; id < mirror.bounds.size(); ++id) {
+            if (mirror.live[id] && overlaps(query, mirror.bounds[id])) {
+                expected.push_back(id);
+            }
+        }
+        CHECK_AT(sorted(reported) == expected, "query matches a scan", line);
+    }
+
+    // A box of six planes, wide enough to take some cells whole
+    Plane planes[6] = { { { 1, 0, 0 }, 6 }, { { -1, 0, 0 }, 5 },
+                        { { 0, 1, 0 }, 7 }, { { 0, -1, 0 }, 4 },
+                        { { 0, 0, 1 }, 8 }, { { 0, 0, -1 }, 8 } };
+    std::vector<uint32_t> reported;
+    grid.cull(planes, 6, [&reported](uint32_t id) {
+        reported.push_back(id);
+    });
+    std::vector<uint32_t> expected;
+    for (uint32_t id = 0; id < mirror.bounds.size(); ++id) {
+        if (mirror.live[id] && !outside(mirror.bounds[id], planes, 6)) {
+            expected.push_back(id);
+        }
+    }
+    CHECK_AT(sorted(reported) == expected, "cull matches a scan", line);
+}
+
+void testInsertAndQuery() {
+    LooseGrid grid;
+    grid.init(2.0f);
+    Mirror mirror;
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> position(-10.0f, 10.0f);
+    std::uniform_real_distribution<float> size(0.0f, 0.5f);
+    for (uint32_t id = 0; id < 2000; ++id) {
+        // Every fiftieth object is larger than a cell
+        float half = id % 50 == 0 ? 3.0f : size(rng);
+        Bounds b = box({ position(rng), position(rng), position(rng) }, half);
+        grid.insert(id, b);
+        mirror.set(id, b);
+    }
+    CHECK(grid.size() == 2000 && grid.contains(1999));
+    CHECK(grid.cellCount() > 1);
+    checkAgainst(grid, mirror, 2, __LINE__);
+}
+
+void testMoveAndRemove() {
+    LooseGrid grid;
+    grid.init(2.0f);
+    Mirror mirror;
+    std::mt19937 rng(3);
+    std::uniform_real_distribution<float> position(-10.0f, 10.0f);
+    std::uniform_real_distribution<float> nudge(-0.2f, 0.2f);
+    for (uint32_t id = 0; id < 1000; ++id) {
+        Bounds b = box({ position(rng), position(rng), position(rng) }, 0.3f);
+        grid.insert(id, b);
+        mirror.set(id, b);
+    }
+
+    // Small moves mostly stay in their cell; jumps change cell
+    for (uint32_t id = 0; id < 1000; ++id) {
+        Float3 c = mirror.bounds[id].center();
+        Bounds b = id % 3 == 0
+            ? box({ position(rng), position(rng), position(rng) }, 0.3f)
+            : box({ c.x + nudge(rng), c.y + nudge(rng), c.z }, 0.3f);
+        grid.move(id, b);
+        mirror.set(id, b);
+    }
+    CHECK(grid.stats().moves == 1000);
+    CHECK(grid.stats().cellChanges > 0 && grid.stats().cellChanges < 1000);
+    checkAgainst(grid, mirror, 4, __LINE__);
+
+    for (uint32_t id = 0; id < 1000; id += 2) {
+        grid.remove(id);
+        mirror.live[id] = false;
+    }
+    CHECK(grid.size() == 500 && !grid.contains(0) && grid.contains(1));
+    checkAgainst(grid, mirror, 5, __LINE__);
+
+    // Removed ids may be inserted again
+    for (uint32_t id = 0; id < 1000; id += 4) {
+        Bounds b = box({ position(rng), position(rng), position(rng) }, 0.1f);
+        grid.insert(id, b);
+        mirror.set(id, b);
+    }
+    CHECK(grid.size() == 750);
+    checkAgainst(grid, mirror, 6, __LINE__);
+}
+
+// -----------------------------------------------------------------------------
+double msSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+// Objects on a square grid over [-1, 1], as --instances places them, in
+// cells of four spacings as the renderer uses. A moving object is put
+// somewhere within one and a half spacings of its home, so objects in the
+// columns and rows next to a cell edge may cross it. The view takes in the
+// middle half of the scene, turned.
+void bench(uint32_t count) {
+    const int frames = 10;
+    uint32_t side = static_cast<uint32_t>(ceil(sqrt(double(count))));
+    float spacing = 2.0f / side;
+    std::vector<Float3> homes(count);
+    std::vector<Bounds> bounds(count);
+    for (uint32_t i = 0; i < count; ++i) {
+        homes[i] = { -1.0f + spacing * (i % side + 0.5f),
+                     1.0f - spacing * (i / side + 0.5f), 0.0f };
+        bounds[i] = box(homes[i], spacing * 0.45f);
+    }
+    Plane planes[6];
+    frustumPlanes(Matrix4::rotationZ(0.3f) * Matrix4::scaling(2, 2, 1),
+                  planes);
+
+    int workers = std::max(1, static_cast<int>(
+                                  std::thread::hardware_concurrency()) - 1);
+    jobSystem().start(workers);
+    LooseGrid grid;
+    grid.init(4.0f * spacing);
+    for (uint32_t i = 0; i < count; ++i) grid.insert(i, bounds[i]);
+    Bvh bvh;
+    bvh.build(bounds.data(), count);
+    std::cerr << count << " objects, " << grid.cellCount() << " cells, "
+              << bvh.nodeCount() << " BVH nodes, " << workers << " workers"
+              << std::endl;
+
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> offset(-1.5f, 1.5f);
+    std::vector<uint32_t> moved;
+    for (uint32_t percent : { 10u, 50u, 100u }) {
+        double gridUpdateMs = 0.0;
+        double gridCullMs = 0.0;
+        double bvhUpdateMs = 0.0;
+        double bvhCullMs = 0.0;
+        uint64_t visible[2] = {};
+        uint64_t cellChanges = grid.stats().cellChanges;
+        for (int frame = 0; frame < frames; ++frame) {
+            moved.clear();
+            for (uint32_t i = 0; i < count; ++i) {
+                if (rng() % 100 >= percent) continue;
+                Float3 c = { homes[i].x + offset(rng) * spacing,
+                             homes[i].y + offset(rng) * spacing, 0.0f };
+                bounds[i] = box(c, spacing * 0.45f);
+                moved.push_back(i);
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            for (uint32_t i : moved) grid.move(i, bounds[i]);
+            gridUpdateMs += msSince(start);
+            start = std::chrono::steady_clock::now();
+            grid.cull(planes, 6, [&visible](uint32_t) { ++visible[0]; });
+            gridCullMs += msSince(start);
+
+            start = std::chrono::steady_clock::now();
+            bvh.update(bounds.data());
+            bvhUpdateMs += msSince(start);
+            start = std::chrono::steady_clock::now();
+            bvh.cull(planes, 6, [&visible](uint32_t) { ++visible[1]; });
+            bvhCullMs += msSince(start);
+        }
+        std::cerr << "  " << percent << "% moving: grid update "
+                  << gridUpdateMs / frames << " ms, cull "
+                  << gridCullMs / frames << " ms; BVH refit "
+                  << bvhUpdateMs / frames << " ms, cull "
+                  << bvhCullMs / frames << " ms" << std::endl;
+        std::cerr << "    per frame: "
+                  << (grid.stats().cellChanges - cellChanges) / frames
+                  << " cell changes, " << visible[0] / frames
+                  << " visible in the grid, " << visible[1] / frames
+                  << " reported by the BVH" << std::endl;
+    }
+    jobSystem().stop();
+}
+
+} // namespace
+
+// -----------------------------------------------------------------------------
+int main(int argc, char* argv[]) {
+    if (argc == 3 && strcmp(argv[1], "--bench") == 0) {
+        bench(static_cast<uint32_t>(std::max(1, atoi(argv[2]))));
+        return 0;
+    }
+
+    testInsertAndQuery();
+    testMoveAndRemove();
+    return testResult("loose_grid");
+}
@@ -0,0 +1,350 @@
+#include "lz_codec.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace {
+
+constexpr size_t kMinMatch = 4;
+constexpr size_t kLastLiterals = 5;     // the format ends on literals
+constexpr size_t kMatchSafe = 12;       // no match starts closer to the end
+constexpr size_t kMaxOffset = 65535;
+constexpr uint32_t kFastHashBits = 14;
+constexpr uint32_t kHighHashBits = 16;
+constexpr uint32_t kHighWindow = 1 << 16;
+constexpr uint32_t kHighSearchDepth = 64;
+
+inline uint32_t read32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline uint64_t read64(const uint8_t* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline uint32_t hash4(uint32_t v, uint32_t bits) {
+    return (v * 2654435761u) >> (32 - bits);
+}
+
+inline uint32_t trailingZeros(uint64_t v) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward64(&index, v);
+    return index;
+#else
+    return static_cast<uint32_t>(__builtin_ctzll(v));
+#endif
+}
+
+// Bytes matching from `a` and `b` onwards, stopping at `limit` for `a`
+inline size_t matchLength(const uint8_t* a, const uint8_t* b,
+                          const uint8_t* limit) {
+    const uint8_t* start = a;
+    while (a + 8 <= limit) {
+        uint64_t diff = read64(a) ^ read64(b);
+        if (diff != 0) return size_t(a - start) + trailingZeros(diff) / 8;
+        a += 8;
+        b += 8;
+    }
+    while (a < limit && *a == *b) {
+        ++a;
+        ++b;
+    }
+    return size_t(a - start);
+}
+
+// Output cursor; a sequence that does not fit marks the whole block failed
+struct Writer {
+    uint8_t* op;
+    uint8_t* end;
+    bool ok = true;
+
+    void length(size_t n) {
+        for (; n >= 255; n -= 255) byte(255);
+        byte(static_cast<uint8_t>(n));
+    }
+
+    void byte(uint8_t b) {
+        if (op == end) {
+            ok = false;
+            return;
+        }
+        *op++ = b;
+    }
+
+    // A match of 0 ends the block with literals only
+    void sequence(const uint8_t* literals, size_t literalCount,
+                  size_t offset, size_t match) {
+        size_t ml = match - kMinMatch;
+        byte(static_cast<uint8_t>(
+            (literalCount < 15 ? literalCount : 15) << 4 |
+            (match == 0 ? 0 : ml < 15 ? ml : 15)));
+        if (literalCount >= 15) length(literalCount - 15);
+        if (!ok || size_t(end - op) < literalCount) {
+            ok = false;
+            return;
+        }
+        if (literalCount > 0) memcpy(op, literals, literalCount);
+        op += literalCount;
+        if (match == 0) return;
+        byte(static_cast<uint8_t>(offset));
+        byte(static_cast<uint8_t>(offset >> 8));
+        if (ml >= 15) length(ml - 15);
+    }
+};
+
+size_t compressFast(const uint8_t* src, size_t size, Writer& out) {
+    std::vector<uint32_t> table(size_t(1) << kFastHashBits, 0);
+    const uint8_t* ip = src;
+    const uint8_t* anchor = src;
+    const uint8_t* end = src + size;
+
+    if (size > kMatchSafe) {
+        const uint8_t* searchLimit = end - kMatchSafe;
+        const uint8_t* matchLimit = end - kLastLiterals;
+        uint32_t misses = 0;
+        ++ip;
+        while (ip < searchLimit) {
+            uint32_t v = read32(ip);
+            uint32_t h = hash4(v, kFastHashBits);
+            const uint8_t* ref = src + table[h];
+            table[h] = static_cast<uint32_t>(ip - src);
+            if (ref >= ip || size_t(ip - ref) > kMaxOffset ||
+                read32(ref) != v) {
+                ip += 1 + (misses++ >> 6);
+                continue;
+            }
+            misses = 0;
+
+            while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+                --ip;
+                --ref;
+            }
+            size_t match = kMinMatch + matchLength(ip + kMinMatch,
+                                                   ref + kMinMatch,
+                                                   matchLimit);
+            out.sequence(anchor, size_t(ip - anchor), size_t(ip - ref),
+                         match);
+            if (!out.ok) return 0;
+            ip += match;
+            anchor = ip;
+            if (ip - 2 >= src && ip < searchLimit) {
+                table[hash4(read32(ip - 2), kFastHashBits)] =
+                    static_cast<uint32_t>(ip - 2 - src);
+            }
+        }
+    }
+    out.sequence(anchor, size_t(end - anchor), 0, 0);
+    return out.ok ? 1 : 0;
+}
+
+// Hash chains over the window; chain_ holds the distance back to the
+// previous position with the same hash
+class HighMatcher {
+ public:
+    HighMatcher(const uint8_t* src, size_t size)
+        : src_(src),
+          size_(size),
+          head_(size_t(1) << kHighHashBits, -1),
+          chain_(kHighWindow, 0) {
+    }
+
+    void insertUpTo(size_t position) {
+        for (; next_ < position && next_ + kMinMatch <= size_; ++next_) {
+            uint32_t h = hash4(read32(src_ + next_), kHighHashBits);
+            int64_t previous = head_[h];
+            size_t delta = previous < 0 ? 0 : next_ - size_t(previous);
+            chain_[next_ & (kHighWindow - 1)] =
+                static_cast<uint16_t>(delta > kMaxOffset ? 0 : delta);
+            head_[h] = static_cast<int64_t>(next_);
+        }
+    }
+
+    // Longest match for `position` ending before `limit`
+    size_t find(size_t position, const uint8_t* limit, size_t& offset) {
+        insertUpTo(position);
+        const uint8_t* ip = src_ + position;
+        int64_t candidate = head_[hash4(read32(ip), kHighHashBits)];
+        size_t best = 0;
+        for (uint32_t depth = 0; candidate >= 0 && depth < kHighSearchDepth;
+             ++depth) {
+            size_t distance = position - size_t(candidate);
+            if (distance == 0 || distance > kMaxOffset) break;
+            const uint8_t* ref = src_ + candidate;
+            if (ref[best] == ip[best] && read32(ref) == read32(ip)) {
+                size_t length = kMinMatch +
+                    matchLength(ip + kMinMatch, ref + kMinMatch, limit);
+                if (length > best) {
+                    best = length;
+                    offset = distance;
+                    if (ip + best >= limit) break;
+                }
+            }
+            uint16_t delta = chain_[size_t(candidate) & (kHighWindow - 1)];
+            if (delta == 0) break;
+            candidate -= delta;
+        }
+        return best;
+    }
+
+ private:
+    const uint8_t* src_;
+    size_t size_;
+    size_t next_ = 0;
+    std::vector<int64_t> head_;
+    std::vector<uint16_t> chain_;
+};
+
+// One step of lazy matching: a match is deferred when the next position
+// has a longer one
+size_t compressHigh(const uint8_t* src, size_t size, Writer& out) {
+    const uint8_t* anchor = src;
+    const uint8_t* end = src + size;
+
+    if (size > kMatchSafe) {
+        HighMatcher matcher(src, size);
+        const uint8_t* matchLimit = end - kLastLiterals;
+        size_t searchLimit = size - kMatchSafe;
+        size_t position = 0;
+        while (position < searchLimit) {
+            size_t offset = 0;
+            size_t match = matcher.find(position, matchLimit, offset);
+            if (match < kMinMatch) {
+                ++position;
+                continue;
+            }
+            while (position + 1 < searchLimit) {
+                size_t nextOffset = 0;
+                size_t next = matcher.find(position + 1, matchLimit,
+                                           nextOffset);
+                if (next <= match) break;
+                ++position;
+                match = next;
+                offset = nextOffset;
+            }
+
+            const uint8_t* ip = src + position;
+            out.sequence(anchor, size_t(ip - anchor), offset, match);
+            if (!out.ok) return 0;
+            position += match;
+            anchor = src + position;
+        }
+    }
+    out.sequence(anchor, size_t(end - anchor), 0, 0);
+    return out.ok ? 1 : 0;
+}
+
+// Copies in 16-byte steps when both sides have room to overrun, which the
+// following sequences then overwrite
+inline void copyForward(uint8_t* op, const uint8_t* from, size_t n,
+                        const uint8_t* opEnd, const uint8_t* fromEnd) {
+    if (op + n + 16 <= opEnd && from + n + 16 <= fromEnd) {
+        for (size_t i = 0; i < n; i += 16) memcpy(op + i, from + i, 16);
+    } else if (n > 0) {
+        memcpy(op, from, n);
+    }
+}
+
+} // namespace
+
+// -----------------------------------------------------------------------------
+size_t lzBound(size_t size) {
+    return size + size / 255 + 16;
+}
+
+size_t lzCompress(const uint8_t* src, size_t size, uint8_t* dst,
+                  size_t capacity, LzLevel level) {
+    Writer out = { dst, dst + capacity };
+    size_t ok = level == LzLevel::kHigh ? compressHigh(src, size, out)
+                                        : compressFast(src, size, out);
+    return ok ? size_t(out.op - dst) : 0;
+}
+
+bool lzDecompress(const uint8_t* src, size_t size, uint8_t* dst,
+                  size_t rawSize) {
+    const uint8_t* ip = src;
+    const uint8_t* ipEnd = src + size;
+    uint8_t* op = dst;
+    uint8_t* opEnd = dst + rawSize;
+
+    // Length extensions: 255 continues, anything else ends
+    auto extend = [&](size_t& length) {
+        uint8_t b;
+        do {
+            if (ip == ipEnd) return false;
+            b = *ip++;
+            length += b;
+        } while (b == 255);
+        return true;
+    };
+
+    while (ip < ipEnd) {
+        uint8_t token = *ip++;
+        size_t literals = token >> 4;
+
+        // Most sequences are short: fixed-size copies of a short literal
+        // run and match, with room to overrun in both buffers
+        if (literals < 15 && ipEnd - ip >= 18 && opEnd - op >= 40) {
+            memcpy(op, ip, 16);
+            ip += literals;
+            op += literals;
+            size_t offset = size_t(ip[0]) | size_t(ip[1]) << 8;
+            size_t match = (token & 15) + kMinMatch;
+            if (match < 15 + kMinMatch && offset >= 8 &&
+                offset <= size_t(op - dst) && ip + 2 < ipEnd) {
+                const uint8_t* from = op - offset;
+                memcpy(op, from, 8);
+                memcpy(op + 8, from + 8, 8);
+                memcpy(op + 16, from + 16, 8);
+                ip += 2;
+                op += match;
+                continue;
+            }
+        } else {
+            if (literals == 15 && !extend(literals)) return false;
+            if (literals > size_t(ipEnd - ip) ||
+                literals > size_t(opEnd - op)) {
+                return false;
+            }
+            copyForward(op, ip, literals, opEnd, ipEnd);
+            ip += literals;
+            op += literals;
+        }
+        if (ip == ipEnd) break;
+
+        if (ipEnd - ip < 2) return false;
+        size_t offset = size_t(ip[0]) | size_t(ip[1]) << 8;
+        ip += 2;
+        size_t match = token & 15;
+        if (match == 15 && !extend(match)) return false;
+        match += kMinMatch;
+        if (offset == 0 || offset > size_t(op - dst) ||
+            match > size_t(opEnd - op)) {
+            return false;
+        }
+
+        const uint8_t* from = op - offset;
+        if (offset >= 16) {
+            copyForward(op, from, match, opEnd, opEnd);
+        } else {
+            // Overlapping: the match repeats its first `offset` bytes, so
+            // each copy can take everything written so far, doubling
+            for (size_t copied = 0; copied < match;) {
+                size_t n = std::min(offset + copied, match - copied);
+                memcpy(op + copied, from, n);
+                copied += n;
+            }
+        }
+        op += match;
+    }
+    return op == opEnd;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// -----------------------------------------------------------------------------
+// Byte-oriented LZ77 compression in the LZ4 block format: each sequence is
+// a token holding the literal and match lengths, the literals, a 16-bit
+// back offset and any length extension bytes. Decoding is a loop of copies
+// with no entropy stage, which is what makes it fast enough to run between
+// a read completing and the upload.
+//
+// kFast finds matches through one hash table probe per position, skipping
+// ahead faster the longer it goes without one. kHigh follows hash chains
+// over the whole 64 KB window and keeps the longest match, spending much
+// more time compressing for smaller output at the same decode speed.
+//
+// Blocks are independent; nothing is shared between calls, so any number
+// may run at once.
+enum class LzLevel : uint8_t {
+    kFast,
+    kHigh,
+};
+
+// Worst-case compressed size of `size` bytes
+size_t lzBound(size_t size);
+
+// Returns the compressed size, or 0 when the output would not fit in
+// `capacity` bytes
+size_t lzCompress(const uint8_t* src, size_t size, uint8_t* dst,
+                  size_t capacity, LzLevel level);
+
+// Decodes exactly `rawSize` bytes. Every length and offset is checked
+// against both buffers, so corrupt input fails instead of overrunning.
+bool lzDecompress(const uint8_t* src, size_t size, uint8_t* dst,
+                  size_t rawSize);
@@ -0,0 +1,336 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "lz_codec.h"
+#include "pack_file.h"
+#include "test_check.h"
+
+// -----------------------------------------------------------------------------
+// Tests for the LZ codec and asset packs: round trips of random, all-zero,
+// short and incompressible inputs at both levels, truncated blocks and
+// hand-made blocks with a bad offset or an oversized length failing to
+// decode, and a pack written, opened and loaded with every codec, then
+// rejected once its index is corrupted. With --bench it compresses and
+// decompresses that many KB of mesh-like data at both levels and prints
+// the ratio and MB/s each way.
+//
+//   LzCodecTest [--bench <kb>]
+namespace {
+
+const LzLevel kLevels[] = { LzLevel::kFast, LzLevel::kHigh };
+
+std::vector<uint8_t> compress(const std::vector<uint8_t>& raw,
+                              LzLevel level) {
+    std::vector<uint8_t> packed(lzBound(raw.size()));
+    size_t size = lzCompress(raw.data(), raw.size(), packed.data(),
+                             packed.size(), level);
+    packed.resize(size);
+    return packed;
+}
+
+bool roundTrips(const std::vector<uint8_t>& raw, LzLevel level) {
+    std::vector<uint8_t> packed = compress(raw, level);
+    if (packed.empty() || packed.size() > lzBound(raw.size())) return false;
+    std::vector<uint8_t> out(raw.size() + 1, 0xCD);
+    return lzDecompress(packed.data(), packed.size(), out.data(),
+                        raw.size()) &&
+           std::equal(raw.begin(), raw.end(), out.begin()) &&
+           out.back() == 0xCD;
+}
+
+// Vertices on a heightfield, as in a vertex buffer: x and z stepping over
+// a grid, quantized heights with a little noise
+std::vector<uint8_t> meshLike(size_t size, uint32_t seed) {
+    std::mt19937 rng(seed);
+    std::vector<uint8_t> data(size);
+    for (size_t i = 0; i + 12 <= size; i += 12) {
+        size_t vertex = i / 12;
+        float position[3] = {
+            float(vertex % 64),
+            std::floor(std::sin(vertex * 0.01f) * 16.0f + rng() % 2) / 16.0f,
+            float(vertex / 64),
+        };
+        memcpy(&data[i], position, 12);
+    }
+    return data;
+}
+
+std::vector<uint8_t> randomBytes(size_t size, uint32_t seed) {
+    std::mt19937 rng(seed);
+    std::vector<uint8_t> data(size);
+    for (uint8_t& b : data) b = static_cast<uint8_t>(rng());
+    return data;
+}
+
+void testRoundTrip() {
+    for (LzLevel level : kLevels) {
+        for (size_t size = 0; size < 12; ++size) {
+            CHECK(roundTrips(std::vector<uint8_t>(size, 'a'), level));
+            CHECK(roundTrips(randomBytes(size, 1), level));
+        }
+        for (size_t size : { 100, 4096, 65536, 300000 }) {
+            CHECK(roundTrips(std::vector<uint8_t>(size, 0), level));
+            CHECK(roundTrips(meshLike(size, 2), level));
+            CHECK(roundTrips(randomBytes(size, 3), level));
+        }
+
+        // Zeros collapse; random bytes grow only by the format's overhead
+        std::vector<uint8_t> zeros(65536, 0);
+        CHECK(compress(zeros, level).size() < 512);
+        std::vector<uint8_t> noise = randomBytes(65536, 4);
+        size_t packed = compress(noise, level).size();
+        CHECK(packed >= noise.size() && packed <= lzBound(noise.size()));
+    }
+
+    // kHigh searches harder for the same format
+    std::vector<uint8_t> mesh = meshLike(1 << 18, 5);
+    CHECK(compress(mesh, LzLevel::kHigh).size() <=
+          compress(mesh, LzLevel::kFast).size());
+
+    // Too little room fails instead of overrunning
+    std::vector<uint8_t> noise = randomBytes(1000, 6);
+    std::vector<uint8_t> small(500);
+    CHECK(lzCompress(noise.data(), noise.size(), small.data(), small.size(),
+                     LzLevel::kFast) == 0);
+}
+
+void testTruncated() {
+    for (LzLevel level : kLevels) {
+        std::vector<uint8_t> raw = meshLike(20000, 7);
+        std::vector<uint8_t> packed = compress(raw, level);
+        std::vector<uint8_t> out(raw.size());
+        bool rejected = true;
+        for (size_t size = 0; size < packed.size(); ++size) {
+            // Copied so reading past the end would be past the allocation
+            std::vector<uint8_t> cut(packed.begin(), packed.begin() + size);
+            rejected &= !lzDecompress(cut.data(), cut.size(), out.data(),
+                                      out.size());
+        }
+        CHECK(rejected);
+        // The wrong raw size fails either way
+        CHECK(!lzDecompress(packed.data(), packed.size(), out.data(),
+                            out.size() - 1));
+    }
+}
+
+// Blocks written by hand: "abcd", a match of 8 from 4 back, then "x"
+void testCorrupt() {
+    const uint8_t valid[] = { 0x44, 'a', 'b', 'c', 'd', 4, 0, 0x10, 'x' };
+    std::vector<uint8_t> block(valid, valid + sizeof(valid));
+    uint8_t out[64];
+    CHECK(lzDecompress(block.data(), block.size(), out, 13));
+    CHECK(memcmp(out, "abcdabcdabcdx", 13) == 0);
+
+    // An offset reaching before the start of the output, or zero
+    std::vector<uint8_t> bad = block;
+    bad[5] = 5;
+    CHECK(!lzDecompress(bad.data(), bad.size(), out, 13));
+    bad[5] = 0;
+    CHECK(!lzDecompress(bad.data(), bad.size(), out, 13));
+
+    // A match longer than the output left
+    bad = block;
+    bad[0] = 0x4F;
+    bad.insert(bad.begin() + 7, 10);
+    CHECK(!lzDecompress(bad.data(), bad.size(), out, 13));
+
+    // Literal runs longer than the input holds, or than the output
+    const uint8_t longLiterals[] = { 0xF0, 200, 'a', 'b', 'c' };
+    CHECK(!lzDecompress(longLiterals, sizeof(longLiterals), out,
+                        sizeof(out)));
+    const uint8_t endless[] = { 0xF0, 255, 255 };
+    CHECK(!lzDecompress(endless, sizeof(endless), out, sizeof(out)));
+    CHECK(!lzDecompress(valid, sizeof(valid), out, 4));
+
+    // Long enough for the decoder's fast path: 14 literals, a match of 4
+    // from 8 back, then 30 literals
+    std::vector<uint8_t> longer = { 0xE0 };
+    for (int i = 0; i < 14; ++i) longer.push_back('a' + i);
+    longer.insert(longer.end(), { 8, 0, 0xF0, 15 });
+    for (int i = 0; i < 30; ++i) longer.push_back('0' + i % 10);
+    uint8_t decoded[48];
+    CHECK(lzDecompress(longer.data(), longer.size(), decoded, 48));
+    CHECK(memcmp(decoded + 14, "ghij0123", 8) == 0);
+    longer[15] = 15;
+    CHECK(!lzDecompress(longer.data(), longer.size(), decoded, 48));
+    longer[15] = 200;
+    CHECK(!lzDecompress(longer.data(), longer.size(), decoded, 48));
+}
+
+// -----------------------------------------------------------------------------
+namespace fs = std::filesystem;
+
+std::string tempPath(const char* name) {
+    return (fs::temp_directory_path() / name).string();
+}
+
+bool readFile(const std::string& path, std::vector<uint8_t>& data) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file == nullptr) return false;
+    data.resize(fs::file_size(path));
+    bool ok = fread(data.data(), 1, data.size(), file) == data.size();
+    fclose(file);
+    return ok;
+}
+
+bool writeFile(const std::string& path, const std::vector<uint8_t>& data) {
+    FILE* file = fopen(path.c_str(), "wb");
+    if (file == nullptr) return false;
+    bool ok = fwrite(data.data(), 1, data.size(), file) == data.size();
+    fclose(file);
+    return ok;
+}
+
+void testPack() {
+    const uint32_t blockSize = 4096;
+    std::vector<std::vector<uint8_t>> assets = {
+        meshLike(50000, 9),              // thirteen blocks, the last short
+        randomBytes(3 * blockSize, 10),  // stored: does not shrink
+        {},
+        std::vector<uint8_t>(100, 7),
+    };
+    const char* names[] = { "mesh", "noise", "empty", "sevens" };
+    PackWriter writer;
+    for (size_t a = 0; a < assets.size(); ++a) writer.add(names[a], assets[a]);
+
+    std::string path = tempPath("lz_codec_test.pack");
+    for (PackCodec codec : { PackCodec::kStore, PackCodec::kLzFast,
+                             PackCodec::kLzHigh }) {
+        PackWriteStats stats;
+        CHECK(writer.write(path, codec, blockSize, &stats));
+        CHECK(stats.blocks == 13 + 3 + 0 + 1);
+        // The noise never shrinks; the mesh does
+        CHECK(codec == PackCodec::kStore
+                  ? stats.storedBlocks == stats.blocks
+                  : stats.storedBlocks >= 3 &&
+                        stats.storedBlocks < stats.blocks);
+        CHECK(stats.packBytes > 0 && (codec == PackCodec::kStore ||
+                                      stats.packBytes < stats.rawBytes));
+
+        PackReader reader;
+        CHECK(reader.open(path));
+        CHECK(reader.assetCount() == assets.size());
+        CHECK(reader.blockSize() == blockSize);
+        CHECK(reader.find("missing") == -1);
+        for (size_t a = 0; a < assets.size(); ++a) {
+            int index = reader.find(names[a]);
+            CHECK(index >= 0 && reader.name(index) == names[a]);
+            if (index < 0) continue;
+            CHECK(reader.asset(index).rawSize == assets[a].size());
+            std::vector<uint8_t> loaded(assets[a].size() + 1, 0xCD);
+            CHECK(reader.load(index, loaded.data()));
+            CHECK(std::equal(assets[a].begin(), assets[a].end(),
+                             loaded.begin()) && loaded.back() == 0xCD);
+        }
+    }
+
+    std::vector<uint8_t> pack;
+    CHECK(readFile(path, pack));
+    PackFooter footer;
+    memcpy(&footer, pack.data() + pack.size() - sizeof(footer),
+           sizeof(footer));
+    size_t blocks = footer.indexOffset +
+                    footer.assetCount * sizeof(PackAssetEntry);
+
+    // Each corruption of the index is caught by open()
+    auto rejected = [&](size_t at, const void* bytes, size_t size) {
+        std::vector<uint8_t> corrupt = pack;
+        memcpy(corrupt.data() + at, bytes, size);
+        std::string corruptPath = tempPath("lz_codec_test_corrupt.pack");
+        PackReader reader;
+        bool opened = writeFile(corruptPath, corrupt) &&
+                      reader.open(corruptPath);
+        fs::remove(corruptPath);
+        return !opened;
+    };
+    uint32_t huge = 0x7FFFFFFF;
+    uint64_t pastIndex = footer.indexOffset;
+    uint8_t badCodec = 9;
+    uint32_t badMagic = 0;
+    CHECK(rejected(blocks + offsetof(PackBlock, compressedSize), &huge, 4));
+    CHECK(rejected(blocks + offsetof(PackBlock, offset), &pastIndex, 8));
+    CHECK(rejected(blocks + offsetof(PackBlock, codec), &badCodec, 1));
+    CHECK(rejected(footer.indexOffset + offsetof(PackAssetEntry, rawSize),
+                   &huge, 4));
+    CHECK(rejected(footer.indexOffset + offsetof(PackAssetEntry, nameLength),
+                   &huge, 4));
+    CHECK(rejected(pack.size() - 4, &badMagic, 4));
+    CHECK(rejected(pack.size() - sizeof(footer), &huge, 4));
+
+    // A corrupt block opens but fails to load: all 255s is a literal
+    // length that never ends
+    std::vector<uint8_t> corrupt = pack;
+    PackBlock first;
+    memcpy(&first, pack.data() + blocks, sizeof(first));
+    CHECK(first.codec == static_cast<uint8_t>(PackCodec::kLzHigh));
+    memset(corrupt.data() + first.offset, 0xFF, first.compressedSize);
+    CHECK(writeFile(path, corrupt));
+    PackReader reader;
+    CHECK(reader.open(path));
+    std::vector<uint8_t> loaded(assets[0].size());
+    CHECK(reader.assetCount() == 4 && !reader.load(0, loaded.data()));
+    reader.close();
+    fs::remove(path);
+}
+
+// -----------------------------------------------------------------------------
+double msSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+void bench(uint32_t kb) {
+    std::vector<uint8_t> raw = meshLike(size_t(kb) << 10, 11);
+    std::vector<uint8_t> packed(lzBound(raw.size()));
+    std::vector<uint8_t> out(raw.size());
+    for (LzLevel level : kLevels) {
+        auto start = std::chrono::steady_clock::now();
+        size_t size = lzCompress(raw.data(), raw.size(), packed.data(),
+                                 packed.size(), level);
+        double compressMs = msSince(start);
+
+        const int passes = 10;
+        bool ok = true;
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < passes; ++i) {
+            ok &= lzDecompress(packed.data(), size, out.data(), out.size());
+        }
+        double decompressMs = msSince(start) / passes;
+
+        double mb = raw.size() / double(1 << 20);
+        std::cerr << (level == LzLevel::kHigh ? "high: " : "fast: ")
+                  << kb << " KB to " << size / 1024 << " KB ("
+                  << double(raw.size()) / std::max<size_t>(size, 1)
+                  << ":1), compress " << mb / (compressMs * 1e-3)
+                  << " MB/s, decompress " << mb / (decompressMs * 1e-3)
+                  << " MB/s" << (ok && out == raw ? "" : ", MISMATCH")
+                  << std::endl;
+    }
+}
+
+} // namespace
+
+// -----------------------------------------------------------------------------
+int main(int argc, char* argv[]) {
+    if (argc == 3 && strcmp(argv[1], "--bench") == 0) {
+        bench(static_cast<uint32_t>(std::max(1, atoi(argv[2]))));
+        return 0;
+    }
+
+    testRoundTrip();
+    testTruncated();
+    testCorrupt();
+    testPack();
+    return testResult("lz_codec");
+}
@@ -1,10 +1,49 @@
+#define NOMINMAX
 #include <windows.h>
+#include <windowsx.h>
+#include <comdef.h>
 #include <d3d11.h>
+#include <d3d11_1.h>
 #include <dxgi.h>
 #include <dxgi1_2.h>
+#include <dxgi1_4.h>
 #include <DirectXMath.h>
 #include <d3dcompiler.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "async_loading.h"
+#include "bounded_queue.h"
+#include "bvh.h"
+#include "command_buffer.h"
+#include "constant_cache.h"
+#include "cpu_topology.h"
+#include "ecs.h"
+#include "frame_arena.h"
+#include "gpu_resources.h"
+#include "instance_buffer.h"
+#include "job_system.h"
+#include "lod.h"
+#include "loose_grid.h"
+#include "mesh_file.h"
+#include "pack_file.h"
+#include "picking.h"
+#include "profiler.h"
+#include "sampling_profiler.h"
+#include "scene_components.h"
+#include "scene_graph.h"
+#include "texture_file.h"
+#include "texture_streaming.h"
+#include "upload_manager.h"
+#include "video_memory.h"
 
 #pragma comment(lib, "d3d11.lib")
 #pragma comment(lib, "dxgi.lib")
@@ -24,11 +63,16 @@ const char* vertexShaderSrc = R"(
 struct VS_INPUT {
     float3 position : POSITION;
     float4 color : COLOR;
+    float4 world0 : WORLD0;
+    float4 world1 : WORLD1;
+    float4 world2 : WORLD2;
+    float4 world3 : WORLD3;
 };
 
 struct PS_INPUT {
     float4 position : SV_POSITION;
     float4 color : COLOR;
+    float2 uv : TEXCOORD0;
 };
 
 cbuffer ConstantBuffer : register(b0) {
@@ -37,9 +81,13 @@ cbuffer ConstantBuffer : register(b0) {
 
 PS_INPUT VSMain(VS_INPUT input) {
     PS_INPUT output;
-    output.position = float4(input.position, 1.0f);
+    float4x4 world = float4x4(input.world0, input.world1, input.world2,
+                              input.world3);
+    output.position = mul(world, float4(input.position, 1.0f));
     output.position = mul(FinalMatrix, output.position);
     output.color = input.color;
+    // Planar mapping: the texture spans object x and y in [-0.5, 0.5]
+    output.uv = input.position.xy * float2(1.0f, -1.0f) + 0.5f;
     return output;
 }
 )";
@@ -48,10 +96,14 @@ const char* pixelShaderSrc = R"(
 struct PS_INPUT {
     float4 position : SV_POSITION;
     float4 color : COLOR;
+    float2 uv : TEXCOORD0;
 };
 
+Texture2D Texture : register(t0);
+SamplerState Sampler : register(s0);
+
 float4 PSMain(PS_INPUT input) : SV_TARGET {
-    return input.color;
+    return Texture.Sample(Sampler, input.uv) * input.color;
 }
 )";
 
@@ -66,6 +118,69 @@ struct CBUFFER {
     DirectX::XMMATRIX FinalMatrix;
 };
 
+// Per-instance vertex stream; stored transposed like FinalMatrix
+struct InstanceData {
+    Matrix4 world;
+};
+
+// Everything the present thread needs to submit one frame. Built on the main
+// thread so frame preparation never waits on a blocking Present(). The
+// recorded commands live in the frame's arena, as do the projected texture
+// sizes the streamer plans from when the frame is submitted. Residency is
+// only refreshed for what the frame uses: the mesh and instance buffers if
+// it draws (or updates the instances), textures the visible instances map.
+// A frame that replaces the whole instance buffer carries a snapshot of it
+// outside the arena, which is too small for a large instance array.
+struct FrameData {
+    const CommandBuffer* commands;
+    const float* texturePixels;  // per streamed texture, or nullptr
+    const uint8_t* instanceSnapshot;  // whole instance buffer, or nullptr
+    bool drawsInstances;
+    bool uploadsInstances;
+};
+
+// Frames the main thread may run ahead of the present thread.
+constexpr size_t kMaxQueuedFrames = 1;
+
+// Requests from WindowProc that need the device context to themselves.
+// mainloop() stops queuing frames, keeps pumping messages until the present
+// thread has drained, and only then carries them out.
+enum class WindowAction { kNone, kToggleFullscreen, kClose };
+
+// One arena per frame in flight: being built, queued and being submitted.
+constexpr size_t kFrameArenaCount = kMaxQueuedFrames + 2;
+constexpr size_t kFrameArenaBytes = 8 << 20;
+constexpr size_t kCommandBufferWords = 1 << 20;
+constexpr uint32_t kUploadRingBytes = 8 << 20;
+
+// Instance data recorded per frame; the rest of a large change is spread
+// over the following frames. A backlog of more than kInstanceBacklogFrames
+// frames' worth is sent as one upload of the whole buffer instead, so the
+// GPU's copy never trails the CPU by more than that.
+constexpr uint32_t kInstanceUploadBytes = 2 << 20;
+constexpr uint32_t kInstanceBacklogFrames = 4;
+
+// Culled instances between two visible runs are drawn anyway, saving a
+// draw, when there are at most this many
+constexpr uint32_t kDrawMergeGap = 16;
+
+// Loose grid cell edge, in instance spacings
+constexpr float kGridCellInstances = 4.0f;
+
+// Rim segments of the finest and coarsest levels of the LOD disc; each
+// level has a quarter of the segments of the one before
+constexpr uint32_t kDiscSegments = 768;
+constexpr uint32_t kDiscCoarsestSegments = 3;
+
+// Streamed texture memory unless --texture-budget-mb says otherwise
+constexpr uint64_t kDefaultTextureBudgetBytes = 64ull << 20;
+
+// By TextureFormat
+constexpr DXGI_FORMAT kTextureDxgiFormats[] = {
+    DXGI_FORMAT_R8G8B8A8_UNORM, DXGI_FORMAT_BC1_UNORM, DXGI_FORMAT_BC3_UNORM,
+    DXGI_FORMAT_BC4_UNORM,      DXGI_FORMAT_BC5_UNORM, DXGI_FORMAT_BC7_UNORM,
+};
+
 // -----------------------------------------------------------------------------
 class MainWindow {
  public:
@@ -79,28 +194,200 @@ class MainWindow {
 
     HRESULT resizeSwapChain(uint32_t width, uint32_t height);
 
+    // Must be called before init()
+    void setPresentThreadEnabled(bool enabled) { use_present_thread_ = enabled; }
+    void setSimulatedVideoMemoryBudget(uint64_t bytes) {
+        simulated_budget_bytes_ = bytes;
+    }
+    void setFrameArenaBacking(const BackingOptions& options) {
+        arena_backing_ = options;
+    }
+    void setPresentThreadPlacement(const ThreadPlacement& placement) {
+        present_placement_ = placement;
+    }
+    void setUploadBatching(bool enabled) { uploads_.setBatching(enabled); }
+    void setStaticScene(bool enabled) { static_scene_ = enabled; }
+    void setInstanceCount(uint32_t count) { instance_count_ = count; }
+    void setInstanceChurn(float percent) { instance_churn_ = percent; }
+    void setInstanceRespawn(float percent) { instance_respawn_ = percent; }
+    void setLooseGrid(bool enabled) { loose_grid_ = enabled; }
+    void setPickRays(uint32_t count) { pick_rays_ = count; }
+    void setLod(bool enabled) { lod_ = enabled; }
+    void setLodThreshold(float pixels) { lods_.setThreshold(pixels); }
+    void setMeshPath(const std::string& path) { mesh_path_ = path; }
+    // --mesh then names an asset in this pack instead of a file
+    void setPackPath(const std::string& path) { pack_path_ = path; }
+    // Instance i uses texture i % count; without any, textures are white
+    void addTexturePath(const std::string& path) {
+        texture_paths_.push_back(path);
+    }
+    void setTextureBudget(uint64_t bytes) { texture_budget_bytes_ = bytes; }
+
+    // Casts a ray through client pixel (x, y) with the last frame's view
+    RayHit pick(float x, float y);
+
+    void reportStats() const;
+
  private:
     static LRESULT CALLBACK WindowProc(HWND hWnd, UINT message,
                                        WPARAM wParam, LPARAM lParam);
 
  private:
     bool is_fullscreen_;
+    bool use_present_thread_;
+    bool static_scene_;
+    uint32_t instance_count_;
+    float instance_churn_;
+    float instance_respawn_;
+    bool loose_grid_;
+    uint32_t pick_rays_;
+    bool lod_;
+    std::string mesh_path_;
+    std::string pack_path_;
+    std::vector<std::string> texture_paths_;
+    uint64_t texture_budget_bytes_;
+    uint64_t simulated_budget_bytes_;
     HWND hWnd_;
     ID3D11RenderTargetView* pRenderTargetView_;
     ID3D11Device* pDevice_;
     ID3D11DeviceContext* pDeviceContext_;
     IDXGISwapChain1* pSwapChain_;
-    ID3D11VertexShader* pVertexShader_;
-    ID3D11PixelShader* pPixelShader_;
-    ID3D11InputLayout* pInputLayout_;
-    ID3D11Buffer* pVertexBuffer_;
-    ID3D11Buffer* pConstBuffer_;
+
+    // Resources; tables are only modified on the context thread
+    GpuResources resources_;
+    VertexShaderHandle vertexShader_;
+    PixelShaderHandle pixelShader_;
+    InputLayoutHandle inputLayout_;
+    BufferHandle vertexBuffer_;
+    BufferHandle constBuffer_;
+    SamplerHandle sampler_;
+    UploadManager uploads_;
+    ConstantCache constants_;
+
+    // Instances; written by the main thread, uploaded by dirty page
+    InstanceBuffer instances_;
+    BufferHandle instanceBuffer_;
+    SceneGraph scene_;
+    World entities_;
+    std::vector<Entity> instanceEntities_;
+    EntityCommandBuffer spawns_;            // respawns, played per frame
+    std::vector<uint32_t> spawnSlots_;      // in recording order
+    std::vector<Entity> spawned_;
+    uint64_t respawned_;
+    std::vector<Vertex> meshVertices_;
+    std::vector<Bounds> meshBounds_;
+    std::vector<LodMesh> lodMeshes_;
+    std::vector<Bounds> instanceBounds_;    // by instance slot
+    std::vector<Matrix4> instanceWorlds_;   // by instance slot
+    std::vector<uint32_t> instanceMeshes_;  // by instance slot
+    std::vector<uint32_t> instanceMaterials_;   // by instance slot
+    std::vector<PickMesh> pickMeshes_;
+    std::vector<uint32_t> movedSlots_;      // in the last updateInstances()
+    Bvh bvh_;
+    LooseGrid grid_;
+    std::vector<uint8_t> visible_;          // by instance slot
+    std::vector<TexturedDraw> draws_;       // this frame's, before sorting
+    LodSelector lods_;
+    bool bvhStale_;                         // grid mode builds it to pick
+    Matrix4 viewProjection_;
+    std::vector<Ray> rays_;
+    std::vector<RayHit> hits_;
+    uint32_t gridSide_;
+    std::mt19937 rng_;
+
+    // Spatial index cost and culling results, summed over frames
+    double spatialUpdateMs_;
+    double cullMs_;
+    uint64_t drawnInstances_;
+    uint64_t instanceDraws_;
+    uint64_t drawnTriangles_;
+
+    // Textures by material, one per --texture path. Streamed ones are also
+    // indexed by their streamer index; their views are replaced in place
+    // as levels come and go.
+    std::vector<TextureHandle> materialTextures_;
+    std::vector<int> materialStreams_;      // streamer index, or -1
+    std::unique_ptr<TextureStreamer> textureStreamer_;
+    std::vector<TextureHandle> streamedTextures_;
+    std::vector<ResidencyManager::ResourceId> textureResidency_;
+
+    // Ray casts, summed over frames
+    uint64_t castRays_;
+    uint64_t rayHits_;
+    double castMs_;
+
+    // Present thread; owns the device context while it is running
+    std::thread presentThread_;
+    ThreadPlacement present_placement_;
+    BoundedQueue<FrameData, kMaxQueuedFrames> frameQueue_;
+    HANDLE hFrameSlotFree_;
+    HANDLE hPresentDrained_;     // set as the present thread exits
+    WindowAction pendingAction_;
+
+    // Where frame time goes: building on the main thread, waiting there for
+    // a queue slot, and submitting (Present() included) on whichever
+    // thread presents
+    uint64_t buildNs_;
+    uint64_t slotWaitNs_;
+    uint64_t submitNs_;
+    uint64_t presentNs_;
+    uint64_t submittedFrames_;
+
+    // Resumes coroutines that need the immediate context; drained by
+    // whichever thread currently owns it.
+    ManualExecutor contextExecutor_;
+
+    // Per-frame transient memory, recycled every kFrameArenaCount frames
+    BackingOptions arena_backing_;
+    FrameArena frameArenas_[kFrameArenaCount];
+    CommandBuffer commandBuffers_[kFrameArenaCount];
+    std::vector<uint8_t> instanceSnapshots_[kFrameArenaCount];
+    uint64_t frameIndex_;
+    uint64_t recordedCommandBytes_;
+    uint64_t recordedDraws_;
+
+    // Video memory accounting
+    std::unique_ptr<BudgetProvider> budgetProvider_;
+    std::unique_ptr<ResidencyManager> residency_;
+    ResidencyManager::ResourceId backBufferResidency_;
+    ResidencyManager::ResourceId vertexBufferResidency_;
+    ResidencyManager::ResourceId instanceBufferResidency_;
 
     HWND createWindow();
     HRESULT initD3D();
-    HRESULT initPipeline();
-    HRESULT initGraphics();
+    void initResidency(IDXGIAdapter* adapter);
+    uint64_t backBufferBytes();
+    void buildMeshes();
+    bool loadMesh(const std::string& path);
+    bool readPackedMesh(const std::string& name,
+                        std::vector<MeshVertex>& vertices, LodMesh& lods);
+    void initInstances();
+    uint32_t materialCount() const {
+        return std::max<uint32_t>(
+            1, static_cast<uint32_t>(texture_paths_.size()));
+    }
+    bool initTextures();
+    bool applyTextureChange(const TextureResidencyChange& change);
+    void projectTextures(const Matrix4& viewProjection, float* pixels);
+    Matrix4 instanceLocal(uint32_t index, float angle) const;
+    void respawnInstances();
+    uint32_t updateInstances();
+    void updateSpatialIndex();
+    void recordVisibleDraws(CommandBuffer& commands,
+                            const Matrix4& viewProjection);
+    void clientSize(float& width, float& height) const;
+    PickScene pickScene();
+    void castScreenRays();
+    Task<HRESULT> initPipeline();
+    Task<HRESULT> initGraphics();
+    Task<HRESULT> loadResources();
     HRESULT renderFrame();
+    void buildFrame(FrameData& frame);
+    HRESULT submitFrame(const FrameData& frame);
+    void startPresentThread();
+    void stopPresentThread();
+    void presentThreadMain();
+    void runPendingAction();
     void toggleFullscreen();
     void releaseResources(ID3D11RenderTargetView* renderTargetView);
 
@@ -110,17 +397,233 @@ class MainWindow {
     ID3D11Device* device() const { return pDevice_; }
     ID3D11DeviceContext* deviceCtx() const { return pDeviceContext_; }
     IDXGISwapChain1* swapChain() const { return pSwapChain_; }
-    ID3D11VertexShader* vertexShader() const { return pVertexShader_; }
-    ID3D11PixelShader* pixelShader() const { return pPixelShader_; }
-    ID3D11Buffer* vertexBuffer() const { return pVertexBuffer_; }
+    ID3D11VertexShader* vertexShader() const {
+        return resolve(resources_.vertexShaders, vertexShader_);
+    }
+    ID3D11PixelShader* pixelShader() const {
+        return resolve(resources_.pixelShaders, pixelShader_);
+    }
+    ID3D11InputLayout* inputLayout() const {
+        return resolve(resources_.inputLayouts, inputLayout_);
+    }
+    ID3D11Buffer* vertexBuffer() const {
+        return resolve(resources_.buffers, vertexBuffer_);
+    }
+    ID3D11Buffer* constBuffer() const {
+        return resolve(resources_.buffers, constBuffer_);
+    }
+    ID3D11Buffer* instanceBuffer() const {
+        return resolve(resources_.buffers, instanceBuffer_);
+    }
 };
 
 // -----------------------------------------------------------------------------
 MainWindow::MainWindow()
-    : is_fullscreen_(false) {
+    : is_fullscreen_(false),
+      use_present_thread_(false),
+      static_scene_(false),
+      instance_count_(1),
+      instance_churn_(0.0f),
+      instance_respawn_(0.0f),
+      loose_grid_(false),
+      pick_rays_(0),
+      lod_(false),
+      texture_budget_bytes_(kDefaultTextureBudgetBytes),
+      simulated_budget_bytes_(0),
+      respawned_(0),
+      bvhStale_(false),
+      viewProjection_(Matrix4::identity()),
+      gridSide_(1),
+      spatialUpdateMs_(0.0),
+      cullMs_(0.0),
+      drawnInstances_(0),
+      instanceDraws_(0),
+      drawnTriangles_(0),
+      castRays_(0),
+      rayHits_(0),
+      castMs_(0.0),
+      hFrameSlotFree_(nullptr),
+      hPresentDrained_(nullptr),
+      pendingAction_(WindowAction::kNone),
+      buildNs_(0),
+      slotWaitNs_(0),
+      submitNs_(0),
+      presentNs_(0),
+      submittedFrames_(0),
+      frameIndex_(0),
+      recordedCommandBytes_(0),
+      recordedDraws_(0),
+      backBufferResidency_(0),
+      vertexBufferResidency_(0),
+      instanceBufferResidency_(0) {
 }
 
 MainWindow::~MainWindow() {
+    stopPresentThread();
+    if (hFrameSlotFree_ != nullptr) {
+        CloseHandle(hFrameSlotFree_);
+    }
+    if (hPresentDrained_ != nullptr) {
+        CloseHandle(hPresentDrained_);
+    }
+
+    // Waits for its loads, which call back into nothing once they finish
+    textureStreamer_.reset();
+    releaseAll(resources_);
+}
+
+void MainWindow::reportStats() const {
+    if (frameIndex_ > 0) {
+        double frames = static_cast<double>(frameIndex_);
+        double submitted = static_cast<double>(
+            std::max<uint64_t>(1, submittedFrames_));
+        std::cerr << "Frame build: " << buildNs_ / frames / 1e6
+                  << " ms on the main thread, " << slotWaitNs_ / frames / 1e6
+                  << " ms waiting for a queue slot; submit "
+                  << submitNs_ / submitted / 1e6 << " ms, of which Present() "
+                  << presentNs_ / submitted / 1e6 << " ms, on the "
+                  << (use_present_thread_ ? "present" : "main") << " thread"
+                  << std::endl;
+
+        std::cerr << "Command buffers: "
+                  << recordedCommandBytes_ / frameIndex_ << " bytes/frame, "
+                  << (recordedDraws_ > 0
+                      ? recordedCommandBytes_ / recordedDraws_ : 0)
+                  << " bytes/draw" << std::endl;
+
+        const UploadStats& u = uploads_.stats();
+        std::cerr << "Uploads: " << u.updates << " updates, " << u.copies
+                  << " copies, " << u.bytes / frameIndex_ << " bytes/frame, "
+                  << u.fallbacks << " unbatched batches, "
+                  << u.cpuMs * 1000.0 / frameIndex_ << " us/frame"
+                  << std::endl;
+
+        const ConstantCacheStats& c = constants_.stats();
+        std::cerr << "Constants: " << c.hits << "/" << c.lookups
+                  << " uploads skipped ("
+                  << (c.lookups > 0 ? 100.0 * c.hits / c.lookups : 0.0)
+                  << "%, " << c.bytesSkipped / frameIndex_
+                  << " bytes/frame), " << c.bindsSkipped << "/" << c.binds
+                  << " binds skipped" << std::endl;
+
+        const InstanceUploadStats& inst = instances_.stats();
+        std::cerr << "Instances: " << instances_.count() << " ("
+                  << (instances_.sizeBytes() >> 10) << " KB), "
+                  << instance_churn_ << "% moved per frame, "
+                  << inst.bytes / frameIndex_ << " bytes/frame in "
+                  << static_cast<double>(inst.runs) / frameIndex_
+                  << " copies/frame, "
+                  << static_cast<double>(inst.dirtyPages) / frameIndex_
+                  << " dirty pages/frame" << std::endl;
+        std::cerr << "  backlog "
+                  << static_cast<double>(inst.backlogPages) / frameIndex_
+                  << " pages/frame (max " << inst.maxBacklogPages
+                  << "), " << inst.fullUploads << " full uploads"
+                  << std::endl;
+
+        const SceneGraphStats& g = scene_.stats();
+        if (g.updates > 0 && g.updateMs > 0.0) {
+            std::cerr << "Scene graph: " << scene_.size() << " nodes, "
+                      << g.nodesUpdated / g.updates << " updated per pass, "
+                      << g.updateMs / g.updates << " ms per pass, "
+                      << g.nodesUpdated / g.updateMs / 1000.0
+                      << " M nodes/s" << std::endl;
+        }
+
+        EcsStats e = entities_.stats();
+        std::cerr << "Entities: " << e.entities << " in " << e.chunks
+                  << " chunks of " << (kChunkBytes >> 10) << " KB, "
+                  << e.archetypes << ", "
+                  << static_cast<double>(respawned_) / frameIndex_
+                  << " respawned per frame" << std::endl;
+
+        if (loose_grid_) {
+            const LooseGridStats& l = grid_.stats();
+            std::cerr << "Loose grid: " << grid_.cellCount() << " cells, "
+                      << l.moves / frameIndex_ << " moves/frame, "
+                      << l.cellChanges / frameIndex_
+                      << " cell changes/frame" << std::endl;
+        } else {
+            const BvhStats& b = bvh_.stats();
+            std::cerr << "BVH: " << bvh_.nodeCount() << " nodes, cost "
+                      << bvh_.cost() << ", built in " << b.buildMs << " ms";
+            if (b.refits > 0) {
+                std::cerr << ", " << b.rebuilds
+                          << " partial rebuilds averaging "
+                          << (b.rebuilds > 0 ? b.rebuildMs / b.rebuilds
+                                             : 0.0)
+                          << " ms";
+            }
+            std::cerr << std::endl;
+        }
+
+        std::cerr << "Culling: " << drawnInstances_ / frameIndex_ << "/"
+                  << instances_.count() << " instances drawn in "
+                  << static_cast<double>(instanceDraws_) / frameIndex_
+                  << " draws/frame; " << spatialUpdateMs_ / frameIndex_
+                  << " ms/frame updating the "
+                  << (loose_grid_ ? "grid" : "BVH") << ", "
+                  << cullMs_ / frameIndex_ << " ms/frame culling"
+                  << std::endl;
+
+        if (lod_) {
+            const LodStats& l = lods_.stats();
+            std::cerr << "LOD: " << drawnTriangles_ / frameIndex_
+                      << " triangles/frame, "
+                      << l.levelChanges / frameIndex_
+                      << " level changes/frame, "
+                      << (l.selections > 0 ? l.selectMs / l.selections : 0.0)
+                      << " ms/frame selecting" << std::endl;
+        }
+
+        if (castRays_ > 0) {
+            std::cerr << "Ray casts: " << castRays_ / frameIndex_
+                      << " rays/frame, " << rayHits_ * 100 / castRays_
+                      << "% hit, "
+                      << (castMs_ > 0.0 ? castRays_ / castMs_ / 1000.0 : 0.0)
+                      << " M rays/s" << std::endl;
+        }
+    }
+
+    const BackingInfo& arena = frameArenas_[0].info();
+    size_t arenaHighWater = 0;
+    for (const FrameArena& a : frameArenas_) {
+        arenaHighWater = std::max(arenaHighWater, a.highWater());
+    }
+    std::cerr << "Frame arenas: " << kFrameArenaCount << " x "
+              << (arena.bytes >> 10) << " KB, page size "
+              << (arena.pageSize >> 10) << " KB"
+              << (arena.hugePages ? " (huge pages)" : "")
+              << (arena.transparentHuge ? " (transparent huge pages)" : "")
+              << ", NUMA node " << arena.numaNode
+              << ", high water " << arenaHighWater << " bytes" << std::endl;
+
+    if (textureStreamer_ && textureStreamer_->count() > 0) {
+        TextureStreamingStats t = textureStreamer_->stats();
+        std::cerr << "Textures: " << t.textures << " streamed, resident "
+                  << (t.residentBytes >> 10) << " KB, peak "
+                  << (t.peakResidentBytes >> 10) << " KB of "
+                  << (t.budgetBytes >> 20) << " MB, " << t.loads
+                  << " loads (" << (t.loadedBytes >> 10) << " KB), "
+                  << t.evictions << " evictions ("
+                  << (t.evictedBytes >> 10) << " KB), " << t.failedLoads
+                  << " failed, " << t.limitedFrames
+                  << " frames limited by the budget; latency p50 "
+                  << t.latencyP50Ms << " ms, p99 " << t.latencyP99Ms
+                  << " ms, max " << t.latencyMaxMs << " ms" << std::endl;
+    }
+
+    if (residency_) {
+        const ResidencyStats& s = residency_->stats();
+        std::cerr << "Video memory: budget " << (s.budgetBytes >> 20)
+                  << " MB, tracked " << (s.trackedBytes >> 10)
+                  << " KB, resident " << (s.residentBytes >> 10)
+                  << " KB, evictions " << s.evictions
+                  << " (" << (s.evictedBytes >> 10) << " KB), restores "
+                  << s.restores << ", budget changes " << s.budgetChanges
+                  << ", frames over budget " << s.overBudgetFrames
+                  << std::endl;
+    }
 }
 
 void MainWindow::toggleFullscreen() {
@@ -168,6 +671,10 @@ HRESULT MainWindow::resizeSwapChain(uint32_t width, uint32_t height) {
     deviceCtx()->OMSetRenderTargets(1, &pRenderTargetView_, nullptr);
     backBuffer->Release();
 
+    if (residency_) {
+        residency_->resize(backBufferResidency_, backBufferBytes());
+    }
+
     // Set up the viewport
     D3D11_VIEWPORT viewport = {};
     viewport.Width = static_cast<float>(width);
@@ -224,6 +731,8 @@ HRESULT MainWindow::initD3D() {
     }
     dxgiDevice->Release();
 
+    initResidency(dxgiAdapter);
+
     IDXGIFactory2* dxgiFactory = nullptr;
     hr = dxgiAdapter->GetParent(__uuidof(IDXGIFactory2),
                                 reinterpret_cast<void**>(&dxgiFactory));
@@ -242,6 +751,11 @@ HRESULT MainWindow::initD3D() {
         return hr;
     }
 
+    if (residency_) {
+        backBufferResidency_ = residency_->track("back buffers",
+                                                 backBufferBytes(),
+                                                 kResidencyCritical, nullptr);
+    }
 
     ID3D11Texture2D* backBuffer = nullptr;
     swapChain()->GetBuffer(0, __uuidof(ID3D11Texture2D),
@@ -264,51 +778,84 @@ HRESULT MainWindow::initD3D() {
     return hr;
 }
 
-HRESULT MainWindow::initPipeline() {
-    ID3DBlob* vsBlob = nullptr;
-    ID3DBlob* psBlob = nullptr;
-    ID3DBlob* errorBlob = nullptr;
-
-    HRESULT hr;
-    hr = D3DCompile(vertexShaderSrc, strlen(vertexShaderSrc), nullptr, nullptr,
-                    nullptr, "VSMain", "vs_5_0", 0, 0, &vsBlob, &errorBlob);
-    if (FAILED(hr)) {
-        if (errorBlob) {
-            std::cerr << reinterpret_cast<char*>(errorBlob->GetBufferPointer())
-                      << std::endl;
-            errorBlob->Release();
+void MainWindow::initResidency(IDXGIAdapter* adapter) {
+    if (simulated_budget_bytes_ != 0) {
+        budgetProvider_ =
+            std::make_unique<SimulatedBudgetProvider>(simulated_budget_bytes_);
+    } else {
+        IDXGIAdapter3* dxgiAdapter3 = nullptr;
+        HRESULT hr = adapter->QueryInterface(
+            __uuidof(IDXGIAdapter3), reinterpret_cast<void**>(&dxgiAdapter3));
+        if (FAILED(hr)) {
+            std::cerr << "Video memory budget queries unavailable" << std::endl;
+            return;
         }
-        return hr;
+        budgetProvider_ = std::make_unique<DxgiBudgetProvider>(dxgiAdapter3);
+        dxgiAdapter3->Release();
     }
 
-    hr = D3DCompile(pixelShaderSrc, strlen(pixelShaderSrc), nullptr, nullptr,
-                    nullptr, "PSMain", "ps_5_0", 0, 0, &psBlob, &errorBlob);
+    residency_ = std::make_unique<ResidencyManager>(budgetProvider_.get());
+}
+
+uint64_t MainWindow::backBufferBytes() {
+    DXGI_SWAP_CHAIN_DESC1 desc = {};
+    swapChain()->GetDesc1(&desc);
+
+    // DXGI_FORMAT_R8G8B8A8_UNORM
+    return static_cast<uint64_t>(desc.Width) * desc.Height * 4 *
+           desc.BufferCount;
+}
+
+Task<HRESULT> MainWindow::initPipeline() {
+    // Both shaders compile concurrently on the job system
+    std::vector<Task<ShaderBlob>> compiles;
+    compiles.push_back(compileShader(vertexShaderSrc, "VSMain", "vs_5_0"));
+    compiles.push_back(compileShader(pixelShaderSrc, "PSMain", "ps_5_0"));
+    std::vector<ShaderBlob> blobs = co_await whenAll(std::move(compiles));
+    ID3DBlob* vsBlob = blobs[0].blob;
+    ID3DBlob* psBlob = blobs[1].blob;
+
+    HRESULT hr = FAILED(blobs[0].hr) ? blobs[0].hr : blobs[1].hr;
     if (FAILED(hr)) {
-        if (errorBlob) {
-            std::cerr << reinterpret_cast<char*>(errorBlob->GetBufferPointer())
-                      << std::endl;
-            errorBlob->Release();
-        }
-        return hr;
+        if (vsBlob) vsBlob->Release();
+        if (psBlob) psBlob->Release();
+        co_return hr;
     }
 
-    device()->CreateVertexShader(vsBlob->GetBufferPointer(),
-                                 vsBlob->GetBufferSize(),
-                                 nullptr, &pVertexShader_);
-    device()->CreatePixelShader(psBlob->GetBufferPointer(),
-                                psBlob->GetBufferSize(),
-                                nullptr, &pPixelShader_);
+    ID3D11VertexShader* vertexShader = nullptr;
+    ID3D11PixelShader* pixelShader = nullptr;
+    ID3D11InputLayout* inputLayout = nullptr;
+    ID3D11Buffer* constBuffer = nullptr;
+
+    // Each step runs only if the ones before it succeeded; whatever was
+    // created is released if a later one fails
+    hr = device()->CreateVertexShader(vsBlob->GetBufferPointer(),
+                                      vsBlob->GetBufferSize(),
+                                      nullptr, &vertexShader);
+    HR_CHECK(hr);
+    if (SUCCEEDED(hr)) {
+        hr = device()->CreatePixelShader(psBlob->GetBufferPointer(),
+                                         psBlob->GetBufferSize(),
+                                         nullptr, &pixelShader);
+        HR_CHECK(hr);
+    }
 
     D3D11_INPUT_ELEMENT_DESC layout[] = {
         { "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 },
         { "COLOR", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 0, 12, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+        { "WORLD", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 0, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+        { "WORLD", 1, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 16, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+        { "WORLD", 2, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 32, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+        { "WORLD", 3, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 48, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
     };
 
-    device()->CreateInputLayout(layout, 2,
-                                vsBlob->GetBufferPointer(),
-                                vsBlob->GetBufferSize(),
-                                &pInputLayout_);
-    deviceCtx()->IASetInputLayout(pInputLayout_);
+    if (SUCCEEDED(hr)) {
+        hr = device()->CreateInputLayout(layout, ARRAYSIZE(layout),
+                                         vsBlob->GetBufferPointer(),
+                                         vsBlob->GetBufferSize(),
+                                         &inputLayout);
+        HR_CHECK(hr);
+    }
 
     vsBlob->Release();
     psBlob->Release();
@@ -319,83 +866,917 @@ HRESULT MainWindow::initPipeline() {
     cbd.Usage = D3D11_USAGE_DEFAULT;
     cbd.ByteWidth = sizeof(CBUFFER);
     cbd.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
-    device()->CreateBuffer(&cbd, NULL, &pConstBuffer_);
+    if (SUCCEEDED(hr)) {
+        hr = device()->CreateBuffer(&cbd, NULL, &constBuffer);
+        HR_CHECK(hr);
+    }
+    if (FAILED(hr)) {
+        if (vertexShader) vertexShader->Release();
+        if (pixelShader) pixelShader->Release();
+        if (inputLayout) inputLayout->Release();
+        co_return hr;
+    }
 
-    // Set the constant buffer
-    deviceCtx()->VSSetConstantBuffers(0, 1, &pConstBuffer_);
+    // Registration, binding and residency bookkeeping belong to the
+    // context thread
+    co_await contextExecutor_.schedule();
 
-    return hr;
+    vertexShader_ = resources_.vertexShaders.insert(vertexShader);
+    pixelShader_ = resources_.pixelShaders.insert(pixelShader);
+    inputLayout_ = resources_.inputLayouts.insert(inputLayout);
+    constBuffer_ = resources_.buffers.insert(constBuffer);
+
+    if (residency_) {
+        residency_->track("constant buffer", sizeof(CBUFFER),
+                          kResidencyCritical, nullptr);
+    }
+
+    co_return hr;
 }
 
-HRESULT MainWindow::initGraphics() {
-    HRESULT hr = S_OK;
-    Vertex vertices[] = {
+// Every mesh from buildMeshes() shares one vertex buffer
+Task<HRESULT> MainWindow::initGraphics() {
+    uint32_t vertexBytes =
+        static_cast<uint32_t>(meshVertices_.size() * sizeof(Vertex));
+    D3D11_BUFFER_DESC bufferDesc = {};
+    bufferDesc.Usage = D3D11_USAGE_DEFAULT;
+    bufferDesc.ByteWidth = vertexBytes;
+    bufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+
+    const uint8_t* bytes =
+        reinterpret_cast<const uint8_t*>(meshVertices_.data());
+    BufferUpload upload = co_await uploadBuffer(
+        device(), bufferDesc,
+        std::vector<uint8_t>(bytes, bytes + vertexBytes));
+    if (FAILED(upload.hr)) {
+        co_return upload.hr;
+    }
+
+    // Initial instance contents; later changes go up by dirty page
+    D3D11_BUFFER_DESC instanceDesc = {};
+    instanceDesc.Usage = D3D11_USAGE_DEFAULT;
+    instanceDesc.ByteWidth = instances_.sizeBytes();
+    instanceDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+    D3D11_SUBRESOURCE_DATA instanceData = { instances_.get(0), 0, 0 };
+    ID3D11Buffer* instanceBuffer = nullptr;
+    HRESULT hr = device()->CreateBuffer(&instanceDesc, &instanceData,
+                                        &instanceBuffer);
+    if (FAILED(hr)) {
+        upload.buffer->Release();
+        co_return hr;
+    }
+
+    co_await contextExecutor_.schedule();
+
+    vertexBuffer_ = resources_.buffers.insert(upload.buffer);
+    instanceBuffer_ = resources_.buffers.insert(instanceBuffer);
+
+    // Evicting only lowers the OS eviction priority; D3D11 pages the
+    // buffer back in on use.
+    if (residency_) {
+        vertexBufferResidency_ = residency_->track(
+            "mesh vertices", vertexBytes, kResidencyNormal,
+            [this](bool resident) {
+                vertexBuffer()->SetEvictionPriority(
+                    resident ? DXGI_RESOURCE_PRIORITY_NORMAL
+                             : DXGI_RESOURCE_PRIORITY_MINIMUM);
+            });
+        instanceBufferResidency_ = residency_->track(
+            "instances", instanceDesc.ByteWidth, kResidencyNormal,
+            [this](bool resident) {
+                instanceBuffer()->SetEvictionPriority(
+                    resident ? DXGI_RESOURCE_PRIORITY_NORMAL
+                             : DXGI_RESOURCE_PRIORITY_MINIMUM);
+            });
+    }
+
+    co_return S_OK;
+}
+
+Task<HRESULT> MainWindow::loadResources() {
+    std::vector<Task<HRESULT>> loads;
+    loads.push_back(initPipeline());
+    loads.push_back(initGraphics());
+    std::vector<HRESULT> results = co_await whenAll(std::move(loads));
+
+    for (HRESULT hr : results) {
+        if (FAILED(hr)) co_return hr;
+    }
+    co_return S_OK;
+}
+
+// Creates the sampler and the white 1x1 texture that stands in for
+// materials without a texture, then adds the --texture files to the
+// streamer, which reads their tails. Residency changes use the immediate
+// context, so this runs before the present thread starts.
+bool MainWindow::initTextures() {
+    const uint32_t white = 0xffffffff;
+    D3D11_TEXTURE2D_DESC desc = {};
+    desc.Width = 1;
+    desc.Height = 1;
+    desc.MipLevels = 1;
+    desc.ArraySize = 1;
+    desc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+    desc.SampleDesc.Count = 1;
+    desc.Usage = D3D11_USAGE_IMMUTABLE;
+    desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+    D3D11_SUBRESOURCE_DATA data = { &white, sizeof(white), 0 };
+    ID3D11Texture2D* texture = nullptr;
+    ID3D11ShaderResourceView* view = nullptr;
+    HRESULT hr = device()->CreateTexture2D(&desc, &data, &texture);
+    if (SUCCEEDED(hr)) {
+        hr = device()->CreateShaderResourceView(texture, nullptr, &view);
+        texture->Release();
+    }
+    if (FAILED(hr)) {
+        std::cerr << "Failed to create the default texture" << std::endl;
+        return false;
+    }
+    TextureHandle whiteTexture = resources_.textures.insert(view);
+
+    D3D11_SAMPLER_DESC samplerDesc = {};
+    samplerDesc.Filter = D3D11_FILTER_MIN_MAG_MIP_LINEAR;
+    samplerDesc.AddressU = D3D11_TEXTURE_ADDRESS_WRAP;
+    samplerDesc.AddressV = D3D11_TEXTURE_ADDRESS_WRAP;
+    samplerDesc.AddressW = D3D11_TEXTURE_ADDRESS_WRAP;
+    samplerDesc.ComparisonFunc = D3D11_COMPARISON_NEVER;
+    samplerDesc.MaxLOD = D3D11_FLOAT32_MAX;
+    ID3D11SamplerState* sampler = nullptr;
+    hr = device()->CreateSamplerState(&samplerDesc, &sampler);
+    if (FAILED(hr)) {
+        std::cerr << "Failed to create sampler" << std::endl;
+        return false;
+    }
+    sampler_ = resources_.samplers.insert(sampler);
+
+    textureStreamer_ = std::make_unique<TextureStreamer>(
+        texture_budget_bytes_, [this](const TextureResidencyChange& change) {
+            return applyTextureChange(change);
+        });
+    materialTextures_.assign(materialCount(), whiteTexture);
+    materialStreams_.assign(materialCount(), -1);
+    for (size_t m = 0; m < texture_paths_.size(); ++m) {
+        int index = textureStreamer_->add(texture_paths_[m]);
+        if (index < 0) {
+            std::cerr << "Using white instead of " << texture_paths_[m]
+                      << std::endl;
+            continue;
+        }
+        materialTextures_[m] = streamedTextures_[index];
+        materialStreams_[m] = index;
+    }
+    return true;
+}
+
+// A streamed texture is recreated with its resident levels whenever they
+// change: levels both copies hold are copied on the GPU, loaded ones are
+// uploaded from the file's bytes. The new view replaces the old one in its
+// table slot, so handles in frames already recorded stay valid.
+bool MainWindow::applyTextureChange(const TextureResidencyChange& change) {
+    const TextureInfo& info = *change.info;
+    D3D11_TEXTURE2D_DESC desc = {};
+    desc.Width = info.levelWidth(change.firstLevel);
+    desc.Height = info.levelHeight(change.firstLevel);
+    desc.MipLevels = info.levelCount - change.firstLevel;
+    desc.ArraySize = 1;
+    desc.Format = kTextureDxgiFormats[static_cast<uint32_t>(info.format)];
+    desc.SampleDesc.Count = 1;
+    desc.Usage = D3D11_USAGE_DEFAULT;
+    desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+
+    bool added = change.texture == streamedTextures_.size();
+    ID3D11ShaderResourceView** view =
+        added ? nullptr
+              : resources_.textures.get(streamedTextures_[change.texture]);
+    if (!added && view == nullptr) return false;
+
+    ID3D11Texture2D* texture = nullptr;
+    HRESULT hr = device()->CreateTexture2D(&desc, nullptr, &texture);
+    if (FAILED(hr)) {
+        std::cerr << "Failed to create texture" << std::endl;
+        return false;
+    }
+
+    ID3D11Resource* previous = nullptr;
+    if (view != nullptr) (*view)->GetResource(&previous);
+    for (uint32_t l = change.firstLevel; l < info.levelCount; ++l) {
+        UINT level = l - change.firstLevel;
+        if (l >= change.previousFirst) {
+            deviceCtx()->CopySubresourceRegion(texture, level, 0, 0, 0,
+                                               previous,
+                                               l - change.previousFirst,
+                                               nullptr);
+        } else {
+            const uint8_t* bytes = change.data +
+                (info.levels[l].offset - info.levels[change.firstLevel].offset);
+            deviceCtx()->UpdateSubresource(texture, level, nullptr, bytes,
+                                           info.levels[l].rowPitch, 0);
+        }
+    }
+    if (previous != nullptr) previous->Release();
+
+    ID3D11ShaderResourceView* newView = nullptr;
+    hr = device()->CreateShaderResourceView(texture, nullptr, &newView);
+    texture->Release();
+    if (FAILED(hr)) {
+        std::cerr << "Failed to create texture view" << std::endl;
+        return false;
+    }
+
+    uint64_t bytes = info.bytesFrom(change.firstLevel);
+    if (added) {
+        TextureHandle handle = resources_.textures.insert(newView);
+        streamedTextures_.push_back(handle);
+        if (residency_) {
+            // Evicting only lowers the OS eviction priority, as for buffers
+            textureResidency_.push_back(residency_->track(
+                "texture", bytes, kResidencyNormal,
+                [this, handle](bool resident) {
+                    ID3D11ShaderResourceView* current =
+                        resolve(resources_.textures, handle);
+                    ID3D11Resource* resource = nullptr;
+                    current->GetResource(&resource);
+                    resource->SetEvictionPriority(
+                        resident ? DXGI_RESOURCE_PRIORITY_NORMAL
+                                 : DXGI_RESOURCE_PRIORITY_MINIMUM);
+                    resource->Release();
+                }));
+        }
+    } else {
+        (*view)->Release();
+        *view = newView;
+        if (residency_) {
+            residency_->resize(textureResidency_[change.texture], bytes);
+        }
+    }
+    return true;
+}
+
+// Mesh 0 is the triangle, drawn at one level. Mesh 1 is the --mesh file, or
+// else a disc whose levels halve the rim segments twice over, down to a
+// triangle; each level's error is how far its rim falls inside the finest
+// one.
+void MainWindow::buildMeshes() {
+    Vertex triangle[] = {
         { DirectX::XMFLOAT3(0.0f, 0.5f, 0.0f), DirectX::XMFLOAT4(1.0f, 0.0f, 0.0f, 1.0f) },
         { DirectX::XMFLOAT3(0.5f, -0.5f, 0.0f), DirectX::XMFLOAT4(0.0f, 1.0f, 0.0f, 1.0f) },
         { DirectX::XMFLOAT3(-0.5f, -0.5f, 0.0f), DirectX::XMFLOAT4(0.0f, 0.0f, 1.0f, 1.0f) },
     };
+    LodMesh single;
+    single.levelCount = 1;
+    single.levels[0] = { 0, 3, 0.0f };
+    PickMesh corners;
+    for (const Vertex& v : triangle) {
+        meshVertices_.push_back(v);
+        corners.corners.push_back({ v.position.x, v.position.y, 0.0f });
+    }
+    meshBounds_.push_back({ { -0.5f, -0.5f, 0.0f }, { 0.5f, 0.5f, 0.0f } });
+    lodMeshes_.push_back(single);
+    pickMeshes_.push_back(std::move(corners));
+    if (!mesh_path_.empty() && loadMesh(mesh_path_)) return;
+
+    const float radius = 0.5f;
+    auto rim = [radius](uint32_t segments) {
+        return radius * std::cos(DirectX::XM_PI / segments);
+    };
+    auto color = [](float angle) {
+        return DirectX::XMFLOAT4(
+            0.5f + 0.5f * std::cos(angle),
+            0.5f + 0.5f * std::cos(angle - DirectX::XM_2PI / 3.0f),
+            0.5f + 0.5f * std::cos(angle + DirectX::XM_2PI / 3.0f), 1.0f);
+    };
+    LodMesh disc;
+    PickMesh discCorners;
+    for (uint32_t segments = kDiscSegments;
+         segments >= kDiscCoarsestSegments && disc.levelCount < kMaxLodLevels;
+         segments /= 4) {
+        LodLevel& level = disc.levels[disc.levelCount++];
+        level.firstVertex = static_cast<uint32_t>(meshVertices_.size());
+        level.vertexCount = segments * 3;
+        level.error = rim(kDiscSegments) - rim(segments);
+        for (uint32_t s = 0; s < segments; ++s) {
+            float a0 = DirectX::XM_2PI * s / segments;
+            float a1 = DirectX::XM_2PI * (s + 1) / segments;
+            Vertex fan[3] = {
+                { DirectX::XMFLOAT3(0.0f, 0.0f, 0.0f),
+                  DirectX::XMFLOAT4(1.0f, 1.0f, 1.0f, 1.0f) },
+                { DirectX::XMFLOAT3(radius * std::cos(a1),
+                                    radius * std::sin(a1), 0.0f),
+                  color(a1) },
+                { DirectX::XMFLOAT3(radius * std::cos(a0),
+                                    radius * std::sin(a0), 0.0f),
+                  color(a0) },
+            };
+            for (const Vertex& v : fan) {
+                meshVertices_.push_back(v);
+                if (segments == kDiscSegments) {
+                    discCorners.corners.push_back(
+                        { v.position.x, v.position.y, 0.0f });
+                }
+            }
+        }
+    }
+    meshBounds_.push_back(
+        { { -radius, -radius, 0.0f }, { radius, radius, 0.0f } });
+    lodMeshes_.push_back(disc);
+    pickMeshes_.push_back(std::move(discCorners));
+}
 
-    D3D11_BUFFER_DESC bufferDesc = {};
-    bufferDesc.Usage = D3D11_USAGE_DEFAULT;
-    bufferDesc.ByteWidth = sizeof(vertices);
-    bufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+// Appends a mesh tool file as the next mesh, from the --pack file when one
+// was given; its vertices share Vertex's layout, so they are copied as
+// they are
+bool MainWindow::loadMesh(const std::string& path) {
+    static_assert(sizeof(MeshVertex) == sizeof(Vertex), "same layout");
+    std::vector<MeshVertex> vertices;
+    LodMesh lods;
+    bool read = pack_path_.empty() ? readMeshFile(path, vertices, lods)
+                                   : readPackedMesh(path, vertices, lods);
+    if (!read || vertices.empty()) {
+        std::cerr << "Using the built-in disc instead of " << path
+                  << std::endl;
+        return false;
+    }
 
-    D3D11_SUBRESOURCE_DATA initData = {};
-    initData.pSysMem = vertices;
+    uint32_t base = static_cast<uint32_t>(meshVertices_.size());
+    meshVertices_.resize(base + vertices.size());
+    memcpy(&meshVertices_[base], vertices.data(),
+           vertices.size() * sizeof(MeshVertex));
+    for (uint32_t l = 0; l < lods.levelCount; ++l) {
+        lods.levels[l].firstVertex += base;
+    }
 
-    hr = device()->CreateBuffer(&bufferDesc, &initData, &pVertexBuffer_);
-    if (FAILED(hr)) {
-        std::cerr << "Failed to create buffer" << std::endl;
-        return hr;
+    Bounds bounds = { vertices[0].position, vertices[0].position };
+    PickMesh corners;
+    const LodLevel& full = lods.levels[0];
+    for (const MeshVertex& v : vertices) {
+        bounds = merge(bounds, { v.position, v.position });
+    }
+    for (uint32_t i = 0; i < full.vertexCount; ++i) {
+        corners.corners.push_back(
+            vertices[full.firstVertex - base + i].position);
     }
+    meshBounds_.push_back(bounds);
+    lodMeshes_.push_back(lods);
+    pickMeshes_.push_back(std::move(corners));
+    return true;
+}
 
-    UINT stride = sizeof(Vertex);
-    UINT offset = 0;
-    deviceCtx()->IASetVertexBuffers(0, 1, &pVertexBuffer_, &stride, &offset);
-    deviceCtx()->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+// One read for the asset's blocks, which decompress in parallel on the job
+// system; the decoded file is then parsed like one read from disk
+bool MainWindow::readPackedMesh(const std::string& name,
+                                std::vector<MeshVertex>& vertices,
+                                LodMesh& lods) {
+    PackReader pack;
+    if (!pack.open(pack_path_)) return false;
+    int index = pack.find(name);
+    if (index < 0) {
+        std::cerr << name << " is not in " << pack_path_ << std::endl;
+        return false;
+    }
+    std::vector<uint8_t> bytes(pack.asset(index).rawSize);
+    PackLoadStats stats;
+    if (!pack.load(index, bytes.data(), &stats) ||
+        !decodeMeshFile(bytes.data(), bytes.size(), vertices, lods)) {
+        return false;
+    }
+    std::cerr << "Loaded " << name << " from " << pack_path_ << ": "
+              << stats.compressedBytes / 1024.0 << " KB read in "
+              << stats.readMs << " ms, " << stats.rawBytes / 1024.0
+              << " KB decompressed in " << stats.decompressMs << " ms"
+              << std::endl;
+    return true;
+}
 
-    return hr;
+// Lays instances out on a square grid filling the screen: a root, one node
+// per row and the instances as children of their row. A single instance
+// keeps the triangle's original size.
+void MainWindow::initInstances() {
+    uint32_t count = std::max(1u, instance_count_);
+    instances_.init(sizeof(InstanceData), count);
+    gridSide_ = static_cast<uint32_t>(ceil(sqrt(static_cast<double>(count))));
+
+    buildMeshes();
+    uint32_t mesh = lod_ || !mesh_path_.empty() ? 1 : 0;
+
+    float cell = 2.0f / gridSide_;
+    NodeId root = scene_.create(SceneGraph::kNoParent, Matrix4::identity());
+    NodeId row = root;
+    instanceEntities_.resize(count);
+    instanceBounds_.resize(count);
+    instanceWorlds_.resize(count);
+    instanceMeshes_.assign(count, mesh);
+    instanceMaterials_.resize(count);
+    lods_.init(count);
+    visible_.resize(count);
+    for (uint32_t i = 0; i < count; ++i) {
+        if (i % gridSide_ == 0) {
+            float y = 1.0f - cell * (i / gridSide_ + 0.5f);
+            row = scene_.create(root, Matrix4::translation(0.0f, y, 0.0f));
+        }
+        NodeId node = scene_.create(row, instanceLocal(i, 0.0f));
+        instanceMaterials_[i] = i % materialCount();
+        instanceEntities_[i] = entities_.create(
+            SceneNode{ node }, WorldTransform{}, WorldBounds{}, MeshRef{ mesh },
+            MaterialRef{ instanceMaterials_[i] }, InstanceSlot{ i }, Moved{});
+    }
+    updateInstances();
+    if (loose_grid_) {
+        grid_.init(kGridCellInstances * cell);
+        for (uint32_t i = 0; i < count; ++i) {
+            grid_.insert(i, instanceBounds_[i]);
+        }
+        bvhStale_ = true;
+    } else {
+        bvh_.build(instanceBounds_.data(), count);
+    }
+}
+
+Matrix4 MainWindow::instanceLocal(uint32_t index, float angle) const {
+    float cell = 2.0f / gridSide_;
+    float scale = std::min(1.0f, cell * 0.9f);
+    float x = -1.0f + cell * (index % gridSide_ + 0.5f);
+    return Matrix4::scaling(scale, scale, 1.0f) * Matrix4::rotationZ(angle) *
+           Matrix4::translation(x, 0.0f, 0.0f);
+}
+
+// Propagates transform changes through the scene graph, refreshes the
+// world transform and bounds of the entities whose node moved, then copies
+// those into the instance buffer and the BVH's bounds. Returns how many
+// instances moved.
+uint32_t MainWindow::updateInstances() {
+    PROFILE_ZONE("updateInstances");
+    scene_.update();
+    movedSlots_.clear();
+
+    entities_.parallelForEach<const SceneNode, const MeshRef, WorldTransform,
+                              WorldBounds, Moved>(
+        [this](Entity, const SceneNode& node, const MeshRef& mesh,
+               WorldTransform& transform, WorldBounds& bounds, Moved& moved) {
+            moved.moved = scene_.changed(node.node);
+            if (!moved.moved) return;
+            transform.world = scene_.world(node.node);
+            bounds.bounds = transformBounds(meshBounds_[mesh.mesh],
+                                            transform.world);
+        });
+
+    // Serial: the instance buffer's dirty bits are shared
+    entities_.forEach<const WorldTransform, const WorldBounds,
+                      const InstanceSlot, const Moved>(
+        [this](Entity, const WorldTransform& transform,
+               const WorldBounds& bounds, const InstanceSlot& slot,
+               const Moved& moved) {
+            if (!moved.moved) return;
+            InstanceData instance;
+            instance.world = transpose(transform.world);
+            instances_.set(slot.index, &instance);
+            instanceBounds_[slot.index] = bounds.bounds;
+            instanceWorlds_[slot.index] = transform.world;
+            if (lod_) {
+                lods_.setObject(slot.index, transform.world,
+                                instanceMeshes_[slot.index]);
+            }
+            movedSlots_.push_back(slot.index);
+        });
+    return static_cast<uint32_t>(movedSlots_.size());
+}
+
+// Replaces a share of the instances with new entities in the same slots,
+// as objects dying and others spawning in their place would. Each keeps
+// its node, which is moved so the next update refreshes the new entity.
+// The destroys and creates go through the command buffer and are applied
+// in one playback.
+void MainWindow::respawnInstances() {
+    uint32_t count = static_cast<uint32_t>(
+        instances_.count() * (instance_respawn_ / 100.0f));
+    if (count == 0) return;
+    PROFILE_ZONE("respawnInstances");
+
+    std::uniform_real_distribution<float> angle(0.0f, DirectX::XM_2PI);
+    spawnSlots_.clear();
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t slot = rng_() % instances_.count();
+        Entity& entity = instanceEntities_[slot];
+        if (entity == Entity()) continue;   // already replaced this frame
+        SceneNode node = *entities_.get<SceneNode>(entity);
+        spawns_.destroy(entity);
+        spawns_.create(node, WorldTransform{}, WorldBounds{},
+                       MeshRef{ instanceMeshes_[slot] },
+                       MaterialRef{ instanceMaterials_[slot] },
+                       InstanceSlot{ slot }, Moved{});
+        scene_.setLocal(node.node, instanceLocal(slot, angle(rng_)));
+        entity = Entity();
+        spawnSlots_.push_back(slot);
+    }
+
+    spawned_.clear();
+    spawns_.playback(entities_, &spawned_);
+    for (size_t i = 0; i < spawnSlots_.size(); ++i) {
+        instanceEntities_[spawnSlots_[i]] = spawned_[i];
+    }
+    respawned_ += spawnSlots_.size();
+}
+
+// The grid moves only the instances that moved; the BVH refits as a whole
+void MainWindow::updateSpatialIndex() {
+    PROFILE_ZONE("updateSpatialIndex");
+    uint64_t start = Profiler::nowNs();
+    if (loose_grid_) {
+        for (uint32_t slot : movedSlots_) {
+            grid_.move(slot, instanceBounds_[slot]);
+        }
+        bvhStale_ = true;
+    } else {
+        bvh_.update(instanceBounds_.data());
+    }
+    spatialUpdateMs_ += (Profiler::nowNs() - start) / 1e6;
+}
+
+// Culls the instances against the view and records one instanced draw per
+// run of visible slots with the same mesh, level and material, bridging
+// short gaps. The draws go out grouped by texture, so each is bound once;
+// there is no depth buffer, but slot order carries no meaning either, as
+// instances are placed at random.
+void MainWindow::recordVisibleDraws(CommandBuffer& commands,
+                                    const Matrix4& viewProjection) {
+    PROFILE_ZONE("cullInstances");
+    uint64_t start = Profiler::nowNs();
+    Plane planes[6];
+    frustumPlanes(viewProjection, planes);
+    std::fill(visible_.begin(), visible_.end(), 0);
+    auto mark = [this](uint32_t slot) { visible_[slot] = 1; };
+    if (loose_grid_) {
+        grid_.cull(planes, 6, mark);
+    } else {
+        bvh_.cull(planes, 6, mark);
+    }
+    cullMs_ += (Profiler::nowNs() - start) / 1e6;
+
+    const uint8_t* levels = lods_.levels();
+    uint32_t count = static_cast<uint32_t>(visible_.size());
+    uint32_t i = 0;
+    draws_.clear();
+    while (i < count) {
+        while (i < count && !visible_[i]) ++i;
+        if (i == count) break;
+
+        uint32_t first = i;
+        uint32_t end = i;
+        uint32_t mesh = instanceMeshes_[first];
+        uint8_t level = levels[first];
+        uint32_t material = instanceMaterials_[first];
+        for (; i < count && i - end <= kDrawMergeGap; ++i) {
+            if (!visible_[i]) continue;
+            if (instanceMeshes_[i] != mesh || levels[i] != level ||
+                instanceMaterials_[i] != material) {
+                break;
+            }
+            end = i + 1;
+        }
+        i = end;
+        const LodLevel& lod = lodMeshes_[mesh].levels[level];
+        draws_.push_back({ materialTextures_[material], lod.vertexCount,
+                           end - first, lod.firstVertex, first });
+        drawnInstances_ += end - first;
+        drawnTriangles_ += uint64_t(lod.vertexCount / 3) * (end - first);
+        ++instanceDraws_;
+    }
+    recordDraws(commands, draws_.data(), draws_.size());
+}
+
+// Pixels each streamed texture spans on screen: the most over the visible
+// instances using it. A texture spans one object unit, taken as the larger
+// side of the instance's bounds, which errs towards detail when rotated.
+void MainWindow::projectTextures(const Matrix4& viewProjection,
+                                 float* pixels) {
+    PROFILE_ZONE("projectTextures");
+    float width;
+    float height;
+    clientSize(width, height);
+    const Matrix4& a = viewProjection;
+    auto column = [&a](int c) {
+        return std::sqrt(a.m[0][c] * a.m[0][c] + a.m[1][c] * a.m[1][c] +
+                         a.m[2][c] * a.m[2][c]);
+    };
+    float pixelsPerUnit = std::max(column(0) * width, column(1) * height) *
+                          0.5f;
+
+    std::fill(pixels, pixels + textureStreamer_->count(), 0.0f);
+    uint32_t count = static_cast<uint32_t>(visible_.size());
+    for (uint32_t i = 0; i < count; ++i) {
+        int texture = materialStreams_[instanceMaterials_[i]];
+        if (!visible_[i] || texture < 0) continue;
+        Float3 c = instanceBounds_[i].center();
+        Float3 e = instanceBounds_[i].extent();
+        float w = c.x * a.m[0][3] + c.y * a.m[1][3] + c.z * a.m[2][3] +
+                  a.m[3][3];
+        float side = 2.0f * std::max(e.x, e.y) * pixelsPerUnit /
+                     std::max(w, 1e-6f);
+        pixels[texture] = std::max(pixels[texture], side);
+    }
+}
+
+// Picking always goes through the BVH; in grid mode it is built on the
+// first pick and refitted on later ones after instances moved
+PickScene MainWindow::pickScene() {
+    if (bvhStale_) {
+        if (bvh_.primitiveCount() == 0) {
+            bvh_.build(instanceBounds_.data(),
+                       static_cast<uint32_t>(instanceBounds_.size()));
+        } else {
+            bvh_.update(instanceBounds_.data());
+        }
+        bvhStale_ = false;
+    }
+    PickScene scene;
+    scene.bvh = &bvh_;
+    scene.worlds = instanceWorlds_.data();
+    scene.meshOf = instanceMeshes_.data();
+    scene.meshes = pickMeshes_.data();
+    return scene;
+}
+
+void MainWindow::clientSize(float& width, float& height) const {
+    RECT rect;
+    GetClientRect(hWnd_, &rect);
+    width = static_cast<float>(std::max(1L, rect.right - rect.left));
+    height = static_cast<float>(std::max(1L, rect.bottom - rect.top));
+}
+
+RayHit MainWindow::pick(float x, float y) {
+    float width;
+    float height;
+    clientSize(width, height);
+    return castRay(pickScene(),
+                   screenRay(viewProjection_, x, y, width, height));
+}
+
+// Casts pick_rays_ rays through random pixels, as a stand-in for many
+// programmatic picks per frame
+void MainWindow::castScreenRays() {
+    PROFILE_ZONE("castScreenRays");
+    float width;
+    float height;
+    clientSize(width, height);
+    std::uniform_real_distribution<float> x(0.0f, width);
+    std::uniform_real_distribution<float> y(0.0f, height);
+    rays_.resize(pick_rays_);
+    hits_.resize(pick_rays_);
+    for (Ray& ray : rays_) {
+        ray = screenRay(viewProjection_, x(rng_), y(rng_), width, height);
+    }
+
+    uint64_t start = Profiler::nowNs();
+    castRays(pickScene(), rays_.data(), pick_rays_, hits_.data());
+    castMs_ += (Profiler::nowNs() - start) / 1e6;
+    castRays_ += pick_rays_;
+    for (const RayHit& hit : hits_) {
+        rayHits_ += hit.instance != RayHit::kNone;
+    }
 }
 
 HRESULT MainWindow::renderFrame() {
-    // Rebind the Render Target View
-    ID3D11Texture2D* backBuffer = nullptr;
-    HRESULT hr = S_OK;
+    FrameData frame;
+    buildFrame(frame);
+    return submitFrame(frame);
+}
+
+void MainWindow::buildFrame(FrameData& frame) {
+    PROFILE_ZONE("buildFrame");
+    uint64_t startNs = Profiler::nowNs();
+
+    size_t slot = frameIndex_++ % kFrameArenaCount;
+    FrameArena& arena = frameArenas_[slot];
+    arena.reset();
+
+    CommandBuffer& commands = commandBuffers_[slot];
+    commands.reset(arena.allocate<uint32_t>(kCommandBufferWords),
+                   kCommandBufferWords);
 
     // Create rotation matrix
     static float Time = 0.0f;
-    Time += 0.01f;
+    if (!static_scene_) Time += 0.01f;
     DirectX::XMMATRIX RotationMatrix = DirectX::XMMatrixRotationZ(Time);
 
     // Update the constant buffer
     CBUFFER cb;
     cb.FinalMatrix = XMMatrixTranspose(RotationMatrix);
-    deviceCtx()->UpdateSubresource(pConstBuffer_, 0, NULL, &cb, 0, 0);
+    commands.updateConstants(constBuffer_, &cb, sizeof(cb));
+
+    // Move a share of the instances; only their pages are uploaded
+    uint32_t moved = static_cast<uint32_t>(
+        instances_.count() * (instance_churn_ / 100.0f));
+    std::uniform_real_distribution<float> angle(0.0f, DirectX::XM_2PI);
+    for (uint32_t i = 0; i < moved; ++i) {
+        uint32_t index = rng_() % instances_.count();
+        const SceneNode* node =
+            entities_.get<SceneNode>(instanceEntities_[index]);
+        scene_.setLocal(node->node, instanceLocal(index, angle(rng_)));
+    }
+    respawnInstances();
+    if (updateInstances() > 0) updateSpatialIndex();
+    uint64_t uploadedBytes = instances_.stats().bytes;
+    uint64_t dirtyBytes =
+        uint64_t(instances_.dirtyPages()) * InstanceBuffer::kPageBytes;
+    frame.instanceSnapshot = nullptr;
+    if (dirtyBytes > uint64_t(kInstanceUploadBytes) * kInstanceBacklogFrames) {
+        std::vector<uint8_t>& snapshot = instanceSnapshots_[slot];
+        snapshot.resize(instances_.sizeBytes());
+        instances_.copyAll(snapshot.data());
+        frame.instanceSnapshot = snapshot.data();
+    } else {
+        instances_.recordUploads(commands, instanceBuffer_,
+                                 kInstanceUploadBytes);
+    }
+    frame.uploadsInstances = instances_.stats().bytes != uploadedBytes;
 
     // draw
-    deviceCtx()->OMSetRenderTargets(1, &pRenderTargetView_, nullptr);
-
     float clearColor[4] = { 0.0f, 0.2f, 0.4f, 1.0f };
-    deviceCtx()->ClearRenderTargetView(pRenderTargetView_, clearColor);
-    deviceCtx()->VSSetShader(vertexShader(), nullptr, 0);
-    deviceCtx()->PSSetShader(pixelShader(), nullptr, 0);
+    commands.clear(clearColor);
+    commands.setInputLayout(inputLayout_);
+    commands.setTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+    commands.setVertexBuffer(0, vertexBuffer_, sizeof(Vertex), 0);
+    commands.setVertexBuffer(1, instanceBuffer_, sizeof(InstanceData), 0);
+    commands.setConstantBuffer(kStageVertex, 0, constBuffer_);
+    commands.setVertexShader(vertexShader_);
+    commands.setPixelShader(pixelShader_);
+    commands.setSampler(0, sampler_);
+    Matrix4 viewProjection;
+    DirectX::XMStoreFloat4x4(
+        reinterpret_cast<DirectX::XMFLOAT4X4*>(&viewProjection),
+        RotationMatrix);
+    if (lod_) {
+        PROFILE_ZONE("selectLods");
+        float width;
+        float height;
+        clientSize(width, height);
+        lods_.select(viewProjection, width, height, lodMeshes_.data());
+    }
+    recordVisibleDraws(commands, viewProjection);
+    viewProjection_ = viewProjection;
+    frame.texturePixels = nullptr;
+    if (textureStreamer_ && textureStreamer_->count() > 0) {
+        float* pixels = arena.allocate<float>(textureStreamer_->count());
+        if (pixels != nullptr) {
+            projectTextures(viewProjection, pixels);
+            frame.texturePixels = pixels;
+        }
+    }
+    if (pick_rays_ > 0) castScreenRays();
 
-    deviceCtx()->Draw(3, 0);
+    if (commands.overflowed()) {
+        std::cerr << "Command buffer overflow, frame truncated" << std::endl;
+    }
+    recordedCommandBytes_ += commands.sizeBytes();
+    recordedDraws_ += commands.drawCount();
+    frame.commands = &commands;
+    frame.drawsInstances = commands.drawCount() > 0;
+    buildNs_ += Profiler::nowNs() - startNs;
+}
+
+HRESULT MainWindow::submitFrame(const FrameData& frame) {
+    PROFILE_ZONE("submitFrame");
+    uint64_t startNs = Profiler::nowNs();
+    HRESULT hr = S_OK;
 
-    swapChain()->Present(1, 0);
+    contextExecutor_.runPending();
 
+    // Levels change before the draws that asked for them are replayed
+    if (frame.texturePixels != nullptr) {
+        PROFILE_ZONE("streamTextures");
+        textureStreamer_->update(frame.texturePixels);
+    }
+
+    // Resources the frame leaves untouched become candidates for eviction
+    if (residency_) {
+        residency_->update();
+        if (frame.drawsInstances) {
+            residency_->touch(vertexBufferResidency_);
+        }
+        if (frame.drawsInstances || frame.uploadsInstances) {
+            residency_->touch(instanceBufferResidency_);
+        }
+        const float* pixels = frame.texturePixels;
+        for (size_t t = 0; pixels != nullptr &&
+                           t < textureResidency_.size(); ++t) {
+            if (pixels[t] > 0.0f) residency_->touch(textureResidency_[t]);
+        }
+    }
+
+    // The whole buffer is replaced: with DISCARD the driver renames it
+    // rather than waiting for draws still reading the old contents
+    if (frame.instanceSnapshot != nullptr) {
+        PROFILE_ZONE("uploadAllInstances");
+        ID3D11DeviceContext1* context1 = nullptr;
+        if (SUCCEEDED(deviceCtx()->QueryInterface(
+                __uuidof(ID3D11DeviceContext1),
+                reinterpret_cast<void**>(&context1)))) {
+            context1->UpdateSubresource1(instanceBuffer(), 0, nullptr,
+                                         frame.instanceSnapshot, 0, 0,
+                                         D3D11_COPY_DISCARD);
+            context1->Release();
+        } else {
+            deviceCtx()->UpdateSubresource(instanceBuffer(), 0, nullptr,
+                                           frame.instanceSnapshot, 0, 0);
+        }
+    }
+
+    deviceCtx()->OMSetRenderTargets(1, &pRenderTargetView_, nullptr);
+    executeCommands(*frame.commands, deviceCtx(), resources_,
+                    pRenderTargetView_, uploads_, constants_);
+
+    uint64_t presentNs = Profiler::nowNs();
+    {
+        PROFILE_ZONE("Present");
+        hr = swapChain()->Present(1, 0);
+    }
+    profiler().endFrame();
+
+    uint64_t endNs = Profiler::nowNs();
+    presentNs_ += endNs - presentNs;
+    submitNs_ += endNs - startNs;
+    ++submittedFrames_;
     return hr;
 }
 
+void MainWindow::startPresentThread() {
+    if (!use_present_thread_ || presentThread_.joinable()) return;
+
+    frameQueue_.reopen();
+    presentThread_ = std::thread(&MainWindow::presentThreadMain, this);
+}
+
+void MainWindow::stopPresentThread() {
+    if (!presentThread_.joinable()) return;
+
+    // Queued frames are still submitted before the thread exits, so the
+    // context is idle and owned by the caller once this returns.
+    frameQueue_.close();
+    presentThread_.join();
+}
+
+void MainWindow::presentThreadMain() {
+    applyThreadPlacement("present", present_placement_);
+    samplingProfiler().registerCurrentThread("present");
+
+    FrameData frame;
+    while (frameQueue_.pop(frame)) {
+        SetEvent(hFrameSlotFree_);
+        submitFrame(frame);
+    }
+
+    samplingProfiler().unregisterCurrentThread();
+    SetEvent(hPresentDrained_);
+}
+
+// Runs on the main thread with the present thread stopped, so nothing else
+// touches the context or the swap chain
+void MainWindow::runPendingAction() {
+    WindowAction action = pendingAction_;
+    pendingAction_ = WindowAction::kNone;
+    if (action == WindowAction::kClose) {
+        DestroyWindow(hWnd_);
+        return;
+    }
+
+    toggleFullscreen();
+    RECT rect;
+    GetClientRect(hWnd_, &rect);
+    UINT width = rect.right - rect.left;
+    UINT height = rect.bottom - rect.top;
+    if (FAILED(resizeSwapChain(width, height))) {
+        exit(1);
+    }
+    startPresentThread();
+}
+
 bool MainWindow::init() {
     hWnd_ = this->createWindow();
 
     do {
         if (FAILED(initD3D())) break;
+        initInstances();
+        if (FAILED(uploads_.init(device(), kUploadRingBytes))) break;
 
-        if (FAILED(initPipeline())) break;
+        {
+            PROFILE_ZONE("loadResources");
+            if (FAILED(syncWait(loadResources(), &contextExecutor_))) break;
+        }
+        if (!initTextures()) break;
+
+        // Reserved on the thread that builds frames so first-touch and
+        // kCallerNode place the pages on its NUMA node.
+        bool arenasReady = true;
+        for (FrameArena& arena : frameArenas_) {
+            arenasReady &= arena.init(kFrameArenaBytes, arena_backing_);
+        }
+        if (!arenasReady) break;
+
+        hFrameSlotFree_ = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+        if (hFrameSlotFree_ == nullptr) break;
+        hPresentDrained_ = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+        if (hPresentDrained_ == nullptr) break;
 
-        if (FAILED(initGraphics())) break;
+        startPresentThread();
 
         return true;
     } while (false);
@@ -407,12 +1788,37 @@ void MainWindow::mainloop() {
     MSG msg = {};
     while (msg.message != WM_QUIT) {
         if (PeekMessage(&msg, nullptr, 0, 0, PM_REMOVE)) {
+            PROFILE_ZONE("DispatchMessage");
             TranslateMessage(&msg);
             DispatchMessage(&msg);
-        } else {
+        } else if (pendingAction_ != WindowAction::kNone) {
+            // Queued frames are still presented; the window and the swap
+            // chain change only once the present thread has exited
+            if (presentThread_.joinable()) {
+                frameQueue_.close();
+                DWORD wait = MsgWaitForMultipleObjects(
+                    1, &hPresentDrained_, FALSE, INFINITE, QS_ALLINPUT);
+                if (wait != WAIT_OBJECT_0) continue;
+                presentThread_.join();
+            }
+            runPendingAction();
+        } else if (!presentThread_.joinable()) {
             renderFrame();
+        } else if (frameQueue_.full()) {
+            // Never block on the present thread here: DXGI may need this
+            // thread to process window messages while Present() is running.
+            uint64_t startNs = Profiler::nowNs();
+            MsgWaitForMultipleObjects(1, &hFrameSlotFree_, FALSE, INFINITE,
+                                      QS_ALLINPUT);
+            slotWaitNs_ += Profiler::nowNs() - startNs;
+        } else {
+            FrameData frame;
+            buildFrame(frame);
+            frameQueue_.tryPush(frame);
         }
     }
+
+    stopPresentThread();
 }
 
 LRESULT CALLBACK MainWindow::WindowProc(
@@ -422,20 +1828,32 @@ LRESULT CALLBACK MainWindow::WindowProc(
 
     switch (message) {
     case WM_KEYDOWN:
-        if (wParam == VK_F11) {
-            pWindow->toggleFullscreen();
+        // Mode changes and ResizeBuffers must not overlap Present(), and
+        // joining the present thread here could deadlock: DXGI may be
+        // waiting for this thread to pump messages. mainloop() does it.
+        if (wParam == VK_F11 &&
+            pWindow->pendingAction_ == WindowAction::kNone) {
+            pWindow->pendingAction_ = WindowAction::kToggleFullscreen;
+        }
+        break;
 
-            RECT rect;
-            GetClientRect(hWnd, &rect);
-            UINT width = rect.right - rect.left;
-            UINT height = rect.bottom - rect.top;
+    case WM_CLOSE:
+        // Queued frames must not present into a destroyed window
+        pWindow->pendingAction_ = WindowAction::kClose;
+        break;
 
-            HRESULT hr = pWindow->resizeSwapChain(width, height);
-            if (FAILED(hr)) {
-                exit(1);
-            }
+    case WM_LBUTTONDOWN: {
+        RayHit hit = pWindow->pick(
+            static_cast<float>(GET_X_LPARAM(lParam)),
+            static_cast<float>(GET_Y_LPARAM(lParam)));
+        if (hit.instance != RayHit::kNone) {
+            std::cerr << "Picked instance " << hit.instance << " at t = "
+                      << hit.t << std::endl;
+        } else {
+            std::cerr << "Picked nothing" << std::endl;
         }
         break;
+    }
 
     case WM_SIZE:
         // TBD
@@ -483,11 +1901,144 @@ HWND MainWindow::createWindow() {
 
 // -----------------------------------------------------------------------------
 // Main
-int main() {
+int main(int argc, char* argv[]) {
     MainWindow window;
+    ProfilerConfig profilerConfig;
+    const char* profileJsonPath = nullptr;
+    const char* sampleProfilePath = nullptr;
+    int sampleHz = 997;
+    BackingOptions arenaBacking;
+    bool pinThreads = false;
+    bool highPriority = false;
+    int workerCount = -1;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--present-thread") == 0) {
+            window.setPresentThreadEnabled(true);
+        } else if (strcmp(argv[i], "--hitch-ms") == 0 && i + 1 < argc) {
+            profilerConfig.hitchThresholdMs = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--hitch-dir") == 0 && i + 1 < argc) {
+            profilerConfig.dumpDirectory = argv[++i];
+        } else if (strcmp(argv[i], "--hw-counters") == 0) {
+            profilerConfig.hwCounters = true;
+        } else if (strcmp(argv[i], "--profile-json") == 0 && i + 1 < argc) {
+            profileJsonPath = argv[++i];
+        } else if (strcmp(argv[i], "--sample-profile") == 0 && i + 1 < argc) {
+            sampleProfilePath = argv[++i];
+        } else if (strcmp(argv[i], "--sample-hz") == 0 && i + 1 < argc) {
+            sampleHz = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--pin-threads") == 0) {
+            pinThreads = true;
+        } else if (strcmp(argv[i], "--high-priority") == 0) {
+            highPriority = true;
+        } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            workerCount = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--instances") == 0 && i + 1 < argc) {
+            window.setInstanceCount(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--instance-churn") == 0 &&
+                   i + 1 < argc) {
+            window.setInstanceChurn(static_cast<float>(atof(argv[++i])));
+        } else if (strcmp(argv[i], "--instance-respawn") == 0 &&
+                   i + 1 < argc) {
+            window.setInstanceRespawn(static_cast<float>(atof(argv[++i])));
+        } else if (strcmp(argv[i], "--loose-grid") == 0) {
+            window.setLooseGrid(true);
+        } else if (strcmp(argv[i], "--pick-rays") == 0 && i + 1 < argc) {
+            window.setPickRays(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--lod") == 0) {
+            window.setLod(true);
+        } else if (strcmp(argv[i], "--lod-pixels") == 0 && i + 1 < argc) {
+            window.setLodThreshold(static_cast<float>(atof(argv[++i])));
+        } else if (strcmp(argv[i], "--mesh") == 0 && i + 1 < argc) {
+            window.setMeshPath(argv[++i]);
+        } else if (strcmp(argv[i], "--pack") == 0 && i + 1 < argc) {
+            window.setPackPath(argv[++i]);
+        } else if (strcmp(argv[i], "--texture") == 0 && i + 1 < argc) {
+            window.addTexturePath(argv[++i]);
+        } else if (strcmp(argv[i], "--texture-budget-mb") == 0 &&
+                   i + 1 < argc) {
+            window.setTextureBudget(
+                static_cast<uint64_t>(atof(argv[++i]) * (1 << 20)));
+        } else if (strcmp(argv[i], "--static-scene") == 0) {
+            window.setStaticScene(true);
+        } else if (strcmp(argv[i], "--no-upload-batching") == 0) {
+            window.setUploadBatching(false);
+        } else if (strcmp(argv[i], "--huge-pages") == 0) {
+            arenaBacking.hugePages = true;
+        } else if (strcmp(argv[i], "--numa-node") == 0 && i + 1 < argc) {
+            ++i;
+            arenaBacking.numaNode = strcmp(argv[i], "local") == 0
+                ? BackingOptions::kCallerNode : atoi(argv[i]);
+        } else if (strcmp(argv[i], "--simulate-vram-mb") == 0 &&
+                   i + 1 < argc) {
+            window.setSimulatedVideoMemoryBudget(
+                static_cast<uint64_t>(atof(argv[++i]) * (1 << 20)));
+        }
+    }
 
+    profiler().configure(profilerConfig);
+    if (profilerConfig.hwCounters && !hw_counters::available()) {
+        std::cerr << "Hardware counters are not available" << std::endl;
+    }
+
+    CpuTopology topology;
+    if (discoverTopology(topology)) {
+        std::cerr << "CPU: " << topology.describe() << std::endl;
+    }
+
+    // Leave a core each for the render and present threads
+    if (workerCount < 0) {
+        workerCount = std::max(1, topology.coreCount - 2);
+    }
+
+    // Render thread first, then present thread, then workers. Workers keep
+    // normal priority so they never preempt the frame threads.
+    std::vector<int> cpus = planThreadPlacement(topology, 2 + workerCount,
+                                                currentCpu());
+    ThreadPlacement renderPlacement;
+    ThreadPlacement presentPlacement;
+    std::vector<ThreadPlacement> workerPlacements(workerCount);
+    if (pinThreads) {
+        renderPlacement.cpu = cpus[0];
+        presentPlacement.cpu = cpus[1];
+        for (int i = 0; i < workerCount; ++i) {
+            workerPlacements[i].cpu = cpus[2 + i];
+        }
+    }
+    if (highPriority) {
+        renderPlacement.priority = kThreadPriorityHigh;
+        presentPlacement.priority = kThreadPriorityHigh;
+    }
+    applyThreadPlacement("render", renderPlacement);
+    window.setPresentThreadPlacement(presentPlacement);
+    jobSystem().start(workerCount, workerPlacements);
+
+    samplingProfiler().registerCurrentThread("render");
+    if (sampleProfilePath != nullptr && !samplingProfiler().start(sampleHz)) {
+        std::cerr << "Failed to start sampling profiler" << std::endl;
+    }
+
+    window.setFrameArenaBacking(arenaBacking);
     window.init();
     window.mainloop();
+    jobSystem().stop();
+    window.reportStats();
+
+    FrameTimeStats frames = profiler().frameTimeStats();
+    std::cerr << "Frame times (" << (pinThreads ? "pinned" : "unpinned")
+              << (highPriority ? ", high priority" : "") << "): "
+              << frames.frames << " frames, mean " << frames.meanMs
+              << " ms, jitter " << frames.stddevMs << " ms, p99 "
+              << frames.p99Ms << " ms, max " << frames.maxMs << " ms"
+              << std::endl;
+
+    if (profileJsonPath != nullptr) {
+        profiler().writeSummary(profileJsonPath);
+    }
+
+    if (samplingProfiler().running()) {
+        samplingProfiler().stopAndWrite(sampleProfilePath);
+    }
 
     return 0;
 }
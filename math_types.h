@@ -0,0 +1,217 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+
+// -----------------------------------------------------------------------------
+// Minimal math for the scene-side modules, which stay free of DirectXMath so
+// they build on every platform. Conventions match DirectXMath: row-major
+// storage, row vectors, `a * b` applies `a` first. A Matrix4 has the memory
+// layout of XMFLOAT4X4.
+struct Float3 {
+    float x, y, z;
+};
+
+inline Float3 operator+(const Float3& a, const Float3& b) {
+    return { a.x + b.x, a.y + b.y, a.z + b.z };
+}
+inline Float3 operator-(const Float3& a, const Float3& b) {
+    return { a.x - b.x, a.y - b.y, a.z - b.z };
+}
+inline Float3 operator*(const Float3& a, float s) {
+    return { a.x * s, a.y * s, a.z * s };
+}
+inline float dot(const Float3& a, const Float3& b) {
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+inline Float3 cross(const Float3& a, const Float3& b) {
+    return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z,
+             a.x * b.y - a.y * b.x };
+}
+inline float length(const Float3& a) {
+    return std::sqrt(dot(a, a));
+}
+
+struct Matrix4 {
+    float m[4][4];
+
+    static Matrix4 identity() {
+        return {{ { 1, 0, 0, 0 }, { 0, 1, 0, 0 },
+                  { 0, 0, 1, 0 }, { 0, 0, 0, 1 } }};
+    }
+    static Matrix4 translation(float x, float y, float z) {
+        Matrix4 r = identity();
+        r.m[3][0] = x;
+        r.m[3][1] = y;
+        r.m[3][2] = z;
+        return r;
+    }
+    static Matrix4 scaling(float x, float y, float z) {
+        Matrix4 r = identity();
+        r.m[0][0] = x;
+        r.m[1][1] = y;
+        r.m[2][2] = z;
+        return r;
+    }
+    static Matrix4 rotationZ(float angle) {
+        float s = std::sin(angle);
+        float c = std::cos(angle);
+        Matrix4 r = identity();
+        r.m[0][0] = c;
+        r.m[0][1] = s;
+        r.m[1][0] = -s;
+        r.m[1][1] = c;
+        return r;
+    }
+};
+
+// Each output row is a weighted sum of b's rows, which compilers vectorize
+// into four broadcast multiply-adds per row.
+inline Matrix4 operator*(const Matrix4& a, const Matrix4& b) {
+    Matrix4 r;
+    for (int i = 0; i < 4; ++i) {
+        for (int j = 0; j < 4; ++j) {
+            r.m[i][j] = a.m[i][0] * b.m[0][j] + a.m[i][1] * b.m[1][j] +
+                        a.m[i][2] * b.m[2][j] + a.m[i][3] * b.m[3][j];
+        }
+    }
+    return r;
+}
+
+inline Matrix4 transpose(const Matrix4& a) {
+    Matrix4 r;
+    for (int i = 0; i < 4; ++i) {
+        for (int j = 0; j < 4; ++j) r.m[i][j] = a.m[j][i];
+    }
+    return r;
+}
+
+// General inverse by cofactors; a singular matrix gives non-finite values
+inline Matrix4 inverse(const Matrix4& matrix) {
+    const float* a = &matrix.m[0][0];
+    float c[16];
+    c[0] = a[5] * a[10] * a[15] - a[5] * a[11] * a[14] -
+           a[9] * a[6] * a[15] + a[9] * a[7] * a[14] +
+           a[13] * a[6] * a[11] - a[13] * a[7] * a[10];
+    c[4] = -a[4] * a[10] * a[15] + a[4] * a[11] * a[14] +
+           a[8] * a[6] * a[15] - a[8] * a[7] * a[14] -
+           a[12] * a[6] * a[11] + a[12] * a[7] * a[10];
+    c[8] = a[4] * a[9] * a[15] - a[4] * a[11] * a[13] -
+           a[8] * a[5] * a[15] + a[8] * a[7] * a[13] +
+           a[12] * a[5] * a[11] - a[12] * a[7] * a[9];
+    c[12] = -a[4] * a[9] * a[14] + a[4] * a[10] * a[13] +
+            a[8] * a[5] * a[14] - a[8] * a[6] * a[13] -
+            a[12] * a[5] * a[10] + a[12] * a[6] * a[9];
+    c[1] = -a[1] * a[10] * a[15] + a[1] * a[11] * a[14] +
+           a[9] * a[2] * a[15] - a[9] * a[3] * a[14] -
+           a[13] * a[2] * a[11] + a[13] * a[3] * a[10];
+    c[5] = a[0] * a[10] * a[15] - a[0] * a[11] * a[14] -
+           a[8] * a[2] * a[15] + a[8] * a[3] * a[14] +
+           a[12] * a[2] * a[11] - a[12] * a[3] * a[10];
+    c[9] = -a[0] * a[9] * a[15] + a[0] * a[11] * a[13] +
+           a[8] * a[1] * a[15] - a[8] * a[3] * a[13] -
+           a[12] * a[1] * a[11] + a[12] * a[3] * a[9];
+    c[13] = a[0] * a[9] * a[14] - a[0] * a[10] * a[13] -
+            a[8] * a[1] * a[14] + a[8] * a[2] * a[13] +
+            a[12] * a[1] * a[10] - a[12] * a[2] * a[9];
+    c[2] = a[1] * a[6] * a[15] - a[1] * a[7] * a[14] -
+           a[5] * a[2] * a[15] + a[5] * a[3] * a[14] +
+           a[13] * a[2] * a[7] - a[13] * a[3] * a[6];
+    c[6] = -a[0] * a[6] * a[15] + a[0] * a[7] * a[14] +
+           a[4] * a[2] * a[15] - a[4] * a[3] * a[14] -
+           a[12] * a[2] * a[7] + a[12] * a[3] * a[6];
+    c[10] = a[0] * a[5] * a[15] - a[0] * a[7] * a[13] -
+            a[4] * a[1] * a[15] + a[4] * a[3] * a[13] +
+            a[12] * a[1] * a[7] - a[12] * a[3] * a[5];
+    c[14] = -a[0] * a[5] * a[14] + a[0] * a[6] * a[13] +
+            a[4] * a[1] * a[14] - a[4] * a[2] * a[13] -
+            a[12] * a[1] * a[6] + a[12] * a[2] * a[5];
+    c[3] = -a[1] * a[6] * a[11] + a[1] * a[7] * a[10] +
+           a[5] * a[2] * a[11] - a[5] * a[3] * a[10] -
+           a[9] * a[2] * a[7] + a[9] * a[3] * a[6];
+    c[7] = a[0] * a[6] * a[11] - a[0] * a[7] * a[10] -
+           a[4] * a[2] * a[11] + a[4] * a[3] * a[10] +
+           a[8] * a[2] * a[7] - a[8] * a[3] * a[6];
+    c[11] = -a[0] * a[5] * a[11] + a[0] * a[7] * a[9] +
+            a[4] * a[1] * a[11] - a[4] * a[3] * a[9] -
+            a[8] * a[1] * a[7] + a[8] * a[3] * a[5];
+    c[15] = a[0] * a[5] * a[10] - a[0] * a[6] * a[9] -
+            a[4] * a[1] * a[10] + a[4] * a[2] * a[9] +
+            a[8] * a[1] * a[6] - a[8] * a[2] * a[5];
+
+    float det = a[0] * c[0] + a[1] * c[4] + a[2] * c[8] + a[3] * c[12];
+    Matrix4 r;
+    float* out = &r.m[0][0];
+    for (int i = 0; i < 16; ++i) out[i] = c[i] / det;
+    return r;
+}
+
+inline Float3 transformPoint(const Float3& p, const Matrix4& a) {
+    return { p.x * a.m[0][0] + p.y * a.m[1][0] + p.z * a.m[2][0] + a.m[3][0],
+             p.x * a.m[0][1] + p.y * a.m[1][1] + p.z * a.m[2][1] + a.m[3][1],
+             p.x * a.m[0][2] + p.y * a.m[1][2] + p.z * a.m[2][2] + a.m[3][2] };
+}
+
+// Axis-aligned box
+struct Bounds {
+    Float3 min;
+    Float3 max;
+
+    Float3 center() const { return (min + max) * 0.5f; }
+    Float3 extent() const { return (max - min) * 0.5f; }
+};
+
+inline Bounds merge(const Bounds& a, const Bounds& b) {
+    return { { std::min(a.min.x, b.min.x), std::min(a.min.y, b.min.y),
+               std::min(a.min.z, b.min.z) },
+             { std::max(a.max.x, b.max.x), std::max(a.max.y, b.max.y),
+               std::max(a.max.z, b.max.z) } };
+}
+
+// Proportional to the chance a random ray hits the box, which is what the
+// surface area heuristic weighs
+inline float halfArea(const Bounds& b) {
+    Float3 d = b.max - b.min;
+    return d.x * d.y + d.y * d.z + d.z * d.x;
+}
+
+// Points with dot(normal, p) + d >= 0 are inside
+struct Plane {
+    Float3 normal;
+    float d;
+};
+
+// Inward planes of the D3D clip volume of `viewProjection`, for points
+// transformed as row vectors: left, right, bottom, top, near, far. Each is
+// a sum of the w column and a signed x, y or z column.
+inline void frustumPlanes(const Matrix4& viewProjection, Plane planes[6]) {
+    const Matrix4& a = viewProjection;
+    auto combine = [&a](int j, float s, float w) {
+        return Plane{ { w * a.m[0][3] + s * a.m[0][j],
+                        w * a.m[1][3] + s * a.m[1][j],
+                        w * a.m[2][3] + s * a.m[2][j] },
+                      w * a.m[3][3] + s * a.m[3][j] };
+    };
+    planes[0] = combine(0, 1.0f, 1.0f);
+    planes[1] = combine(0, -1.0f, 1.0f);
+    planes[2] = combine(1, 1.0f, 1.0f);
+    planes[3] = combine(1, -1.0f, 1.0f);
+    planes[4] = combine(2, 1.0f, 0.0f);      // z >= 0
+    planes[5] = combine(2, -1.0f, 1.0f);
+}
+
+// Box around the transformed box: the center is transformed, the extent
+// goes through the absolute value of the rotation-scale part.
+inline Bounds transformBounds(const Bounds& b, const Matrix4& a) {
+    Float3 c = transformPoint(b.center(), a);
+    Float3 e = b.extent();
+    Float3 r = {
+        std::fabs(a.m[0][0]) * e.x + std::fabs(a.m[1][0]) * e.y +
+            std::fabs(a.m[2][0]) * e.z,
+        std::fabs(a.m[0][1]) * e.x + std::fabs(a.m[1][1]) * e.y +
+            std::fabs(a.m[2][1]) * e.z,
+        std::fabs(a.m[0][2]) * e.x + std::fabs(a.m[1][2]) * e.y +
+            std::fabs(a.m[2][2]) * e.z,
+    };
+    return { c - r, c + r };
+}
@@ -0,0 +1,170 @@
+#include "mesh_file.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+namespace {
+
+bool readBytes(const std::string& path, std::vector<uint8_t>& bytes) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        std::cerr << "Failed to open " << path << std::endl;
+        return false;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    bool ok = size >= 0;
+    if (ok) {
+        bytes.resize(static_cast<size_t>(size));
+        ok = fread(bytes.data(), 1, bytes.size(), file) == bytes.size();
+    }
+    fclose(file);
+    if (!ok) std::cerr << "Failed to read " << path << std::endl;
+    return ok;
+}
+
+} // namespace
+
+// -----------------------------------------------------------------------------
+void encodeMeshFile(const std::vector<MeshVertex>& vertices,
+                    const LodMesh& lods, std::vector<uint8_t>& out) {
+    MeshFileHeader header = { kMeshFileMagic, kMeshFileVersion,
+                              lods.levelCount,
+                              static_cast<uint32_t>(vertices.size()) };
+    size_t levelBytes = sizeof(LodLevel) * lods.levelCount;
+    size_t vertexBytes = sizeof(MeshVertex) * vertices.size();
+    size_t at = out.size();
+    out.resize(at + sizeof(header) + levelBytes + vertexBytes);
+    memcpy(&out[at], &header, sizeof(header));
+    at += sizeof(header);
+    memcpy(&out[at], lods.levels, levelBytes);
+    at += levelBytes;
+    if (vertexBytes > 0) memcpy(&out[at], vertices.data(), vertexBytes);
+}
+
+bool decodeMeshFile(const uint8_t* data, size_t size,
+                    std::vector<MeshVertex>& vertices, LodMesh& lods) {
+    MeshFileHeader header;
+    if (size < sizeof(header)) return false;
+    memcpy(&header, data, sizeof(header));
+    if (header.magic != kMeshFileMagic ||
+        header.version != kMeshFileVersion || header.levelCount == 0 ||
+        header.levelCount > kMaxLodLevels) {
+        return false;
+    }
+
+    size_t levelBytes = sizeof(LodLevel) * header.levelCount;
+    size_t vertexBytes = sizeof(MeshVertex) * size_t(header.vertexCount);
+    if (size != sizeof(header) + levelBytes + vertexBytes) return false;
+    lods.levelCount = header.levelCount;
+    memcpy(lods.levels, data + sizeof(header), levelBytes);
+    vertices.resize(header.vertexCount);
+    if (vertexBytes > 0) {
+        memcpy(vertices.data(), data + sizeof(header) + levelBytes,
+               vertexBytes);
+    }
+
+    // Every level must lie within the vertex array
+    for (uint32_t l = 0; l < lods.levelCount; ++l) {
+        const LodLevel& level = lods.levels[l];
+        if (level.vertexCount % 3 != 0 ||
+            level.firstVertex > header.vertexCount ||
+            level.vertexCount > header.vertexCount - level.firstVertex) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool writeMeshFile(const std::string& path,
+                   const std::vector<MeshVertex>& vertices,
+                   const LodMesh& lods) {
+    FILE* file = fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        std::cerr << "Failed to open " << path << std::endl;
+        return false;
+    }
+
+    std::vector<uint8_t> bytes;
+    encodeMeshFile(vertices, lods, bytes);
+    bool ok = fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+    ok = fclose(file) == 0 && ok;
+    if (!ok) std::cerr << "Failed to write " << path << std::endl;
+    return ok;
+}
+
+bool readMeshFile(const std::string& path, std::vector<MeshVertex>& vertices,
+                  LodMesh& lods) {
+    std::vector<uint8_t> bytes;
+    if (!readBytes(path, bytes)) return false;
+    if (!decodeMeshFile(bytes.data(), bytes.size(), vertices, lods)) {
+        std::cerr << "Invalid mesh file " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+bool parseObj(const char* text, size_t size,
+              std::vector<MeshVertex>& triangles) {
+    std::vector<MeshVertex> positions;
+    std::vector<uint32_t> corners;
+    std::string line;
+    for (size_t at = 0; at < size;) {
+        const char* start = text + at;
+        const char* end = static_cast<const char*>(
+            memchr(start, '\n', size - at));
+        size_t length = end != nullptr ? size_t(end - start) : size - at;
+        at += length + 1;
+        if (length < 2 || start[1] != ' ') continue;
+        line.assign(start, length);     // terminated for the parsers
+
+        if (line[0] == 'v') {
+            MeshVertex v = { { 0.0f, 0.0f, 0.0f }, { 1.0f, 1.0f, 1.0f, 1.0f } };
+            sscanf(line.c_str() + 2, "%f %f %f %f %f %f", &v.position.x,
+                   &v.position.y, &v.position.z, &v.color[0], &v.color[1],
+                   &v.color[2]);
+            positions.push_back(v);
+        } else if (line[0] == 'f') {
+            corners.clear();
+            const char* cursor = line.c_str() + 2;
+            while (true) {
+                char* next;
+                long index = strtol(cursor, &next, 10);
+                if (next == cursor) break;
+                index = index < 0 ? long(positions.size()) + index
+                                  : index - 1;
+                if (index < 0 || index >= long(positions.size())) {
+                    return false;
+                }
+                corners.push_back(static_cast<uint32_t>(index));
+                cursor = next;
+                while (*cursor != '\0' && *cursor != ' ' && *cursor != '\t') {
+                    ++cursor;
+                }
+            }
+            for (size_t k = 2; k < corners.size(); ++k) {
+                triangles.push_back(positions[corners[0]]);
+                triangles.push_back(positions[corners[k - 1]]);
+                triangles.push_back(positions[corners[k]]);
+            }
+        }
+    }
+    return true;
+}
+
+bool readObjFile(const std::string& path,
+                 std::vector<MeshVertex>& triangles) {
+    std::vector<uint8_t> bytes;
+    if (!readBytes(path, bytes)) return false;
+    if (!parseObj(reinterpret_cast<const char*>(bytes.data()), bytes.size(),
+                  triangles)) {
+        std::cerr << "Invalid face in " << path << std::endl;
+        return false;
+    }
+    return true;
+}
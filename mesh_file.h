@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "lod.h"
+#include "math_types.h"
+
+// -----------------------------------------------------------------------------
+// Mesh files with a chain of levels of detail, as written by the mesh tool.
+// Every level is a non-indexed triangle list in one shared vertex array, so
+// a loader uploads the array as one vertex buffer and draws a level as a
+// vertex range, the way initGraphics() draws its meshes.
+//
+// Layout, little-endian:
+//   MeshFileHeader
+//   LodLevel[levelCount]        finest first
+//   MeshVertex[vertexCount]
+constexpr uint32_t kMeshFileMagic = 0x3148534D;    // "MSH1"
+constexpr uint32_t kMeshFileVersion = 1;
+
+// Same layout as the renderer's Vertex
+struct MeshVertex {
+    Float3 position;
+    float color[4];
+};
+static_assert(sizeof(MeshVertex) == 28, "matches Vertex");
+
+struct MeshFileHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t levelCount;
+    uint32_t vertexCount;
+};
+
+// In-memory forms, for tools that keep files in a cache
+void encodeMeshFile(const std::vector<MeshVertex>& vertices,
+                    const LodMesh& lods, std::vector<uint8_t>& out);
+bool decodeMeshFile(const uint8_t* data, size_t size,
+                    std::vector<MeshVertex>& vertices, LodMesh& lods);
+
+bool writeMeshFile(const std::string& path,
+                   const std::vector<MeshVertex>& vertices,
+                   const LodMesh& lods);
+bool readMeshFile(const std::string& path, std::vector<MeshVertex>& vertices,
+                  LodMesh& lods);
+
+// Wavefront OBJ input for the tools: positions with optional colors after
+// them, and polygons as triangle fans appended to `triangles`. Texture
+// coordinates and normals are ignored.
+bool parseObj(const char* text, size_t size,
+              std::vector<MeshVertex>& triangles);
+bool readObjFile(const std::string& path,
+                 std::vector<MeshVertex>& triangles);
@@ -0,0 +1,417 @@
+#include "mesh_simplify.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <unordered_map>
+
+#include "content_hash.h"
+#include "job_system.h"
+
+namespace {
+
+// How far past the goal's cost a pass may collapse
+constexpr float kPassCostSlack = 1.5f;
+
+// A collapse may turn a moved triangle's normal at most this far (cosine),
+// so near-right-angle turns and triangles squashed flat are refused too
+constexpr float kMaxTurnCos = 0.2f;
+
+constexpr uint32_t kEvaluateGrain = 16384;
+
+// Symmetric 3x3 matrices are stored as xx, xy, xz, yy, yz, zz
+double quadraticForm(const double* a, const Float3& p) {
+    double x = p.x;
+    double y = p.y;
+    double z = p.z;
+    return a[0] * x * x + a[3] * y * y + a[5] * z * z +
+           2.0 * (a[1] * x * y + a[2] * x * z + a[4] * y * z);
+}
+
+void addOuter(double* a, const Float3& v, double weight) {
+    a[0] += weight * v.x * v.x;
+    a[1] += weight * v.x * v.y;
+    a[2] += weight * v.x * v.z;
+    a[3] += weight * v.y * v.y;
+    a[4] += weight * v.y * v.z;
+    a[5] += weight * v.z * v.z;
+}
+
+uint64_t edgeKey(uint32_t a, uint32_t b) {
+    return a < b ? (uint64_t(a) << 32) | b : (uint64_t(b) << 32) | a;
+}
+
+} // namespace
+
+// -----------------------------------------------------------------------------
+void MeshSimplifier::init(const MeshVertex* vertices, uint32_t vertexCount,
+                          const SimplifyOptions& options) {
+    options_ = options;
+    vertices_.clear();
+    indices_.clear();
+    error_ = 0.0f;
+    stats_ = SimplifyStats();
+
+    // Weld vertices with identical position and color
+    std::unordered_map<uint64_t, uint32_t> welded;
+    welded.reserve(vertexCount / 2);
+    indices_.reserve(vertexCount);
+    Bounds box = { vertices[0].position, vertices[0].position };
+    for (uint32_t i = 0; i < vertexCount; ++i) {
+        const MeshVertex& v = vertices[i];
+        box = merge(box, { v.position, v.position });
+        uint64_t hash = contentHash(&v, sizeof(v));
+        auto it = welded.find(hash);
+        if (it != welded.end() &&
+            memcmp(&vertices_[it->second], &v, sizeof(v)) == 0) {
+            indices_.push_back(it->second);
+            continue;
+        }
+        uint32_t index = static_cast<uint32_t>(vertices_.size());
+        vertices_.push_back(v);
+        if (it == welded.end()) welded.emplace(hash, index);
+        indices_.push_back(index);
+    }
+    Float3 diagonal = box.max - box.min;
+    attributeScale_ = options_.attributeWeight * dot(diagonal, diagonal);
+
+    // Drop triangles that welding made degenerate
+    uint32_t kept = 0;
+    for (size_t i = 0; i + 2 < indices_.size(); i += 3) {
+        const uint32_t* v = &indices_[i];
+        if (v[0] == v[1] || v[1] == v[2] || v[2] == v[0]) continue;
+        for (int k = 0; k < 3; ++k) indices_[kept++] = v[k];
+    }
+    indices_.resize(kept);
+
+    uint32_t count = static_cast<uint32_t>(vertices_.size());
+    quadrics_.assign(count, Quadric{});
+    border_.assign(count, 0);
+    for (uint32_t t = 0; t < triangleCount(); ++t) addTriangle(t);
+    addBorders();
+
+    facing_.resize(triangleCount());
+    for (uint32_t t = 0; t < triangleCount(); ++t) {
+        const uint32_t* v = &indices_[t * 3];
+        Float3 p0 = vertices_[v[0]].position;
+        facing_[t] = cross(vertices_[v[1]].position - p0,
+                           vertices_[v[2]].position - p0);
+    }
+}
+
+void MeshSimplifier::addPlane(Quadric& q, const Float3& n, double d,
+                              double weight) const {
+    addOuter(q.a, n, weight);
+    q.b[0] += weight * n.x * d;
+    q.b[1] += weight * n.y * d;
+    q.b[2] += weight * n.z * d;
+    q.c += weight * d * d;
+}
+
+// The triangle's plane, and for each color channel the gradient g and
+// offset d that interpolate the channel: color(p) = g.p + d in the plane
+void MeshSimplifier::addTriangle(uint32_t t) {
+    const uint32_t* v = &indices_[t * 3];
+    Float3 p0 = vertices_[v[0]].position;
+    Float3 e1 = vertices_[v[1]].position - p0;
+    Float3 e2 = vertices_[v[2]].position - p0;
+    Float3 n = cross(e1, e2);
+    float n2 = dot(n, n);
+    if (n2 == 0.0f) return;
+    float len = std::sqrt(n2);
+    float area = 0.5f * len;
+    Float3 normal = n * (1.0f / len);
+    float offset = -dot(normal, p0);
+
+    Float3 across1 = cross(e2, n) * (1.0f / n2);
+    Float3 across2 = cross(n, e1) * (1.0f / n2);
+    Float3 g[kColors];
+    float d[kColors];
+    for (uint32_t j = 0; j < kColors; ++j) {
+        float s0 = vertices_[v[0]].color[j];
+        g[j] = across1 * (vertices_[v[1]].color[j] - s0) +
+               across2 * (vertices_[v[2]].color[j] - s0);
+        d[j] = s0 - dot(g[j], p0);
+    }
+
+    for (int k = 0; k < 3; ++k) {
+        Quadric& q = quadrics_[v[k]];
+        addPlane(q, normal, offset, area);
+        q.area += area;
+        for (uint32_t j = 0; j < kColors; ++j) {
+            addOuter(q.ga, g[j], area);
+            q.gb[0] += area * g[j].x * d[j];
+            q.gb[1] += area * g[j].y * d[j];
+            q.gb[2] += area * g[j].z * d[j];
+            q.gc += area * d[j] * d[j];
+            q.g[j][0] -= area * g[j].x;
+            q.g[j][1] -= area * g[j].y;
+            q.g[j][2] -= area * g[j].z;
+            q.d[j] -= area * d[j];
+        }
+    }
+}
+
+// Edges used by one triangle are open borders
+void MeshSimplifier::addBorders() {
+    struct Edge {
+        uint64_t key;
+        uint32_t triangle;
+    };
+    std::vector<Edge> edges;
+    edges.reserve(indices_.size());
+    for (uint32_t t = 0; t < triangleCount(); ++t) {
+        const uint32_t* v = &indices_[t * 3];
+        for (int k = 0; k < 3; ++k) {
+            edges.push_back({ edgeKey(v[k], v[(k + 1) % 3]), t });
+        }
+    }
+    std::sort(edges.begin(), edges.end(),
+              [](const Edge& a, const Edge& b) { return a.key < b.key; });
+
+    for (size_t i = 0; i < edges.size();) {
+        size_t j = i + 1;
+        while (j < edges.size() && edges[j].key == edges[i].key) ++j;
+        uint32_t a = static_cast<uint32_t>(edges[i].key >> 32);
+        uint32_t b = static_cast<uint32_t>(edges[i].key);
+        if (j - i == 1) {
+            const uint32_t* v = &indices_[edges[i].triangle * 3];
+            Float3 p0 = vertices_[v[0]].position;
+            Float3 n = cross(vertices_[v[1]].position - p0,
+                             vertices_[v[2]].position - p0);
+            Float3 edge = vertices_[b].position - vertices_[a].position;
+            Float3 side = cross(edge, n);
+            float len = length(side);
+            if (len > 0.0f) {
+                side = side * (1.0f / len);
+                float weight = options_.borderWeight * dot(edge, edge);
+                float offset = -dot(side, vertices_[a].position);
+                addPlane(quadrics_[a], side, offset, weight);
+                addPlane(quadrics_[b], side, offset, weight);
+            }
+            border_[a] = 1;
+            border_[b] = 1;
+        }
+        i = j;
+    }
+}
+
+// Position and color error of a quadric at a vertex
+MeshSimplifier::Error MeshSimplifier::errorAt(const Quadric& q,
+                                              const MeshVertex& v) const {
+    double x = v.position.x;
+    double y = v.position.y;
+    double z = v.position.z;
+    Error e;
+    e.position = quadraticForm(q.a, v.position) +
+                 2.0 * (q.b[0] * x + q.b[1] * y + q.b[2] * z) + q.c;
+    e.color = quadraticForm(q.ga, v.position) +
+              2.0 * (q.gb[0] * x + q.gb[1] * y + q.gb[2] * z) + q.gc;
+    for (uint32_t j = 0; j < kColors; ++j) {
+        double s = v.color[j];
+        e.color += q.area * s * s +
+                   2.0 * s * (q.g[j][0] * x + q.g[j][1] * y + q.g[j][2] * z +
+                              q.d[j]);
+    }
+    return e;
+}
+
+// Cost of moving `from` onto `to`. Quadrics are linear, so the summed
+// quadric's error is the sum of both errors at the survivor, and the
+// survivor's own share is the same for all its edges.
+bool MeshSimplifier::evaluate(uint32_t from, uint32_t to, float& cost,
+                              float& distance) const {
+    if (border_[from] && (options_.lockBorders || !border_[to])) return false;
+
+    Error e = errorAt(quadrics_[from], vertices_[to]);
+    double position = std::max(e.position + self_[to].position, 0.0);
+    double color = std::max(e.color + self_[to].color, 0.0);
+    double area = quadrics_[from].area + quadrics_[to].area;
+    cost = static_cast<float>(position + attributeScale_ * color);
+    distance = area > 0.0 ? static_cast<float>(std::sqrt(position / area))
+                          : 0.0f;
+    return true;
+}
+
+// Counting sort on the top 16 bits of the cost. Costs are not negative,
+// so their bit patterns order like the values; ties within 1% are fine.
+void MeshSimplifier::sortCandidates() {
+    constexpr uint32_t kBuckets = 1 << 16;
+    std::vector<uint32_t> start(kBuckets + 1, 0);
+    auto bucket = [](float cost) {
+        uint32_t bits;
+        memcpy(&bits, &cost, sizeof(bits));
+        return bits >> 16;
+    };
+    for (const Candidate& c : candidates_) {
+        if (c.to != kInvalid) ++start[bucket(c.cost) + 1];
+    }
+    for (uint32_t b = 0; b < kBuckets; ++b) start[b + 1] += start[b];
+    sorted_.resize(start[kBuckets]);
+    for (const Candidate& c : candidates_) {
+        if (c.to != kInvalid) sorted_[start[bucket(c.cost)]++] = c;
+    }
+}
+
+// True when moving `from` onto `to` turns one of its other triangles too
+// far, squashes it flat or leaves it facing away from the input triangle
+// it descends from; small turns allowed one at a time would otherwise
+// pile up over passes into folds. Corners already collapsed in this pass
+// are read through the remap.
+bool MeshSimplifier::flips(uint32_t from, uint32_t to) const {
+    const Float3& target = vertices_[to].position;
+    for (uint32_t a = first_[from]; a < first_[from + 1]; ++a) {
+        const uint32_t* corners = &indices_[adjacent_[a] * 3];
+        uint32_t v[3] = { remap_[corners[0]], remap_[corners[1]],
+                          remap_[corners[2]] };
+        if (v[0] == to || v[1] == to || v[2] == to) continue;
+
+        Float3 p[3];
+        for (int k = 0; k < 3; ++k) p[k] = vertices_[v[k]].position;
+        Float3 before = cross(p[1] - p[0], p[2] - p[0]);
+        for (int k = 0; k < 3; ++k) {
+            if (v[k] == from) p[k] = target;
+        }
+        Float3 after = cross(p[1] - p[0], p[2] - p[0]);
+        const Float3& input = facing_[adjacent_[a]];
+        float size = length(after);
+        if (dot(before, after) <= kMaxTurnCos * length(before) * size ||
+            dot(input, after) <= kMaxTurnCos * length(input) * size) {
+            return true;
+        }
+    }
+    return false;
+}
+
+uint32_t MeshSimplifier::collapsePass(uint32_t targetTriangles) {
+    uint32_t count = static_cast<uint32_t>(vertices_.size());
+    uint32_t triangles = triangleCount();
+    ++stats_.passes;
+
+    // Triangles around each vertex
+    first_.assign(count + 1, 0);
+    for (uint32_t v : indices_) ++first_[v + 1];
+    for (uint32_t v = 0; v < count; ++v) first_[v + 1] += first_[v];
+    adjacent_.resize(indices_.size());
+    remap_.assign(first_.begin(), first_.end() - 1);
+    for (size_t i = 0; i < indices_.size(); ++i) {
+        adjacent_[remap_[indices_[i]]++] = static_cast<uint32_t>(i / 3);
+    }
+
+    // Every half-edge is the collapse of its start onto its end, priced in
+    // parallel
+    self_.resize(count);
+    jobSystem().parallelFor(count, kEvaluateGrain,
+                            [this](uint32_t begin, uint32_t end) {
+        for (uint32_t v = begin; v < end; ++v) {
+            if (first_[v] == first_[v + 1]) continue;
+            self_[v] = errorAt(quadrics_[v], vertices_[v]);
+        }
+    });
+    candidates_.resize(indices_.size());
+    jobSystem().parallelFor(
+        static_cast<uint32_t>(indices_.size()), kEvaluateGrain,
+        [this](uint32_t begin, uint32_t end) {
+            for (uint32_t i = begin; i < end; ++i) {
+                Candidate& c = candidates_[i];
+                c.from = indices_[i];
+                c.to = indices_[i - i % 3 + (i + 1) % 3];
+                if (!evaluate(c.from, c.to, c.cost, c.distance)) {
+                    c.to = kInvalid;
+                }
+            }
+        });
+    sortCandidates();
+
+    // Each collapse removes about two triangles. Vertices it touched are
+    // locked for the rest of the pass, as their prices are out of date.
+    // Locks leave cheap edges for later passes, so a pass stops well
+    // before costs exceed those it would have reached without them.
+    uint32_t goal = std::max(1u, (triangles - targetTriangles) / 2);
+    float costLimit = goal < sorted_.size()
+                          ? kPassCostSlack * sorted_[goal].cost
+                          : std::numeric_limits<float>::max();
+    for (uint32_t v = 0; v < count; ++v) remap_[v] = v;
+    locked_.assign(count, 0);
+    uint32_t collapses = 0;
+    for (const Candidate& c : sorted_) {
+        if (collapses == goal || c.cost > costLimit) break;
+        if (locked_[c.from] || locked_[c.to]) continue;
+        if (flips(c.from, c.to)) {
+            ++stats_.rejectedFlips;
+            continue;
+        }
+
+        // Quadrics are plain sums
+        static_assert(sizeof(Quadric) % sizeof(double) == 0, "all doubles");
+        double* sum = reinterpret_cast<double*>(&quadrics_[c.to]);
+        const double* add =
+            reinterpret_cast<const double*>(&quadrics_[c.from]);
+        for (size_t i = 0; i < sizeof(Quadric) / sizeof(double); ++i) {
+            sum[i] += add[i];
+        }
+        border_[c.to] |= border_[c.from];
+        remap_[c.from] = c.to;
+        locked_[c.from] = 1;
+        locked_[c.to] = 1;
+        error_ = std::max(error_, c.distance);
+        ++collapses;
+    }
+
+    // Move collapsed corners and drop the triangles that lost an edge
+    uint32_t kept = 0;
+    for (size_t i = 0; i < indices_.size(); i += 3) {
+        uint32_t v[3] = { remap_[indices_[i]], remap_[indices_[i + 1]],
+                          remap_[indices_[i + 2]] };
+        if (v[0] == v[1] || v[1] == v[2] || v[2] == v[0]) continue;
+        facing_[kept / 3] = facing_[i / 3];
+        for (int k = 0; k < 3; ++k) indices_[kept++] = v[k];
+    }
+    indices_.resize(kept);
+    facing_.resize(kept / 3);
+    stats_.collapses += collapses;
+    return collapses;
+}
+
+uint32_t MeshSimplifier::simplify(uint32_t targetTriangles) {
+    while (triangleCount() > targetTriangles &&
+           collapsePass(targetTriangles) > 0) {
+    }
+    return triangleCount();
+}
+
+void MeshSimplifier::emit(std::vector<MeshVertex>& out) const {
+    out.reserve(out.size() + indices_.size());
+    for (uint32_t v : indices_) out.push_back(vertices_[v]);
+}
+
+// -----------------------------------------------------------------------------
+void buildLodChain(const MeshVertex* triangles, uint32_t vertexCount,
+                   const float* ratios, uint32_t ratioCount,
+                   const SimplifyOptions& options,
+                   std::vector<MeshVertex>& vertices, LodMesh& lods) {
+    lods.levelCount = 1;
+    lods.levels[0] = { static_cast<uint32_t>(vertices.size()), vertexCount,
+                       0.0f };
+    vertices.insert(vertices.end(), triangles, triangles + vertexCount);
+    if (vertexCount < 3) return;
+
+    MeshSimplifier simplifier;
+    simplifier.init(triangles, vertexCount, options);
+    uint32_t inputTriangles = vertexCount / 3;
+    uint32_t previous = inputTriangles;
+    for (uint32_t r = 0; r < ratioCount && lods.levelCount < kMaxLodLevels;
+         ++r) {
+        uint32_t target = static_cast<uint32_t>(inputTriangles * ratios[r]);
+        uint32_t reached = simplifier.simplify(target);
+        if (reached >= previous || reached == 0) break;
+
+        LodLevel& level = lods.levels[lods.levelCount++];
+        level.firstVertex = static_cast<uint32_t>(vertices.size());
+        level.vertexCount = reached * 3;
+        level.error = simplifier.error();
+        simplifier.emit(vertices);
+        previous = reached;
+    }
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "lod.h"
+#include "mesh_file.h"
+
+// -----------------------------------------------------------------------------
+// Edge-collapse simplification with quadric error metrics (Garland and
+// Heckbert). Each vertex accumulates the squared distance to the planes of
+// its triangles, weighted by area; collapsing an edge sums the two quadrics
+// and the cheapest collapse is taken next.
+//
+// Collapses are half-edge: one end moves onto the other, so the survivor
+// keeps its position and color exactly and no new vertices are invented.
+// Colors are preserved with Hoppe's attribute quadrics, which charge the
+// squared difference between a vertex's color and the color each triangle
+// interpolates at its position. Open borders get extra planes through the
+// border edge, perpendicular to the triangle, so outlines stay in place.
+// Collapses that would turn a triangle near edge-on, against its previous
+// normal or against the input triangle it descends from, are rejected.
+//
+// Collapses run in passes, which is much faster than keeping a priority
+// queue current: every pass prices each half-edge once, orders them by cost
+// with a bucket sort and takes the cheapest, skipping collapses that touch
+// a vertex already changed in the pass.
+//
+// Simplification is progressive: simplify() may be called with decreasing
+// targets and the mesh emitted after each, which is how buildLodChain()
+// produces every level in one run. Not thread-safe; use one simplifier
+// per mesh.
+struct SimplifyOptions {
+    // Color error against position error; at 1, a full change of one
+    // channel costs as much as moving by the mesh's bounding diagonal
+    float attributeWeight = 0.1f;
+    float borderWeight = 10.0f;
+    bool lockBorders = false;
+};
+
+struct SimplifyStats {
+    uint64_t passes = 0;
+    uint64_t collapses = 0;
+    uint64_t rejectedFlips = 0;
+};
+
+class MeshSimplifier {
+ public:
+    // Welds identical vertices of a non-indexed triangle list
+    void init(const MeshVertex* vertices, uint32_t vertexCount,
+              const SimplifyOptions& options);
+
+    // Collapses edges until at most `targetTriangles` remain or no valid
+    // collapse is left. Returns the remaining triangle count.
+    uint32_t simplify(uint32_t targetTriangles);
+
+    uint32_t triangleCount() const {
+        return static_cast<uint32_t>(indices_.size() / 3);
+    }
+
+    // Largest area-weighted RMS distance to the original planes over all
+    // collapses so far, in object units
+    float error() const { return error_; }
+
+    // Appends the remaining triangles as a non-indexed triangle list
+    void emit(std::vector<MeshVertex>& out) const;
+
+    const SimplifyStats& stats() const { return stats_; }
+
+ private:
+    static constexpr uint32_t kColors = 4;
+
+    // Position terms p'Ap + 2b'p + c, then the same for the color gradients
+    // plus the color cross terms. Doubles: the constant terms are many
+    // orders of magnitude above the errors of small triangles.
+    struct Quadric {
+        double a[6], b[3], c;
+        double area;
+        double ga[6], gb[3], gc;
+        double g[kColors][3], d[kColors];
+    };
+
+    struct Error {
+        double position = 0.0;
+        double color = 0.0;
+    };
+
+    static constexpr uint32_t kInvalid = ~0u;
+
+    struct Candidate {
+        float cost;
+        float distance;
+        uint32_t from, to;           // kInvalid `to` when not allowed
+    };
+
+    void addPlane(Quadric& q, const Float3& n, double d,
+                  double weight) const;
+    void addTriangle(uint32_t t);
+    void addBorders();
+    Error errorAt(const Quadric& q, const MeshVertex& v) const;
+    bool evaluate(uint32_t from, uint32_t to, float& cost,
+                  float& distance) const;
+    void sortCandidates();
+    bool flips(uint32_t from, uint32_t to) const;
+    uint32_t collapsePass(uint32_t targetTriangles);
+
+    SimplifyOptions options_;
+    float attributeScale_ = 0.0f;
+    std::vector<MeshVertex> vertices_;
+    std::vector<uint32_t> indices_;          // live triangles
+    std::vector<Quadric> quadrics_;
+    std::vector<uint8_t> border_;
+    std::vector<Float3> facing_;             // input normal of each triangle
+    float error_ = 0.0f;
+
+    // Per pass
+    std::vector<uint32_t> first_;            // triangles by vertex
+    std::vector<uint32_t> adjacent_;
+    std::vector<Error> self_;                // each vertex at itself
+    std::vector<Candidate> candidates_;
+    std::vector<Candidate> sorted_;
+    std::vector<uint32_t> remap_;
+    std::vector<uint8_t> locked_;
+    SimplifyStats stats_;
+};
+
+// Level 0 is the input; each ratio adds a level with about that share of
+// its triangles, unless simplification can no longer reach it. Returns the
+// levels in `lods` over the triangle lists appended to `vertices`.
+void buildLodChain(const MeshVertex* triangles, uint32_t vertexCount,
+                   const float* ratios, uint32_t ratioCount,
+                   const SimplifyOptions& options,
+                   std::vector<MeshVertex>& vertices, LodMesh& lods);
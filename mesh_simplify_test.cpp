@@ -0,0 +1,391 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <set>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "mesh_file.h"
+#include "mesh_simplify.h"
+#include "test_check.h"
+
+// -----------------------------------------------------------------------------
+// Tests for MeshSimplifier and .mesh files: a closed sphere and a bordered
+// height field simplified progressively to several ratios, each level near
+// its target triangle count, with no triangle flipped against the surface,
+// the sphere still closed and the field's outline and projected area kept
+// (every border vertex kept outright with lockBorders); buildLodChain()
+// errors growing level by level; a LOD chain round tripping through
+// encodeMeshFile() and a file, with truncated and inconsistent data
+// refused; and parseObj() fanning polygons. With --bench it simplifies a
+// sphere of that many triangles to each ratio and prints triangles removed
+// per second and the error reached.
+//
+//   MeshSimplifyTest [--bench <triangles>]
+namespace {
+
+const float kRatios[] = { 0.5f, 0.25f, 0.1f, 0.03f };
+
+// Positions computed once per vertex and shared by every triangle using
+// them, so init() welds them back together
+std::vector<MeshVertex> triangleList(const std::vector<MeshVertex>& points,
+                                     const std::vector<uint32_t>& indices) {
+    std::vector<MeshVertex> out;
+    out.reserve(indices.size());
+    for (uint32_t index : indices) out.push_back(points[index]);
+    return out;
+}
+
+// Latitude rings between two poles, wound outwards
+std::vector<MeshVertex> sphere(uint32_t rings, uint32_t segments) {
+    const float pi = 3.14159265f;
+    std::vector<MeshVertex> points;
+    points.push_back({ { 0.0f, 0.0f, 1.0f }, { 1, 1, 1, 1 } });
+    for (uint32_t r = 1; r < rings; ++r) {
+        float theta = pi * r / rings;
+        for (uint32_t s = 0; s < segments; ++s) {
+            float phi = 2.0f * pi * s / segments;
+            Float3 p = { std::sin(theta) * std::cos(phi),
+                         std::sin(theta) * std::sin(phi), std::cos(theta) };
+            points.push_back({ p, { 0.5f + 0.5f * p.x, 0.5f, 0.5f, 1 } });
+        }
+    }
+    uint32_t south = static_cast<uint32_t>(points.size());
+    points.push_back({ { 0.0f, 0.0f, -1.0f }, { 1, 1, 1, 1 } });
+
+    auto at = [segments](uint32_t ring, uint32_t s) {
+        return 1 + (ring - 1) * segments + s % segments;
+    };
+    std::vector<uint32_t> indices;
+    for (uint32_t s = 0; s < segments; ++s) {
+        indices.insert(indices.end(), { 0, at(1, s), at(1, s + 1) });
+        for (uint32_t r = 1; r + 1 < rings; ++r) {
+            indices.insert(indices.end(), { at(r, s), at(r + 1, s),
+                                            at(r + 1, s + 1),
+                                            at(r, s), at(r + 1, s + 1),
+                                            at(r, s + 1) });
+        }
+        indices.insert(indices.end(), { at(rings - 1, s), south,
+                                        at(rings - 1, s + 1) });
+    }
+    return triangleList(points, indices);
+}
+
+// A unit square of rolling terrain; its outline is an open border
+std::vector<MeshVertex> heightField(uint32_t side) {
+    std::vector<MeshVertex> points;
+    for (uint32_t y = 0; y < side; ++y) {
+        for (uint32_t x = 0; x < side; ++x) {
+            float u = float(x) / (side - 1);
+            float v = float(y) / (side - 1);
+            float h = 0.08f * std::sin(u * 11.0f) * std::cos(v * 7.0f);
+            points.push_back({ { u, v, h }, { u, v, 0.5f, 1 } });
+        }
+    }
+    std::vector<uint32_t> indices;
+    for (uint32_t y = 0; y + 1 < side; ++y) {
+        for (uint32_t x = 0; x + 1 < side; ++x) {
+            uint32_t i = y * side + x;
+            indices.insert(indices.end(), { i, i + side, i + 1,
+                                            i + 1, i + side, i + side + 1 });
+        }
+    }
+    return triangleList(points, indices);
+}
+
+Float3 normal(const MeshVertex* t) {
+    return cross(t[1].position - t[0].position,
+                 t[2].position - t[0].position);
+}
+
+typedef std::pair<Float3, Float3> Edge;
+
+bool before(const Float3& a, const Float3& b) {
+    return std::tie(a.x, a.y, a.z) < std::tie(b.x, b.y, b.z);
+}
+
+struct EdgeLess {
+    bool operator()(const Edge& a, const Edge& b) const {
+        if (before(a.first, b.first)) return true;
+        if (before(b.first, a.first)) return false;
+        return before(a.second, b.second);
+    }
+};
+
+// Undirected edges used by exactly one triangle
+std::vector<Edge> openEdges(const std::vector<MeshVertex>& triangles) {
+    std::map<Edge, int, EdgeLess> uses;
+    for (size_t t = 0; t < triangles.size(); t += 3) {
+        for (int e = 0; e < 3; ++e) {
+            Float3 a = triangles[t + e].position;
+            Float3 b = triangles[t + (e + 1) % 3].position;
+            if (before(b, a)) std::swap(a, b);
+            ++uses[{ a, b }];
+        }
+    }
+    std::vector<Edge> open;
+    for (const auto& entry : uses) {
+        if (entry.second == 1) open.push_back(entry.first);
+    }
+    return open;
+}
+
+bool onOutline(const Float3& p) {
+    return p.x == 0.0f || p.x == 1.0f || p.y == 0.0f || p.y == 1.0f;
+}
+
+bool sameSide(const Edge& e) {
+    return (e.first.x == e.second.x &&
+            (e.first.x == 0.0f || e.first.x == 1.0f)) ||
+           (e.first.y == e.second.y &&
+            (e.first.y == 0.0f || e.first.y == 1.0f));
+}
+
+double projectedArea(const std::vector<MeshVertex>& triangles) {
+    double area = 0.0;
+    for (size_t t = 0; t < triangles.size(); t += 3) {
+        area += 0.5 * std::fabs(normal(&triangles[t]).z);
+    }
+    return area;
+}
+
+// Near the target: never above it, and the simplifier should not give up
+// far short of it on meshes this smooth
+void checkCount(uint32_t reached, uint32_t target, int line) {
+    CHECK_AT(reached <= target && reached >= target * 9 / 10,
+             "triangle count near the target", line);
+}
+
+void testSphere() {
+    std::vector<MeshVertex> input = sphere(48, 96);
+    uint32_t inputTriangles = static_cast<uint32_t>(input.size() / 3);
+    CHECK(openEdges(input).empty());
+
+    MeshSimplifier simplifier;
+    simplifier.init(input.data(), static_cast<uint32_t>(input.size()),
+                    SimplifyOptions());
+    CHECK(simplifier.triangleCount() == inputTriangles);
+    float error = 0.0f;
+    for (float ratio : kRatios) {
+        uint32_t target = static_cast<uint32_t>(inputTriangles * ratio);
+        uint32_t reached = simplifier.simplify(target);
+        checkCount(reached, target, __LINE__);
+        CHECK(reached == simplifier.triangleCount());
+        CHECK(simplifier.error() >= error);
+        error = simplifier.error();
+
+        std::vector<MeshVertex> out;
+        simplifier.emit(out);
+        CHECK(out.size() == size_t(reached) * 3);
+        bool outward = true;
+        bool onSphere = true;
+        for (size_t t = 0; t < out.size(); t += 3) {
+            Float3 center = (out[t].position + out[t + 1].position +
+                             out[t + 2].position) * (1.0f / 3.0f);
+            outward &= dot(normal(&out[t]), center) > 0.0f;
+            onSphere &= std::fabs(length(out[t].position) - 1.0f) < 1e-5f;
+        }
+        CHECK(outward);
+        CHECK(onSphere);                     // half-edge collapses only
+        CHECK(openEdges(out).empty());       // still closed
+    }
+    CHECK(error > 0.0f && error < 0.2f);
+}
+
+void checkField(bool lockBorders) {
+    const uint32_t side = 41;
+    std::vector<MeshVertex> input = heightField(side);
+    uint32_t inputTriangles = static_cast<uint32_t>(input.size() / 3);
+    double area = projectedArea(input);
+    std::set<Float3, bool (*)(const Float3&, const Float3&)> border(before);
+    for (const MeshVertex& v : input) {
+        if (onOutline(v.position)) border.insert(v.position);
+    }
+    CHECK(border.size() == (side - 1) * 4);
+
+    SimplifyOptions options;
+    options.lockBorders = lockBorders;
+    MeshSimplifier simplifier;
+    simplifier.init(input.data(), static_cast<uint32_t>(input.size()),
+                    options);
+    for (float ratio : kRatios) {
+        uint32_t target = static_cast<uint32_t>(inputTriangles * ratio);
+        uint32_t reached = simplifier.simplify(target);
+        std::vector<MeshVertex> out;
+        simplifier.emit(out);
+        // Locked, the border alone needs more than the smallest targets
+        if (!lockBorders || ratio >= 0.1f) checkCount(reached, target,
+                                                      __LINE__);
+
+        // As the input is wound. Steep slopes may leave slivers standing
+        // on edge, whose z is rounding; none may lean past upright.
+        bool upward = true;
+        for (size_t t = 0; t < out.size(); t += 3) {
+            Float3 n = normal(&out[t]);
+            upward &= n.z < 1e-4f * length(n);
+        }
+        CHECK(upward);
+        CHECK(std::fabs(projectedArea(out) - area) < 1e-4 * area);
+
+        // The outline stays on the square, corners included
+        bool outline = true;
+        for (const Edge& e : openEdges(out)) outline &= sameSide(e);
+        CHECK(outline);
+        std::set<Float3, bool (*)(const Float3&, const Float3&)> kept(
+            before);
+        for (const MeshVertex& v : out) {
+            if (onOutline(v.position)) kept.insert(v.position);
+        }
+        for (Float3 corner : { Float3{ 0, 0, 0 }, Float3{ 1, 0, 0 },
+                               Float3{ 0, 1, 0 }, Float3{ 1, 1, 0 } }) {
+            bool found = false;
+            for (const Float3& p : kept) {
+                found |= p.x == corner.x && p.y == corner.y;
+            }
+            CHECK(found);
+        }
+        if (lockBorders) CHECK(kept.size() == border.size());
+    }
+}
+
+void testField() {
+    checkField(false);
+    checkField(true);
+}
+
+void testLodChain() {
+    std::vector<MeshVertex> input = sphere(24, 48);
+    std::vector<MeshVertex> vertices;
+    LodMesh lods;
+    buildLodChain(input.data(), static_cast<uint32_t>(input.size()),
+                  kRatios, 4, SimplifyOptions(), vertices, lods);
+    CHECK(lods.levelCount == 5);
+    CHECK(lods.levels[0].vertexCount == input.size() &&
+          lods.levels[0].error == 0.0f);
+    bool ordered = true;
+    for (uint32_t l = 1; l < lods.levelCount; ++l) {
+        const LodLevel& level = lods.levels[l];
+        const LodLevel& finer = lods.levels[l - 1];
+        ordered &= level.vertexCount < finer.vertexCount &&
+                   level.error >= finer.error &&
+                   level.firstVertex == finer.firstVertex + finer.vertexCount;
+    }
+    CHECK(ordered);
+    CHECK(vertices.size() == lods.levels[lods.levelCount - 1].firstVertex +
+                             lods.levels[lods.levelCount - 1].vertexCount);
+
+    // In memory and through a file, byte for byte
+    std::vector<uint8_t> encoded;
+    encodeMeshFile(vertices, lods, encoded);
+    std::vector<MeshVertex> decodedVertices;
+    LodMesh decoded;
+    CHECK(decodeMeshFile(encoded.data(), encoded.size(), decodedVertices,
+                         decoded));
+    CHECK(decoded.levelCount == lods.levelCount &&
+          memcmp(decoded.levels, lods.levels,
+                 sizeof(LodLevel) * lods.levelCount) == 0);
+    CHECK(decodedVertices.size() == vertices.size() &&
+          memcmp(decodedVertices.data(), vertices.data(),
+                 vertices.size() * sizeof(MeshVertex)) == 0);
+
+    std::string path =
+        (std::filesystem::temp_directory_path() / "mesh_test.mesh").string();
+    CHECK(writeMeshFile(path, vertices, lods));
+    std::vector<MeshVertex> readVertices;
+    LodMesh read;
+    CHECK(readMeshFile(path, readVertices, read));
+    CHECK(read.levelCount == lods.levelCount &&
+          readVertices.size() == vertices.size() &&
+          memcmp(readVertices.data(), vertices.data(),
+                 vertices.size() * sizeof(MeshVertex)) == 0);
+    std::filesystem::remove(path);
+
+    // Truncated, a bad magic, and a level running past the vertices
+    CHECK(!decodeMeshFile(encoded.data(), encoded.size() - 1,
+                          decodedVertices, decoded));
+    CHECK(!decodeMeshFile(encoded.data(), 8, decodedVertices, decoded));
+    std::vector<uint8_t> corrupt = encoded;
+    corrupt[0] ^= 1;
+    CHECK(!decodeMeshFile(corrupt.data(), corrupt.size(), decodedVertices,
+                          decoded));
+    corrupt = encoded;
+    LodLevel last = lods.levels[lods.levelCount - 1];
+    last.vertexCount += 3;
+    memcpy(corrupt.data() + sizeof(MeshFileHeader) +
+               sizeof(LodLevel) * (lods.levelCount - 1),
+           &last, sizeof(last));
+    CHECK(!decodeMeshFile(corrupt.data(), corrupt.size(), decodedVertices,
+                          decoded));
+}
+
+void testObj() {
+    const char text[] =
+        "# a quad and a triangle\n"
+        "v 0 0 0\nv 1 0 0 1 0 0\nv 1 1 0\nv 0 1 0\n"
+        "vt 0 0\nvn 0 0 1\n"
+        "f 1/1/1 2/1/1 3/1/1 4/1/1\n"
+        "f 1 2 3\n";
+    std::vector<MeshVertex> triangles;
+    CHECK(parseObj(text, sizeof(text) - 1, triangles));
+    CHECK(triangles.size() == 9);
+    CHECK(triangles.size() == 9 && triangles[4].position.x == 1.0f &&
+          triangles[5].position.y == 1.0f &&
+          triangles[5].position.x == 0.0f);
+    CHECK(triangles.size() == 9 && triangles[1].color[0] == 1.0f &&
+          triangles[1].color[1] == 0.0f);
+}
+
+// -----------------------------------------------------------------------------
+void bench(uint32_t triangles) {
+    uint32_t rings = std::max(4u, static_cast<uint32_t>(
+        std::sqrt(triangles / 4.0)));
+    std::vector<MeshVertex> input = sphere(rings, rings * 2);
+    uint32_t inputTriangles = static_cast<uint32_t>(input.size() / 3);
+
+    auto start = std::chrono::steady_clock::now();
+    MeshSimplifier simplifier;
+    simplifier.init(input.data(), static_cast<uint32_t>(input.size()),
+                    SimplifyOptions());
+    std::cerr << "Sphere: " << inputTriangles << " triangles" << std::endl;
+    for (float ratio : kRatios) {
+        uint32_t before = simplifier.triangleCount();
+        auto step = std::chrono::steady_clock::now();
+        uint32_t reached = simplifier.simplify(
+            static_cast<uint32_t>(inputTriangles * ratio));
+        double ms = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - step).count();
+        std::cerr << "  ratio " << ratio << ": " << reached
+                  << " triangles, error " << simplifier.error() << ", "
+                  << (before - reached) / std::max(ms, 1e-3) / 1000.0
+                  << " M triangles/s removed" << std::endl;
+    }
+    double ms = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+    std::cerr << "Total " << ms << " ms, "
+              << simplifier.stats().rejectedFlips << " collapses refused"
+              << std::endl;
+}
+
+} // namespace
+
+// -----------------------------------------------------------------------------
+int main(int argc, char* argv[]) {
+    if (argc == 3 && strcmp(argv[1], "--bench") == 0) {
+        bench(static_cast<uint32_t>(std::max(1, atoi(argv[2]))));
+        return 0;
+    }
+
+    testSphere();
+    testField();
+    testLodChain();
+    testObj();
+    return testResult("mesh_simplify");
+}
@@ -0,0 +1,293 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "hw_counters.h"
+#include "job_system.h"
+#include "mesh_file.h"
+#include "mesh_simplify.h"
+#include "sampling_profiler.h"
+
+// -----------------------------------------------------------------------------
+// Offline tool that builds level of detail chains and writes them as .mesh
+// files for the renderer's --mesh option. Inputs are Wavefront OBJ files,
+// with optional vertex colors after the position, or .mesh files, whose
+// first level is simplified again. Assets are processed in parallel, one
+// per job.
+//
+//   MeshTool [options] <output dir> <input.obj|input.mesh>...
+//   MeshTool [options] --bench <triangles>
+//
+// --ratios lists the share of the input's triangles for each level after
+// the first. --bench simplifies a procedural height field of about that
+// many triangles and prints throughput and the error at each ratio; with
+// --hw-counters, also IPC and cache, branch and dTLB miss rates per step,
+// and the counts of each step as a line of JSON on stdout.
+// --sample-profile samples every thread's stacks (SIGPROF, --sample-hz,
+// default 997) into <prefix>.folded and a <prefix>.svg flamegraph.
+namespace {
+
+struct Asset {
+    std::string input;
+    std::string output;
+    bool ok = false;
+    uint32_t triangles = 0;
+    LodMesh lods;
+    double ms = 0.0;
+};
+
+const char* baseName(const std::string& path) {
+    size_t slash = path.find_last_of("/\\");
+    return path.c_str() + (slash == std::string::npos ? 0 : slash + 1);
+}
+
+bool endsWith(const std::string& s, const char* suffix) {
+    size_t n = strlen(suffix);
+    return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+}
+
+bool readInput(const std::string& path, std::vector<MeshVertex>& triangles) {
+    if (!endsWith(path, ".mesh")) return readObjFile(path, triangles);
+
+    std::vector<MeshVertex> vertices;
+    LodMesh lods;
+    if (!readMeshFile(path, vertices, lods)) return false;
+    const LodLevel& full = lods.levels[0];
+    triangles.assign(vertices.begin() + full.firstVertex,
+                     vertices.begin() + full.firstVertex + full.vertexCount);
+    return true;
+}
+
+// Rolling terrain colored by height; its outline is an open border
+std::vector<MeshVertex> heightField(uint32_t triangles) {
+    uint32_t side = std::max(2u, static_cast<uint32_t>(
+        std::sqrt(triangles / 2.0)) + 1);
+    std::vector<MeshVertex> grid(size_t(side) * side);
+    for (uint32_t y = 0; y < side; ++y) {
+        for (uint32_t x = 0; x < side; ++x) {
+            float u = float(x) / (side - 1);
+            float v = float(y) / (side - 1);
+            float h = 0.08f * std::sin(u * 11.0f) * std::cos(v * 7.0f) +
+                      0.03f * std::sin((u + v) * 37.0f);
+            float t = std::clamp(h * 6.0f + 0.5f, 0.0f, 1.0f);
+            grid[size_t(y) * side + x] = {
+                { u - 0.5f, v - 0.5f, h }, { t, 0.6f, 1.0f - t, 1.0f } };
+        }
+    }
+
+    std::vector<MeshVertex> out;
+    out.reserve(size_t(side - 1) * (side - 1) * 6);
+    for (uint32_t y = 0; y + 1 < side; ++y) {
+        for (uint32_t x = 0; x + 1 < side; ++x) {
+            const MeshVertex* row = &grid[size_t(y) * side + x];
+            const MeshVertex* next = row + side;
+            MeshVertex quad[6] = { row[0], next[0], row[1],
+                                   row[1], next[0], next[1] };
+            out.insert(out.end(), quad, quad + 6);
+        }
+    }
+    return out;
+}
+
+std::vector<float> parseRatios(const char* list) {
+    std::vector<float> ratios;
+    for (const char* p = list; *p != '\0';) {
+        char* end;
+        float r = strtof(p, &end);
+        if (end == p) break;
+        if (r > 0.0f && r < 1.0f) ratios.push_back(r);
+        p = *end == ',' ? end + 1 : end;
+    }
+    std::sort(ratios.begin(), ratios.end(), std::greater<float>());
+    return ratios;
+}
+
+// Counter summary of a bench step, when counting, and its JSON on stdout
+void printCounters(const HwCounterSpan& counters, const std::string& step) {
+    std::string summary = counters.summary();
+    if (summary.empty()) return;
+    std::cerr << "    " << summary << std::endl;
+    std::cout << counters.json(step.c_str()) << std::endl;
+}
+
+void bench(uint32_t triangles, const std::vector<float>& ratios,
+           const SimplifyOptions& options, bool hwCounters) {
+    std::vector<MeshVertex> input = heightField(triangles);
+    uint32_t inputTriangles = static_cast<uint32_t>(input.size() / 3);
+    if (hwCounters && !hw_counters::available()) {
+        std::cerr << "Hardware counters unavailable" << std::endl;
+    }
+
+    HwCounterSpan total(hwCounters);
+    auto start = std::chrono::steady_clock::now();
+    MeshSimplifier simplifier;
+    simplifier.init(input.data(), static_cast<uint32_t>(input.size()),
+                    options);
+    double initMs = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+    std::cerr << "Height field: " << inputTriangles << " triangles, "
+              << "prepared in " << initMs << " ms" << std::endl;
+
+    for (float ratio : ratios) {
+        uint32_t target = static_cast<uint32_t>(inputTriangles * ratio);
+        uint32_t before = simplifier.triangleCount();
+        HwCounterSpan counters(hwCounters);
+        auto step = std::chrono::steady_clock::now();
+        uint32_t reached = simplifier.simplify(target);
+        double ms = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - step).count();
+        std::cerr << "  ratio " << ratio << ": " << reached << "/" << target
+                  << " triangles, error " << simplifier.error() << ", "
+                  << (before - reached) / std::max(ms, 1e-3) / 1000.0
+                  << " M triangles/s removed" << std::endl;
+        char name[32];
+        snprintf(name, sizeof(name), "ratio %g", ratio);
+        printCounters(counters, name);
+    }
+
+    double totalMs = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+    const SimplifyStats& s = simplifier.stats();
+    std::cerr << "Total " << totalMs << " ms, "
+              << inputTriangles / totalMs / 1000.0
+              << " M input triangles/s; " << s.collapses << " collapses in "
+              << s.passes << " passes, " << s.rejectedFlips
+              << " rejected flips" << std::endl;
+    printCounters(total, "total");
+}
+
+} // namespace
+
+// -----------------------------------------------------------------------------
+int main(int argc, char* argv[]) {
+    std::vector<float> ratios = { 0.5f, 0.25f, 0.125f, 0.0625f };
+    SimplifyOptions options;
+    int workerCount = -1;
+    uint32_t benchTriangles = 0;
+    bool hwCounters = false;
+    const char* sampleProfilePath = nullptr;
+    int sampleHz = 997;
+    std::vector<std::string> paths;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--ratios") == 0 && i + 1 < argc) {
+            ratios = parseRatios(argv[++i]);
+        } else if (strcmp(argv[i], "--attribute-weight") == 0 &&
+                   i + 1 < argc) {
+            options.attributeWeight = static_cast<float>(atof(argv[++i]));
+        } else if (strcmp(argv[i], "--lock-borders") == 0) {
+            options.lockBorders = true;
+        } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            workerCount = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--bench") == 0 && i + 1 < argc) {
+            benchTriangles = static_cast<uint32_t>(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--hw-counters") == 0) {
+            hwCounters = true;
+        } else if (strcmp(argv[i], "--sample-profile") == 0 && i + 1 < argc) {
+            sampleProfilePath = argv[++i];
+        } else if (strcmp(argv[i], "--sample-hz") == 0 && i + 1 < argc) {
+            sampleHz = atoi(argv[++i]);
+        } else {
+            paths.push_back(argv[i]);
+        }
+    }
+
+    // The job system's workers register as they start
+    samplingProfiler().registerCurrentThread("main");
+    if (sampleProfilePath != nullptr && !samplingProfiler().start(sampleHz)) {
+        std::cerr << "Failed to start sampling profiler" << std::endl;
+    }
+
+    if (benchTriangles > 0) {
+        bench(benchTriangles, ratios, options, hwCounters);
+        if (samplingProfiler().running()) {
+            samplingProfiler().stopAndWrite(sampleProfilePath);
+        }
+        return 0;
+    }
+    if (paths.size() < 2) {
+        std::cerr << "Usage: MeshTool [--ratios r,r,...] "
+                     "[--attribute-weight w] [--lock-borders] "
+                     "[--workers n]\n"
+                     "                [--sample-profile prefix] "
+                     "[--sample-hz n] <output dir> <input>...\n"
+                     "       MeshTool [options] [--hw-counters] "
+                     "--bench <triangles>"
+                  << std::endl;
+        return 1;
+    }
+
+    if (workerCount < 0) {
+        workerCount = std::max(
+            0, static_cast<int>(std::thread::hardware_concurrency()) - 1);
+    }
+    jobSystem().start(workerCount);
+
+    std::vector<Asset> assets(paths.size() - 1);
+    for (size_t i = 0; i < assets.size(); ++i) {
+        std::string name = baseName(paths[i + 1]);
+        assets[i].input = paths[i + 1];
+        assets[i].output =
+            paths[0] + "/" + name.substr(0, name.find_last_of('.')) + ".mesh";
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    jobSystem().parallelFor(
+        static_cast<uint32_t>(assets.size()), 1,
+        [&](uint32_t begin, uint32_t end) {
+            for (uint32_t a = begin; a < end; ++a) {
+                Asset& asset = assets[a];
+                auto assetStart = std::chrono::steady_clock::now();
+                std::vector<MeshVertex> input;
+                if (!readInput(asset.input, input) || input.empty()) continue;
+
+                std::vector<MeshVertex> vertices;
+                buildLodChain(input.data(),
+                              static_cast<uint32_t>(input.size()),
+                              ratios.data(),
+                              static_cast<uint32_t>(ratios.size()), options,
+                              vertices, asset.lods);
+                asset.triangles = static_cast<uint32_t>(input.size() / 3);
+                asset.ok = writeMeshFile(asset.output, vertices, asset.lods);
+                asset.ms = std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - assetStart).count();
+            }
+        });
+    double totalMs = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+    jobSystem().stop();
+
+    uint64_t triangles = 0;
+    int failed = 0;
+    for (const Asset& asset : assets) {
+        if (!asset.ok) {
+            std::cerr << asset.input << ": failed" << std::endl;
+            ++failed;
+            continue;
+        }
+        triangles += asset.triangles;
+        std::cerr << asset.input << " -> " << asset.output << ": ";
+        for (uint32_t l = 0; l < asset.lods.levelCount; ++l) {
+            const LodLevel& level = asset.lods.levels[l];
+            std::cerr << (l == 0 ? "" : ", ") << level.vertexCount / 3;
+            if (l > 0) std::cerr << " (error " << level.error << ")";
+        }
+        std::cerr << " triangles in " << asset.ms << " ms" << std::endl;
+    }
+    std::cerr << assets.size() - failed << " meshes, " << triangles
+              << " triangles in " << totalMs << " ms ("
+              << triangles / std::max(totalMs, 1e-3) / 1000.0
+              << " M triangles/s, " << workerCount + 1 << " threads)"
+              << std::endl;
+    if (samplingProfiler().running()) {
+        samplingProfiler().stopAndWrite(sampleProfilePath);
+    }
+    return failed == 0 ? 0 : 1;
+}
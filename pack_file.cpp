@@ -0,0 +1,315 @@
+#include "pack_file.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+#include "content_hash.h"
+#include "job_system.h"
+
+namespace {
+
+// Packs may pass 2 GB, beyond what fseek() takes on every platform
+bool seek(FILE* file, uint64_t offset, int origin) {
+#if defined(_WIN32)
+    return _fseeki64(file, static_cast<__int64>(offset), origin) == 0;
+#else
+    return fseeko(file, static_cast<off_t>(offset), origin) == 0;
+#endif
+}
+
+uint64_t tell(FILE* file) {
+#if defined(_WIN32)
+    return static_cast<uint64_t>(_ftelli64(file));
+#else
+    return static_cast<uint64_t>(ftello(file));
+#endif
+}
+
+double msSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+} // namespace
+
+// -----------------------------------------------------------------------------
+void PackWriter::add(const std::string& name, std::vector<uint8_t> data) {
+    assets_.push_back({ name, std::move(data) });
+}
+
+bool PackWriter::write(const std::string& path, PackCodec codec,
+                       uint32_t blockSize, PackWriteStats* stats) const {
+    blockSize = std::max(blockSize, 4096u);
+    struct Pending {
+        uint32_t asset;
+        uint64_t rawOffset;
+        uint32_t rawSize;
+        PackCodec codec;
+        std::vector<uint8_t> compressed;
+    };
+
+    std::vector<PackAssetEntry> entries(assets_.size());
+    std::vector<Pending> pending;
+    std::string names;
+    for (uint32_t a = 0; a < assets_.size(); ++a) {
+        const Asset& asset = assets_[a];
+        PackAssetEntry& entry = entries[a];
+        entry.rawSize = asset.data.size();
+        entry.firstBlock = static_cast<uint32_t>(pending.size());
+        entry.nameOffset = static_cast<uint32_t>(names.size());
+        entry.nameLength = static_cast<uint32_t>(asset.name.size());
+        names += asset.name;
+        for (uint64_t at = 0; at < asset.data.size(); at += blockSize) {
+            uint32_t size = static_cast<uint32_t>(
+                std::min<uint64_t>(blockSize, asset.data.size() - at));
+            pending.push_back({ a, at, size, codec, {} });
+        }
+        entry.blockCount =
+            static_cast<uint32_t>(pending.size()) - entry.firstBlock;
+    }
+
+    // Blocks and hashes across the job system
+    auto start = std::chrono::steady_clock::now();
+    jobSystem().parallelFor(
+        static_cast<uint32_t>(pending.size()), 1,
+        [&](uint32_t begin, uint32_t end) {
+            for (uint32_t b = begin; b < end; ++b) {
+                Pending& block = pending[b];
+                if (block.codec == PackCodec::kStore) continue;
+                const uint8_t* raw =
+                    assets_[block.asset].data.data() + block.rawOffset;
+                block.compressed.resize(lzBound(block.rawSize));
+                size_t size = lzCompress(
+                    raw, block.rawSize, block.compressed.data(),
+                    block.compressed.size(),
+                    block.codec == PackCodec::kLzHigh ? LzLevel::kHigh
+                                                      : LzLevel::kFast);
+                if (size == 0 || size >= block.rawSize) {
+                    block.codec = PackCodec::kStore;
+                    block.compressed.clear();
+                } else {
+                    block.compressed.resize(size);
+                }
+            }
+        });
+    jobSystem().parallelFor(
+        static_cast<uint32_t>(assets_.size()), 1,
+        [&](uint32_t begin, uint32_t end) {
+            for (uint32_t a = begin; a < end; ++a) {
+                entries[a].hash = contentHash(assets_[a].data.data(),
+                                              assets_[a].data.size());
+            }
+        });
+    double compressMs = msSince(start);
+
+    FILE* file = fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        std::cerr << "Failed to open " << path << std::endl;
+        return false;
+    }
+
+    PackHeader header = { kPackMagic, kPackVersion, blockSize, 0 };
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    std::vector<PackBlock> blocks(pending.size());
+    uint64_t offset = sizeof(header);
+    uint32_t stored = 0;
+    for (size_t b = 0; ok && b < pending.size(); ++b) {
+        const Pending& p = pending[b];
+        const uint8_t* data = p.codec == PackCodec::kStore
+            ? assets_[p.asset].data.data() + p.rawOffset
+            : p.compressed.data();
+        uint32_t size = p.codec == PackCodec::kStore
+            ? p.rawSize : static_cast<uint32_t>(p.compressed.size());
+        PackBlock& block = blocks[b];
+        memset(&block, 0, sizeof(block));
+        block.offset = offset;
+        block.compressedSize = size;
+        block.rawSize = p.rawSize;
+        block.codec = static_cast<uint8_t>(p.codec);
+        stored += p.codec == PackCodec::kStore ? 1 : 0;
+        ok = fwrite(data, 1, size, file) == size;
+        offset += size;
+    }
+
+    PackFooter footer = { offset, static_cast<uint32_t>(entries.size()),
+                          static_cast<uint32_t>(blocks.size()),
+                          static_cast<uint32_t>(names.size()), kPackMagic };
+    ok = ok &&
+         fwrite(entries.data(), sizeof(PackAssetEntry), entries.size(),
+                file) == entries.size() &&
+         fwrite(blocks.data(), sizeof(PackBlock), blocks.size(), file) ==
+             blocks.size() &&
+         fwrite(names.data(), 1, names.size(), file) == names.size() &&
+         fwrite(&footer, sizeof(footer), 1, file) == 1;
+    uint64_t packBytes = tell(file);
+    ok = fclose(file) == 0 && ok;
+    if (!ok) {
+        std::cerr << "Failed to write " << path << std::endl;
+        return false;
+    }
+
+    if (stats != nullptr) {
+        stats->rawBytes = 0;
+        for (const Asset& asset : assets_) stats->rawBytes += asset.data.size();
+        stats->packBytes = packBytes;
+        stats->blocks = static_cast<uint32_t>(blocks.size());
+        stats->storedBlocks = stored;
+        stats->compressMs = compressMs;
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+PackReader::~PackReader() {
+    close();
+}
+
+bool PackReader::open(const std::string& path) {
+    close();
+    file_ = fopen(path.c_str(), "rb");
+    if (file_ == nullptr) {
+        std::cerr << "Failed to open " << path << std::endl;
+        return false;
+    }
+
+    PackHeader header;
+    PackFooter footer;
+    bool ok = fread(&header, sizeof(header), 1, file_) == 1 &&
+              header.magic == kPackMagic && header.version == kPackVersion &&
+              header.blockSize > 0 && seek(file_, 0, SEEK_END);
+    uint64_t fileSize = ok ? tell(file_) : 0;
+    ok = ok && fileSize >= sizeof(header) + sizeof(footer) &&
+         seek(file_, fileSize - sizeof(footer), SEEK_SET) &&
+         fread(&footer, sizeof(footer), 1, file_) == 1 &&
+         footer.magic == kPackMagic;
+    uint64_t indexBytes = ok
+        ? uint64_t(footer.assetCount) * sizeof(PackAssetEntry) +
+              uint64_t(footer.blockCount) * sizeof(PackBlock) +
+              footer.nameBytes
+        : 0;
+    ok = ok && footer.indexOffset >= sizeof(header) &&
+         footer.indexOffset + indexBytes + sizeof(footer) == fileSize;
+    if (ok) {
+        blockSize_ = header.blockSize;
+        assets_.resize(footer.assetCount);
+        blocks_.resize(footer.blockCount);
+        names_.resize(footer.nameBytes);
+        ok = seek(file_, footer.indexOffset, SEEK_SET) &&
+             fread(assets_.data(), sizeof(PackAssetEntry), assets_.size(),
+                   file_) == assets_.size() &&
+             fread(blocks_.data(), sizeof(PackBlock), blocks_.size(),
+                   file_) == blocks_.size() &&
+             fread(names_.data(), 1, names_.size(), file_) == names_.size();
+    }
+
+    // Blocks lie within the data, and each asset's blocks are back to back
+    // and full up to its last, so load() can read them as one range
+    for (const PackBlock& block : blocks_) {
+        if (!ok) break;
+        ok = block.codec <= static_cast<uint8_t>(PackCodec::kLzHigh) &&
+             block.rawSize <= blockSize_ &&
+             block.offset + block.compressedSize <= footer.indexOffset &&
+             (block.codec != static_cast<uint8_t>(PackCodec::kStore) ||
+              block.compressedSize == block.rawSize);
+    }
+    for (const PackAssetEntry& entry : assets_) {
+        if (!ok) break;
+        ok = entry.nameOffset <= names_.size() &&
+             entry.nameLength <= names_.size() - entry.nameOffset &&
+             entry.firstBlock <= blocks_.size() &&
+             entry.blockCount <= blocks_.size() - entry.firstBlock;
+        uint64_t raw = 0;
+        for (uint32_t b = 0; ok && b < entry.blockCount; ++b) {
+            const PackBlock& block = blocks_[entry.firstBlock + b];
+            ok = (b + 1 == entry.blockCount || block.rawSize == blockSize_) &&
+                 (b == 0 || block.offset ==
+                      blocks_[entry.firstBlock + b - 1].offset +
+                      blocks_[entry.firstBlock + b - 1].compressedSize);
+            raw += block.rawSize;
+        }
+        ok = ok && raw == entry.rawSize;
+    }
+
+    if (!ok) {
+        std::cerr << "Invalid pack " << path << std::endl;
+        close();
+    }
+    return ok;
+}
+
+void PackReader::close() {
+    if (file_ != nullptr) fclose(file_);
+    file_ = nullptr;
+    assets_.clear();
+    blocks_.clear();
+    names_.clear();
+}
+
+std::string PackReader::name(uint32_t index) const {
+    const PackAssetEntry& entry = assets_[index];
+    return names_.substr(entry.nameOffset, entry.nameLength);
+}
+
+int PackReader::find(const std::string& name) const {
+    for (uint32_t a = 0; a < assets_.size(); ++a) {
+        const PackAssetEntry& entry = assets_[a];
+        if (entry.nameLength == name.size() &&
+            names_.compare(entry.nameOffset, entry.nameLength, name) == 0) {
+            return static_cast<int>(a);
+        }
+    }
+    return -1;
+}
+
+bool PackReader::load(uint32_t index, uint8_t* destination,
+                      PackLoadStats* stats) {
+    const PackAssetEntry& entry = assets_[index];
+    if (entry.blockCount == 0) return true;
+
+    auto start = std::chrono::steady_clock::now();
+    const PackBlock& first = blocks_[entry.firstBlock];
+    const PackBlock& last = blocks_[entry.firstBlock + entry.blockCount - 1];
+    uint64_t bytes = last.offset + last.compressedSize - first.offset;
+    scratch_.resize(bytes);
+    if (!seek(file_, first.offset, SEEK_SET) ||
+        fread(scratch_.data(), 1, bytes, file_) != bytes) {
+        std::cerr << "Failed to read pack" << std::endl;
+        return false;
+    }
+    double readMs = msSince(start);
+
+    start = std::chrono::steady_clock::now();
+    std::vector<uint8_t> failed(entry.blockCount, 0);
+    jobSystem().parallelFor(
+        entry.blockCount, 1, [&](uint32_t begin, uint32_t end) {
+            for (uint32_t b = begin; b < end; ++b) {
+                const PackBlock& block = blocks_[entry.firstBlock + b];
+                failed[b] = !decodeBlock(
+                    block, scratch_.data() + (block.offset - first.offset),
+                    destination + uint64_t(b) * blockSize_);
+            }
+        });
+    bool ok = std::find(failed.begin(), failed.end(), 1) == failed.end();
+    if (!ok) std::cerr << "Corrupt block in pack" << std::endl;
+
+    if (stats != nullptr) {
+        stats->compressedBytes += bytes;
+        stats->rawBytes += entry.rawSize;
+        stats->readMs += readMs;
+        stats->decompressMs += msSince(start);
+    }
+    return ok;
+}
+
+bool PackReader::decodeBlock(const PackBlock& block, const uint8_t* data,
+                             uint8_t* destination) {
+    if (block.codec == static_cast<uint8_t>(PackCodec::kStore)) {
+        if (block.compressedSize != block.rawSize) return false;
+        memcpy(destination, data, block.rawSize);
+        return true;
+    }
+    return lzDecompress(data, block.compressedSize, destination,
+                        block.rawSize);
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "lz_codec.h"
+
+// -----------------------------------------------------------------------------
+// Asset packs: many cooked assets in one file, each split into blocks that
+// are compressed independently, so a loader can decompress an asset's
+// blocks in parallel, straight into the memory they are uploaded from.
+// Blocks never span assets, so one asset loads without touching another.
+//
+// Layout, little-endian:
+//   PackHeader
+//   block data                  each asset's blocks back to back
+//   PackAssetEntry[assetCount]
+//   PackBlock[blockCount]
+//   names                       not terminated; entries hold offsets
+//   PackFooter                  last in the file, locates the index
+//
+// Writing compresses every block across the job system; a block that does
+// not shrink is stored as it is.
+constexpr uint32_t kPackMagic = 0x314B4150;       // "PAK1"
+constexpr uint32_t kPackVersion = 1;
+constexpr uint32_t kDefaultPackBlockSize = 256 << 10;
+
+enum class PackCodec : uint8_t {
+    kStore,
+    kLzFast,
+    kLzHigh,
+};
+
+struct PackHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t blockSize;          // raw; an asset's last block may be less
+    uint32_t reserved;
+};
+
+struct PackAssetEntry {
+    uint64_t rawSize;
+    uint64_t hash;               // contentHash() of the raw bytes
+    uint32_t firstBlock;
+    uint32_t blockCount;
+    uint32_t nameOffset;
+    uint32_t nameLength;
+};
+
+struct PackBlock {
+    uint64_t offset;             // in the file
+    uint32_t compressedSize;
+    uint32_t rawSize;
+    uint8_t codec;               // PackCodec
+    uint8_t reserved[7];
+};
+
+struct PackFooter {
+    uint64_t indexOffset;
+    uint32_t assetCount;
+    uint32_t blockCount;
+    uint32_t nameBytes;
+    uint32_t magic;
+};
+
+static_assert(sizeof(PackAssetEntry) == 32, "no padding on disk");
+static_assert(sizeof(PackBlock) == 24, "no padding on disk");
+static_assert(sizeof(PackFooter) == 24, "no padding on disk");
+
+struct PackWriteStats {
+    uint64_t rawBytes = 0;
+    uint64_t packBytes = 0;
+    uint32_t blocks = 0;
+    uint32_t storedBlocks = 0;   // did not shrink
+    double compressMs = 0.0;
+};
+
+class PackWriter {
+ public:
+    void add(const std::string& name, std::vector<uint8_t> data);
+
+    bool write(const std::string& path, PackCodec codec,
+               uint32_t blockSize = kDefaultPackBlockSize,
+               PackWriteStats* stats = nullptr) const;
+
+ private:
+    struct Asset {
+        std::string name;
+        std::vector<uint8_t> data;
+    };
+
+    std::vector<Asset> assets_;
+};
+
+struct PackLoadStats {
+    uint64_t compressedBytes = 0;
+    uint64_t rawBytes = 0;
+    double readMs = 0.0;
+    double decompressMs = 0.0;
+};
+
+class PackReader {
+ public:
+    PackReader() = default;
+    ~PackReader();
+    PackReader(const PackReader&) = delete;
+    PackReader& operator=(const PackReader&) = delete;
+
+    // Reads the footer and index; blocks are read by load()
+    bool open(const std::string& path);
+    void close();
+
+    uint32_t assetCount() const {
+        return static_cast<uint32_t>(assets_.size());
+    }
+    const PackAssetEntry& asset(uint32_t index) const {
+        return assets_[index];
+    }
+    const PackBlock& block(uint32_t index) const { return blocks_[index]; }
+    uint32_t blockSize() const { return blockSize_; }
+    std::string name(uint32_t index) const;
+
+    // Index of the asset with this name, or -1
+    int find(const std::string& name) const;
+
+    // Reads the asset's blocks with one read and decompresses them in
+    // parallel on the job system into `destination`, which must hold
+    // asset(index).rawSize bytes
+    bool load(uint32_t index, uint8_t* destination,
+              PackLoadStats* stats = nullptr);
+
+    // Decodes one block, read separately, into `destination`, which must
+    // hold block.rawSize bytes
+    static bool decodeBlock(const PackBlock& block, const uint8_t* data,
+                            uint8_t* destination);
+
+ private:
+    FILE* file_ = nullptr;
+    uint32_t blockSize_ = 0;
+    std::vector<PackAssetEntry> assets_;
+    std::vector<PackBlock> blocks_;
+    std::string names_;
+    std::vector<uint8_t> scratch_;
+};
@@ -0,0 +1,407 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "content_hash.h"
+#include "cook_cache.h"
+#include "hw_counters.h"
+#include "job_system.h"
+#include "pack_file.h"
+#include "sampling_profiler.h"
+
+#if defined(__linux__)
+#include "stream_io.h"
+#endif
+
+// -----------------------------------------------------------------------------
+// Builds, lists and benchmarks asset packs. Directories are packed
+// recursively, with names relative to the directory.
+//
+//   PackTool [--codec store|fast|high] [--block-kb n] <pack> <inputs>...
+//   PackTool --list <pack>
+//   PackTool [--hw-counters] --bench <inputs>...
+//
+// --bench packs the inputs with every codec and prints the pack size, the
+// compression rate, the time to load every asset from a cold file, and
+// decompression GB/s across the job system. On Linux the blocks are also
+// streamed through StreamPipeline, which decompresses each block as its
+// read completes. --hw-counters adds IPC and cache, branch and dTLB miss
+// rates over every thread for the cold load and the decompression, and
+// writes their counts as lines of JSON to stdout.
+// --sample-profile samples every thread's stacks (SIGPROF, --sample-hz,
+// default 997) into <prefix>.folded and a <prefix>.svg flamegraph.
+namespace fs = std::filesystem;
+
+namespace {
+
+struct Input {
+    std::string name;
+    std::string path;
+};
+
+std::vector<Input> findInputs(const std::vector<std::string>& paths) {
+    std::vector<Input> inputs;
+    for (const std::string& path : paths) {
+        std::error_code error;
+        if (!fs::is_directory(path, error)) {
+            inputs.push_back({ fs::path(path).filename().string(), path });
+            continue;
+        }
+        for (const fs::directory_entry& entry :
+             fs::recursive_directory_iterator(path, error)) {
+            if (!entry.is_regular_file()) continue;
+            inputs.push_back(
+                { fs::relative(entry.path(), path).generic_string(),
+                  entry.path().string() });
+        }
+    }
+    std::sort(inputs.begin(), inputs.end(),
+              [](const Input& a, const Input& b) { return a.name < b.name; });
+    return inputs;
+}
+
+const char* codecName(PackCodec codec) {
+    switch (codec) {
+    case PackCodec::kStore: return "store";
+    case PackCodec::kLzFast: return "fast";
+    case PackCodec::kLzHigh: return "high";
+    }
+    return "?";
+}
+
+bool parseCodec(const char* name, PackCodec& codec) {
+    for (PackCodec c : { PackCodec::kStore, PackCodec::kLzFast,
+                         PackCodec::kLzHigh }) {
+        if (strcmp(name, codecName(c)) == 0) {
+            codec = c;
+            return true;
+        }
+    }
+    return false;
+}
+
+double msSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+// So a load reads the device rather than memory
+void dropFromPageCache(const std::string& path) {
+#if defined(__linux__)
+    int file = open(path.c_str(), O_RDONLY);
+    if (file < 0) return;
+    fdatasync(file);        // dirty pages would stay cached
+    posix_fadvise(file, 0, 0, POSIX_FADV_DONTNEED);
+    close(file);
+#else
+    (void)path;
+#endif
+}
+
+int list(const std::string& path) {
+    PackReader reader;
+    if (!reader.open(path)) return 1;
+    for (uint32_t a = 0; a < reader.assetCount(); ++a) {
+        const PackAssetEntry& entry = reader.asset(a);
+        uint64_t compressed = 0;
+        for (uint32_t b = 0; b < entry.blockCount; ++b) {
+            compressed += reader.block(entry.firstBlock + b).compressedSize;
+        }
+        std::cerr << reader.name(a) << ": " << entry.rawSize << " -> "
+                  << compressed << " bytes in " << entry.blockCount
+                  << " blocks" << std::endl;
+    }
+    return 0;
+}
+
+#if defined(__linux__)
+// Every block as its own read; the processing stage decompresses it into
+// the asset's place in `staging`
+bool streamPack(const std::string& path, const PackReader& reader,
+                const std::vector<uint64_t>& assetOffsets, uint8_t* staging,
+                StreamStats& stats) {
+    std::vector<StreamRead> reads;
+    std::vector<uint64_t> rawOffsets;
+    uint32_t largest = 0;
+    for (uint32_t a = 0; a < reader.assetCount(); ++a) {
+        const PackAssetEntry& entry = reader.asset(a);
+        for (uint32_t b = 0; b < entry.blockCount; ++b) {
+            const PackBlock& block = reader.block(entry.firstBlock + b);
+            reads.push_back({ -1, block.offset, block.compressedSize,
+                              entry.firstBlock + b });
+            rawOffsets.push_back(assetOffsets[a] +
+                                 uint64_t(b) * reader.blockSize());
+            largest = std::max(largest, block.compressedSize);
+        }
+    }
+
+    std::unique_ptr<ReadBackend> backend = createUringBackend();
+    if (backend == nullptr) backend = createThreadPoolBackend();
+    const uint32_t depth = 16;
+    StreamBuffers buffers;
+    bool direct = false;
+    int file = openStreamFile(path, direct);
+    if (file < 0 || !buffers.init(depth * 2, largest) ||
+        !backend->init(buffers, depth)) {
+        closeStreamFile(file);
+        return false;
+    }
+    for (size_t r = 0; r < reads.size(); ++r) {
+        reads[r].file = file;
+        reads[r].tag = reads[r].tag << 32 | r;
+    }
+
+    StreamPipeline pipeline(*backend, buffers, depth);
+    stats = pipeline.run(
+        reads,
+        [&](const StreamRead& read, const uint8_t* data, uint32_t size) {
+            const PackBlock& block =
+                reader.block(static_cast<uint32_t>(read.tag >> 32));
+            return size == block.compressedSize &&
+                   PackReader::decodeBlock(
+                       block, data,
+                       staging + rawOffsets[read.tag & 0xFFFFFFFF]);
+        },
+        [](const StreamRead&, bool) {});
+    closeStreamFile(file);
+    return stats.failed == 0;
+}
+#endif
+
+int bench(const std::vector<Input>& inputs, uint32_t blockSize,
+          bool hwCounters) {
+    if (hwCounters && !hw_counters::available()) {
+        std::cerr << "Hardware counters unavailable" << std::endl;
+    }
+    PackWriter writer;
+    std::vector<uint64_t> hashes;
+    uint64_t rawBytes = 0;
+    for (const Input& input : inputs) {
+        std::vector<uint8_t> bytes;
+        if (!readFileBytes(input.path, bytes)) return 1;
+        rawBytes += bytes.size();
+        hashes.push_back(contentHash(bytes.data(), bytes.size()));
+        writer.add(input.name, std::move(bytes));
+    }
+    std::cerr << "Packing " << inputs.size() << " assets, "
+              << rawBytes / 1048576.0 << " MB, " << blockSize / 1024
+              << " KB blocks, " << jobSystem().workerCount() + 1
+              << " threads" << std::endl;
+
+    // Staging for every asset at once, as an upload ring would hold them
+    std::vector<uint8_t> staging(rawBytes);
+    bool ok = true;
+    for (PackCodec codec : { PackCodec::kStore, PackCodec::kLzFast,
+                             PackCodec::kLzHigh }) {
+        std::string path = std::string("pack_bench_") + codecName(codec) +
+                           ".pack";
+        PackWriteStats written;
+        if (!writer.write(path, codec, blockSize, &written)) return 1;
+
+        // Cold load of every asset, each decompressed across the job system
+        dropFromPageCache(path);
+        PackReader reader;
+        if (!reader.open(path)) return 1;
+        std::vector<uint64_t> assetOffsets(reader.assetCount());
+        PackLoadStats loaded;
+        HwCounterSpan loadCounters(hwCounters);
+        auto start = std::chrono::steady_clock::now();
+        uint64_t at = 0;
+        for (uint32_t a = 0; a < reader.assetCount(); ++a) {
+            assetOffsets[a] = at;
+            ok = reader.load(a, staging.data() + at, &loaded) && ok;
+            at += reader.asset(a).rawSize;
+        }
+        double loadMs = msSince(start);
+        std::string loadCounted = loadCounters.summary();
+        for (uint32_t a = 0; a < reader.assetCount(); ++a) {
+            ok = ok && contentHash(staging.data() + assetOffsets[a],
+                                   reader.asset(a).rawSize) == hashes[a];
+        }
+
+        // Decompression alone: every block of the pack from memory
+        std::vector<uint8_t> packed;
+        ok = readFileBytes(path, packed) && ok;
+        std::vector<uint32_t> blockAsset;
+        std::vector<uint64_t> blockRaw;
+        for (uint32_t a = 0; a < reader.assetCount(); ++a) {
+            for (uint32_t b = 0; b < reader.asset(a).blockCount; ++b) {
+                blockAsset.push_back(a);
+                blockRaw.push_back(assetOffsets[a] +
+                                   uint64_t(b) * reader.blockSize());
+            }
+        }
+        HwCounterSpan decodeCounters(hwCounters);
+        start = std::chrono::steady_clock::now();
+        jobSystem().parallelFor(
+            static_cast<uint32_t>(blockRaw.size()), 1,
+            [&](uint32_t begin, uint32_t end) {
+                for (uint32_t b = begin; b < end; ++b) {
+                    const PackBlock& block = reader.block(b);
+                    PackReader::decodeBlock(block,
+                                            packed.data() + block.offset,
+                                            staging.data() + blockRaw[b]);
+                }
+            });
+        double decodeMs = msSince(start);
+        std::string decodeCounted = decodeCounters.summary();
+
+        char line[256];
+        snprintf(line, sizeof(line),
+                 "  %-5s %8.2f MB (%5.1f%%), compress %7.1f MB/s, "
+                 "cold load %7.1f ms (read %6.1f ms), decompress %6.2f GB/s",
+                 codecName(codec), written.packBytes / 1048576.0,
+                 100.0 * written.packBytes / std::max<uint64_t>(rawBytes, 1),
+                 rawBytes / std::max(written.compressMs, 1e-3) / 1000.0,
+                 loadMs, loaded.readMs,
+                 rawBytes / std::max(decodeMs, 1e-3) / 1e6);
+        std::cerr << line << std::endl;
+        if (!loadCounted.empty()) {
+            std::cerr << "        cold load: " << loadCounted << "\n"
+                      << "        decompress: " << decodeCounted
+                      << std::endl;
+            std::string name = codecName(codec);
+            std::cout << loadCounters.json((name + " cold load").c_str())
+                      << "\n"
+                      << decodeCounters.json((name + " decompress").c_str())
+                      << std::endl;
+        }
+
+#if defined(__linux__)
+        dropFromPageCache(path);
+        StreamStats streamed;
+        start = std::chrono::steady_clock::now();
+        bool streamOk = streamPack(path, reader, assetOffsets,
+                                   staging.data(), streamed);
+        double streamMs = msSince(start);
+        for (uint32_t a = 0; streamOk && a < reader.assetCount(); ++a) {
+            streamOk = contentHash(staging.data() + assetOffsets[a],
+                                   reader.asset(a).rawSize) == hashes[a];
+        }
+        snprintf(line, sizeof(line),
+                 "        streamed cold in %7.1f ms, %.2f GB/s raw, "
+                 "read latency p50 %.3f ms%s",
+                 streamMs, rawBytes / std::max(streamMs, 1e-3) / 1e6,
+                 streamed.latencyP50Ms, streamOk ? "" : ", FAILED");
+        std::cerr << line << std::endl;
+        ok = ok && streamOk;
+#endif
+        reader.close();
+        std::error_code error;
+        fs::remove(path, error);
+    }
+    if (!ok) std::cerr << "Loaded assets did not match" << std::endl;
+    return ok ? 0 : 1;
+}
+
+} // namespace
+
+// -----------------------------------------------------------------------------
+int main(int argc, char* argv[]) {
+    PackCodec codec = PackCodec::kLzHigh;
+    uint32_t blockSize = kDefaultPackBlockSize;
+    int workerCount = -1;
+    bool listPack = false;
+    bool benchPack = false;
+    bool hwCounters = false;
+    const char* sampleProfilePath = nullptr;
+    int sampleHz = 997;
+    std::vector<std::string> paths;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--codec") == 0 && i + 1 < argc) {
+            if (!parseCodec(argv[++i], codec)) {
+                std::cerr << "Unknown codec " << argv[i] << std::endl;
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--block-kb") == 0 && i + 1 < argc) {
+            blockSize = static_cast<uint32_t>(atoi(argv[++i])) * 1024;
+        } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            workerCount = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--list") == 0) {
+            listPack = true;
+        } else if (strcmp(argv[i], "--bench") == 0) {
+            benchPack = true;
+        } else if (strcmp(argv[i], "--hw-counters") == 0) {
+            hwCounters = true;
+        } else if (strcmp(argv[i], "--sample-profile") == 0 && i + 1 < argc) {
+            sampleProfilePath = argv[++i];
+        } else if (strcmp(argv[i], "--sample-hz") == 0 && i + 1 < argc) {
+            sampleHz = atoi(argv[++i]);
+        } else {
+            paths.push_back(argv[i]);
+        }
+    }
+
+    if (listPack && paths.size() == 1) return list(paths[0]);
+    if (paths.size() < (benchPack ? 1u : 2u) || listPack) {
+        std::cerr << "Usage: PackTool [--codec store|fast|high] "
+                     "[--block-kb n] [--workers n]\n"
+                     "                [--sample-profile prefix] "
+                     "[--sample-hz n] <pack> <inputs>...\n"
+                     "       PackTool --list <pack>\n"
+                     "       PackTool [options] [--hw-counters] "
+                     "--bench <inputs>..."
+                  << std::endl;
+        return 1;
+    }
+
+    if (workerCount < 0) {
+        workerCount = std::max(
+            0, static_cast<int>(std::thread::hardware_concurrency()) - 1);
+    }
+    // Workers open their counters as they start
+    if (hwCounters) hw_counters::countNewThreads();
+    jobSystem().start(workerCount);
+
+    samplingProfiler().registerCurrentThread("main");
+    if (sampleProfilePath != nullptr && !samplingProfiler().start(sampleHz)) {
+        std::cerr << "Failed to start sampling profiler" << std::endl;
+    }
+
+    int result = 0;
+    if (benchPack) {
+        result = bench(findInputs(paths), blockSize, hwCounters);
+    } else {
+        PackWriter writer;
+        std::vector<Input> inputs =
+            findInputs(std::vector<std::string>(paths.begin() + 1,
+                                                paths.end()));
+        for (const Input& input : inputs) {
+            std::vector<uint8_t> bytes;
+            if (!readFileBytes(input.path, bytes)) {
+                result = 1;
+                continue;
+            }
+            writer.add(input.name, std::move(bytes));
+        }
+        PackWriteStats stats;
+        if (result == 0 && writer.write(paths[0], codec, blockSize, &stats)) {
+            std::cerr << paths[0] << ": " << inputs.size() << " assets, "
+                      << stats.rawBytes << " -> " << stats.packBytes
+                      << " bytes in " << stats.blocks << " blocks ("
+                      << stats.storedBlocks << " stored) in "
+                      << stats.compressMs << " ms" << std::endl;
+        } else {
+            result = 1;
+        }
+    }
+    jobSystem().stop();
+    if (samplingProfiler().running()) {
+        samplingProfiler().stopAndWrite(sampleProfilePath);
+    }
+    return result;
+}
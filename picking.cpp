@@ -0,0 +1,131 @@
+#include "picking.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "job_system.h"
+
+namespace {
+
+// Packets of four rays per parallelFor batch
+constexpr uint32_t kPacketsPerBatch = 16;
+
+// Moller-Trumbore. Returns the distance along the ray, or maxT on a miss.
+float intersectTriangle(const Float3& origin, const Float3& direction,
+                        const Float3& a, const Float3& b, const Float3& c,
+                        float maxT, float& u, float& v) {
+    Float3 e1 = b - a;
+    Float3 e2 = c - a;
+    Float3 p = cross(direction, e2);
+    float det = dot(e1, p);
+    if (std::fabs(det) < 1e-12f) return maxT;
+
+    float inv = 1.0f / det;
+    Float3 s = origin - a;
+    float bu = dot(s, p) * inv;
+    if (bu < 0.0f || bu > 1.0f) return maxT;
+    Float3 q = cross(s, e1);
+    float bv = dot(direction, q) * inv;
+    if (bv < 0.0f || bu + bv > 1.0f) return maxT;
+
+    float t = dot(e2, q) * inv;
+    if (t < 0.0f || t >= maxT) return maxT;
+    u = bu;
+    v = bv;
+    return t;
+}
+
+// Nearest triangle of `instance` closer than maxT, recorded in `hit`
+float hitInstance(const PickScene& scene, uint32_t instance,
+                  const Float3& origin, const Float3& direction, float maxT,
+                  RayHit& hit) {
+    const Matrix4& world = scene.worlds[instance];
+    const std::vector<Float3>& corners =
+        scene.meshes[scene.meshOf[instance]].corners;
+    for (size_t i = 0; i + 2 < corners.size(); i += 3) {
+        float u;
+        float v;
+        float t = intersectTriangle(origin, direction,
+                                    transformPoint(corners[i], world),
+                                    transformPoint(corners[i + 1], world),
+                                    transformPoint(corners[i + 2], world),
+                                    maxT, u, v);
+        if (t < maxT) {
+            maxT = t;
+            hit.triangle = static_cast<uint32_t>(i / 3);
+            hit.u = u;
+            hit.v = v;
+        }
+    }
+    return maxT;
+}
+
+} // namespace
+
+// -----------------------------------------------------------------------------
+RayHit castRay(const PickScene& scene, const Ray& ray) {
+    RayHit hit;
+    float t;
+    hit.instance = scene.bvh->raycast(
+        ray.origin, ray.direction, ray.maxT, t,
+        [&](uint32_t instance, float maxT) {
+            return hitInstance(scene, instance, ray.origin, ray.direction,
+                               maxT, hit);
+        });
+    hit.t = t;
+    return hit;
+}
+
+void castRays(const PickScene& scene, const Ray* rays, uint32_t count,
+              RayHit* hits) {
+    uint32_t packets = (count + 3) / 4;
+    jobSystem().parallelFor(
+        packets, kPacketsPerBatch, [&](uint32_t begin, uint32_t end) {
+            for (uint32_t p = begin; p < end; ++p) {
+                // A short last packet repeats its final ray
+                uint32_t index[4];
+                Float3 origin[4];
+                Float3 direction[4];
+                float t[4];
+                for (uint32_t r = 0; r < 4; ++r) {
+                    index[r] = std::min(p * 4 + r, count - 1);
+                    origin[r] = rays[index[r]].origin;
+                    direction[r] = rays[index[r]].direction;
+                    t[r] = rays[index[r]].maxT;
+                }
+
+                RayHit packet[4];
+                uint32_t closest[4];
+                scene.bvh->raycast4(
+                    origin, direction, t, closest,
+                    [&](uint32_t r, uint32_t instance, float maxT) {
+                        return hitInstance(scene, instance, origin[r],
+                                           direction[r], maxT, packet[r]);
+                    });
+
+                for (uint32_t r = 0; r < 4 && p * 4 + r < count; ++r) {
+                    packet[r].instance = closest[r];
+                    packet[r].t = t[r];
+                    hits[index[r]] = packet[r];
+                }
+            }
+        });
+}
+
+Ray screenRay(const Matrix4& viewProjection, float x, float y, float width,
+              float height) {
+    Matrix4 inv = inverse(viewProjection);
+    float nx = 2.0f * x / width - 1.0f;
+    float ny = 1.0f - 2.0f * y / height;
+
+    // Unproject the pixel on both clip planes
+    auto unproject = [&inv, nx, ny](float z) {
+        Float3 p = transformPoint({ nx, ny, z }, inv);
+        float w = nx * inv.m[0][3] + ny * inv.m[1][3] + z * inv.m[2][3] +
+                  inv.m[3][3];
+        return p * (1.0f / w);
+    };
+    Float3 nearPoint = unproject(0.0f);
+    Float3 farPoint = unproject(1.0f);
+    return { nearPoint, farPoint - nearPoint, 1.0f };
+}
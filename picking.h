@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "bvh.h"
+#include "math_types.h"
+
+// -----------------------------------------------------------------------------
+// Ray casts against instanced triangle meshes. The BVH over instance world
+// bounds yields candidate instances; their triangles are moved to world
+// space and tested exactly. castRays() takes a stream of rays four at a time
+// through Bvh::raycast4(), with the packets spread across the job system,
+// so rays cast in screen order share most of their node visits.
+//
+// The scene arrays are read while rays are cast and must not change then.
+struct Ray {
+    Float3 origin;
+    Float3 direction;
+    float maxT;
+};
+
+struct RayHit {
+    static constexpr uint32_t kNone = ~0u;
+
+    uint32_t instance = kNone;
+    uint32_t triangle = 0;
+    float t = 0.0f;
+    float u = 0.0f;              // barycentrics of the hit point
+    float v = 0.0f;
+};
+
+// Object-space triangles, three corners each
+struct PickMesh {
+    std::vector<Float3> corners;
+};
+
+struct PickScene {
+    const Bvh* bvh = nullptr;
+    const Matrix4* worlds = nullptr;     // by instance
+    const uint32_t* meshOf = nullptr;    // by instance
+    const PickMesh* meshes = nullptr;
+};
+
+RayHit castRay(const PickScene& scene, const Ray& ray);
+void castRays(const PickScene& scene, const Ray* rays, uint32_t count,
+              RayHit* hits);
+
+// Ray through pixel (x, y) of a width by height view, from the near plane
+// at t = 0 to the far plane at t = 1
+Ray screenRay(const Matrix4& viewProjection, float x, float y, float width,
+              float height);
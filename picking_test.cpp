@@ -0,0 +1,253 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "bvh.h"
+#include "job_system.h"
+#include "picking.h"
+#include "test_check.h"
+
+// -----------------------------------------------------------------------------
+// Tests for picking: screenRay() unprojection, hit distance and barycentrics
+// on a single triangle, and castRay() and castRays() against every triangle
+// of a scene laid out as the renderer's --instances, including a stream
+// whose length is not a multiple of four. With --bench it builds that many
+// instances and casts 4096 rays through random pixels and through a 64x64
+// tile, one at a time and as packets, and prints millions of rays per
+// second for each.
+//
+//   PickingTest [--bench <instances>]
+namespace {
+
+bool near(float a, float b) { return std::fabs(a - b) < 1e-4f; }
+
+// The renderer's triangle on a grid of instances, each turned and scaled
+// into its cell
+struct Scene {
+    PickMesh mesh;
+    std::vector<Matrix4> worlds;
+    std::vector<Bounds> bounds;
+    std::vector<uint32_t> meshOf;
+    Bvh bvh;
+
+    explicit Scene(uint32_t count) {
+        mesh.corners = { { 0.0f, 0.5f, 0.0f }, { 0.5f, -0.5f, 0.0f },
+                         { -0.5f, -0.5f, 0.0f } };
+        Bounds meshBounds = { { -0.5f, -0.5f, 0.0f }, { 0.5f, 0.5f, 0.0f } };
+        uint32_t side = static_cast<uint32_t>(ceil(sqrt(double(count))));
+        float cell = 2.0f / side;
+        float scale = std::min(1.0f, cell * 0.9f);
+        std::mt19937 rng(1);
+        std::uniform_real_distribution<float> angle(0.0f, 6.2831853f);
+        for (uint32_t i = 0; i < count; ++i) {
+            float x = -1.0f + cell * (i % side + 0.5f);
+            float y = 1.0f - cell * (i / side + 0.5f);
+            Matrix4 world = Matrix4::scaling(scale, scale, 1.0f) *
+                            Matrix4::rotationZ(angle(rng)) *
+                            Matrix4::translation(x, y, 0.0f);
+            worlds.push_back(world);
+            bounds.push_back(transformBounds(meshBounds, world));
+        }
+        meshOf.assign(count, 0);
+        bvh.build(bounds.data(), count);
+    }
+
+    PickScene pickScene() const {
+        PickScene scene;
+        scene.bvh = &bvh;
+        scene.worlds = worlds.data();
+        scene.meshOf = meshOf.data();
+        scene.meshes = &mesh;
+        return scene;
+    }
+};
+
+// Closest hit over every instance's triangle, without the BVH
+RayHit bruteForce(const Scene& scene, const Ray& ray) {
+    RayHit best;
+    best.t = ray.maxT;
+    for (uint32_t i = 0; i < scene.worlds.size(); ++i) {
+        Float3 a = transformPoint(scene.mesh.corners[0], scene.worlds[i]);
+        Float3 b = transformPoint(scene.mesh.corners[1], scene.worlds[i]);
+        Float3 c = transformPoint(scene.mesh.corners[2], scene.worlds[i]);
+        Float3 e1 = b - a;
+        Float3 e2 = c - a;
+        Float3 p = cross(ray.direction, e2);
+        float det = dot(e1, p);
+        if (std::fabs(det) < 1e-12f) continue;
+        Float3 s = ray.origin - a;
+        float u = dot(s, p) / det;
+        Float3 q = cross(s, e1);
+        float v = dot(ray.direction, q) / det;
+        float t = dot(e2, q) / det;
+        if (u < 0.0f || v < 0.0f || u + v > 1.0f) continue;
+        if (t < 0.0f || t >= best.t) continue;
+        best.instance = i;
+        best.t = t;
+    }
+    if (best.instance == RayHit::kNone) best.t = ray.maxT;
+    return best;
+}
+
+std::vector<Ray> randomRays(uint32_t count, uint32_t seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> pixel(0.0f, 1024.0f);
+    Matrix4 view = Matrix4::rotationZ(0.2f);
+    std::vector<Ray> rays(count);
+    for (Ray& ray : rays) {
+        ray = screenRay(view, pixel(rng), pixel(rng), 1024.0f, 1024.0f);
+    }
+    return rays;
+}
+
+void testScreenRay() {
+    // Identity: pixel centers map straight onto clip space, near to far
+    Ray ray = screenRay(Matrix4::identity(), 512.0f, 512.0f, 1024.0f,
+                        1024.0f);
+    CHECK(near(ray.origin.x, 0.0f) && near(ray.origin.y, 0.0f));
+    CHECK(near(ray.origin.z, 0.0f) && near(ray.direction.z, 1.0f));
+    CHECK(ray.maxT == 1.0f);
+    ray = screenRay(Matrix4::identity(), 0.0f, 0.0f, 1024.0f, 1024.0f);
+    CHECK(near(ray.origin.x, -1.0f) && near(ray.origin.y, 1.0f));
+
+    // Through a scaling view, the ray lands on the scaled-down point
+    Matrix4 view = Matrix4::scaling(2.0f, 2.0f, 1.0f);
+    ray = screenRay(view, 1024.0f, 512.0f, 1024.0f, 1024.0f);
+    CHECK(near(ray.origin.x, 0.5f) && near(ray.origin.y, 0.0f));
+}
+
+void testSingleTriangle() {
+    Scene scene(1);
+    PickScene pick = scene.pickScene();
+
+    // Straight down the z axis through the triangle's centroid area
+    Ray ray = { { 0.0f, 0.0f, -1.0f }, { 0.0f, 0.0f, 1.0f }, 10.0f };
+    RayHit hit = castRay(pick, ray);
+    CHECK(hit.instance == 0 && hit.triangle == 0);
+    CHECK(near(hit.t, 1.0f));
+    CHECK(hit.u >= 0.0f && hit.v >= 0.0f && hit.u + hit.v <= 1.0f);
+
+    // The hit point rebuilt from the barycentrics is where the ray crossed
+    const Matrix4& world = scene.worlds[0];
+    Float3 a = transformPoint(scene.mesh.corners[0], world);
+    Float3 b = transformPoint(scene.mesh.corners[1], world);
+    Float3 c = transformPoint(scene.mesh.corners[2], world);
+    Float3 point = a + (b - a) * hit.u + (c - a) * hit.v;
+    CHECK(near(point.x, 0.0f) && near(point.y, 0.0f));
+
+    // Beside the triangle, and short of it
+    ray.origin = { 5.0f, 5.0f, -1.0f };
+    CHECK(castRay(pick, ray).instance == RayHit::kNone);
+    ray.origin = { 0.0f, 0.0f, -1.0f };
+    ray.maxT = 0.5f;
+    CHECK(castRay(pick, ray).instance == RayHit::kNone);
+}
+
+void testAgainstBruteForce() {
+    Scene scene(10000);
+    PickScene pick = scene.pickScene();
+    std::vector<Ray> rays = randomRays(1001, 2);     // not a multiple of 4
+    std::vector<RayHit> hits(rays.size());
+    castRays(pick, rays.data(), static_cast<uint32_t>(rays.size()),
+             hits.data());
+
+    uint32_t hitCount = 0;
+    bool singleMatches = true;
+    bool packetsMatch = true;
+    for (size_t r = 0; r < rays.size(); ++r) {
+        RayHit expected = bruteForce(scene, rays[r]);
+        RayHit single = castRay(pick, rays[r]);
+        hitCount += expected.instance != RayHit::kNone;
+        // Neighbours may overlap at the same depth; either is right
+        singleMatches &= (single.instance == RayHit::kNone) ==
+                             (expected.instance == RayHit::kNone) &&
+                         near(single.t, expected.t);
+        packetsMatch &= (hits[r].instance == RayHit::kNone) ==
+                            (single.instance == RayHit::kNone) &&
+                        hits[r].t == single.t;
+    }
+    CHECK(hitCount > 0 && hitCount < rays.size());
+    CHECK(singleMatches);
+    CHECK(packetsMatch);
+}
+
+// -----------------------------------------------------------------------------
+double msSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+void benchRays(const char* name, const Scene& scene,
+               const std::vector<Ray>& rays) {
+    PickScene pick = scene.pickScene();
+    uint32_t count = static_cast<uint32_t>(rays.size());
+    std::vector<RayHit> hits(count);
+    const int runs = 5;
+
+    auto start = std::chrono::steady_clock::now();
+    uint32_t hitCount = 0;
+    for (int run = 0; run < runs; ++run) {
+        for (uint32_t r = 0; r < count; ++r) {
+            hits[r] = castRay(pick, rays[r]);
+            hitCount += hits[r].instance != RayHit::kNone;
+        }
+    }
+    double singleMs = msSince(start);
+
+    start = std::chrono::steady_clock::now();
+    for (int run = 0; run < runs; ++run) {
+        castRays(pick, rays.data(), count, hits.data());
+    }
+    double packetMs = msSince(start);
+
+    std::cerr << "  " << name << ": single " << runs * count / singleMs /
+                                                   1000.0
+              << " M rays/s, packets " << runs * count / packetMs / 1000.0
+              << " M rays/s (" << hitCount / runs << " of " << count
+              << " hit)" << std::endl;
+}
+
+void bench(uint32_t count) {
+    int workers = std::max(1, static_cast<int>(
+                                  std::thread::hardware_concurrency()) - 1);
+    jobSystem().start(workers);
+    Scene scene(count);
+    std::cerr << count << " instances, " << scene.bvh.nodeCount()
+              << " BVH nodes, " << workers << " workers" << std::endl;
+
+    benchRays("random pixels", scene, randomRays(4096, 3));
+
+    // A 64x64 tile in screen order, as a pass over part of the screen
+    Matrix4 view = Matrix4::rotationZ(0.2f);
+    std::vector<Ray> tile;
+    for (uint32_t y = 0; y < 64; ++y) {
+        for (uint32_t x = 0; x < 64; ++x) {
+            tile.push_back(screenRay(view, 480.0f + x, 480.0f + y, 1024.0f,
+                                     1024.0f));
+        }
+    }
+    benchRays("64x64 tile", scene, tile);
+    jobSystem().stop();
+}
+
+} // namespace
+
+// -----------------------------------------------------------------------------
+int main(int argc, char* argv[]) {
+    if (argc == 3 && strcmp(argv[1], "--bench") == 0) {
+        bench(static_cast<uint32_t>(std::max(1, atoi(argv[2]))));
+        return 0;
+    }
+
+    testScreenRay();
+    testSingleTriangle();
+    testAgainstBruteForce();
+    return testResult("picking");
+}
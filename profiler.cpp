@@ -0,0 +1,263 @@
+#include "profiler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <map>
+
+// -----------------------------------------------------------------------------
+Profiler& profiler() {
+    static Profiler instance;
+    return instance;
+}
+
+Profiler::Profiler()
+    : ring_(kCapacity),
+      writeIndex_(0),
+      frameCount_(0),
+      lastFrameNs_(0),
+      lastDumpNs_(0),
+      ewmaMs_(0.0),
+      meanMs_(0.0),
+      m2_(0.0),
+      maxMs_(0.0),
+      histogram_(kHistogramBuckets, 0),
+      dumpCount_(0),
+      droppedDumps_(0),
+      writing_(false) {
+}
+
+Profiler::~Profiler() {
+    if (writer_.joinable()) {
+        writer_.join();
+    }
+}
+
+uint32_t Profiler::threadId() {
+    static std::atomic<uint32_t> nextId(0);
+    thread_local uint32_t id = nextId.fetch_add(1);
+    return id;
+}
+
+void Profiler::endFrame() {
+    uint64_t now = nowNs();
+    uint64_t last = lastFrameNs_;
+    lastFrameNs_ = now;
+    if (last == 0) return;
+
+    double frameMs = (now - last) * 1e-6;
+    record("Frame", last, now);
+    ++frameCount_;
+
+    double delta = frameMs - meanMs_;
+    meanMs_ += delta / frameCount_;
+    m2_ += delta * (frameMs - meanMs_);
+    maxMs_ = std::max(maxMs_, frameMs);
+    size_t bucket = static_cast<size_t>(frameMs / kHistogramBucketMs);
+    ++histogram_[std::min(bucket, kHistogramBuckets - 1)];
+
+    bool hitch = frameMs > config_.hitchThresholdMs;
+    if (frameCount_ > config_.warmupFrames &&
+        frameMs > config_.spikeFactor * ewmaMs_) {
+        hitch = true;
+    }
+
+    // Hitches are kept out of the average so one long frame does not mask
+    // the next one.
+    if (ewmaMs_ == 0.0) {
+        ewmaMs_ = frameMs;
+    } else if (!hitch) {
+        ewmaMs_ += config_.ewmaAlpha * (frameMs - ewmaMs_);
+    }
+
+    double sinceDump = (now - lastDumpNs_) * 1e-9;
+    if (hitch && (lastDumpNs_ == 0 ||
+                  sinceDump >= config_.minDumpIntervalSeconds) &&
+        dump(frameMs)) {
+        lastDumpNs_ = now;
+    }
+}
+
+std::vector<ZoneRecord> Profiler::zones(uint64_t sinceNs) const {
+    uint64_t end = writeIndex_.load(std::memory_order_acquire);
+    uint64_t count = std::min<uint64_t>(end, kCapacity);
+    std::vector<ZoneRecord> zones;
+    zones.reserve(count);
+    for (uint64_t i = end - count; i < end; ++i) {
+        // Not finished yet, or already reused for a later zone
+        const Slot& slot = ring_[i & (kCapacity - 1)];
+        uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+        if (sequence != 2 * i + 2) continue;
+
+        ZoneRecord r = {};
+        copyRecord(slot.record, r);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.sequence.load(std::memory_order_relaxed) != sequence) {
+            continue;
+        }
+        if (r.endNs >= sinceNs) zones.push_back(r);
+    }
+    return zones;
+}
+
+FrameTimeStats Profiler::frameTimeStats() const {
+    FrameTimeStats stats;
+    stats.frames = frameCount_;
+    if (frameCount_ == 0) return stats;
+
+    stats.meanMs = meanMs_;
+    stats.stddevMs = frameCount_ > 1 ? sqrt(m2_ / (frameCount_ - 1)) : 0.0;
+    stats.maxMs = maxMs_;
+
+    uint64_t p50 = (frameCount_ + 1) / 2;
+    uint64_t p99 = (frameCount_ * 99 + 99) / 100;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < kHistogramBuckets; ++i) {
+        uint64_t before = seen;
+        seen += histogram_[i];
+        double upperMs = (i + 1) * kHistogramBucketMs;
+        if (before < p50 && seen >= p50) stats.p50Ms = upperMs;
+        if (before < p99 && seen >= p99) stats.p99Ms = upperMs;
+    }
+    return stats;
+}
+
+bool Profiler::dump(double frameMs) {
+    // The caller is presenting frames; waiting for a writer still busy with
+    // the last dump would be a hitch of its own, so this one is dropped
+    if (writing_.load(std::memory_order_acquire)) {
+        ++droppedDumps_;
+        std::cerr << "Hitch: frame " << frameCount_ << " took " << frameMs
+                  << " ms, not dumped while the last dump is written"
+                  << std::endl;
+        return false;
+    }
+    if (writer_.joinable()) {
+        writer_.join();              // done with its file already
+    }
+
+    // Snapshot on the calling thread; formatting and file I/O happen on a
+    // writer thread so the dump does not cause the next hitch.
+    uint64_t windowStart = lastFrameNs_ -
+        static_cast<uint64_t>(config_.windowSeconds * 1e9);
+    std::vector<ZoneRecord> zones = this->zones(windowStart);
+
+    char fileName[64];
+    snprintf(fileName, sizeof(fileName), "/hitch_%llu.json",
+             static_cast<unsigned long long>(frameCount_));
+    std::string path = config_.dumpDirectory + fileName;
+
+    std::cerr << "Hitch: frame " << frameCount_ << " took " << frameMs
+              << " ms (avg " << ewmaMs_ << " ms), writing " << path
+              << std::endl;
+
+    ++dumpCount_;
+    writing_.store(true, std::memory_order_relaxed);
+    writer_ = std::thread(
+        [this, path, windowStart, zones = std::move(zones)]() mutable {
+            writeTrace(std::move(path), std::move(zones), windowStart);
+            writing_.store(false, std::memory_order_release);
+        });
+    return true;
+}
+
+void Profiler::writeTrace(std::string path, std::vector<ZoneRecord> zones,
+                          uint64_t baseNs) {
+    FILE* file = fopen(path.c_str(), "w");
+    if (file == nullptr) {
+        std::cerr << "Failed to open " << path << std::endl;
+        return;
+    }
+
+    fprintf(file, "{\"traceEvents\":[\n");
+    for (size_t i = 0; i < zones.size(); ++i) {
+        const ZoneRecord& r = zones[i];
+        uint64_t start = r.startNs > baseNs ? r.startNs - baseNs : 0;
+        fprintf(file,
+                "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%u,"
+                "\"ts\":%.3f,\"dur\":%.3f",
+                i == 0 ? "" : ",", r.name, r.threadId,
+                start * 1e-3, (r.endNs - r.startNs) * 1e-3);
+        if (r.hasCounters) {
+            fprintf(file, ",\"args\":{");
+            for (int c = 0; c < kHwCounterCount; ++c) {
+                fprintf(file, "%s\"%s\":%llu", c == 0 ? "" : ",",
+                        hw_counters::name(static_cast<HwCounter>(c)),
+                        static_cast<unsigned long long>(r.counters.value[c]));
+            }
+            fprintf(file, "}");
+        }
+        fprintf(file, "}\n");
+    }
+    fprintf(file, "]}\n");
+    fclose(file);
+}
+
+bool Profiler::writeSummary(const std::string& path) const {
+    struct ZoneTotals {
+        uint64_t count = 0;
+        uint64_t totalNs = 0;
+        uint64_t countedZones = 0;
+        uint64_t counters[kHwCounterCount] = {};
+    };
+
+    std::map<std::string, ZoneTotals> totals;
+    for (const ZoneRecord& r : zones()) {
+        ZoneTotals& t = totals[r.name];
+        ++t.count;
+        t.totalNs += r.endNs - r.startNs;
+        if (r.hasCounters) {
+            ++t.countedZones;
+            for (int c = 0; c < kHwCounterCount; ++c) {
+                t.counters[c] += r.counters.value[c];
+            }
+        }
+    }
+
+    FILE* file = fopen(path.c_str(), "w");
+    if (file == nullptr) {
+        std::cerr << "Failed to open " << path << std::endl;
+        return false;
+    }
+
+    FrameTimeStats frames = frameTimeStats();
+    fprintf(file, "{\"frames\":%llu,\"frame_time_ewma_ms\":%.4f,"
+            "\"frame_time_mean_ms\":%.4f,\"frame_time_stddev_ms\":%.4f,"
+            "\"frame_time_p50_ms\":%.1f,\"frame_time_p99_ms\":%.1f,"
+            "\"frame_time_max_ms\":%.4f,\"hitch_dumps\":%u,"
+            "\"hitch_dumps_dropped\":%u,\"zones\":[\n",
+            static_cast<unsigned long long>(frameCount_), ewmaMs_,
+            frames.meanMs, frames.stddevMs, frames.p50Ms, frames.p99Ms,
+            frames.maxMs, dumpCount_, droppedDumps_);
+    bool first = true;
+    for (const auto& entry : totals) {
+        const ZoneTotals& t = entry.second;
+        fprintf(file, "%s{\"name\":\"%s\",\"count\":%llu,\"total_ms\":%.4f,"
+                "\"avg_ms\":%.4f",
+                first ? "" : ",", entry.first.c_str(),
+                static_cast<unsigned long long>(t.count), t.totalNs * 1e-6,
+                t.totalNs * 1e-6 / t.count);
+        if (t.countedZones > 0) {
+            for (int c = 0; c < kHwCounterCount; ++c) {
+                fprintf(file, ",\"%s\":%llu",
+                        hw_counters::name(static_cast<HwCounter>(c)),
+                        static_cast<unsigned long long>(t.counters[c]));
+            }
+            double cycles = static_cast<double>(t.counters[kHwCycles]);
+            double kinstr = t.counters[kHwInstructions] / 1000.0;
+            fprintf(file, ",\"ipc\":%.3f,\"cache_misses_per_kinstr\":%.3f,"
+                    "\"branch_misses_per_kinstr\":%.3f,"
+                    "\"dtlb_misses_per_kinstr\":%.3f",
+                    cycles > 0 ? t.counters[kHwInstructions] / cycles : 0.0,
+                    kinstr > 0 ? t.counters[kHwCacheMisses] / kinstr : 0.0,
+                    kinstr > 0 ? t.counters[kHwBranchMisses] / kinstr : 0.0,
+                    kinstr > 0 ? t.counters[kHwDtlbMisses] / kinstr : 0.0);
+        }
+        fprintf(file, "}\n");
+        first = false;
+    }
+    fprintf(file, "]}\n");
+    fclose(file);
+    return true;
+}
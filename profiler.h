@@ -0,0 +1,196 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "hw_counters.h"
+
+// -----------------------------------------------------------------------------
+// Always-on instrumentation zones kept in a rolling ring buffer. When a frame
+// exceeds the hitch threshold, or spikes well above the frame-time EWMA, the
+// last few seconds of zones are written to disk as a Chrome trace
+// (chrome://tracing, Perfetto) so rare long frames can be inspected after
+// the fact.
+//
+// Any thread may record while another reads the ring. Each slot carries a
+// sequence number, odd while its fields are written; a reader keeps a copy
+// only if the sequence was the slot's finished one before and after it
+// copied, and skips the slot otherwise. The fields themselves are copied
+// with relaxed atomics, so a torn copy is thrown away rather than being a
+// data race.
+struct ProfilerConfig {
+    double hitchThresholdMs = 50.0;    // absolute frame-time limit
+    double spikeFactor = 2.5;          // frame > factor * EWMA is a spike
+    double ewmaAlpha = 0.05;
+    double windowSeconds = 3.0;        // how much history a dump contains
+    double minDumpIntervalSeconds = 5.0;
+    uint32_t warmupFrames = 120;       // let the EWMA settle before spikes count
+    std::string dumpDirectory = ".";
+    bool hwCounters = false;           // sample perf counters per zone
+};
+
+struct FrameTimeStats {
+    uint64_t frames = 0;
+    double meanMs = 0.0;
+    double stddevMs = 0.0;       // jitter
+    double p50Ms = 0.0;
+    double p99Ms = 0.0;
+    double maxMs = 0.0;
+};
+
+struct ZoneRecord {
+    const char* name;
+    uint64_t startNs;
+    uint64_t endNs;
+    uint32_t threadId;
+    bool hasCounters;
+    HwCounterValues counters;          // scaled deltas over the zone
+};
+
+class Profiler {
+ public:
+    // Power of two so the write index can be masked
+    static constexpr size_t kCapacity = 1 << 16;
+
+    // Frame-time histogram for percentiles: 0.1 ms buckets up to 200 ms
+    static constexpr size_t kHistogramBuckets = 2000;
+    static constexpr double kHistogramBucketMs = 0.1;
+
+    Profiler();
+    ~Profiler();
+
+    void configure(const ProfilerConfig& config) { config_ = config; }
+    const ProfilerConfig& config() const { return config_; }
+
+    static uint64_t nowNs() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    bool countersEnabled() const { return config_.hwCounters; }
+
+    void record(const char* name, uint64_t startNs, uint64_t endNs,
+                const HwCounterValues* counters = nullptr) {
+        uint64_t index = writeIndex_.fetch_add(1, std::memory_order_relaxed);
+        Slot& slot = ring_[index & (kCapacity - 1)];
+        slot.sequence.store(2 * index + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        ZoneRecord r;
+        r.name = name;
+        r.startNs = startNs;
+        r.endNs = endNs;
+        r.threadId = threadId();
+        r.hasCounters = counters != nullptr;
+        if (counters != nullptr) {
+            r.counters = *counters;
+        }
+        copyRecord(r, slot.record);
+        slot.sequence.store(2 * index + 2, std::memory_order_release);
+    }
+
+    // The zones still in the ring that ended at or after `sinceNs`, oldest
+    // first. Slots being written meanwhile are left out.
+    std::vector<ZoneRecord> zones(uint64_t sinceNs = 0) const;
+
+    // Call once per presented frame; checks for hitches and triggers dumps.
+    void endFrame();
+
+    uint64_t frameCount() const { return frameCount_; }
+    FrameTimeStats frameTimeStats() const;
+    double frameTimeEwmaMs() const { return ewmaMs_; }
+    uint32_t dumpCount() const { return dumpCount_; }
+    // Hitches not dumped because the previous dump was still being written
+    uint32_t droppedDumps() const { return droppedDumps_; }
+
+    // Per-zone timing and counter totals over the zones still in the ring.
+    bool writeSummary(const std::string& path) const;
+
+ private:
+    // sequence is 2 * index + 2 once the zone recorded at `index` is
+    // complete, and odd while a zone is being written
+    struct Slot {
+        std::atomic<uint64_t> sequence{ 0 };
+        ZoneRecord record = {};
+    };
+
+    template <typename T>
+    static void relaxedCopy(const T& from, T& to) {
+        T value = std::atomic_ref<T>(const_cast<T&>(from)).load(
+            std::memory_order_relaxed);
+        std::atomic_ref<T>(to).store(value, std::memory_order_relaxed);
+    }
+
+    static void copyRecord(const ZoneRecord& from, ZoneRecord& to) {
+        relaxedCopy(from.name, to.name);
+        relaxedCopy(from.startNs, to.startNs);
+        relaxedCopy(from.endNs, to.endNs);
+        relaxedCopy(from.threadId, to.threadId);
+        relaxedCopy(from.hasCounters, to.hasCounters);
+        if (!to.hasCounters) return;
+        for (int c = 0; c < kHwCounterCount; ++c) {
+            relaxedCopy(from.counters.value[c], to.counters.value[c]);
+        }
+    }
+
+    static uint32_t threadId();
+    bool dump(double frameMs);
+    static void writeTrace(std::string path, std::vector<ZoneRecord> zones,
+                           uint64_t baseNs);
+
+    ProfilerConfig config_;
+    std::vector<Slot> ring_;
+    std::atomic<uint64_t> writeIndex_;
+
+    uint64_t frameCount_;
+    uint64_t lastFrameNs_;
+    uint64_t lastDumpNs_;
+    double ewmaMs_;
+    double meanMs_;              // Welford running mean and M2
+    double m2_;
+    double maxMs_;
+    std::vector<uint32_t> histogram_;
+    uint32_t dumpCount_;
+    uint32_t droppedDumps_;
+    std::thread writer_;
+    std::atomic<bool> writing_;  // writer_ has not finished its dump
+};
+
+Profiler& profiler();
+
+// -----------------------------------------------------------------------------
+class ScopedZone {
+ public:
+    explicit ScopedZone(const char* name)
+        : name_(name),
+          counted_(profiler().countersEnabled() &&
+                   hw_counters::read(startCounters_)),
+          startNs_(Profiler::nowNs()) {
+    }
+
+    ~ScopedZone() {
+        uint64_t endNs = Profiler::nowNs();
+        HwCounterValues endCounters;
+        HwCounterValues counts;
+        if (counted_ && hw_counters::read(endCounters) &&
+            hw_counters::delta(startCounters_, endCounters, counts)) {
+            profiler().record(name_, startNs_, endNs, &counts);
+        } else {
+            profiler().record(name_, startNs_, endNs);
+        }
+    }
+
+ private:
+    const char* name_;
+    HwCounterValues startCounters_;
+    bool counted_;
+    uint64_t startNs_;
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_ZONE(name) ScopedZone PROFILE_CONCAT(zone_, __LINE__)(name)
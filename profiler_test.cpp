@@ -0,0 +1,233 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "profiler.h"
+#include "test_check.h"
+
+// -----------------------------------------------------------------------------
+// Tests for Profiler: the ring keeping its newest kCapacity zones oldest
+// first after it wraps, zones() filtering by end time, hitch dumps from the
+// absolute threshold and from spikes over the EWMA, the dump interval, and
+// snapshots taken while other threads record never holding a torn zone.
+// With --bench it times that many PROFILE_ZONEs on one thread and on every
+// hardware thread at once, and prints the cost per zone and what it adds to
+// a 16.7 ms frame holding a thousand of them.
+//
+//   ProfilerTest [--bench <zones>]
+namespace {
+
+namespace fs = std::filesystem;
+
+void testWraparound() {
+    Profiler p;
+    CHECK(p.zones().empty());
+
+    const uint64_t count = Profiler::kCapacity + 100;
+    for (uint64_t i = 0; i < count; ++i) p.record("Zone", i, i + 1);
+
+    std::vector<ZoneRecord> zones = p.zones();
+    CHECK(zones.size() == Profiler::kCapacity);
+    bool ordered = !zones.empty() && zones.front().startNs == 100;
+    for (size_t i = 0; ordered && i < zones.size(); ++i) {
+        ordered = zones[i].startNs == 100 + i &&
+                  zones[i].endNs == 101 + i &&
+                  strcmp(zones[i].name, "Zone") == 0 &&
+                  !zones[i].hasCounters;
+    }
+    CHECK(ordered);
+
+    // Only zones ending at or after the cutoff
+    std::vector<ZoneRecord> recent = p.zones(count - 9);
+    CHECK(recent.size() == 10);
+    CHECK(!recent.empty() && recent.front().endNs == count - 9);
+}
+
+void testCounters() {
+    Profiler p;
+    HwCounterValues counters;
+    for (int c = 0; c < kHwCounterCount; ++c) counters.value[c] = 10 + c;
+    p.record("Counted", 1, 2, &counters);
+    std::vector<ZoneRecord> zones = p.zones();
+    CHECK(zones.size() == 1);
+    CHECK(!zones.empty() && zones[0].hasCounters &&
+          zones[0].counters.value[kHwCounterCount - 1] ==
+              10 + kHwCounterCount - 1);
+}
+
+// A scratch dump directory, emptied first
+std::string dumpDirectory(const char* name) {
+    fs::path path = fs::temp_directory_path() / name;
+    std::error_code error;
+    fs::remove_all(path, error);
+    fs::create_directories(path, error);
+    return path.string();
+}
+
+size_t dumpFiles(const std::string& directory) {
+    size_t files = 0;
+    std::error_code error;
+    for (const auto& entry : fs::directory_iterator(directory, error)) {
+        if (entry.path().filename().string().rfind("hitch_", 0) == 0) {
+            ++files;
+        }
+    }
+    return files;
+}
+
+void frame(Profiler& p, int ms) {
+    uint64_t start = Profiler::nowNs();
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+    p.record("Work", start, Profiler::nowNs());
+    p.endFrame();
+}
+
+void testHitchThreshold() {
+    std::string directory = dumpDirectory("profiler_test_threshold");
+    {
+        Profiler p;
+        ProfilerConfig config;
+        config.hitchThresholdMs = 40.0;
+        config.spikeFactor = 1000.0;          // only the threshold counts
+        config.minDumpIntervalSeconds = 0.0;
+        config.dumpDirectory = directory;
+        p.configure(config);
+
+        p.endFrame();                         // starts the first frame
+        for (int i = 0; i < 5; ++i) frame(p, 1);
+        CHECK(p.dumpCount() == 0);
+        frame(p, 60);
+        CHECK(p.dumpCount() == 1);
+        CHECK(p.frameCount() == 6);
+
+        // A second hitch straight after is dumped unless the first is still
+        // being written, and then it is counted as dropped
+        frame(p, 60);
+        CHECK(p.dumpCount() + p.droppedDumps() == 2);
+    }
+    // The destructor waited for the writer
+    CHECK(dumpFiles(directory) >= 1);
+    CHECK(fs::exists(fs::path(directory) / "hitch_6.json"));
+    std::error_code error;
+    fs::remove_all(directory, error);
+}
+
+void testHitchSpike() {
+    std::string directory = dumpDirectory("profiler_test_spike");
+    {
+        Profiler p;
+        ProfilerConfig config;
+        config.hitchThresholdMs = 1000.0;     // only spikes count
+        config.spikeFactor = 4.0;
+        config.warmupFrames = 5;
+        config.minDumpIntervalSeconds = 60.0;
+        config.dumpDirectory = directory;
+        p.configure(config);
+
+        p.endFrame();
+        for (int i = 0; i < 8; ++i) frame(p, 10);
+        CHECK(p.dumpCount() == 0);
+        CHECK(p.frameTimeEwmaMs() > 5.0);
+        frame(p, 150);
+        CHECK(p.dumpCount() == 1);
+
+        // Hitches are kept out of the EWMA, and the next one falls inside
+        // the dump interval
+        CHECK(p.frameTimeEwmaMs() < 100.0);
+        frame(p, 150);
+        CHECK(p.dumpCount() == 1 && p.droppedDumps() == 0);
+    }
+    CHECK(dumpFiles(directory) == 1);
+    std::error_code error;
+    fs::remove_all(directory, error);
+}
+
+// Writers stamp every zone so that a copy mixing two of them shows
+void testConcurrentSnapshot() {
+    Profiler p;
+    const int writers = 3;
+    const uint64_t perWriter = 200000;
+    std::vector<std::thread> threads;
+    for (int w = 0; w < writers; ++w) {
+        threads.emplace_back([&p, w] {
+            const char* names[] = { "A", "B", "C" };
+            for (uint64_t i = 0; i < perWriter; ++i) {
+                uint64_t start = i * writers + w;
+                p.record(names[w], start, start * 3 + w);
+            }
+        });
+    }
+
+    bool consistent = true;
+    size_t snapshots = 0;
+    do {
+        for (const ZoneRecord& r : p.zones()) {
+            int w = static_cast<int>(r.startNs % writers);
+            consistent &= r.name != nullptr && r.name[0] == 'A' + w &&
+                          r.endNs == r.startNs * 3 + w;
+        }
+        ++snapshots;
+    } while (snapshots < 20 ||
+             p.zones().size() < Profiler::kCapacity);
+    for (std::thread& t : threads) t.join();
+    CHECK(consistent);
+    CHECK(p.zones().size() == Profiler::kCapacity);
+}
+
+// -----------------------------------------------------------------------------
+double msSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+double zoneNs(uint32_t zones, int threads) {
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([zones] {
+            for (uint32_t i = 0; i < zones; ++i) {
+                PROFILE_ZONE("Bench");
+            }
+        });
+    }
+    for (std::thread& t : workers) t.join();
+    return msSince(start) * 1e6 / zones;
+}
+
+void bench(uint32_t zones) {
+    int threads = std::max(1u, std::thread::hardware_concurrency());
+    double single = zoneNs(zones, 1);
+    double shared = zoneNs(zones, threads);
+    std::cerr << zones << " zones: " << single << " ns per zone on one "
+              << "thread, " << shared << " ns per zone on each of "
+              << threads << " threads at once" << std::endl;
+    for (int perFrame : { 100, 1000 }) {
+        std::cerr << "  " << perFrame << " zones per 16.7 ms frame: "
+                  << perFrame * single * 1e-6 / 16.7 * 100.0
+                  << "% of the frame" << std::endl;
+    }
+}
+
+} // namespace
+
+// -----------------------------------------------------------------------------
+int main(int argc, char* argv[]) {
+    if (argc == 3 && strcmp(argv[1], "--bench") == 0) {
+        bench(static_cast<uint32_t>(std::max(1, atoi(argv[2]))));
+        return 0;
+    }
+
+    testWraparound();
+    testCounters();
+    testHitchThreshold();
+    testHitchSpike();
+    testConcurrentSnapshot();
+    return testResult("profiler");
+}
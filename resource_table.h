@@ -0,0 +1,121 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+// Handle-addressed storage for one resource type. A handle packs a slot index
+// and the slot's generation into 32 bits; removing a resource bumps the
+// generation, so stale handles fail validation instead of reaching a freed
+// object. Values live densely packed (removal swaps the last value into the
+// hole), which keeps iteration linear and lookups at two array reads.
+template <typename T>
+class ResourceTable {
+ public:
+    static constexpr uint32_t kIndexBits = 20;
+    static constexpr uint32_t kGenerationBits = 32 - kIndexBits;
+    static constexpr uint32_t kMaxEntries = (1u << kIndexBits) - 1;
+
+    struct Handle {
+        uint32_t value = 0;      // 0 is never a valid handle
+
+        bool isNull() const { return value == 0; }
+        bool operator==(const Handle& other) const { return value == other.value; }
+        bool operator!=(const Handle& other) const { return value != other.value; }
+    };
+
+    Handle insert(T value) {
+        uint32_t index;
+        if (freeHead_ != kNoSlot) {
+            index = freeHead_;
+            freeHead_ = slots_[index].dense;
+        } else {
+            if (slots_.size() >= kMaxEntries) return Handle();
+            index = static_cast<uint32_t>(slots_.size());
+            slots_.push_back(Slot{ 1, 0 });
+        }
+
+        Slot& slot = slots_[index];
+        slot.dense = static_cast<uint32_t>(values_.size());
+        values_.push_back(std::move(value));
+        owners_.push_back(index);
+        return makeHandle(index, slot.generation);
+    }
+
+    bool valid(Handle handle) const {
+        uint32_t index = indexOf(handle);
+        return index < slots_.size() &&
+               slots_[index].generation == generationOf(handle) &&
+               !handle.isNull();
+    }
+
+    // nullptr for stale or null handles
+    T* get(Handle handle) {
+        return valid(handle) ? &values_[slots_[indexOf(handle)].dense] : nullptr;
+    }
+    const T* get(Handle handle) const {
+        return valid(handle) ? &values_[slots_[indexOf(handle)].dense] : nullptr;
+    }
+
+    // Moves the value to `out` (if given) and invalidates the handle.
+    bool remove(Handle handle, T* out = nullptr) {
+        if (!valid(handle)) return false;
+
+        uint32_t index = indexOf(handle);
+        Slot& slot = slots_[index];
+        uint32_t dense = slot.dense;
+        if (out != nullptr) *out = std::move(values_[dense]);
+
+        uint32_t last = static_cast<uint32_t>(values_.size() - 1);
+        if (dense != last) {
+            values_[dense] = std::move(values_[last]);
+            owners_[dense] = owners_[last];
+            slots_[owners_[dense]].dense = dense;
+        }
+        values_.pop_back();
+        owners_.pop_back();
+
+        // Generation 0 is skipped so a null handle never validates
+        slot.generation = (slot.generation + 1) & ((1u << kGenerationBits) - 1);
+        if (slot.generation == 0) slot.generation = 1;
+        slot.dense = freeHead_;
+        freeHead_ = index;
+        return true;
+    }
+
+    size_t size() const { return values_.size(); }
+
+    // Dense iteration, order changes on removal
+    T* begin() { return values_.data(); }
+    T* end() { return values_.data() + values_.size(); }
+    const T* begin() const { return values_.data(); }
+    const T* end() const { return values_.data() + values_.size(); }
+
+ private:
+    static constexpr uint32_t kNoSlot = 0xffffffffu;
+
+    struct Slot {
+        uint32_t generation;
+        uint32_t dense;          // index into values_, or next free slot
+    };
+
+    // Index is stored +1 so that slot 0 generation 1 is not handle value 0
+    static Handle makeHandle(uint32_t index, uint32_t generation) {
+        Handle handle;
+        handle.value = (generation << kIndexBits) | (index + 1);
+        return handle;
+    }
+    static uint32_t indexOf(Handle handle) {
+        return (handle.value & kMaxEntries) - 1;
+    }
+    static uint32_t generationOf(Handle handle) {
+        return handle.value >> kIndexBits;
+    }
+
+    std::vector<Slot> slots_;
+    std::vector<T> values_;
+    std::vector<uint32_t> owners_;   // slot index of each dense value
+    uint32_t freeHead_ = kNoSlot;
+};
@@ -0,0 +1,194 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+#include "resource_table.h"
+#include "test_check.h"
+
+// -----------------------------------------------------------------------------
+// Tests for ResourceTable: stale handles after removal and slot reuse, the
+// 12-bit generation wrapping past 0, and dense swap-removal. With --bench it
+// also times lookups against raw pointers and std::unordered_map.
+//
+//   ResourceTableTest [--bench <entries>]
+namespace {
+
+typedef ResourceTable<int> IntTable;
+
+void testInsertGet() {
+    IntTable table;
+    IntTable::Handle a = table.insert(10);
+    IntTable::Handle b = table.insert(20);
+    CHECK(!a.isNull() && !b.isNull() && a != b);
+    CHECK(table.size() == 2);
+    CHECK(table.get(a) != nullptr && *table.get(a) == 10);
+    CHECK(table.get(b) != nullptr && *table.get(b) == 20);
+    CHECK(table.get(IntTable::Handle()) == nullptr);
+    CHECK(!table.valid(IntTable::Handle()));
+}
+
+void testStaleAfterRemoveAndReuse() {
+    IntTable table;
+    IntTable::Handle a = table.insert(1);
+    int out = 0;
+    CHECK(table.remove(a, &out) && out == 1);
+    CHECK(!table.valid(a));
+    CHECK(table.get(a) == nullptr);
+    CHECK(!table.remove(a));
+
+    // The freed slot is reused with the next generation
+    IntTable::Handle b = table.insert(2);
+    CHECK((b.value & IntTable::kMaxEntries) ==
+          (a.value & IntTable::kMaxEntries));
+    CHECK(b != a);
+    CHECK(table.get(a) == nullptr);
+    CHECK(table.get(b) != nullptr && *table.get(b) == 2);
+    CHECK(table.size() == 1);
+}
+
+void testGenerationWrap() {
+    IntTable table;
+    const uint32_t generations = 1u << IntTable::kGenerationBits;
+    IntTable::Handle first = table.insert(0);
+    IntTable::Handle previous = first;
+    // Every generation of one slot, from 1 up through the wrap
+    for (uint32_t i = 1; i < generations + 2; ++i) {
+        CHECK(table.remove(previous));
+        IntTable::Handle next = table.insert(static_cast<int>(i));
+        CHECK(!next.isNull());
+        CHECK(next != previous);
+        CHECK(!table.valid(previous));
+        CHECK(*table.get(next) == static_cast<int>(i));
+        // Generation 0 is skipped, so the handle is never the null value
+        CHECK((next.value >> IntTable::kIndexBits) != 0);
+        previous = next;
+    }
+    // 4095 generations later the first one comes round again: the wrap is
+    // the documented limit of a 12-bit generation
+    CHECK(table.size() == 1);
+    CHECK((previous.value >> IntTable::kIndexBits) ==
+          (first.value >> IntTable::kIndexBits) + 2);
+}
+
+void testDenseSwapRemove() {
+    IntTable table;
+    std::vector<IntTable::Handle> handles;
+    for (int i = 0; i < 8; ++i) handles.push_back(table.insert(i));
+
+    // Removing from the middle moves the last value into the hole
+    CHECK(table.remove(handles[2]));
+    CHECK(table.size() == 7);
+    CHECK(table.begin()[2] == 7);
+    CHECK(*table.get(handles[7]) == 7);
+
+    // Removing the last value moves nothing
+    CHECK(table.remove(handles[7]));
+    CHECK(table.size() == 6);
+    CHECK(*table.get(handles[6]) == 6);
+
+    int sum = 0;
+    for (int v : table) sum += v;
+    CHECK(sum == 0 + 1 + 3 + 4 + 5 + 6);
+    for (int i : { 0, 1, 3, 4, 5, 6 }) {
+        CHECK(table.get(handles[i]) != nullptr &&
+              *table.get(handles[i]) == i);
+    }
+
+    // Emptying and refilling keeps every live handle resolving
+    for (int i : { 0, 1, 3, 4, 5, 6 }) CHECK(table.remove(handles[i]));
+    CHECK(table.size() == 0);
+    for (int i = 0; i < 8; ++i) handles[i] = table.insert(100 + i);
+    for (int i = 0; i < 8; ++i) CHECK(*table.get(handles[i]) == 100 + i);
+}
+
+void testCapacity() {
+    ResourceTable<uint8_t> table;
+    for (uint32_t i = 0; i < ResourceTable<uint8_t>::kMaxEntries; ++i) {
+        table.insert(0);
+    }
+    CHECK(table.insert(0).isNull());
+}
+
+// -----------------------------------------------------------------------------
+double msSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+// Lookups in a random order, as draws reference resources; each variant
+// sums the values so the loads cannot be dropped
+void bench(uint32_t entries) {
+    const uint32_t lookups = 1u << 24;
+    std::vector<std::unique_ptr<int>> objects;
+    for (uint32_t i = 0; i < entries; ++i) {
+        objects.push_back(std::make_unique<int>(static_cast<int>(i)));
+    }
+    std::mt19937 rng(1);
+    std::vector<uint32_t> order(lookups);
+    for (uint32_t& o : order) o = rng() % entries;
+
+    std::vector<int*> pointers;
+    ResourceTable<int*> table;
+    std::vector<ResourceTable<int*>::Handle> handles;
+    std::unordered_map<uint32_t, int*> map;
+    for (uint32_t i = 0; i < entries; ++i) {
+        pointers.push_back(objects[i].get());
+        handles.push_back(table.insert(objects[i].get()));
+        map.emplace(i, objects[i].get());
+    }
+
+    std::cerr << entries << " entries, " << lookups << " lookups"
+              << std::endl;
+    auto report = [&](const char* name, double ms, int64_t sum) {
+        std::cerr << "  " << name << ": " << ms << " ms, "
+                  << ms * 1e6 / lookups << " ns per lookup (sum " << sum
+                  << ")" << std::endl;
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    int64_t sum = 0;
+    for (uint32_t o : order) sum += *pointers[o];
+    report("raw pointer", msSince(start), sum);
+
+    std::vector<ResourceTable<int*>::Handle> ordered(lookups);
+    for (uint32_t i = 0; i < lookups; ++i) ordered[i] = handles[order[i]];
+    start = std::chrono::steady_clock::now();
+    sum = 0;
+    for (ResourceTable<int*>::Handle handle : ordered) {
+        int* const* object = table.get(handle);
+        if (object != nullptr) sum += **object;
+    }
+    report("handle table", msSince(start), sum);
+
+    start = std::chrono::steady_clock::now();
+    sum = 0;
+    for (uint32_t o : order) {
+        auto found = map.find(o);
+        if (found != map.end()) sum += *found->second;
+    }
+    report("unordered_map", msSince(start), sum);
+}
+
+} // namespace
+
+// -----------------------------------------------------------------------------
+int main(int argc, char* argv[]) {
+    if (argc == 3 && strcmp(argv[1], "--bench") == 0) {
+        bench(std::max(1, atoi(argv[2])));
+        return 0;
+    }
+
+    testInsertGet();
+    testStaleAfterRemoveAndReuse();
+    testGenerationWrap();
+    testDenseSwapRemove();
+    testCapacity();
+    return testResult("resource_table");
+}
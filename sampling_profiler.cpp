@@ -0,0 +1,509 @@
+#include "sampling_profiler.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <map>
+
+#ifdef __linux__
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+#elif defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#include <dbghelp.h>
+
+#pragma comment(lib, "dbghelp.lib")
+#pragma comment(lib, "winmm.lib")
+#endif
+
+namespace {
+
+// Slot of the calling thread in SamplingProfiler::threads_, -1 if unregistered
+thread_local int tlsThreadSlot = -1;
+
+}  // namespace
+
+void recordSignalSample(void* ucontext);
+
+// -----------------------------------------------------------------------------
+SamplingProfiler& samplingProfiler() {
+    static SamplingProfiler instance;
+    return instance;
+}
+
+SamplingProfiler::SamplingProfiler()
+    : sampleIndex_(0),
+      dropped_(0),
+      running_(false),
+      frequencyHz_(0) {
+}
+
+SamplingProfiler::~SamplingProfiler() {
+    stop();
+}
+
+SamplingProfiler::Sample* SamplingProfiler::claimSample() {
+    size_t index = sampleIndex_.fetch_add(1, std::memory_order_relaxed);
+    if (index >= samples_.size()) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    return &samples_[index];
+}
+
+size_t SamplingProfiler::sampleCount() const {
+    return std::min(sampleIndex_.load(), samples_.size());
+}
+
+void SamplingProfiler::registerCurrentThread(const char* name) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (int i = 0; i < kMaxThreads; ++i) {
+        ThreadSlot& slot = threads_[i];
+        if (slot.active) continue;
+
+        slot = ThreadSlot();
+        slot.name = name;
+        slot.active = true;
+#ifdef __linux__
+        slot.tid = static_cast<int>(syscall(SYS_gettid));
+        pthread_getcpuclockid(pthread_self(), &slot.cpuClock);
+#elif defined(_WIN32)
+        HANDLE handle = nullptr;
+        DuplicateHandle(GetCurrentProcess(), GetCurrentThread(),
+                        GetCurrentProcess(), &handle,
+                        THREAD_SUSPEND_RESUME | THREAD_GET_CONTEXT |
+                        THREAD_QUERY_INFORMATION, FALSE, 0);
+        slot.handle = handle;
+#endif
+        tlsThreadSlot = i;
+        if (running_) armThread(slot);
+        return;
+    }
+    std::cerr << "Sampling profiler: too many threads" << std::endl;
+}
+
+void SamplingProfiler::unregisterCurrentThread() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (tlsThreadSlot < 0) return;
+
+    ThreadSlot& slot = threads_[tlsThreadSlot];
+    disarmThread(slot);
+#ifdef _WIN32
+    CloseHandle(slot.handle);
+    slot.handle = nullptr;
+#endif
+    slot.active = false;
+    tlsThreadSlot = -1;
+}
+
+bool SamplingProfiler::start(int frequencyHz) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (running_ || frequencyHz <= 0) return false;
+
+    samples_.assign(kMaxSamples, Sample());
+    sampleIndex_ = 0;
+    dropped_ = 0;
+    frequencyHz_ = frequencyHz;
+
+#ifdef __linux__
+    // backtrace() loads libgcc lazily; do that here, not inside the handler.
+    void* warmup[1];
+    backtrace(warmup, 1);
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = [](int, siginfo_t*, void* ucontext) {
+        recordSignalSample(ucontext);
+    };
+    action.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGPROF, &action, nullptr) != 0) {
+        std::cerr << "Sampling profiler: sigaction failed" << std::endl;
+        return false;
+    }
+
+    running_ = true;
+    for (ThreadSlot& slot : threads_) {
+        if (slot.active) armThread(slot);
+    }
+#elif defined(_WIN32)
+    SymSetOptions(SYMOPT_UNDNAME | SYMOPT_DEFERRED_LOADS);
+    SymInitialize(GetCurrentProcess(), nullptr, TRUE);
+
+    running_ = true;
+    sampler_ = std::thread(&SamplingProfiler::samplerMain, this);
+#else
+    return false;
+#endif
+    return true;
+}
+
+void SamplingProfiler::stop() {
+#ifdef _WIN32
+    running_ = false;
+    if (sampler_.joinable()) {
+        sampler_.join();
+    }
+#endif
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    running_ = false;
+    for (ThreadSlot& slot : threads_) {
+        if (slot.active) disarmThread(slot);
+    }
+}
+
+#ifdef __linux__
+
+void recordSignalSample(void* ucontext) {
+    SamplingProfiler& profiler = samplingProfiler();
+    if (tlsThreadSlot < 0 || !profiler.running_) return;
+
+    SamplingProfiler::Sample* sample = profiler.claimSample();
+    if (sample == nullptr) return;
+
+    // Drop the handler and signal trampoline frames: the interrupted
+    // function starts at the program counter saved in the signal context.
+    const int kMaxFrames = SamplingProfiler::kMaxDepth + 3;
+    void* frames[kMaxFrames];
+    int depth = backtrace(frames, kMaxFrames);
+    void* pc = nullptr;
+#if defined(__x86_64__)
+    pc = reinterpret_cast<void*>(
+        static_cast<ucontext_t*>(ucontext)->uc_mcontext.gregs[REG_RIP]);
+#elif defined(__aarch64__)
+    pc = reinterpret_cast<void*>(
+        static_cast<ucontext_t*>(ucontext)->uc_mcontext.pc);
+#endif
+    int skip = std::min(depth, 3);
+    for (int i = 0; i < depth; ++i) {
+        if (frames[i] == pc) {
+            skip = i;
+            break;
+        }
+    }
+    depth = std::min(depth, skip + SamplingProfiler::kMaxDepth);
+
+    sample->thread = static_cast<uint32_t>(tlsThreadSlot);
+    sample->depth = static_cast<uint32_t>(depth - skip);
+    memcpy(sample->frames, frames + skip, sizeof(void*) * (depth - skip));
+}
+
+void SamplingProfiler::armThread(ThreadSlot& slot) {
+    sigevent event;
+    memset(&event, 0, sizeof(event));
+    event.sigev_notify = SIGEV_THREAD_ID;
+    event.sigev_signo = SIGPROF;
+    event.sigev_notify_thread_id = slot.tid;
+
+    // Per-thread CPU clock so idle or blocked threads do not produce samples
+    if (timer_create(slot.cpuClock, &event, &slot.timer) != 0) {
+        std::cerr << "Sampling profiler: timer_create failed for "
+                  << slot.name << std::endl;
+        return;
+    }
+
+    long periodNs = 1000000000L / frequencyHz_;
+    itimerspec spec;
+    spec.it_interval.tv_sec = periodNs / 1000000000L;
+    spec.it_interval.tv_nsec = periodNs % 1000000000L;
+    spec.it_value = spec.it_interval;
+    timer_settime(slot.timer, 0, &spec, nullptr);
+    slot.hasTimer = true;
+}
+
+void SamplingProfiler::disarmThread(ThreadSlot& slot) {
+    if (!slot.hasTimer) return;
+    timer_delete(slot.timer);
+    slot.hasTimer = false;
+}
+
+#elif defined(_WIN32)
+
+void SamplingProfiler::armThread(ThreadSlot&) {
+}
+
+void SamplingProfiler::disarmThread(ThreadSlot&) {
+}
+
+void SamplingProfiler::samplerMain() {
+    timeBeginPeriod(1);
+    DWORD periodMs = std::max<DWORD>(1, 1000 / frequencyHz_);
+
+    while (running_) {
+        Sleep(periodMs);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (uint32_t i = 0; i < kMaxThreads; ++i) {
+            ThreadSlot& slot = threads_[i];
+            if (!slot.active) continue;
+
+            // Nothing may allocate while the thread is suspended: it could
+            // hold the heap lock.
+            Sample* sample = claimSample();
+            if (sample == nullptr) break;
+
+            if (SuspendThread(slot.handle) == static_cast<DWORD>(-1)) {
+                sample->depth = 0;
+                continue;
+            }
+
+            CONTEXT context = {};
+            context.ContextFlags = CONTEXT_FULL;
+            uint32_t depth = 0;
+            if (GetThreadContext(slot.handle, &context)) {
+#if defined(_M_X64)
+                while (depth < kMaxDepth && context.Rip != 0) {
+                    sample->frames[depth++] =
+                        reinterpret_cast<void*>(context.Rip);
+
+                    DWORD64 imageBase = 0;
+                    PRUNTIME_FUNCTION function =
+                        RtlLookupFunctionEntry(context.Rip, &imageBase,
+                                               nullptr);
+                    if (function == nullptr) {
+                        // Leaf function: return address is at the top of stack
+                        context.Rip = *reinterpret_cast<DWORD64*>(context.Rsp);
+                        context.Rsp += 8;
+                    } else {
+                        void* handlerData = nullptr;
+                        DWORD64 establisherFrame = 0;
+                        RtlVirtualUnwind(UNW_FLAG_NHANDLER, imageBase,
+                                         context.Rip, function, &context,
+                                         &handlerData, &establisherFrame,
+                                         nullptr);
+                    }
+                }
+#endif
+            }
+            ResumeThread(slot.handle);
+
+            sample->thread = i;
+            sample->depth = depth;
+        }
+    }
+
+    timeEndPeriod(1);
+}
+
+#else
+
+void SamplingProfiler::armThread(ThreadSlot&) {
+}
+
+void SamplingProfiler::disarmThread(ThreadSlot&) {
+}
+
+#endif
+
+// -----------------------------------------------------------------------------
+namespace {
+
+std::string symbolName(void* address) {
+    char buffer[64];
+#ifdef __linux__
+    Dl_info info;
+    if (dladdr(address, &info) && info.dli_sname != nullptr) {
+        int status = 0;
+        char* demangled = abi::__cxa_demangle(info.dli_sname, nullptr,
+                                              nullptr, &status);
+        std::string name = status == 0 ? demangled : info.dli_sname;
+        free(demangled);
+        return name;
+    }
+#elif defined(_WIN32)
+    alignas(SYMBOL_INFO) char symbolBuffer[sizeof(SYMBOL_INFO) + 256];
+    SYMBOL_INFO* symbol = reinterpret_cast<SYMBOL_INFO*>(symbolBuffer);
+    symbol->SizeOfStruct = sizeof(SYMBOL_INFO);
+    symbol->MaxNameLen = 255;
+    DWORD64 displacement = 0;
+    if (SymFromAddr(GetCurrentProcess(),
+                    reinterpret_cast<DWORD64>(address),
+                    &displacement, symbol)) {
+        return symbol->Name;
+    }
+#endif
+    snprintf(buffer, sizeof(buffer), "0x%llx",
+             static_cast<unsigned long long>(
+                 reinterpret_cast<uintptr_t>(address)));
+    return buffer;
+}
+
+std::string escapeXml(const std::string& text) {
+    std::string escaped;
+    for (char c : text) {
+        if (c == '<') escaped += "&lt;";
+        else if (c == '>') escaped += "&gt;";
+        else if (c == '&') escaped += "&amp;";
+        else escaped += c;
+    }
+    return escaped;
+}
+
+}  // namespace
+
+std::vector<std::pair<std::string, uint64_t>>
+SamplingProfiler::foldStacks() const {
+    std::map<void*, std::string> symbols;
+    std::map<std::string, uint64_t> folded;
+
+    size_t count = sampleCount();
+    for (size_t i = 0; i < count; ++i) {
+        const Sample& sample = samples_[i];
+        if (sample.depth == 0) continue;
+
+        std::string stack = threads_[sample.thread].name;
+        for (int d = static_cast<int>(sample.depth) - 1; d >= 0; --d) {
+            void* frame = sample.frames[d];
+            auto it = symbols.find(frame);
+            if (it == symbols.end()) {
+                it = symbols.emplace(frame, symbolName(frame)).first;
+            }
+            stack += ';';
+            stack += it->second;
+        }
+        ++folded[stack];
+    }
+
+    return std::vector<std::pair<std::string, uint64_t>>(folded.begin(),
+                                                         folded.end());
+}
+
+bool SamplingProfiler::writeFolded(const std::string& path) const {
+    FILE* file = fopen(path.c_str(), "w");
+    if (file == nullptr) {
+        std::cerr << "Failed to open " << path << std::endl;
+        return false;
+    }
+
+    for (const auto& entry : foldStacks()) {
+        fprintf(file, "%s %llu\n", entry.first.c_str(),
+                static_cast<unsigned long long>(entry.second));
+    }
+    fclose(file);
+    return true;
+}
+
+bool SamplingProfiler::writeFlamegraph(const std::string& path) const {
+    struct Node {
+        std::string name;
+        uint64_t samples = 0;
+        std::map<std::string, size_t> children;
+    };
+
+    // Merge folded stacks into a call tree rooted at "all"
+    std::vector<Node> nodes(1);
+    nodes[0].name = "all";
+    size_t maxDepth = 0;
+    for (const auto& entry : foldStacks()) {
+        size_t node = 0;
+        size_t depth = 0;
+        nodes[0].samples += entry.second;
+
+        size_t begin = 0;
+        while (begin <= entry.first.size()) {
+            size_t end = entry.first.find(';', begin);
+            if (end == std::string::npos) end = entry.first.size();
+            std::string frame = entry.first.substr(begin, end - begin);
+            begin = end + 1;
+
+            auto it = nodes[node].children.find(frame);
+            size_t child;
+            if (it == nodes[node].children.end()) {
+                child = nodes.size();
+                nodes[node].children.emplace(frame, child);
+                nodes.emplace_back();
+                nodes.back().name = frame;
+            } else {
+                child = it->second;
+            }
+            nodes[child].samples += entry.second;
+            node = child;
+            maxDepth = std::max(maxDepth, ++depth);
+        }
+    }
+
+    FILE* file = fopen(path.c_str(), "w");
+    if (file == nullptr) {
+        std::cerr << "Failed to open " << path << std::endl;
+        return false;
+    }
+
+    const double width = 1200.0;
+    const int rowHeight = 16;
+    int height = static_cast<int>(maxDepth + 1) * rowHeight;
+    fprintf(file,
+            "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"%.0f\" "
+            "height=\"%d\" font-family=\"monospace\" font-size=\"11\">\n",
+            width, height);
+
+    double total = static_cast<double>(std::max<uint64_t>(1, nodes[0].samples));
+    struct Pending { size_t node; double x; int depth; };
+    std::vector<Pending> stack = { { 0, 0.0, 0 } };
+    while (!stack.empty()) {
+        Pending p = stack.back();
+        stack.pop_back();
+
+        const Node& n = nodes[p.node];
+        double w = width * n.samples / total;
+        if (w < 0.5) continue;
+
+        // Root at the bottom, callees stacked above
+        int y = height - (p.depth + 1) * rowHeight;
+        unsigned hash = 0;
+        for (char c : n.name) hash = hash * 31 + static_cast<unsigned char>(c);
+
+        std::string label = escapeXml(n.name);
+        fprintf(file,
+                "<g><title>%s (%llu samples, %.2f%%)</title>"
+                "<rect x=\"%.2f\" y=\"%d\" width=\"%.2f\" height=\"%d\" "
+                "fill=\"rgb(%u,%u,60)\"/>",
+                label.c_str(), static_cast<unsigned long long>(n.samples),
+                100.0 * n.samples / total, p.x, y, w, rowHeight - 1,
+                200 + hash % 55, 80 + (hash >> 8) % 120);
+        if (w > 40.0) {
+            // Cut the name, not the escaped label, so no entity is split
+            size_t chars = static_cast<size_t>(w / 7.0);
+            std::string text = escapeXml(n.name.substr(0, chars));
+            fprintf(file, "<text x=\"%.2f\" y=\"%d\">%s</text>",
+                    p.x + 2.0, y + rowHeight - 4, text.c_str());
+        }
+        fprintf(file, "</g>\n");
+
+        double x = p.x;
+        for (const auto& child : n.children) {
+            stack.push_back({ child.second, x, p.depth + 1 });
+            x += width * nodes[child.second].samples / total;
+        }
+    }
+
+    fprintf(file, "</svg>\n");
+    fclose(file);
+    return true;
+}
+
+bool SamplingProfiler::stopAndWrite(const std::string& prefix) {
+    stop();
+    bool ok = writeFolded(prefix + ".folded");
+    ok = writeFlamegraph(prefix + ".svg") && ok;
+    std::cerr << sampleCount() << " samples written to " << prefix
+              << ".folded/.svg";
+    if (droppedSamples() > 0) {
+        std::cerr << ", " << droppedSamples() << " dropped past "
+                  << kMaxSamples;
+    }
+    std::cerr << std::endl;
+    return ok;
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+// Statistical CPU profiler for registered threads. On Linux each thread gets a
+// CPU-time timer delivering SIGPROF and the handler records a backtrace; on
+// Windows (x64) a sampler thread suspends each thread and unwinds its stack.
+// Samples are aggregated into folded stacks ("thread;outer;...;leaf count")
+// and an SVG flamegraph when profiling stops.
+class SamplingProfiler {
+ public:
+    static constexpr int kMaxDepth = 48;
+    static constexpr size_t kMaxSamples = 1 << 15;
+    static constexpr int kMaxThreads = 16;
+
+    SamplingProfiler();
+    ~SamplingProfiler();
+
+    // Threads may register before or after start().
+    void registerCurrentThread(const char* name);
+    void unregisterCurrentThread();
+
+    bool start(int frequencyHz);
+    void stop();
+    bool running() const { return running_; }
+
+    size_t sampleCount() const;
+    uint64_t droppedSamples() const { return dropped_.load(); }
+
+    bool writeFolded(const std::string& path) const;
+    bool writeFlamegraph(const std::string& path) const;
+
+    // Stops, writes <prefix>.folded and <prefix>.svg and prints the number
+    // of samples, and of samples dropped once kMaxSamples were taken.
+    bool stopAndWrite(const std::string& prefix);
+
+ private:
+    struct Sample {
+        uint32_t thread;
+        uint32_t depth;
+        void* frames[kMaxDepth];   // leaf first
+    };
+
+    struct ThreadSlot {
+        std::string name;
+        bool active = false;
+#ifdef __linux__
+        int tid = 0;
+        clockid_t cpuClock = {};
+        timer_t timer = {};
+        bool hasTimer = false;
+#elif defined(_WIN32)
+        void* handle = nullptr;
+#endif
+    };
+
+    // Async-signal-safe: claims a slot with one atomic increment.
+    Sample* claimSample();
+    void armThread(ThreadSlot& slot);
+    void disarmThread(ThreadSlot& slot);
+    std::vector<std::pair<std::string, uint64_t>> foldStacks() const;
+
+    friend void recordSignalSample(void* ucontext);
+
+#ifdef _WIN32
+    void samplerMain();
+    std::thread sampler_;
+#endif
+
+    std::vector<Sample> samples_;
+    std::atomic<size_t> sampleIndex_;
+    std::atomic<uint64_t> dropped_;
+    ThreadSlot threads_[kMaxThreads];
+    mutable std::mutex mutex_;
+    std::atomic<bool> running_;
+    int frequencyHz_;
+};
+
+SamplingProfiler& samplingProfiler();
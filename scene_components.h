@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+
+#include "math_types.h"
+#include "scene_graph.h"
+
+// -----------------------------------------------------------------------------
+// Components of the objects the renderer draws. The scene graph owns the
+// transform hierarchy; entities mirror the world transform and bounds of
+// their node so queries over drawable objects stay within the chunk arrays.
+struct SceneNode {
+    NodeId node;
+};
+
+struct WorldTransform {
+    Matrix4 world;
+};
+
+struct WorldBounds {
+    Bounds bounds;
+};
+
+struct MeshRef {
+    uint32_t mesh;
+};
+
+struct MaterialRef {
+    uint32_t material;
+};
+
+// Row in the instance buffer
+struct InstanceSlot {
+    uint32_t index;
+};
+
+// Set for one update when WorldTransform changed
+struct Moved {
+    uint8_t moved;
+};
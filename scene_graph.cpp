@@ -0,0 +1,196 @@
+#include "scene_graph.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+
+#include "job_system.h"
+
+namespace {
+
+// Below this many nodes per range the job hand-off costs more than it saves
+constexpr uint32_t kMinGrain = 4096;
+
+// Ranges per worker, so uneven subtrees still balance
+constexpr uint32_t kBatchesPerWorker = 4;
+
+template <typename T>
+void permute(std::vector<T>& values, const std::vector<uint32_t>& order) {
+    std::vector<T> sorted(values.size());
+    for (uint32_t i = 0; i < order.size(); ++i) sorted[i] = values[order[i]];
+    values.swap(sorted);
+}
+
+} // namespace
+
+// -----------------------------------------------------------------------------
+NodeId SceneGraph::create(NodeId parent, const Matrix4& local) {
+    NodeId id = static_cast<NodeId>(indexOf_.size());
+    uint32_t index = size();
+    indexOf_.push_back(index);
+    idAt_.push_back(id);
+    parent_.push_back(parent == kNoParent ? kNoParent : indexOf_[parent]);
+    subtreeEnd_.push_back(index + 1);
+    local_.push_back(local);
+    world_.push_back(local);
+    dirty_.push_back(1);
+    changed_.push_back(0);
+
+    sorted_ = false;
+    anyDirty_ = true;
+    return id;
+}
+
+void SceneGraph::setLocal(NodeId node, const Matrix4& local) {
+    uint32_t index = indexOf_[node];
+    local_[index] = local;
+    dirty_[index] = 1;
+    anyDirty_ = true;
+}
+
+void SceneGraph::update() {
+    if (!sorted_) {
+        sortDepthFirst();
+        partition();
+    }
+
+    if (!anyDirty_) {
+        memset(changed_.data(), 0, changed_.size());
+        return;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    uint32_t updated = 0;
+
+    if (jobSystem().workerCount() == 0 || batches_.size() < 2) {
+        updated = updateRange(0, size());
+    } else {
+        for (uint32_t index : spine_) {
+            updated += updateRange(index, index + 1);
+        }
+
+        std::atomic<uint32_t> rangeUpdated{0};
+        jobSystem().parallelFor(
+            static_cast<uint32_t>(batches_.size()), 1,
+            [this, &rangeUpdated](uint32_t begin, uint32_t end) {
+                uint32_t count = 0;
+                for (uint32_t b = begin; b < end; ++b) {
+                    count += updateRange(batches_[b].begin, batches_[b].end);
+                }
+                rangeUpdated += count;
+            });
+        updated += rangeUpdated;
+    }
+
+    anyDirty_ = false;
+    ++stats_.updates;
+    stats_.nodesUpdated += updated;
+    stats_.updateMs += std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+// Parents outside [begin, end) must already be up to date
+uint32_t SceneGraph::updateRange(uint32_t begin, uint32_t end) {
+    uint32_t count = 0;
+    for (uint32_t i = begin; i < end; ++i) {
+        uint32_t parent = parent_[i];
+        bool inherited = parent != kNoParent && changed_[parent];
+        changed_[i] = dirty_[i] | inherited;
+        if (!changed_[i]) continue;
+
+        world_[i] = parent == kNoParent ? local_[i]
+                                        : local_[i] * world_[parent];
+        dirty_[i] = 0;
+        ++count;
+    }
+    return count;
+}
+
+void SceneGraph::sortDepthFirst() {
+    uint32_t n = size();
+
+    // Children of each node in creation order, as offsets into one array
+    std::vector<uint32_t> childStart(n + 1, 0);
+    for (uint32_t i = 0; i < n; ++i) {
+        if (parent_[i] != kNoParent) ++childStart[parent_[i] + 1];
+    }
+    for (uint32_t i = 0; i < n; ++i) childStart[i + 1] += childStart[i];
+    std::vector<uint32_t> children(childStart[n]);
+    std::vector<uint32_t> fill(childStart.begin(), childStart.end() - 1);
+    for (uint32_t i = 0; i < n; ++i) {
+        if (parent_[i] != kNoParent) children[fill[parent_[i]]++] = i;
+    }
+
+    // Pre-order walk; children are pushed in reverse to keep their order
+    std::vector<uint32_t> order;
+    order.reserve(n);
+    std::vector<uint32_t> stack;
+    for (uint32_t root = 0; root < n; ++root) {
+        if (parent_[root] != kNoParent) continue;
+        stack.push_back(root);
+        while (!stack.empty()) {
+            uint32_t node = stack.back();
+            stack.pop_back();
+            order.push_back(node);
+            for (uint32_t c = childStart[node + 1]; c > childStart[node]; --c) {
+                stack.push_back(children[c - 1]);
+            }
+        }
+    }
+
+    std::vector<uint32_t> newIndex(n);
+    for (uint32_t i = 0; i < n; ++i) newIndex[order[i]] = i;
+
+    std::vector<uint32_t> parent(n);
+    for (uint32_t i = 0; i < n; ++i) {
+        uint32_t old = parent_[order[i]];
+        parent[i] = old == kNoParent ? kNoParent : newIndex[old];
+    }
+    parent_.swap(parent);
+    permute(local_, order);
+    permute(world_, order);
+    permute(dirty_, order);
+    permute(changed_, order);
+    permute(idAt_, order);
+    for (uint32_t i = 0; i < n; ++i) indexOf_[idAt_[i]] = i;
+
+    // Children follow their parent, so one backward pass sizes every subtree
+    for (uint32_t i = 0; i < n; ++i) subtreeEnd_[i] = i + 1;
+    for (uint32_t i = n; i-- > 0;) {
+        if (parent_[i] != kNoParent) {
+            subtreeEnd_[parent_[i]] =
+                std::max(subtreeEnd_[parent_[i]], subtreeEnd_[i]);
+        }
+    }
+
+    sorted_ = true;
+}
+
+// Subtrees no larger than the grain become ranges, merging adjacent ones;
+// nodes above them form the serial spine.
+void SceneGraph::partition() {
+    spine_.clear();
+    batches_.clear();
+
+    uint32_t workers = std::max(1, jobSystem().workerCount());
+    uint32_t grain = std::max(kMinGrain,
+                              size() / (workers * kBatchesPerWorker));
+
+    uint32_t i = 0;
+    while (i < size()) {
+        uint32_t end = subtreeEnd_[i];
+        if (end - i > grain) {
+            spine_.push_back(i);
+            ++i;
+            continue;
+        }
+        if (!batches_.empty() && batches_.back().end == i &&
+            end - batches_.back().begin <= grain) {
+            batches_.back().end = end;
+        } else {
+            batches_.push_back({ i, end });
+        }
+        i = end;
+    }
+}
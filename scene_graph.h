@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "math_types.h"
+
+// -----------------------------------------------------------------------------
+// Transform hierarchy in flat arrays sorted depth-first, so every parent
+// precedes its children and every subtree is a contiguous range. update()
+// is then a single forward pass: a node is recomputed if it was dirty or its
+// parent was recomputed this pass, and clean subtrees cost one flag test per
+// node. Large hierarchies are split into independent subtree ranges that
+// run on the job system; the nodes above them are done first, serially.
+//
+// Nodes are referenced by stable ids; creating nodes re-sorts the arrays on
+// the next update(). Not thread-safe.
+typedef uint32_t NodeId;
+
+struct SceneGraphStats {
+    uint64_t updates = 0;
+    uint64_t nodesUpdated = 0;
+    double updateMs = 0.0;
+};
+
+class SceneGraph {
+ public:
+    static constexpr NodeId kNoParent = ~0u;
+
+    NodeId create(NodeId parent, const Matrix4& local);
+
+    void setLocal(NodeId node, const Matrix4& local);
+    const Matrix4& local(NodeId node) const { return local_[indexOf_[node]]; }
+    const Matrix4& world(NodeId node) const { return world_[indexOf_[node]]; }
+
+    // Whether the node's world transform changed in the last update()
+    bool changed(NodeId node) const { return changed_[indexOf_[node]] != 0; }
+
+    uint32_t size() const { return static_cast<uint32_t>(parent_.size()); }
+
+    void update();
+
+    const SceneGraphStats& stats() const { return stats_; }
+
+ private:
+    struct Range {
+        uint32_t begin;
+        uint32_t end;
+    };
+
+    void sortDepthFirst();
+    void partition();
+    uint32_t updateRange(uint32_t begin, uint32_t end);
+
+    // Indexed by depth-first position
+    std::vector<uint32_t> parent_;
+    std::vector<uint32_t> subtreeEnd_;
+    std::vector<Matrix4> local_;
+    std::vector<Matrix4> world_;
+    std::vector<uint8_t> dirty_;
+    std::vector<uint8_t> changed_;
+    std::vector<NodeId> idAt_;
+
+    // Indexed by id
+    std::vector<uint32_t> indexOf_;
+
+    // Serial prefix and parallel subtree ranges, from partition()
+    std::vector<uint32_t> spine_;
+    std::vector<Range> batches_;
+
+    bool sorted_ = true;
+    bool anyDirty_ = false;
+    SceneGraphStats stats_;
+};
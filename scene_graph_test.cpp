@@ -0,0 +1,253 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "job_system.h"
+#include "scene_graph.h"
+#include "test_check.h"
+
+// -----------------------------------------------------------------------------
+// Tests for SceneGraph: world transforms after update() against a plain
+// recursive walk of the same hierarchy, serially and split across workers,
+// after the first build, after edits to scattered nodes, after new nodes
+// force a re-sort and after a deep chain is hung under it; changed()
+// holding for exactly the edited nodes and their descendants; and an
+// update with nothing dirty touching nothing. With --bench it builds a
+// million-node hierarchy and prints updates per second with every root
+// moved and with 1% of nodes moved, serially and on the job system.
+//
+//   SceneGraphTest [--bench <updates>]
+namespace {
+
+// The hierarchy as the test built it, by id
+struct Reference {
+    std::vector<NodeId> parent;
+    std::vector<Matrix4> local;
+    std::vector<Matrix4> world;
+    std::vector<bool> known;
+
+    const Matrix4& worldOf(NodeId id) {
+        if (!known[id]) {
+            world[id] = parent[id] == SceneGraph::kNoParent
+                ? local[id] : local[id] * worldOf(parent[id]);
+            known[id] = true;
+        }
+        return world[id];
+    }
+
+    void invalidate() { known.assign(parent.size(), false); }
+};
+
+Matrix4 randomLocal(std::mt19937& rng) {
+    std::uniform_real_distribution<float> angle(-3.14159f, 3.14159f);
+    std::uniform_real_distribution<float> offset(-2.0f, 2.0f);
+    std::uniform_real_distribution<float> scale(0.9f, 1.1f);
+    float s = scale(rng);
+    return Matrix4::scaling(s, s, s) * Matrix4::rotationZ(angle(rng)) *
+           Matrix4::translation(offset(rng), offset(rng), offset(rng));
+}
+
+// Under a random earlier node, or a new root one time in `rootEvery`
+NodeId add(SceneGraph& graph, Reference& ref, std::mt19937& rng,
+           uint32_t rootEvery) {
+    NodeId parent = SceneGraph::kNoParent;
+    if (!ref.parent.empty() && rng() % rootEvery != 0) {
+        parent = static_cast<NodeId>(rng() % ref.parent.size());
+    }
+    Matrix4 local = randomLocal(rng);
+    NodeId id = graph.create(parent, local);
+    ref.parent.push_back(parent);
+    ref.local.push_back(local);
+    ref.world.push_back(Matrix4());
+    ref.known.push_back(false);
+    return id;
+}
+
+bool close(const Matrix4& a, const Matrix4& b) {
+    for (int i = 0; i < 4; ++i) {
+        for (int j = 0; j < 4; ++j) {
+            float tolerance = 1e-4f * (1.0f + std::fabs(b.m[i][j]));
+            if (std::fabs(a.m[i][j] - b.m[i][j]) > tolerance) return false;
+        }
+    }
+    return true;
+}
+
+void checkWorlds(SceneGraph& graph, Reference& ref, int line) {
+    ref.invalidate();
+    bool match = graph.size() == ref.parent.size();
+    for (NodeId id = 0; match && id < ref.parent.size(); ++id) {
+        match = close(graph.world(id), ref.worldOf(id));
+    }
+    CHECK_AT(match, "world transforms match the recursive walk", line);
+}
+
+// Parents are created first, so one pass in id order sees every parent's
+// answer before its children's
+void checkChanged(const SceneGraph& graph, const Reference& ref,
+                  const std::vector<bool>& edited, int line) {
+    std::vector<bool> expected(ref.parent.size());
+    bool match = true;
+    for (NodeId id = 0; id < ref.parent.size(); ++id) {
+        NodeId parent = ref.parent[id];
+        expected[id] = edited[id] ||
+                       (parent != SceneGraph::kNoParent && expected[parent]);
+        match &= graph.changed(id) == expected[id];
+    }
+    CHECK_AT(match, "changed() marks edited nodes and descendants", line);
+}
+
+void run(uint32_t nodes) {
+    std::mt19937 rng(nodes);
+    SceneGraph graph;
+    Reference ref;
+    for (uint32_t i = 0; i < nodes; ++i) add(graph, ref, rng, 500);
+    graph.update();
+    checkWorlds(graph, ref, __LINE__);
+    CHECK(graph.stats().nodesUpdated == nodes);
+
+    // Scattered edits: only they and their subtrees change
+    for (int round = 0; round < 3; ++round) {
+        std::vector<bool> edited(ref.parent.size(), false);
+        uint64_t before = graph.stats().nodesUpdated;
+        for (uint32_t e = 0; e < nodes / 50; ++e) {
+            NodeId id = static_cast<NodeId>(rng() % ref.parent.size());
+            ref.local[id] = randomLocal(rng);
+            graph.setLocal(id, ref.local[id]);
+            edited[id] = true;
+        }
+        graph.update();
+        checkWorlds(graph, ref, __LINE__);
+        checkChanged(graph, ref, edited, __LINE__);
+        uint64_t changed = 0;
+        for (NodeId id = 0; id < ref.parent.size(); ++id) {
+            changed += graph.changed(id) ? 1 : 0;
+        }
+        CHECK(graph.stats().nodesUpdated - before == changed);
+    }
+
+    // New nodes under old ones re-sort the arrays; ids stay put
+    std::vector<bool> edited(ref.parent.size(), false);
+    for (uint32_t i = 0; i < nodes / 4; ++i) {
+        add(graph, ref, rng, 500);
+        edited.push_back(true);
+    }
+    graph.update();
+    checkWorlds(graph, ref, __LINE__);
+    checkChanged(graph, ref, edited, __LINE__);
+
+    // A chain far deeper than any subtree grain, edited at its top
+    NodeId top = static_cast<NodeId>(rng() % ref.parent.size());
+    NodeId link = top;
+    for (uint32_t depth = 0; depth < 5000; ++depth) {
+        Matrix4 local = Matrix4::rotationZ(0.001f) *
+                        Matrix4::translation(0.001f, 0.0f, 0.0f);
+        ref.parent.push_back(link);
+        link = graph.create(link, local);
+        ref.local.push_back(local);
+        ref.world.push_back(Matrix4());
+        ref.known.push_back(false);
+    }
+    ref.local[top] = randomLocal(rng);
+    graph.setLocal(top, ref.local[top]);
+    graph.update();
+    checkWorlds(graph, ref, __LINE__);
+    CHECK(graph.changed(link));
+
+    // Nothing dirty: nothing changes
+    uint64_t before = graph.stats().nodesUpdated;
+    graph.update();
+    CHECK(graph.stats().nodesUpdated == before);
+    checkChanged(graph, ref, std::vector<bool>(ref.parent.size(), false),
+                 __LINE__);
+    checkWorlds(graph, ref, __LINE__);
+}
+
+void testSerial() {
+    run(1000);
+    run(30000);
+}
+
+// Enough nodes that partition() splits them into subtree ranges
+void testWorkers() {
+    jobSystem().start(3);
+    run(30000);
+    run(100000);
+    jobSystem().stop();
+}
+
+// -----------------------------------------------------------------------------
+// A million nodes, each under a random earlier node or, one time in a
+// thousand, a new root
+void benchRun(uint32_t updates, const char* label) {
+    std::mt19937 rng(1);
+    SceneGraph graph;
+    Reference ref;
+    const uint32_t nodes = 1000000;
+    std::vector<NodeId> roots;
+    for (uint32_t i = 0; i < nodes; ++i) {
+        NodeId id = add(graph, ref, rng, 1000);
+        if (ref.parent[id] == SceneGraph::kNoParent) roots.push_back(id);
+    }
+    graph.update();
+
+    for (int moved = 0; moved < 2; ++moved) {
+        SceneGraphStats before = graph.stats();
+        auto start = std::chrono::steady_clock::now();
+        for (uint32_t u = 0; u < updates; ++u) {
+            if (moved == 0) {
+                for (NodeId root : roots) {
+                    graph.setLocal(root, Matrix4::translation(
+                        float(u), 0.0f, 0.0f));
+                }
+            } else {
+                for (uint32_t e = 0; e < nodes / 100; ++e) {
+                    NodeId id = static_cast<NodeId>(rng() % nodes);
+                    graph.setLocal(id, ref.local[id]);
+                }
+            }
+            graph.update();
+        }
+        double ms = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - start).count();
+        const SceneGraphStats& after = graph.stats();
+        std::cerr << "  " << label << ", "
+                  << (moved == 0 ? "every root moved" : "1% of nodes moved")
+                  << ": " << updates * 1000.0 / ms << " updates/s ("
+                  << (after.updateMs - before.updateMs) / updates
+                  << " ms in update()), "
+                  << (after.nodesUpdated - before.nodesUpdated) / updates
+                  << " nodes recomputed per update" << std::endl;
+    }
+}
+
+void bench(uint32_t updates) {
+    std::cerr << "1000000 nodes under about 1000 roots" << std::endl;
+    benchRun(updates, "serial");
+    int workers = std::max(1, static_cast<int>(
+                                  std::thread::hardware_concurrency()) - 1);
+    jobSystem().start(workers);
+    benchRun(updates, "job system");
+    jobSystem().stop();
+}
+
+} // namespace
+
+// -----------------------------------------------------------------------------
+int main(int argc, char* argv[]) {
+    if (argc == 3 && strcmp(argv[1], "--bench") == 0) {
+        bench(static_cast<uint32_t>(std::max(1, atoi(argv[2]))));
+        return 0;
+    }
+
+    testSerial();
+    testWorkers();
+    return testResult("scene_graph");
+}
@@ -0,0 +1,220 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "job_system.h"
+#include "sampling_profiler.h"
+#include "stream_io.h"
+
+// -----------------------------------------------------------------------------
+// Streams one large file through StreamPipeline with each backend and
+// prints throughput and read latency per queue depth. Processing sums the
+// bytes on the job system, standing in for decompression. Buffered runs
+// drop the file from the page cache first so both backends read the
+// device.
+//
+//   StreamBench [--file path] [--size-mb n] [--block-kb n] [--depths d,d,...]
+//               [--direct] [--random] [--workers n]
+//               [--sample-profile prefix] [--sample-hz n]
+//
+// --sample-profile samples every thread's stacks (SIGPROF, --sample-hz,
+// default 997) into <prefix>.folded and a <prefix>.svg flamegraph.
+namespace {
+
+double cpuSeconds() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+           (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1e-6;
+}
+
+bool prepareFile(const std::string& path, uint64_t bytes) {
+    struct stat info;
+    if (stat(path.c_str(), &info) == 0 && uint64_t(info.st_size) >= bytes) {
+        return true;
+    }
+
+    FILE* file = fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        std::cerr << "Failed to open " << path << std::endl;
+        return false;
+    }
+    std::mt19937_64 rng(1);
+    std::vector<uint64_t> chunk((1 << 20) / sizeof(uint64_t));
+    bool ok = true;
+    for (uint64_t written = 0; ok && written < bytes;
+         written += chunk.size() * sizeof(uint64_t)) {
+        for (uint64_t& word : chunk) word = rng();
+        ok = fwrite(chunk.data(), sizeof(uint64_t), chunk.size(), file) ==
+             chunk.size();
+    }
+    ok = fflush(file) == 0 && fsync(fileno(file)) == 0 && ok;
+    ok = fclose(file) == 0 && ok;
+    if (!ok) std::cerr << "Failed to write " << path << std::endl;
+    return ok;
+}
+
+std::vector<uint32_t> parseList(const char* list) {
+    std::vector<uint32_t> values;
+    for (const char* p = list; *p != '\0';) {
+        char* end;
+        long v = strtol(p, &end, 10);
+        if (end == p) break;
+        if (v > 0) values.push_back(static_cast<uint32_t>(v));
+        p = *end == ',' ? end + 1 : end;
+    }
+    return values;
+}
+
+} // namespace
+
+// -----------------------------------------------------------------------------
+int main(int argc, char* argv[]) {
+    std::string path = "stream_bench.dat";
+    uint64_t sizeMb = 1024;
+    uint32_t blockKb = 256;
+    std::vector<uint32_t> depths = { 1, 2, 4, 8, 16, 32, 64 };
+    bool direct = false;
+    bool random = false;
+    int workerCount = -1;
+    const char* sampleProfilePath = nullptr;
+    int sampleHz = 997;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--file") == 0 && i + 1 < argc) {
+            path = argv[++i];
+        } else if (strcmp(argv[i], "--size-mb") == 0 && i + 1 < argc) {
+            sizeMb = static_cast<uint64_t>(atoll(argv[++i]));
+        } else if (strcmp(argv[i], "--block-kb") == 0 && i + 1 < argc) {
+            blockKb = static_cast<uint32_t>(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--depths") == 0 && i + 1 < argc) {
+            depths = parseList(argv[++i]);
+        } else if (strcmp(argv[i], "--direct") == 0) {
+            direct = true;
+        } else if (strcmp(argv[i], "--random") == 0) {
+            random = true;
+        } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            workerCount = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--sample-profile") == 0 && i + 1 < argc) {
+            sampleProfilePath = argv[++i];
+        } else if (strcmp(argv[i], "--sample-hz") == 0 && i + 1 < argc) {
+            sampleHz = atoi(argv[++i]);
+        } else {
+            std::cerr << "Usage: StreamBench [--file path] [--size-mb n] "
+                         "[--block-kb n] [--depths d,d,...]\n"
+                         "                   [--direct] [--random] "
+                         "[--workers n]\n"
+                         "                   [--sample-profile prefix] "
+                         "[--sample-hz n]" << std::endl;
+            return 1;
+        }
+    }
+
+    // Blocks stay aligned for O_DIRECT
+    uint32_t blockBytes = std::max(1u, blockKb * 1024 / kStreamAlignment) *
+                          kStreamAlignment;
+    uint64_t fileBytes = sizeMb << 20;
+    if (!prepareFile(path, fileBytes)) return 1;
+
+    if (workerCount < 0) {
+        workerCount = std::max(
+            1, static_cast<int>(std::thread::hardware_concurrency()) - 1);
+    }
+    jobSystem().start(workerCount);
+
+    samplingProfiler().registerCurrentThread("main");
+    if (sampleProfilePath != nullptr && !samplingProfiler().start(sampleHz)) {
+        std::cerr << "Failed to start sampling profiler" << std::endl;
+    }
+
+    std::vector<StreamRead> reads;
+    for (uint64_t offset = 0; offset + blockBytes <= fileBytes;
+         offset += blockBytes) {
+        reads.push_back({ -1, offset, blockBytes, reads.size() });
+    }
+    if (random) std::shuffle(reads.begin(), reads.end(), std::mt19937(1));
+
+    std::cerr << "Streaming " << (fileBytes >> 20) << " MB in "
+              << blockBytes / 1024 << " KB " << (random ? "random" : "")
+              << (random ? " " : "") << "reads, "
+              << (direct ? "O_DIRECT" : "buffered") << ", "
+              << workerCount << " workers" << std::endl;
+
+    bool ok = true;
+    for (uint32_t depth : depths) {
+        for (int b = 0; b < 2; ++b) {
+            std::unique_ptr<ReadBackend> backend =
+                b == 0 ? createUringBackend() : createThreadPoolBackend();
+            if (backend == nullptr) {
+                std::cerr << "  io_uring is not available" << std::endl;
+                continue;
+            }
+
+            // Twice the queue depth: reads in flight plus reads waiting
+            // in the processing stage
+            StreamBuffers buffers;
+            if (!buffers.init(std::min(depth * 2, kMaxStreamBuffers),
+                              blockBytes) ||
+                !backend->init(buffers, std::min(depth, buffers.count()))) {
+                ok = false;
+                continue;
+            }
+
+            bool fileDirect = direct;
+            int file = openStreamFile(path, fileDirect);
+            if (file < 0) return 1;
+            if (!fileDirect) posix_fadvise(file, 0, 0, POSIX_FADV_DONTNEED);
+            for (StreamRead& read : reads) read.file = file;
+
+            std::vector<uint64_t> sums(reads.size());
+            uint64_t consumed = 0;
+            double cpuStart = cpuSeconds();
+            StreamPipeline pipeline(*backend, buffers, depth);
+            StreamStats s = pipeline.run(
+                reads,
+                [&sums](const StreamRead& read, const uint8_t* data,
+                        uint32_t size) {
+                    uint64_t sum = 0;
+                    for (uint32_t i = 0; i + 8 <= size; i += 8) {
+                        uint64_t word;
+                        memcpy(&word, data + i, sizeof(word));
+                        sum += word;
+                    }
+                    sums[read.tag] = sum;
+                    return size == read.size;
+                },
+                [&consumed](const StreamRead&, bool) { ++consumed; });
+            double cpuMs = (cpuSeconds() - cpuStart) * 1000.0;
+            closeStreamFile(file);
+
+            char line[200];
+            snprintf(line, sizeof(line),
+                     "  depth %3u %-10s %6.2f GB/s, latency p50 %7.3f ms, "
+                     "p99 %7.3f ms, %5.1f reads/submit, CPU %.0f ms%s",
+                     depth, backend->name(),
+                     s.bytes / std::max(s.ms, 1e-3) / 1e6,
+                     s.latencyP50Ms, s.latencyP99Ms,
+                     double(s.reads) / std::max<uint64_t>(s.submits, 1),
+                     cpuMs, s.failed > 0 || consumed != reads.size()
+                         ? ", FAILED" : "");
+            std::cerr << line << std::endl;
+            ok = ok && s.failed == 0 && consumed == reads.size();
+        }
+    }
+    jobSystem().stop();
+    if (samplingProfiler().running()) {
+        samplingProfiler().stopAndWrite(sampleProfilePath);
+    }
+    return ok ? 0 : 1;
+}
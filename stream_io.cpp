@@ -0,0 +1,477 @@
+#include "stream_io.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+#include "bounded_queue.h"
+#include "job_system.h"
+
+// -----------------------------------------------------------------------------
+StreamBuffers::~StreamBuffers() {
+    free(memory_);
+}
+
+bool StreamBuffers::init(uint32_t count, uint32_t size) {
+    free(memory_);
+    memory_ = nullptr;
+    count_ = std::min(count, kMaxStreamBuffers);
+    size_ = (size + kStreamAlignment - 1) / kStreamAlignment *
+            kStreamAlignment;
+    if (posix_memalign(reinterpret_cast<void**>(&memory_), kStreamAlignment,
+                       size_t(count_) * size_) != 0) {
+        memory_ = nullptr;
+        count_ = 0;
+        std::cerr << "Failed to allocate stream buffers" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+int openStreamFile(const std::string& path, bool& direct) {
+    int flags = O_RDONLY;
+#if defined(O_DIRECT)
+    if (direct) {
+        int file = open(path.c_str(), flags | O_DIRECT);
+        if (file >= 0) return file;
+        if (errno != EINVAL) {
+            std::cerr << "Failed to open " << path << std::endl;
+            return -1;
+        }
+    }
+#endif
+    direct = false;
+    int file = open(path.c_str(), flags);
+    if (file < 0) std::cerr << "Failed to open " << path << std::endl;
+    return file;
+}
+
+void closeStreamFile(int file) {
+    if (file >= 0) close(file);
+}
+
+// -----------------------------------------------------------------------------
+#if defined(__linux__)
+namespace {
+
+// Talks to the kernel through the raw system calls and the shared rings,
+// without liburing
+class UringBackend : public ReadBackend {
+ public:
+    ~UringBackend() override {
+        if (sqes_ != nullptr) munmap(sqes_, sqesBytes_);
+        if (cqRing_ != nullptr && cqRing_ != sqRing_) {
+            munmap(cqRing_, cqRingBytes_);
+        }
+        if (sqRing_ != nullptr) munmap(sqRing_, sqRingBytes_);
+        if (ring_ >= 0) close(ring_);
+    }
+
+    const char* name() const override { return "io_uring"; }
+
+    bool setup(uint32_t entries) {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        ring_ = static_cast<int>(
+            syscall(__NR_io_uring_setup, entries, &params));
+        if (ring_ < 0) return false;
+
+        sqRingBytes_ = params.sq_off.array + params.sq_entries *
+                                                 sizeof(uint32_t);
+        cqRingBytes_ = params.cq_off.cqes + params.cq_entries *
+                                                sizeof(io_uring_cqe);
+        bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single) sqRingBytes_ = cqRingBytes_ =
+            std::max(sqRingBytes_, cqRingBytes_);
+        sqRing_ = map(sqRingBytes_, IORING_OFF_SQ_RING);
+        cqRing_ = single ? sqRing_ : map(cqRingBytes_, IORING_OFF_CQ_RING);
+        sqesBytes_ = params.sq_entries * sizeof(io_uring_sqe);
+        sqes_ = static_cast<io_uring_sqe*>(
+            map(sqesBytes_, IORING_OFF_SQES));
+        if (sqRing_ == nullptr || cqRing_ == nullptr || sqes_ == nullptr) {
+            return false;
+        }
+
+        uint8_t* sq = static_cast<uint8_t*>(sqRing_);
+        uint8_t* cq = static_cast<uint8_t*>(cqRing_);
+        sqHead_ = reinterpret_cast<uint32_t*>(sq + params.sq_off.head);
+        sqTail_ = reinterpret_cast<uint32_t*>(sq + params.sq_off.tail);
+        sqMask_ = *reinterpret_cast<uint32_t*>(sq + params.sq_off.ring_mask);
+        sqArray_ = reinterpret_cast<uint32_t*>(sq + params.sq_off.array);
+        sqEntries_ = params.sq_entries;
+        cqHead_ = reinterpret_cast<uint32_t*>(cq + params.cq_off.head);
+        cqTail_ = reinterpret_cast<uint32_t*>(cq + params.cq_off.tail);
+        cqMask_ = *reinterpret_cast<uint32_t*>(cq + params.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        return true;
+    }
+
+    bool init(const StreamBuffers& buffers, uint32_t queueDepth) override {
+        if (queueDepth > sqEntries_) return false;
+        buffers_ = &buffers;
+
+        // Registration pins the buffers once; without it (RLIMIT_MEMLOCK)
+        // every read pins its pages itself
+        std::vector<iovec> iov(buffers.count());
+        for (uint32_t i = 0; i < buffers.count(); ++i) {
+            iov[i].iov_base = buffers.data(i);
+            iov[i].iov_len = buffers.size();
+        }
+        fixed_ = syscall(__NR_io_uring_register, ring_,
+                         IORING_REGISTER_BUFFERS, iov.data(),
+                         static_cast<unsigned>(iov.size())) == 0;
+        return true;
+    }
+
+    uint32_t submit(const ReadOp* ops, uint32_t count) override {
+        uint32_t tail = *sqTail_;
+        // The kernel consumes entries inside io_uring_enter(), so
+        // outstanding reads never fill the ring; this guards misuse
+        uint32_t room = sqEntries_ -
+                        (tail - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE));
+        count = std::min(count, room);
+        for (uint32_t i = 0; i < count; ++i) {
+            uint32_t index = tail & sqMask_;
+            io_uring_sqe* sqe = &sqes_[index];
+            memset(sqe, 0, sizeof(*sqe));
+            sqe->opcode = fixed_ ? IORING_OP_READ_FIXED : IORING_OP_READ;
+            sqe->fd = ops[i].file;
+            sqe->off = ops[i].offset;
+            sqe->addr = reinterpret_cast<uint64_t>(
+                buffers_->data(ops[i].buffer));
+            sqe->len = ops[i].size;
+            sqe->buf_index = static_cast<uint16_t>(ops[i].buffer);
+            sqe->user_data = ops[i].buffer;
+            sqArray_[index] = index;
+            ++tail;
+        }
+        __atomic_store_n(sqTail_, tail, __ATOMIC_RELEASE);
+
+        // One system call for the whole batch
+        uint32_t left = count;
+        while (left > 0) {
+            long submitted = syscall(__NR_io_uring_enter, ring_, left, 0, 0,
+                                     nullptr, 0);
+            if (submitted < 0) {
+                if (errno == EINTR || errno == EAGAIN) continue;
+                std::cerr << "io_uring_enter failed: " << strerror(errno)
+                          << std::endl;
+                // Take back the entries the kernel has not read, so their
+                // buffers can be reused; only this thread enters the ring,
+                // so the head cannot move under us
+                __atomic_store_n(sqTail_,
+                                 __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE),
+                                 __ATOMIC_RELEASE);
+                return count - left;
+            }
+            left -= static_cast<uint32_t>(submitted);
+        }
+        return count;
+    }
+
+    uint32_t complete(ReadDone* done, uint32_t max, bool wait) override {
+        uint32_t head = *cqHead_;
+        uint32_t tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+        while (head == tail && wait) {
+            long r = syscall(__NR_io_uring_enter, ring_, 0, 1,
+                             IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (r < 0 && errno != EINTR) return 0;
+            tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+        }
+
+        uint32_t count = 0;
+        for (; head != tail && count < max; ++head, ++count) {
+            const io_uring_cqe& cqe = cqes_[head & cqMask_];
+            done[count].buffer = static_cast<uint32_t>(cqe.user_data);
+            done[count].result = cqe.res;
+        }
+        __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+        return count;
+    }
+
+ private:
+    void* map(size_t bytes, off_t offset) {
+        void* p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, ring_, offset);
+        return p == MAP_FAILED ? nullptr : p;
+    }
+
+    int ring_ = -1;
+    const StreamBuffers* buffers_ = nullptr;
+    bool fixed_ = false;
+    void* sqRing_ = nullptr;
+    void* cqRing_ = nullptr;
+    size_t sqRingBytes_ = 0;
+    size_t cqRingBytes_ = 0;
+    io_uring_sqe* sqes_ = nullptr;
+    size_t sqesBytes_ = 0;
+    uint32_t* sqHead_ = nullptr;
+    uint32_t* sqTail_ = nullptr;
+    uint32_t* sqArray_ = nullptr;
+    uint32_t sqMask_ = 0;
+    uint32_t sqEntries_ = 0;
+    uint32_t* cqHead_ = nullptr;
+    uint32_t* cqTail_ = nullptr;
+    io_uring_cqe* cqes_ = nullptr;
+    uint32_t cqMask_ = 0;
+};
+
+} // namespace
+
+std::unique_ptr<ReadBackend> createUringBackend() {
+    auto backend = std::make_unique<UringBackend>();
+    if (!backend->setup(kMaxStreamBuffers)) return nullptr;
+    return backend;
+}
+#else
+std::unique_ptr<ReadBackend> createUringBackend() {
+    return nullptr;
+}
+#endif
+
+// -----------------------------------------------------------------------------
+namespace {
+
+// One blocking pread() per thread, as many threads as the queue depth
+class ThreadPoolBackend : public ReadBackend {
+ public:
+    ~ThreadPoolBackend() override {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        hasWork_.notify_all();
+        for (std::thread& thread : threads_) thread.join();
+    }
+
+    const char* name() const override { return "pread pool"; }
+
+    bool init(const StreamBuffers& buffers, uint32_t queueDepth) override {
+        buffers_ = &buffers;
+        for (uint32_t i = 0; i < queueDepth; ++i) {
+            threads_.emplace_back(&ThreadPoolBackend::threadMain, this);
+        }
+        return true;
+    }
+
+    uint32_t submit(const ReadOp* ops, uint32_t count) override {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            pending_.insert(pending_.end(), ops, ops + count);
+        }
+        hasWork_.notify_all();
+        return count;
+    }
+
+    uint32_t complete(ReadDone* done, uint32_t max, bool wait) override {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (wait) hasDone_.wait(lock, [this] { return !finished_.empty(); });
+        uint32_t count = 0;
+        while (!finished_.empty() && count < max) {
+            done[count++] = finished_.front();
+            finished_.pop_front();
+        }
+        return count;
+    }
+
+ private:
+    void threadMain() {
+        while (true) {
+            ReadOp op;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                hasWork_.wait(lock, [this] {
+                    return stopping_ || !pending_.empty();
+                });
+                if (pending_.empty()) return;
+                op = pending_.front();
+                pending_.pop_front();
+            }
+
+            uint8_t* data = buffers_->data(op.buffer);
+            uint32_t total = 0;
+            int32_t result = 0;
+            while (total < op.size) {
+                ssize_t n = pread(op.file, data + total, op.size - total,
+                                  static_cast<off_t>(op.offset + total));
+                if (n < 0 && errno == EINTR) continue;
+                if (n < 0) {
+                    result = -errno;
+                    break;
+                }
+                if (n == 0) break;
+                total += static_cast<uint32_t>(n);
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                finished_.push_back(
+                    { op.buffer, result < 0 ? result : int32_t(total) });
+            }
+            hasDone_.notify_one();
+        }
+    }
+
+    const StreamBuffers* buffers_ = nullptr;
+    std::vector<std::thread> threads_;
+    std::mutex mutex_;
+    std::condition_variable hasWork_;
+    std::condition_variable hasDone_;
+    std::deque<ReadOp> pending_;
+    std::deque<ReadDone> finished_;
+    bool stopping_ = false;
+};
+
+} // namespace
+
+std::unique_ptr<ReadBackend> createThreadPoolBackend() {
+    return std::make_unique<ThreadPoolBackend>();
+}
+
+// -----------------------------------------------------------------------------
+StreamPipeline::StreamPipeline(ReadBackend& backend, StreamBuffers& buffers,
+                               uint32_t queueDepth)
+    : backend_(backend),
+      buffers_(buffers),
+      queueDepth_(std::max(1u, std::min(queueDepth, buffers.count()))) {
+}
+
+StreamStats StreamPipeline::run(const std::vector<StreamRead>& reads,
+                                const Process& process,
+                                const Consume& consume) {
+    using Clock = std::chrono::steady_clock;
+    struct Processed {
+        uint32_t buffer;
+        bool ok;
+    };
+
+    // Shared with the jobs, which may still be returning from tryPush()
+    // after the last item was popped
+    struct State {
+        BoundedQueue<Processed, kMaxStreamBuffers> processed;
+    };
+    auto state = std::make_shared<State>();
+
+    StreamStats stats;
+    auto start = Clock::now();
+    std::vector<uint32_t> freeBuffers;
+    for (uint32_t b = buffers_.count(); b-- > 0;) freeBuffers.push_back(b);
+    std::vector<uint32_t> readOf(buffers_.count());
+    std::vector<Clock::time_point> submitted(buffers_.count());
+    std::vector<float> latencies;
+    latencies.reserve(reads.size());
+
+    std::vector<ReadOp> ops;
+    std::vector<ReadDone> done(queueDepth_);
+    size_t next = 0;
+    size_t consumed = 0;
+    uint32_t inBackend = 0;
+
+    // Finished reads go to the job system as they come back
+    auto dispatch = [&](uint32_t count) {
+        Clock::time_point now = Clock::now();
+        for (uint32_t i = 0; i < count; ++i) {
+            uint32_t buffer = done[i].buffer;
+            int32_t result = done[i].result;
+            latencies.push_back(std::chrono::duration<float, std::milli>(
+                now - submitted[buffer]).count());
+            if (result > 0) stats.bytes += uint64_t(result);
+            --inBackend;
+
+            const StreamRead* read = &reads[readOf[buffer]];
+            const uint8_t* data = buffers_.data(buffer);
+            jobSystem().submit([state, &process, read, data, buffer,
+                                result] {
+                bool ok = result >= 0 &&
+                          process(*read, data, static_cast<uint32_t>(result));
+                state->processed.tryPush({ buffer, ok });
+            });
+        }
+    };
+    auto finish = [&](const Processed& item) {
+        if (!item.ok) ++stats.failed;
+        consume(reads[readOf[item.buffer]], item.ok);
+        freeBuffers.push_back(item.buffer);
+        ++consumed;
+    };
+
+    while (consumed < reads.size()) {
+        ops.clear();
+        while (next < reads.size() && !freeBuffers.empty() &&
+               inBackend + ops.size() < queueDepth_) {
+            uint32_t buffer = freeBuffers.back();
+            freeBuffers.pop_back();
+            const StreamRead& read = reads[next];
+            readOf[buffer] = static_cast<uint32_t>(next++);
+            ops.push_back({ read.file, read.offset,
+                            std::min(read.size, buffers_.size()), buffer });
+        }
+        if (!ops.empty()) {
+            Clock::time_point now = Clock::now();
+            for (const ReadOp& op : ops) submitted[op.buffer] = now;
+            uint32_t queued = backend_.submit(
+                ops.data(), static_cast<uint32_t>(ops.size()));
+            // Queued reads keep their buffers until they complete; the
+            // rest were never seen by the backend and fail now
+            for (size_t i = queued; i < ops.size(); ++i) {
+                finish({ ops[i].buffer, false });
+            }
+            if (queued > 0) {
+                inBackend += queued;
+                ++stats.submits;
+            }
+        }
+
+        bool progress = false;
+        uint32_t count = backend_.complete(done.data(), queueDepth_, false);
+        dispatch(count);
+        progress = count > 0;
+        Processed item;
+        while (state->processed.tryPop(item)) {
+            finish(item);
+            progress = true;
+        }
+        if (progress) continue;
+
+        // Nothing moved: wait on whichever stage holds the oldest work
+        if (inBackend > 0) {
+            dispatch(backend_.complete(done.data(), queueDepth_, true));
+        } else if (consumed < next && state->processed.pop(item)) {
+            finish(item);
+        }
+    }
+
+    stats.reads = reads.size();
+    stats.ms = std::chrono::duration<double, std::milli>(
+        Clock::now() - start).count();
+    if (!latencies.empty()) {
+        auto at = [&](double q) {
+            size_t k = std::min(latencies.size() - 1,
+                                size_t(q * latencies.size()));
+            std::nth_element(latencies.begin(), latencies.begin() + k,
+                             latencies.end());
+            return double(latencies[k]);
+        };
+        stats.latencyP50Ms = at(0.5);
+        stats.latencyP99Ms = at(0.99);
+        stats.latencyMaxMs =
+            *std::max_element(latencies.begin(), latencies.end());
+    }
+    return stats;
+}
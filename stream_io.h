@@ -0,0 +1,132 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+// Asynchronous file reads for asset streaming, POSIX only for now.
+//
+// Reads land in a fixed set of aligned buffers owned by StreamBuffers. The
+// io_uring backend registers them with the kernel once, so each read is a
+// READ_FIXED that skips pinning pages, and submits every batch of reads
+// with a single io_uring_enter(); one thread keeps the whole queue depth in
+// flight. The thread-pool backend issues blocking pread() calls from one
+// thread per outstanding read and is kept as the baseline to compare
+// against, and as the fallback where io_uring is unavailable.
+//
+// Files opened with `direct` bypass the page cache (O_DIRECT). Offsets,
+// sizes and buffers must then be multiples of kStreamAlignment, which
+// StreamBuffers guarantees for the buffers.
+//
+// StreamPipeline drives a backend through two stages: `process` runs on
+// the job system as each read completes (decompression), and `consume`
+// runs on the calling thread afterwards (upload). A buffer is only reused
+// once its read was consumed, so the buffer count bounds everything in
+// flight at once and a slow stage holds back reads instead of growing a
+// queue.
+constexpr uint32_t kStreamAlignment = 4096;
+constexpr uint32_t kMaxStreamBuffers = 256;
+
+class StreamBuffers {
+ public:
+    StreamBuffers() = default;
+    ~StreamBuffers();
+    StreamBuffers(const StreamBuffers&) = delete;
+    StreamBuffers& operator=(const StreamBuffers&) = delete;
+
+    // `size` is rounded up to kStreamAlignment
+    bool init(uint32_t count, uint32_t size);
+
+    uint32_t count() const { return count_; }
+    uint32_t size() const { return size_; }
+    uint8_t* data(uint32_t index) const {
+        return memory_ + size_t(index) * size_;
+    }
+
+ private:
+    uint8_t* memory_ = nullptr;
+    uint32_t count_ = 0;
+    uint32_t size_ = 0;
+};
+
+// Returns -1 on failure. Falls back to buffered reads when the file system
+// refuses O_DIRECT and clears `direct` to say so.
+int openStreamFile(const std::string& path, bool& direct);
+void closeStreamFile(int file);
+
+struct ReadOp {
+    int file;
+    uint64_t offset;
+    uint32_t size;
+    uint32_t buffer;
+};
+
+struct ReadDone {
+    uint32_t buffer;
+    int32_t result;              // bytes read, or -errno
+};
+
+class ReadBackend {
+ public:
+    virtual ~ReadBackend() {}
+
+    virtual const char* name() const = 0;
+
+    // At most `queueDepth` reads are outstanding at once
+    virtual bool init(const StreamBuffers& buffers, uint32_t queueDepth) = 0;
+
+    // Returns how many of `ops`, from the first, were queued; the rest
+    // never reached the backend and their buffers are the caller's again
+    virtual uint32_t submit(const ReadOp* ops, uint32_t count) = 0;
+
+    // Returns up to `max` finished reads; with `wait`, blocks for one
+    virtual uint32_t complete(ReadDone* done, uint32_t max, bool wait) = 0;
+};
+
+// Null when the kernel has no io_uring or it is not permitted
+std::unique_ptr<ReadBackend> createUringBackend();
+std::unique_ptr<ReadBackend> createThreadPoolBackend();
+
+struct StreamRead {
+    int file;
+    uint64_t offset;
+    uint32_t size;               // at most the buffer size
+    uint64_t tag;                // the caller's
+};
+
+struct StreamStats {
+    uint64_t reads = 0;
+    uint64_t bytes = 0;
+    uint64_t failed = 0;
+    uint64_t submits = 0;        // backend submit() calls
+    double ms = 0.0;
+    double latencyP50Ms = 0.0;   // submit to completion
+    double latencyP99Ms = 0.0;
+    double latencyMaxMs = 0.0;
+};
+
+class StreamPipeline {
+ public:
+    // On a job, with the bytes read; false counts the read as failed
+    using Process = std::function<bool(const StreamRead& read,
+                                       const uint8_t* data, uint32_t size)>;
+
+    // On the thread calling run(), once processing finished
+    using Consume = std::function<void(const StreamRead& read, bool ok)>;
+
+    StreamPipeline(ReadBackend& backend, StreamBuffers& buffers,
+                   uint32_t queueDepth);
+
+    // Streams every read and returns once all were consumed
+    StreamStats run(const std::vector<StreamRead>& reads,
+                    const Process& process, const Consume& consume);
+
+ private:
+    ReadBackend& backend_;
+    StreamBuffers& buffers_;
+    uint32_t queueDepth_;
+};
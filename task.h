@@ -0,0 +1,288 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <coroutine>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <utility>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+// Minimal C++20 coroutine support for asynchronous loading.
+//
+//   Task<ShaderBlob> compile(...) {
+//       co_await jobSystem().schedule();       // continue on a worker
+//       ...
+//       co_await contextExecutor.schedule();   // continue where the
+//       ...                                    // immediate context is owned
+//   }
+//
+// Tasks are lazy: nothing runs until the task is awaited, passed to
+// whenAll() or to syncWait(). Results are returned by value; failures are
+// reported through the result (HRESULT), as elsewhere in the project. An
+// exception escaping a task is rethrown to whoever awaits it; whenAll()
+// rethrows the first, in task order, once every task has finished.
+class Executor {
+ public:
+    virtual ~Executor() {}
+
+    virtual void post(std::coroutine_handle<> handle) = 0;
+
+    struct ScheduleAwaiter {
+        Executor& executor;
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> handle) {
+            executor.post(handle);
+        }
+        void await_resume() const noexcept {}
+    };
+
+    ScheduleAwaiter schedule() { return ScheduleAwaiter{ *this }; }
+};
+
+// Runs posted coroutines only when its owner calls runPending(); used for
+// work that must happen on a specific thread.
+class ManualExecutor : public Executor {
+ public:
+    void post(std::coroutine_handle<> handle) override {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            pending_.push_back(handle);
+            hasPending_.store(true, std::memory_order_release);
+        }
+        wakeup_.notify_all();
+    }
+
+    // Returns the number of coroutines resumed. Cheap when nothing is queued.
+    size_t runPending() {
+        if (!hasPending_.load(std::memory_order_acquire)) return 0;
+
+        std::deque<std::coroutine_handle<>> ready;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ready.swap(pending_);
+            hasPending_.store(false, std::memory_order_release);
+        }
+        for (std::coroutine_handle<> handle : ready) {
+            handle.resume();
+        }
+        return ready.size();
+    }
+
+    // Blocks until something is posted or `flag` is set with setFlag();
+    // returns the flag. The flag is only touched under the executor's lock,
+    // so the waiter may destroy it as soon as this returns true.
+    bool waitForWorkOr(const bool& flag) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        wakeup_.wait(lock, [this, &flag] { return !pending_.empty() || flag; });
+        return flag;
+    }
+
+    void setFlag(bool& flag) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        flag = true;
+        wakeup_.notify_all();
+    }
+
+ private:
+    std::mutex mutex_;
+    std::condition_variable wakeup_;
+    std::deque<std::coroutine_handle<>> pending_;
+    std::atomic<bool> hasPending_{ false };
+};
+
+// -----------------------------------------------------------------------------
+template <typename T>
+class Task {
+ public:
+    struct promise_type {
+        std::optional<T> value;
+        std::exception_ptr exception;
+        std::coroutine_handle<> continuation;
+
+        Task get_return_object() {
+            return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        std::suspend_always initial_suspend() noexcept { return {}; }
+
+        struct FinalAwaiter {
+            bool await_ready() const noexcept { return false; }
+            std::coroutine_handle<> await_suspend(
+                    std::coroutine_handle<promise_type> handle) noexcept {
+                // Symmetric transfer back to the awaiter keeps long await
+                // chains from growing the stack.
+                std::coroutine_handle<> next = handle.promise().continuation;
+                return next ? next : std::noop_coroutine();
+            }
+            void await_resume() const noexcept {}
+        };
+
+        FinalAwaiter final_suspend() noexcept { return {}; }
+
+        template <typename U>
+        void return_value(U&& result) { value.emplace(std::forward<U>(result)); }
+
+        void unhandled_exception() { exception = std::current_exception(); }
+    };
+
+    Task() : handle_(nullptr) {}
+    explicit Task(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+    Task(Task&& other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            if (handle_) handle_.destroy();
+            handle_ = std::exchange(other.handle_, nullptr);
+        }
+        return *this;
+    }
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task() {
+        if (handle_) handle_.destroy();
+    }
+
+    bool done() const { return !handle_ || handle_.done(); }
+
+    auto operator co_await() noexcept {
+        struct Awaiter {
+            std::coroutine_handle<promise_type> handle;
+            bool await_ready() const noexcept { return !handle || handle.done(); }
+            std::coroutine_handle<> await_suspend(
+                    std::coroutine_handle<> awaiting) noexcept {
+                handle.promise().continuation = awaiting;
+                return handle;
+            }
+            T await_resume() {
+                promise_type& promise = handle.promise();
+                if (promise.exception) std::rethrow_exception(promise.exception);
+                return std::move(*promise.value);
+            }
+        };
+        return Awaiter{ handle_ };
+    }
+
+ private:
+    std::coroutine_handle<promise_type> handle_;
+};
+
+// -----------------------------------------------------------------------------
+namespace task_detail {
+
+// Fire-and-forget coroutine; its frame is freed when the body finishes.
+struct Detached {
+    struct promise_type {
+        Detached get_return_object() {
+            return Detached{
+                std::coroutine_handle<promise_type>::from_promise(*this) };
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+struct WhenAllState {
+    std::atomic<size_t> remaining;
+    std::coroutine_handle<> continuation;
+};
+
+template <typename T>
+Detached runAndSignal(Task<T>& task, std::optional<T>& result,
+                      std::exception_ptr& error, WhenAllState& state) {
+    try {
+        result.emplace(co_await task);
+    } catch (...) {
+        error = std::current_exception();
+    }
+    if (state.remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        state.continuation.resume();
+    }
+}
+
+template <typename T>
+struct WhenAllAwaiter {
+    std::vector<Task<T>>& tasks;
+    std::vector<std::optional<T>>& results;
+    std::vector<std::exception_ptr>& errors;
+    WhenAllState& state;
+
+    bool await_ready() const noexcept { return tasks.empty(); }
+
+    bool await_suspend(std::coroutine_handle<> awaiting) {
+        // One extra count for this function, so a child finishing
+        // synchronously cannot resume the awaiter before it is suspended.
+        state.continuation = awaiting;
+        state.remaining.store(tasks.size() + 1, std::memory_order_relaxed);
+        for (size_t i = 0; i < tasks.size(); ++i) {
+            runAndSignal(tasks[i], results[i], errors[i], state)
+                .handle.resume();
+        }
+        return state.remaining.fetch_sub(1, std::memory_order_acq_rel) != 1;
+    }
+
+    void await_resume() const noexcept {}
+};
+
+template <typename T>
+Detached signalWhenDone(Task<T>& task, std::optional<T>& result,
+                        std::exception_ptr& error, bool& done,
+                        ManualExecutor& pump) {
+    try {
+        result.emplace(co_await task);
+    } catch (...) {
+        error = std::current_exception();
+    }
+    pump.setFlag(done);
+}
+
+}  // namespace task_detail
+
+// Starts all tasks at once and completes when every one has finished.
+template <typename T>
+Task<std::vector<T>> whenAll(std::vector<Task<T>> tasks) {
+    std::vector<std::optional<T>> results(tasks.size());
+    std::vector<std::exception_ptr> errors(tasks.size());
+    task_detail::WhenAllState state;
+    co_await task_detail::WhenAllAwaiter<T>{ tasks, results, errors, state };
+
+    for (const std::exception_ptr& error : errors) {
+        if (error) std::rethrow_exception(error);
+    }
+    std::vector<T> values;
+    values.reserve(results.size());
+    for (std::optional<T>& result : results) {
+        values.push_back(std::move(*result));
+    }
+    co_return values;
+}
+
+// Blocks the calling thread until the task completes, and rethrows what it
+// threw. If the task hops to `pump` (an executor owned by the calling
+// thread), that work runs here while waiting.
+template <typename T>
+T syncWait(Task<T> task, ManualExecutor* pump = nullptr) {
+    ManualExecutor local;
+    ManualExecutor& executor = pump != nullptr ? *pump : local;
+
+    std::optional<T> result;
+    std::exception_ptr error;
+    bool done = false;
+    task_detail::signalWhenDone(task, result, error, done, executor)
+        .handle.resume();
+
+    while (true) {
+        executor.runPending();
+        if (executor.waitForWorkOr(done)) break;
+    }
+    if (error) std::rethrow_exception(error);
+    return std::move(*result);
+}
@@ -0,0 +1,351 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "job_system.h"
+#include "task.h"
+#include "test_check.h"
+
+// -----------------------------------------------------------------------------
+// Tests for Task, whenAll(), syncWait() and JobSystem::parallelFor(): tasks
+// starting only when awaited; exceptions reaching the awaiting task, and
+// through whenAll() and syncWait(), after every other task has finished;
+// whenAll() results in task order however the tasks finish; a million
+// nested co_awaits finishing without growing the stack, as the transfers
+// between frames are symmetric; work hopping onto a ManualExecutor running
+// on the thread pumping it; and parallelFor() covering every index once at
+// many counts and grains, nested in a worker and with no workers at all.
+// With --bench it times one co_await, one hop onto the job system and a
+// load of that many 64 KB asset files, serially and with whenAll().
+//
+//   TaskTest [--bench <assets>]
+namespace {
+
+Task<int> value(int v) {
+    co_return v;
+}
+
+Task<int> sum(int a, int b) {
+    int x = co_await value(a);
+    int y = co_await value(b);
+    co_return x + y;
+}
+
+Task<int> onWorker(int v) {
+    co_await jobSystem().schedule();
+    co_return v;
+}
+
+Task<int> fail(const char* what) {
+    co_await jobSystem().schedule();
+    throw std::runtime_error(what);
+    co_return 0;
+}
+
+void testBasics() {
+    bool started = false;
+    auto lazy = [&started]() -> Task<int> {
+        started = true;
+        co_return 7;
+    };
+    Task<int> task = lazy();
+    CHECK(!started && !task.done());
+    CHECK(syncWait(std::move(task)) == 7);
+    CHECK(started);
+    CHECK(syncWait(sum(2, 3)) == 5);
+    CHECK(syncWait(onWorker(11)) == 11);
+
+    // Never awaited: the frame is freed without running
+    started = false;
+    { Task<int> dropped = lazy(); }
+    CHECK(!started);
+}
+
+void testExceptions() {
+    auto catches = []() -> Task<int> {
+        try {
+            co_await fail("inner");
+        } catch (const std::runtime_error& e) {
+            co_return strcmp(e.what(), "inner") == 0 ? 1 : -1;
+        }
+        co_return 0;
+    };
+    CHECK(syncWait(catches()) == 1);
+
+    bool thrown = false;
+    try {
+        syncWait(fail("sync"));
+    } catch (const std::runtime_error& e) {
+        thrown = strcmp(e.what(), "sync") == 0;
+    }
+    CHECK(thrown);
+
+    // The first failure in task order, once the others are done
+    std::atomic<int> finished{ 0 };
+    auto slow = [&finished](int v) -> Task<int> {
+        co_await jobSystem().schedule();
+        std::this_thread::sleep_for(std::chrono::milliseconds(v % 3));
+        ++finished;
+        co_return v;
+    };
+    std::vector<Task<int>> tasks;
+    for (int i = 0; i < 8; ++i) {
+        if (i == 3) tasks.push_back(fail("third"));
+        else if (i == 6) tasks.push_back(fail("sixth"));
+        else tasks.push_back(slow(i));
+    }
+    std::string caught;
+    try {
+        syncWait(whenAll(std::move(tasks)));
+    } catch (const std::runtime_error& e) {
+        caught = e.what();
+    }
+    CHECK(caught == "third");
+    CHECK(finished == 6);
+}
+
+void testWhenAllOrder() {
+    // Later tasks finish first
+    auto delayed = [](int v, int ms) -> Task<int> {
+        co_await jobSystem().schedule();
+        std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+        co_return v;
+    };
+    std::vector<Task<int>> tasks;
+    for (int i = 0; i < 6; ++i) tasks.push_back(delayed(i * 10, 12 - 2 * i));
+    tasks.push_back(value(60));                  // done synchronously
+    std::vector<int> results = syncWait(whenAll(std::move(tasks)));
+    bool ordered = results.size() == 7;
+    for (int i = 0; ordered && i < 7; ++i) ordered = results[i] == i * 10;
+    CHECK(ordered);
+
+    CHECK(syncWait(whenAll(std::vector<Task<int>>())).empty());
+
+    // Many more tasks than workers, some awaiting each other
+    std::vector<Task<int>> many;
+    for (int i = 0; i < 1000; ++i) {
+        many.push_back(i % 2 == 0 ? onWorker(i) : sum(i, 0));
+    }
+    std::vector<int> values = syncWait(whenAll(std::move(many)));
+    bool all = values.size() == 1000;
+    for (int i = 0; all && i < 1000; ++i) all = values[i] == i;
+    CHECK(all);
+}
+
+// Each level awaits the next; without symmetric transfer every resume
+// would nest in the one before it and overflow the stack
+Task<uint64_t> chain(uint32_t depth, bool hop) {
+    if (depth == 0) {
+        if (hop) co_await jobSystem().schedule();
+        co_return 0;
+    }
+    uint64_t below = co_await chain(depth - 1, hop);
+    co_return below + 1;
+}
+
+Task<uint64_t> throwingChain(uint32_t depth) {
+    if (depth == 0) throw std::runtime_error("bottom");
+    co_return co_await throwingChain(depth - 1) + 1;
+}
+
+void testDeepChain() {
+    CHECK(syncWait(chain(1000000, false)) == 1000000);
+    CHECK(syncWait(chain(1000000, true)) == 1000000);
+    bool thrown = false;
+    try {
+        syncWait(throwingChain(100000));
+    } catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    CHECK(thrown);
+}
+
+void testManualExecutor() {
+    ManualExecutor pump;
+    std::thread::id caller = std::this_thread::get_id();
+    auto hops = [&pump]() -> Task<int> {
+        co_await jobSystem().schedule();
+        co_await pump.schedule();
+        co_return 1;
+    };
+    std::thread::id ranOn;
+    auto record = [&]() -> Task<int> {
+        int v = co_await hops();
+        ranOn = std::this_thread::get_id();
+        co_return v;
+    };
+    CHECK(syncWait(record(), &pump) == 1);
+    CHECK(ranOn == caller);
+    CHECK(pump.runPending() == 0);
+}
+
+void checkCoverage(uint32_t count, uint32_t grain, int line) {
+    std::vector<std::atomic<uint32_t>> hits(count);
+    jobSystem().parallelFor(count, grain, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; ++i) ++hits[i];
+    });
+    bool once = true;
+    for (uint32_t i = 0; i < count; ++i) once &= hits[i] == 1;
+    CHECK_AT(once, "every index exactly once", line);
+}
+
+void testParallelFor() {
+    const uint32_t counts[] = { 0, 1, 7, 64, 1000, 100003 };
+    const uint32_t grains[] = { 1, 3, 64, 100000 };
+    for (uint32_t count : counts) {
+        for (uint32_t grain : grains) checkCoverage(count, grain, __LINE__);
+    }
+
+    // From inside workers, which take batches of their own loop
+    std::atomic<uint32_t> total{ 0 };
+    jobSystem().parallelFor(16, 1, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; ++i) {
+            jobSystem().parallelFor(1000, 10, [&](uint32_t b, uint32_t e) {
+                total += e - b;
+            });
+        }
+    });
+    CHECK(total == 16000);
+
+    // And from a coroutine on a worker
+    auto inTask = []() -> Task<int> {
+        co_await jobSystem().schedule();
+        std::atomic<int> n{ 0 };
+        jobSystem().parallelFor(5000, 7, [&n](uint32_t b, uint32_t e) {
+            n += int(e - b);
+        });
+        co_return n.load();
+    };
+    CHECK(syncWait(inTask()) == 5000);
+}
+
+// -----------------------------------------------------------------------------
+namespace fs = std::filesystem;
+
+constexpr size_t kAssetBytes = 64 << 10;
+
+Task<uint64_t> trivial() {
+    co_return 1;
+}
+
+Task<uint64_t> awaitMany(uint32_t count) {
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < count; ++i) total += co_await trivial();
+    co_return total;
+}
+
+Task<uint64_t> hopMany(uint32_t count) {
+    for (uint32_t i = 0; i < count; ++i) co_await jobSystem().schedule();
+    co_return count;
+}
+
+// Reads a file on a worker and folds its bytes, standing in for a decode
+uint64_t readAsset(const std::string& path) {
+    std::vector<uint8_t> bytes(kAssetBytes);
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file == nullptr) return 0;
+    size_t read = fread(bytes.data(), 1, bytes.size(), file);
+    fclose(file);
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < read; ++i) {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+Task<uint64_t> loadAsset(std::string path) {
+    co_await jobSystem().schedule();
+    co_return readAsset(path);
+}
+
+double msSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+void bench(uint32_t assets) {
+    const uint32_t awaits = 10000000;
+    auto start = std::chrono::steady_clock::now();
+    uint64_t total = syncWait(awaitMany(awaits));
+    std::cerr << "co_await of a finished-on-start task: "
+              << msSince(start) * 1e6 / awaits << " ns (" << total << ")"
+              << std::endl;
+
+    const uint32_t hops = 200000;
+    start = std::chrono::steady_clock::now();
+    syncWait(hopMany(hops));
+    std::cerr << "co_await jobSystem().schedule(): "
+              << msSince(start) * 1e6 / hops << " ns" << std::endl;
+
+    fs::path dir = fs::temp_directory_path() / "task_bench";
+    fs::create_directories(dir);
+    std::vector<std::string> paths;
+    std::vector<uint8_t> bytes(kAssetBytes);
+    for (uint32_t a = 0; a < assets; ++a) {
+        for (size_t i = 0; i < bytes.size(); ++i) {
+            bytes[i] = static_cast<uint8_t>(i * 7 + a);
+        }
+        paths.push_back((dir / ("asset" + std::to_string(a))).string());
+        FILE* file = fopen(paths.back().c_str(), "wb");
+        if (file == nullptr) return;
+        fwrite(bytes.data(), 1, bytes.size(), file);
+        fclose(file);
+    }
+
+    start = std::chrono::steady_clock::now();
+    uint64_t serial = 0;
+    for (const std::string& path : paths) serial ^= readAsset(path);
+    double serialMs = msSince(start);
+
+    start = std::chrono::steady_clock::now();
+    std::vector<Task<uint64_t>> loads;
+    for (const std::string& path : paths) loads.push_back(loadAsset(path));
+    uint64_t parallel = 0;
+    for (uint64_t hash : syncWait(whenAll(std::move(loads)))) {
+        parallel ^= hash;
+    }
+    double parallelMs = msSince(start);
+    std::cerr << assets << " assets of " << kAssetBytes / 1024 << " KB on "
+              << jobSystem().workerCount() << " workers: serial "
+              << serialMs << " ms, whenAll " << parallelMs << " ms"
+              << (serial == parallel ? "" : " (MISMATCH)") << std::endl;
+    fs::remove_all(dir);
+}
+
+} // namespace
+
+// -----------------------------------------------------------------------------
+int main(int argc, char* argv[]) {
+    int workers = std::max(2, static_cast<int>(
+                                  std::thread::hardware_concurrency()) - 1);
+    jobSystem().start(workers);
+    if (argc == 3 && strcmp(argv[1], "--bench") == 0) {
+        bench(static_cast<uint32_t>(std::max(1, atoi(argv[2]))));
+        jobSystem().stop();
+        return 0;
+    }
+
+    testBasics();
+    testExceptions();
+    testWhenAllOrder();
+    testDeepChain();
+    testManualExecutor();
+    testParallelFor();
+    jobSystem().stop();
+
+    // With no workers, jobs run inline and parallelFor() is a plain loop
+    CHECK(syncWait(sum(20, 22)) == 42);
+    CHECK(syncWait(chain(1000, true)) == 1000);
+    checkCoverage(1000, 7, __LINE__);
+    return testResult("task");
+}
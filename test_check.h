@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstring>
+#include <iostream>
+
+// -----------------------------------------------------------------------------
+// Checks for the *Test programs. CHECK() prints the file, line and condition
+// of every check that fails and counts it; CHECK_AT() reports a failure at
+// a caller's line, for helpers that check on behalf of several tests.
+// main() ends with `return testResult("name");`, which prints a summary and
+// exits non-zero if anything failed.
+inline int& testFailures() {
+    static int failures = 0;
+    return failures;
+}
+
+inline void testCheck(bool condition, const char* what, const char* file,
+                      int line) {
+    if (condition) return;
+    const char* name = file;
+    for (const char* p = file; *p != '\0'; ++p) {
+        if (*p == '/' || *p == '\\') name = p + 1;
+    }
+    std::cerr << name << ":" << line << ": " << what << std::endl;
+    ++testFailures();
+}
+
+inline int testResult(const char* name) {
+    if (testFailures() > 0) {
+        std::cerr << testFailures() << " checks failed" << std::endl;
+        return 1;
+    }
+    std::cerr << name << ": all tests passed" << std::endl;
+    return 0;
+}
+
+#define CHECK(condition) \
+    testCheck((condition), #condition, __FILE__, __LINE__)
+#define CHECK_AT(condition, what, line) \
+    testCheck((condition), (what), __FILE__, (line))
@@ -0,0 +1,1336 @@
+#include "texture_compress.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#include "job_system.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BC_SSE2 1
+#endif
+
+namespace {
+
+// Blocks per job system batch
+constexpr uint32_t kBlocksPerBatch = 256;
+
+const char* const kQualityNames[] = { "fast", "balanced", "best",
+                                      "reference" };
+
+// BC7 interpolation weights, out of 64, for 2, 3 and 4-bit indices
+const uint8_t kWeights2[4] = { 0, 21, 43, 64 };
+const uint8_t kWeights3[8] = { 0, 9, 18, 27, 37, 46, 55, 64 };
+const uint8_t kWeights4[16] = { 0, 4, 9, 13, 17, 21, 26, 30,
+                                34, 38, 43, 47, 51, 55, 60, 64 };
+
+const uint8_t* bc7Weights(int indexBits) {
+    return indexBits == 2 ? kWeights2 : indexBits == 3 ? kWeights3
+                                                       : kWeights4;
+}
+
+// The texels of one block as bytes and, for the float kernels, as one
+// array per channel
+struct Block {
+    alignas(16) float ch[4][16];
+    alignas(16) uint8_t texels[64];      // RGBA
+};
+
+// The first of a run of channel arrays
+typedef const float (*Channels)[16];
+
+// Up to 16 colors of up to 4 channels
+struct Palette {
+    float c[16][4];
+    uint32_t count = 0;
+};
+
+// -----------------------------------------------------------------------------
+// Kernels shared by the formats
+
+#if BC_SSE2
+inline float sum4(__m128 v) {
+    v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+    v = _mm_add_ss(v, _mm_shuffle_ps(v, v, 1));
+    return _mm_cvtss_f32(v);
+}
+
+inline float min4(__m128 v) {
+    v = _mm_min_ps(v, _mm_movehl_ps(v, v));
+    v = _mm_min_ss(v, _mm_shuffle_ps(v, v, 1));
+    return _mm_cvtss_f32(v);
+}
+
+inline float max4(__m128 v) {
+    v = _mm_max_ps(v, _mm_movehl_ps(v, v));
+    v = _mm_max_ss(v, _mm_shuffle_ps(v, v, 1));
+    return _mm_cvtss_f32(v);
+}
+#endif
+
+inline float clamp255(float v) {
+    return std::min(255.0f, std::max(0.0f, v));
+}
+
+void loadBlock(const Image& image, uint32_t bx, uint32_t by, Block& block) {
+    uint32_t x0 = bx * 4;
+    for (uint32_t y = 0; y < 4; ++y) {
+        uint32_t sy = std::min(by * 4 + y, image.height - 1);
+        const uint8_t* row = image.rgba.data() + size_t(sy) * image.width * 4;
+        uint8_t* texels = block.texels + y * 16;
+        if (x0 + 4 <= image.width) {
+            memcpy(texels, row + size_t(x0) * 4, 16);
+            continue;
+        }
+        for (uint32_t x = 0; x < 4; ++x) {
+            uint32_t sx = std::min(x0 + x, image.width - 1);
+            memcpy(texels + x * 4, row + size_t(sx) * 4, 4);
+        }
+    }
+
+#if BC_SSE2
+    const __m128i mask = _mm_set1_epi32(0xff);
+    for (uint32_t g = 0; g < 16; g += 4) {
+        __m128i t = _mm_load_si128(
+            reinterpret_cast<const __m128i*>(block.texels + g * 4));
+        _mm_store_ps(block.ch[0] + g,
+                     _mm_cvtepi32_ps(_mm_and_si128(t, mask)));
+        _mm_store_ps(block.ch[1] + g, _mm_cvtepi32_ps(
+            _mm_and_si128(_mm_srli_epi32(t, 8), mask)));
+        _mm_store_ps(block.ch[2] + g, _mm_cvtepi32_ps(
+            _mm_and_si128(_mm_srli_epi32(t, 16), mask)));
+        _mm_store_ps(block.ch[3] + g,
+                     _mm_cvtepi32_ps(_mm_srli_epi32(t, 24)));
+    }
+#else
+    for (uint32_t i = 0; i < 16; ++i) {
+        for (uint32_t c = 0; c < 4; ++c) {
+            block.ch[c][i] = block.texels[i * 4 + c];
+        }
+    }
+#endif
+}
+
+// Mean and principal axis of kChannels channels. The axis comes from power
+// iteration on the covariance matrix, started from its largest row.
+template <int kChannels>
+void principalAxis(Channels ch, float mean[4], float axis[4]) {
+    float sum[kChannels];
+    float products[kChannels][kChannels];
+#if BC_SSE2
+    __m128 s[kChannels];
+    __m128 p[kChannels][kChannels];
+    for (int c = 0; c < kChannels; ++c) {
+        s[c] = _mm_setzero_ps();
+        for (int d = c; d < kChannels; ++d) p[c][d] = _mm_setzero_ps();
+    }
+    for (uint32_t g = 0; g < 16; g += 4) {
+        __m128 x[kChannels];
+        for (int c = 0; c < kChannels; ++c) {
+            x[c] = _mm_load_ps(ch[c] + g);
+            s[c] = _mm_add_ps(s[c], x[c]);
+        }
+        for (int c = 0; c < kChannels; ++c) {
+            for (int d = c; d < kChannels; ++d) {
+                p[c][d] = _mm_add_ps(p[c][d], _mm_mul_ps(x[c], x[d]));
+            }
+        }
+    }
+    for (int c = 0; c < kChannels; ++c) {
+        sum[c] = sum4(s[c]);
+        for (int d = c; d < kChannels; ++d) products[c][d] = sum4(p[c][d]);
+    }
+#else
+    for (int c = 0; c < kChannels; ++c) {
+        sum[c] = 0.0f;
+        for (int d = c; d < kChannels; ++d) products[c][d] = 0.0f;
+    }
+    for (uint32_t i = 0; i < 16; ++i) {
+        for (int c = 0; c < kChannels; ++c) {
+            sum[c] += ch[c][i];
+            for (int d = c; d < kChannels; ++d) {
+                products[c][d] += ch[c][i] * ch[d][i];
+            }
+        }
+    }
+#endif
+
+    float covariance[kChannels][kChannels];
+    for (int c = 0; c < kChannels; ++c) mean[c] = sum[c] / 16.0f;
+    int start = 0;
+    for (int c = 0; c < kChannels; ++c) {
+        for (int d = c; d < kChannels; ++d) {
+            covariance[c][d] = products[c][d] / 16.0f - mean[c] * mean[d];
+            covariance[d][c] = covariance[c][d];
+        }
+        if (covariance[c][c] > covariance[start][start]) start = c;
+    }
+
+    float v[kChannels];
+    for (int c = 0; c < kChannels; ++c) v[c] = covariance[start][c];
+    for (int iteration = 0; iteration < 8; ++iteration) {
+        float next[kChannels];
+        float largest = 0.0f;
+        for (int c = 0; c < kChannels; ++c) {
+            next[c] = 0.0f;
+            for (int d = 0; d < kChannels; ++d) {
+                next[c] += covariance[c][d] * v[d];
+            }
+            largest = std::max(largest, std::fabs(next[c]));
+        }
+        if (!(largest > 0.0f)) break;
+        for (int c = 0; c < kChannels; ++c) v[c] = next[c] / largest;
+    }
+
+    float length = 0.0f;
+    for (int c = 0; c < kChannels; ++c) length += v[c] * v[c];
+    length = std::sqrt(length);
+    for (int c = 0; c < kChannels; ++c) {
+        // Flat blocks have no axis; any will do
+        axis[c] = length > 1e-6f ? v[c] / length
+                                 : 1.0f / std::sqrt(float(kChannels));
+    }
+}
+
+// Lowest and highest projection of the texels onto `axis` through `mean`
+template <int kChannels>
+void projectExtent(Channels ch, const float mean[4], const float axis[4],
+                   float& lo, float& hi) {
+#if BC_SSE2
+    __m128 low = _mm_set1_ps(FLT_MAX);
+    __m128 high = _mm_set1_ps(-FLT_MAX);
+    for (uint32_t g = 0; g < 16; g += 4) {
+        __m128 t = _mm_setzero_ps();
+        for (int c = 0; c < kChannels; ++c) {
+            __m128 d = _mm_sub_ps(_mm_load_ps(ch[c] + g),
+                                  _mm_set1_ps(mean[c]));
+            t = _mm_add_ps(t, _mm_mul_ps(d, _mm_set1_ps(axis[c])));
+        }
+        low = _mm_min_ps(low, t);
+        high = _mm_max_ps(high, t);
+    }
+    lo = min4(low);
+    hi = max4(high);
+#else
+    lo = FLT_MAX;
+    hi = -FLT_MAX;
+    for (uint32_t i = 0; i < 16; ++i) {
+        float t = 0.0f;
+        for (int c = 0; c < kChannels; ++c) {
+            t += (ch[c][i] - mean[c]) * axis[c];
+        }
+        lo = std::min(lo, t);
+        hi = std::max(hi, t);
+    }
+#endif
+}
+
+// Nearest palette color for each texel; returns the squared error
+template <int kChannels>
+float selectIndices(Channels ch, const Palette& palette,
+                    uint8_t indices[16]) {
+#if BC_SSE2
+    __m128 total = _mm_setzero_ps();
+    for (uint32_t g = 0; g < 16; g += 4) {
+        __m128 x[kChannels];
+        for (int c = 0; c < kChannels; ++c) x[c] = _mm_load_ps(ch[c] + g);
+        __m128 best = _mm_set1_ps(FLT_MAX);
+        __m128i bestIndex = _mm_setzero_si128();
+        for (uint32_t k = 0; k < palette.count; ++k) {
+            __m128 d = _mm_sub_ps(x[0], _mm_set1_ps(palette.c[k][0]));
+            __m128 error = _mm_mul_ps(d, d);
+            for (int c = 1; c < kChannels; ++c) {
+                d = _mm_sub_ps(x[c], _mm_set1_ps(palette.c[k][c]));
+                error = _mm_add_ps(error, _mm_mul_ps(d, d));
+            }
+            __m128i less = _mm_castps_si128(_mm_cmplt_ps(error, best));
+            best = _mm_min_ps(error, best);
+            bestIndex = _mm_or_si128(
+                _mm_and_si128(less, _mm_set1_epi32(static_cast<int>(k))),
+                _mm_andnot_si128(less, bestIndex));
+        }
+        total = _mm_add_ps(total, best);
+        alignas(16) int32_t lanes[4];
+        _mm_store_si128(reinterpret_cast<__m128i*>(lanes), bestIndex);
+        for (uint32_t i = 0; i < 4; ++i) {
+            indices[g + i] = static_cast<uint8_t>(lanes[i]);
+        }
+    }
+    return sum4(total);
+#else
+    float total = 0.0f;
+    for (uint32_t i = 0; i < 16; ++i) {
+        float best = FLT_MAX;
+        uint8_t bestIndex = 0;
+        for (uint32_t k = 0; k < palette.count; ++k) {
+            float error = 0.0f;
+            for (int c = 0; c < kChannels; ++c) {
+                float d = ch[c][i] - palette.c[k][c];
+                error += d * d;
+            }
+            if (error < best) {
+                best = error;
+                bestIndex = static_cast<uint8_t>(k);
+            }
+        }
+        total += best;
+        indices[i] = bestIndex;
+    }
+    return total;
+#endif
+}
+
+// Endpoints with the least squared error for fixed indices, where index i
+// lies weights[i] of the way from the first endpoint to the second. False
+// when the indices do not pin down two endpoints.
+template <int kChannels>
+bool refit(Channels ch, const uint8_t indices[16], const float* weights,
+           float e0[4], float e1[4]) {
+    float aa = 0.0f;
+    float bb = 0.0f;
+    float ab = 0.0f;
+    float ax[kChannels] = {};
+    float bx[kChannels] = {};
+    for (uint32_t i = 0; i < 16; ++i) {
+        float w = weights[indices[i]];
+        float a = 1.0f - w;
+        aa += a * a;
+        bb += w * w;
+        ab += a * w;
+        for (int c = 0; c < kChannels; ++c) {
+            ax[c] += a * ch[c][i];
+            bx[c] += w * ch[c][i];
+        }
+    }
+    float det = aa * bb - ab * ab;
+    if (std::fabs(det) < 1e-6f) return false;
+    for (int c = 0; c < kChannels; ++c) {
+        e0[c] = clamp255((bb * ax[c] - ab * bx[c]) / det);
+        e1[c] = clamp255((aa * bx[c] - ab * ax[c]) / det);
+    }
+    return true;
+}
+
+// Starting endpoints: the ends of the principal axis, pulled in by `inset`
+// of the extent
+template <int kChannels>
+void axisEndpoints(Channels ch, float inset, float e0[4], float e1[4],
+                   float mean[4], float axis[4]) {
+    principalAxis<kChannels>(ch, mean, axis);
+    float lo;
+    float hi;
+    projectExtent<kChannels>(ch, mean, axis, lo, hi);
+    float pull = (hi - lo) * inset;
+    for (int c = 0; c < kChannels; ++c) {
+        e0[c] = clamp255(mean[c] + axis[c] * (hi - pull));
+        e1[c] = clamp255(mean[c] + axis[c] * (lo + pull));
+    }
+}
+
+// -----------------------------------------------------------------------------
+// BC1 color
+
+// Fraction of the way to the second endpoint, by index
+const float kBc1Weights[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+
+uint16_t pack565(const float c[4]) {
+    auto q = [](float v, int max) {
+        return std::clamp(static_cast<int>(v * max / 255.0f + 0.5f), 0, max);
+    };
+    return static_cast<uint16_t>(q(c[0], 31) << 11 | q(c[1], 63) << 5 |
+                                 q(c[2], 31));
+}
+
+void unpack565(uint16_t v, int c[3]) {
+    int r = v >> 11;
+    int g = (v >> 5) & 63;
+    int b = v & 31;
+    c[0] = r << 3 | r >> 2;
+    c[1] = g << 2 | g >> 4;
+    c[2] = b << 3 | b >> 2;
+}
+
+// Four-color mode: the endpoints and the points a third of the way along
+void bc1Palette(uint16_t c0, uint16_t c1, int palette[4][3]) {
+    int a[3];
+    int b[3];
+    unpack565(c0, a);
+    unpack565(c1, b);
+    for (int c = 0; c < 3; ++c) {
+        palette[0][c] = a[c];
+        palette[1][c] = b[c];
+        palette[2][c] = (2 * a[c] + b[c] + 1) / 3;
+        palette[3][c] = (a[c] + 2 * b[c] + 1) / 3;
+    }
+}
+
+struct Bc1Candidate {
+    uint16_t c0 = 0;
+    uint16_t c1 = 0;
+    uint8_t indices[16] = {};
+    float error = FLT_MAX;
+};
+
+// Replaces `best` if endpoints c0 and c1 do better
+bool tryBc1(Channels ch, uint16_t c0, uint16_t c1, Bc1Candidate& best) {
+    int colors[4][3];
+    bc1Palette(c0, c1, colors);
+    Palette palette;
+    palette.count = 4;
+    for (int k = 0; k < 4; ++k) {
+        for (int c = 0; c < 3; ++c) palette.c[k][c] = float(colors[k][c]);
+    }
+    Bc1Candidate candidate;
+    candidate.c0 = c0;
+    candidate.c1 = c1;
+    candidate.error = selectIndices<3>(ch, palette, candidate.indices);
+    if (candidate.error >= best.error) return false;
+    best = candidate;
+    return true;
+}
+
+void refitBc1(Channels ch, int iterations, Bc1Candidate& best) {
+    for (int i = 0; i < iterations; ++i) {
+        float e0[4];
+        float e1[4];
+        if (!refit<3>(ch, best.indices, kBc1Weights, e0, e1)) return;
+        if (!tryBc1(ch, pack565(e0), pack565(e1), best)) return;
+    }
+}
+
+// Steps of one in each endpoint component while the error drops
+void searchBc1(Channels ch, Bc1Candidate& best) {
+    const int shifts[3] = { 11, 5, 0 };
+    const int maxima[3] = { 31, 63, 31 };
+    for (int round = 0; round < 8; ++round) {
+        bool improved = false;
+        for (int e = 0; e < 2; ++e) {
+            for (int c = 0; c < 3; ++c) {
+                for (int step = -1; step <= 1; step += 2) {
+                    uint16_t endpoints[2] = { best.c0, best.c1 };
+                    int v = (endpoints[e] >> shifts[c]) & maxima[c];
+                    if (v + step < 0 || v + step > maxima[c]) continue;
+                    endpoints[e] = static_cast<uint16_t>(
+                        (endpoints[e] & ~(maxima[c] << shifts[c])) |
+                        (v + step) << shifts[c]);
+                    improved |= tryBc1(ch, endpoints[0], endpoints[1], best);
+                }
+            }
+        }
+        if (!improved) break;
+    }
+}
+
+// Cluster fit: the texels, sorted along the axis, are split into four runs,
+// one per palette color, in every possible way. Each split's least squares
+// endpoints are scored in closed form, before quantization; the best
+// split's endpoints give the axis for the next pass.
+void clusterFitBc1(Channels ch, const float mean[4], const float axis0[4],
+                   Bc1Candidate& best) {
+    float axis[3] = { axis0[0], axis0[1], axis0[2] };
+    for (int pass = 0; pass < 4; ++pass) {
+        float key[16];
+        uint8_t order[16];
+        for (uint8_t i = 0; i < 16; ++i) {
+            key[i] = 0.0f;
+            for (int c = 0; c < 3; ++c) {
+                key[i] += (ch[c][i] - mean[c]) * axis[c];
+            }
+            order[i] = i;
+        }
+        std::sort(order, order + 16,
+                  [&key](uint8_t a, uint8_t b) { return key[a] > key[b]; });
+        float prefix[17][3] = {};
+        for (int k = 0; k < 16; ++k) {
+            for (int c = 0; c < 3; ++c) {
+                prefix[k + 1][c] = prefix[k][c] + ch[c][order[k]];
+            }
+        }
+
+        float bestScore = FLT_MAX;
+        float best0[4] = {};
+        float best1[4] = {};
+        for (int n0 = 0; n0 <= 16; ++n0) {
+            for (int n1 = 0; n0 + n1 <= 16; ++n1) {
+                for (int n2 = 0; n0 + n1 + n2 <= 16; ++n2) {
+                    int n3 = 16 - n0 - n1 - n2;
+                    float aa = n0 + n1 * (4.0f / 9.0f) + n2 * (1.0f / 9.0f);
+                    float bb = n3 + n1 * (1.0f / 9.0f) + n2 * (4.0f / 9.0f);
+                    float ab = (n1 + n2) * (2.0f / 9.0f);
+                    float det = aa * bb - ab * ab;
+                    if (det < 1e-6f) continue;
+                    int k1 = n0;
+                    int k2 = n0 + n1;
+                    int k3 = n0 + n1 + n2;
+                    float e0[4];
+                    float e1[4];
+                    float score = 0.0f;
+                    for (int c = 0; c < 3; ++c) {
+                        float s0 = prefix[k1][c];
+                        float s1 = prefix[k2][c] - prefix[k1][c];
+                        float s2 = prefix[k3][c] - prefix[k2][c];
+                        float s3 = prefix[16][c] - prefix[k3][c];
+                        float ax = s0 + s1 * (2.0f / 3.0f) + s2 * (1.0f / 3.0f);
+                        float bx = s1 * (1.0f / 3.0f) + s2 * (2.0f / 3.0f) + s3;
+                        e0[c] = clamp255((bb * ax - ab * bx) / det);
+                        e1[c] = clamp255((aa * bx - ab * ax) / det);
+                        score += aa * e0[c] * e0[c] +
+                                 2.0f * ab * e0[c] * e1[c] +
+                                 bb * e1[c] * e1[c] -
+                                 2.0f * (e0[c] * ax + e1[c] * bx);
+                    }
+                    if (score < bestScore) {
+                        bestScore = score;
+                        memcpy(best0, e0, sizeof(e0));
+                        memcpy(best1, e1, sizeof(e1));
+                    }
+                }
+            }
+        }
+        if (bestScore == FLT_MAX) return;
+        tryBc1(ch, pack565(best0), pack565(best1), best);
+
+        float length = 0.0f;
+        for (int c = 0; c < 3; ++c) {
+            axis[c] = best0[c] - best1[c];
+            length += axis[c] * axis[c];
+        }
+        if (length < 1e-6f) return;
+        length = std::sqrt(length);
+        for (int c = 0; c < 3; ++c) axis[c] /= length;
+    }
+}
+
+void writeBc1(Bc1Candidate& best, uint8_t out[8]) {
+    // Four-color mode needs c0 > c1; equal endpoints make one color
+    static const uint8_t kSwapped[4] = { 1, 0, 3, 2 };
+    if (best.c0 < best.c1) {
+        std::swap(best.c0, best.c1);
+        for (uint8_t& index : best.indices) index = kSwapped[index];
+    } else if (best.c0 == best.c1) {
+        memset(best.indices, 0, sizeof(best.indices));
+    }
+    uint32_t bits = 0;
+    for (uint32_t i = 0; i < 16; ++i) {
+        bits |= uint32_t(best.indices[i]) << (2 * i);
+    }
+    out[0] = static_cast<uint8_t>(best.c0);
+    out[1] = static_cast<uint8_t>(best.c0 >> 8);
+    out[2] = static_cast<uint8_t>(best.c1);
+    out[3] = static_cast<uint8_t>(best.c1 >> 8);
+    for (uint32_t i = 0; i < 4; ++i) {
+        out[4 + i] = static_cast<uint8_t>(bits >> (8 * i));
+    }
+}
+
+void encodeBc1(const Block& block, BcQuality quality, uint8_t out[8]) {
+    Channels ch = block.ch;
+    float mean[4];
+    float axis[4];
+    float e0[4];
+    float e1[4];
+    // Pulling the ends in by a sixteenth puts the outer palette colors
+    // nearer the texels they stand for
+    axisEndpoints<3>(ch, 1.0f / 16.0f, e0, e1, mean, axis);
+    Bc1Candidate best;
+    tryBc1(ch, pack565(e0), pack565(e1), best);
+    if (quality >= BcQuality::kBalanced) {
+        refitBc1(ch, quality >= BcQuality::kBest ? 4 : 2, best);
+    }
+    if (quality >= BcQuality::kBest) searchBc1(ch, best);
+    if (quality == BcQuality::kReference) {
+        clusterFitBc1(ch, mean, axis, best);
+        refitBc1(ch, 4, best);
+        searchBc1(ch, best);
+    }
+    writeBc1(best, out);
+}
+
+// -----------------------------------------------------------------------------
+// BC4 single channel
+
+// Fraction of the way to e1, by index, in eight-value mode
+const float kBc4Weights[8] = { 0.0f, 1.0f, 1.0f / 7.0f, 2.0f / 7.0f,
+                               3.0f / 7.0f, 4.0f / 7.0f, 5.0f / 7.0f,
+                               6.0f / 7.0f };
+
+// Eight values between the endpoints when e0 > e1; otherwise six, plus 0
+// and 255
+void bc4Palette(int e0, int e1, uint8_t palette[8]) {
+    palette[0] = static_cast<uint8_t>(e0);
+    palette[1] = static_cast<uint8_t>(e1);
+    if (e0 > e1) {
+        for (int i = 1; i < 7; ++i) {
+            palette[i + 1] =
+                static_cast<uint8_t>(((7 - i) * e0 + i * e1 + 3) / 7);
+        }
+    } else {
+        for (int i = 1; i < 5; ++i) {
+            palette[i + 1] =
+                static_cast<uint8_t>(((5 - i) * e0 + i * e1 + 2) / 5);
+        }
+        palette[6] = 0;
+        palette[7] = 255;
+    }
+}
+
+// Nearest palette value for each of 16 values, all 16 at once; returns the
+// squared error
+uint32_t selectBc4(const uint8_t values[16], const uint8_t palette[8],
+                   uint8_t indices[16]) {
+#if BC_SSE2
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(values));
+    __m128i best = _mm_set1_epi8(-1);
+    __m128i bestIndex = _mm_setzero_si128();
+    for (int k = 0; k < 8; ++k) {
+        __m128i p = _mm_set1_epi8(static_cast<char>(palette[k]));
+        __m128i d = _mm_or_si128(_mm_subs_epu8(v, p), _mm_subs_epu8(p, v));
+        // d < best, unsigned: d <= best and d != best
+        __m128i less = _mm_andnot_si128(
+            _mm_cmpeq_epi8(d, best),
+            _mm_cmpeq_epi8(_mm_min_epu8(d, best), d));
+        best = _mm_min_epu8(d, best);
+        bestIndex = _mm_or_si128(
+            _mm_and_si128(less, _mm_set1_epi8(static_cast<char>(k))),
+            _mm_andnot_si128(less, bestIndex));
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(indices), bestIndex);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i low = _mm_unpacklo_epi8(best, zero);
+    __m128i high = _mm_unpackhi_epi8(best, zero);
+    __m128i squares = _mm_add_epi32(_mm_madd_epi16(low, low),
+                                    _mm_madd_epi16(high, high));
+    squares = _mm_add_epi32(squares, _mm_srli_si128(squares, 8));
+    squares = _mm_add_epi32(squares, _mm_srli_si128(squares, 4));
+    return static_cast<uint32_t>(_mm_cvtsi128_si32(squares));
+#else
+    uint32_t total = 0;
+    for (uint32_t i = 0; i < 16; ++i) {
+        int best = 256;
+        for (int k = 0; k < 8; ++k) {
+            int d = std::abs(int(values[i]) - int(palette[k]));
+            if (d < best) {
+                best = d;
+                indices[i] = static_cast<uint8_t>(k);
+            }
+        }
+        total += uint32_t(best * best);
+    }
+    return total;
+#endif
+}
+
+struct Bc4Candidate {
+    int e0 = 0;
+    int e1 = 0;
+    uint8_t indices[16] = {};
+    uint32_t error = UINT32_MAX;
+};
+
+bool tryBc4(const uint8_t values[16], int e0, int e1, Bc4Candidate& best) {
+    if (e0 < 0 || e0 > 255 || e1 < 0 || e1 > 255) return false;
+    uint8_t palette[8];
+    bc4Palette(e0, e1, palette);
+    Bc4Candidate candidate;
+    candidate.e0 = e0;
+    candidate.e1 = e1;
+    candidate.error = selectBc4(values, palette, candidate.indices);
+    if (candidate.error >= best.error) return false;
+    best = candidate;
+    return true;
+}
+
+void refitBc4(Channels ch, const uint8_t values[16], int iterations,
+              Bc4Candidate& best) {
+    for (int i = 0; i < iterations && best.e0 > best.e1; ++i) {
+        float e0[4];
+        float e1[4];
+        if (!refit<1>(ch, best.indices, kBc4Weights, e0, e1)) return;
+        int a = static_cast<int>(e0[0] + 0.5f);
+        int b = static_cast<int>(e1[0] + 0.5f);
+        if (a <= b || !tryBc4(values, a, b, best)) return;
+    }
+}
+
+// Endpoints within `radius` of the best ones, keeping its mode
+void searchBc4(const uint8_t values[16], int radius, Bc4Candidate& best) {
+    int e0 = best.e0;
+    int e1 = best.e1;
+    bool eight = e0 > e1;
+    for (int d0 = -radius; d0 <= radius; ++d0) {
+        for (int d1 = -radius; d1 <= radius; ++d1) {
+            if ((e0 + d0 > e1 + d1) == eight) {
+                tryBc4(values, e0 + d0, e1 + d1, best);
+            }
+        }
+    }
+}
+
+void encodeBc4(const Block& block, uint32_t channel, BcQuality quality,
+               uint8_t out[8]) {
+    uint8_t values[16];
+    int lo = 255;
+    int hi = 0;
+    int innerLo = 255;
+    int innerHi = 0;
+    for (uint32_t i = 0; i < 16; ++i) {
+        int v = block.texels[i * 4 + channel];
+        values[i] = static_cast<uint8_t>(v);
+        lo = std::min(lo, v);
+        hi = std::max(hi, v);
+        if (v != 0 && v != 255) {
+            innerLo = std::min(innerLo, v);
+            innerHi = std::max(innerHi, v);
+        }
+    }
+
+    // Equal endpoints make every index 0
+    Bc4Candidate best;
+    tryBc4(values, hi, lo, best);
+    Channels ch = block.ch + channel;
+    if (hi > lo && quality >= BcQuality::kBalanced) {
+        refitBc4(ch, values, quality >= BcQuality::kBest ? 4 : 2, best);
+        // Six-value mode has exact 0 and 255, which frees its endpoints
+        // for the values in between
+        if ((lo == 0 || hi == 255) && innerLo <= innerHi) {
+            tryBc4(values, innerLo, innerHi, best);
+        }
+    }
+    if (hi > lo && quality >= BcQuality::kBest) searchBc4(values, 2, best);
+    if (hi > lo && quality == BcQuality::kReference) {
+        for (int a = std::max(lo, hi - 8); a <= hi; ++a) {
+            for (int b = lo; b <= std::min(hi, lo + 8); ++b) {
+                if (a > b) tryBc4(values, a, b, best);
+                tryBc4(values, b, a, best);
+            }
+        }
+        refitBc4(ch, values, 4, best);
+        searchBc4(values, 4, best);
+    }
+
+    out[0] = static_cast<uint8_t>(best.e0);
+    out[1] = static_cast<uint8_t>(best.e1);
+    uint64_t bits = 0;
+    for (uint32_t i = 0; i < 16; ++i) {
+        bits |= uint64_t(best.indices[i]) << (3 * i);
+    }
+    for (uint32_t i = 0; i < 6; ++i) {
+        out[2 + i] = static_cast<uint8_t>(bits >> (8 * i));
+    }
+}
+
+// -----------------------------------------------------------------------------
+// BC7
+
+// Fields are stored least significant bit first
+class BitWriter {
+ public:
+    explicit BitWriter(uint8_t* out) : out_(out) { memset(out, 0, 16); }
+
+    void put(uint32_t value, uint32_t bits) {
+        for (uint32_t i = 0; i < bits; ++i, ++at_) {
+            if ((value >> i) & 1) out_[at_ >> 3] |= uint8_t(1 << (at_ & 7));
+        }
+    }
+
+ private:
+    uint8_t* out_;
+    uint32_t at_ = 0;
+};
+
+class BitReader {
+ public:
+    explicit BitReader(const uint8_t* in) : in_(in) {}
+
+    uint32_t get(uint32_t bits) {
+        uint32_t value = 0;
+        for (uint32_t i = 0; i < bits; ++i, ++at_) {
+            value |= uint32_t((in_[at_ >> 3] >> (at_ & 7)) & 1) << i;
+        }
+        return value;
+    }
+
+ private:
+    const uint8_t* in_;
+    uint32_t at_ = 0;
+};
+
+// An endpoint of `bits` bits widened to 8 by repeating its top bits
+inline int expandBits(int value, int bits) {
+    return bits >= 8 ? value : value << (8 - bits) | value >> (2 * bits - 8);
+}
+
+inline int quantizeBits(float value, int bits) {
+    int max = (1 << bits) - 1;
+    return std::clamp(static_cast<int>(value * max / 255.0f + 0.5f), 0, max);
+}
+
+inline int interpolate(int e0, int e1, int weight) {
+    return ((64 - weight) * e0 + weight * e1 + 32) >> 6;
+}
+
+// Mode 6: one RGBA line, 7-bit endpoints plus a p-bit each, 4-bit indices
+struct Bc7Mode6 {
+    int endpoints[2][4] = {};
+    int pbits[2] = {};
+    uint8_t indices[16] = {};
+    float error = FLT_MAX;
+};
+
+// Modes 4 and 5: RGB and one channel, rotated into alpha, on separate lines
+// with separate indices
+struct Bc7Split {
+    int mode = 5;
+    int rotation = 0;            // 0, or 1 + the channel swapped with alpha
+    int indexMode = 0;           // mode 4: 1 gives color the 3-bit indices
+    int color[2][3] = {};
+    int alpha[2] = {};
+    uint8_t colorIndices[16] = {};
+    uint8_t alphaIndices[16] = {};
+    float error = FLT_MAX;
+};
+
+struct SplitLayout {
+    int colorBits;
+    int alphaBits;
+    int colorIndexBits;
+    int alphaIndexBits;
+};
+
+SplitLayout splitLayout(int mode, int indexMode) {
+    if (mode == 5) return { 7, 8, 2, 2 };
+    return indexMode == 1 ? SplitLayout{ 5, 6, 3, 2 }
+                          : SplitLayout{ 5, 6, 2, 3 };
+}
+
+// Picks the p-bit with the lower error unless `forced` is 0 or 1
+void quantizeMode6(const float e[4], int forced, int q[4], int& pbit) {
+    float bestError = FLT_MAX;
+    for (int bit = 0; bit < 2; ++bit) {
+        if (forced >= 0 && bit != forced) continue;
+        int values[4];
+        float error = 0.0f;
+        for (int c = 0; c < 4; ++c) {
+            values[c] = std::clamp(
+                static_cast<int>((e[c] - bit) * 0.5f + 0.5f), 0, 127);
+            float d = float(values[c] * 2 + bit) - e[c];
+            error += d * d;
+        }
+        if (error < bestError) {
+            bestError = error;
+            memcpy(q, values, sizeof(values));
+            pbit = bit;
+        }
+    }
+}
+
+// Replaces `best` if `candidate`'s endpoints do better; picks its indices
+bool evaluateMode6(Channels ch, Bc7Mode6& candidate, Bc7Mode6& best) {
+    Palette palette;
+    palette.count = 16;
+    for (int k = 0; k < 16; ++k) {
+        for (int c = 0; c < 4; ++c) {
+            palette.c[k][c] = float(interpolate(
+                candidate.endpoints[0][c] * 2 + candidate.pbits[0],
+                candidate.endpoints[1][c] * 2 + candidate.pbits[1],
+                kWeights4[k]));
+        }
+    }
+    candidate.error = selectIndices<4>(ch, palette, candidate.indices);
+    if (candidate.error >= best.error) return false;
+    best = candidate;
+    return true;
+}
+
+bool tryMode6(Channels ch, const float e0[4], const float e1[4], int p0,
+              int p1, Bc7Mode6& best) {
+    Bc7Mode6 candidate;
+    quantizeMode6(e0, p0, candidate.endpoints[0], candidate.pbits[0]);
+    quantizeMode6(e1, p1, candidate.endpoints[1], candidate.pbits[1]);
+    return evaluateMode6(ch, candidate, best);
+}
+
+// Steps of one in each endpoint component while the error drops
+void searchMode6(Channels ch, Bc7Mode6& best) {
+    for (int round = 0; round < 4; ++round) {
+        bool improved = false;
+        for (int e = 0; e < 2; ++e) {
+            for (int c = 0; c < 4; ++c) {
+                for (int step = -1; step <= 1; step += 2) {
+                    Bc7Mode6 candidate = best;
+                    int v = candidate.endpoints[e][c] + step;
+                    if (v < 0 || v > 127) continue;
+                    candidate.endpoints[e][c] = v;
+                    improved |= evaluateMode6(ch, candidate, best);
+                }
+            }
+        }
+        if (!improved) break;
+    }
+}
+
+void encodeMode6(const Block& block, BcQuality quality, Bc7Mode6& best) {
+    Channels ch = block.ch;
+    float mean[4];
+    float axis[4];
+    float e0[4];
+    float e1[4];
+    axisEndpoints<4>(ch, 0.0f, e0, e1, mean, axis);
+    tryMode6(ch, e0, e1, -1, -1, best);
+    if (quality == BcQuality::kFast) return;
+
+    float weights[16];
+    for (int k = 0; k < 16; ++k) weights[k] = kWeights4[k] / 64.0f;
+    int refits = quality == BcQuality::kBalanced ? 2
+               : quality == BcQuality::kBest ? 4 : 8;
+    for (int i = 0; i < refits; ++i) {
+        if (!refit<4>(ch, best.indices, weights, e0, e1)) break;
+        if (!tryMode6(ch, e0, e1, -1, -1, best)) break;
+    }
+    if (quality == BcQuality::kBalanced) return;
+
+    // The p-bit nearest each endpoint need not be best for the block
+    if (refit<4>(ch, best.indices, weights, e0, e1)) {
+        for (int p = 0; p < 4; ++p) tryMode6(ch, e0, e1, p & 1, p >> 1, best);
+    }
+    if (quality == BcQuality::kReference) searchMode6(ch, best);
+}
+
+// Endpoints of `endpointBits` for kChannels channels, refitted `refits`
+// times; returns the squared error
+template <int kChannels>
+float fitLine(Channels ch, int endpointBits, int indexBits, int refits,
+              int q0[], int q1[], uint8_t indices[16]) {
+    float mean[4];
+    float axis[4];
+    float e0[4];
+    float e1[4];
+    axisEndpoints<kChannels>(ch, 0.0f, e0, e1, mean, axis);
+    const uint8_t* table = bc7Weights(indexBits);
+    float weights[16];
+    for (int k = 0; k < (1 << indexBits); ++k) weights[k] = table[k] / 64.0f;
+
+    float bestError = FLT_MAX;
+    for (int i = 0; i <= refits; ++i) {
+        if (i > 0 && !refit<kChannels>(ch, indices, weights, e0, e1)) break;
+        int a[4];
+        int b[4];
+        Palette palette;
+        palette.count = 1u << indexBits;
+        for (int c = 0; c < kChannels; ++c) {
+            a[c] = quantizeBits(e0[c], endpointBits);
+            b[c] = quantizeBits(e1[c], endpointBits);
+        }
+        for (uint32_t k = 0; k < palette.count; ++k) {
+            for (int c = 0; c < kChannels; ++c) {
+                palette.c[k][c] = float(interpolate(
+                    expandBits(a[c], endpointBits),
+                    expandBits(b[c], endpointBits), table[k]));
+            }
+        }
+        uint8_t candidate[16];
+        float error = selectIndices<kChannels>(ch, palette, candidate);
+        if (error >= bestError) break;
+        bestError = error;
+        memcpy(q0, a, sizeof(int) * kChannels);
+        memcpy(q1, b, sizeof(int) * kChannels);
+        memcpy(indices, candidate, 16);
+    }
+    return bestError;
+}
+
+void encodeSplit(const Block& block, int mode, int rotation, int indexMode,
+                 BcQuality quality, Bc7Split& best) {
+    alignas(16) float ch[4][16];
+    memcpy(ch, block.ch, sizeof(ch));
+    if (rotation != 0) {
+        std::swap_ranges(ch[3], ch[3] + 16, ch[rotation - 1]);
+    }
+
+    SplitLayout layout = splitLayout(mode, indexMode);
+    int refits = quality == BcQuality::kReference ? 4 : 2;
+    Bc7Split candidate;
+    candidate.mode = mode;
+    candidate.rotation = rotation;
+    candidate.indexMode = indexMode;
+    candidate.error =
+        fitLine<3>(ch, layout.colorBits, layout.colorIndexBits, refits,
+                   candidate.color[0], candidate.color[1],
+                   candidate.colorIndices) +
+        fitLine<1>(ch + 3, layout.alphaBits, layout.alphaIndexBits, refits,
+                   &candidate.alpha[0], &candidate.alpha[1],
+                   candidate.alphaIndices);
+    if (candidate.error < best.error) best = candidate;
+}
+
+// The first index's top bit is implied 0: swap the endpoints to make it so
+template <int kChannels>
+void fixAnchor(int e0[], int e1[], uint8_t indices[16], int indexBits) {
+    int count = 1 << indexBits;
+    if (indices[0] < count / 2) return;
+    for (int c = 0; c < kChannels; ++c) std::swap(e0[c], e1[c]);
+    for (uint32_t i = 0; i < 16; ++i) {
+        indices[i] = static_cast<uint8_t>(count - 1 - indices[i]);
+    }
+}
+
+void putIndices(BitWriter& bits, const uint8_t indices[16], int indexBits) {
+    for (uint32_t i = 0; i < 16; ++i) {
+        bits.put(indices[i], i == 0 ? indexBits - 1 : indexBits);
+    }
+}
+
+void writeMode6(Bc7Mode6& m, uint8_t out[16]) {
+    if (m.indices[0] >= 8) std::swap(m.pbits[0], m.pbits[1]);
+    fixAnchor<4>(m.endpoints[0], m.endpoints[1], m.indices, 4);
+    BitWriter bits(out);
+    bits.put(1 << 6, 7);
+    for (int c = 0; c < 4; ++c) {
+        bits.put(m.endpoints[0][c], 7);
+        bits.put(m.endpoints[1][c], 7);
+    }
+    bits.put(m.pbits[0], 1);
+    bits.put(m.pbits[1], 1);
+    putIndices(bits, m.indices, 4);
+}
+
+void writeSplit(Bc7Split& s, uint8_t out[16]) {
+    SplitLayout layout = splitLayout(s.mode, s.indexMode);
+    fixAnchor<3>(s.color[0], s.color[1], s.colorIndices,
+                 layout.colorIndexBits);
+    fixAnchor<1>(&s.alpha[0], &s.alpha[1], s.alphaIndices,
+                 layout.alphaIndexBits);
+    BitWriter bits(out);
+    bits.put(1u << s.mode, s.mode + 1);
+    bits.put(s.rotation, 2);
+    if (s.mode == 4) bits.put(s.indexMode, 1);
+    for (int c = 0; c < 3; ++c) {
+        bits.put(s.color[0][c], layout.colorBits);
+        bits.put(s.color[1][c], layout.colorBits);
+    }
+    bits.put(s.alpha[0], layout.alphaBits);
+    bits.put(s.alpha[1], layout.alphaBits);
+    // The 2-bit indices come first; in mode 4 they may be alpha's
+    if (s.mode == 4 && s.indexMode == 1) {
+        putIndices(bits, s.alphaIndices, layout.alphaIndexBits);
+        putIndices(bits, s.colorIndices, layout.colorIndexBits);
+    } else {
+        putIndices(bits, s.colorIndices, layout.colorIndexBits);
+        putIndices(bits, s.alphaIndices, layout.alphaIndexBits);
+    }
+}
+
+int worstChannel(const Block& block, const Bc7Mode6& m) {
+    float errors[4] = {};
+    for (uint32_t i = 0; i < 16; ++i) {
+        int weight = kWeights4[m.indices[i]];
+        for (int c = 0; c < 4; ++c) {
+            float d = block.ch[c][i] -
+                      float(interpolate(m.endpoints[0][c] * 2 + m.pbits[0],
+                                        m.endpoints[1][c] * 2 + m.pbits[1],
+                                        weight));
+            errors[c] += d * d;
+        }
+    }
+    return static_cast<int>(std::max_element(errors, errors + 4) - errors);
+}
+
+void encodeBc7(const Block& block, BcQuality quality, uint8_t out[16]) {
+    Bc7Mode6 mode6;
+    encodeMode6(block, quality, mode6);
+    Bc7Split split;
+    if (quality == BcQuality::kBalanced && mode6.error > 0.0f) {
+        // The channel that strays furthest from mode 6's line gets its own
+        int channel = worstChannel(block, mode6);
+        int rotation = channel == 3 ? 0 : channel + 1;
+        encodeSplit(block, 5, rotation, 0, quality, split);
+        encodeSplit(block, 4, rotation, 0, quality, split);
+        encodeSplit(block, 4, rotation, 1, quality, split);
+    } else if (quality >= BcQuality::kBest && mode6.error > 0.0f) {
+        for (int rotation = 0; rotation < 4; ++rotation) {
+            encodeSplit(block, 5, rotation, 0, quality, split);
+            encodeSplit(block, 4, rotation, 0, quality, split);
+            encodeSplit(block, 4, rotation, 1, quality, split);
+        }
+    }
+    if (split.error < mode6.error) {
+        writeSplit(split, out);
+    } else {
+        writeMode6(mode6, out);
+    }
+}
+
+void encodeBlock(const Block& block, TextureFormat format, BcQuality quality,
+                 uint8_t* out) {
+    switch (format) {
+    case TextureFormat::kRgba8:
+        break;
+    case TextureFormat::kBc1:
+        encodeBc1(block, quality, out);
+        break;
+    case TextureFormat::kBc3:
+        encodeBc4(block, 3, quality, out);
+        encodeBc1(block, quality, out + 8);
+        break;
+    case TextureFormat::kBc4:
+        encodeBc4(block, 0, quality, out);
+        break;
+    case TextureFormat::kBc5:
+        encodeBc4(block, 0, quality, out);
+        encodeBc4(block, 1, quality, out + 8);
+        break;
+    case TextureFormat::kBc7:
+        encodeBc7(block, quality, out);
+        break;
+    }
+}
+
+// -----------------------------------------------------------------------------
+// Decoding
+
+// BC3's color block is always in four-color mode
+void decodeBc1(const uint8_t in[8], bool fourColor, uint8_t out[64]) {
+    uint16_t c0 = static_cast<uint16_t>(in[0] | in[1] << 8);
+    uint16_t c1 = static_cast<uint16_t>(in[2] | in[3] << 8);
+    int a[3];
+    int b[3];
+    unpack565(c0, a);
+    unpack565(c1, b);
+    int palette[4][4];
+    for (int c = 0; c < 3; ++c) {
+        palette[0][c] = a[c];
+        palette[1][c] = b[c];
+        if (c0 > c1 || fourColor) {
+            palette[2][c] = (2 * a[c] + b[c] + 1) / 3;
+            palette[3][c] = (a[c] + 2 * b[c] + 1) / 3;
+        } else {
+            palette[2][c] = (a[c] + b[c] + 1) / 2;
+            palette[3][c] = 0;
+        }
+    }
+    palette[0][3] = palette[1][3] = palette[2][3] = 255;
+    palette[3][3] = c0 > c1 || fourColor ? 255 : 0;
+
+    uint32_t bits = uint32_t(in[4]) | uint32_t(in[5]) << 8 |
+                    uint32_t(in[6]) << 16 | uint32_t(in[7]) << 24;
+    for (uint32_t i = 0; i < 16; ++i) {
+        const int* color = palette[(bits >> (2 * i)) & 3];
+        for (int c = 0; c < 4; ++c) out[i * 4 + c] = uint8_t(color[c]);
+    }
+}
+
+void decodeBc4(const uint8_t in[8], uint32_t channel, uint8_t out[64]) {
+    uint8_t palette[8];
+    bc4Palette(in[0], in[1], palette);
+    uint64_t bits = 0;
+    for (uint32_t i = 0; i < 6; ++i) bits |= uint64_t(in[2 + i]) << (8 * i);
+    for (uint32_t i = 0; i < 16; ++i) {
+        out[i * 4 + channel] = palette[(bits >> (3 * i)) & 7];
+    }
+}
+
+// Zeroes channels [first, 3) and makes alpha opaque
+void fillMissing(uint32_t first, uint8_t out[64]) {
+    for (uint32_t i = 0; i < 16; ++i) {
+        for (uint32_t c = first; c < 3; ++c) out[i * 4 + c] = 0;
+        out[i * 4 + 3] = 255;
+    }
+}
+
+bool decodeBc7(const uint8_t in[16], uint8_t out[64]) {
+    int mode = 0;
+    while (mode < 8 && !((in[0] >> mode) & 1)) ++mode;
+    BitReader bits(in);
+    bits.get(mode + 1);
+
+    if (mode == 6) {
+        int e[2][4];
+        for (int c = 0; c < 4; ++c) {
+            e[0][c] = static_cast<int>(bits.get(7));
+            e[1][c] = static_cast<int>(bits.get(7));
+        }
+        int p0 = static_cast<int>(bits.get(1));
+        int p1 = static_cast<int>(bits.get(1));
+        for (int c = 0; c < 4; ++c) {
+            e[0][c] = e[0][c] << 1 | p0;
+            e[1][c] = e[1][c] << 1 | p1;
+        }
+        for (uint32_t i = 0; i < 16; ++i) {
+            int index = static_cast<int>(bits.get(i == 0 ? 3 : 4));
+            for (int c = 0; c < 4; ++c) {
+                out[i * 4 + c] = static_cast<uint8_t>(
+                    interpolate(e[0][c], e[1][c], kWeights4[index]));
+            }
+        }
+        return true;
+    }
+    if (mode != 4 && mode != 5) return false;
+
+    int rotation = static_cast<int>(bits.get(2));
+    int indexMode = mode == 4 ? static_cast<int>(bits.get(1)) : 0;
+    SplitLayout layout = splitLayout(mode, indexMode);
+    int color[2][3];
+    int alpha[2];
+    for (int c = 0; c < 3; ++c) {
+        for (int e = 0; e < 2; ++e) {
+            color[e][c] = expandBits(
+                static_cast<int>(bits.get(layout.colorBits)),
+                layout.colorBits);
+        }
+    }
+    for (int e = 0; e < 2; ++e) {
+        alpha[e] = expandBits(static_cast<int>(bits.get(layout.alphaBits)),
+                              layout.alphaBits);
+    }
+    // The 2-bit indices come first
+    int firstBits = 2;
+    int secondBits = mode == 4 ? 3 : 2;
+    uint8_t first[16];
+    uint8_t second[16];
+    for (uint32_t i = 0; i < 16; ++i) {
+        first[i] = static_cast<uint8_t>(
+            bits.get(i == 0 ? firstBits - 1 : firstBits));
+    }
+    for (uint32_t i = 0; i < 16; ++i) {
+        second[i] = static_cast<uint8_t>(
+            bits.get(i == 0 ? secondBits - 1 : secondBits));
+    }
+    bool swapped = mode == 4 && indexMode == 1;
+    const uint8_t* colorIndices = swapped ? second : first;
+    const uint8_t* alphaIndices = swapped ? first : second;
+    const uint8_t* colorWeights = bc7Weights(layout.colorIndexBits);
+    const uint8_t* alphaWeights = bc7Weights(layout.alphaIndexBits);
+    for (uint32_t i = 0; i < 16; ++i) {
+        int texel[4];
+        for (int c = 0; c < 3; ++c) {
+            texel[c] = interpolate(color[0][c], color[1][c],
+                                   colorWeights[colorIndices[i]]);
+        }
+        texel[3] = interpolate(alpha[0], alpha[1],
+                               alphaWeights[alphaIndices[i]]);
+        if (rotation != 0) std::swap(texel[3], texel[rotation - 1]);
+        for (int c = 0; c < 4; ++c) out[i * 4 + c] = uint8_t(texel[c]);
+    }
+    return true;
+}
+
+} // namespace
+
+// -----------------------------------------------------------------------------
+const char* bcQualityName(BcQuality quality) {
+    return kQualityNames[static_cast<int>(quality)];
+}
+
+bool parseBcQuality(const char* name, BcQuality& quality) {
+    for (int q = 0; q < 4; ++q) {
+        if (strcmp(name, kQualityNames[q]) == 0) {
+            quality = static_cast<BcQuality>(q);
+            return true;
+        }
+    }
+    return false;
+}
+
+void compressImage(const Image& image, TextureFormat format,
+                   BcQuality quality, std::vector<uint8_t>& out) {
+    uint32_t blockBytes = textureBlockBytes(format);
+    if (blockBytes == 0) {
+        out = image.rgba;
+        return;
+    }
+
+    uint32_t blocksWide = (image.width + 3) / 4;
+    uint32_t blocksHigh = (image.height + 3) / 4;
+    out.resize(size_t(blocksWide) * blocksHigh * blockBytes);
+    uint8_t* blocks = out.data();
+    jobSystem().parallelFor(
+        blocksHigh, std::max(1u, kBlocksPerBatch / std::max(1u, blocksWide)),
+        [&](uint32_t begin, uint32_t end) {
+            Block block;
+            for (uint32_t by = begin; by < end; ++by) {
+                for (uint32_t bx = 0; bx < blocksWide; ++bx) {
+                    loadBlock(image, bx, by, block);
+                    encodeBlock(block, format, quality,
+                                blocks + (size_t(by) * blocksWide + bx) *
+                                             blockBytes);
+                }
+            }
+        });
+}
+
+bool decompressImage(const uint8_t* data, size_t size, TextureFormat format,
+                     uint32_t width, uint32_t height, Image& image) {
+    if (size < textureLevelBytes(format, width, height)) return false;
+    image.width = width;
+    image.height = height;
+    image.rgba.resize(size_t(width) * height * 4);
+    uint32_t blockBytes = textureBlockBytes(format);
+    if (blockBytes == 0) {
+        memcpy(image.rgba.data(), data, image.rgba.size());
+        return true;
+    }
+
+    bool ok = true;
+    uint32_t blocksWide = (width + 3) / 4;
+    uint32_t blocksHigh = (height + 3) / 4;
+    for (uint32_t by = 0; by < blocksHigh; ++by) {
+        for (uint32_t bx = 0; bx < blocksWide; ++bx) {
+            const uint8_t* in =
+                data + (size_t(by) * blocksWide + bx) * blockBytes;
+            uint8_t texels[64];
+            switch (format) {
+            case TextureFormat::kRgba8:
+                break;
+            case TextureFormat::kBc1:
+                decodeBc1(in, false, texels);
+                break;
+            case TextureFormat::kBc3:
+                decodeBc1(in + 8, true, texels);
+                decodeBc4(in, 3, texels);
+                break;
+            case TextureFormat::kBc4:
+                decodeBc4(in, 0, texels);
+                fillMissing(1, texels);
+                break;
+            case TextureFormat::kBc5:
+                decodeBc4(in, 0, texels);
+                decodeBc4(in + 8, 1, texels);
+                fillMissing(2, texels);
+                break;
+            case TextureFormat::kBc7:
+                if (!decodeBc7(in, texels)) {
+                    memset(texels, 0, sizeof(texels));
+                    ok = false;
+                }
+                break;
+            }
+            for (uint32_t y = 0; y < 4 && by * 4 + y < height; ++y) {
+                uint32_t columns = std::min(4u, width - bx * 4);
+                memcpy(&image.rgba[(size_t(by * 4 + y) * width + bx * 4) * 4],
+                       texels + y * 16, columns * 4);
+            }
+        }
+    }
+    return ok;
+}
+
+double compressionPsnr(const Image& source, const Image& decoded,
+                       TextureFormat format) {
+    uint32_t channels = textureChannels(format);
+    size_t texels = std::min(source.rgba.size(), decoded.rgba.size()) / 4;
+    double sum = 0.0;
+    for (size_t i = 0; i < texels; ++i) {
+        for (uint32_t c = 0; c < channels; ++c) {
+            double d = double(source.rgba[i * 4 + c]) -
+                       double(decoded.rgba[i * 4 + c]);
+            sum += d * d;
+        }
+    }
+    if (sum == 0.0) return std::numeric_limits<double>::infinity();
+    double mse = sum / (double(texels) * channels);
+    return 10.0 * std::log10(255.0 * 255.0 / mse);
+}
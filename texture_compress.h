@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "texture_file.h"
+
+// -----------------------------------------------------------------------------
+// Block compression of RGBA8 images to BC1, BC3, BC4, BC5 and BC7. Every
+// 4x4 block is encoded on its own, so the blocks of an image are compressed
+// in parallel on the job system, a few rows of blocks per batch. Partial
+// blocks at the right and bottom edges repeat the edge texels.
+//
+//   BC1  RGB: four colors on the line between two 5:6:5 endpoints
+//   BC3  BC1 color plus alpha encoded as BC4
+//   BC4  red: eight values between two 8-bit endpoints
+//   BC5  red and green as two BC4 blocks, for normal maps
+//   BC7  RGBA in the single-subset modes: 6 (RGBA endpoints, 16 levels),
+//        and 4 and 5 (color and one channel with separate indices)
+//
+// Endpoints start from the extent of the texels along their principal
+// axis. Presets then add work:
+//   kFast       that guess only; BC7 uses mode 6 alone
+//   kBalanced   least squares refits of the endpoints to the indices; for
+//               BC7, modes 4 and 5 with the channel mode 6 fits worst
+//               rotated into alpha
+//   kBest       more refits, a search of the neighbouring endpoints and,
+//               for BC7, modes 4 and 5 in every channel rotation
+//   kReference  exhaustive searches (cluster fit for colors, every endpoint
+//               pair near the range for BC4) on top of kBest; the yardstick
+//               the presets are measured against, far too slow to cook with
+//
+// The inner loops (covariance, projections, palette index selection) run on
+// SSE2, four texels or sixteen bytes per register, with scalar fallbacks.
+// Errors are plain sums of squared channel differences, the measure PSNR
+// reports.
+enum class BcQuality : uint8_t {
+    kFast,
+    kBalanced,
+    kBest,
+    kReference,
+};
+
+const char* bcQualityName(BcQuality quality);
+bool parseBcQuality(const char* name, BcQuality& quality);
+
+// Blocks of `image` in `format`, rows of blocks top first, sized by
+// textureLevelBytes(); kRgba8 copies the texels
+void compressImage(const Image& image, TextureFormat format,
+                   BcQuality quality, std::vector<uint8_t>& out);
+
+// Texels back from blocks as the GPU samples them: BC4 as (r, 0, 0, 255),
+// BC5 as (r, g, 0, 255). BC7 blocks must use the modes this encoder writes.
+bool decompressImage(const uint8_t* data, size_t size, TextureFormat format,
+                     uint32_t width, uint32_t height, Image& image);
+
+// Peak signal to noise ratio in dB over the channels `format` stores;
+// infinite when the images match
+double compressionPsnr(const Image& source, const Image& decoded,
+                       TextureFormat format);
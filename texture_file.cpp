@@ -0,0 +1,306 @@
+#include "texture_file.h"
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+namespace {
+
+bool readBytes(const std::string& path, std::vector<uint8_t>& bytes) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        std::cerr << "Failed to open " << path << std::endl;
+        return false;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    bool ok = size >= 0;
+    if (ok) {
+        bytes.resize(static_cast<size_t>(size));
+        ok = fread(bytes.data(), 1, bytes.size(), file) == bytes.size();
+    }
+    fclose(file);
+    if (!ok) std::cerr << "Failed to read " << path << std::endl;
+    return ok;
+}
+
+inline uint32_t read16(const uint8_t* p) {
+    return uint32_t(p[0]) | uint32_t(p[1]) << 8;
+}
+
+const TextureFormat kTextureFormats[] = {
+    TextureFormat::kRgba8, TextureFormat::kBc1, TextureFormat::kBc3,
+    TextureFormat::kBc4, TextureFormat::kBc5, TextureFormat::kBc7,
+};
+
+} // namespace
+
+// -----------------------------------------------------------------------------
+uint64_t TextureInfo::bytesFrom(uint32_t first) const {
+    uint64_t bytes = 0;
+    for (uint32_t l = first; l < levelCount; ++l) bytes += levels[l].bytes;
+    return bytes;
+}
+
+bool TextureInfo::canBeFirst(uint32_t level) const {
+    return textureBlockBytes(format) == 0 ||
+           (levelWidth(level) % 4 == 0 && levelHeight(level) % 4 == 0);
+}
+
+uint32_t textureBlockBytes(TextureFormat format) {
+    switch (format) {
+    case TextureFormat::kRgba8: return 0;
+    case TextureFormat::kBc1: return 8;
+    case TextureFormat::kBc3: return 16;
+    case TextureFormat::kBc4: return 8;
+    case TextureFormat::kBc5: return 16;
+    case TextureFormat::kBc7: return 16;
+    }
+    return 0;
+}
+
+uint32_t textureRowPitch(TextureFormat format, uint32_t width) {
+    uint32_t blockBytes = textureBlockBytes(format);
+    if (blockBytes != 0) return (width + 3) / 4 * blockBytes;
+    return width * 4;
+}
+
+uint32_t textureLevelBytes(TextureFormat format, uint32_t width,
+                           uint32_t height) {
+    if (textureBlockBytes(format) != 0) {
+        return textureRowPitch(format, width) * ((height + 3) / 4);
+    }
+    return textureRowPitch(format, width) * height;
+}
+
+uint32_t textureChannels(TextureFormat format) {
+    switch (format) {
+    case TextureFormat::kRgba8: return 4;
+    case TextureFormat::kBc1: return 3;
+    case TextureFormat::kBc3: return 4;
+    case TextureFormat::kBc4: return 1;
+    case TextureFormat::kBc5: return 2;
+    case TextureFormat::kBc7: return 4;
+    }
+    return 0;
+}
+
+const char* textureFormatName(TextureFormat format) {
+    switch (format) {
+    case TextureFormat::kRgba8: return "rgba8";
+    case TextureFormat::kBc1: return "bc1";
+    case TextureFormat::kBc3: return "bc3";
+    case TextureFormat::kBc4: return "bc4";
+    case TextureFormat::kBc5: return "bc5";
+    case TextureFormat::kBc7: return "bc7";
+    }
+    return "unknown";
+}
+
+bool parseTextureFormat(const char* name, TextureFormat& format) {
+    for (TextureFormat f : kTextureFormats) {
+        if (strcmp(name, textureFormatName(f)) == 0) {
+            format = f;
+            return true;
+        }
+    }
+    return false;
+}
+
+void encodeTextureFile(TextureFormat format, uint32_t width, uint32_t height,
+                       const std::vector<std::vector<uint8_t>>& levels,
+                       std::vector<uint8_t>& out) {
+    TextureFileHeader header = { kTextureFileMagic, kTextureFileVersion,
+                                 static_cast<uint32_t>(format), width,
+                                 height,
+                                 static_cast<uint32_t>(levels.size()) };
+    size_t at = out.size();
+    uint64_t offset = sizeof(header) +
+                      sizeof(TextureLevelEntry) * levels.size();
+    out.resize(at + sizeof(header) +
+               sizeof(TextureLevelEntry) * levels.size());
+    memcpy(&out[at], &header, sizeof(header));
+    at += sizeof(header);
+    for (uint32_t l = 0; l < levels.size(); ++l) {
+        uint32_t w = width >> l > 0 ? width >> l : 1;
+        TextureLevelEntry entry = {
+            offset, static_cast<uint32_t>(levels[l].size()),
+            textureRowPitch(format, w) };
+        memcpy(&out[at], &entry, sizeof(entry));
+        at += sizeof(entry);
+        offset += levels[l].size();
+    }
+    for (const std::vector<uint8_t>& level : levels) {
+        out.insert(out.end(), level.begin(), level.end());
+    }
+}
+
+bool writeTextureFile(const std::string& path, TextureFormat format,
+                      uint32_t width, uint32_t height,
+                      const std::vector<std::vector<uint8_t>>& levels) {
+    std::vector<uint8_t> bytes;
+    encodeTextureFile(format, width, height, levels, bytes);
+    FILE* file = fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        std::cerr << "Failed to open " << path << std::endl;
+        return false;
+    }
+    bool ok = fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+    ok = fclose(file) == 0 && ok;
+    if (!ok) std::cerr << "Failed to write " << path << std::endl;
+    return ok;
+}
+
+bool decodeTextureInfo(const uint8_t* data, size_t size, uint64_t fileSize,
+                       TextureInfo& info) {
+    TextureFileHeader header;
+    if (size < sizeof(header)) return false;
+    memcpy(&header, data, sizeof(header));
+    if (header.magic != kTextureFileMagic ||
+        header.version != kTextureFileVersion ||
+        header.format > static_cast<uint32_t>(TextureFormat::kBc7) ||
+        header.width == 0 || header.height == 0 || header.levelCount == 0 ||
+        header.levelCount > kMaxTextureLevels ||
+        size < sizeof(header) +
+                   sizeof(TextureLevelEntry) * header.levelCount) {
+        return false;
+    }
+
+    info.format = static_cast<TextureFormat>(header.format);
+    info.width = header.width;
+    info.height = header.height;
+    info.levelCount = header.levelCount;
+    memcpy(info.levels, data + sizeof(header),
+           sizeof(TextureLevelEntry) * header.levelCount);
+
+    // Levels are back to back after the table, each of its expected size
+    uint64_t offset = sizeof(header) +
+                      sizeof(TextureLevelEntry) * header.levelCount;
+    for (uint32_t l = 0; l < info.levelCount; ++l) {
+        const TextureLevelEntry& level = info.levels[l];
+        uint32_t w = info.levelWidth(l);
+        uint32_t h = info.levelHeight(l);
+        if (level.offset != offset ||
+            level.bytes != textureLevelBytes(info.format, w, h) ||
+            level.rowPitch != textureRowPitch(info.format, w)) {
+            return false;
+        }
+        offset += level.bytes;
+    }
+    return offset == fileSize;
+}
+
+bool readTextureInfo(const std::string& path, TextureInfo& info) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        std::cerr << "Failed to open " << path << std::endl;
+        return false;
+    }
+
+    uint8_t table[sizeof(TextureFileHeader) +
+                  sizeof(TextureLevelEntry) * kMaxTextureLevels];
+    size_t size = fread(table, 1, sizeof(table), file);
+    bool ok = fseek(file, 0, SEEK_END) == 0;
+    long fileSize = ok ? ftell(file) : -1;
+    fclose(file);
+    ok = fileSize >= 0 &&
+         decodeTextureInfo(table, size, static_cast<uint64_t>(fileSize),
+                           info);
+    if (!ok) std::cerr << "Invalid texture " << path << std::endl;
+    return ok;
+}
+
+// -----------------------------------------------------------------------------
+bool decodeTga(const uint8_t* data, size_t size, Image& image) {
+    const size_t kHeaderBytes = 18;
+    if (size < kHeaderBytes) return false;
+    uint32_t idLength = data[0];
+    uint32_t colorMapType = data[1];
+    uint32_t type = data[2];
+    uint32_t mapLength = read16(data + 5);
+    uint32_t mapEntryBits = data[7];
+    uint32_t width = read16(data + 12);
+    uint32_t height = read16(data + 14);
+    uint32_t bits = data[16];
+    uint32_t descriptor = data[17];
+
+    bool gray = type == 3 || type == 11;
+    bool rle = type == 10 || type == 11;
+    if ((type != 2 && type != 3 && type != 10 && type != 11) ||
+        colorMapType > 1 || width == 0 || height == 0 ||
+        (gray ? bits != 8 : bits != 24 && bits != 32)) {
+        return false;
+    }
+
+    // A color map is allowed before true color data, and skipped
+    size_t at = kHeaderBytes + idLength +
+                (colorMapType == 1 ? mapLength * ((mapEntryBits + 7) / 8)
+                                   : 0);
+    uint32_t pixelBytes = bits / 8;
+    size_t pixels = size_t(width) * height;
+    std::vector<uint8_t> raw(pixels * pixelBytes);
+    if (!rle) {
+        if (size < at || size - at < raw.size()) return false;
+        memcpy(raw.data(), data + at, raw.size());
+    } else {
+        // Packets: a header byte, then one pixel repeated or raw pixels
+        size_t written = 0;
+        while (written < pixels) {
+            if (at >= size) return false;
+            uint32_t packet = data[at++];
+            size_t count = (packet & 0x7f) + 1;
+            size_t bytes = (packet & 0x80 ? 1 : count) * pixelBytes;
+            if (count > pixels - written || size - at < bytes) return false;
+            uint8_t* out = raw.data() + written * pixelBytes;
+            if (packet & 0x80) {
+                for (size_t i = 0; i < count; ++i) {
+                    memcpy(out + i * pixelBytes, data + at, pixelBytes);
+                }
+            } else {
+                memcpy(out, data + at, bytes);
+            }
+            at += bytes;
+            written += count;
+        }
+    }
+
+    // Rows are bottom up unless bit 5 says otherwise; bit 4 mirrors them
+    bool topDown = (descriptor & 0x20) != 0;
+    bool rightToLeft = (descriptor & 0x10) != 0;
+    image.width = width;
+    image.height = height;
+    image.rgba.resize(pixels * 4);
+    for (uint32_t y = 0; y < height; ++y) {
+        uint32_t sourceRow = topDown ? y : height - 1 - y;
+        const uint8_t* row = raw.data() + size_t(sourceRow) * width *
+                             pixelBytes;
+        uint8_t* out = image.rgba.data() + size_t(y) * width * 4;
+        for (uint32_t x = 0; x < width; ++x) {
+            const uint8_t* p =
+                row + size_t(rightToLeft ? width - 1 - x : x) * pixelBytes;
+            if (gray) {
+                out[0] = out[1] = out[2] = p[0];
+                out[3] = 255;
+            } else {
+                out[0] = p[2];
+                out[1] = p[1];
+                out[2] = p[0];
+                out[3] = pixelBytes == 4 ? p[3] : 255;
+            }
+            out += 4;
+        }
+    }
+    return true;
+}
+
+bool readTgaFile(const std::string& path, Image& image) {
+    std::vector<uint8_t> bytes;
+    if (!readBytes(path, bytes)) return false;
+    if (!decodeTga(bytes.data(), bytes.size(), image)) {
+        std::cerr << "Unsupported TGA " << path << std::endl;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+// Texture files with a full mip chain, as written by the texture tool and
+// the asset cook. Each level is stored whole and the levels follow each
+// other, so a streamer reads any run of levels with a single read and
+// uploads them as they are. Block compressed levels hold 4x4 texel blocks,
+// a row of blocks at a time; partial blocks pad the right and bottom edges.
+//
+// Layout, little-endian:
+//   TextureFileHeader
+//   TextureLevelEntry[levelCount]   finest first
+//   level data                      in the same order
+constexpr uint32_t kTextureFileMagic = 0x31584554;   // "TEX1"
+constexpr uint32_t kTextureFileVersion = 1;
+constexpr uint32_t kMaxTextureLevels = 16;           // 32768 x 32768
+
+enum class TextureFormat : uint32_t {
+    kRgba8,                      // 8 bits per channel, rows packed
+    kBc1,                        // RGB, 8 bytes per block
+    kBc3,                        // RGBA, 16 bytes per block
+    kBc4,                        // R, 8 bytes per block
+    kBc5,                        // RG, 16 bytes per block
+    kBc7,                        // RGBA, 16 bytes per block
+};
+
+struct TextureFileHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t format;             // TextureFormat
+    uint32_t width;
+    uint32_t height;
+    uint32_t levelCount;
+};
+
+struct TextureLevelEntry {
+    uint64_t offset;             // in the file
+    uint32_t bytes;
+    uint32_t rowPitch;
+};
+
+static_assert(sizeof(TextureFileHeader) == 24, "no padding on disk");
+static_assert(sizeof(TextureLevelEntry) == 16, "no padding on disk");
+
+struct TextureInfo {
+    TextureFormat format = TextureFormat::kRgba8;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t levelCount = 0;
+    TextureLevelEntry levels[kMaxTextureLevels];
+
+    uint32_t levelWidth(uint32_t level) const {
+        return width >> level > 0 ? width >> level : 1;
+    }
+    uint32_t levelHeight(uint32_t level) const {
+        return height >> level > 0 ? height >> level : 1;
+    }
+    // Whether the level can be the finest one of a texture: D3D wants
+    // whole blocks on the top level of a block compressed texture
+    bool canBeFirst(uint32_t level) const;
+    // Bytes of levels [first, levelCount)
+    uint64_t bytesFrom(uint32_t first) const;
+};
+
+// Uncompressed RGBA8 pixels, rows packed, top row first
+struct Image {
+    uint32_t width = 0;
+    uint32_t height = 0;
+    std::vector<uint8_t> rgba;
+};
+
+// 0 for uncompressed formats
+uint32_t textureBlockBytes(TextureFormat format);
+// Bytes of one row of texels, or of blocks
+uint32_t textureRowPitch(TextureFormat format, uint32_t width);
+uint32_t textureLevelBytes(TextureFormat format, uint32_t width,
+                           uint32_t height);
+// Channels the format stores, from red on
+uint32_t textureChannels(TextureFormat format);
+
+// Lower case names ("rgba8", "bc1", ...) for the tools' options
+const char* textureFormatName(TextureFormat format);
+bool parseTextureFormat(const char* name, TextureFormat& format);
+
+// Levels finest first, each sized by textureLevelBytes()
+void encodeTextureFile(TextureFormat format, uint32_t width, uint32_t height,
+                       const std::vector<std::vector<uint8_t>>& levels,
+                       std::vector<uint8_t>& out);
+bool writeTextureFile(const std::string& path, TextureFormat format,
+                      uint32_t width, uint32_t height,
+                      const std::vector<std::vector<uint8_t>>& levels);
+
+// Validates the header and level table against a file of `fileSize` bytes;
+// `data` needs only hold the header and table
+bool decodeTextureInfo(const uint8_t* data, size_t size, uint64_t fileSize,
+                       TextureInfo& info);
+
+// Reads the header and level table only
+bool readTextureInfo(const std::string& path, TextureInfo& info);
+
+// Truevision TGA input for the tools: uncompressed or run-length encoded
+// true color, 24 or 32 bits per pixel, or 8-bit grayscale. Alpha is opaque
+// unless the file has it.
+bool decodeTga(const uint8_t* data, size_t size, Image& image);
+bool readTgaFile(const std::string& path, Image& image);
@@ -0,0 +1,320 @@
+#include "texture_mips.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "job_system.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MIPS_SSE2 1
+#endif
+
+namespace {
+
+constexpr uint32_t kBoxGrainPixels = 16384;     // output pixels per batch
+constexpr uint32_t kKaiserBandRows = 32;
+constexpr double kKaiserWidth = 3.0;            // output pixels each side
+constexpr double kKaiserAlpha = 4.0;
+constexpr double kPi = 3.14159265358979323846;
+
+// Modified Bessel function of the first kind, order 0, by its series
+double besselI0(double x) {
+    double sum = 1.0;
+    double term = 1.0;
+    double q = x * x / 4.0;
+    for (int k = 1; k < 64 && term > sum * 1e-12; ++k) {
+        term *= q / (double(k) * k);
+        sum += term;
+    }
+    return sum;
+}
+
+// `x` in output pixels from the center
+double kaiser(double x) {
+    double t = x / kKaiserWidth;
+    if (t <= -1.0 || t >= 1.0) return 0.0;
+    double sinc = x == 0.0 ? 1.0 : std::sin(kPi * x) / (kPi * x);
+    return sinc * besselI0(kKaiserAlpha * std::sqrt(1.0 - t * t)) /
+           besselI0(kKaiserAlpha);
+}
+
+// `count` source indices and weights per output pixel along one axis;
+// indices are clamped to the edge, so they never decrease
+struct Taps {
+    uint32_t count = 0;
+    std::vector<uint32_t> index;
+    std::vector<float> weight;
+};
+
+Taps kaiserTaps(uint32_t sourceSize, uint32_t size) {
+    Taps taps;
+    if (sourceSize == size) {
+        taps.count = 1;
+        for (uint32_t i = 0; i < size; ++i) {
+            taps.index.push_back(i);
+            taps.weight.push_back(1.0f);
+        }
+        return taps;
+    }
+
+    double scale = double(sourceSize) / size;
+    double radius = kKaiserWidth * scale;
+    // Source pixel centers strictly inside the radius
+    taps.count = static_cast<uint32_t>(std::ceil(2.0 * radius));
+    taps.index.resize(size_t(size) * taps.count);
+    taps.weight.resize(size_t(size) * taps.count);
+    std::vector<double> weights(taps.count);
+    for (uint32_t i = 0; i < size; ++i) {
+        double center = (i + 0.5) * scale;
+        int64_t first =
+            static_cast<int64_t>(std::floor(center - radius - 0.5)) + 1;
+        double sum = 0.0;
+        for (uint32_t k = 0; k < taps.count; ++k) {
+            int64_t j = first + k;
+            weights[k] = kaiser((j + 0.5 - center) / scale);
+            sum += weights[k];
+            taps.index[size_t(i) * taps.count + k] = static_cast<uint32_t>(
+                std::clamp<int64_t>(j, 0, sourceSize - 1));
+        }
+        for (uint32_t k = 0; k < taps.count; ++k) {
+            taps.weight[size_t(i) * taps.count + k] =
+                static_cast<float>(weights[k] / sum);
+        }
+    }
+    return taps;
+}
+
+// -----------------------------------------------------------------------------
+void boxRows(const Image& source, Image& out, uint32_t begin, uint32_t end) {
+    uint32_t sw = source.width;
+    uint32_t sh = source.height;
+    // Outputs whose two columns are both inside the source
+    uint32_t pairs = sw / 2;
+    for (uint32_t y = begin; y < end; ++y) {
+        const uint8_t* row0 =
+            source.rgba.data() + size_t(std::min(2 * y, sh - 1)) * sw * 4;
+        const uint8_t* row1 =
+            source.rgba.data() + size_t(std::min(2 * y + 1, sh - 1)) * sw * 4;
+        uint8_t* dst = out.rgba.data() + size_t(y) * out.width * 4;
+        uint32_t x = 0;
+#if MIPS_SSE2
+        // Four source pixels from each row make two output pixels: widen to
+        // 16 bits, add the rows, then add neighbouring pixels
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i round = _mm_set1_epi16(2);
+        for (; x + 2 <= pairs; x += 2) {
+            __m128i a = _mm_loadu_si128(
+                reinterpret_cast<const __m128i*>(row0 + x * 8));
+            __m128i b = _mm_loadu_si128(
+                reinterpret_cast<const __m128i*>(row1 + x * 8));
+            __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero),
+                                       _mm_unpacklo_epi8(b, zero));
+            __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero),
+                                       _mm_unpackhi_epi8(b, zero));
+            __m128i sum = _mm_add_epi16(_mm_unpacklo_epi64(lo, hi),
+                                        _mm_unpackhi_epi64(lo, hi));
+            sum = _mm_srli_epi16(_mm_add_epi16(sum, round), 2);
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + x * 4),
+                             _mm_packus_epi16(sum, sum));
+        }
+#endif
+        for (; x < out.width; ++x) {
+            uint32_t x0 = std::min(2 * x, sw - 1) * 4;
+            uint32_t x1 = std::min(2 * x + 1, sw - 1) * 4;
+            for (uint32_t c = 0; c < 4; ++c) {
+                dst[x * 4 + c] = static_cast<uint8_t>(
+                    (row0[x0 + c] + row0[x1 + c] + row1[x0 + c] +
+                     row1[x1 + c] + 2) >> 2);
+            }
+        }
+    }
+}
+
+// One source row to `width` float RGBA pixels; `scratch` holds the source
+// row widened to float
+void kaiserRow(const uint8_t* row, uint32_t sourceWidth, const Taps& taps,
+               uint32_t width, float* scratch, float* out) {
+    uint32_t x = 0;
+#if MIPS_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    for (; x < sourceWidth; ++x) {
+        int32_t pixel;
+        memcpy(&pixel, row + size_t(x) * 4, sizeof(pixel));
+        __m128i v = _mm_unpacklo_epi8(_mm_cvtsi32_si128(pixel), zero);
+        _mm_storeu_ps(scratch + size_t(x) * 4,
+                      _mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero)));
+    }
+    // Four outputs at a time, so their sums do not wait on each other
+    const uint32_t count = taps.count;
+    for (x = 0; x + 4 <= width; x += 4) {
+        const uint32_t* index = &taps.index[size_t(x) * count];
+        const float* weight = &taps.weight[size_t(x) * count];
+        __m128 s0 = _mm_setzero_ps();
+        __m128 s1 = _mm_setzero_ps();
+        __m128 s2 = _mm_setzero_ps();
+        __m128 s3 = _mm_setzero_ps();
+        auto tap = [&](uint32_t i) {
+            return _mm_mul_ps(_mm_set1_ps(weight[i]),
+                              _mm_loadu_ps(scratch + size_t(index[i]) * 4));
+        };
+        for (uint32_t k = 0; k < count; ++k) {
+            s0 = _mm_add_ps(s0, tap(k));
+            s1 = _mm_add_ps(s1, tap(count + k));
+            s2 = _mm_add_ps(s2, tap(2 * count + k));
+            s3 = _mm_add_ps(s3, tap(3 * count + k));
+        }
+        _mm_storeu_ps(out + size_t(x) * 4, s0);
+        _mm_storeu_ps(out + size_t(x) * 4 + 4, s1);
+        _mm_storeu_ps(out + size_t(x) * 4 + 8, s2);
+        _mm_storeu_ps(out + size_t(x) * 4 + 12, s3);
+    }
+    for (; x < width; ++x) {
+        const uint32_t* index = &taps.index[size_t(x) * count];
+        const float* weight = &taps.weight[size_t(x) * count];
+        __m128 sum = _mm_setzero_ps();
+        for (uint32_t k = 0; k < count; ++k) {
+            sum = _mm_add_ps(sum, _mm_mul_ps(
+                _mm_set1_ps(weight[k]),
+                _mm_loadu_ps(scratch + size_t(index[k]) * 4)));
+        }
+        _mm_storeu_ps(out + size_t(x) * 4, sum);
+    }
+#else
+    for (; x < size_t(sourceWidth) * 4; ++x) scratch[x] = row[x];
+    for (x = 0; x < width; ++x) {
+        const uint32_t* index = &taps.index[size_t(x) * taps.count];
+        const float* weight = &taps.weight[size_t(x) * taps.count];
+        float sum[4] = {};
+        for (uint32_t k = 0; k < taps.count; ++k) {
+            const float* p = scratch + size_t(index[k]) * 4;
+            for (uint32_t c = 0; c < 4; ++c) sum[c] += weight[k] * p[c];
+        }
+        memcpy(out + size_t(x) * 4, sum, sizeof(sum));
+    }
+#endif
+}
+
+// Weighted sum of `count` filtered rows, rounded and saturated to bytes
+void kaiserColumn(const float* const* rows, const float* weight,
+                  uint32_t count, uint32_t width, uint8_t* out) {
+    uint32_t x = 0;
+#if MIPS_SSE2
+    // Four pixels at a time: independent sums, and one 16-byte store
+    for (; x + 4 <= width; x += 4) {
+        __m128 s0 = _mm_setzero_ps();
+        __m128 s1 = _mm_setzero_ps();
+        __m128 s2 = _mm_setzero_ps();
+        __m128 s3 = _mm_setzero_ps();
+        for (uint32_t k = 0; k < count; ++k) {
+            const float* row = rows[k] + size_t(x) * 4;
+            __m128 w = _mm_set1_ps(weight[k]);
+            s0 = _mm_add_ps(s0, _mm_mul_ps(w, _mm_loadu_ps(row)));
+            s1 = _mm_add_ps(s1, _mm_mul_ps(w, _mm_loadu_ps(row + 4)));
+            s2 = _mm_add_ps(s2, _mm_mul_ps(w, _mm_loadu_ps(row + 8)));
+            s3 = _mm_add_ps(s3, _mm_mul_ps(w, _mm_loadu_ps(row + 12)));
+        }
+        __m128i lo = _mm_packs_epi32(_mm_cvtps_epi32(s0),
+                                     _mm_cvtps_epi32(s1));
+        __m128i hi = _mm_packs_epi32(_mm_cvtps_epi32(s2),
+                                     _mm_cvtps_epi32(s3));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + size_t(x) * 4),
+                         _mm_packus_epi16(lo, hi));
+    }
+    for (; x < width; ++x) {
+        __m128 sum = _mm_setzero_ps();
+        for (uint32_t k = 0; k < count; ++k) {
+            sum = _mm_add_ps(sum, _mm_mul_ps(
+                _mm_set1_ps(weight[k]), _mm_loadu_ps(rows[k] + x * 4)));
+        }
+        __m128i v = _mm_cvtps_epi32(sum);
+        v = _mm_packs_epi32(v, v);
+        v = _mm_packus_epi16(v, v);
+        int32_t pixel = _mm_cvtsi128_si32(v);
+        memcpy(out + size_t(x) * 4, &pixel, sizeof(pixel));
+    }
+#else
+    for (; x < width; ++x) {
+        for (uint32_t c = 0; c < 4; ++c) {
+            float sum = 0.0f;
+            for (uint32_t k = 0; k < count; ++k) {
+                sum += weight[k] * rows[k][x * 4 + c];
+            }
+            out[x * 4 + c] = static_cast<uint8_t>(
+                std::clamp(sum, 0.0f, 255.0f) + 0.5f);
+        }
+    }
+#endif
+}
+
+void kaiserDownsample(const Image& source, Image& out) {
+    uint32_t width = out.width;
+    uint32_t height = out.height;
+    Taps across = kaiserTaps(source.width, width);
+    Taps down = kaiserTaps(source.height, height);
+    uint32_t bands = (height + kKaiserBandRows - 1) / kKaiserBandRows;
+    jobSystem().parallelFor(bands, 1, [&](uint32_t begin, uint32_t end) {
+        std::vector<float> scratch(size_t(source.width) * 4);
+        std::vector<float> filtered;
+        std::vector<const float*> rows(down.count);
+        for (uint32_t band = begin; band < end; ++band) {
+            uint32_t y0 = band * kKaiserBandRows;
+            uint32_t y1 = std::min(height, y0 + kKaiserBandRows);
+            uint32_t firstRow = down.index[size_t(y0) * down.count];
+            uint32_t lastRow = down.index[size_t(y1) * down.count - 1];
+            size_t rowFloats = size_t(width) * 4;
+            filtered.resize((lastRow - firstRow + 1) * rowFloats);
+            for (uint32_t y = firstRow; y <= lastRow; ++y) {
+                kaiserRow(source.rgba.data() + size_t(y) * source.width * 4,
+                          source.width, across, width, scratch.data(),
+                          &filtered[(y - firstRow) * rowFloats]);
+            }
+            for (uint32_t y = y0; y < y1; ++y) {
+                const uint32_t* index = &down.index[size_t(y) * down.count];
+                for (uint32_t k = 0; k < down.count; ++k) {
+                    rows[k] = &filtered[(index[k] - firstRow) * rowFloats];
+                }
+                kaiserColumn(rows.data(), &down.weight[size_t(y) * down.count],
+                             down.count, width,
+                             out.rgba.data() + size_t(y) * width * 4);
+            }
+        }
+    });
+}
+
+} // namespace
+
+// -----------------------------------------------------------------------------
+uint32_t mipLevelCount(uint32_t width, uint32_t height) {
+    uint32_t levels = 1;
+    for (uint32_t side = std::max(width, height); side > 1; side >>= 1) {
+        ++levels;
+    }
+    return levels;
+}
+
+void downsample(const Image& source, MipFilter filter, Image& out) {
+    out.width = std::max(1u, source.width / 2);
+    out.height = std::max(1u, source.height / 2);
+    out.rgba.resize(size_t(out.width) * out.height * 4);
+    if (filter == MipFilter::kKaiser) {
+        kaiserDownsample(source, out);
+        return;
+    }
+    uint32_t grain = std::max(1u, kBoxGrainPixels / out.width);
+    jobSystem().parallelFor(out.height, grain,
+                            [&](uint32_t begin, uint32_t end) {
+                                boxRows(source, out, begin, end);
+                            });
+}
+
+void generateMips(const Image& source, MipFilter filter,
+                  std::vector<Image>& levels) {
+    levels.resize(mipLevelCount(source.width, source.height));
+    levels[0] = source;
+    for (size_t l = 1; l < levels.size(); ++l) {
+        downsample(levels[l - 1], filter, levels[l]);
+    }
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "texture_file.h"
+
+// -----------------------------------------------------------------------------
+// Mip chain generation for RGBA8 images. Each level halves both sides,
+// rounding down to at least one pixel, and is filtered from the level
+// before it. Channels are filtered as stored; no sRGB conversion is made.
+//
+// kBox averages 2x2 blocks, clamping at odd edges, eight bytes of output
+// per step with SSE2. It is the cheapest filter and blurs the most.
+//
+// kKaiser is a Kaiser-windowed sinc, three output pixels wide, applied as
+// a horizontal then a vertical pass in float with one RGBA pixel per SSE
+// register. It keeps detail that the box filter smears over a few levels,
+// at several times the cost. The passes run in bands of output rows on the
+// job system, each band filtering only the source rows it needs, so the
+// intermediate image never exists in full.
+//
+// Both filters have a scalar fallback for targets without SSE2.
+enum class MipFilter : uint8_t {
+    kBox,
+    kKaiser,
+};
+
+// Levels down to 1x1, level 0 included
+uint32_t mipLevelCount(uint32_t width, uint32_t height);
+
+// The next level of `source`
+void downsample(const Image& source, MipFilter filter, Image& out);
+
+// `levels[0]` is a copy of `source`, the last level is 1x1
+void generateMips(const Image& source, MipFilter filter,
+                  std::vector<Image>& levels);
@@ -0,0 +1,300 @@
+#include "texture_streaming.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+
+#include "job_system.h"
+
+namespace {
+
+// Texture files may pass 2 GB, beyond what fseek() takes on every platform
+bool seek(FILE* file, uint64_t offset) {
+#if defined(_WIN32)
+    return _fseeki64(file, static_cast<__int64>(offset), SEEK_SET) == 0;
+#else
+    return fseeko(file, static_cast<off_t>(offset), SEEK_SET) == 0;
+#endif
+}
+
+bool readRange(const std::string& path, uint64_t offset, uint64_t bytes,
+               std::vector<uint8_t>& data) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        std::cerr << "Failed to open " << path << std::endl;
+        return false;
+    }
+    data.resize(bytes);
+    bool ok = seek(file, offset) &&
+              fread(data.data(), 1, bytes, file) == bytes;
+    fclose(file);
+    if (!ok) std::cerr << "Failed to read " << path << std::endl;
+    return ok;
+}
+
+} // namespace
+
+// -----------------------------------------------------------------------------
+TextureStreamer::TextureStreamer(uint64_t budgetBytes, ApplyCallback apply)
+    : budgetBytes_(budgetBytes), apply_(std::move(apply)) {
+}
+
+TextureStreamer::~TextureStreamer() {
+    // Loads in flight refer to this object
+    std::unique_lock<std::mutex> lock(mutex_);
+    loaded_.wait(lock, [this] { return finished_.size() == inFlight_; });
+}
+
+int TextureStreamer::add(const std::string& path) {
+    Texture texture;
+    texture.path = path;
+    if (!readTextureInfo(path, texture.info)) return -1;
+    const TextureInfo& info = texture.info;
+    if (!info.canBeFirst(0)) return -1;
+    texture.tail = info.levelCount - 1;
+    while (texture.tail > 0 && info.levelWidth(texture.tail - 1) <= kTailSize &&
+           info.levelHeight(texture.tail - 1) <= kTailSize) {
+        --texture.tail;
+    }
+    while (texture.tail > 0 && !info.canBeFirst(texture.tail)) --texture.tail;
+
+    std::vector<uint8_t> data;
+    uint64_t bytes = info.bytesFrom(texture.tail);
+    if (!readRange(path, info.levels[texture.tail].offset, bytes, data)) {
+        return -1;
+    }
+    uint32_t index = static_cast<uint32_t>(textures_.size());
+    if (!apply_({ index, &info, texture.tail, info.levelCount, data.data(),
+                  bytes })) {
+        return -1;
+    }
+    texture.first = texture.tail;
+    texture.planned = texture.tail;
+    textures_.push_back(std::move(texture));
+    residentBytes_ += bytes;
+    stats_.peakResidentBytes =
+        std::max(stats_.peakResidentBytes, residentBytes_);
+    return static_cast<int>(index);
+}
+
+void TextureStreamer::update(const float* projectedPixels) {
+    ++frame_;
+    for (size_t t = 0; t < textures_.size(); ++t) {
+        textures_[t].pixels = projectedPixels[t];
+    }
+    applyFinished();
+    plan();
+
+    for (Texture& texture : textures_) {
+        if (texture.first < texture.planned &&
+            frame_ - texture.wantedFrame >= kEvictDelayFrames) {
+            evict(texture, texture.planned);
+        }
+    }
+    startLoads();
+    stats_.peakResidentBytes =
+        std::max(stats_.peakResidentBytes, residentBytes_);
+}
+
+void TextureStreamer::flush() {
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        loaded_.wait(lock, [this] { return finished_.size() == inFlight_; });
+    }
+    applyFinished();
+}
+
+TextureStreamingStats TextureStreamer::stats() const {
+    TextureStreamingStats stats = stats_;
+    stats.textures = count();
+    stats.budgetBytes = budgetBytes_;
+    stats.residentBytes = residentBytes_;
+    if (!latencies_.empty()) {
+        std::vector<float> latencies = latencies_;
+        auto at = [&latencies](double q) {
+            size_t k = std::min(latencies.size() - 1,
+                                size_t(q * latencies.size()));
+            std::nth_element(latencies.begin(), latencies.begin() + k,
+                             latencies.end());
+            return double(latencies[k]);
+        };
+        stats.latencyP50Ms = at(0.5);
+        stats.latencyP99Ms = at(0.99);
+        stats.latencyMaxMs =
+            *std::max_element(latencies.begin(), latencies.end());
+    }
+    return stats;
+}
+
+// The finest level with at least one texel per projected pixel, or the
+// next finer one that can start the texture
+uint32_t TextureStreamer::wantedLevel(const Texture& texture) const {
+    if (texture.failed || !(texture.pixels > 0.0f)) return texture.tail;
+    float side = static_cast<float>(
+        std::max(texture.info.width, texture.info.height));
+    float level = std::floor(std::log2(side / texture.pixels));
+    uint32_t wanted = static_cast<uint32_t>(
+        std::clamp(level, 0.0f, static_cast<float>(texture.tail)));
+    while (wanted > 0 && !texture.info.canBeFirst(wanted)) --wanted;
+    return wanted;
+}
+
+void TextureStreamer::plan() {
+    uint64_t total = 0;
+    for (Texture& texture : textures_) {
+        texture.planned = wantedLevel(texture);
+        total += texture.info.bytesFrom(texture.planned);
+    }
+    stats_.wantedBytes = total;
+    if (total > budgetBytes_) ++stats_.limitedFrames;
+
+    // Give up the level with the most texels per pixel until it fits
+    while (total > budgetBytes_) {
+        Texture* coarsen = nullptr;
+        float most = 0.0f;
+        for (Texture& texture : textures_) {
+            if (texture.planned >= texture.tail) continue;
+            float texels = static_cast<float>(
+                std::max(texture.info.levelWidth(texture.planned),
+                         texture.info.levelHeight(texture.planned)));
+            float perPixel = texels / texture.pixels;
+            if (coarsen == nullptr || perPixel > most) {
+                coarsen = &texture;
+                most = perPixel;
+            }
+        }
+        if (coarsen == nullptr) break;
+        do {
+            total -= coarsen->info.levels[coarsen->planned].bytes;
+            ++coarsen->planned;
+        } while (coarsen->planned < coarsen->tail &&
+                 !coarsen->info.canBeFirst(coarsen->planned));
+    }
+
+    Clock::time_point now = Clock::now();
+    for (Texture& texture : textures_) {
+        if (texture.planned <= texture.first) texture.wantedFrame = frame_;
+        if (texture.planned < texture.first && !texture.waiting) {
+            texture.waiting = true;
+            texture.requested = now;
+        } else if (texture.planned >= texture.first) {
+            texture.waiting = false;
+        }
+    }
+}
+
+// A load is applied down to the current plan, and only if the texture did
+// not lose levels while it was in flight
+void TextureStreamer::applyFinished() {
+    std::vector<Load> finished;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        finished.swap(finished_);
+        inFlight_ -= static_cast<uint32_t>(finished.size());
+    }
+
+    Clock::time_point now = Clock::now();
+    for (const Load& load : finished) {
+        Texture& texture = textures_[load.texture];
+        const TextureInfo& info = texture.info;
+        texture.loading = false;
+        inFlightBytes_ -= info.bytesFrom(load.first) - info.bytesFrom(load.end);
+        if (!load.ok) {
+            texture.failed = true;
+            ++stats_.failedLoads;
+            continue;
+        }
+
+        uint32_t first = std::max(load.first, texture.planned);
+        if (first >= texture.first || load.end != texture.first) continue;
+        const uint8_t* data = load.data.data() +
+            (info.levels[first].offset - info.levels[load.first].offset);
+        uint64_t bytes = info.bytesFrom(first) - info.bytesFrom(texture.first);
+        if (!apply_({ load.texture, &info, first, texture.first, data,
+                      bytes })) {
+            continue;
+        }
+        residentBytes_ += bytes;
+        texture.first = first;
+        ++stats_.loads;
+        stats_.loadedBytes += bytes;
+        if (texture.waiting && first <= texture.planned) {
+            latencies_.push_back(std::chrono::duration<float, std::milli>(
+                now - texture.requested).count());
+            texture.waiting = false;
+        }
+    }
+}
+
+void TextureStreamer::evict(Texture& texture, uint32_t level) {
+    uint32_t index = static_cast<uint32_t>(&texture - textures_.data());
+    uint64_t bytes =
+        texture.info.bytesFrom(texture.first) - texture.info.bytesFrom(level);
+    if (!apply_({ index, &texture.info, level, texture.first, nullptr,
+                  bytes })) {
+        return;
+    }
+    residentBytes_ -= bytes;
+    texture.first = level;
+    ++stats_.evictions;
+    stats_.evictedBytes += bytes;
+}
+
+// Evicts every level kept past the plan; false if there were none
+bool TextureStreamer::evictKept() {
+    bool any = false;
+    for (Texture& texture : textures_) {
+        if (texture.first < texture.planned) {
+            evict(texture, texture.planned);
+            any = true;
+        }
+    }
+    return any;
+}
+
+void TextureStreamer::startLoads() {
+    std::vector<uint32_t> order;
+    for (uint32_t t = 0; t < textures_.size(); ++t) {
+        const Texture& texture = textures_[t];
+        if (texture.planned < texture.first && !texture.loading) {
+            order.push_back(t);
+        }
+    }
+    std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) {
+        return textures_[a].pixels > textures_[b].pixels;
+    });
+
+    bool evicted = false;
+    for (uint32_t t : order) {
+        if (inFlight_ >= kMaxLoadsInFlight) break;
+        Texture& texture = textures_[t];
+        const TextureInfo& info = texture.info;
+        uint64_t bytes =
+            info.bytesFrom(texture.planned) - info.bytesFrom(texture.first);
+        if (residentBytes_ + inFlightBytes_ + bytes > budgetBytes_ &&
+            !evicted) {
+            evictKept();
+            evicted = true;
+        }
+        if (residentBytes_ + inFlightBytes_ + bytes > budgetBytes_) continue;
+
+        texture.loading = true;
+        inFlightBytes_ += bytes;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ++inFlight_;
+        }
+        uint32_t first = texture.planned;
+        uint32_t end = texture.first;
+        uint64_t offset = info.levels[first].offset;
+        std::string path = texture.path;
+        jobSystem().submit([this, t, first, end, offset, bytes, path] {
+            Load load = { t, first, end, false, {} };
+            load.ok = readRange(path, offset, bytes, load.data);
+            std::lock_guard<std::mutex> lock(mutex_);
+            finished_.push_back(std::move(load));
+            loaded_.notify_all();
+        });
+    }
+}
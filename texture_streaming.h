@@ -0,0 +1,151 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "texture_file.h"
+
+// -----------------------------------------------------------------------------
+// Streams texture mip levels in and out of a byte budget. Each texture keeps
+// one run of levels resident, from its finest resident level down to 1x1.
+// The tail, the levels no larger than kTailSize on either side, is read
+// when the texture is added and never leaves. Block compressed textures
+// only start on levels made of whole blocks (TextureInfo::canBeFirst()),
+// so their tail and wanted levels round to finer ones where needed.
+//
+// update() runs once per frame with each texture's projected size: the
+// pixels its width spans on screen, or 0 when it is not seen. A texture
+// wants the finest level that still has a texel per pixel. When the wanted
+// levels do not fit the budget, levels are given up one at a time by the
+// texture with the most texels per pixel, so textures large on screen keep
+// their detail the longest.
+//
+// Missing levels load as one read per texture on the job system, at most
+// kMaxLoadsInFlight at once and largest on screen first. Finished loads are
+// applied by the next update(). Levels no longer wanted stay for
+// kEvictDelayFrames, as the camera often turns back, unless a load needs
+// their memory.
+//
+// Residency changes reach the renderer through the apply callback, always
+// from add() or update(). Latency runs from the update() that first wanted
+// a level to the one that made it resident.
+//
+// Not thread safe: use from one thread, normally the one that owns the
+// device context.
+struct TextureResidencyChange {
+    uint32_t texture;
+    const TextureInfo* info;
+    uint32_t firstLevel;         // finest level resident after the change
+    uint32_t previousFirst;
+    // Levels [firstLevel, previousFirst) back to back, when they were
+    // loaded; nullptr when levels were evicted
+    const uint8_t* data;
+    uint64_t bytes;              // of those levels
+};
+
+struct TextureStreamingStats {
+    uint32_t textures = 0;
+    uint64_t budgetBytes = 0;
+    uint64_t residentBytes = 0;
+    uint64_t peakResidentBytes = 0;
+    uint64_t wantedBytes = 0;    // in the last update(), before the budget
+    uint64_t loads = 0;
+    uint64_t loadedBytes = 0;
+    uint64_t failedLoads = 0;
+    uint64_t evictions = 0;
+    uint64_t evictedBytes = 0;
+    uint64_t limitedFrames = 0;  // wanted levels did not fit the budget
+    double latencyP50Ms = 0.0;
+    double latencyP99Ms = 0.0;
+    double latencyMaxMs = 0.0;
+};
+
+class TextureStreamer {
+ public:
+    // Returns false if the renderer could not take the change, which then
+    // does not happen
+    typedef std::function<bool(const TextureResidencyChange&)> ApplyCallback;
+
+    static constexpr uint32_t kTailSize = 64;
+    static constexpr uint32_t kMaxLoadsInFlight = 4;
+    static constexpr uint32_t kEvictDelayFrames = 60;
+
+    TextureStreamer(uint64_t budgetBytes, ApplyCallback apply);
+    ~TextureStreamer();
+    TextureStreamer(const TextureStreamer&) = delete;
+    TextureStreamer& operator=(const TextureStreamer&) = delete;
+
+    // Reads the texture's header and tail; returns its index, or -1
+    int add(const std::string& path);
+
+    void setBudget(uint64_t bytes) { budgetBytes_ = bytes; }
+
+    // `projectedPixels` holds one entry per texture
+    void update(const float* projectedPixels);
+
+    // Waits for the loads in flight and applies them
+    void flush();
+
+    uint32_t count() const { return static_cast<uint32_t>(textures_.size()); }
+    const TextureInfo& info(uint32_t texture) const {
+        return textures_[texture].info;
+    }
+    uint32_t firstResident(uint32_t texture) const {
+        return textures_[texture].first;
+    }
+
+    TextureStreamingStats stats() const;
+
+ private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Texture {
+        std::string path;
+        TextureInfo info;
+        uint32_t tail = 0;           // first level of the tail
+        uint32_t first = 0;          // finest resident level
+        uint32_t planned = 0;        // finest level within the budget
+        bool loading = false;
+        bool failed = false;         // a load failed; no more are tried
+        bool waiting = false;        // planned < first since `requested`
+        Clock::time_point requested;
+        uint64_t wantedFrame = 0;    // last frame `first` was within plan
+        float pixels = 0.0f;
+    };
+
+    // Levels [first, end) of one texture
+    struct Load {
+        uint32_t texture;
+        uint32_t first;
+        uint32_t end;
+        bool ok;
+        std::vector<uint8_t> data;
+    };
+
+    uint32_t wantedLevel(const Texture& texture) const;
+    void plan();
+    void applyFinished();
+    void evict(Texture& texture, uint32_t level);
+    bool evictKept();
+    void startLoads();
+
+    uint64_t budgetBytes_;
+    ApplyCallback apply_;
+    std::vector<Texture> textures_;
+    uint64_t frame_ = 0;
+    uint64_t residentBytes_ = 0;
+    uint64_t inFlightBytes_ = 0;
+    uint32_t inFlight_ = 0;
+    std::vector<float> latencies_;
+    TextureStreamingStats stats_;
+
+    // Shared with the load jobs
+    std::mutex mutex_;
+    std::condition_variable loaded_;
+    std::vector<Load> finished_;
+};
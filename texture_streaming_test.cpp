@@ -0,0 +1,334 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "job_system.h"
+#include "test_check.h"
+#include "texture_file.h"
+#include "texture_mips.h"
+#include "texture_streaming.h"
+
+// -----------------------------------------------------------------------------
+// Tests for mip generation and TextureStreamer: the box filter, SSE2 where
+// built with it, matching the plain 2x2 average at odd and even sizes; the
+// Kaiser filter returning a flat image for a flat one and the same bytes
+// however its bands spread over workers; the streamer holding the levels
+// it made resident within the budget, coarsening the texture with the most
+// texels per pixel first, and every residency change it reports joining
+// the levels already resident, including when a load lands after its
+// texture was evicted. With --bench it generates the mips of an image of
+// that size with each filter and prints megapixels per second.
+//
+//   TextureStreamingTest [--bench <size>]
+namespace {
+
+namespace fs = std::filesystem;
+
+Image noise(uint32_t width, uint32_t height, uint32_t seed) {
+    std::mt19937 rng(seed);
+    Image image;
+    image.width = width;
+    image.height = height;
+    image.rgba.resize(size_t(width) * height * 4);
+    for (uint8_t& byte : image.rgba) byte = static_cast<uint8_t>(rng());
+    return image;
+}
+
+// The 2x2 average with clamped edges, as the filter is specified
+Image boxReference(const Image& source) {
+    Image out;
+    out.width = std::max(1u, source.width / 2);
+    out.height = std::max(1u, source.height / 2);
+    out.rgba.resize(size_t(out.width) * out.height * 4);
+    auto at = [&source](uint32_t x, uint32_t y, uint32_t c) {
+        x = std::min(x, source.width - 1);
+        y = std::min(y, source.height - 1);
+        return source.rgba[(size_t(y) * source.width + x) * 4 + c];
+    };
+    for (uint32_t y = 0; y < out.height; ++y) {
+        for (uint32_t x = 0; x < out.width; ++x) {
+            for (uint32_t c = 0; c < 4; ++c) {
+                out.rgba[(size_t(y) * out.width + x) * 4 + c] =
+                    static_cast<uint8_t>(
+                        (at(2 * x, 2 * y, c) + at(2 * x + 1, 2 * y, c) +
+                         at(2 * x, 2 * y + 1, c) +
+                         at(2 * x + 1, 2 * y + 1, c) + 2) >> 2);
+            }
+        }
+    }
+    return out;
+}
+
+const uint32_t kSizes[][2] = {
+    { 1, 1 }, { 2, 2 }, { 3, 5 }, { 4, 1 }, { 1, 40 }, { 9, 9 },
+    { 17, 6 }, { 64, 64 }, { 129, 77 }, { 300, 200 },
+};
+
+void testBox() {
+    uint32_t seed = 0;
+    for (const auto& size : kSizes) {
+        Image source = noise(size[0], size[1], ++seed);
+        Image out;
+        downsample(source, MipFilter::kBox, out);
+        Image expected = boxReference(source);
+        CHECK(out.width == expected.width && out.height == expected.height);
+        CHECK_AT(out.rgba == expected.rgba, "box filter matches the average",
+                 __LINE__);
+    }
+
+    std::vector<Image> levels;
+    generateMips(noise(300, 200, 7), MipFilter::kBox, levels);
+    CHECK(levels.size() == mipLevelCount(300, 200) && levels.size() == 9);
+    CHECK(levels.back().width == 1 && levels.back().height == 1);
+    bool chained = true;
+    for (size_t l = 1; l < levels.size(); ++l) {
+        chained &= levels[l].rgba == boxReference(levels[l - 1]).rgba;
+    }
+    CHECK(chained);
+}
+
+void testKaiser() {
+    const uint8_t flat[][4] = {
+        { 0, 0, 0, 0 }, { 255, 255, 255, 255 }, { 201, 99, 13, 128 },
+    };
+    for (const auto& size : kSizes) {
+        for (const auto& color : flat) {
+            Image source;
+            source.width = size[0];
+            source.height = size[1];
+            for (uint32_t p = 0; p < size[0] * size[1]; ++p) {
+                source.rgba.insert(source.rgba.end(), color, color + 4);
+            }
+            Image out;
+            downsample(source, MipFilter::kKaiser, out);
+            bool same = out.width == std::max(1u, size[0] / 2) &&
+                        out.height == std::max(1u, size[1] / 2);
+            for (size_t i = 0; same && i < out.rgba.size(); ++i) {
+                same = out.rgba[i] == color[i % 4];
+            }
+            CHECK_AT(same, "flat in, flat out", __LINE__);
+        }
+    }
+
+    // Bands are filtered independently, so workers change nothing
+    Image source = noise(517, 389, 3);
+    std::vector<Image> serial;
+    generateMips(source, MipFilter::kKaiser, serial);
+    jobSystem().start(3);
+    std::vector<Image> parallel;
+    generateMips(source, MipFilter::kKaiser, parallel);
+    jobSystem().stop();
+    bool same = serial.size() == parallel.size();
+    for (size_t l = 0; same && l < serial.size(); ++l) {
+        same = serial[l].rgba == parallel[l].rgba;
+    }
+    CHECK(same);
+}
+
+// -----------------------------------------------------------------------------
+// An RGBA8 texture of `side` texels with its full chain, in the temp dir
+std::string writeTexture(const char* name, uint32_t side) {
+    std::vector<Image> chain;
+    generateMips(noise(side, side, side), MipFilter::kBox, chain);
+    std::vector<std::vector<uint8_t>> levels;
+    for (Image& level : chain) levels.push_back(std::move(level.rgba));
+    std::string path = (fs::temp_directory_path() / name).string();
+    return writeTextureFile(path, TextureFormat::kRgba8, side, side, levels)
+               ? path : "";
+}
+
+// Follows the changes the streamer reports, as a renderer would, and
+// checks each one extends or trims the run of levels already resident
+struct Residency {
+    std::vector<uint32_t> first;
+    uint64_t bytes = 0;
+    bool joined = true;
+
+    TextureStreamer::ApplyCallback callback() {
+        return [this](const TextureResidencyChange& change) {
+            if (change.texture == first.size()) {
+                first.push_back(change.info->levelCount);
+            }
+            const TextureInfo& info = *change.info;
+            uint64_t bytes = change.data != nullptr
+                ? info.bytesFrom(change.firstLevel) -
+                      info.bytesFrom(change.previousFirst)
+                : info.bytesFrom(change.previousFirst) -
+                      info.bytesFrom(change.firstLevel);
+            joined &= change.texture < first.size() &&
+                      change.previousFirst == first[change.texture] &&
+                      change.bytes == bytes &&
+                      (change.data != nullptr) ==
+                          (change.firstLevel < change.previousFirst);
+            if (change.data != nullptr) {
+                this->bytes += change.bytes;
+            } else {
+                this->bytes -= change.bytes;
+            }
+            first[change.texture] = change.firstLevel;
+            return true;
+        };
+    }
+};
+
+// Updates until the loads the plan asks for have landed
+void settle(TextureStreamer& streamer, const std::vector<float>& pixels) {
+    for (int frame = 0; frame < 4; ++frame) {
+        streamer.update(pixels.data());
+        streamer.flush();
+    }
+}
+
+// Two 1024 textures: A fills 1024 pixels and wants level 0 (1 texel per
+// pixel), B fills 300 and wants level 1 (1.7 texels per pixel). B gives up
+// a level first, then A, whose 1 texel per pixel beats B's 0.85.
+void testBudget() {
+    std::string a = writeTexture("texture_streaming_test_a.tex", 1024);
+    std::string b = writeTexture("texture_streaming_test_b.tex", 1024);
+    CHECK(!a.empty() && !b.empty());
+    const uint64_t level0 = 1024 * 1024 * 4;
+    const struct {
+        uint64_t budget;
+        uint32_t firstA, firstB;
+    } cases[] = {
+        { 2 * level0, 0, 1 },              // everything wanted fits
+        { level0 * 3 / 2, 0, 2 },
+        { level0 * 5 / 4, 1, 2 },
+        { level0 / 4, 2, 3 },
+    };
+    jobSystem().start(2);
+    for (const auto& c : cases) {
+        Residency residency;
+        TextureStreamer streamer(c.budget, residency.callback());
+        CHECK(streamer.add(a) == 0 && streamer.add(b) == 1);
+        CHECK(streamer.firstResident(0) == 4);   // 64x64 starts the tail
+        settle(streamer, { 1024.0f, 300.0f });
+        TextureStreamingStats stats = streamer.stats();
+        CHECK_AT(streamer.firstResident(0) == c.firstA &&
+                 streamer.firstResident(1) == c.firstB,
+                 "coarsens the most texels per pixel first", __LINE__);
+        CHECK(stats.peakResidentBytes <= c.budget);
+        CHECK(stats.residentBytes == residency.bytes);
+        CHECK(stats.wantedBytes ==
+              streamer.info(0).bytesFrom(0) + streamer.info(1).bytesFrom(1));
+        CHECK((stats.limitedFrames > 0) == (c.budget < 2 * level0));
+        CHECK(residency.joined);
+        CHECK(residency.first[0] == c.firstA && residency.first[1] == c.firstB);
+    }
+
+    // Out of view for a while, everything returns to the tail
+    Residency residency;
+    TextureStreamer streamer(2 * level0, residency.callback());
+    streamer.add(a);
+    streamer.add(b);
+    settle(streamer, { 1024.0f, 300.0f });
+    CHECK(streamer.firstResident(0) == 0);
+    std::vector<float> hidden = { 0.0f, 0.0f };
+    for (uint32_t frame = 0; frame < TextureStreamer::kEvictDelayFrames;
+         ++frame) {
+        streamer.update(hidden.data());
+    }
+    CHECK(streamer.firstResident(0) == 4 && streamer.firstResident(1) == 4);
+    CHECK(streamer.stats().evictions == 2);
+    CHECK(residency.joined);
+    jobSystem().stop();
+    fs::remove(a);
+    fs::remove(b);
+}
+
+// A load of T's level 0 waits behind a blocked worker. Meanwhile T leaves
+// the view and U's load needs the memory T keeps, so T is evicted to its
+// tail; then T comes back into view. When the level 0 read lands, T wants
+// it again, but it no longer joins the levels resident and must be dropped.
+void testLoadAfterEviction() {
+    std::string t = writeTexture("texture_streaming_test_t.tex", 512);
+    std::string u = writeTexture("texture_streaming_test_u.tex", 512);
+    jobSystem().start(1);
+    Residency residency;
+    TextureStreamer streamer(2621440, residency.callback());
+    CHECK(streamer.add(t) == 0 && streamer.add(u) == 1);
+    settle(streamer, { 256.0f, 0.0f });
+    CHECK(streamer.firstResident(0) == 1 && streamer.firstResident(1) == 3);
+
+    std::atomic<bool> release{ false };
+    jobSystem().submit([&release] {
+        while (!release) std::this_thread::yield();
+    });
+    std::vector<float> tInView = { 512.0f, 0.0f };
+    std::vector<float> uInView = { 0.0f, 512.0f };
+    streamer.update(tInView.data());         // T's level 0 queued
+    streamer.update(uInView.data());         // T evicted for U's load
+    CHECK(streamer.firstResident(0) == 3);
+    streamer.update(tInView.data());         // T wanted again
+    uint64_t loads = streamer.stats().loads;
+
+    release = true;
+    streamer.flush();
+    CHECK(streamer.firstResident(0) == 3);
+    CHECK(streamer.stats().loads == loads);
+    CHECK(streamer.stats().failedLoads == 0);
+    CHECK(residency.joined);
+
+    // A fresh load brings T in whole
+    settle(streamer, tInView);
+    CHECK(streamer.firstResident(0) == 0 && streamer.firstResident(1) == 3);
+    CHECK(residency.joined);
+    CHECK(residency.first[0] == 0 && residency.first[1] == 3);
+    CHECK(streamer.stats().residentBytes == residency.bytes);
+    CHECK(streamer.stats().peakResidentBytes <= 2621440);
+    jobSystem().stop();
+    fs::remove(t);
+    fs::remove(u);
+}
+
+// -----------------------------------------------------------------------------
+void bench(uint32_t size) {
+    Image source = noise(size, size, 1);
+    int workers = std::max(1, static_cast<int>(
+                                  std::thread::hardware_concurrency()) - 1);
+    for (int pool = 0; pool < 2; ++pool) {
+        if (pool == 1) jobSystem().start(workers);
+        for (MipFilter filter : { MipFilter::kBox, MipFilter::kKaiser }) {
+            std::vector<Image> levels;
+            generateMips(source, filter, levels);       // warm up
+            const int runs = 5;
+            auto start = std::chrono::steady_clock::now();
+            for (int run = 0; run < runs; ++run) {
+                generateMips(source, filter, levels);
+            }
+            double ms = std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - start).count() / runs;
+            std::cerr << size << "x" << size << " "
+                      << (filter == MipFilter::kBox ? "box" : "kaiser")
+                      << (pool == 0 ? ", serial" : ", job system") << ": "
+                      << ms << " ms, " << double(size) * size / (ms * 1e3)
+                      << " Mpixels/s" << std::endl;
+        }
+    }
+    jobSystem().stop();
+}
+
+} // namespace
+
+// -----------------------------------------------------------------------------
+int main(int argc, char* argv[]) {
+    if (argc == 3 && strcmp(argv[1], "--bench") == 0) {
+        bench(static_cast<uint32_t>(std::max(1, atoi(argv[2]))));
+        return 0;
+    }
+
+    testBox();
+    testKaiser();
+    testBudget();
+    testLoadAfterEviction();
+    return testResult("texture_streaming");
+}
@@ -0,0 +1,403 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <random>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "hw_counters.h"
+#include "job_system.h"
+#include "sampling_profiler.h"
+#include "texture_compress.h"
+#include "texture_file.h"
+#include "texture_mips.h"
+#include "texture_streaming.h"
+
+// -----------------------------------------------------------------------------
+// Offline tool that builds mip chains, block compresses them and writes them
+// as .tex files for the renderer's --texture option, and benchmarks mip
+// generation, block compression and texture streaming. Inputs are TGA
+// images; levels are filtered and compressed on the job system. --format
+// picks rgba8 or a BC format (bc7 unless given), --quality the compression
+// preset (balanced unless given).
+//
+//   TextureTool [--filter box|kaiser] <output dir> <input.tga>...
+//   TextureTool [options] [--hw-counters] --bench <size>
+//   TextureTool [options] [--budget-mb n] --stream <textures> <work dir>
+//
+// --bench builds the chain of a procedural size x size image with each
+// filter and prints megapixels per second of source, then compresses the
+// image to every BC format with the reference encoder and each preset and
+// prints megapixels per second and PSNR against the source, with each
+// preset's loss from the reference. The reference is the kReference preset,
+// an exhaustive search too slow for cooking. --hw-counters adds IPC and
+// cache, branch and dTLB miss rates, over every thread, to each of those
+// lines, and writes the counts of each as a line of JSON to stdout.
+// --sample-profile samples every thread's stacks (SIGPROF,
+// --sample-hz, default 997) into <prefix>.folded and a <prefix>.svg
+// flamegraph. --stream writes that
+// many 1024 x 1024 textures in a row and flies a camera past them for 300
+// frames of 16 ms, streaming under the budget from files dropped from the
+// page cache where the platform allows, and prints resident bytes and
+// streaming latency.
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr uint32_t kStreamTextureSize = 1024;
+constexpr uint32_t kStreamFrames = 300;
+constexpr auto kStreamFrameTime = std::chrono::milliseconds(16);
+
+double msSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+const char* baseName(const std::string& path) {
+    size_t slash = path.find_last_of("/\\");
+    return path.c_str() + (slash == std::string::npos ? 0 : slash + 1);
+}
+
+const char* filterName(MipFilter filter) {
+    return filter == MipFilter::kKaiser ? "kaiser" : "box";
+}
+
+// Rings and a checkerboard over noise: detail at every scale, which is
+// what tells the filters apart. Alpha is a diagonal ramp, so the alpha
+// formats have something to encode.
+Image testImage(uint32_t size, uint32_t seed) {
+    Image image;
+    image.width = size;
+    image.height = size;
+    image.rgba.resize(size_t(size) * size * 4);
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<int> noise(-24, 24);
+    float phase = static_cast<float>(seed % 17);
+    for (uint32_t y = 0; y < size; ++y) {
+        for (uint32_t x = 0; x < size; ++x) {
+            float u = float(x) / size - 0.5f;
+            float v = float(y) / size - 0.5f;
+            float ring = 0.5f + 0.5f * std::sin(
+                (u * u + v * v) * 400.0f + phase);
+            bool check = ((x >> 4) ^ (y >> 4)) & 1;
+            uint8_t* p = &image.rgba[(size_t(y) * size + x) * 4];
+            p[0] = static_cast<uint8_t>(std::clamp(
+                int(ring * 200.0f) + noise(rng), 0, 255));
+            p[1] = static_cast<uint8_t>(check ? 180 : 60);
+            p[2] = static_cast<uint8_t>(std::clamp(
+                int(x * 255 / size) + noise(rng), 0, 255));
+            p[3] = static_cast<uint8_t>((x + y) * 255 / (2 * size));
+        }
+    }
+    return image;
+}
+
+// D3D only creates block compressed textures of whole blocks; other sizes
+// are written as rgba8
+bool writeChain(const std::string& path, const std::vector<Image>& chain,
+                TextureFormat format, BcQuality quality) {
+    if (chain[0].width % 4 != 0 || chain[0].height % 4 != 0) {
+        if (format != TextureFormat::kRgba8) {
+            std::cerr << path << ": " << chain[0].width << " x "
+                      << chain[0].height << " is not whole blocks, "
+                      << "writing rgba8" << std::endl;
+        }
+        format = TextureFormat::kRgba8;
+    }
+    std::vector<std::vector<uint8_t>> levels(chain.size());
+    for (size_t l = 0; l < chain.size(); ++l) {
+        compressImage(chain[l], format, quality, levels[l]);
+    }
+    return writeTextureFile(path, format, chain[0].width, chain[0].height,
+                            levels);
+}
+
+void dropFromPageCache(const std::string& path) {
+#if defined(__linux__)
+    int file = open(path.c_str(), O_RDONLY);
+    if (file < 0) return;
+    fdatasync(file);        // dirty pages would stay cached
+    posix_fadvise(file, 0, 0, POSIX_FADV_DONTNEED);
+    close(file);
+#else
+    (void)path;
+#endif
+}
+
+// Counter summary of a bench step, when counting, and its JSON on stdout
+void printCounters(const HwCounterSpan& counters, const std::string& step) {
+    std::string summary = counters.summary();
+    if (summary.empty()) return;
+    std::cerr << "    " << summary << std::endl;
+    std::cout << counters.json(step.c_str()) << std::endl;
+}
+
+// The reference runs first so that each preset can be compared with it
+void benchCompression(const Image& source, bool hwCounters) {
+    const TextureFormat formats[] = {
+        TextureFormat::kBc1, TextureFormat::kBc3, TextureFormat::kBc4,
+        TextureFormat::kBc5, TextureFormat::kBc7,
+    };
+    const BcQuality qualities[] = {
+        BcQuality::kReference, BcQuality::kFast, BcQuality::kBalanced,
+        BcQuality::kBest,
+    };
+    double megapixels = double(source.width) * source.height / 1e6;
+    for (TextureFormat format : formats) {
+        double referencePsnr = 0.0;
+        for (BcQuality quality : qualities) {
+            std::vector<uint8_t> blocks;
+            HwCounterSpan counters(hwCounters);
+            auto start = std::chrono::steady_clock::now();
+            compressImage(source, format, quality, blocks);
+            double ms = msSince(start);
+            counters.stop();
+            Image decoded;
+            decompressImage(blocks.data(), blocks.size(), format,
+                            source.width, source.height, decoded);
+            double psnr = compressionPsnr(source, decoded, format);
+            std::cerr << "  " << textureFormatName(format) << " "
+                      << bcQualityName(quality) << ": " << ms << " ms, "
+                      << megapixels / std::max(ms, 1e-3) * 1000.0
+                      << " MP/s, PSNR " << psnr << " dB";
+            if (quality == BcQuality::kReference) {
+                referencePsnr = psnr;
+            } else {
+                std::cerr << " (" << psnr - referencePsnr
+                          << " dB from the reference)";
+            }
+            std::cerr << std::endl;
+            printCounters(counters, std::string(textureFormatName(format)) +
+                                    " " + bcQualityName(quality));
+        }
+    }
+}
+
+void bench(uint32_t size, bool hwCounters) {
+    Image source = testImage(size, 1);
+    for (MipFilter filter : { MipFilter::kBox, MipFilter::kKaiser }) {
+        std::vector<Image> chain;
+        generateMips(source, filter, chain);    // warm up
+        HwCounterSpan counters(hwCounters);
+        auto start = std::chrono::steady_clock::now();
+        const int runs = 4;
+        for (int r = 0; r < runs; ++r) generateMips(source, filter, chain);
+        double ms = msSince(start) / runs;
+        std::cerr << "  " << filterName(filter) << ": " << chain.size()
+                  << " levels in " << ms << " ms, "
+                  << double(size) * size / ms / 1000.0 << " MP/s"
+                  << std::endl;
+        printCounters(counters, filterName(filter));
+    }
+}
+
+// Texture t sits at x = t; the camera moves along x at a fixed height, so
+// each texture grows on screen as it approaches and shrinks behind it
+int stream(uint32_t count, const std::string& workDir, uint64_t budget,
+           TextureFormat format, BcQuality quality) {
+    std::error_code error;
+    fs::create_directories(workDir, error);
+    std::vector<std::string> paths;
+    for (uint32_t t = 0; t < count; ++t) {
+        std::string path = workDir + "/stream" + std::to_string(t) + ".tex";
+        std::vector<Image> chain;
+        generateMips(testImage(kStreamTextureSize, t + 1), MipFilter::kBox,
+                     chain);
+        if (!writeChain(path, chain, format, quality)) return 1;
+        dropFromPageCache(path);
+        paths.push_back(path);
+    }
+
+    // Stand-in for the GPU: each texture's resident levels, copied in
+    std::vector<std::vector<uint8_t>> uploaded(count);
+    TextureStreamer streamer(
+        budget, [&uploaded](const TextureResidencyChange& change) {
+            std::vector<uint8_t>& levels = uploaded[change.texture];
+            if (change.data == nullptr) {
+                levels.erase(levels.begin(), levels.begin() + change.bytes);
+            } else {
+                levels.insert(levels.begin(), change.data,
+                              change.data + change.bytes);
+            }
+            return true;
+        });
+    for (const std::string& path : paths) {
+        if (streamer.add(path) < 0) return 1;
+    }
+
+    std::vector<float> pixels(count);
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t frame = 0; frame < kStreamFrames; ++frame) {
+        auto next = std::chrono::steady_clock::now() + kStreamFrameTime;
+        float camera = -2.0f + (count + 4.0f) * frame / kStreamFrames;
+        for (uint32_t t = 0; t < count; ++t) {
+            float distance = std::fabs(camera - t) + 0.25f;
+            pixels[t] = distance < 6.0f ? 1024.0f / distance : 0.0f;
+        }
+        streamer.update(pixels.data());
+        std::this_thread::sleep_until(next);
+    }
+    streamer.flush();
+    double ms = msSince(start);
+
+    TextureStreamingStats s = streamer.stats();
+    std::cerr << "Streamed " << s.textures << " textures over "
+              << kStreamFrames << " frames in " << ms << " ms" << std::endl;
+    std::cerr << "  budget " << (s.budgetBytes >> 20) << " MB, resident "
+              << (s.residentBytes >> 10) << " KB, peak "
+              << (s.peakResidentBytes >> 10) << " KB, wanted "
+              << (s.wantedBytes >> 10) << " KB in the last frame, "
+              << s.limitedFrames << " frames limited by the budget"
+              << std::endl;
+    std::cerr << "  " << s.loads << " loads (" << (s.loadedBytes >> 20)
+              << " MB), " << s.evictions << " evictions ("
+              << (s.evictedBytes >> 20) << " MB), " << s.failedLoads
+              << " failed; latency p50 " << s.latencyP50Ms << " ms, p99 "
+              << s.latencyP99Ms << " ms, max " << s.latencyMaxMs << " ms"
+              << std::endl;
+    return s.failedLoads == 0 ? 0 : 1;
+}
+
+} // namespace
+
+// -----------------------------------------------------------------------------
+int main(int argc, char* argv[]) {
+    MipFilter filter = MipFilter::kKaiser;
+    TextureFormat format = TextureFormat::kBc7;
+    BcQuality quality = BcQuality::kBalanced;
+    int workerCount = -1;
+    uint32_t benchSize = 0;
+    uint32_t streamTextures = 0;
+    uint64_t budget = 64ull << 20;
+    bool hwCounters = false;
+    const char* sampleProfilePath = nullptr;
+    int sampleHz = 997;
+    std::vector<std::string> paths;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            ++i;
+            filter = strcmp(argv[i], "box") == 0 ? MipFilter::kBox
+                                                 : MipFilter::kKaiser;
+        } else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            if (!parseTextureFormat(argv[++i], format)) {
+                std::cerr << "Unknown format " << argv[i] << std::endl;
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--quality") == 0 && i + 1 < argc) {
+            if (!parseBcQuality(argv[++i], quality)) {
+                std::cerr << "Unknown quality " << argv[i] << std::endl;
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            workerCount = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--bench") == 0 && i + 1 < argc) {
+            benchSize = static_cast<uint32_t>(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--stream") == 0 && i + 1 < argc) {
+            streamTextures = static_cast<uint32_t>(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--budget-mb") == 0 && i + 1 < argc) {
+            budget = static_cast<uint64_t>(atof(argv[++i]) * (1 << 20));
+        } else if (strcmp(argv[i], "--hw-counters") == 0) {
+            hwCounters = true;
+        } else if (strcmp(argv[i], "--sample-profile") == 0 && i + 1 < argc) {
+            sampleProfilePath = argv[++i];
+        } else if (strcmp(argv[i], "--sample-hz") == 0 && i + 1 < argc) {
+            sampleHz = atoi(argv[++i]);
+        } else {
+            paths.push_back(argv[i]);
+        }
+    }
+
+    bool usage = benchSize > 0 ? !paths.empty()
+               : streamTextures > 0 ? paths.size() != 1
+               : paths.size() < 2;
+    if (usage) {
+        std::cerr << "Usage: TextureTool [--filter box|kaiser] [--workers n] "
+                     "[--format rgba8|bc1|bc3|bc4|bc5|bc7]\n"
+                     "                   [--quality "
+                     "fast|balanced|best|reference]\n"
+                     "                   [--sample-profile prefix] "
+                     "[--sample-hz n] <output dir> <input.tga>...\n"
+                     "       TextureTool [options] [--hw-counters] "
+                     "--bench <size>\n"
+                     "       TextureTool [options] [--budget-mb n] "
+                     "--stream <textures> <work dir>"
+                  << std::endl;
+        return 1;
+    }
+
+    if (workerCount < 0) {
+        workerCount = std::max(
+            0, static_cast<int>(std::thread::hardware_concurrency()) - 1);
+    }
+    // Workers open their counters as they start
+    if (hwCounters) hw_counters::countNewThreads();
+    jobSystem().start(workerCount);
+
+    samplingProfiler().registerCurrentThread("main");
+    if (sampleProfilePath != nullptr && !samplingProfiler().start(sampleHz)) {
+        std::cerr << "Failed to start sampling profiler" << std::endl;
+    }
+
+    int result = 0;
+    if (benchSize > 0) {
+        if (hwCounters && !hw_counters::available()) {
+            std::cerr << "Hardware counters unavailable" << std::endl;
+        }
+        std::cerr << "Mip chain of " << benchSize << " x " << benchSize
+                  << ", " << workerCount + 1 << " threads" << std::endl;
+        bench(benchSize, hwCounters);
+        std::cerr << "Block compression of " << benchSize << " x "
+                  << benchSize << std::endl;
+        benchCompression(testImage(benchSize, 1), hwCounters);
+    } else if (streamTextures > 0) {
+        result = stream(streamTextures, paths[0], budget, format, quality);
+    } else {
+        auto start = std::chrono::steady_clock::now();
+        uint64_t pixels = 0;
+        for (size_t i = 1; i < paths.size(); ++i) {
+            std::string name = baseName(paths[i]);
+            std::string output = paths[0] + "/" +
+                                 name.substr(0, name.find_last_of('.')) +
+                                 ".tex";
+            Image image;
+            std::vector<Image> chain;
+            if (!readTgaFile(paths[i], image)) {
+                result = 1;
+                continue;
+            }
+            generateMips(image, filter, chain);
+            if (!writeChain(output, chain, format, quality)) {
+                result = 1;
+                continue;
+            }
+            pixels += uint64_t(image.width) * image.height;
+            std::cerr << paths[i] << " -> " << output << ": "
+                      << image.width << " x " << image.height << ", "
+                      << chain.size() << " levels" << std::endl;
+        }
+        double ms = msSince(start);
+        std::cerr << pixels / 1e6 << " MP in " << ms << " ms with the "
+                  << filterName(filter) << " filter, "
+                  << textureFormatName(format) << " "
+                  << bcQualityName(quality) << " ("
+                  << pixels / std::max(ms, 1e-3) / 1000.0 << " MP/s, "
+                  << workerCount + 1 << " threads)" << std::endl;
+    }
+    jobSystem().stop();
+    if (samplingProfiler().running()) {
+        samplingProfiler().stopAndWrite(sampleProfilePath);
+    }
+    return result;
+}
@@ -0,0 +1,113 @@
+#include "upload_manager.h"
+
+#include <chrono>
+#include <iostream>
+
+// -----------------------------------------------------------------------------
+UploadManager::UploadManager()
+    : pRing_(nullptr),
+      batching_(true) {
+}
+
+UploadManager::~UploadManager() {
+    release();
+}
+
+HRESULT UploadManager::init(ID3D11Device* device, uint32_t ringBytes) {
+    release();
+
+    // Dynamic buffers need a bind flag even if they are only copied from
+    D3D11_BUFFER_DESC desc = {};
+    desc.Usage = D3D11_USAGE_DYNAMIC;
+    const uint32_t a = UploadPlan::kRunAlignment;
+    desc.ByteWidth = (ringBytes + a - 1) & ~(a - 1);
+    desc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+    desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+
+    HRESULT hr = device->CreateBuffer(&desc, nullptr, &pRing_);
+    if (FAILED(hr)) {
+        std::cerr << "Failed to create upload ring" << std::endl;
+        return hr;
+    }
+    ring_.reset(desc.ByteWidth);
+    return S_OK;
+}
+
+void UploadManager::release() {
+    if (pRing_) {
+        pRing_->Release();
+        pRing_ = nullptr;
+    }
+    ring_.reset(0);
+    plan_.clear();
+}
+
+void UploadManager::enqueue(ID3D11Buffer* dest, uint32_t offset,
+                            const void* data, uint32_t bytes) {
+    if (dest == nullptr || bytes == 0) return;
+    plan_.add(dest, offset, data, bytes);
+    ++stats_.updates;
+    stats_.bytes += bytes;
+}
+
+void UploadManager::flush(ID3D11DeviceContext* context) {
+    if (plan_.empty()) return;
+    auto start = std::chrono::steady_clock::now();
+    ++stats_.batches;
+
+    uint32_t stagingBytes = plan_.build();
+    if (!batching_ || pRing_ == nullptr || !ring_.fits(stagingBytes)) {
+        flushIndividually(context);
+    } else {
+        // Wrap by discarding; the GPU keeps reading the old contents
+        bool discard = false;
+        uint32_t head = ring_.place(stagingBytes, &discard);
+        D3D11_MAP mapType = discard ? D3D11_MAP_WRITE_DISCARD
+                                    : D3D11_MAP_WRITE_NO_OVERWRITE;
+
+        D3D11_MAPPED_SUBRESOURCE mapped;
+        if (FAILED(context->Map(pRing_, 0, mapType, 0, &mapped))) {
+            flushIndividually(context);
+        } else {
+            plan_.fill(static_cast<uint8_t*>(mapped.pData) + head);
+            context->Unmap(pRing_, 0);
+
+            for (const UploadRun& run : plan_.runs()) {
+                D3D11_BOX box = {};
+                box.left = head + run.staging;
+                box.right = box.left + run.end - run.begin;
+                box.bottom = 1;
+                box.back = 1;
+                context->CopySubresourceRegion(run.dest, 0, run.begin, 0, 0,
+                                               pRing_, 0, &box);
+            }
+            stats_.copies += plan_.runs().size();
+            ring_.commit(head, stagingBytes);
+        }
+    }
+
+    plan_.clear();
+    stats_.cpuMs += std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+void UploadManager::flushIndividually(ID3D11DeviceContext* context) {
+    if (batching_) ++stats_.fallbacks;
+
+    for (const UploadUpdate& u : plan_.updates()) {
+        // Whole-buffer writes go without a box; constant buffers require it
+        D3D11_BUFFER_DESC desc;
+        u.dest->GetDesc(&desc);
+        if (u.offset == 0 && u.bytes == desc.ByteWidth) {
+            context->UpdateSubresource(u.dest, 0, nullptr, u.data, 0, 0);
+        } else {
+            D3D11_BOX box = {};
+            box.left = u.offset;
+            box.right = u.offset + u.bytes;
+            box.bottom = 1;
+            box.back = 1;
+            context->UpdateSubresource(u.dest, 0, &box, u.data, 0, 0);
+        }
+    }
+    stats_.copies += plan_.updates().size();
+}
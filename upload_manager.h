@@ -0,0 +1,59 @@
+#pragma once
+
+#include <d3d11.h>
+
+#include <cstdint>
+
+#include "upload_plan.h"
+
+// -----------------------------------------------------------------------------
+// Coalesces buffer updates into a single staging copy per batch. Updates are
+// queued with enqueue() and issued by flush(): UploadPlan merges them into
+// runs with a slice of a linear staging ring each, and each run becomes one
+// CopySubresourceRegion. Overlapping updates still resolve in submission
+// order because the payloads are written into the runs in the order they
+// were queued.
+//
+// The staging ring is a dynamic buffer filled with WRITE_NO_OVERWRITE and
+// discarded when it wraps, so a flush never waits on the GPU. Batches that
+// do not fit the ring fall back to one UpdateSubresource per update.
+//
+// Context-thread only. Payload pointers must stay valid until flush().
+struct UploadStats {
+    uint64_t updates = 0;        // enqueue() calls
+    uint64_t copies = 0;         // GPU copies actually issued
+    uint64_t bytes = 0;          // payload bytes uploaded
+    uint64_t batches = 0;        // flush() calls with pending updates
+    uint64_t fallbacks = 0;      // batches issued as individual updates
+    double cpuMs = 0.0;          // time spent in flush()
+};
+
+class UploadManager {
+ public:
+    UploadManager();
+    ~UploadManager();
+
+    HRESULT init(ID3D11Device* device, uint32_t ringBytes);
+    void release();
+
+    // With batching off every update is its own UpdateSubresource, for
+    // comparing against the batched path.
+    void setBatching(bool enabled) { batching_ = enabled; }
+
+    void enqueue(ID3D11Buffer* dest, uint32_t offset, const void* data,
+                 uint32_t bytes);
+    bool pending() const { return !plan_.empty(); }
+    void flush(ID3D11DeviceContext* context);
+
+    const UploadStats& stats() const { return stats_; }
+
+ private:
+    void flushIndividually(ID3D11DeviceContext* context);
+
+    ID3D11Buffer* pRing_;
+    StagingRing ring_;
+    bool batching_;
+
+    UploadPlan plan_;
+    UploadStats stats_;
+};
@@ -0,0 +1,83 @@
+#include "upload_plan.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+// Keeps every run 16-byte aligned in the ring, which constant buffer copies
+// need and which costs nothing for the others.
+uint32_t alignUp(uint32_t value) {
+    const uint32_t a = UploadPlan::kRunAlignment;
+    return (value + a - 1) & ~(a - 1);
+}
+
+} // namespace
+
+// -----------------------------------------------------------------------------
+void UploadPlan::add(ID3D11Buffer* dest, uint32_t offset, const void* data,
+                     uint32_t bytes) {
+    updates_.push_back({ dest, offset, bytes, data, 0 });
+}
+
+void UploadPlan::clear() {
+    updates_.clear();
+    runs_.clear();
+}
+
+uint32_t UploadPlan::build() {
+    runs_.clear();
+    if (updates_.empty()) return 0;
+
+    // Sort by destination, then offset, and merge into runs
+    order_.resize(updates_.size());
+    for (uint32_t i = 0; i < order_.size(); ++i) order_[i] = i;
+    std::sort(order_.begin(), order_.end(), [this](uint32_t a, uint32_t b) {
+        const UploadUpdate& ua = updates_[a];
+        const UploadUpdate& ub = updates_[b];
+        if (ua.dest != ub.dest) return ua.dest < ub.dest;
+        return ua.offset < ub.offset;
+    });
+
+    uint32_t stagingBytes = 0;
+    for (uint32_t index : order_) {
+        UploadUpdate& u = updates_[index];
+        uint32_t end = u.offset + u.bytes;
+        if (!runs_.empty() && runs_.back().dest == u.dest &&
+            u.offset <= runs_.back().end) {
+            UploadRun& run = runs_.back();
+            run.end = std::max(run.end, end);
+        } else {
+            if (!runs_.empty()) {
+                stagingBytes = alignUp(runs_.back().staging +
+                                       runs_.back().end - runs_.back().begin);
+            }
+            runs_.push_back({ u.dest, u.offset, end, stagingBytes });
+        }
+        u.staging = runs_.back().staging + u.offset - runs_.back().begin;
+    }
+    const UploadRun& last = runs_.back();
+    return last.staging + last.end - last.begin;
+}
+
+void UploadPlan::fill(uint8_t* staging) const {
+    // Submission order, so later writes to the same bytes win
+    for (const UploadUpdate& u : updates_) {
+        memcpy(staging + u.staging, u.data, u.bytes);
+    }
+}
+
+// -----------------------------------------------------------------------------
+void StagingRing::reset(uint32_t size) {
+    size_ = size;
+    head_ = size;
+}
+
+uint32_t StagingRing::place(uint32_t bytes, bool* discard) const {
+    *discard = head_ + bytes > size_;
+    return *discard ? 0 : head_;
+}
+
+void StagingRing::commit(uint32_t offset, uint32_t bytes) {
+    head_ = alignUp(offset + bytes);
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "gpu_handles.h"
+
+// -----------------------------------------------------------------------------
+// The API-free half of UploadManager: which copies a batch of buffer updates
+// becomes and where each payload goes in the staging ring. build() sorts the
+// queued ranges by destination and offset, merges touching or overlapping
+// ranges of one buffer into a run and gives every run a 16-byte aligned slice
+// of the staging area; fill() then writes the payloads in submission order,
+// so where updates overlap the last one queued wins, as it would have with
+// one UpdateSubresource each. Destinations are only compared, never called.
+struct UploadUpdate {
+    ID3D11Buffer* dest;
+    uint32_t offset;
+    uint32_t bytes;
+    const void* data;
+    uint32_t staging;            // offset in the staging area, set by build()
+};
+
+struct UploadRun {
+    ID3D11Buffer* dest;
+    uint32_t begin;
+    uint32_t end;
+    uint32_t staging;
+};
+
+class UploadPlan {
+ public:
+    static constexpr uint32_t kRunAlignment = 16;
+
+    void add(ID3D11Buffer* dest, uint32_t offset, const void* data,
+             uint32_t bytes);
+    bool empty() const { return updates_.empty(); }
+    void clear();
+
+    // Plans the runs and returns the staging bytes they need
+    uint32_t build();
+
+    // Copies every payload to `staging` + its staging offset
+    void fill(uint8_t* staging) const;
+
+    // In submission order
+    const std::vector<UploadUpdate>& updates() const { return updates_; }
+    const std::vector<UploadRun>& runs() const { return runs_; }
+
+ private:
+    std::vector<UploadUpdate> updates_;
+    std::vector<uint32_t> order_;
+    std::vector<UploadRun> runs_;
+};
+
+// -----------------------------------------------------------------------------
+// Placement in a linear staging ring that is discarded, not waited on, when
+// it wraps: a batch goes after the previous one if it fits and otherwise at
+// 0 in a fresh ring. place() only looks; commit() moves the head once the
+// batch was actually written, so a failed map leaves the ring as it was.
+class StagingRing {
+ public:
+    // Starts full, so the first batch discards
+    void reset(uint32_t size);
+    uint32_t size() const { return size_; }
+
+    // Offset for a batch of `bytes`, with `discard` set if it wraps.
+    // Batches larger than the ring do not fit at all.
+    bool fits(uint32_t bytes) const { return bytes <= size_; }
+    uint32_t place(uint32_t bytes, bool* discard) const;
+    void commit(uint32_t offset, uint32_t bytes);
+
+ private:
+    uint32_t size_ = 0;
+    uint32_t head_ = 0;
+};
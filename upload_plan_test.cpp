@@ -0,0 +1,251 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "test_check.h"
+#include "upload_plan.h"
+
+// -----------------------------------------------------------------------------
+// Tests for UploadPlan and StagingRing, the planning half of UploadManager:
+// adjacent and overlapping updates of one buffer merging into one run and
+// other buffers and gaps starting new ones; overlapping updates resolving in
+// submission order; random batches copied through the staging area leaving
+// every buffer as one direct write per update would, with runs 16-byte
+// aligned and disjoint in the staging area; and the ring placing batches
+// back to back, restarting at 0 with a discard when one does not fit and
+// staying put until a batch is committed. With --bench it plans and fills
+// batches of constant updates for that many objects and prints the time
+// per update.
+//
+//   UploadPlanTest [--bench <objects>]
+namespace {
+
+// Destinations are only compared, so any distinct pointers do
+ID3D11Buffer* fakeBuffer(uintptr_t id) {
+    return reinterpret_cast<ID3D11Buffer*>((id + 1) * 0x100);
+}
+
+// What the GPU copies do: each run from the staging area into its buffer
+void execute(const UploadPlan& plan, uint32_t stagingBytes,
+             std::vector<std::vector<uint8_t>>& buffers) {
+    std::vector<uint8_t> staging(stagingBytes);
+    plan.fill(staging.data());
+    for (const UploadRun& run : plan.runs()) {
+        size_t id = reinterpret_cast<uintptr_t>(run.dest) / 0x100 - 1;
+        memcpy(buffers[id].data() + run.begin, staging.data() + run.staging,
+               run.end - run.begin);
+    }
+}
+
+void testMerge() {
+    ID3D11Buffer* a = fakeBuffer(0);
+    ID3D11Buffer* b = fakeBuffer(1);
+    uint8_t payload[64] = {};
+    UploadPlan plan;
+    CHECK(plan.empty() && plan.build() == 0 && plan.runs().empty());
+
+    plan.add(a, 64, payload, 16);
+    plan.add(b, 0, payload, 8);
+    plan.add(a, 16, payload, 16);        // [16, 32)
+    plan.add(a, 32, payload, 8);         // touches it
+    plan.add(a, 48, payload, 24);        // overlaps [64, 80)
+    plan.add(a, 0, payload, 4);          // gap of 12 bytes before 16
+    uint32_t bytes = plan.build();
+
+    const std::vector<UploadRun>& runs = plan.runs();
+    CHECK(runs.size() == 4);
+    if (runs.size() == 4) {
+        // Sorted by destination, then offset
+        bool aFirst = a < b;
+        const UploadRun* ra = &runs[aFirst ? 0 : 1];
+        const UploadRun* rb = &runs[aFirst ? 3 : 0];
+        CHECK(ra[0].dest == a && ra[0].begin == 0 && ra[0].end == 4);
+        CHECK(ra[1].dest == a && ra[1].begin == 16 && ra[1].end == 40);
+        CHECK(ra[2].dest == a && ra[2].begin == 48 && ra[2].end == 80);
+        CHECK(rb->dest == b && rb->begin == 0 && rb->end == 8);
+        bool aligned = true;
+        for (const UploadRun& run : runs) aligned &= run.staging % 16 == 0;
+        CHECK(aligned);
+        CHECK(bytes == runs.back().staging + runs.back().end -
+                       runs.back().begin);
+    }
+
+    // Updates keep submission order and land inside their run
+    const std::vector<UploadUpdate>& updates = plan.updates();
+    CHECK(updates.size() == 6 && updates[0].offset == 64 &&
+          updates[5].offset == 0);
+    if (runs.size() == 4) {
+        const UploadRun& r = runs[a < b ? 2 : 3];
+        CHECK(updates[0].staging == r.staging + 16);
+        CHECK(updates[4].staging == r.staging);
+    }
+
+    plan.clear();
+    CHECK(plan.empty() && plan.runs().empty());
+}
+
+void testSubmissionOrder() {
+    std::vector<std::vector<uint8_t>> buffers(1, std::vector<uint8_t>(32));
+    std::vector<uint8_t> first(32, 'A');
+    std::vector<uint8_t> second(8, 'B');
+    std::vector<uint8_t> third(8, 'C');
+    UploadPlan plan;
+    plan.add(fakeBuffer(0), 0, first.data(), 32);
+    plan.add(fakeBuffer(0), 8, second.data(), 8);
+    plan.add(fakeBuffer(0), 4, third.data(), 8);
+    execute(plan, plan.build(), buffers);
+    CHECK(plan.runs().size() == 1);
+    CHECK(std::string(buffers[0].begin(), buffers[0].end()) ==
+          "AAAACCCCCCCCBBBBAAAAAAAAAAAAAAAA");
+
+    // The same ranges queued the other way round
+    plan.clear();
+    plan.add(fakeBuffer(0), 4, third.data(), 8);
+    plan.add(fakeBuffer(0), 8, second.data(), 8);
+    plan.add(fakeBuffer(0), 0, first.data(), 32);
+    execute(plan, plan.build(), buffers);
+    CHECK(std::string(buffers[0].begin(), buffers[0].end()) ==
+          std::string(32, 'A'));
+}
+
+void testAgainstDirectWrites() {
+    const uint32_t kBuffers = 4;
+    const uint32_t kBufferBytes = 512;
+    std::mt19937 rng(7);
+    std::vector<std::vector<uint8_t>> planned(
+        kBuffers, std::vector<uint8_t>(kBufferBytes));
+    std::vector<std::vector<uint8_t>> direct = planned;
+    std::vector<std::vector<uint8_t>> payloads;
+
+    bool same = true;
+    bool disjoint = true;
+    bool separate = true;
+    UploadPlan plan;
+    for (int batch = 0; batch < 200; ++batch) {
+        plan.clear();
+        payloads.clear();
+        uint32_t count = 1 + rng() % 40;
+        payloads.reserve(count);
+        for (uint32_t i = 0; i < count; ++i) {
+            uint32_t id = rng() % kBuffers;
+            uint32_t offset = rng() % kBufferBytes;
+            uint32_t bytes = 1 + rng() % std::min(64u, kBufferBytes - offset);
+            payloads.emplace_back(bytes);
+            for (uint8_t& byte : payloads.back()) {
+                byte = static_cast<uint8_t>(rng());
+            }
+            plan.add(fakeBuffer(id), offset, payloads.back().data(), bytes);
+            memcpy(direct[id].data() + offset, payloads.back().data(), bytes);
+        }
+        uint32_t stagingBytes = plan.build();
+        execute(plan, stagingBytes, planned);
+        same &= planned == direct;
+
+        const std::vector<UploadRun>& runs = plan.runs();
+        for (size_t r = 0; r < runs.size(); ++r) {
+            disjoint &= runs[r].staging % 16 == 0;
+            if (r > 0) {
+                disjoint &= runs[r].staging >= runs[r - 1].staging +
+                                               runs[r - 1].end -
+                                               runs[r - 1].begin;
+                // Touching ranges would have merged
+                separate &= runs[r].dest != runs[r - 1].dest ||
+                            runs[r].begin > runs[r - 1].end;
+            }
+        }
+        disjoint &= runs.back().staging + runs.back().end -
+                    runs.back().begin == stagingBytes;
+    }
+    CHECK(same);
+    CHECK(disjoint);
+    CHECK(separate);
+}
+
+void testRing() {
+    StagingRing ring;
+    ring.reset(1024);
+    CHECK(ring.size() == 1024);
+    CHECK(ring.fits(1024) && !ring.fits(1025));
+
+    // Starts full: the first batch discards
+    bool discard = false;
+    CHECK(ring.place(100, &discard) == 0 && discard);
+    ring.commit(0, 100);
+
+    // Back to back, 16-byte aligned; placing alone does not move the head
+    CHECK(ring.place(900, &discard) == 112 && !discard);
+    CHECK(ring.place(900, &discard) == 112 && !discard);
+    ring.commit(112, 900);
+
+    // No room left: restart at 0 in a fresh ring
+    CHECK(ring.place(1, &discard) == 0 && discard);
+    ring.commit(0, 1);
+    CHECK(ring.place(1008, &discard) == 16 && !discard);
+    CHECK(ring.place(1009, &discard) == 0 && discard);
+
+    // A batch that wrapped but was never written leaves the head alone
+    CHECK(ring.place(1009, &discard) == 0 && discard);
+    CHECK(ring.place(16, &discard) == 16 && !discard);
+
+    ring.reset(0);
+    CHECK(!ring.fits(1));
+}
+
+// -----------------------------------------------------------------------------
+void bench(uint32_t count) {
+    // Per-object constants: 256 buffers, 64 to 256 bytes at 256-byte slots,
+    // with one in four objects also writing a second block next to the first
+    std::mt19937 rng(3);
+    std::vector<uint8_t> payload(512, 1);
+    std::vector<uint8_t> staging;
+    UploadPlan plan;
+    const int batches = 200;
+    size_t runs = 0;
+    double planMs = 0.0;
+    for (int batch = 0; batch < batches; ++batch) {
+        plan.clear();
+        for (uint32_t i = 0; i < count; ++i) {
+            uint32_t slot = rng() % 16;
+            uint32_t bytes = 64 + 16 * (rng() % 13);
+            ID3D11Buffer* dest = fakeBuffer(rng() % 256);
+            plan.add(dest, slot * 256, payload.data(), bytes);
+            if (rng() % 4 == 0) {
+                plan.add(dest, slot * 256 + bytes, payload.data(), 64);
+            }
+        }
+        auto start = std::chrono::steady_clock::now();
+        uint32_t bytes = plan.build();
+        staging.resize(std::max<size_t>(staging.size(), bytes));
+        plan.fill(staging.data());
+        planMs += std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - start).count();
+        runs += plan.runs().size();
+    }
+    size_t updates = plan.updates().size();
+    std::cerr << count << " objects per batch, ~" << updates << " updates: "
+              << planMs * 1e6 / (double(updates) * batches)
+              << " ns per update to plan and fill, "
+              << double(runs) / batches << " copies per batch" << std::endl;
+}
+
+} // namespace
+
+// -----------------------------------------------------------------------------
+int main(int argc, char* argv[]) {
+    if (argc == 3 && strcmp(argv[1], "--bench") == 0) {
+        bench(static_cast<uint32_t>(std::max(1, atoi(argv[2]))));
+        return 0;
+    }
+
+    testMerge();
+    testSubmissionOrder();
+    testAgainstDirectWrites();
+    testRing();
+    return testResult("upload_plan");
+}
@@ -0,0 +1,168 @@
+#include "video_memory.h"
+
+#include <algorithm>
+#include <iostream>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <dxgi1_4.h>
+#endif
+
+// -----------------------------------------------------------------------------
+#ifdef _WIN32
+
+DxgiBudgetProvider::DxgiBudgetProvider(IDXGIAdapter3* adapter)
+    : pAdapter_(adapter),
+      hBudgetEvent_(nullptr),
+      cookie_(0) {
+    pAdapter_->AddRef();
+
+    hBudgetEvent_ = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+    DWORD cookie = 0;
+    if (hBudgetEvent_ == nullptr ||
+        FAILED(pAdapter_->RegisterVideoMemoryBudgetChangeNotificationEvent(
+            hBudgetEvent_, &cookie))) {
+        std::cerr << "Video memory budget notifications unavailable"
+                  << std::endl;
+    }
+    cookie_ = cookie;
+}
+
+DxgiBudgetProvider::~DxgiBudgetProvider() {
+    if (cookie_ != 0) {
+        pAdapter_->UnregisterVideoMemoryBudgetChangeNotification(cookie_);
+    }
+    if (hBudgetEvent_ != nullptr) {
+        CloseHandle(hBudgetEvent_);
+    }
+    pAdapter_->Release();
+}
+
+bool DxgiBudgetProvider::query(MemoryBudget& out) {
+    DXGI_QUERY_VIDEO_MEMORY_INFO info = {};
+    HRESULT hr = pAdapter_->QueryVideoMemoryInfo(
+        0, DXGI_MEMORY_SEGMENT_GROUP_LOCAL, &info);
+    if (FAILED(hr)) return false;
+
+    out.budgetBytes = info.Budget;
+    out.usageBytes = info.CurrentUsage;
+    return true;
+}
+
+bool DxgiBudgetProvider::budgetChanged() {
+    return hBudgetEvent_ != nullptr &&
+           WaitForSingleObject(hBudgetEvent_, 0) == WAIT_OBJECT_0;
+}
+
+#endif
+
+// -----------------------------------------------------------------------------
+ResidencyManager::ResidencyManager(BudgetProvider* provider)
+    : provider_(provider),
+      frame_(0) {
+}
+
+ResidencyManager::ResourceId ResidencyManager::track(
+        const char* name, uint64_t sizeBytes, ResidencyPriority priority,
+        ResidencyCallback callback) {
+    ResourceId id;
+    if (!freeIds_.empty()) {
+        id = freeIds_.back();
+        freeIds_.pop_back();
+    } else {
+        id = static_cast<ResourceId>(entries_.size());
+        entries_.emplace_back();
+    }
+
+    Entry& e = entries_[id];
+    e.name = name;
+    e.sizeBytes = sizeBytes;
+    e.lastUsedFrame = frame_;
+    e.priority = priority;
+    e.callback = std::move(callback);
+    e.resident = true;
+    e.live = true;
+
+    stats_.trackedBytes += sizeBytes;
+    stats_.residentBytes += sizeBytes;
+    return id;
+}
+
+void ResidencyManager::untrack(ResourceId id) {
+    Entry& e = entries_[id];
+    stats_.trackedBytes -= e.sizeBytes;
+    if (e.resident) stats_.residentBytes -= e.sizeBytes;
+
+    e = Entry();
+    freeIds_.push_back(id);
+}
+
+void ResidencyManager::resize(ResourceId id, uint64_t sizeBytes) {
+    Entry& e = entries_[id];
+    stats_.trackedBytes += sizeBytes - e.sizeBytes;
+    if (e.resident) stats_.residentBytes += sizeBytes - e.sizeBytes;
+    e.sizeBytes = sizeBytes;
+}
+
+void ResidencyManager::touch(ResourceId id) {
+    Entry& e = entries_[id];
+    e.lastUsedFrame = frame_;
+    if (e.resident) return;
+
+    e.resident = true;
+    stats_.residentBytes += e.sizeBytes;
+    ++stats_.restores;
+    if (e.callback) e.callback(true);
+}
+
+void ResidencyManager::update() {
+    ++frame_;
+
+    if (provider_->budgetChanged()) {
+        ++stats_.budgetChanges;
+    }
+
+    MemoryBudget budget;
+    if (!provider_->query(budget)) return;
+    stats_.budgetBytes = budget.budgetBytes;
+
+    // The OS figure includes memory we do not track (driver, other
+    // processes' shared allocations); use whichever is larger.
+    uint64_t usage = std::max(budget.usageBytes, stats_.residentBytes);
+    if (usage <= budget.budgetBytes) return;
+    ++stats_.overBudgetFrames;
+
+    uint64_t target = static_cast<uint64_t>(budget.budgetBytes *
+                                            kTargetFraction);
+    uint64_t untracked = usage - stats_.residentBytes;
+
+    // Lowest priority first, then least recently used. Resources used in
+    // the previous frame are kept: evicting them would only cause churn.
+    std::vector<ResourceId> candidates;
+    for (ResourceId id = 0; id < entries_.size(); ++id) {
+        const Entry& e = entries_[id];
+        if (e.live && e.resident && e.priority != kResidencyCritical &&
+            e.lastUsedFrame + 1 < frame_) {
+            candidates.push_back(id);
+        }
+    }
+    std::sort(candidates.begin(), candidates.end(),
+              [this](ResourceId a, ResourceId b) {
+        const Entry& ea = entries_[a];
+        const Entry& eb = entries_[b];
+        if (ea.priority != eb.priority) return ea.priority < eb.priority;
+        return ea.lastUsedFrame < eb.lastUsedFrame;
+    });
+
+    for (ResourceId id : candidates) {
+        if (untracked + stats_.residentBytes <= target) break;
+
+        Entry& e = entries_[id];
+        e.resident = false;
+        stats_.residentBytes -= e.sizeBytes;
+        stats_.evictedBytes += e.sizeBytes;
+        ++stats_.evictions;
+        if (e.callback) e.callback(false);
+    }
+}
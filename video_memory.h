@@ -0,0 +1,143 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+struct IDXGIAdapter3;
+typedef void* HANDLE;
+#endif
+
+// -----------------------------------------------------------------------------
+// Video memory accounting and a residency policy. Resources are registered
+// with their size and a priority; once per frame the manager compares the
+// tracked usage against the budget reported by a BudgetProvider and evicts
+// the least recently used, lowest priority resources until usage fits.
+// What "evict" means is up to the owner of the resource (lower the D3D11
+// eviction priority, release the GPU copy, ...); the manager only decides
+// which resources and when.
+struct MemoryBudget {
+    uint64_t budgetBytes = 0;
+    uint64_t usageBytes = 0;     // as reported by the OS, 0 if unknown
+};
+
+class BudgetProvider {
+ public:
+    virtual ~BudgetProvider() {}
+
+    virtual bool query(MemoryBudget& out) = 0;
+
+    // True once after the budget changed since the last call.
+    virtual bool budgetChanged() = 0;
+};
+
+// Budget set by hand, for exercising eviction without a GPU
+class SimulatedBudgetProvider : public BudgetProvider {
+ public:
+    explicit SimulatedBudgetProvider(uint64_t budgetBytes)
+        : budgetBytes_(budgetBytes), changed_(true) {
+    }
+
+    void setBudget(uint64_t budgetBytes) {
+        budgetBytes_ = budgetBytes;
+        changed_ = true;
+    }
+
+    bool query(MemoryBudget& out) override {
+        out.budgetBytes = budgetBytes_;
+        out.usageBytes = 0;
+        return true;
+    }
+
+    bool budgetChanged() override {
+        bool changed = changed_;
+        changed_ = false;
+        return changed;
+    }
+
+ private:
+    uint64_t budgetBytes_;
+    bool changed_;
+};
+
+#ifdef _WIN32
+// Local segment group budget from IDXGIAdapter3 (Windows 10+)
+class DxgiBudgetProvider : public BudgetProvider {
+ public:
+    explicit DxgiBudgetProvider(IDXGIAdapter3* adapter);
+    ~DxgiBudgetProvider() override;
+
+    bool query(MemoryBudget& out) override;
+    bool budgetChanged() override;
+
+ private:
+    IDXGIAdapter3* pAdapter_;
+    HANDLE hBudgetEvent_;
+    unsigned long cookie_;
+};
+#endif
+
+// -----------------------------------------------------------------------------
+enum ResidencyPriority {
+    kResidencyLow,
+    kResidencyNormal,
+    kResidencyHigh,
+    kResidencyCritical,          // never evicted (swap chain, per-frame data)
+};
+
+struct ResidencyStats {
+    uint64_t trackedBytes = 0;
+    uint64_t residentBytes = 0;
+    uint64_t budgetBytes = 0;
+    uint64_t evictions = 0;
+    uint64_t evictedBytes = 0;
+    uint64_t restores = 0;       // evicted resources used again (churn)
+    uint64_t budgetChanges = 0;
+    uint64_t overBudgetFrames = 0;
+};
+
+// Not thread safe: use from the thread that owns the device context.
+class ResidencyManager {
+ public:
+    typedef uint32_t ResourceId;
+    typedef std::function<void(bool resident)> ResidencyCallback;
+
+    // Fraction of the budget the manager evicts down to, leaving headroom
+    // for resources created before the next update().
+    static constexpr double kTargetFraction = 0.9;
+
+    explicit ResidencyManager(BudgetProvider* provider);
+
+    ResourceId track(const char* name, uint64_t sizeBytes,
+                     ResidencyPriority priority, ResidencyCallback callback);
+    void untrack(ResourceId id);
+    void resize(ResourceId id, uint64_t sizeBytes);
+
+    // Mark as used this frame; makes an evicted resource resident again.
+    void touch(ResourceId id);
+
+    // Once per frame: re-query the budget and evict if over it.
+    void update();
+
+    bool isResident(ResourceId id) const { return entries_[id].resident; }
+    const ResidencyStats& stats() const { return stats_; }
+
+ private:
+    struct Entry {
+        std::string name;
+        uint64_t sizeBytes = 0;
+        uint64_t lastUsedFrame = 0;
+        ResidencyPriority priority = kResidencyNormal;
+        ResidencyCallback callback;
+        bool resident = false;
+        bool live = false;
+    };
+
+    BudgetProvider* provider_;
+    std::vector<Entry> entries_;
+    std::vector<ResourceId> freeIds_;
+    uint64_t frame_;
+    ResidencyStats stats_;
+};
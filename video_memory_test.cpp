@@ -0,0 +1,246 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "test_check.h"
+#include "video_memory.h"
+
+// -----------------------------------------------------------------------------
+// Tests for ResidencyManager under a SimulatedBudgetProvider: eviction order
+// (priority, then least recently used) down to the target fraction, resources
+// used in the previous frame and critical ones kept, restores counted as
+// churn, and budget changes. With --bench it runs a moving working set over
+// a budget smaller than the tracked resources and prints evictions, restores
+// and the cost of update().
+//
+//   VideoMemoryTest [--bench <resources>]
+namespace {
+
+typedef ResidencyManager::ResourceId ResourceId;
+
+constexpr uint64_t kMB = 1 << 20;
+
+// Callbacks record the last state the manager asked for
+struct Tracked {
+    ResourceId id = 0;
+    int evictions = 0;
+    int restores = 0;
+};
+
+ResourceId track(ResidencyManager& manager, Tracked& tracked,
+                 uint64_t sizeBytes, ResidencyPriority priority) {
+    tracked.id = manager.track("test", sizeBytes, priority,
+                               [&tracked](bool resident) {
+        if (resident) ++tracked.restores;
+        else ++tracked.evictions;
+    });
+    return tracked.id;
+}
+
+void testUnderBudget() {
+    SimulatedBudgetProvider provider(100 * kMB);
+    ResidencyManager manager(&provider);
+    Tracked a;
+    Tracked b;
+    track(manager, a, 40 * kMB, kResidencyNormal);
+    track(manager, b, 40 * kMB, kResidencyLow);
+    for (int frame = 0; frame < 4; ++frame) manager.update();
+    CHECK(manager.stats().evictions == 0);
+    CHECK(manager.stats().overBudgetFrames == 0);
+    CHECK(manager.isResident(a.id) && manager.isResident(b.id));
+    CHECK(manager.stats().budgetBytes == 100 * kMB);
+}
+
+void testEvictionOrder() {
+    SimulatedBudgetProvider provider(70 * kMB);
+    ResidencyManager manager(&provider);
+    Tracked low;
+    Tracked older;
+    Tracked newer;
+    Tracked high;
+    track(manager, low, 30 * kMB, kResidencyLow);
+    track(manager, older, 30 * kMB, kResidencyNormal);
+    track(manager, newer, 30 * kMB, kResidencyNormal);
+    track(manager, high, 30 * kMB, kResidencyHigh);
+
+    // 120 MB tracked: over budget, but everything was used last frame
+    manager.update();
+    CHECK(manager.stats().overBudgetFrames == 1);
+    CHECK(manager.stats().evictions == 0);
+    manager.touch(newer.id);
+    manager.update();
+
+    // Down to 63 MB: the low priority resource first, then the normal one
+    // not used last frame; `newer` was, and `high` is not needed
+    CHECK(!manager.isResident(low.id) && low.evictions == 1);
+    CHECK(!manager.isResident(older.id) && older.evictions == 1);
+    CHECK(manager.isResident(newer.id) && newer.evictions == 0);
+    CHECK(manager.isResident(high.id) && high.evictions == 0);
+    CHECK(manager.stats().evictions == 2);
+    CHECK(manager.stats().evictedBytes == 60 * kMB);
+    CHECK(manager.stats().residentBytes == 60 * kMB);
+    CHECK(manager.stats().trackedBytes == 120 * kMB);
+}
+
+void testCriticalKept() {
+    SimulatedBudgetProvider provider(10 * kMB);
+    ResidencyManager manager(&provider);
+    Tracked critical;
+    Tracked normal;
+    track(manager, critical, 20 * kMB, kResidencyCritical);
+    track(manager, normal, 5 * kMB, kResidencyNormal);
+    for (int frame = 0; frame < 4; ++frame) manager.update();
+
+    // Still over budget, with nothing left that may be evicted
+    CHECK(manager.isResident(critical.id) && critical.evictions == 0);
+    CHECK(!manager.isResident(normal.id));
+    CHECK(manager.stats().overBudgetFrames == 4);
+}
+
+void testRestoreIsChurn() {
+    SimulatedBudgetProvider provider(50 * kMB);
+    ResidencyManager manager(&provider);
+    Tracked a;
+    Tracked b;
+    track(manager, a, 40 * kMB, kResidencyNormal);
+    track(manager, b, 40 * kMB, kResidencyNormal);
+    manager.update();
+    manager.touch(b.id);
+    manager.update();
+    manager.touch(b.id);
+    manager.update();
+    CHECK(!manager.isResident(a.id));
+
+    // Using the evicted resource makes it resident again at once
+    manager.touch(a.id);
+    CHECK(manager.isResident(a.id) && a.restores == 1);
+    CHECK(manager.stats().restores == 1);
+    CHECK(manager.stats().residentBytes == 80 * kMB);
+
+    // Touching a resident resource is not a restore
+    manager.touch(b.id);
+    CHECK(manager.stats().restores == 1 && b.restores == 0);
+}
+
+void testBudgetChange() {
+    SimulatedBudgetProvider provider(100 * kMB);
+    ResidencyManager manager(&provider);
+    Tracked a;
+    Tracked b;
+    track(manager, a, 40 * kMB, kResidencyNormal);
+    track(manager, b, 40 * kMB, kResidencyLow);
+    manager.update();
+    manager.update();
+    CHECK(manager.stats().budgetChanges == 1);     // the initial budget
+    CHECK(manager.stats().evictions == 0);
+
+    provider.setBudget(60 * kMB);
+    manager.update();
+    CHECK(manager.stats().budgetChanges == 2);
+    CHECK(manager.stats().budgetBytes == 60 * kMB);
+    CHECK(!manager.isResident(b.id) && manager.isResident(a.id));
+}
+
+void testUntrackAndResize() {
+    SimulatedBudgetProvider provider(100 * kMB);
+    ResidencyManager manager(&provider);
+    Tracked a;
+    Tracked b;
+    track(manager, a, 10 * kMB, kResidencyNormal);
+    track(manager, b, 20 * kMB, kResidencyNormal);
+    manager.resize(a.id, 15 * kMB);
+    CHECK(manager.stats().trackedBytes == 35 * kMB);
+    CHECK(manager.stats().residentBytes == 35 * kMB);
+
+    manager.untrack(a.id);
+    CHECK(manager.stats().trackedBytes == 20 * kMB);
+
+    // The id is reused
+    Tracked c;
+    CHECK(track(manager, c, 5 * kMB, kResidencyNormal) == a.id);
+    CHECK(manager.stats().residentBytes == 25 * kMB);
+}
+
+// -----------------------------------------------------------------------------
+double msSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+// Resources of 1 to 8 MB, a quarter at low and a quarter at high priority,
+// under a budget of half their total. Each frame touches a window of a
+// quarter of them that moves on by one resource, plus a few at random, as
+// a camera passing objects would; every run then shrinks the budget by
+// half and grows it back, as when another application claims memory.
+void bench(uint32_t resources) {
+    const uint32_t frames = 2000;
+    std::mt19937 rng(1);
+    std::vector<uint64_t> sizes(resources);
+    uint64_t total = 0;
+    for (uint64_t& size : sizes) {
+        size = (1 + rng() % 8) * kMB;
+        total += size;
+    }
+
+    SimulatedBudgetProvider provider(total / 2);
+    ResidencyManager manager(&provider);
+    std::vector<ResourceId> ids(resources);
+    for (uint32_t r = 0; r < resources; ++r) {
+        ResidencyPriority priority = r % 4 == 0 ? kResidencyLow
+                                   : r % 4 == 1 ? kResidencyHigh
+                                   : kResidencyNormal;
+        ids[r] = manager.track("bench", sizes[r], priority, nullptr);
+    }
+
+    uint32_t window = std::max(1u, resources / 4);
+    double updateMs = 0.0;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t frame = 0; frame < frames; ++frame) {
+        if (frame == frames / 2) provider.setBudget(total / 4);
+        if (frame == frames / 2 + 100) provider.setBudget(total / 2);
+
+        auto update = std::chrono::steady_clock::now();
+        manager.update();
+        updateMs += msSince(update);
+        for (uint32_t w = 0; w < window; ++w) {
+            manager.touch(ids[(frame + w) % resources]);
+        }
+        for (int r = 0; r < 4; ++r) manager.touch(ids[rng() % resources]);
+    }
+    double ms = msSince(start);
+
+    const ResidencyStats& s = manager.stats();
+    std::cerr << resources << " resources, " << (total >> 20)
+              << " MB tracked, budget " << (total / 2 >> 20) << " MB, "
+              << frames << " frames in " << ms << " ms" << std::endl;
+    std::cerr << "  " << s.evictions << " evictions ("
+              << (s.evictedBytes >> 20) << " MB), " << s.restores
+              << " restores, " << s.overBudgetFrames
+              << " frames over budget, " << s.budgetChanges
+              << " budget changes" << std::endl;
+    std::cerr << "  resident " << (s.residentBytes >> 20) << " MB; update "
+              << updateMs * 1000.0 / frames << " us per frame" << std::endl;
+}
+
+} // namespace
+
+// -----------------------------------------------------------------------------
+int main(int argc, char* argv[]) {
+    if (argc == 3 && strcmp(argv[1], "--bench") == 0) {
+        bench(static_cast<uint32_t>(std::max(1, atoi(argv[2]))));
+        return 0;
+    }
+
+    testUnderBudget();
+    testEvictionOrder();
+    testCriticalKept();
+    testRestoreIsChurn();
+    testBudgetChange();
+    testUntrackAndResize();
+    return testResult("video_memory");
+}